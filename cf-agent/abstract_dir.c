@@ -28,6 +28,7 @@
 #include <abstract_dir.h>
 #include <item_lib.h>
 #include <rlist.h>
+#include <stat_cache.h>                               /* StatCachePrefetch */
 
 struct AbstractDir_
 {
@@ -61,6 +62,11 @@ AbstractDir *AbstractDirOpen(const char *dirname, const FileCopy *fc, AgentConne
             return NULL;
         }
         d->listpos = d->list;
+
+        /* The copy engine stats every entry right after listing it, so
+         * pipeline the STAT exchanges now instead of paying one round trip
+         * per entry later. Results land in the connection's stat cache. */
+        StatCachePrefetch(conn, fc->encrypt, dirname, d->list);
     }
     return d;
 }
@@ -136,6 +136,78 @@ static bool CheckPosixLinuxDefaultACEs(EvalContext *ctx, Rlist *aces, AclMethod
     return retval;
 }
 
+#ifdef WITH_XATTR
+/* Raw-xattr fast path for ACL sweeps.
+ *
+ * Rebuilding libacl objects and comparing them entry by entry costs several
+ * syscalls and allocations per file, which dominates sweeps over large
+ * trees that are already compliant.  The kernel stores the whole ACL as a
+ * single system.posix_acl_access / _default extended attribute, so once a
+ * full verification has concluded that a file matches the promise, we
+ * remember that file's raw attribute bytes; every later file handled by the
+ * same promise whose attribute is byte-identical must match too and is
+ * passed with one getxattr() plus a memcmp().  Any difference (including a
+ * missing attribute or an oversized ACL) just falls through to the full
+ * libacl reconciliation, so mismatches can only cost, never lie.  Only the
+ * "overwrite" method is cacheable: with "append" the target ACL depends on
+ * each file's existing entries. */
+
+#define ACL_SIGNATURE_SIZE_MAX 512     /* fits 63 entries, more than ext4 allows */
+
+static struct
+{
+    const Rlist *aces;                 /* promise identity, NULL when empty */
+    acl_type_t acl_type;
+    ssize_t size;
+    char xattr[ACL_SIGNATURE_SIZE_MAX];
+} acl_signature_cache = { .aces = NULL }; /* GLOBAL_X */
+
+static const char *AclXattrName(acl_type_t acl_type)
+{
+    return (acl_type == ACL_TYPE_ACCESS) ?
+        "system.posix_acl_access" : "system.posix_acl_default";
+}
+
+/* Remember the raw ACL attribute of a file that was just found (or made)
+ * compliant, so that its siblings can be verified without libacl. */
+static void AclSignatureCacheSeed(const Rlist *aces, AclMethod method,
+                                  acl_type_t acl_type, const char *changes_path)
+{
+    if (aces == NULL || method != ACL_METHOD_OVERWRITE)
+    {
+        return;
+    }
+
+    ssize_t size = getxattr(changes_path, AclXattrName(acl_type),
+                            acl_signature_cache.xattr,
+                            sizeof(acl_signature_cache.xattr));
+    if (size > 0)
+    {
+        acl_signature_cache.aces = aces;
+        acl_signature_cache.acl_type = acl_type;
+        acl_signature_cache.size = size;
+    }
+}
+
+/* @return true if @a changes_path provably carries the promised ACL. */
+static bool AclSignatureCacheMatch(const Rlist *aces, AclMethod method,
+                                   acl_type_t acl_type, const char *changes_path)
+{
+    if (aces == NULL || method != ACL_METHOD_OVERWRITE ||
+        aces != acl_signature_cache.aces ||
+        acl_type != acl_signature_cache.acl_type)
+    {
+        return false;
+    }
+
+    char xattr[ACL_SIGNATURE_SIZE_MAX];
+    ssize_t size = getxattr(changes_path, AclXattrName(acl_type),
+                            xattr, sizeof(xattr));
+    return (size == acl_signature_cache.size &&
+            memcmp(xattr, acl_signature_cache.xattr, size) == 0);
+}
+#endif /* WITH_XATTR */
+
 /**
  * Takes as input CFEngine-syntax ACEs and a path to a file.  Checks if the
  * CFEngine-syntax ACL translates to the POSIX Linux ACL set on the given
@@ -171,6 +243,14 @@ static bool CheckPosixLinuxACEs(EvalContext *ctx, Rlist *aces, AclMethod method,
         changes_path = ToChangesChroot(file_path);
     }
 
+#ifdef WITH_XATTR
+    if (AclSignatureCacheMatch(aces, method, acl_type, changes_path))
+    {
+        RecordNoChange(ctx, pp, a, "'%s' ACL on '%s' needs no modification.", acl_type_str, file_path);
+        return true;
+    }
+#endif
+
 // read existing acl
 
     if ((acl_existing = acl_get_file(changes_path, acl_type)) == NULL)
@@ -417,11 +497,19 @@ static bool CheckPosixLinuxACEs(EvalContext *ctx, Rlist *aces, AclMethod method,
 
             RecordChange(ctx, pp, a, "%s ACL on '%s' successfully changed", acl_type_str, file_path);
             *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
+
+#ifdef WITH_XATTR
+            AclSignatureCacheSeed(aces, method, acl_type, changes_path);
+#endif
         }
     }
     else
     {
         RecordNoChange(ctx, pp, a, "'%s' ACL on '%s' needs no modification.", acl_type_str, file_path);
+
+#ifdef WITH_XATTR
+        AclSignatureCacheSeed(aces, method, acl_type, changes_path);
+#endif
     }
 
     acl_free(acl_existing);
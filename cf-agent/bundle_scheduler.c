@@ -0,0 +1,180 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <bundle_scheduler.h>
+
+#include <string_lib.h>                                    /* StringEqual */
+#include <logging.h>                                       /* Log */
+
+/* Promise types that only read state or touch the bundle-private scope, and
+ * therefore never cause two bundles to conflict with each other. Everything
+ * else (files, processes, packages, commands, ...) actuates shared system
+ * state and is treated conservatively. */
+static bool PromiseTypeIsSideEffectFree(const char *promise_type)
+{
+    return (StringEqual(promise_type, "vars") ||
+            StringEqual(promise_type, "defaults") ||
+            StringEqual(promise_type, "meta") ||
+            StringEqual(promise_type, "reports"));
+}
+
+/* methods promises pull in other bundles whose promise types we would have
+ * to resolve transitively; treat them as conflicting with everything. */
+static bool BundleIsOpaque(const Bundle *bp)
+{
+    for (size_t i = 0; i < SeqLength(bp->sections); i++)
+    {
+        const BundleSection *section = SeqAt(bp->sections, i);
+        if (StringEqual(section->promise_type, "methods"))
+        {
+            return true;
+        }
+    }
+
+    /* classes promises in a common bundle define global classes that any
+     * later bundle may be guarded by. */
+    if (StringEqual(bp->type, "common"))
+    {
+        for (size_t i = 0; i < SeqLength(bp->sections); i++)
+        {
+            const BundleSection *section = SeqAt(bp->sections, i);
+            if (StringEqual(section->promise_type, "classes"))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool BundlesConflict(const Bundle *a, const Bundle *b)
+{
+    assert(a != NULL);
+    assert(b != NULL);
+
+    if (BundleIsOpaque(a) || BundleIsOpaque(b))
+    {
+        return true;
+    }
+
+    for (size_t i = 0; i < SeqLength(a->sections); i++)
+    {
+        const BundleSection *sa = SeqAt(a->sections, i);
+        if (PromiseTypeIsSideEffectFree(sa->promise_type))
+        {
+            continue;
+        }
+
+        for (size_t j = 0; j < SeqLength(b->sections); j++)
+        {
+            const BundleSection *sb = SeqAt(b->sections, j);
+            if (StringEqual(sa->promise_type, sb->promise_type))
+            {
+                return true;
+            }
+        }
+    }
+
+    /* Custom promise sections are actuated by external modules whose
+     * footprint we cannot see; same-type sections always conflict. */
+    for (size_t i = 0; i < SeqLength(a->custom_sections); i++)
+    {
+        const BundleSection *sa = SeqAt(a->custom_sections, i);
+        for (size_t j = 0; j < SeqLength(b->custom_sections); j++)
+        {
+            const BundleSection *sb = SeqAt(b->custom_sections, j);
+            if (StringEqual(sa->promise_type, sb->promise_type))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+Seq *BundleSchedulePartition(const Seq *bundles)
+{
+    assert(bundles != NULL);
+
+    Seq *waves = SeqNew(SeqLength(bundles), SeqDestroy);
+    Seq *current = NULL;
+
+    for (size_t i = 0; i < SeqLength(bundles); i++)
+    {
+        const Bundle *bp = SeqAt((Seq *) bundles, i);
+
+        bool conflicts = false;
+        if (current != NULL)
+        {
+            for (size_t j = 0; !conflicts && j < SeqLength(current); j++)
+            {
+                conflicts = BundlesConflict(SeqAt(current, j), bp);
+            }
+        }
+
+        if (current == NULL || conflicts)
+        {
+            current = SeqNew(4, NULL);
+            SeqAppend(waves, current);
+        }
+        SeqAppend(current, (void *) bp);
+    }
+
+    return waves;
+}
+
+void BundleScheduleReport(const Seq *waves, size_t num_bundles)
+{
+    assert(waves != NULL);
+
+    const size_t num_waves = SeqLength(waves);
+    if (num_waves == 0 || num_bundles == 0)
+    {
+        return;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Bundle scheduler: %zu bundles partitioned into %zu conflict-free"
+        " waves (theoretical parallel speed-up %.1fx)",
+        num_bundles, num_waves, (double) num_bundles / (double) num_waves);
+
+    for (size_t i = 0; i < num_waves; i++)
+    {
+        const Seq *wave = SeqAt((Seq *) waves, i);
+        if (SeqLength(wave) > 1)
+        {
+            Writer *w = StringWriter();
+            for (size_t j = 0; j < SeqLength(wave); j++)
+            {
+                const Bundle *bp = SeqAt((Seq *) wave, j);
+                WriterWriteF(w, "%s%s", (j > 0) ? ", " : "", bp->name);
+            }
+            Log(LOG_LEVEL_VERBOSE, "Bundle scheduler: wave %zu: %s",
+                i + 1, StringWriterData(w));
+            WriterClose(w);
+        }
+    }
+}
@@ -0,0 +1,69 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_BUNDLE_SCHEDULER_H
+#define CFENGINE_BUNDLE_SCHEDULER_H
+
+#include <cf3.defs.h>
+#include <policy.h>
+#include <sequence.h>
+
+/**
+ * Dependency-aware scheduling of the agent bundlesequence.
+ *
+ * The scheduler partitions the resolved bundlesequence into "waves": groups
+ * of consecutive bundles that provably cannot conflict with each other, based
+ * on the promise types each bundle declares. Two bundles conflict when they
+ * both contain promises of a type that actuates system state, or when either
+ * of them calls methods (an opaque dependency on other bundles). Bundles
+ * within one wave are safe to evaluate in any order - and eventually
+ * concurrently, once EvalContext grows a thread-safe evaluation path.
+ *
+ * Until then the wave executor in cf-agent.c still evaluates bundles
+ * serially, but wave membership is computed and reported so that policy
+ * authors can see how much of their bundlesequence is parallelisable.
+ */
+
+/**
+ * @return true if evaluating @a a and @a b concurrently could produce a
+ *         different outcome than evaluating them in sequence.
+ */
+bool BundlesConflict(const Bundle *a, const Bundle *b);
+
+/**
+ * Partition an ordered Seq of (const Bundle *) into waves.
+ *
+ * @param bundles ordered bundlesequence entries, already resolved
+ * @return Seq of waves; each wave is a Seq of (const Bundle *) borrowed from
+ *         @a bundles. Free with SeqDestroy() (waves own no bundles).
+ */
+Seq *BundleSchedulePartition(const Seq *bundles);
+
+/**
+ * Log a verbose summary of the wave partition, including the maximum
+ * theoretical speed-up (number of bundles / number of waves).
+ */
+void BundleScheduleReport(const Seq *waves, size_t num_bundles);
+
+#endif
@@ -59,6 +59,8 @@
 #include <matching.h>
 #include <match_scope.h>
 #include <instrumentation.h>
+#include <mem_accounting.h>
+#include <files_timeout.h>
 #include <promises.h>
 #include <unix.h>
 #include <attributes.h>
@@ -70,6 +72,7 @@
 #include <fncall.h>
 #include <rlist.h>
 #include <agent-diagnostics.h>
+#include <bundle_scheduler.h>
 #include <known_dirs.h>
 #include <cf-agent-enterprise-stubs.h>
 #include <syslog_client.h>
@@ -80,6 +83,8 @@
 #include <buffer.h>
 #include <loading.h>
 #include <conn_cache.h>                 /* ConnCache_Init,ConnCache_Destroy */
+#include <override_fsattrs.h>           /* OverrideImmutableBatchBegin,End */
+#include <exec_broker.h>                /* ExecBrokerStart,ExecBrokerShutdown */
 #include <net.h>
 #include <package_module.h>
 #include <string_lib.h>
@@ -120,25 +125,13 @@ static int CFA_BACKGROUND_LIMIT = 1; /* GLOBAL_P */
 
 static Item *PROCESSREFRESH = NULL; /* GLOBAL_P */
 
-static const char *const AGENT_TYPESEQUENCE[] =
-{
-    "meta",
-    "vars",
-    "defaults",
-    "classes",                  /* Maelstrom order 2 */
-    "users",
-    "files",
-    "packages",
-    "guest_environments",
-    "methods",
-    "processes",
-    "services",
-    "commands",
-    "storage",
-    "databases",
-    "reports",
-    NULL
-};
+/* Wall-clock seconds one bundle may spend actuating promises, 0 meaning no
+ * budget; set by body agent control bundle_time_budget. */
+static time_t BUNDLE_TIME_BUDGET = 0; /* GLOBAL_P */
+
+/* The evaluation order of promise types ("Maelstrom order") is the
+ * TypeSequence order; the canonical name table lives in policy.c next to
+ * the parse-time TypeSequenceFromString() resolution. */
 
 /*******************************************************************/
 /* Agent specific variables                                        */
@@ -160,10 +153,12 @@ static void KeepPromiseBundles(EvalContext *ctx, const Policy *policy, GenericAg
 static void KeepPromises(EvalContext *ctx, const Policy *policy, GenericAgentConfig *config);
 static int NoteBundleCompliance(const Bundle *bundle, int save_pr_kept, int save_pr_repaired, int save_pr_notkept, struct timespec start);
 static void AllClassesReport(const EvalContext *ctx);
+static void MemoryReport(const EvalContext *ctx, const Policy *policy);
 static bool HasAvahiSupport(void);
 static int AutomaticBootstrap(GenericAgentConfig *config);
-static void BannerStatusEnd(PromiseResult status, const char *type, char *name);
-static void BannerStatusBegin(const char *type, char *name);
+static void BannerStatusEnd(PromiseResult status, TypeSequence type,
+                            const char *type_str, char *name);
+static void BannerStatusBegin(TypeSequence type, const char *type_str, char *name);
 static PromiseResult DefaultVarPromise(EvalContext *ctx, const Promise *pp);
 static void WaitForBackgroundProcesses();
 
@@ -215,6 +210,7 @@ static const struct option OPTIONS[] =
     {"log-modules", required_argument, 0, 0},
     {"no-augments", no_argument, 0, 0},
     {"no-host-specific-data", no_argument, 0, 0},
+    {"show-class-diff", no_argument, 0, 0 },
     {"show-evaluated-classes", optional_argument, 0, 0 },
     {"show-evaluated-vars", optional_argument, 0, 0 },
     {"skip-bootstrap-policy-run", no_argument, 0, 0 },
@@ -251,6 +247,7 @@ static const char *const HINTS[] =
     "Enable even more detailed debug logging for specific areas of the implementation. Use together with '-d'. Use --log-modules=help for a list of available modules",
     "Do not load augments (def.json)",
     "Do not load host-specific data (host_specific.json)",
+    "Show classes that appeared or disappeared since the previous agent run, prefixed with '+' or '-'",
     "Show *final* evaluated classes, including those defined in common bundles in policy. Optionally can take a regular expression.",
     "Show *final* evaluated variables, including those defined without dependency to user-defined classes in policy. Optionally can take a regular expression.",
     "Do not run policy as the last step of the bootstrap process",
@@ -292,6 +289,11 @@ int main(int argc, char *argv[])
 
     GenericAgentConfigApply(ctx, config);
 
+    /* Fork the executor broker now, while our image is still small --
+     * after policy load every fork() for a commands promise would copy
+     * the page tables of a much bigger process. */
+    ExecBrokerStart();
+
     const char *program_invocation_name = argv[0];
     const char *last_dir_sep = strrchr(program_invocation_name, FILE_SEPARATOR);
     const char *program_name = (last_dir_sep != NULL ? last_dir_sep + 1 : program_invocation_name);
@@ -325,16 +327,24 @@ int main(int argc, char *argv[])
 
     BeginAudit();
 
+    /* Queue remote syslog messages instead of resolving and sending each one
+     * inline, which would distort promise timing. */
+    RemoteSysLogAsyncEnable(true);
+
     EvalContextProfilingStart(ctx);
     KeepPromises(ctx, policy, config);
     EvalContextProfilingEnd(ctx);
 
+    /* Flush queued syslog messages now that evaluation is done. */
+    RemoteSysLogAsyncEnable(false);
+
     if (EvalAborted(ctx))
     {
         ret = EC_EVAL_ABORTED;
     }
 
     ConnCache_Destroy();
+    ExecBrokerShutdown();
 
     if (ALLCLASSESREPORT)
     {
@@ -357,6 +367,8 @@ int main(int argc, char *argv[])
 
     GenerateReports(config, ctx);
 
+    MemoryReport(ctx, policy);
+
     PurgeLocks();
     BackupLockDatabase();
 
@@ -372,6 +384,10 @@ int main(int argc, char *argv[])
         free(config->agent_specific.agent.show_evaluated_variables);
     }
 
+    /* Always persist the class set so the delta covers every run, not just
+     * the ones asking to see it. */
+    GenericAgentTrackClassDiff(ctx, config->agent_specific.agent.show_class_diff);
+
     PolicyDestroy(policy); /* Can we safely do this earlier ? */
     if (config->agent_specific.agent.bootstrap_argument &&
         !VerifyBootstrap(config->agent_specific.agent.skip_bootstrap_service_start))
@@ -432,6 +448,9 @@ int main(int argc, char *argv[])
         xmlCleanupParser();
 #endif
 
+    /* One batched write transaction instead of one per measured event. */
+    InstrumentationFlush();
+
     CallCleanupFunctions();
 
     return ret;
@@ -721,6 +740,10 @@ static GenericAgentConfig *CheckOpts(int argc, char **argv)
             {
                 config->agent_specific.common.no_host_specific = true;
             }
+            else if (StringEqual(option_name, "show-class-diff"))
+            {
+                config->agent_specific.agent.show_class_diff = true;
+            }
             else if (StringEqual(option_name, "show-evaluated-classes"))
             {
                 if (optarg == NULL)
@@ -1385,6 +1408,45 @@ static void KeepControlPromises(EvalContext *ctx, const Policy *policy, GenericA
                 }
                 continue;
             }
+
+            if (StringEqual(cp->lval, CFA_CONTROLBODY[AGENT_CONTROL_PROFILE].lval))
+            {
+                /* Only ever enables: 'profile => "false"' must not cancel
+                 * a --profile given on the command line. */
+                if (BooleanFromString(value))
+                {
+                    Log(LOG_LEVEL_VERBOSE, "Enabling run profiling (profile => \"true\")");
+                    EvalContextSetProfiling(ctx, true);
+                }
+                continue;
+            }
+
+            if (StringEqual(cp->lval, CFA_CONTROLBODY[AGENT_CONTROL_MEMORY_BUDGET].lval))
+            {
+                size_t budget = (size_t) IntFromString(value);
+                MemBudgetSet(budget);
+                Log(LOG_LEVEL_VERBOSE,
+                    "Setting memory_budget to %zu bytes", budget);
+                continue;
+            }
+
+            if (StringEqual(cp->lval, CFA_CONTROLBODY[AGENT_CONTROL_BUNDLE_TIME_BUDGET].lval))
+            {
+                BUNDLE_TIME_BUDGET = (time_t) IntFromString(value);
+                Log(LOG_LEVEL_VERBOSE,
+                    "Setting bundle_time_budget to %jd seconds",
+                    (intmax_t) BUNDLE_TIME_BUDGET);
+                continue;
+            }
+
+            if (StringEqual(cp->lval, CFA_CONTROLBODY[AGENT_CONTROL_FS_OPERATION_TIMEOUT].lval))
+            {
+                unsigned int timeout = (unsigned int) IntFromString(value);
+                FsTimeoutSet(timeout);
+                Log(LOG_LEVEL_VERBOSE,
+                    "Setting fs_operation_timeout to %u seconds", timeout);
+                continue;
+            }
         }
     }
 
@@ -1519,6 +1581,31 @@ static void KeepPromiseBundles(EvalContext *ctx, const Policy *policy, GenericAg
     Log(LOG_LEVEL_VERBOSE, "%s", StringWriterData(w));
     WriterClose(w);
 
+    /* Partition the bundlesequence into conflict-free waves and report the
+     * available parallelism (see bundle_scheduler.c). Evaluation below is
+     * still serial and in sequence order, which is always a valid schedule. */
+    {
+        Seq *scheduled = SeqNew(16, NULL);
+        for (const Rlist *rp = bundlesequence; rp; rp = rp->next)
+        {
+            const char *name = (rp->val.type == RVAL_TYPE_FNCALL)
+                ? RlistFnCallValue(rp)->name : RlistScalarValue(rp);
+            const Bundle *bp = EvalContextResolveBundleExpression(ctx, policy, name, "agent");
+            if (bp == NULL)
+            {
+                bp = EvalContextResolveBundleExpression(ctx, policy, name, "common");
+            }
+            if (bp != NULL)
+            {
+                SeqAppend(scheduled, (void *) bp);
+            }
+        }
+        Seq *waves = BundleSchedulePartition(scheduled);
+        BundleScheduleReport(waves, SeqLength(scheduled));
+        SeqDestroy(waves);
+        SeqDestroy(scheduled);
+    }
+
 /* If all is okay, go ahead and evaluate */
 
     for (const Rlist *rp = bundlesequence; rp; rp = rp->next)
@@ -1599,14 +1686,81 @@ static void AllClassesReport(const EvalContext *ctx)
     }
 }
 
+/**
+ * One verbose block at the end of the run: enough to see which subsystem
+ * grew when chasing out-of-memory kills on small devices, without any
+ * allocator instrumentation.
+ */
+static void MemoryReport(const EvalContext *ctx, const Policy *policy)
+{
+    if (!WouldLog(LOG_LEVEL_VERBOSE))
+    {
+        return;
+    }
+
+    size_t bundles = 0, promises = 0;
+    if (policy != NULL)
+    {
+        bundles = SeqLength(policy->bundles);
+        for (size_t i = 0; i < bundles; i++)
+        {
+            const Bundle *bp = SeqAt(policy->bundles, i);
+            promises += SeqLength(bp->all_promises);
+        }
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Memory report: resident %zu KiB, high water %zu KiB",
+        MemCurrentRSS() / 1024, MemHighWater() / 1024);
+    Log(LOG_LEVEL_VERBOSE,
+        "Memory report: policy tree %zu bundle(s), %zu promise(s);"
+        " %zu global variable(s); %zu cached function result(s)",
+        bundles, promises,
+        EvalContextGlobalVariablesCount(ctx),
+        EvalContextFunctionCacheEntries(ctx));
+    if (MemBudgetGet() > 0)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Memory report: budget %zu KiB, %zu cache eviction(s)",
+            MemBudgetGet() / 1024, MemBudgetEvictions());
+    }
+}
+
 PromiseResult ScheduleAgentOperations(EvalContext *ctx, const Bundle *bp)
 // NB - this function can be called recursively through "methods"
 {
+    /* Arm this bundle's wall-clock budget. A method bundle gets its own
+     * budget, but an outer bundle's sooner deadline still wins: using up
+     * the caller's remaining time inside a method is no better than using
+     * it up directly. */
+    const time_t outer_deadline = EvalContextGetBundleDeadline(ctx);
+    if (BUNDLE_TIME_BUDGET > 0)
+    {
+        const time_t deadline = time(NULL) + BUNDLE_TIME_BUDGET;
+        if (outer_deadline == 0 || deadline < outer_deadline)
+        {
+            EvalContextSetBundleDeadline(ctx, deadline);
+        }
+    }
+
+    /* Immutable bits cleared with fsattrs override are restored in one
+     * sweep when the bundle finishes; nested (methods) bundles join the
+     * outermost batch. */
+    OverrideImmutableBatchBegin();
+
+    PromiseResult result;
     if (EvalContextIsClassicOrder(ctx, bp))
     {
-        return ScheduleAgentOperationsNormalOrder(ctx, bp);
+        result = ScheduleAgentOperationsNormalOrder(ctx, bp);
     }
-    return ScheduleAgentOperationsTopDownOrder(ctx, bp);
+    else
+    {
+        result = ScheduleAgentOperationsTopDownOrder(ctx, bp);
+    }
+
+    OverrideImmutableBatchEnd();
+    EvalContextSetBundleDeadline(ctx, outer_deadline);
+    return result;
 }
 
 PromiseResult ScheduleAgentOperationsNormalOrder(EvalContext *ctx, const Bundle *bp)
@@ -1624,13 +1778,14 @@ PromiseResult ScheduleAgentOperationsNormalOrder(EvalContext *ctx, const Bundle
     }
 
     PromiseResult result = PROMISE_RESULT_SKIPPED;
+    size_t generation = EvalContextGetStateGeneration(ctx);
 
     for (int pass = 1; pass < CF_DONEPASSES; pass++)
     {
         // Evaluate built-in (non-custom) promise types, according to type sequence (normal order):
-        for (TypeSequence type = 0; AGENT_TYPESEQUENCE[type] != NULL; type++)
+        for (TypeSequence type = 0; TYPE_SEQUENCE_NAMES[type] != NULL; type++)
         {
-            const BundleSection *sp = BundleGetSection((Bundle *)bp, AGENT_TYPESEQUENCE[type]);
+            const BundleSection *sp = BundleGetSection((Bundle *)bp, TYPE_SEQUENCE_NAMES[type]);
 
             if (!sp || SeqLength(sp->promises) == 0)
             {
@@ -1646,6 +1801,17 @@ PromiseResult ScheduleAgentOperationsNormalOrder(EvalContext *ctx, const Bundle
             {
                 Promise *pp = SeqAt(sp->promises, ppi);
 
+                if (EvalContextBundleDeadlineExceeded(ctx))
+                {
+                    Log(LOG_LEVEL_NOTICE,
+                        "Bundle '%s' exceeded its time budget, "
+                        "skipping its remaining promises", bp->name);
+                    DeleteTypeContext(ctx, type);
+                    EvalContextStackPopFrame(ctx);
+                    NoteBundleCompliance(bp, save_pr_kept, save_pr_repaired, save_pr_notkept, start);
+                    return PromiseResultUpdate(result, PROMISE_RESULT_SKIPPED);
+                }
+
                 EvalContextSetPass(ctx, pass);
 
                 PromiseResult promise_result = ExpandPromise(ctx, pp, KeepAgentPromise, NULL);
@@ -1683,6 +1849,16 @@ PromiseResult ScheduleAgentOperationsNormalOrder(EvalContext *ctx, const Bundle
             {
                 Promise *pp = SeqAt(section->promises, ppi);
 
+                if (EvalContextBundleDeadlineExceeded(ctx))
+                {
+                    Log(LOG_LEVEL_NOTICE,
+                        "Bundle '%s' exceeded its time budget, "
+                        "skipping its remaining promises", bp->name);
+                    EvalContextStackPopFrame(ctx);
+                    NoteBundleCompliance(bp, save_pr_kept, save_pr_repaired, save_pr_notkept, start);
+                    return PromiseResultUpdate(result, PROMISE_RESULT_SKIPPED);
+                }
+
                 EvalContextSetPass(ctx, pass);
 
                 PromiseResult promise_result = ExpandPromise(ctx, pp, KeepAgentPromise, NULL);
@@ -1697,6 +1873,24 @@ PromiseResult ScheduleAgentOperationsNormalOrder(EvalContext *ctx, const Bundle
             }
             EvalContextStackPopFrame(ctx);
         }
+
+        /* If the pass defined no new classes or variables, re-running the
+         * middle passes would just reproduce it. Jump ahead to the final
+         * pass, which still has to run: several constructs (unresolved
+         * if/unless guards, custom promise validation) behave differently
+         * on the last pass. */
+        if (pass < CF_DONEPASSES - 2)
+        {
+            const size_t new_generation = EvalContextGetStateGeneration(ctx);
+            if (new_generation == generation)
+            {
+                Log(LOG_LEVEL_VERBOSE,
+                    "Bundle '%s' converged after pass %d, skipping to final pass",
+                    bp->name, pass);
+                pass = CF_DONEPASSES - 2;
+            }
+            generation = new_generation;
+        }
     }
 
     NoteBundleCompliance(bp, save_pr_kept, save_pr_repaired, save_pr_notkept, start);
@@ -1718,11 +1912,21 @@ PromiseResult ScheduleAgentOperationsTopDownOrder(EvalContext *ctx, const Bundle
     }
 
     PromiseResult result = PROMISE_RESULT_SKIPPED;
+    size_t generation = EvalContextGetStateGeneration(ctx);
     for (int pass = 1; pass < CF_DONEPASSES; pass++)
     {
         const char *last_promise_type = "";
         for (size_t ppi = 0; ppi < SeqLength(bp->all_promises); ppi++)
         {
+            if (EvalContextBundleDeadlineExceeded(ctx))
+            {
+                Log(LOG_LEVEL_NOTICE,
+                    "Bundle '%s' exceeded its time budget, "
+                    "skipping its remaining promises", bp->name);
+                NoteBundleCompliance(bp, save_pr_kept, save_pr_repaired, save_pr_notkept, start);
+                return PromiseResultUpdate(result, PROMISE_RESULT_SKIPPED);
+            }
+
             EvalContextSetPass(ctx, pass);
             Promise *pp = SeqAt(bp->all_promises, ppi);
             BundleSection *parent_section = pp->parent_section;
@@ -1745,6 +1949,22 @@ PromiseResult ScheduleAgentOperationsTopDownOrder(EvalContext *ctx, const Bundle
             }
             EvalContextStackPopFrame(ctx);
         }
+
+        /* See ScheduleAgentOperationsNormalOrder(): a pass that changed no
+         * state makes further middle passes pointless, but the final pass
+         * has distinct last-pass semantics and must still run. */
+        if (pass < CF_DONEPASSES - 2)
+        {
+            const size_t new_generation = EvalContextGetStateGeneration(ctx);
+            if (new_generation == generation)
+            {
+                Log(LOG_LEVEL_VERBOSE,
+                    "Bundle '%s' converged after pass %d, skipping to final pass",
+                    bp->name, pass);
+                pass = CF_DONEPASSES - 2;
+            }
+            generation = new_generation;
+        }
     }
 
     NoteBundleCompliance(bp, save_pr_kept, save_pr_repaired, save_pr_notkept, start);
@@ -1952,13 +2172,18 @@ static PromiseResult KeepAgentPromise(EvalContext *ctx, const Promise *pp, ARG_U
     assert(param == NULL);
     assert(pp != NULL);
 
-    BannerStatusBegin(PromiseGetPromiseType(pp), pp->promiser);
+    /* Dense type ID resolved at parse time (BundleAppendSection): dispatch
+     * compiles to a jump table instead of a strcmp chain per promise. */
+    const TypeSequence type = pp->parent_section->type_sequence;
+
+    BannerStatusBegin(type, PromiseGetPromiseType(pp), pp->promiser);
     struct timespec start = BeginMeasure();
     PromiseResult result = PROMISE_RESULT_NOOP;
 
-    if (strcmp("meta", PromiseGetPromiseType(pp)) == 0 ||
-        strcmp("vars", PromiseGetPromiseType(pp)) == 0)
+    switch (type)
     {
+    case TYPE_SEQUENCE_META:
+    case TYPE_SEQUENCE_VARS:
         Log(LOG_LEVEL_VERBOSE, "V:     Computing value of '%s'", pp->promiser);
 
         result = VerifyVarPromise(ctx, pp, NULL);
@@ -1969,17 +2194,17 @@ static PromiseResult KeepAgentPromise(EvalContext *ctx, const Promise *pp, ARG_U
                 LogVariableValue(ctx, pp);
             }
         }
-    }
-    else if (strcmp("defaults", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_DEFAULTS:
         result = DefaultVarPromise(ctx, pp);
-    }
-    else if (strcmp("classes", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_CONTEXTS:
         result = VerifyClassPromise(ctx, pp, NULL);
-    }
-    else if (strcmp("processes", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_PROCESSES:
         if (!LoadProcessTable())
         {
             Log(LOG_LEVEL_ERR, "Unable to read the process table - cannot keep processes: type promises");
@@ -1990,112 +2215,119 @@ static PromiseResult KeepAgentPromise(EvalContext *ctx, const Promise *pp, ARG_U
         {
             EndMeasurePromise(start, pp);
         }
-    }
-    else if (strcmp("storage", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_STORAGE:
         result = FindAndVerifyStoragePromises(ctx, pp);
         if (result != PROMISE_RESULT_SKIPPED)
         {
             EndMeasurePromise(start, pp);
         }
-    }
-    else if (strcmp("packages", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_PACKAGES:
         result = VerifyPackagesPromise(ctx, pp);
         if (result != PROMISE_RESULT_SKIPPED)
         {
             EndMeasurePromise(start, pp);
         }
-    }
-    else if (strcmp("users", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_USERS:
         result = VerifyUsersPromise(ctx, pp);
         if (result != PROMISE_RESULT_SKIPPED)
         {
             EndMeasurePromise(start, pp);
         }
-    }
+        break;
 
-    else if (strcmp("files", PromiseGetPromiseType(pp)) == 0)
-    {
+    case TYPE_SEQUENCE_FILES:
         result = ParallelFindAndVerifyFilesPromises(ctx, pp);
         if (result != PROMISE_RESULT_SKIPPED)
         {
             EndMeasurePromise(start, pp);
         }
-    }
-    else if (strcmp("commands", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_COMMANDS:
         result = VerifyExecPromise(ctx, pp);
         if (result != PROMISE_RESULT_SKIPPED)
         {
             EndMeasurePromise(start, pp);
         }
-    }
-    else if (strcmp("databases", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_DATABASES:
         result = VerifyDatabasePromises(ctx, pp);
         if (result != PROMISE_RESULT_SKIPPED)
         {
             EndMeasurePromise(start, pp);
         }
-    }
-    else if (strcmp("methods", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_METHODS:
         result = VerifyMethodsPromise(ctx, pp);
         if (result != PROMISE_RESULT_SKIPPED)
         {
             EndMeasurePromise(start, pp);
         }
-    }
-    else if (strcmp("services", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_SERVICES:
         result = VerifyServicesPromise(ctx, pp);
         if (result != PROMISE_RESULT_SKIPPED)
         {
             EndMeasurePromise(start, pp);
         }
-    }
-    else if (strcmp("guest_environments", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_ENVIRONMENTS:
         result = VerifyEnvironmentsPromise(ctx, pp);
         if (result != PROMISE_RESULT_SKIPPED)
         {
             EndMeasurePromise(start, pp);
         }
-    }
-    else if (strcmp("reports", PromiseGetPromiseType(pp)) == 0)
-    {
+        break;
+
+    case TYPE_SEQUENCE_REPORTS:
         result = VerifyReportPromise(ctx, pp);
-    }
-    else if (!IsBuiltInPromiseType(PromiseGetPromiseType(pp)))
-    {
-        result = EvaluateCustomPromise(ctx, pp);
-    }
-    else
-    {
-        result = PROMISE_RESULT_NOOP;
+        break;
+
+    case TYPE_SEQUENCE_NONE:
+    default:
+        if (!IsBuiltInPromiseType(PromiseGetPromiseType(pp)))
+        {
+            result = EvaluateCustomPromise(ctx, pp);
+        }
+        else
+        {
+            /* Built-in promise type of another component, nothing for the
+             * agent to do. */
+            result = PROMISE_RESULT_NOOP;
+        }
+        break;
     }
 
-    BannerStatusEnd(result, PromiseGetPromiseType(pp), pp->promiser);
+    BannerStatusEnd(result, type, PromiseGetPromiseType(pp), pp->promiser);
     EvalContextLogPromiseIterationOutcome(ctx, pp, result);
     return result;
 }
 
-static void BannerStatusBegin(const char *type, char *name)
+static void BannerStatusBegin(TypeSequence type, const char *type_str, char *name)
 {
-    if (StringEqual(type, "vars") || StringEqual(type, "classes"))
+    if ((type == TYPE_SEQUENCE_VARS) || (type == TYPE_SEQUENCE_CONTEXTS))
     {
         return;
     }
     Log(LOG_LEVEL_VERBOSE, "P: BEGIN %s promise (%.30s%s)",
-        type, name,
+        type_str, name,
         (strlen(name) > 30) ? "..." : "");
 }
 
-static void BannerStatusEnd(PromiseResult status, const char *type, char *name)
+static void BannerStatusEnd(PromiseResult status, TypeSequence type,
+                            const char *type_str, char *name)
 {
-    if ((strcmp(type, "vars") == 0) || (strcmp(type, "classes") == 0))
+    if ((type == TYPE_SEQUENCE_VARS) || (type == TYPE_SEQUENCE_CONTEXTS))
     {
         return;
     }
@@ -2129,7 +2361,7 @@ static void BannerStatusEnd(PromiseResult status, const char *type, char *name)
     }
 
     Log(LOG_LEVEL_VERBOSE, "P: END %s promise (%.30s%s)",
-        type, name,
+        type_str, name,
         (strlen(name) > 30) ? "..." : "");
 }
 
@@ -2157,6 +2389,7 @@ static void NewTypeContext(TypeSequence type)
 #ifndef __MINGW32__                   // TODO: Run if implemented on Windows
         if (SeqLength(GetGlobalMountedFSList()))
         {
+            InvalidateMountedFSIndex();
             DeleteMountInfo(GetGlobalMountedFSList());
             SeqClear(GetGlobalMountedFSList());
         }
@@ -24,6 +24,9 @@
 
 #include <cf_sql.h>
 
+#include <sequence.h>
+#include <cleanup.h>
+
 #ifdef HAVE_MYSQL_H
 # include <mysql.h>
 #elif defined(HAVE_MYSQL_MYSQL_H)
@@ -83,6 +86,14 @@ static void CfCloseMysqlDB(DbMysqlConn *c)
 
 /*****************************************************************************/
 
+/* Check that a pooled connection is still alive before reusing it. */
+static bool CfAliveMysqlDB(DbMysqlConn *c)
+{
+    return mysql_ping(&c->conn) == 0;
+}
+
+/*****************************************************************************/
+
 static void CfNewQueryMysqlDb(CfdbConn *cfdb, const char *query)
 {
     DbMysqlConn *mc = cfdb->data;
@@ -157,6 +168,11 @@ static void CfCloseMysqlDB(ARG_UNUSED void *c)
 {
 }
 
+static bool CfAliveMysqlDB(ARG_UNUSED void *c)
+{
+    return false;
+}
+
 static void CfNewQueryMysqlDb(ARG_UNUSED CfdbConn *cfdb, ARG_UNUSED const char *query)
 {
 }
@@ -238,6 +254,14 @@ static void CfClosePostgresqlDb(DbPostgresqlConn *c)
 
 /*****************************************************************************/
 
+/* Check that a pooled connection is still alive before reusing it. */
+static bool CfAlivePostgresqlDb(DbPostgresqlConn *c)
+{
+    return PQstatus(c->conn) == CONNECTION_OK;
+}
+
+/*****************************************************************************/
+
 static void CfNewQueryPostgresqlDb(CfdbConn *cfdb, const char *query)
 {
     DbPostgresqlConn *pc = cfdb->data;
@@ -303,6 +327,11 @@ static void CfClosePostgresqlDb(ARG_UNUSED void *c)
 {
 }
 
+static bool CfAlivePostgresqlDb(ARG_UNUSED void *c)
+{
+    return false;
+}
+
 static void CfNewQueryPostgresqlDb(ARG_UNUSED CfdbConn *cfdb, ARG_UNUSED const char *query)
 {
 }
@@ -319,11 +348,123 @@ static void CfDeletePostgresqlQuery(ARG_UNUSED CfdbConn *cfdb)
 
 /*****************************************************************************/
 
+/* Per-run connection pool.
+ *
+ * A grant-management policy easily has dozens of databases promises against
+ * the same server, and connection setup (TCP handshake plus authentication)
+ * dominates the verification queries themselves.  CfCloseDB() therefore
+ * parks the driver handle here instead of closing it, and CfConnectDB()
+ * revives a parked handle whenever the (type, host, user, database) key
+ * matches and the connection is still alive.  The pool is drained at process
+ * exit; databases promises are evaluated from a single thread, so no
+ * locking is needed. */
+
+typedef struct
+{
+    DatabaseType type;
+    char *host;
+    char *user;
+    char *db;
+    void *data;                 /* Parked RDBMS-specific handle */
+} CfdbPooledConn;
+
+static Seq *cfdb_pool = NULL; /* GLOBAL_X */
+
+static void CfdbPooledConnClose(CfdbPooledConn *entry)
+{
+    switch (entry->type)
+    {
+    case DATABASE_TYPE_MYSQL:
+        CfCloseMysqlDB(entry->data);
+        break;
+
+    case DATABASE_TYPE_POSTGRES:
+        CfClosePostgresqlDb(entry->data);
+        break;
+
+    default:
+        break;
+    }
+
+    free(entry->host);
+    free(entry->user);
+    free(entry->db);
+    free(entry);
+}
+
+static void CfdbPoolShutdown(void)
+{
+    if (cfdb_pool != NULL)
+    {
+        const size_t length = SeqLength(cfdb_pool);
+        for (size_t i = 0; i < length; i++)
+        {
+            CfdbPooledConnClose(SeqAt(cfdb_pool, i));
+        }
+        SeqDestroy(cfdb_pool);
+        cfdb_pool = NULL;
+    }
+}
+
+/* Takes ownership of @a host, @a user and @a db. */
+static void CfdbPoolPark(DatabaseType type, char *host, char *user, char *db,
+                         void *data)
+{
+    if (cfdb_pool == NULL)
+    {
+        cfdb_pool = SeqNew(8, NULL);
+        RegisterCleanupFunction(&CfdbPoolShutdown);
+    }
+
+    CfdbPooledConn *entry = xcalloc(1, sizeof(CfdbPooledConn));
+    entry->type = type;
+    entry->host = host;
+    entry->user = user;
+    entry->db = db;
+    entry->data = data;
+    SeqAppend(cfdb_pool, entry);
+}
+
+/* @return a parked driver handle for the key, or NULL if none is pooled. */
+static void *CfdbPoolTake(DatabaseType type, const char *host,
+                          const char *user, const char *db)
+{
+    if (cfdb_pool == NULL)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < SeqLength(cfdb_pool); i++)
+    {
+        CfdbPooledConn *entry = SeqAt(cfdb_pool, i);
+        if (entry->type == type &&
+            strcmp(entry->host, host) == 0 &&
+            strcmp(entry->user, user) == 0 &&
+            strcmp(entry->db, db) == 0)
+        {
+            void *data = entry->data;
+            SeqRemove(cfdb_pool, i);       /* NULL item destructor */
+            free(entry->host);
+            free(entry->user);
+            free(entry->db);
+            free(entry);
+            return data;
+        }
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************/
+
 void CfConnectDB(CfdbConn *cfdb, DatabaseType dbtype, char *remotehost, char *dbuser, char *passwd, char *db)
 {
 
     cfdb->connected = false;
     cfdb->type = dbtype;
+    cfdb->pool_host = NULL;
+    cfdb->pool_user = NULL;
+    cfdb->pool_db = NULL;
 
 /* If db == NULL, no database was specified, so we assume it has not been created yet. Need to
    open a generic database and create */
@@ -333,6 +474,44 @@ void CfConnectDB(CfdbConn *cfdb, DatabaseType dbtype, char *remotehost, char *db
         db = "no db specified";
     }
 
+    void *pooled = CfdbPoolTake(dbtype, remotehost, dbuser, db);
+    if (pooled != NULL)
+    {
+        bool alive = false;
+        switch (dbtype)
+        {
+        case DATABASE_TYPE_MYSQL:
+            alive = CfAliveMysqlDB(pooled);
+            break;
+
+        case DATABASE_TYPE_POSTGRES:
+            alive = CfAlivePostgresqlDb(pooled);
+            break;
+
+        default:
+            break;
+        }
+
+        if (alive)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Reusing pooled connection to SQL database '%s', user '%s', host '%s', type %d",
+                db, dbuser, remotehost, dbtype);
+            cfdb->data = pooled;
+            cfdb->connected = true;
+            cfdb->pool_host = xstrdup(remotehost);
+            cfdb->pool_user = xstrdup(dbuser);
+            cfdb->pool_db = xstrdup(db);
+            return;
+        }
+
+        /* The server hung up on the parked handle; close it and reconnect. */
+        CfdbPooledConn *dead = xcalloc(1, sizeof(CfdbPooledConn));
+        dead->type = dbtype;
+        dead->data = pooled;
+        CfdbPooledConnClose(dead);
+    }
+
     Log(LOG_LEVEL_VERBOSE, "Connect to SQL database '%s', user '%s', host '%s', type %d", db, dbuser, remotehost,
           dbtype);
 
@@ -352,7 +531,12 @@ void CfConnectDB(CfdbConn *cfdb, DatabaseType dbtype, char *remotehost, char *db
     }
 
     if (cfdb->data)
+    {
         cfdb->connected = true;
+        cfdb->pool_host = xstrdup(remotehost);
+        cfdb->pool_user = xstrdup(dbuser);
+        cfdb->pool_db = xstrdup(db);
+    }
 }
 
 /*****************************************************************************/
@@ -367,11 +551,15 @@ void CfCloseDB(CfdbConn *cfdb)
     switch (cfdb->type)
     {
     case DATABASE_TYPE_MYSQL:
-        CfCloseMysqlDB(cfdb->data);
-        break;
-
     case DATABASE_TYPE_POSTGRES:
-        CfClosePostgresqlDb(cfdb->data);
+        /* Park the live handle for the next promise against the same
+         * server; ownership of the key strings moves to the pool entry. */
+        CfdbPoolPark(cfdb->type, cfdb->pool_host, cfdb->pool_user,
+                     cfdb->pool_db, cfdb->data);
+        cfdb->pool_host = NULL;
+        cfdb->pool_user = NULL;
+        cfdb->pool_db = NULL;
+        cfdb->data = NULL;
         break;
 
     default:
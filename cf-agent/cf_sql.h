@@ -38,6 +38,11 @@ typedef struct
     char **rowdata;
     DatabaseType type;
     void *data;                 /* Generic pointer to RDBMS-specific data */
+    /* Connection-pool key, set by CfConnectDB() on success and consumed by
+     * CfCloseDB() when the handle is parked for reuse: */
+    char *pool_host;
+    char *pool_user;
+    char *pool_db;
 } CfdbConn;
 
 void CfConnectDB(CfdbConn *cfdb, DatabaseType dbtype, char *remotehost, char *dbuser, char *passwd, char *db);
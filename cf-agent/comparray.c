@@ -30,27 +30,101 @@
 
 #include <comparray.h>
 
+/* Linear probing with power-of-two sizing; grown at 75% load.  Occupied
+ * buckets are the ones with a non-NULL value. */
+
+#define COMPARRAY_INITIAL_BUCKETS 256
+
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+    char *value;
+} CompressedArrayBucket;
+
+struct CompressedArray_
+{
+    size_t num_buckets;         /* power of two */
+    size_t num_entries;
+    CompressedArrayBucket *buckets;
+};
+
 /*******************************************************************/
 
-bool FixCompressedArrayValue(int i, const char *value, CompressedArray **start)
+static size_t CompressedArrayHash(dev_t dev, ino_t ino)
 {
-    CompressedArray *ap;
+    /* Inode numbers are typically sequential, so scramble with a Fibonacci
+     * multiplier to spread neighbouring inodes across the table. */
+    uint64_t h = (uint64_t) ino ^ ((uint64_t) dev * UINT64_C(0x100000001B3));
+    return (size_t) (h * UINT64_C(0x9E3779B97F4A7C15));
+}
+
+/* @return the bucket holding (dev, ino), or the empty bucket where it
+ *         would be inserted. */
+static CompressedArrayBucket *CompressedArrayFind(const CompressedArray *array, dev_t dev, ino_t ino)
+{
+    const size_t mask = array->num_buckets - 1;
+    size_t i = CompressedArrayHash(dev, ino) & mask;
 
-    for (ap = *start; ap != NULL; ap = ap->next)
+    while (array->buckets[i].value != NULL &&
+           (array->buckets[i].dev != dev || array->buckets[i].ino != ino))
     {
-        if (ap->key == i)
+        i = (i + 1) & mask;
+    }
+
+    return &array->buckets[i];
+}
+
+static void CompressedArrayGrow(CompressedArray *array)
+{
+    const size_t old_num_buckets = array->num_buckets;
+    CompressedArrayBucket *old_buckets = array->buckets;
+
+    array->num_buckets *= 2;
+    array->buckets = xcalloc(array->num_buckets, sizeof(CompressedArrayBucket));
+
+    for (size_t i = 0; i < old_num_buckets; i++)
+    {
+        if (old_buckets[i].value != NULL)
         {
-            /* value already fixed */
-            return false;
+            *CompressedArrayFind(array, old_buckets[i].dev, old_buckets[i].ino) = old_buckets[i];
         }
     }
 
-    ap = xmalloc(sizeof(CompressedArray));
+    free(old_buckets);
+}
+
+/*******************************************************************/
+
+bool FixCompressedArrayValue(dev_t dev, ino_t ino, const char *value, CompressedArray **start)
+{
+    CompressedArray *array = *start;
+
+    if (array == NULL)
+    {
+        array = xcalloc(1, sizeof(CompressedArray));
+        array->num_buckets = COMPARRAY_INITIAL_BUCKETS;
+        array->buckets = xcalloc(array->num_buckets, sizeof(CompressedArrayBucket));
+        *start = array;
+    }
+
+    CompressedArrayBucket *bucket = CompressedArrayFind(array, dev, ino);
+    if (bucket->value != NULL)
+    {
+        /* value already fixed */
+        return false;
+    }
+
+    bucket->dev = dev;
+    bucket->ino = ino;
+    bucket->value = xstrdup(value);
+    array->num_entries++;
+
+    if (array->num_entries > array->num_buckets - array->num_buckets / 4)
+    {
+        CompressedArrayGrow(array);
+    }
 
-    ap->key = i;
-    ap->value = xstrdup(value);
-    ap->next = *start;
-    *start = ap;
     return true;
 }
 
@@ -60,48 +134,31 @@ void DeleteCompressedArray(CompressedArray *start)
 {
     if (start != NULL)
     {
-        DeleteCompressedArray(start->next);
-        start->next = NULL;
-
-        if (start->value != NULL)
+        for (size_t i = 0; i < start->num_buckets; i++)
         {
-            free(start->value);
+            free(start->buckets[i].value);
         }
 
+        free(start->buckets);
         free(start);
     }
 }
 
 /*******************************************************************/
 
-bool CompressedArrayElementExists(CompressedArray *start, int key)
+bool CompressedArrayElementExists(CompressedArray *start, dev_t dev, ino_t ino)
 {
-    CompressedArray *ap;
-
-    for (ap = start; ap != NULL; ap = ap->next)
-    {
-        if (ap->key == key)
-        {
-            return true;
-        }
-    }
-
-    return false;
+    return CompressedArrayValue(start, dev, ino) != NULL;
 }
 
 /*******************************************************************/
 
-char *CompressedArrayValue(CompressedArray *start, int key)
+char *CompressedArrayValue(CompressedArray *start, dev_t dev, ino_t ino)
 {
-    CompressedArray *ap;
-
-    for (ap = start; ap != NULL; ap = ap->next)
+    if (start == NULL)
     {
-        if (ap->key == key)
-        {
-            return ap->value;
-        }
+        return NULL;
     }
 
-    return NULL;
+    return CompressedArrayFind(start, dev, ino)->value;
 }
@@ -27,16 +27,18 @@
 
 #include <cf3.defs.h>
 
-typedef struct CompressedArray_
-{
-    int key;
-    char *value;
-    struct CompressedArray_ *next;
-} CompressedArray;
-
-bool FixCompressedArrayValue(int i, const char *value, CompressedArray **start);
+/**
+ * Map of hardlinked inodes seen during a copy, to the destination path the
+ * first link was copied to.  Implemented as an open-addressed hash table
+ * keyed by (device, inode) so that heavily hardlinked trees (backup
+ * snapshots) do not degrade to quadratic scans; a NULL pointer is the empty
+ * map and storage is allocated on first insert.
+ */
+typedef struct CompressedArray_ CompressedArray;
+
+bool FixCompressedArrayValue(dev_t dev, ino_t ino, const char *value, CompressedArray **start);
 void DeleteCompressedArray(CompressedArray *start);
-bool CompressedArrayElementExists(CompressedArray *start, int key);
-char *CompressedArrayValue(CompressedArray *start, int key);
+bool CompressedArrayElementExists(CompressedArray *start, dev_t dev, ino_t ino);
+char *CompressedArrayValue(CompressedArray *start, dev_t dev, ino_t ino);
 
 #endif
@@ -298,12 +298,24 @@ static bool MigrateOldStatDatabase(CF_DB *changes_db)
 
 static bool OpenChangesDB(CF_DB **db)
 {
+    /* The old-database migration only ever needs to happen once per host,
+     * but the check for it ran on every open: two heap-allocated paths and
+     * two stat() calls per monitored file add up over a large
+     * change-monitored tree. Check once per process instead. */
+    static bool migration_checked = false; /* GLOBAL_X */
+
     if (!OpenDB(db, dbid_changes))
     {
         Log(LOG_LEVEL_ERR, "Could not open changes database");
         return false;
     }
 
+    if (migration_checked)
+    {
+        return true;
+    }
+    migration_checked = true;
+
     struct stat statbuf;
     char *old_checksums_db = DBIdToPath(dbid_checksums);
     char *old_filestats_db = DBIdToPath(dbid_filestats);
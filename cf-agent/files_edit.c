@@ -178,6 +178,9 @@ end:
     {
         DeleteItemList(ec->file_start);
         free(ec->changes_filename);
+#ifdef HAVE_LIBXML2
+        free(ec->xpath_cache_expr);
+#endif
         free(ec);
     }
 }
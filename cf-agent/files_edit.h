@@ -50,6 +50,11 @@ typedef struct
     int pass;  // Current convergence pass (1 to CF_DONEPASSES-1)
 #ifdef HAVE_LIBXML2
     xmlDocPtr xmldoc;
+    /* Cache of the last successful select_xpath lookup.  Only valid while
+     * num_edits is unchanged, since any edit may move or free the node. */
+    char *xpath_cache_expr;
+    xmlNodePtr xpath_cache_node;
+    int xpath_cache_edits;
 #endif
     NewLineMode new_line_mode;
 } EditContext;
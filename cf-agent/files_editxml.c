@@ -1026,6 +1026,17 @@ static bool XmlSelectNode(EvalContext *ctx, char *rawxpath, xmlDocPtr doc, xmlNo
         return false;
     }
 
+    /* Several promises in one edit_xml bundle typically select the same node
+     * (e.g. a series of attribute edits), so reuse the last selection as
+     * long as no edit has been made since it was taken. */
+    if ((edcontext->xpath_cache_expr != NULL) &&
+        (edcontext->xpath_cache_edits == edcontext->num_edits) &&
+        (strcmp(edcontext->xpath_cache_expr, rawxpath) == 0))
+    {
+        *docnode = edcontext->xpath_cache_node;
+        return true;
+    }
+
     if ((xpathExpr = CharToXmlChar(rawxpath)) == NULL)
     {
         RecordFailure(ctx, pp, a, "Unable to create new XPath expression");
@@ -1092,6 +1103,14 @@ static bool XmlSelectNode(EvalContext *ctx, char *rawxpath, xmlDocPtr doc, xmlNo
     xmlXPathFreeContext(xpathCtx);
     xmlXPathFreeObject(xpathObj);
 
+    if (valid)
+    {
+        free(edcontext->xpath_cache_expr);
+        edcontext->xpath_cache_expr = xstrdup(rawxpath);
+        edcontext->xpath_cache_node = cur;
+        edcontext->xpath_cache_edits = edcontext->num_edits;
+    }
+
     return valid;
 }
 
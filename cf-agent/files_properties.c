@@ -46,7 +46,7 @@ static const char *const SKIPFILES[] =
 };
 
 /* TODO rework to accept only one param: path+nodename */
-static bool ConsiderFile(const char *nodename, const char *path, struct stat *stat)
+static bool ConsiderFile(const char *nodename, const char *path, const struct stat *stat)
 {
     int i;
 
@@ -108,6 +108,12 @@ bool ConsiderLocalFile(const char *filename, const char *directory)
     }
 }
 
+bool ConsiderLocalFileWithStat(const char *filename, const char *directory,
+                               const struct stat *stat)
+{
+    return ConsiderFile(filename, directory, stat);
+}
+
 bool ConsiderAbstractFile(const char *filename, const char *directory, const FileCopy *fc, AgentConnection *conn)
 {
     /* First check if the file should be avoided, e.g. ".." - before sending
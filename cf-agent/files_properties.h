@@ -36,6 +36,13 @@ void AddFilenameToListOfSuspicious(const char *filename);
  */
 bool ConsiderLocalFile(const char *filename, const char *path);
 
+/*
+ * As ConsiderLocalFile(), but reuses the lstat() result the caller already
+ * has instead of stat'ing the entry a second time (NULL if lstat() failed).
+ */
+bool ConsiderLocalFileWithStat(const char *filename, const char *path,
+                               const struct stat *stat);
+
 bool ConsiderAbstractFile(const char *nodename, const char *path, const FileCopy *fc, AgentConnection *conn);
 
 #endif
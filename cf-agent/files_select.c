@@ -29,6 +29,7 @@
 #include <files_interfaces.h>
 #include <promises.h>
 #include <match_scope.h>
+#include <matching.h>                       /* RegexListMatchAnyPrefilter */
 #include <string_lib.h>
 #include <files_lib.h>
 #include <pipes.h>
@@ -86,12 +87,19 @@ bool SelectLeaf(EvalContext *ctx, char *path, const struct stat *sb, const FileS
         StringSetAdd(leaf_attr, xstrdup("leaf_name"));
     }
 
-    for (rp = fs->name; rp != NULL; rp = rp->next)
+    /* One combined pass over each pattern list rejects the common no-match
+     * case; the per-pattern loops only run after a hit, preserving
+     * first-match attribution. */
+    if (fs->name != NULL &&
+        RegexListMatchAnyPrefilter(fs->name, ReadLastNode(path)))
     {
-        if (SelectNameRegexMatch(ctx, path, RlistScalarValue(rp)))
+        for (rp = fs->name; rp != NULL; rp = rp->next)
         {
-            StringSetAdd(leaf_attr, xstrdup("leaf_name"));
-            break;
+            if (SelectNameRegexMatch(ctx, path, RlistScalarValue(rp)))
+            {
+                StringSetAdd(leaf_attr, xstrdup("leaf_name"));
+                break;
+            }
         }
     }
 
@@ -100,12 +108,16 @@ bool SelectLeaf(EvalContext *ctx, char *path, const struct stat *sb, const FileS
         StringSetAdd(leaf_attr, xstrdup("leaf_path"));
     }
 
-    for (rp = fs->path; rp != NULL; rp = rp->next)
+    if (fs->path != NULL &&
+        RegexListMatchAnyPrefilter(fs->path, path))
     {
-        if (SelectPathRegexMatch(ctx, path, RlistScalarValue(rp)))
+        for (rp = fs->path; rp != NULL; rp = rp->next)
         {
-            StringSetAdd(leaf_attr, xstrdup("path_name"));
-            break;
+            if (SelectPathRegexMatch(ctx, path, RlistScalarValue(rp)))
+            {
+                StringSetAdd(leaf_attr, xstrdup("path_name"));
+                break;
+            }
         }
     }
 
@@ -41,6 +41,7 @@
 #include <rlist.h>
 #include <eval_context.h>
 #include <timeout.h>
+#include <map.h>
 
 /* seconds */
 #define RPCTIMEOUT 60
@@ -48,6 +49,17 @@
 static int FSTAB_EDITS = 0; /* GLOBAL_X */
 static Item *FSTABLIST = NULL; /* GLOBAL_X */
 
+/* Set of every whitespace-separated token in FSTABLIST, so that each
+ * mount promise checks the fstab in one hash lookup instead of
+ * re-tokenizing every line.  Rebuilt lazily after edits. */
+static Map *FSTAB_TOKENS = NULL; /* GLOBAL_X */
+
+static void InvalidateFstabTokens(void)
+{
+    MapDestroy(FSTAB_TOKENS);
+    FSTAB_TOKENS = NULL;
+}
+
 static void GetHostAndSource(const char *buf, char *host, char *source);
 
 static void AugmentMountInfo(Seq *list, char *host, char *source, char *mounton, char *options);
@@ -536,6 +548,7 @@ int VerifyInFstab(EvalContext *ctx, char *name, const Attributes *a, const Promi
     {
         AppendItem(&FSTABLIST, fstab, NULL);
         FSTAB_EDITS++;
+        InvalidateFstabTokens();
         cfPS(ctx, LOG_LEVEL_INFO, PROMISE_RESULT_CHANGE, pp, a, "Adding file system entry '%s' to '%s'", fstab,
              VFSTAB[VSYSTEMHARDCLASS]);
         *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
@@ -644,6 +657,7 @@ int VerifyNotInFstab(EvalContext *ctx, char *name, const Attributes *a, const Pr
                     // Check host name matches too?
                     DeleteThisItem(&FSTABLIST, ip);
                     FSTAB_EDITS++;
+                    InvalidateFstabTokens();
                     changes += 1;
                 }
             }
@@ -796,26 +810,29 @@ static bool MatchFSInFstab(char *match)
     const char delimit[]=" \t\r\n\v\f";
     char *fstab_line, *token;
 
-    for (ip = FSTABLIST; ip != NULL; ip = ip->next)
+    if (FSTAB_TOKENS == NULL)
     {
-        fstab_line = xstrdup(ip->name);
-        if(strncmp(fstab_line, "#", 1) != 0)
+        FSTAB_TOKENS = MapNew(StringHash_untyped, StringEqual_untyped,
+                              free, NULL);
+
+        for (ip = FSTABLIST; ip != NULL; ip = ip->next)
         {
-            token = strtok(fstab_line, delimit);
-            while (token != NULL)
+            if (strncmp(ip->name, "#", 1) == 0)
             {
-                if(strcmp(token, match) == 0)
-                {
-                    free(fstab_line);
-                    return true;
-                }
-                token = strtok(NULL, delimit);
+                continue;
+            }
+
+            fstab_line = xstrdup(ip->name);
+            for (token = strtok(fstab_line, delimit); token != NULL;
+                 token = strtok(NULL, delimit))
+            {
+                MapInsert(FSTAB_TOKENS, xstrdup(token), (void *) (uintptr_t) 1);
             }
+            free(fstab_line);
         }
-        free(fstab_line);
     }
 
-    return false;
+    return (MapGet(FSTAB_TOKENS, match) != NULL);
 }
 
 /*******************************************************************/
@@ -966,5 +983,6 @@ void CleanupNFS(void)
         DeleteItemList(FSTABLIST);
         FSTABLIST = NULL;
         FSTAB_EDITS = 0;
+        InvalidateFstabTokens();
     }
 }
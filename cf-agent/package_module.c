@@ -1604,6 +1604,74 @@ PromiseResult HandleAbsentPromiseAction(EvalContext *ctx,
 
 /* IMPORTANT: This must be called under protection of
  * GLOBAL_PACKAGE_PROMISE_LOCK_NAME lock! */
+/* Key in the packages_installed sub-database under which the state-file
+ * fingerprint for the cached list is recorded. */
+static const char *const STATE_FINGERPRINT_KEY = "<state_fingerprint>";
+
+/**
+ * Fingerprint (path, mtime and size of each file) of the package manager's
+ * own state files, as promised in query_installed_state_files.  While it
+ * matches the one recorded with the cached installed-package list, the list
+ * cannot have changed and the module query can be skipped.
+ */
+static char *PackageManagerStateFingerprint(const Rlist *state_files)
+{
+    Writer *w = StringWriter();
+
+    for (const Rlist *rp = state_files; rp != NULL; rp = rp->next)
+    {
+        const char *path = RlistScalarValue(rp);
+        struct stat sb;
+        if (stat(path, &sb) == 0)
+        {
+            WriterWriteF(w, "%s:%jd:%jd;", path,
+                         (intmax_t) sb.st_mtime, (intmax_t) sb.st_size);
+        }
+        else
+        {
+            WriterWriteF(w, "%s:missing;", path);
+        }
+    }
+    return StringWriterClose(w);
+}
+
+static bool StateFingerprintMatches(const char *pm_name, const char *fingerprint)
+{
+    CF_DB *db;
+    if (!OpenSubDB(&db, dbid_packages_installed, pm_name))
+    {
+        return false;
+    }
+
+    bool match = false;
+    char stored[CF_BUFSIZE];
+    if (ReadDB(db, STATE_FINGERPRINT_KEY, stored, sizeof(stored)))
+    {
+        stored[sizeof(stored) - 1] = '\0';
+        match = (strcmp(stored, fingerprint) == 0);
+    }
+    CloseDB(db);
+    return match;
+}
+
+static void StoreStateFingerprint(const char *pm_name, const char *fingerprint)
+{
+    CF_DB *db;
+    if (!OpenSubDB(&db, dbid_packages_installed, pm_name))
+    {
+        return;
+    }
+
+    if (!WriteDB(db, STATE_FINGERPRINT_KEY, fingerprint,
+                 strlen(fingerprint) + 1))
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Could not store package manager state fingerprint for '%s'",
+            pm_name);
+    }
+    CloseDB(db);
+}
+
 bool UpdateSinglePackageModuleCache(EvalContext *ctx,
                                     const PackageModuleWrapper *module_wrapper,
                                     UpdateType type, bool force_update)
@@ -1656,6 +1724,17 @@ bool UpdateSinglePackageModuleCache(EvalContext *ctx,
         ifelapsed_time = module_wrapper->package_module->updates_ifelapsed;
     }
 
+    /* Fingerprint of the package manager's own state files (when promised in
+     * query_installed_state_files): taken before the query so that a
+     * concurrent change is caught by a mismatch on the next run. */
+    char *state_fingerprint = NULL;
+    if (type == UPDATE_TYPE_INSTALLED &&
+        module_wrapper->package_module->installed_state_files != NULL)
+    {
+        state_fingerprint = PackageManagerStateFingerprint(
+                module_wrapper->package_module->installed_state_files);
+    }
+
     char *db_name = DBIdToSubPath(dbid_val, module_wrapper->name);
     struct stat statbuf;
     if (!force_update)
@@ -1680,6 +1759,18 @@ bool UpdateSinglePackageModuleCache(EvalContext *ctx,
             }
         }
 
+        if (!force_update && state_fingerprint != NULL &&
+            StateFingerprintMatches(module_wrapper->name, state_fingerprint))
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Skipping installed packages query for module '%s': "
+                "package manager state files unchanged",
+                module_wrapper->package_module->name);
+            free(db_name);
+            free(state_fingerprint);
+            return true;
+        }
+
         cache_updates_lock =
                 AcquireLock(ctx, cache_updates_lock_name, VUQNAME, CFSTARTTIME,
                             ifelapsed_time, VEXPIREAFTER, &pp, false);
@@ -1698,6 +1789,12 @@ bool UpdateSinglePackageModuleCache(EvalContext *ctx,
                 "Some error occurred while updating available updates cache.");
             ret = false;
         }
+        else if (state_fingerprint != NULL)
+        {
+            /* Record with the fresh list; UpdatePackagesDB() wiped the
+             * previous one together with the rest of the database. */
+            StoreStateFingerprint(module_wrapper->name, state_fingerprint);
+        }
         if (cache_updates_lock.lock != NULL)
         {
             YieldCurrentLock(cache_updates_lock);
@@ -1709,5 +1806,6 @@ bool UpdateSinglePackageModuleCache(EvalContext *ctx,
             type == UPDATE_TYPE_INSTALLED ?
                     "installed packages" : "available updates");
     }
+    free(state_fingerprint);
     return ret;
 }
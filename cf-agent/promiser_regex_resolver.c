@@ -42,6 +42,7 @@
 #include <scope.h>
 #include <item_lib.h>
 #include <string_lib.h>                                       /* PathAppend */
+#include <regex.h>              /* StringMatchFullWithPrecompiledRegex */
 
 PromiseResult LocateFilePromiserGroup(EvalContext *ctx, char *wildpath, const Promise *pp,
                                       PromiseResult (*fnptr) (EvalContext *ctx, char *path, const Promise *ptr))
@@ -150,7 +151,18 @@ PromiseResult LocateFilePromiserGroup(EvalContext *ctx, char *wildpath, const Pr
                     continue;
                 }
 
-                if (FullTextMatch(ctx, regex, dirp->d_name))
+                /* Matching entries here is a pure filter: any back
+                 * references are recomputed against the complete path
+                 * further down, so a capture-free match avoids
+                 * re-populating the match.* variables for every entry in
+                 * large directories. Literal names short-circuit the regex
+                 * entirely, as in FullTextMatch(). The cached regex is
+                 * re-fetched per entry because the recursion below may
+                 * flush the cache. */
+                Regex *rx = CompileRegexCached(regex);
+
+                if ((strcmp(regex, dirp->d_name) == 0) ||
+                    ((rx != NULL) && StringMatchFullWithPrecompiledRegex(rx, dirp->d_name)))
                 {
                     Log(LOG_LEVEL_DEBUG, "Link '%s' matched regex '%s'", dirp->d_name, regex);
                 }
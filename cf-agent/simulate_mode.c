@@ -41,6 +41,7 @@
 #include <map.h>                /* StringMap */
 #include <csv_parser.h>         /* GetCsvLineNext() */
 #include <unix.h>               /* GetGroupName(), GetUserName() */
+#include <hash.h>               /* HashString(), HashPrintSafe() */
 
 #include <simulate_mode.h>
 
@@ -418,6 +419,197 @@ static bool RunDiff(const char *path1, const char *path2)
     return !failure;
 }
 
+/* 'diff -u' loads both sides of the comparison into memory and compares
+ * them line by line, which makes audit runs over big data files slow and
+ * memory-hungry.  Files above CHUNKED_DIFF_FILE_SIZE_MIN are therefore
+ * compared with content-defined chunking instead: chunk boundaries come
+ * from a Gear rolling hash (the FastCDC family), every chunk is digested,
+ * and only the byte ranges whose chunks have no counterpart in the
+ * original are reported.  Because boundaries depend on the content alone,
+ * unchanged regions chunk identically even when they shift position, so
+ * an insertion does not cascade into false differences downstream. */
+
+#define CHUNKED_DIFF_FILE_SIZE_MIN (16 * 1024 * 1024)
+#define CDC_CHUNK_SIZE_MIN (16 * 1024)
+#define CDC_CHUNK_SIZE_MAX (256 * 1024)
+#define CDC_BOUNDARY_MASK 0xffff   /* boundary chance 1/65536 per byte, ~80 KiB average chunks */
+
+static uint64_t cdc_gear[256]; /* GLOBAL_X, see CdcInitGearTable() */
+
+static void CdcInitGearTable(void)
+{
+    static bool initialized = false; /* GLOBAL_X */
+    if (initialized)
+    {
+        return;
+    }
+
+    /* splitmix64 steps: any fixed seed works, the table just has to spread
+     * byte values over all 64 bits (and be the same for both files). */
+    uint64_t x = UINT64_C(0x2545F4914F6CDD1D);
+    for (size_t i = 0; i < 256; i++)
+    {
+        x += UINT64_C(0x9E3779B97F4A7C15);
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+        cdc_gear[i] = z ^ (z >> 31);
+    }
+    initialized = true;
+}
+
+/* Read one content-defined chunk into @a buf (CDC_CHUNK_SIZE_MAX bytes).
+ * @return the chunk length, 0 at EOF */
+static size_t CdcNextChunk(FILE *f, char *buf)
+{
+    uint64_t hash = 0;
+    size_t len = 0;
+    int c;
+
+    while ((len < CDC_CHUNK_SIZE_MAX) && ((c = getc(f)) != EOF))
+    {
+        buf[len++] = (char) c;
+        hash = (hash << 1) + cdc_gear[(unsigned char) c];
+        if ((len >= CDC_CHUNK_SIZE_MIN) && ((hash & CDC_BOUNDARY_MASK) == 0))
+        {
+            break;
+        }
+    }
+
+    return len;
+}
+
+static void ChunkDigest(const char *buf, size_t len, char digest_str[CF_HOSTKEY_STRING_SIZE])
+{
+    unsigned char digest[EVP_MAX_MD_SIZE + 1] = {0};
+    HashString(buf, len, digest, CF_DEFAULT_DIGEST);
+    HashPrintSafe(digest_str, CF_HOSTKEY_STRING_SIZE, digest, CF_DEFAULT_DIGEST, false);
+}
+
+static bool ChunkedDiff(const char *path1, const char *path2)
+{
+    CdcInitGearTable();
+
+    FILE *f = safe_fopen(path1, "rb");
+    if (f == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to open '%s' for reading: %s", path1, GetErrorStr());
+        return false;
+    }
+
+    char *buf = xmalloc(CDC_CHUNK_SIZE_MAX);
+    char digest_str[CF_HOSTKEY_STRING_SIZE];
+
+    /* Pass 1: digest the original's chunks. */
+    StringSet *orig_chunks = StringSetNew();
+    size_t n_orig_chunks = 0;
+    size_t len;
+    while ((len = CdcNextChunk(f, buf)) > 0)
+    {
+        ChunkDigest(buf, len, digest_str);
+        StringSetAdd(orig_chunks, xstrdup(digest_str));
+        n_orig_chunks++;
+    }
+    bool failure = !feof(f);
+    fclose(f);
+
+    /* Pass 2: walk the changed file and report runs of chunks that have no
+     * counterpart anywhere in the original. */
+    StringSet *new_chunks = StringSetNew();
+    bool header_printed = false;
+    if (!failure)
+    {
+        f = safe_fopen(path2, "rb");
+        if (f == NULL)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to open '%s' for reading: %s", path2, GetErrorStr());
+            failure = true;
+        }
+        else
+        {
+            uintmax_t offset = 0;
+            uintmax_t region_start = 0;
+            size_t region_chunks = 0;
+            while ((len = CdcNextChunk(f, buf)) > 0)
+            {
+                ChunkDigest(buf, len, digest_str);
+                StringSetAdd(new_chunks, xstrdup(digest_str));
+
+                if (StringSetContains(orig_chunks, digest_str))
+                {
+                    if (region_chunks > 0)
+                    {
+                        if (!header_printed)
+                        {
+                            printf("--- original %s\n+++ changed  %s\n", path1, path1);
+                            header_printed = true;
+                        }
+                        printf("@@ changed  bytes %ju-%ju (%zu content-defined chunks) @@\n",
+                               region_start, offset, region_chunks);
+                        region_chunks = 0;
+                    }
+                }
+                else
+                {
+                    if (region_chunks == 0)
+                    {
+                        region_start = offset;
+                    }
+                    region_chunks++;
+                }
+                offset += len;
+            }
+            failure = !feof(f);
+            fclose(f);
+
+            if (region_chunks > 0)
+            {
+                if (!header_printed)
+                {
+                    printf("--- original %s\n+++ changed  %s\n", path1, path1);
+                    header_printed = true;
+                }
+                printf("@@ changed  bytes %ju-%ju (%zu content-defined chunks) @@\n",
+                       region_start, offset, region_chunks);
+            }
+        }
+    }
+
+    if (!failure)
+    {
+        /* Content present in the original but not in the changed file. */
+        size_t n_missing = 0;
+        StringSetIterator it = StringSetIteratorInit(orig_chunks);
+        const char *chunk;
+        while ((chunk = StringSetIteratorNext(&it)) != NULL)
+        {
+            if (!StringSetContains(new_chunks, chunk))
+            {
+                n_missing++;
+            }
+        }
+
+        if (n_missing > 0)
+        {
+            if (!header_printed)
+            {
+                printf("--- original %s\n+++ changed  %s\n", path1, path1);
+            }
+            printf("@@ removed  %zu of %zu original content-defined chunks @@\n",
+                   n_missing, n_orig_chunks);
+        }
+    }
+    else
+    {
+        Log(LOG_LEVEL_ERR, "Failed to compare '%s' and '%s' by chunks", path1, path2);
+    }
+
+    StringSetDestroy(orig_chunks);
+    StringSetDestroy(new_chunks);
+    free(buf);
+    return !failure;
+}
+
 static bool DiffFile(const char *path)
 {
     const char *chrooted_path = ToChangesChroot(path);
@@ -454,6 +646,12 @@ static bool DiffFile(const char *path)
     {
         switch (st_chrooted.st_mode & S_IFMT) {
         case S_IFREG:
+            if ((st_orig.st_size >= CHUNKED_DIFF_FILE_SIZE_MIN) ||
+                (st_chrooted.st_size >= CHUNKED_DIFF_FILE_SIZE_MIN))
+            {
+                return ChunkedDiff(path, chrooted_path);
+            }
+            return RunDiff(path, chrooted_path);
         case S_IFDIR:
             return RunDiff(path, chrooted_path);
         default:
@@ -24,43 +24,139 @@
 
 #include <cf3.defs.h>
 
-#include <files_names.h>
 #include <vercmp_internal.h>
-#include <rlist.h>
+#include <sequence.h>
+#include <map.h>                                           /* TYPED_MAP_*  */
+#include <mutex.h>                                         /* ThreadLock   */
 
-static void ParsePackageVersion(char *version, Rlist **num, Rlist **sep);
+/* A version string split once into its comparable parts: alphanumeric runs
+ * and the single-character separators between them. */
+typedef struct
+{
+    Seq *tokens;                /* alphanumeric runs, major -> minor */
+    Seq *separators;            /* separator between token i and i+1 */
+} ParsedVersion;
 
-VersionCmpResult ComparePackageVersionsInternal(const char *v1, const char *v2, PackageVersionComparator cmp)
+static ParsedVersion *ParsedVersionNew(const char *version)
 {
-    Rlist *rp_pr, *rp_in;
+    ParsedVersion *parsed = xmalloc(sizeof(ParsedVersion));
+    parsed->tokens = SeqNew(8, free);
+    parsed->separators = SeqNew(8, free);
 
-    int result = true;
-    int break_loop = false;
-    int cmp_result;
-    VersionCmpResult version_matched = VERCMP_NO_MATCH;
+    const char *sp = version;
+    while (*sp != '\0')
+    {
+        const char *start = sp;
+        while (isalnum((unsigned char) *sp))
+        {
+            sp++;
+        }
+        SeqAppend(parsed->tokens, xstrndup(start, sp - start));
 
-    Rlist *numbers_pr = NULL, *separators_pr = NULL;
-    Rlist *numbers_in = NULL, *separators_in = NULL;
+        if (*sp == '\0')
+        {
+            break;
+        }
 
-    ParsePackageVersion(CanonifyChar(v1, ','), &numbers_pr, &separators_pr);
-    ParsePackageVersion(CanonifyChar(v2, ','), &numbers_in, &separators_in);
+        /* Commas would be misread as list separators when version strings
+         * travel through policy, so they have always been canonified to '_'
+         * before comparison. */
+        char separator[2] = { (*sp == ',') ? '_' : *sp, '\0' };
+        SeqAppend(parsed->separators, xstrdup(separator));
+        sp++;
+    }
 
-/* If the format of the version string doesn't match, we're already doomed */
+    return parsed;
+}
 
-    Log(LOG_LEVEL_VERBOSE, "Check for compatible versioning model in (%s,%s)", v1, v2);
+static void ParsedVersionDestroy(ParsedVersion *parsed)
+{
+    if (parsed != NULL)
+    {
+        SeqDestroy(parsed->tokens);
+        SeqDestroy(parsed->separators);
+        free(parsed);
+    }
+}
 
-    for (rp_pr = separators_pr, rp_in = separators_in; (rp_pr != NULL) && (rp_in != NULL);
-         rp_pr = rp_pr->next, rp_in = rp_in->next)
+static void ParsedVersionDestroy_untyped(void *parsed)
+{
+    ParsedVersionDestroy(parsed);
+}
+
+TYPED_MAP_DECLARE(VersionCache, char *, ParsedVersion *)
+
+TYPED_MAP_DEFINE(VersionCache, char *, ParsedVersion *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 ParsedVersionDestroy_untyped)
+
+/* Package convergence checks compare the same inventory versions over and
+ * over, so the cache pays for itself after the first pass.  The cap is sized
+ * for large inventories (two distinct strings per package is typical) and a
+ * flush simply means re-parsing on the next lookup. */
+#define VERSION_CACHE_SIZE_MAX 65536
+
+static VersionCacheMap *version_cache = NULL; /* GLOBAL_X */
+static size_t version_cache_entries = 0; /* GLOBAL_X */
+static pthread_mutex_t version_cache_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+/**
+ * Parse @param version once and memoize the result.  The returned structure
+ * is owned by the cache and stays valid until the next flush, which can only
+ * happen in a later lookup.
+ */
+static const ParsedVersion *ParsedVersionLookup(const char *version)
+{
+    ThreadLock(&version_cache_lock);
+
+    if (version_cache == NULL)
     {
-        if (strcmp(RlistScalarValue(rp_pr), RlistScalarValue(rp_in)) != 0)
+        version_cache = VersionCacheMapNew();
+    }
+
+    ParsedVersion *parsed = VersionCacheMapGet(version_cache, version);
+    if (parsed == NULL)
+    {
+        parsed = ParsedVersionNew(version);
+        if (version_cache_entries >= VERSION_CACHE_SIZE_MAX)
         {
-            result = false;
-            break;
+            Log(LOG_LEVEL_DEBUG,
+                "Version cache full (%zu strings), flushing",
+                version_cache_entries);
+            VersionCacheMapDestroy(version_cache);
+            version_cache = VersionCacheMapNew();
+            version_cache_entries = 0;
         }
+        VersionCacheMapInsert(version_cache, xstrdup(version), parsed);
+        version_cache_entries++;
+    }
+
+    ThreadUnlock(&version_cache_lock);
+    return parsed;
+}
+
+VersionCmpResult ComparePackageVersionsInternal(const char *v1, const char *v2, PackageVersionComparator cmp)
+{
+    bool result = true;
+    bool break_loop = false;
+    VersionCmpResult version_matched = VERCMP_NO_MATCH;
 
-        if ((rp_pr->next == NULL) && (rp_in->next == NULL))
+    const ParsedVersion *pv_pr = ParsedVersionLookup(v1);
+    const ParsedVersion *pv_in = ParsedVersionLookup(v2);
+
+/* If the format of the version string doesn't match, we're already doomed */
+
+    Log(LOG_LEVEL_VERBOSE, "Check for compatible versioning model in (%s,%s)", v1, v2);
+
+    const size_t seps_pr = SeqLength(pv_pr->separators);
+    const size_t seps_in = SeqLength(pv_in->separators);
+    for (size_t i = 0; (i < seps_pr) && (i < seps_in); i++)
+    {
+        if (strcmp(SeqAt(pv_pr->separators, i), SeqAt(pv_in->separators, i)) != 0)
         {
-            result = true;
+            result = false;
             break;
         }
     }
@@ -75,14 +171,16 @@ VersionCmpResult ComparePackageVersionsInternal(const char *v1, const char *v2,
         version_matched = VERCMP_ERROR;
     }
 
-    int version_equal = (strcmp(v2, v1) == 0);
+    const bool version_equal = (strcmp(v2, v1) == 0);
 
     if (result)
     {
-        for (rp_pr = numbers_pr, rp_in = numbers_in; (rp_pr != NULL) && (rp_in != NULL);
-             rp_pr = rp_pr->next, rp_in = rp_in->next)
+        const size_t nums_pr = SeqLength(pv_pr->tokens);
+        const size_t nums_in = SeqLength(pv_in->tokens);
+        size_t i;
+        for (i = 0; (i < nums_pr) && (i < nums_in); i++)
         {
-            cmp_result = strcmp(RlistScalarValue(rp_pr), RlistScalarValue(rp_in));
+            int cmp_result = strcmp(SeqAt(pv_pr->tokens, i), SeqAt(pv_in->tokens, i));
 
             switch (cmp)
             {
@@ -145,65 +243,30 @@ VersionCmpResult ComparePackageVersionsInternal(const char *v1, const char *v2,
 
             if ((version_matched == VERCMP_MATCH) || break_loop)
             {
-                rp_pr = NULL;
-                rp_in = NULL;
                 break;
             }
         }
 
-        if (rp_pr != NULL)
+        /* One version has more components than the other and no decision was
+         * made on the shared prefix: the longer one is the greater. */
+        if ((version_matched != VERCMP_MATCH) && !break_loop)
         {
-            if ((cmp == PACKAGE_VERSION_COMPARATOR_GT) || (cmp == PACKAGE_VERSION_COMPARATOR_GE))
+            if (i < nums_pr)
             {
-                version_matched = VERCMP_MATCH;
+                if ((cmp == PACKAGE_VERSION_COMPARATOR_GT) || (cmp == PACKAGE_VERSION_COMPARATOR_GE))
+                {
+                    version_matched = VERCMP_MATCH;
+                }
             }
-        }
-        if (rp_in != NULL)
-        {
-            if ((cmp == PACKAGE_VERSION_COMPARATOR_LT) || (cmp == PACKAGE_VERSION_COMPARATOR_LE))
+            if (i < nums_in)
             {
-                version_matched = VERCMP_MATCH;
+                if ((cmp == PACKAGE_VERSION_COMPARATOR_LT) || (cmp == PACKAGE_VERSION_COMPARATOR_LE))
+                {
+                    version_matched = VERCMP_MATCH;
+                }
             }
         }
     }
 
-    RlistDestroy(numbers_pr);
-    RlistDestroy(numbers_in);
-    RlistDestroy(separators_pr);
-    RlistDestroy(separators_in);
-
     return version_matched;
 }
-
-static void ParsePackageVersion(char *version, Rlist **num, Rlist **sep)
-{
-    char *sp, numeral[30], separator[2];
-
-    if (version == NULL)
-    {
-        return;
-    }
-
-    for (sp = version; *sp != '\0'; sp++)
-    {
-        memset(numeral, 0, 30);
-        memset(separator, 0, 2);
-
-        /* Split in 2's complement */
-
-        sscanf(sp, "%29[0-9a-zA-Z]", numeral);
-        sp += strlen(numeral);
-
-        /* Append to end up with left->right (major->minor) comparison */
-
-        RlistAppendScalar(num, numeral);
-
-        if (*sp == '\0')
-        {
-            return;
-        }
-
-        sscanf(sp, "%1[^0-9a-zA-Z]", separator);
-        RlistAppendScalar(sep, separator);
-    }
-}
@@ -59,6 +59,7 @@
 #include <known_dirs.h>
 #include <evalfunction.h>
 #include <changes_chroot.h>     /* PrepareChangesChroot(), RecordFileChangedInChroot() */
+#include <tree_watch.h>
 #include <cf3.defs.h>
 #include <fsattrs.h>
 #include <override_fsattrs.h>
@@ -66,6 +67,10 @@
 #include <stddef.h>
 #include <string.h>
 
+/* Even a monitored tree (body depth_search monitor) gets a periodic
+ * full scan this often, in case the watcher missed events. */
+#define FILE_TREE_MONITOR_MAX_SCAN_AGE (6 * 3600)
+
 static PromiseResult FindFilePromiserObjects(EvalContext *ctx, const Promise *pp);
 static PromiseResult VerifyFilePromise(EvalContext *ctx, char *path, const Promise *pp);
 static PromiseResult WriteContentFromString(EvalContext *ctx, const char *path, const Attributes *attr,
@@ -276,7 +281,9 @@ void ClearExpandedAttributes(Attributes *a)
     FREE_AND_NULL(a->edit_template);
     FREE_AND_NULL(a->edit_template_string);
 
-    ClearFilesAttributes(a);
+    /* The members shared with the unexpanded skeleton (uid/gid lists) are
+     * NOT freed here: the skeleton outlives each expansion and is released
+     * once with ClearFilesAttributes(). */
 }
 
 static inline bool CreateFalseWasSpecified(const Promise *pp)
@@ -460,6 +467,7 @@ static PromiseResult VerifyFilePromise(EvalContext *ctx, char *path, const Promi
         ChopLastNode(basedir);
         if (safe_chdir(ToChangesPath(basedir)) != 0)
         {
+            SetLeafActuationDir(NULL);
             /* TODO: PROMISE_RESULT_FAIL?!?!?!?! */
             char msg[sizeof(basedir) + 36 + 100]; // 36 for fmt string 100 for error string
             snprintf(msg, sizeof(msg), "Failed to chdir into '%s'. (chdir: '%s')",
@@ -478,6 +486,10 @@ static PromiseResult VerifyFilePromise(EvalContext *ctx, char *path, const Promi
                 Log(LOG_LEVEL_ERR, "%s", msg);
             }
         }
+        else
+        {
+            SetLeafActuationDir(ToChangesPath(basedir));
+        }
     }
 
     /* If file or directory exists but it is not selected by body file_select
@@ -552,7 +564,29 @@ static PromiseResult VerifyFilePromise(EvalContext *ctx, char *path, const Promi
     {
         lstat(changes_path, &oslb);     /* if doesn't exist have to stat again anyway */
 
-        DepthSearch(ctx, path, &oslb, 0, &a, pp, oslb.st_dev, &result);
+        /* With body depth_search monitor, the resident watcher
+         * (cf-execd) may let us skip the recursive scan entirely. Not
+         * usable when changes are simulated in a chroot: the watcher
+         * sees the real tree, not the chroot copy. */
+        const bool monitored = (a.havedepthsearch && a.recursion.monitor &&
+                                !ChrootChanges());
+        const time_t scan_start = time(NULL);
+        if (monitored)
+        {
+            TreeWatchRegister(path);
+        }
+
+        if (monitored && TreeWatchTreeIsClean(path, FILE_TREE_MONITOR_MAX_SCAN_AGE))
+        {
+            RecordNoChange(ctx, pp, &a,
+                           "Tree '%s' is unchanged since the last full scan, "
+                           "skipping depth search", path);
+        }
+        else if (DepthSearch(ctx, path, &oslb, 0, &a, &attr, pp, oslb.st_dev, &result) &&
+                 monitored)
+        {
+            TreeWatchMarkScanned(path, scan_start);
+        }
 
         /* normally searches do not include the base directory */
 
@@ -563,7 +597,7 @@ static PromiseResult VerifyFilePromise(EvalContext *ctx, char *path, const Promi
             /* Handle this node specially */
 
             a.havedepthsearch = false;
-            DepthSearch(ctx, path, &oslb, 0, &a, pp, oslb.st_dev, &result);
+            DepthSearch(ctx, path, &oslb, 0, &a, &attr, pp, oslb.st_dev, &result);
             a.havedepthsearch = save_search;
         }
         else
@@ -721,7 +755,7 @@ static PromiseResult VerifyFilePromise(EvalContext *ctx, char *path, const Promi
     if (exists && (S_ISREG(osb.st_mode) || S_ISLNK(osb.st_mode))
         && (!a.haveselect || SelectLeaf(ctx, path, &osb, &(a.select))))
     {
-        VerifyFileLeaf(ctx, path, &osb, &a, pp, &result);
+        VerifyFileLeaf(ctx, path, &osb, &attr, pp, &result);
     }
 
     if (!exists && a.havechange)
@@ -781,6 +815,7 @@ skip:
     YieldCurrentLock(thislock);
 
     ClearExpandedAttributes(&a);
+    ClearFilesAttributes(&attr);
     EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "promiser");
 
     return result;
@@ -979,7 +1014,9 @@ static PromiseResult RenderTemplateMustache(EvalContext *ctx,
                  edcontext->new_line_mode == NewLineMode_Native);
     }
 
-    Buffer *output_buffer = BufferNew();
+    /* The rendered output is usually at least as large as the template, so
+     * start the buffer there instead of growing it from empty. */
+    Buffer *output_buffer = BufferNewWithCapacity(strlen(template) + 1);
 
     char *message;
     if (strcmp("inline_mustache", attr->template_method) == 0)
@@ -1047,6 +1084,60 @@ static PromiseResult RenderTemplateMustache(EvalContext *ctx,
     return result;
 }
 
+/* A template is typically rendered once per service instance, which used to
+ * mean re-reading the same file from disk for every instance.  Keep the most
+ * recently read template and reuse it while the file on disk is unchanged;
+ * consecutive renderings of one template only stat() the file. */
+static struct
+{
+    char *path;
+    char *contents;
+    ino_t inode;
+    off_t size;
+    time_t mtime;
+} template_cache = { 0 }; /* GLOBAL_X */
+
+static const char *ReadTemplateCached(const char *path)
+{
+    struct stat sb;
+    if ((template_cache.path != NULL) &&
+        (strcmp(template_cache.path, path) == 0) &&
+        (stat(path, &sb) == 0) &&
+        (template_cache.inode == sb.st_ino) &&
+        (template_cache.size == sb.st_size) &&
+        (template_cache.mtime == sb.st_mtime))
+    {
+        return template_cache.contents;
+    }
+
+    int template_fd = safe_open(path, O_RDONLY | O_TEXT);
+    if (template_fd < 0)
+    {
+        return NULL;
+    }
+    if (fstat(template_fd, &sb) != 0)
+    {
+        close(template_fd);
+        return NULL;
+    }
+    Writer *template_writer = FileReadFromFd(template_fd, SIZE_MAX, NULL);
+    close(template_fd);
+    if (template_writer == NULL)
+    {
+        return NULL;
+    }
+
+    free(template_cache.path);
+    free(template_cache.contents);
+    template_cache.path = xstrdup(path);
+    template_cache.contents = StringWriterClose(template_writer);
+    template_cache.inode = sb.st_ino;
+    template_cache.size = sb.st_size;
+    template_cache.mtime = sb.st_mtime;
+
+    return template_cache.contents;
+}
+
 static PromiseResult RenderTemplateMustacheFromFile(EvalContext *ctx,
                                                     const Promise *pp,
                                                     const Attributes *a,
@@ -1062,27 +1153,16 @@ static PromiseResult RenderTemplateMustacheFromFile(EvalContext *ctx,
         return PromiseResultUpdate(result, PROMISE_RESULT_FAIL);
     }
 
-
-    int template_fd = safe_open(a->edit_template, O_RDONLY | O_TEXT);
-    Writer *template_writer = NULL;
-    if (template_fd >= 0)
-    {
-        template_writer = FileReadFromFd(template_fd, SIZE_MAX, NULL);
-        close(template_fd);
-    }
-    if (template_writer == NULL)
+    const char *template_contents = ReadTemplateCached(a->edit_template);
+    if (template_contents == NULL)
     {
         RecordFailure(ctx, pp, a, "Could not read template file '%s'", a->edit_template);
         return PromiseResultUpdate(result, PROMISE_RESULT_FAIL);
     }
 
-    result = RenderTemplateMustache(ctx, pp, a, edcontext,
-                                    StringWriterData(template_writer),
-                                    file_exists);
-
-    WriterClose(template_writer);
-
-    return result;
+    return RenderTemplateMustache(ctx, pp, a, edcontext,
+                                  template_contents,
+                                  file_exists);
 }
 
 static PromiseResult RenderTemplateMustacheFromString(EvalContext *ctx,
@@ -34,6 +34,179 @@
 #include <misc_lib.h>
 #include <eval_context.h>
 #include <known_dirs.h>
+#include <dbm_api.h>
+
+/* Read size for whole-file hashing: large reads keep the syscall count low
+ * and hand OpenSSL's digest code full buffers, which is where its run-time
+ * CPU dispatch (SHA-NI, NEON, AVX2) pays off.  HashFile() reads in CF_BUFSIZE
+ * chunks, which on big files spends more time crossing the kernel boundary
+ * than hashing. */
+#define HASH_FILE_BUFFER_SIZE (1024 * 1024)
+
+bool HashFileMulti(const char *file, size_t num_digests,
+                   const HashMethod types[], unsigned char *const digests[])
+{
+    assert(num_digests > 0);
+
+    bool success = true;
+    EVP_MD_CTX **ctxs = xcalloc(num_digests, sizeof(EVP_MD_CTX *));
+
+    for (size_t i = 0; success && (i < num_digests); i++)
+    {
+        const EVP_MD *const md = HashDigestFromId(types[i]);
+        if (md == NULL)
+        {
+            Log(LOG_LEVEL_ERR, "Could not determine hash function for digest type %d",
+                types[i]);
+            success = false;
+            break;
+        }
+
+        ctxs[i] = EVP_MD_CTX_new();
+        if ((ctxs[i] == NULL) || (EVP_DigestInit(ctxs[i], md) != 1))
+        {
+            Log(LOG_LEVEL_ERR, "Could not initialize openssl hash context");
+            success = false;
+        }
+    }
+
+    int fd = -1;
+    if (success)
+    {
+        fd = safe_open(file, O_RDONLY | O_BINARY);
+        if (fd == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Cannot open file for hashing '%s'. (open: %s)",
+                file, GetErrorStr());
+            success = false;
+        }
+    }
+
+    if (success)
+    {
+#ifdef POSIX_FADV_SEQUENTIAL
+        /* Just a hint, failure is of no consequence. */
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        unsigned char *buffer = xmalloc(HASH_FILE_BUFFER_SIZE);
+        ssize_t len;
+        while ((len = read(fd, buffer, HASH_FILE_BUFFER_SIZE)) > 0)
+        {
+            for (size_t i = 0; i < num_digests; i++)
+            {
+                EVP_DigestUpdate(ctxs[i], buffer, len);
+            }
+        }
+        if (len == -1)
+        {
+            Log(LOG_LEVEL_ERR, "Error reading file for hashing '%s'. (read: %s)",
+                file, GetErrorStr());
+            success = false;
+        }
+        free(buffer);
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    for (size_t i = 0; i < num_digests; i++)
+    {
+        if (ctxs[i] != NULL)
+        {
+            if (success)
+            {
+                unsigned int md_len;
+                EVP_DigestFinal(ctxs[i], digests[i], &md_len);
+            }
+            EVP_MD_CTX_free(ctxs[i]);
+        }
+    }
+    free(ctxs);
+
+    return success;
+}
+
+bool HashFileBuffered(const char *file,
+                      unsigned char digest[EVP_MAX_MD_SIZE + 1],
+                      HashMethod type)
+{
+    unsigned char *const digests[] = { digest };
+    return HashFileMulti(file, 1, &type, digests);
+}
+
+/* Cached digest of a file, valid as long as the stat information below still
+ * matches the file.  Key in the copy_digests database: "<hashname>_<path>". */
+typedef struct
+{
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+} CopyDigestEntry;
+
+/**
+ * Like HashFile(), but consult the copy_digests database first and only
+ * re-hash the file if its stat information changed since the digest was
+ * recorded.  Repeated agent runs over a large unchanged tree then verify it
+ * at stat() speed instead of re-reading every byte.
+ */
+void HashFileCached(const char *file, const struct stat *sb,
+                    unsigned char digest[EVP_MAX_MD_SIZE + 1],
+                    HashMethod type)
+{
+    CF_DB *dbp;
+    if (!OpenDB(&dbp, dbid_copy_digests))
+    {
+        if (!HashFileBuffered(file, digest, type))
+        {
+            HashFile(file, digest, type, false);
+        }
+        return;
+    }
+
+    char *key = NULL;
+    int key_size = xasprintf(&key, "%s_%s", HashNameFromId(type), file) + 1;
+
+    CopyDigestEntry entry;
+    if (ReadComplexKeyDB(dbp, key, key_size, &entry, sizeof(entry)) &&
+        entry.device == sb->st_dev &&
+        entry.inode == sb->st_ino &&
+        entry.size == sb->st_size &&
+        entry.mtime == sb->st_mtime &&
+        entry.ctime == sb->st_ctime)
+    {
+        Log(LOG_LEVEL_DEBUG, "Using cached digest for unchanged file '%s'", file);
+        memcpy(digest, entry.digest, EVP_MAX_MD_SIZE + 1);
+        free(key);
+        CloseDB(dbp);
+        return;
+    }
+
+    if (!HashFileBuffered(file, digest, type))
+    {
+        HashFile(file, digest, type, false);
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    entry.device = sb->st_dev;
+    entry.inode = sb->st_ino;
+    entry.size = sb->st_size;
+    entry.mtime = sb->st_mtime;
+    entry.ctime = sb->st_ctime;
+    memcpy(entry.digest, digest, EVP_MAX_MD_SIZE + 1);
+
+    if (!WriteComplexKeyDB(dbp, key, key_size, &entry, sizeof(entry)))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not cache digest of '%s'", file);
+    }
+
+    free(key);
+    CloseDB(dbp);
+}
 
 bool CompareFileHashes(const char *file1, const char *file2, const struct stat *sstat, const struct stat *dstat, const FileCopy *fc, AgentConnection *conn)
 {
@@ -48,8 +221,8 @@ bool CompareFileHashes(const char *file1, const char *file2, const struct stat *
 
     if (conn == NULL)
     {
-        HashFile(file1, digest1, CF_DEFAULT_DIGEST, false);
-        HashFile(file2, digest2, CF_DEFAULT_DIGEST, false);
+        HashFileCached(file1, sstat, digest1, CF_DEFAULT_DIGEST);
+        HashFileCached(file2, dstat, digest2, CF_DEFAULT_DIGEST);
 
         for (i = 0; i < EVP_MAX_MD_SIZE; i++)
         {
@@ -65,7 +238,10 @@ bool CompareFileHashes(const char *file1, const char *file2, const struct stat *
     else
     {
         assert(fc->servers && strcmp(RlistScalarValue(fc->servers), "localhost"));
-        return CompareHashNet(file1, file2, fc->encrypt, conn);  /* client.c */
+        /* Pipelines the download of a changed file into the same exchange,
+         * for CopyRegularFileNet() to pick up. */
+        return CompareHashAndFetchNet(file1, file2, sstat->st_size,
+                                      fc->encrypt, conn);  /* client.c */
     }
 }
 
@@ -31,4 +31,28 @@
 bool CompareFileHashes(const char *file1, const char *file2, const struct stat *sstat, const struct stat *dstat, const FileCopy *fc, AgentConnection *conn);
 bool CompareBinaryFiles(const char *file1, const char *file2, const struct stat *sstat, const struct stat *dstat, const FileCopy *fc, AgentConnection *conn);
 
+/**
+ * Hash #file with all #num_digests digest algorithms in #types in a single
+ * pass over the contents, using a large read buffer.  digests[i] receives the
+ * digest computed with types[i] and must hold EVP_MAX_MD_SIZE + 1 bytes.
+ *
+ * @return true if the file was read successfully and all digests are valid.
+ */
+bool HashFileMulti(const char *file, size_t num_digests, const HashMethod types[], unsigned char *const digests[]);
+
+/**
+ * Like HashFile(), but reads the file in large buffers.  Prefer this in
+ * hash-bound sweeps over many or big files.
+ *
+ * @return true if the file was read successfully and the digest is valid.
+ */
+bool HashFileBuffered(const char *file, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type);
+
+/**
+ * Hash #file with #type, consulting the copy_digests cache first: when the
+ * file's stat information (#sb) still matches the recorded entry, the cached
+ * digest is returned without reading the file.
+ */
+void HashFileCached(const char *file, const struct stat *sb, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type);
+
 #endif
@@ -37,6 +37,7 @@
 #include <locks.h>
 #include <instrumentation.h>
 #include <match_scope.h>
+#include <matching.h>                       /* RegexListMatchAnyPrefilter */
 #include <files_interfaces.h>
 #include <promises.h>
 #include <files_operators.h>
@@ -46,6 +47,7 @@
 #include <files_repository.h>
 #include <files_select.h>
 #include <files_changes.h>
+#include <files_timeout.h>
 #include <expand.h>
 #include <conversion.h>
 #include <pipes.h>
@@ -71,6 +73,10 @@
 #include <changes_chroot.h>     /* PrepareChangesChroot(), RecordFileChangedInChroot() */
 #include <unix.h>               /* GetGroupName(), GetUserName() */
 #include <override_fsattrs.h>
+#include <protocol.h>           /* ProtocolTreeDigest() */
+#include <file_lib.h>           /* safe_fopen() */
+#include <writer.h>             /* FileWriter() */
+#include <json.h>
 
 #include <cf-windows-functions.h>
 #include "cf3.defs.h"
@@ -84,6 +90,60 @@ static Item *VSETXIDLIST = NULL;
 const Rlist *SINGLE_COPY_LIST = NULL; /* GLOBAL_P */
 StringSet *SINGLE_COPY_CACHE = NULL; /* GLOBAL_X */
 
+static char LEAF_ACTUATION_DIR[CF_BUFSIZE]; /* GLOBAL_X */
+
+void SetLeafActuationDir(const char *changes_dir)
+{
+    if (changes_dir == NULL)
+    {
+        LEAF_ACTUATION_DIR[0] = '\0';
+    }
+    else if (strlcpy(LEAF_ACTUATION_DIR, changes_dir,
+                     sizeof(LEAF_ACTUATION_DIR))
+             >= sizeof(LEAF_ACTUATION_DIR))
+    {
+        LEAF_ACTUATION_DIR[0] = '\0';              /* truncated, don't trust */
+    }
+}
+
+/**
+ * Return #changes_file relative to the recorded actuation directory (the
+ * current working directory, see SetLeafActuationDir()) when it is a direct
+ * child of it, otherwise unchanged.  safe_chmod()/safe_chown() re-walk
+ * every path component with openat() on each call, which dominates
+ * permission sweeps over large trees; addressed through the basename they
+ * walk a single component.
+ */
+static const char *LeafActuationName(const char *changes_file)
+{
+    if (LEAF_ACTUATION_DIR[0] == '\0')
+    {
+        return changes_file;
+    }
+
+    const size_t dirlen = strlen(LEAF_ACTUATION_DIR);
+    if (strncmp(changes_file, LEAF_ACTUATION_DIR, dirlen) != 0 ||
+        !IsFileSep(changes_file[dirlen]))
+    {
+        return changes_file;
+    }
+
+    const char *base = changes_file + dirlen + 1;
+    if (base[0] == '\0')
+    {
+        return changes_file;
+    }
+    for (const char *cp = base; *cp != '\0'; cp++)
+    {
+        if (IsFileSep(*cp))
+        {
+            return changes_file;              /* not a direct child */
+        }
+    }
+
+    return base;
+}
+
 static bool TransformFile(EvalContext *ctx, char *file, const Attributes *attr, const Promise *pp, PromiseResult *result);
 static PromiseResult VerifyName(EvalContext *ctx, char *path, const struct stat *sb, const Attributes *attr, const Promise *pp);
 static PromiseResult VerifyDelete(EvalContext *ctx,
@@ -100,7 +160,7 @@ static bool CheckLinkSecurity(const struct stat *sb, const char *name);
 static bool CompareForFileCopy(char *sourcefile, char *destfile, const struct stat *ssb, const struct stat *dsb, const FileCopy *fc, AgentConnection *conn);
 static void FileAutoDefine(EvalContext *ctx, char *destfile);
 static void TruncateFile(const char *name);
-static void RegisterAHardLink(int i, const char *value, EvalContext *ctx, const Promise *pp,
+static void RegisterAHardLink(dev_t dev, ino_t ino, const char *value, EvalContext *ctx, const Promise *pp,
                               const Attributes *attr, PromiseResult *result,
                               CompressedArray **inode_cache);
 static PromiseResult VerifyCopiedFileAttributes(EvalContext *ctx, const char *src, const char *dest, const struct stat *sstat, const struct stat *dstat, const Attributes *attr, const Promise *pp);
@@ -133,9 +193,11 @@ void SetFileAutoDefineList(const Rlist *auto_define_list)
     AUTO_DEFINE_LIST = auto_define_list;
 }
 
-void VerifyFileLeaf(EvalContext *ctx, char *path, const struct stat *sb, ARG_UNUSED const Attributes *attr, const Promise *pp, PromiseResult *result)
+void VerifyFileLeaf(EvalContext *ctx, char *path, const struct stat *sb, const Attributes *attr, const Promise *pp, PromiseResult *result)
 {
-    // FIXME: This function completely ignores it's attr argument
+    /* #attr is the promiser-independent attribute skeleton built once per
+     * promise (see VerifyFilePromise()); only the this.promiser-dependent
+     * fields are re-expanded here, per leaf. */
     assert(attr != NULL);
 
 /* Here we can assume that we are in the parent directory of the leaf */
@@ -145,8 +207,7 @@ void VerifyFileLeaf(EvalContext *ctx, char *path, const struct stat *sb, ARG_UNU
     /* Update this.promiser again, and overwrite common attributes (classes, action) accordingly */
 
     EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "promiser", path, CF_DATA_TYPE_STRING, "source=promise");        // Parameters may only be scalars
-    Attributes org_attr = GetFilesAttributes(ctx, pp);
-    Attributes new_attr = GetExpandedAttributes(ctx, pp, &org_attr);
+    Attributes new_attr = GetExpandedAttributes(ctx, pp, attr);
 
     if (new_attr.transformer != NULL)
     {
@@ -191,6 +252,13 @@ void VerifyFileLeaf(EvalContext *ctx, char *path, const struct stat *sb, ARG_UNU
 /* Checks whether item matches a list of wildcards */
 static bool MatchRlistItem(EvalContext *ctx, const Rlist *listofregex, const char *teststring)
 {
+    /* One combined pass rejects the common no-match case before the
+     * per-pattern loop (which preserves first-match semantics). */
+    if (!RegexListMatchAnyPrefilter(listofregex, teststring))
+    {
+        return false;
+    }
+
     for (const Rlist *rp = listofregex; rp != NULL; rp = rp->next)
     {
         /* Avoid using regex if possible, due to memory leak */
@@ -596,7 +664,9 @@ static PromiseResult CfCopyFile(EvalContext *ctx, char *sourcefile,
     return result;
 }
 
-static PromiseResult PurgeLocalFiles(EvalContext *ctx, Item *filelist, const char *localdir, const Attributes *attr,
+/* 'filelist' holds the names seen in the source directory; NULL means
+ * nothing was seen, i.e. purge everything. */
+static PromiseResult PurgeLocalFiles(EvalContext *ctx, const StringSet *filelist, const char *localdir, const Attributes *attr,
                                      const Promise *pp, AgentConnection *conn)
 {
     assert(attr != NULL);
@@ -637,6 +707,7 @@ static PromiseResult PurgeLocalFiles(EvalContext *ctx, Item *filelist, const cha
         changes_localdir = ToChangesChroot(localdir);
     }
 
+    SetLeafActuationDir(NULL);             /* CWD leaves the scanned dir */
     if (safe_chdir(changes_localdir) == -1)
     {
         RecordFailure(ctx, pp, attr,
@@ -658,11 +729,11 @@ static PromiseResult PurgeLocalFiles(EvalContext *ctx, Item *filelist, const cha
     {
         if (!ConsiderLocalFile(dirp->d_name, changes_localdir))
         {
-            Log(LOG_LEVEL_VERBOSE, "Skipping '%s'", dirp->d_name);
+            LogLazy(LOG_LEVEL_VERBOSE, "Skipping '%s'", dirp->d_name);
             continue;
         }
 
-        if (!IsItemIn(filelist, dirp->d_name))
+        if (filelist == NULL || !StringSetContains(filelist, dirp->d_name))
         {
             strncpy(filename, localdir, CF_BUFSIZE - 2);
 
@@ -738,7 +809,12 @@ static PromiseResult SourceSearchAndCopy(EvalContext *ctx, const char *from, cha
                                          const Promise *pp, dev_t rootdevice, CompressedArray **inode_cache, AgentConnection *conn)
 {
     /* TODO overflow check all these str*cpy()s in here! */
-    Item *namecache = NULL;
+
+    /* Names seen in the source directory, checked against the destination by
+     * PurgeLocalFiles().  A hash set: with purge on, directories of several
+     * hundred thousand entries made the old Item-list bookkeeping (linear
+     * append here, linear lookup there) quadratic. */
+    StringSet *namecache = NULL;
 
     if (maxrecurse == 0)        /* reached depth limit */
     {
@@ -898,8 +974,12 @@ static PromiseResult SourceSearchAndCopy(EvalContext *ctx, const char *from, cha
 
         if (attr->copy.purge)
         {
-            /* Append this file to the list of files not to purge */
-            AppendItem(&namecache, dirp->d_name, NULL);
+            /* Record this file as one not to purge */
+            if (namecache == NULL)
+            {
+                namecache = StringSetNew();
+            }
+            StringSetAdd(namecache, xstrdup(dirp->d_name));
         }
 
         /* Assemble pathnames. TODO check overflow. */
@@ -1072,7 +1152,7 @@ static PromiseResult SourceSearchAndCopy(EvalContext *ctx, const char *from, cha
     if (attr->copy.purge)
     {
         PurgeLocalFiles(ctx, namecache, to, attr, pp, conn);
-        DeleteItemList(namecache);
+        StringSetDestroy(namecache);
     }
 
     AbstractDirClose(dirh);
@@ -1123,7 +1203,7 @@ static PromiseResult VerifyCopy(EvalContext *ctx,
     PromiseResult result = PROMISE_RESULT_NOOP;
     if (ssb.st_nlink > 1)      /* Preserve hard link structure when copying */
     {
-        RegisterAHardLink(ssb.st_ino, ToChangesPath(destination),
+        RegisterAHardLink(ssb.st_dev, ssb.st_ino, ToChangesPath(destination),
                           ctx, pp, attr, &result, inode_cache);
     }
 
@@ -1486,7 +1566,7 @@ bool CopyRegularFile(EvalContext *ctx, const char *source, const char *dest, con
 
     /* Make an assoc array of inodes used to preserve hard links */
 
-    linkable = CompressedArrayValue(*inode_cache, sstat->st_ino);
+    linkable = CompressedArrayValue(*inode_cache, sstat->st_dev, sstat->st_ino);
 
     /* If making changes in chroot, we need to make sure the target is in the
      * changes chroot before we create the hardlink. */
@@ -1546,6 +1626,12 @@ bool CopyRegularFile(EvalContext *ctx, const char *source, const char *dest, con
     int ret = stat(ToChangesPath(dest), &dest_stat);
     bool dest_exists = (ret == 0);
 
+    /* Digest of the destination's contents, computed while writing them
+     * (local copies with verify only); saves re-reading the destination in
+     * the final verification below. */
+    bool copy_digest_valid = false;
+    unsigned char copy_digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+
     if (remote)
     {
         if (conn->error)
@@ -1610,7 +1696,24 @@ bool CopyRegularFile(EvalContext *ctx, const char *source, const char *dest, con
         // If preserve is true, retain permissions of source file
         if (attr->copy.preserve)
         {
-            if (!CopyRegularFileDisk(changes_source, ToChangesPath(new)))
+            bool copied;
+            if (attr->copy.verify)
+            {
+                /* Hash while copying so the final verification does not
+                 * have to read the destination back. */
+                copied = CopyRegularFileDiskDigest(changes_source,
+                                                   ToChangesPath(new),
+                                                   -1, /* preserve mode */
+                                                   CF_DEFAULT_DIGEST,
+                                                   copy_digest);
+                copy_digest_valid = copied;
+            }
+            else
+            {
+                copied = CopyRegularFileDisk(changes_source,
+                                             ToChangesPath(new));
+            }
+            if (!copied)
             {
                 RecordFailure(ctx, pp, attr, "Failed copying file '%s' to '%s'", source, new);
                 *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
@@ -1624,9 +1727,22 @@ bool CopyRegularFile(EvalContext *ctx, const char *source, const char *dest, con
         {
             // Never preserve SUID bit (0777)
             int mode = dest_exists ? (dest_stat.st_mode & 0777) : CF_PERMS_DEFAULT;
-            if (!CopyRegularFileDiskPerms(changes_source,
-                                          ToChangesPath(new),
-                                          mode))
+            bool copied;
+            if (attr->copy.verify)
+            {
+                copied = CopyRegularFileDiskDigest(changes_source,
+                                                   ToChangesPath(new),
+                                                   mode, CF_DEFAULT_DIGEST,
+                                                   copy_digest);
+                copy_digest_valid = copied;
+            }
+            else
+            {
+                copied = CopyRegularFileDiskPerms(changes_source,
+                                                  ToChangesPath(new),
+                                                  mode);
+            }
+            if (!copied)
             {
                 RecordFailure(ctx, pp, attr, "Failed copying file '%s' to '%s'", source, new);
                 *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
@@ -1831,7 +1947,23 @@ bool CopyRegularFile(EvalContext *ctx, const char *source, const char *dest, con
     {
         Log(LOG_LEVEL_VERBOSE, "Final verification of transmission ...");
 
-        if (CompareFileHashes(source, changes_new, sstat, &new_stat, &(attr->copy), conn))
+        bool corrupted;
+        if (copy_digest_valid)
+        {
+            /* The destination's digest was computed while writing it; only
+             * the source is hashed here, from the digest cache when it is
+             * unchanged. */
+            unsigned char src_digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+            HashFileCached(source, sstat, src_digest, CF_DEFAULT_DIGEST);
+            corrupted = (memcmp(src_digest, copy_digest, EVP_MAX_MD_SIZE) != 0);
+        }
+        else
+        {
+            corrupted = CompareFileHashes(source, changes_new, sstat,
+                                          &new_stat, &(attr->copy), conn);
+        }
+
+        if (corrupted)
         {
             RecordFailure(ctx, pp, attr,
                           "New file '%s' seems to have been corrupted in transit, aborting.", new);
@@ -2682,7 +2814,8 @@ static PromiseResult VerifyFileAttributes(EvalContext *ctx, const char *file, co
                           file, (uintmax_t)dstat->st_mode & 07777, (uintmax_t)newperm & 07777))
         {
             const bool override_immutable = EvalContextOverrideImmutableGet(ctx);
-            if (!OverrideImmutableChmod(changes_file, newperm & 07777, override_immutable))
+            if (!OverrideImmutableChmod(LeafActuationName(changes_file),
+                                        newperm & 07777, override_immutable))
             {
                 RecordFailure(ctx, pp, attr, "Failed to change permissions of '%s'. (chmod: %s)",
                               file, GetErrorStr());
@@ -2829,9 +2962,10 @@ bool HandleFileObstruction(EvalContext *ctx, const char *path, const struct stat
 }
 
 bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel, const Attributes *attr,
-                const Promise *pp, dev_t rootdevice, PromiseResult *result)
+                const Attributes *base_attr, const Promise *pp, dev_t rootdevice, PromiseResult *result)
 {
     assert(attr != NULL);
+    assert(base_attr != NULL);
     Dir *dirh;
     int goback;
     const struct dirent *dirp;
@@ -2849,9 +2983,11 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
         ChopLastNode(basedir);
         if (safe_chdir(basedir))
         {
+            SetLeafActuationDir(NULL);
             Log(LOG_LEVEL_ERR, "Failed to chdir into '%s'. (chdir: '%s')", basedir, GetErrorStr());
             return false;
         }
+        SetLeafActuationDir(basedir);
         if (!attr->haveselect || SelectLeaf(ctx, name, sb, &(attr->select)))
         {
             /* Renames are handled separately. */
@@ -2860,7 +2996,7 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
                 RecordFileEvaluatedInChroot(name);
             }
 
-            VerifyFileLeaf(ctx, name, sb, attr, pp, result);
+            VerifyFileLeaf(ctx, name, sb, base_attr, pp, result);
             return true;
         }
         else
@@ -2905,15 +3041,37 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
     }
 
     char path[CF_BUFSIZE];
+    const size_t base_len = strlcpy(path, name, sizeof(path));
+    if (base_len >= sizeof(path))
+    {
+        RecordFailure(ctx, pp, attr,
+                      "Internal limit reached in DepthSearch(), path too long: '%s'",
+                      name);
+        *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
+        retval = false;
+        goto end;
+    }
+
     for (dirp = DirRead(dirh); dirp != NULL; dirp = DirRead(dirh))
     {
-        if (!ConsiderLocalFile(dirp->d_name, name))
+        /* One lstat() per entry: the result feeds both the skip decision
+         * below and all the type checks that follow.  Goes through the
+         * timeout layer so one dead mount does not hang the search. */
+        if (TimedLstatAt(name, dirp->d_name, &lsb) == -1)
         {
+            Log(LOG_LEVEL_VERBOSE, "Recurse was looking at '%s/%s' when an error occurred. (lstat: %s)",
+                name, dirp->d_name, GetErrorStr());
             continue;
         }
 
-        size_t total_len = strlcpy(path, name, sizeof(path));
-        if ((total_len >= sizeof(path)) || (JoinPaths(path, sizeof(path), dirp->d_name) == NULL))
+        if (!ConsiderLocalFileWithStat(dirp->d_name, name, &lsb))
+        {
+            continue;
+        }
+
+        /* Reuse one buffer: keep the directory prefix, swap the leaf. */
+        path[base_len] = '\0';
+        if (JoinPaths(path, sizeof(path), dirp->d_name) == NULL)
         {
             RecordFailure(ctx, pp, attr,
                           "Internal limit reached in DepthSearch(), path too long: '%s' + '%s'",
@@ -2923,12 +3081,6 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
             goto end;
         }
 
-        if (lstat(dirp->d_name, &lsb) == -1)
-        {
-            Log(LOG_LEVEL_VERBOSE, "Recurse was looking at '%s' when an error occurred. (lstat: %s)", path, GetErrorStr());
-            continue;
-        }
-
         if (S_ISLNK(lsb.st_mode))       /* should we ignore links? */
         {
             if (KillGhostLink(ctx, path, attr, pp, result))
@@ -2979,8 +3131,8 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
 
             if ((attr->recursion.depth > 1) && (rlevel <= attr->recursion.depth))
             {
-                Log(LOG_LEVEL_VERBOSE, "Entering '%s', level %d", path, rlevel);
-                goback = DepthSearch(ctx, path, &lsb, rlevel + 1, attr, pp, rootdevice, result);
+                LogLazy(LOG_LEVEL_VERBOSE, "Entering '%s', level %d", path, rlevel);
+                goback = DepthSearch(ctx, path, &lsb, rlevel + 1, attr, base_attr, pp, rootdevice, result);
                 if (!PopDirState(ctx, pp, attr, goback, name, sb, attr->recursion, result))
                 {
                     FatalError(ctx, "Not safe to continue");
@@ -3001,7 +3153,7 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
                 SeqAppend(selected_files, xstrdup(dirp->d_name));
             }
 
-            VerifyFileLeaf(ctx, path, &lsb, attr, pp, result);
+            VerifyFileLeaf(ctx, path, &lsb, base_attr, pp, result);
 
             /* Renames are handled separately. */
             if ((EVAL_MODE == EVAL_MODE_SIMULATE_MANIFEST_FULL) && !attr->haverename)
@@ -3037,6 +3189,7 @@ static bool PushDirState(EvalContext *ctx, const Promise *pp, const Attributes *
     const char *changes_name = (ToChangesPath(name));
     if (safe_chdir(changes_name) == -1)
     {
+        SetLeafActuationDir(NULL);
         RecordFailure(ctx, pp, attr, "Could not change to directory '%s' (mode '%04jo', chdir: %s)",
                       name, (uintmax_t)(sb->st_mode & 07777), GetErrorStr());
         *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
@@ -3047,6 +3200,7 @@ static bool PushDirState(EvalContext *ctx, const Promise *pp, const Attributes *
     {
         FatalError(ctx, "Not safe to continue");
     }
+    SetLeafActuationDir(changes_name);
     return true;
 }
 
@@ -3062,6 +3216,7 @@ static bool PopDirState(EvalContext *ctx, const Promise *pp, const Attributes *a
     {
         if (safe_chdir(changes_name) == -1)
         {
+            SetLeafActuationDir(NULL);
             RecordFailure(ctx, pp, attr,
                           "Error in backing out of recursive travlink descent securely to '%s'. (chdir: %s)",
                           name, GetErrorStr());
@@ -3073,17 +3228,20 @@ static bool PopDirState(EvalContext *ctx, const Promise *pp, const Attributes *a
         {
             return false;
         }
+        SetLeafActuationDir(changes_name);
     }
     else if (goback)
     {
         if (safe_chdir("..") == -1)
         {
+            SetLeafActuationDir(NULL);
             RecordFailure(ctx, pp, attr,
                           "Error in backing out of recursive descent securely to '%s'. (chdir: %s)",
                           name, GetErrorStr());
             *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
             return false;
         }
+        SetLeafActuationDir(changes_name);
     }
 
     return true;
@@ -3222,6 +3380,97 @@ static PromiseResult VerifyCopiedFileAttributes(EvalContext *ctx, const char *sr
     return result;
 }
 
+/* The tree digest cache grows by one entry per copy_from promise using
+ * tree_digest_check; this is generous. */
+#define TREE_DIGEST_CACHE_SIZE_MAX (1024 * 1024)
+
+static void TreeDigestCachePath(char *buf, size_t buf_size)
+{
+    snprintf(buf, buf_size, "%s%ccf_tree_digests.json",
+             GetStateDir(), FILE_SEPARATOR);
+}
+
+/**
+ * @return true if the digest recorded for this server/source/destination
+ *         triple after the last fully kept run equals @a digest.
+ */
+static bool TreeDigestCacheCheck(const char *server, const char *source,
+                                 const char *destination, const char *digest)
+{
+    char filename[CF_BUFSIZE];
+    TreeDigestCachePath(filename, sizeof(filename));
+
+    JsonElement *doc = NULL;
+    JsonParseError err = JsonParseFile(filename, TREE_DIGEST_CACHE_SIZE_MAX,
+                                       &doc);
+    if (err != JSON_PARSE_OK)
+    {
+        Log(LOG_LEVEL_DEBUG, "No usable tree digest cache at '%s' (%s)",
+            filename, JsonParseErrorToString(err));
+        return false;
+    }
+
+    bool match = false;
+    if (JsonGetType(doc) == JSON_TYPE_OBJECT)
+    {
+        char *key = StringFormat("%s:%s>%s", server, source, destination);
+        const JsonElement *recorded = JsonObjectGet(doc, key);
+        match = (recorded != NULL &&
+                 JsonGetType(recorded) == JSON_TYPE_STRING &&
+                 StringEqual(JsonPrimitiveGetAsString(recorded), digest));
+        free(key);
+    }
+
+    JsonDestroy(doc);
+    return match;
+}
+
+static void TreeDigestCacheStore(const char *server, const char *source,
+                                 const char *destination, const char *digest)
+{
+    char filename[CF_BUFSIZE];
+    TreeDigestCachePath(filename, sizeof(filename));
+
+    JsonElement *doc = NULL;
+    JsonParseError err = JsonParseFile(filename, TREE_DIGEST_CACHE_SIZE_MAX,
+                                       &doc);
+    if (err != JSON_PARSE_OK || JsonGetType(doc) != JSON_TYPE_OBJECT)
+    {
+        JsonDestroy(doc);
+        doc = JsonObjectCreate(1);
+    }
+
+    char *key = StringFormat("%s:%s>%s", server, source, destination);
+    JsonObjectAppendString(doc, key, digest);
+    free(key);
+
+    /* Write to a temporary file and rename so that readers never see a
+     * truncated cache. */
+    char tmp_filename[CF_BUFSIZE];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+
+    FILE *fp = safe_fopen(tmp_filename, "w");
+    if (fp == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Could not write tree digest cache '%s' (fopen: %s)",
+            tmp_filename, GetErrorStr());
+        JsonDestroy(doc);
+        return;
+    }
+
+    Writer *w = FileWriter(fp);
+    JsonWriteCompact(w, doc);
+    WriterClose(w);
+    JsonDestroy(doc);
+
+    if (rename(tmp_filename, filename) != 0)
+    {
+        Log(LOG_LEVEL_ERR, "Could not rename tree digest cache into place"
+            " ('%s' -> '%s': %s)", tmp_filename, filename, GetErrorStr());
+        unlink(tmp_filename);
+    }
+}
+
 static PromiseResult CopyFileSources(EvalContext *ctx, char *destination, const Attributes *attr, const Promise *pp, AgentConnection *conn)
 {
     assert(attr != NULL);
@@ -3269,6 +3518,27 @@ static PromiseResult CopyFileSources(EvalContext *ctx, char *destination, const
         }
     }
 
+    char remote_digest[CF_HOSTKEY_STRING_SIZE];
+    bool have_remote_digest = false;
+    if (attr->copy.tree_digest_check && conn != NULL &&
+        S_ISDIR(ssb.st_mode) && !ChrootChanges())
+    {
+        have_remote_digest = ProtocolTreeDigest(conn, source, remote_digest,
+                                                sizeof(remote_digest));
+        if (have_remote_digest &&
+            TreeDigestCacheCheck(conn->this_server, source, destination,
+                                 remote_digest))
+        {
+            RecordNoChange(ctx, pp, attr,
+                           "Tree digest of '%s' on '%s' unchanged since the"
+                           " last fully kept run, skipping recursive"
+                           " comparison for '%s'",
+                           source, conn->this_server, destination);
+            BufferDestroy(source_buf);
+            return PROMISE_RESULT_NOOP;
+        }
+    }
+
     start = BeginMeasure();
 
     strlcpy(vbuff, destination, CF_BUFSIZE - 3);
@@ -3344,6 +3614,14 @@ static PromiseResult CopyFileSources(EvalContext *ctx, char *destination, const
         EndMeasure(NULL, start);
     }
 
+    /* Only remember the digest after a fully kept pass: anything repaired
+     * (or failed) gets one more full comparison to confirm convergence. */
+    if (have_remote_digest && result == PROMISE_RESULT_NOOP)
+    {
+        TreeDigestCacheStore(conn->this_server, source, destination,
+                             remote_digest);
+    }
+
     BufferDestroy(source_buf);
     return result;
 }
@@ -3370,7 +3648,21 @@ static ProtocolVersion DecideProtocol(const EvalContext *ctx,
     }
 }
 
-static AgentConnection *FileCopyConnectionOpen(const EvalContext *ctx,
+/* Define classes recording that the circuit breaker refused connections to
+ * #servername this run, so policy can react (e.g. skip dependent bundles or
+ * alert) instead of rediscovering the outage promise by promise. */
+static void NoteConnectionSuppressed(EvalContext *ctx, const char *servername)
+{
+    char class_name[CF_MAXVARSIZE];
+    snprintf(class_name, sizeof(class_name),
+             "connection_breaker_open_%s", CanonifyName(servername));
+
+    EvalContextClassPutHard(ctx, "connection_breaker_open",
+                            "report,source=agent");
+    EvalContextClassPutHard(ctx, class_name, "report,source=agent");
+}
+
+static AgentConnection *FileCopyConnectionOpen(EvalContext *ctx,
                                                const char *servername,
                                                const FileCopy *fc, bool background)
 {
@@ -3410,6 +3702,11 @@ static AgentConnection *FileCopyConnectionOpen(const EvalContext *ctx,
 
             if (conn == NULL)                           /* Couldn't connect */
             {
+                if (ServerBreakerIsOpen(servername))
+                {
+                    NoteConnectionSuppressed(ctx, servername);
+                }
+
                 /* Allocate and add to the cache as failure. */
                 conn = NewAgentConn(servername, port, flags);
                 conn->conn_info->status = CONNECTIONINFO_STATUS_NOT_ESTABLISHED;
@@ -3431,6 +3728,10 @@ static AgentConnection *FileCopyConnectionOpen(const EvalContext *ctx,
         int err = 0;
         conn = ServerConnection(servername, port, EvalContextGetRestrictKeys(ctx), conntimeout,
                                 flags, &err);
+        if (conn == NULL && ServerBreakerIsOpen(servername))
+        {
+            NoteConnectionSuppressed(ctx, servername);
+        }
         return conn;
     }
 }
@@ -3704,8 +4005,16 @@ static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, con
     bool changed = false;
     if (attr->change.hash == HASH_METHOD_BEST)
     {
-        HashFile(file, digest1, HASH_METHOD_MD5, false);
-        HashFile(file, digest2, HASH_METHOD_SHA1, false);
+        /* Hash with both digests in a single pass over the contents:
+         * HashFile() would read the file once per digest. */
+        const HashMethod best_types[] = { HASH_METHOD_MD5, HASH_METHOD_SHA1 };
+        unsigned char *const best_digests[] = { digest1, digest2 };
+        if (!HashFileMulti(file, 2, best_types, best_digests))
+        {
+            /* Fall back to one pass per digest. */
+            HashFile(file, digest1, HASH_METHOD_MD5, false);
+            HashFile(file, digest2, HASH_METHOD_SHA1, false);
+        }
 
         changed = (changed ||
                    FileChangesCheckAndUpdateHash(ctx, file, digest1, HASH_METHOD_MD5, attr, pp, &result));
@@ -3714,7 +4023,10 @@ static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, con
     }
     else
     {
-        HashFile(file, digest1, attr->change.hash, false);
+        if (!HashFileBuffered(file, digest1, attr->change.hash))
+        {
+            HashFile(file, digest1, attr->change.hash, false);
+        }
 
         changed = (changed ||
                    FileChangesCheckAndUpdateHash(ctx, file, digest1, attr->change.hash, attr, pp, &result));
@@ -4122,11 +4434,11 @@ static void TruncateFile(const char *name)
     }
 }
 
-static void RegisterAHardLink(int i, const char *value, EvalContext *ctx, const Promise *pp,
+static void RegisterAHardLink(dev_t dev, ino_t ino, const char *value, EvalContext *ctx, const Promise *pp,
                               const Attributes *attr, PromiseResult *result,
                               CompressedArray **inode_cache)
 {
-    if (!FixCompressedArrayValue(i, value, inode_cache))
+    if (!FixCompressedArrayValue(dev, ino, value, inode_cache))
     {
         /* Not root hard link, remove to preserve consistency */
         if (MakingChanges(ctx, pp, attr, result, "remove old hard link '%s' to preserve structure",
@@ -4147,7 +4459,7 @@ static int cf_stat(const char *file, struct stat *buf, const FileCopy *fc, Agent
 
     if (conn == NULL)
     {
-        return stat(file, buf);
+        return TimedStat(file, buf);
     }
     else
     {
@@ -4377,7 +4689,7 @@ bool VerifyOwner(EvalContext *ctx, const char *file, const Promise *pp, const At
     {
 # ifdef HAVE_LCHOWN
         Log(LOG_LEVEL_DEBUG, "Using lchown function");
-        if (safe_lchown(changes_file, uid, gid) == -1)
+        if (safe_lchown(LeafActuationName(changes_file), uid, gid) == -1)
         {
             RecordFailure(ctx, pp, attr, "Cannot set ownership on link '%s'. (lchown: %s)",
                           file, GetErrorStr());
@@ -4402,7 +4714,7 @@ bool VerifyOwner(EvalContext *ctx, const char *file, const Promise *pp, const At
     }
     else
     {
-        if (safe_chown(changes_file, uid, gid) == -1)
+        if (safe_chown(LeafActuationName(changes_file), uid, gid) == -1)
         {
             RecordDenial(ctx, pp, attr, "Cannot set ownership on file '%s'. (chown: %s)",
                          file, GetErrorStr());
@@ -34,9 +34,21 @@ extern StringSet *SINGLE_COPY_CACHE;
 
 void SetFileAutoDefineList(const Rlist *auto_define_list);
 
+/**
+ * Record the directory (in the changes-chroot namespace) that the process
+ * has chdir()ed into while actuating file leaves, or forget it with NULL.
+ * While set, attribute actuation (chmod/chown) addresses direct children
+ * by basename instead of re-walking the full promised path per file.
+ * Callers that move the CWD elsewhere must clear it.
+ */
+void SetLeafActuationDir(const char *changes_dir);
+
 void VerifyFileLeaf(EvalContext *ctx, char *path, const struct stat *sb, const Attributes *attr, const Promise *pp, PromiseResult *result);
 bool HandleFileObstruction(EvalContext *ctx, const char *path, const struct stat *sb, const Attributes *attr, const Promise *pp, PromiseResult *result);
-bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel, const Attributes *attr, const Promise *pp, dev_t rootdevice, PromiseResult *result);
+/* #attr is the (possibly expanded) attributes driving the search itself,
+ * #base_attr the unexpanded skeleton handed to VerifyFileLeaf() for
+ * re-expansion against each leaf's this.promiser. */
+bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel, const Attributes *attr, const Attributes *base_attr, const Promise *pp, dev_t rootdevice, PromiseResult *result);
 bool CfCreateFile(EvalContext *ctx, char *file, const Promise *pp, const Attributes *attr, PromiseResult *result_out);
 void SetSearchDevice(struct stat *sb, const Promise *pp);
 
@@ -39,11 +39,60 @@
 #include <rlist.h>
 #include <ornaments.h>
 #include <string_lib.h>
+#include <map.h>
 
 static void GetReturnValue(EvalContext *ctx, const Bundle *callee, const Promise *caller);
 
 /*****************************************************************************/
 
+/* Opt-in memoization of method calls (the 'cache_method' attribute).
+ * Utility bundles that only derive classes and variables from their
+ * arguments are commonly invoked hundreds of times per run with a handful
+ * of distinct argument tuples; with 'cache_method => "true"' the policy
+ * author asserts that the bundle's effects depend only on its arguments, so
+ * a repeated invocation can report the first invocation's outcome instead
+ * of re-evaluating the bundle.  The effects themselves need no replay: the
+ * classes and bundle-scoped variables the first invocation defined are
+ * still in the EvalContext. */
+
+static Map *method_outcome_cache = NULL; /* GLOBAL_X */
+
+static char *MethodCallKey(const char *method_name, const Rlist *args)
+{
+    Writer *w = StringWriter();
+    WriterWrite(w, method_name);
+    for (const Rlist *rp = args; rp != NULL; rp = rp->next)
+    {
+        WriterWriteChar(w, ';');
+        RvalWrite(w, rp->val);
+    }
+    return StringWriterClose(w);
+}
+
+static bool MethodOutcomeCacheGet(const char *key, PromiseResult *result)
+{
+    if ((method_outcome_cache == NULL) ||
+        !MapHasKey(method_outcome_cache, key))
+    {
+        return false;
+    }
+
+    *result = (PromiseResult) (intptr_t) MapGet(method_outcome_cache, key);
+    return true;
+}
+
+static void MethodOutcomeCachePut(const char *key, PromiseResult result)
+{
+    if (method_outcome_cache == NULL)
+    {
+        method_outcome_cache = MapNew(StringHash_untyped, StringEqual_untyped,
+                                      free, NULL);
+    }
+    MapInsert(method_outcome_cache, xstrdup(key), (void *) (intptr_t) result);
+}
+
+/*****************************************************************************/
+
 /*
  * This function should only be called from the evaluator so that methods promises
  * never report REPAIRED compliance (the promises inside will do that already).
@@ -116,12 +165,30 @@ PromiseResult VerifyMethod(EvalContext *ctx, const Rval call, const Attributes *
         return PROMISE_RESULT_NOOP;
     }
 
+    char *call_key = NULL;
+    if (a->cache_method)
+    {
+        call_key = MethodCallKey(BufferData(method_name), args);
+
+        PromiseResult cached;
+        if (MethodOutcomeCacheGet(call_key, &cached))
+        {
+            cfPS(ctx, LOG_LEVEL_VERBOSE, cached, pp, a,
+                 "Method '%s' already verified with these arguments, reusing its outcome",
+                 BufferData(method_name));
+            free(call_key);
+            BufferDestroy(method_name);
+            return cached;
+        }
+    }
+
     char lockname[CF_BUFSIZE];
     GetLockName(lockname, "method", pp->promiser, args);
 
     CfLock thislock = AcquireLock(ctx, lockname, VUQNAME, CFSTARTTIME, a->transaction.ifelapsed, a->transaction.expireafter, pp, false);
     if (thislock.lock == NULL)
     {
+        free(call_key);
         BufferDestroy(method_name);
         return PROMISE_RESULT_SKIPPED;
     }
@@ -232,6 +299,17 @@ PromiseResult VerifyMethod(EvalContext *ctx, const Rval call, const Attributes *
         }
     }
 
+    if (call_key != NULL)
+    {
+        /* Only a real evaluation's outcome is worth reusing -- a missing
+         * bundle or a warn-only dry run is not. */
+        if ((bp != NULL) && (a->transaction.action != cfa_warn))
+        {
+            MethodOutcomeCachePut(call_key, result);
+        }
+        free(call_key);
+    }
+
     YieldCurrentLock(thislock);
     BufferDestroy(method_name);
     EndBundleBanner(bp);
@@ -37,6 +37,7 @@
 #include <expand.h>
 #include <scope.h>
 #include <vercmp.h>
+#include <verify_files_utils.h>               /* SetLeafActuationDir */
 #include <matching.h>
 #include <match_scope.h>
 #include <attributes.h>
@@ -319,6 +320,10 @@ static PromiseResult HandleOldPackagePromiseType(EvalContext *ctx, const Promise
     {
         Log(LOG_LEVEL_ERR, "Failed to chdir into '/'");
     }
+    else
+    {
+        SetLeafActuationDir(NULL);         /* CWD left the scanned dir */
+    }
 
     char *default_arch = GetDefaultArch(a.packages.package_default_arch_command);
 
@@ -38,6 +38,10 @@
 #include <cf-agent-windows-functions.h>
 #include <ornaments.h>
 #include <eval_context.h>
+#include <files_interfaces.h>                                 /* CfReadLine */
+#include <map.h>                                               /* StringMap */
+#include <pipes.h>
+#include <string_lib.h>
 
 static bool ServicesSanityChecks(const Attributes *a, const Promise *pp);
 static void SetServiceDefaults(Attributes *a);
@@ -200,8 +204,141 @@ static FnCall *DefaultServiceBundleCall(const Promise *pp, const char *service_p
     return call;
 }
 
+#if defined(__linux__)
+
+/* Unit name -> ACTIVE state from one "systemctl list-units" query, shared
+ * by every services promise in the run instead of one subprocess each.
+ * NULL until the first systemd services promise. */
+static StringMap *SYSTEMD_UNIT_STATES = NULL;                   /* GLOBAL_X */
+
+static void LoadSystemdUnitStates(void)
+{
+    SYSTEMD_UNIT_STATES = StringMapNew();
+
+    const char *systemctl = "/usr/bin/systemctl";
+    if (access(systemctl, X_OK) != 0)
+    {
+        systemctl = "/bin/systemctl";
+    }
+
+    char command[CF_BUFSIZE];
+    xsnprintf(command, sizeof(command),
+              "%s list-units --all --plain --no-legend --type=service",
+              systemctl);
+
+    FILE *pp = cf_popen(command, "r", true);
+    if (pp == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Could not query systemd for service states (cf_popen: %s)",
+            GetErrorStr());
+        return;
+    }
+
+    size_t line_size = CF_BUFSIZE;
+    char *line = xmalloc(line_size);
+
+    while (CfReadLine(&line, &line_size, pp) > 0)
+    {
+        /* UNIT LOAD ACTIVE SUB DESCRIPTION */
+        char unit[256], load[64], active[64];
+        if (sscanf(line, "%255s %63s %63s", unit, load, active) == 3)
+        {
+            StringMapInsert(SYSTEMD_UNIT_STATES,
+                            xstrdup(unit), xstrdup(active));
+        }
+    }
+
+    free(line);
+    cf_pclose(pp);
+}
+
+static void SystemdUnitName(const char *promiser, char *unit, size_t unit_size)
+{
+    if (strchr(promiser, '.') == NULL)
+    {
+        xsnprintf(unit, unit_size, "%s.service", promiser);
+    }
+    else
+    {
+        strlcpy(unit, promiser, unit_size);
+    }
+}
+
+/**
+ * True if systemd already reports the promised state, so that the service
+ * bundle and its per-service subprocesses can be skipped altogether.  Only
+ * plain start/stop promises without dependencies or an autostart policy
+ * qualify; everything else keeps going through the bundle, which knows the
+ * platform specifics.
+ */
+static bool SystemdServiceAlreadyConverged(EvalContext *ctx,
+                                           const Attributes *a,
+                                           const Promise *pp)
+{
+    if (!IsDefinedClass(ctx, "systemd") ||
+        a->service.service_depend != NULL ||
+        strcmp(a->service.service_autostart_policy, "none") != 0)
+    {
+        return false;
+    }
+
+    const char *policy = a->service.service_policy;
+    if (strcmp(policy, "start") != 0 && strcmp(policy, "stop") != 0)
+    {
+        return false;
+    }
+
+    if (SYSTEMD_UNIT_STATES == NULL)
+    {
+        LoadSystemdUnitStates();
+    }
+
+    char unit[CF_MAXVARSIZE];
+    SystemdUnitName(pp->promiser, unit, sizeof(unit));
+
+    const char *active = StringMapGet(SYSTEMD_UNIT_STATES, unit);
+    if (active == NULL)
+    {
+        /* Unknown unit: the promiser may be an alias which the service
+         * bundle maps to a real unit name, so let the bundle decide. */
+        return false;
+    }
+
+    return ((strcmp(policy, "start") == 0 && strcmp(active, "active") == 0) ||
+            (strcmp(policy, "stop") == 0 && strcmp(active, "inactive") == 0));
+}
+
+/**
+ * The service bundle may change the unit's state, so drop the cached entry
+ * before delegating: later promises about the same unit must not trust it.
+ */
+static void SystemdForgetUnitState(const char *promiser)
+{
+    if (SYSTEMD_UNIT_STATES != NULL)
+    {
+        char unit[CF_MAXVARSIZE];
+        SystemdUnitName(promiser, unit, sizeof(unit));
+        StringMapRemove(SYSTEMD_UNIT_STATES, unit);
+    }
+}
+
+#endif /* __linux__ */
+
 static PromiseResult DoVerifyServices(EvalContext *ctx, const Attributes *attr, const Promise *pp)
 {
+#if defined(__linux__)
+    if (SystemdServiceAlreadyConverged(ctx, attr, pp))
+    {
+        cfPS(ctx, LOG_LEVEL_VERBOSE, PROMISE_RESULT_NOOP, pp, attr,
+             "Service '%s' already converged on policy '%s' according to "
+             "systemd - promise kept", pp->promiser,
+             attr->service.service_policy);
+        return PROMISE_RESULT_NOOP;
+    }
+    SystemdForgetUnitState(pp->promiser);
+#endif
+
     assert(attr != NULL);
     Attributes a = *attr; // TODO: Remove this local copy
     Rval call;
@@ -42,6 +42,8 @@
 #include <promiser_regex_resolver.h>
 #include <ornaments.h>
 #include <eval_context.h>
+#include <map.h>                                                     /* Map */
+#include <string_lib.h>                          /* StringHash,StringEqual */
 
 bool CF_MOUNTALL = false; /* GLOBAL_X */
 
@@ -50,7 +52,7 @@ static PromiseResult VerifyFileSystem(EvalContext *ctx, char *name, const Attrib
 static PromiseResult VerifyFreeSpace(EvalContext *ctx, char *file, const Attributes *a, const Promise *pp);
 static PromiseResult VolumeScanArrivals(char *file, const Attributes *a, const Promise *pp);
 #if !defined(__MINGW32__)
-static bool FileSystemMountedCorrectly(Seq *list, char *name, const Attributes *a);
+static bool FileSystemMountedCorrectly(char *name, const Attributes *a);
 static bool IsForeignFileSystem(struct stat *childstat, char *dir);
 #endif
 
@@ -69,6 +71,45 @@ Seq *GetGlobalMountedFSList(void)
     return mounted_fs_list;
 }
 
+#ifndef __MINGW32__
+
+/* Lazily built index over the mounted filesystem snapshot: mountpoint ->
+ * Mount entry (borrowed from the Seq above, only keys owned).  Every
+ * storage promise otherwise rescans the whole list. */
+static Map *mounted_fs_index = NULL;                            /* GLOBAL_X */
+
+void InvalidateMountedFSIndex(void)
+{
+    MapDestroy(mounted_fs_index);
+    mounted_fs_index = NULL;
+}
+
+static const Mount *LookupMountedFS(const char *mounton)
+{
+    if (mounted_fs_index == NULL)
+    {
+        Seq *list = GetGlobalMountedFSList();
+        mounted_fs_index = MapNew(StringHash_untyped, StringEqual_untyped,
+                                  free, NULL);
+        const size_t length = SeqLength(list);
+        for (size_t i = 0; i < length; i++)
+        {
+            Mount *mp = SeqAt(list, i);
+            /* Keep the first entry for a mountpoint, like the scans the
+             * index replaces did. */
+            if (mp != NULL && mp->mounton != NULL &&
+                MapGet(mounted_fs_index, mp->mounton) == NULL)
+            {
+                MapInsert(mounted_fs_index, xstrdup(mp->mounton), mp);
+            }
+        }
+    }
+
+    return MapGet(mounted_fs_index, mounton);
+}
+
+#endif /* !__MINGW32__ */
+
 PromiseResult FindAndVerifyStoragePromises(EvalContext *ctx, const Promise *pp)
 {
     PromiseBanner(ctx, pp);
@@ -339,51 +380,34 @@ static PromiseResult VolumeScanArrivals(ARG_UNUSED char *file, ARG_UNUSED const
 /*********************************************************************/
 
 #if !defined(__MINGW32__)
-static bool FileSystemMountedCorrectly(Seq *list, char *name, const Attributes *a)
+static bool FileSystemMountedCorrectly(char *name, const Attributes *a)
 {
-    bool found = false;
+    /* Give primacy to the promised / affected object */
 
-    for (size_t i = 0; i < SeqLength(list); i++)
-    {
-        Mount *mp = SeqAt(list, i);
-
-        if (mp == NULL)
-        {
-            continue;
-        }
-
-        /* Give primacy to the promised / affected object */
+    const Mount *mp = LookupMountedFS(name);
 
-        if (strcmp(name, mp->mounton) == 0)
-        {
-            /* We have found something mounted on the promiser dir */
-
-            found = true;
-
-            if ((a->mount.mount_source) && (strcmp(mp->source, a->mount.mount_source) != 0))
-            {
-                Log(LOG_LEVEL_INFO, "A different file system '%s:%s' is mounted on '%s' than what is promised",
-                      mp->host, mp->source, name);
-                return false;
-            }
-            else
-            {
-                Log(LOG_LEVEL_VERBOSE, "File system '%s' seems to be mounted correctly", mp->source);
-                break;
-            }
-        }
-    }
-
-    if (!found)
+    if (mp == NULL)
     {
         if (!a->mount.unmount)
         {
             Log(LOG_LEVEL_VERBOSE, "File system '%s' seems not to be mounted correctly", name);
             CF_MOUNTALL = true;
         }
+
+        return false;
     }
 
-    return found;
+    /* We have found something mounted on the promiser dir */
+
+    if ((a->mount.mount_source) && (strcmp(mp->source, a->mount.mount_source) != 0))
+    {
+        Log(LOG_LEVEL_INFO, "A different file system '%s:%s' is mounted on '%s' than what is promised",
+              mp->host, mp->source, name);
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "File system '%s' seems to be mounted correctly", mp->source);
+    return true;
 }
 
 /*********************************************************************/
@@ -418,20 +442,14 @@ static bool IsForeignFileSystem(struct stat *childstat, char *dir)
     {
         Log(LOG_LEVEL_DEBUG, "'%s' is on a different file system, not descending", dir);
 
-        for (size_t i = 0; i < SeqLength(GetGlobalMountedFSList()); i++)
-        {
-            Mount *entry = SeqAt(GetGlobalMountedFSList(), i);
+        const Mount *entry = LookupMountedFS(dir);
 
-            if (!strcmp(entry->mounton, dir))
-            {
-                if ((entry->options != NULL)
-                    && ((strstr(entry->options, "nfs") != NULL)
-                        || (strstr(entry->options, "panfs") != NULL)
-                        || (strstr(entry->options, "cifs") != NULL)))
-                {
-                    return true;
-                }
-            }
+        if (entry != NULL && entry->options != NULL
+            && ((strstr(entry->options, "nfs") != NULL)
+                || (strstr(entry->options, "panfs") != NULL)
+                || (strstr(entry->options, "cifs") != NULL)))
+        {
+            return true;
         }
     }
 
@@ -457,7 +475,7 @@ static PromiseResult VerifyMountPromise(EvalContext *ctx, char *name, const Attr
     options = Rlist2String(a->mount.mount_options, ",");
 
     PromiseResult result = PROMISE_RESULT_NOOP;
-    if (!FileSystemMountedCorrectly(GetGlobalMountedFSList(), name, a))
+    if (!FileSystemMountedCorrectly(name, a))
     {
         if (!a->mount.unmount)
         {
@@ -522,6 +540,7 @@ static PromiseResult VerifyMountPromise(EvalContext *ctx, char *name, const Attr
 void DeleteStorageContext(void)
 {
 #ifndef __MINGW32__
+    InvalidateMountedFSIndex();
     CleanupNFS();
 
     if (!DONTDO && CF_MOUNTALL)
@@ -32,6 +32,11 @@ extern bool CF_MOUNTALL;
 PromiseResult FindAndVerifyStoragePromises(EvalContext *ctx, const Promise *pp);
 PromiseResult VerifyStoragePromise(EvalContext *ctx, char *path, const Promise *pp);
 Seq *GetGlobalMountedFSList(void);
+#ifndef __MINGW32__
+/* Callers dropping or reloading the mounted FS list must invalidate the
+ * mountpoint index built over it. */
+void InvalidateMountedFSIndex(void);
+#endif
 
 void DeleteStorageContext(void);
 
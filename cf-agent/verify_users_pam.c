@@ -36,6 +36,7 @@
 #include <eval_context.h>
 #include <regex.h> // CompileRegex()
 #include <buffer.h> // BufferData()
+#include <sequence.h>
 
 #include <cf3.defs.h>
 #include <verify_methods.h>
@@ -915,37 +916,117 @@ static bool SetAccountLocked(const char *puser, const char *hash, bool lock)
 }
 static void TransformGidsToGroups(StringSet **list);
 
-static bool GetGroupInfo (const char *user, const User *u, StringSet **groups_to_set, StringSet **groups_missing, StringSet **current_secondary_groups)
+/* Scanning /etc/passwd and /etc/group once per lookup makes a policy with
+ * hundreds of users promises re-parse them hundreds of times.  Instead each
+ * database is parsed once into a snapshot which is reused while the file on
+ * disk is unchanged; account-modifying commands replace the file, which
+ * changes its identity and makes the next lookup take a fresh snapshot.
+ *
+ * Entries handed out from a snapshot are owned by it and are only valid
+ * until the next lookup after the underlying file has changed. */
+typedef struct
 {
-    assert(u != NULL);
-    bool ret = true;
-    struct group *group_info;
+    Seq *entries;
+    ino_t inode;
+    off_t size;
+    time_t mtime;
+} UserDBSnapshot;
 
-    FILE *fptr = safe_fopen("/etc/group", "r");
-    if (!fptr)
+static UserDBSnapshot passwd_snapshot = { 0 }; /* GLOBAL_X */
+static UserDBSnapshot group_snapshot = { 0 }; /* GLOBAL_X */
+
+static bool SnapshotIsCurrent(const UserDBSnapshot *snapshot, const char *path)
+{
+    struct stat sb;
+    if (snapshot->entries == NULL || stat(path, &sb) != 0)
     {
-        Log(LOG_LEVEL_ERR, "Could not open '/etc/group': %s", GetErrorStr());
         return false;
     }
+    return ((snapshot->inode == sb.st_ino) &&
+            (snapshot->size == sb.st_size) &&
+            (snapshot->mtime == sb.st_mtime));
+}
 
-    StringSet *wanted_groups = StringSetNew();
-    if (u->groups_secondary_given)
+static void UpdateSnapshot(UserDBSnapshot *snapshot, Seq *entries, const struct stat *sb)
+{
+    SeqDestroy(snapshot->entries);
+    snapshot->entries = entries;
+    snapshot->inode = sb->st_ino;
+    snapshot->size = sb->st_size;
+    snapshot->mtime = sb->st_mtime;
+}
+
+static struct group *GroupEntryCopy(const struct group *src)
+{
+    struct group *dst = xcalloc(1, sizeof(struct group));
+    dst->gr_name = xstrdup(src->gr_name);
+    dst->gr_passwd = (src->gr_passwd != NULL) ? xstrdup(src->gr_passwd) : NULL;
+    dst->gr_gid = src->gr_gid;
+    // At least on FreeBSD, gr_mem can be NULL:
+    if (src->gr_mem != NULL)
     {
-        for (Rlist *ptr = u->groups_secondary; ptr != NULL; ptr = ptr->next)
+        size_t num_members = 0;
+        while (src->gr_mem[num_members] != NULL)
         {
-            StringSetAdd(*groups_missing, xstrdup(RvalScalarValue(ptr->val)));
-            StringSetAdd(wanted_groups, xstrdup(RvalScalarValue(ptr->val)));
+            num_members++;
         }
-        TransformGidsToGroups(groups_missing);
-        TransformGidsToGroups(&wanted_groups);
+        dst->gr_mem = xcalloc(num_members + 1, sizeof(char *));
+        for (size_t i = 0; i < num_members; i++)
+        {
+            dst->gr_mem[i] = xstrdup(src->gr_mem[i]);
+        }
+    }
+    return dst;
+}
+
+static void GroupEntryDestroy(void *entry)
+{
+    struct group *group_info = entry;
+    if (group_info != NULL)
+    {
+        free(group_info->gr_name);
+        free(group_info->gr_passwd);
+        if (group_info->gr_mem != NULL)
+        {
+            for (size_t i = 0; group_info->gr_mem[i] != NULL; i++)
+            {
+                free(group_info->gr_mem[i]);
+            }
+            free(group_info->gr_mem);
+        }
+        free(group_info);
+    }
+}
+
+// Uses fgetgrent() instead of getgrent(), to guarantee that the snapshot only
+// contains local groups, and not for example groups from LDAP.
+static Seq *GetGroupSnapshot(void)
+{
+    if (SnapshotIsCurrent(&group_snapshot, "/etc/group"))
+    {
+        return group_snapshot.entries;
     }
 
+    FILE *fptr = safe_fopen("/etc/group", "r");
+    if (!fptr)
+    {
+        Log(LOG_LEVEL_ERR, "Could not open '/etc/group': %s", GetErrorStr());
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(fileno(fptr), &sb) != 0)
+    {
+        Log(LOG_LEVEL_ERR, "Could not stat '/etc/group': %s", GetErrorStr());
+        fclose(fptr);
+        return NULL;
+    }
+
+    Seq *entries = SeqNew(64, GroupEntryDestroy);
     while (true)
     {
         errno = 0;
-        // Use fgetgrent() instead of getgrent(), to guarantee that the
-        // returned group is a local group, and not for example from LDAP.
-        group_info = fgetgrent(fptr);
+        struct group *group_info = fgetgrent(fptr);
         if (!group_info)
         {
             // Documentation among Unices is conflicting on return codes. When there
@@ -954,11 +1035,55 @@ static bool GetGroupInfo (const char *user, const User *u, StringSet **groups_to
             // AIX = ESRCH
             if (errno && errno != ENOENT && errno != ESRCH)
             {
+                int err = errno;
                 Log(LOG_LEVEL_ERR, "Error while getting group list. (fgetgrent: '%s')", GetErrorStr());
-                ret = false;
+                SeqDestroy(entries);
+                fclose(fptr);
+                errno = err;
+                return NULL;
             }
             break;
         }
+        SeqAppend(entries, GroupEntryCopy(group_info));
+#ifdef __FreeBSD__
+        free(group_info);
+#endif
+    }
+    fclose(fptr);
+
+    UpdateSnapshot(&group_snapshot, entries, &sb);
+    return entries;
+}
+
+static bool GetGroupInfo (const char *user, const User *u, StringSet **groups_to_set, StringSet **groups_missing, StringSet **current_secondary_groups)
+{
+    assert(u != NULL);
+
+    StringSet *wanted_groups = StringSetNew();
+    if (u->groups_secondary_given)
+    {
+        for (Rlist *ptr = u->groups_secondary; ptr != NULL; ptr = ptr->next)
+        {
+            StringSetAdd(*groups_missing, xstrdup(RvalScalarValue(ptr->val)));
+            StringSetAdd(wanted_groups, xstrdup(RvalScalarValue(ptr->val)));
+        }
+        TransformGidsToGroups(groups_missing);
+        TransformGidsToGroups(&wanted_groups);
+    }
+
+    // Fetched only after the wanted set is complete, since
+    // TransformGidsToGroups() may refresh the snapshot.
+    Seq *entries = GetGroupSnapshot();
+    if (entries == NULL)
+    {
+        StringSetDestroy(wanted_groups);
+        return false;
+    }
+
+    const size_t num_entries = SeqLength(entries);
+    for (size_t n = 0; n < num_entries; n++)
+    {
+        const struct group *group_info = SeqAt(entries, n);
 
         if (StringSetContains(wanted_groups, group_info->gr_name))
         {
@@ -986,15 +1111,11 @@ static bool GetGroupInfo (const char *user, const User *u, StringSet **groups_to
                 StringSetAdd(*groups_to_set, xstrdup(group_info->gr_name));
             }
         }
-#ifdef __FreeBSD__
-        free(group_info);
-#endif
     }
 
     StringSetDestroy(wanted_groups);
-    fclose(fptr);
 
-    return ret;
+    return true;
 }
 
 static bool EqualGid(const char *key, const struct group *entry)
@@ -1055,46 +1176,34 @@ struct group *fgetgrent(FILE *stream)
 }
 #endif
 
-// Uses fgetgrent() instead of getgrnam(), to guarantee that the returned group
-// is a local group, and not for example from LDAP.
+// Uses the /etc/group snapshot instead of getgrnam(), to guarantee that the
+// returned group is a local group, and not for example from LDAP.  The entry
+// is owned by the snapshot, so do not free it.
 static struct group *GetGrEntry(const char *key,
                                 bool (*equal_fn)(const char *key, const struct group *entry))
 {
-    FILE *fptr = safe_fopen("/etc/group", "r");
-    if (!fptr)
+    Seq *entries = GetGroupSnapshot();
+    if (entries == NULL)
     {
-        Log(LOG_LEVEL_ERR, "Could not open '/etc/group': %s", GetErrorStr());
+        // errno is set by the failed snapshot pass.
         return NULL;
     }
 
-    struct group *group_info;
-    bool found = false;
-    while ((group_info = fgetgrent(fptr)))
+    const size_t num_entries = SeqLength(entries);
+    for (size_t n = 0; n < num_entries; n++)
     {
+        struct group *group_info = SeqAt(entries, n);
         if (equal_fn(key, group_info))
         {
-            found = true;
-            break;
+            return group_info;
         }
-#ifdef __FreeBSD__
-        free(group_info);
-#endif
     }
 
-    fclose(fptr);
-
-    if (found)
-    {
-        return group_info;
-    }
-    else
-    {
-        // Failure to find the user means we just set errno to zero.
-        // Perhaps not optimal, but we cannot pass ENOENT, because the fopen might
-        // fail for this reason, and that should not be treated the same.
-        errno = 0;
-        return NULL;
-    }
+    // Failure to find the user means we just set errno to zero.
+    // Perhaps not optimal, but we cannot pass ENOENT, because the fopen might
+    // fail for this reason, and that should not be treated the same.
+    errno = 0;
+    return NULL;
 }
 
 static void TransformGidsToGroups(StringSet **list)
@@ -1145,9 +1254,6 @@ static void TransformGidsToGroups(StringSet **list)
         {
             StringSetAdd(new_list, xstrdup(data));
         }
-#ifdef __FreeBSD__
-        free(group_info);
-#endif
     }
     StringSet *old_list = *list;
     *list = new_list;
@@ -1257,10 +1363,6 @@ static bool VerifyIfUserNeedsModifs(const char *puser, const User *u,
                 CFUSR_SETBIT(*changemap, i_group);
             }
         }
-
-#ifdef __FreeBSD__
-        free(group_info);
-#endif
     }
 
     ////////////////////////////////////////////
@@ -1804,10 +1906,42 @@ struct passwd *fgetpwent(FILE *stream)
 }
 #endif
 
-// Uses fgetpwent() instead of getpwnam(), to guarantee that the returned user
-// is a local user, and not for example from LDAP.
-static struct passwd *GetPwEntry(const char *puser)
+static struct passwd *PasswdEntryCopy(const struct passwd *src)
+{
+    struct passwd *dst = xcalloc(1, sizeof(struct passwd));
+    dst->pw_name = xstrdup(src->pw_name);
+    dst->pw_passwd = (src->pw_passwd != NULL) ? xstrdup(src->pw_passwd) : NULL;
+    dst->pw_uid = src->pw_uid;
+    dst->pw_gid = src->pw_gid;
+    dst->pw_gecos = (src->pw_gecos != NULL) ? xstrdup(src->pw_gecos) : NULL;
+    dst->pw_dir = (src->pw_dir != NULL) ? xstrdup(src->pw_dir) : NULL;
+    dst->pw_shell = (src->pw_shell != NULL) ? xstrdup(src->pw_shell) : NULL;
+    return dst;
+}
+
+static void PasswdEntryDestroy(void *entry)
 {
+    struct passwd *passwd_info = entry;
+    if (passwd_info != NULL)
+    {
+        free(passwd_info->pw_name);
+        free(passwd_info->pw_passwd);
+        free(passwd_info->pw_gecos);
+        free(passwd_info->pw_dir);
+        free(passwd_info->pw_shell);
+        free(passwd_info);
+    }
+}
+
+// Uses fgetpwent() instead of getpwent(), to guarantee that the snapshot only
+// contains local users, and not for example users from LDAP.
+static Seq *GetPasswdSnapshot(void)
+{
+    if (SnapshotIsCurrent(&passwd_snapshot, "/etc/passwd"))
+    {
+        return passwd_snapshot.entries;
+    }
+
     FILE *fptr = safe_fopen("/etc/passwd", "r");
     if (!fptr)
     {
@@ -1815,34 +1949,74 @@ static struct passwd *GetPwEntry(const char *puser)
         return NULL;
     }
 
-    struct passwd *passwd_info;
-    bool found = false;
-    while ((passwd_info = fgetpwent(fptr)))
+    struct stat sb;
+    if (fstat(fileno(fptr), &sb) != 0)
     {
-        if (strcmp(puser, passwd_info->pw_name) == 0)
+        Log(LOG_LEVEL_ERR, "Could not stat '/etc/passwd': %s", GetErrorStr());
+        fclose(fptr);
+        return NULL;
+    }
+
+    Seq *entries = SeqNew(64, PasswdEntryDestroy);
+    while (true)
+    {
+        errno = 0;
+        struct passwd *passwd_info = fgetpwent(fptr);
+        if (!passwd_info)
         {
-            found = true;
+            // Documentation among Unices is conflicting on return codes. When there
+            // are no more entries, this happens:
+            // Linux = ENOENT
+            // AIX = ESRCH
+            if (errno && errno != ENOENT && errno != ESRCH)
+            {
+                int err = errno;
+                Log(LOG_LEVEL_ERR, "Error while getting user list. (fgetpwent: '%s')", GetErrorStr());
+                SeqDestroy(entries);
+                fclose(fptr);
+                errno = err;
+                return NULL;
+            }
             break;
         }
+        SeqAppend(entries, PasswdEntryCopy(passwd_info));
 #ifdef __FreeBSD__
         free(passwd_info);
 #endif
     }
-
     fclose(fptr);
 
-    if (found)
+    UpdateSnapshot(&passwd_snapshot, entries, &sb);
+    return entries;
+}
+
+// Uses the /etc/passwd snapshot instead of getpwnam(), to guarantee that the
+// returned user is a local user, and not for example from LDAP.  The entry is
+// owned by the snapshot, so do not free it.
+static struct passwd *GetPwEntry(const char *puser)
+{
+    Seq *entries = GetPasswdSnapshot();
+    if (entries == NULL)
     {
-        return passwd_info;
+        // errno is set by the failed snapshot pass.
+        return NULL;
     }
-    else
+
+    const size_t num_entries = SeqLength(entries);
+    for (size_t n = 0; n < num_entries; n++)
     {
-        // Failure to find the user means we just set errno to zero.
-        // Perhaps not optimal, but we cannot pass ENOENT, because the fopen might
-        // fail for this reason, and that should not be treated the same.
-        errno = 0;
-        return NULL;
+        struct passwd *passwd_info = SeqAt(entries, n);
+        if (strcmp(puser, passwd_info->pw_name) == 0)
+        {
+            return passwd_info;
+        }
     }
+
+    // Failure to find the user means we just set errno to zero.
+    // Perhaps not optimal, but we cannot pass ENOENT, because the fopen might
+    // fail for this reason, and that should not be treated the same.
+    errno = 0;
+    return NULL;
 }
 
 void VerifyOneUsersPromise (const char *puser, const User *u, PromiseResult *result, enum cfopaction action,
@@ -1932,7 +2106,4 @@ void VerifyOneUsersPromise (const char *puser, const User *u, PromiseResult *res
             *result = PROMISE_RESULT_NOOP;
         }
     }
-#ifdef __FreeBSD__
-    free(passwd_info);
-#endif
 }
@@ -0,0 +1,104 @@
+#include <averages_pack.h>
+
+// buf must hold at least AVERAGES_PACK_MAX(n_values) bytes.
+// Returns the number of bytes written.
+size_t AveragesPackValues(time_t last_seen, const double *values,
+                          size_t n_values, unsigned char *buf)
+{
+    size_t pos = 0;
+
+    buf[pos++] = AVERAGES_PACK_VERSION;
+
+    const uint64_t stamp = (uint64_t) last_seen;
+    for (size_t b = 0; b < sizeof(stamp); b++)
+    {
+        buf[pos++] = (stamp >> (8 * b)) & 0xFF;
+    }
+
+    uint64_t prev = 0;
+    for (size_t i = 0; i < n_values; i++)
+    {
+        uint64_t bits;
+        memcpy(&bits, &values[i], sizeof(bits));
+
+        const uint64_t x = bits ^ prev;
+        prev = bits;
+
+        if (x == 0)
+        {
+            // Value repeats its predecessor exactly, one byte suffices:
+            buf[pos++] = 0;
+            continue;
+        }
+
+        size_t lead = 0;
+        while (((x >> (8 * (7 - lead))) & 0xFF) == 0)
+        {
+            lead++;
+        }
+        size_t trail = 0;
+        while (((x >> (8 * trail)) & 0xFF) == 0)
+        {
+            trail++;
+        }
+
+        const size_t n_sig = 8 - lead - trail;
+        buf[pos++] = (unsigned char) ((lead << 4) | n_sig);
+        for (size_t b = 0; b < n_sig; b++)
+        {
+            buf[pos++] = (x >> (8 * (trail + b))) & 0xFF;
+        }
+    }
+
+    return pos;
+}
+
+// Returns false if buf is not a well-formed packed record covering
+// n_values values.  A trailing pad byte after the last value is allowed.
+bool AveragesUnpackValues(const unsigned char *buf, size_t buf_size,
+                          time_t *last_seen, double *values, size_t n_values)
+{
+    size_t pos = 0;
+
+    if (buf_size < 1 + sizeof(uint64_t) || buf[pos++] != AVERAGES_PACK_VERSION)
+    {
+        return false;
+    }
+
+    uint64_t stamp = 0;
+    for (size_t b = 0; b < sizeof(stamp); b++)
+    {
+        stamp |= (uint64_t) buf[pos++] << (8 * b);
+    }
+    *last_seen = (time_t) stamp;
+
+    uint64_t prev = 0;
+    for (size_t i = 0; i < n_values; i++)
+    {
+        if (pos >= buf_size)
+        {
+            return false;
+        }
+
+        const unsigned char control = buf[pos++];
+        const size_t lead = control >> 4;
+        const size_t n_sig = control & 0x0F;
+        if (lead + n_sig > 8 || buf_size - pos < n_sig)
+        {
+            return false;
+        }
+
+        const size_t trail = 8 - lead - n_sig;
+        uint64_t x = 0;
+        for (size_t b = 0; b < n_sig; b++)
+        {
+            x |= (uint64_t) buf[pos++] << (8 * (trail + b));
+        }
+
+        const uint64_t bits = x ^ prev;
+        prev = bits;
+        memcpy(&values[i], &bits, sizeof(bits));
+    }
+
+    return true;
+}
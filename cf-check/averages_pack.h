@@ -0,0 +1,31 @@
+#ifndef CF_CHECK_AVERAGES_PACK_H
+#define CF_CHECK_AVERAGES_PACK_H
+
+#include <platform.h>
+
+// Compact on-disk encoding for monitoring history records (history.lmdb).
+//
+// A record is a timestamp followed by a fixed-size array of doubles (the
+// Averages struct viewed as raw values).  Most of those doubles are zero
+// or repeat from slot to slot, so each one is XORed with its predecessor
+// and only the non-zero bytes of the XOR are kept, Gorilla-style but
+// byte-aligned: a control byte carries the count of leading zero bytes
+// and the count of significant bytes, then the significant bytes follow.
+// Typical records shrink roughly 10x; the worst case is 9 bytes per value
+// plus the header.
+//
+// Lives in cf-check (not libpromises) so that cf-check's dump code can
+// decode records without linking libpromises, same as db_structs.h.
+
+#define AVERAGES_PACK_VERSION 1
+
+// Version byte + 64-bit timestamp + worst case 9 bytes per value + one
+// optional pad byte (see PutRecordForTime in libpromises):
+#define AVERAGES_PACK_MAX(n_values) (1 + sizeof(uint64_t) + (n_values) * 9 + 1)
+
+size_t AveragesPackValues(time_t last_seen, const double *values,
+                          size_t n_values, unsigned char *buf);
+bool AveragesUnpackValues(const unsigned char *buf, size_t buf_size,
+                          time_t *last_seen, double *values, size_t n_values);
+
+#endif
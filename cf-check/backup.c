@@ -30,12 +30,14 @@ int backup_files_copy(ARG_UNUSED Seq *filenames)
 #else
 
 #include <replicate_lmdb.h>
+#include <lmdb.h>
 
 static void print_usage(void)
 {
-    printf("Usage: cf-check backup [-d] [FILE ...]\n");
+    printf("Usage: cf-check backup [-d|-s] [FILE ...]\n");
     printf("Example: cf-check backup /var/cfengine/state/cf_lastseen.lmdb\n");
-    printf("Options: -d|--dump use dump strategy instead of plain copy");
+    printf("Options: -d|--dump     use dump strategy instead of plain copy\n");
+    printf("         -s|--snapshot take live snapshots without blocking readers\n");
 }
 
 const char *create_backup_dir()
@@ -188,6 +190,103 @@ static int backup_files_replicate(const Seq *files)
     return corrupted;
 }
 
+/**
+ * Take a live snapshot of one LMDB file using mdb_env_copy2().  The copy
+ * runs inside a read transaction, so writers and other readers are never
+ * blocked; MDB_CP_COMPACT omits free pages, so a mostly-empty map file
+ * produces a snapshot the size of its live data.
+ */
+static int snapshot_lmdb(const char *file, const char *dest_file)
+{
+    MDB_env *env = NULL;
+    int rc = mdb_env_create(&env);
+    if (rc != MDB_SUCCESS)
+    {
+        report_mdb_error(file, "mdb_env_create", rc);
+        return lmdb_errno_to_cf_check_code(rc);
+    }
+
+    rc = mdb_env_open(env, file, MDB_NOSUBDIR | MDB_RDONLY, 0600);
+    if (rc != MDB_SUCCESS)
+    {
+        report_mdb_error(file, "mdb_env_open", rc);
+        mdb_env_close(env);
+        return lmdb_errno_to_cf_check_code(rc);
+    }
+
+    rc = mdb_env_copy2(env, dest_file, MDB_CP_COMPACT);
+    if (rc != MDB_SUCCESS)
+    {
+        report_mdb_error(file, "mdb_env_copy2", rc);
+    }
+    mdb_env_close(env);
+    return lmdb_errno_to_cf_check_code(rc);
+}
+
+/**
+ * Back up LMDB files with live snapshots instead of raw file copies.
+ *
+ * @return the number of files that failed to be snapshotted or -1 in case
+ *         of some internal failure
+ */
+static int backup_files_snapshot(const Seq *files)
+{
+    assert(files != NULL);
+    const size_t length = SeqLength(files);
+
+    // Attempting to back up 0 files is considered a failure:
+    assert_or_return(length > 0, 1);
+
+    const char *backup_dir = create_backup_dir();
+    if (backup_dir == NULL)
+    {
+        // Error already logged
+        return -1;
+    }
+
+    Log(LOG_LEVEL_INFO, "Backing up to '%s' using live snapshots", backup_dir);
+
+    size_t failures = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        const char *file = SeqAt(files, i);
+        assert(StringEndsWith(backup_dir, "/"));
+        char *file_copy = xstrdup(file); /* basename() can modify the string */
+        char *dest_file = StringFormat("%s%s", backup_dir, basename(file_copy));
+        free(file_copy);
+        pid_t child_pid = fork();
+        if (child_pid == 0)
+        {
+            /* child */
+            exit(snapshot_lmdb(file, dest_file));
+        }
+        else
+        {
+            /* parent */
+            int status;
+            pid_t pid = waitpid(child_pid, &status, 0);
+            if (pid != child_pid)
+            {
+                /* real error that should never happen */
+                return -1;
+            }
+            if (WIFEXITED(status) && WEXITSTATUS(status) != CF_CHECK_OK)
+            {
+                Log(LOG_LEVEL_ERR, "Failed to backup file '%s'", file);
+                failures++;
+            }
+            if (WIFSIGNALED(status))
+            {
+                Log(LOG_LEVEL_ERR, "Failed to backup file '%s', child process signaled (%d)",
+                    file, WTERMSIG(status));
+                failures++;
+            }
+        }
+        free(dest_file);
+    }
+    return failures;
+}
+
 /**
  * @return the number of files that failed to be replicated or -1 in case of
  *         some internal failure
@@ -196,20 +295,32 @@ int backup_main(int argc, const char *const *const argv)
 {
     size_t offset = 1;
     bool do_dump = false;
-    if (argc > 1 && argv[1] != NULL && argv[1][0] == '-')
+    bool do_snapshot = false;
+    for (int i = offset; i < argc && argv[i] != NULL && argv[i][0] == '-'; ++i)
     {
-        if (StringMatchesOption(argv[1], "--dump", "-d"))
+        if (StringMatchesOption(argv[i], "--dump", "-d"))
         {
             offset++;
             do_dump = true;
         }
+        else if (StringMatchesOption(argv[i], "--snapshot", "-s"))
+        {
+            offset++;
+            do_snapshot = true;
+        }
         else
         {
             print_usage();
-            printf("Unrecognized option: '%s'\n", argv[1]);
+            printf("Unrecognized option: '%s'\n", argv[i]);
             return 1;
         }
     }
+    if (do_dump && do_snapshot)
+    {
+        print_usage();
+        printf("--dump and --snapshot are mutually exclusive\n");
+        return 1;
+    }
 
     Seq *files = argv_to_lmdb_files(argc, argv, offset);
     if (files == NULL || SeqLength(files) == 0)
@@ -222,6 +333,10 @@ int backup_main(int argc, const char *const *const argv)
     {
         ret = backup_files_replicate(files);
     }
+    else if (do_snapshot)
+    {
+        ret = backup_files_snapshot(files);
+    }
     else
     {
         ret = backup_files_copy(files);
@@ -5,6 +5,8 @@
 #include <diagnose.h>
 #include <backup.h>
 #include <repair.h>
+#include <journal.h>
+#include <records.h>
 #include <string_lib.h>
 #include <logging.h>
 #include <man.h>
@@ -42,6 +44,10 @@ static const Description COMMANDS[] =
                  "cf-check repair"},
     {"dump",     "Print the contents of a database file",
                  "cf-check dump " WORKDIR "/state/cf_lastseen.lmdb"},
+    {"sync",     "Apply a database change journal to a database file",
+                 "cf-check sync cf_lastseen.lmdb.journal " WORKDIR "/state/cf_lastseen.lmdb"},
+    {"records",  "Print per-run promise outcome record files",
+                 "cf-check records " WORKDIR "/state/run_records/run-*.crr"},
     {"lmdump",   "LMDB database dumper (deprecated)",
                  "cf-check lmdump -a " WORKDIR "/state/cf_lastseen.lmdb"},
     {NULL, NULL, NULL}
@@ -222,6 +228,18 @@ int main(int argc, const char *const *argv)
         CallCleanupFunctions();
         return ret;
     }
+    if (StringEqual_IgnoreCase(command, "sync"))
+    {
+        int ret = sync_main(cmd_argc, cmd_argv);
+        CallCleanupFunctions();
+        return ret;
+    }
+    if (StringEqual_IgnoreCase(command, "records"))
+    {
+        int ret = records_main(cmd_argc, cmd_argv);
+        CallCleanupFunctions();
+        return ret;
+    }
     if (StringEqual_IgnoreCase(command, "repair") ||
         StringEqual_IgnoreCase(command, "remediate"))
     {
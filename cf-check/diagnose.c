@@ -476,12 +476,22 @@ static int diagnose_write(const char *path)
     return ret;
 }
 
-static int fork_and_diagnose(const char *path, bool validate, bool test_write)
+/**
+ * Fork a child checking one database.  In validate mode the child's stdout is
+ * redirected to @a output so that concurrently running checks don't interleave
+ * their reports; the parent prints the capture once the child is reaped.
+ */
+static pid_t fork_diagnose(
+    const char *path, bool validate, bool test_write, FILE *output)
 {
     const pid_t child_pid = fork();
     if (child_pid == 0)
     {
         // Child
+        if (output != NULL)
+        {
+            dup2(fileno(output), STDOUT_FILENO);
+        }
         /* The second argument is 'temporary_redirect' and we require a
          * temporary redirect if we want to test writability because that
          * produces output. */
@@ -492,25 +502,18 @@ static int fork_and_diagnose(const char *path, bool validate, bool test_write)
         }
         exit(r);
     }
-    else
-    {
-        // Parent
-        int status;
-        pid_t pid = waitpid(child_pid, &status, 0);
-        if (pid != child_pid)
-        {
-            return CF_CHECK_PID_ERROR;
-        }
-        if (WIFEXITED(status) && WEXITSTATUS(status) != CF_CHECK_OK)
-        {
-            return WEXITSTATUS(status);
-        }
-        if (WIFSIGNALED(status))
-        {
-            return signal_to_cf_check_code(WTERMSIG(status));
-        }
-    }
-    return CF_CHECK_OK;
+    return child_pid;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
 }
 
 static char *follow_symlink(const char *path)
@@ -558,6 +561,21 @@ bool lmdb_file_needs_rotation(const char *file, int *usage)
  * @param[in]  test_write whether to test writing into the DB
  * @return                the number of the corrupted files
  */
+/* Per-database bookkeeping for one diagnosis run.  In forked mode all
+ * children run concurrently and are reaped in completion order, so each
+ * database's timing reflects its own check, not its queue position. */
+typedef struct
+{
+    const char *filename;  // resolved DB file (symlink target if applicable)
+    const char *symlink;   // original path if it was a symlink, else NULL
+    char *symlink_target;  // owned copy backing 'filename'
+    pid_t pid;             // child pid, or -1 if no child was forked
+    FILE *output;          // captured child stdout (validate mode), or NULL
+    double start;
+    double seconds;
+    int result;
+} DiagnoseJob;
+
 size_t diagnose_files(
     const Seq *filenames,
     Seq **corrupt,
@@ -567,28 +585,32 @@ size_t diagnose_files(
 {
     size_t corruptions = 0;
     const size_t length = SeqLength(filenames);
+    const double total_start = now_seconds();
 
     if (corrupt != NULL)
     {
         *corrupt = SeqNew(length, free);
     }
 
+    DiagnoseJob *jobs = xcalloc(length, sizeof(DiagnoseJob));
+    size_t running = 0;
+
     for (size_t i = 0; i < length; ++i)
     {
-        const char *filename = SeqAt(filenames, i);
-        const char *symlink = NULL; // Only initialized because of gcc warning
-        int r = 0; // Only initialized because of LGTM alert
-        char *symlink_target = follow_symlink(filename);
+        DiagnoseJob *job = &jobs[i];
+        job->filename = SeqAt(filenames, i);
+        job->pid = -1;
+        job->symlink_target = follow_symlink(job->filename);
         bool broken_symlink_handled = false;
-        if (symlink_target != NULL)
+        if (job->symlink_target != NULL)
         {
-            symlink = filename;
+            job->symlink = job->filename;
             // If the LMDB file path is a symlink
-            filename = symlink_target;
-            if (access(symlink_target, F_OK) != 0)
+            job->filename = job->symlink_target;
+            if (access(job->symlink_target, F_OK) != 0)
             {
                 // Symlink target file does not exist
-                r = CF_CHECK_OK_DOES_NOT_EXIST;
+                job->result = CF_CHECK_OK_DOES_NOT_EXIST;
                 broken_symlink_handled = true;
             }
             // If this is not the case, continue repair as normal,
@@ -602,62 +624,138 @@ size_t diagnose_files(
         }
         else if (foreground)
         {
-            r = diagnose(filename, true, validate);
+            job->start = now_seconds();
+            int r = diagnose(job->filename, true, validate);
             if ((r == CF_CHECK_OK) && test_write)
             {
-                r = diagnose_write(filename);
+                r = diagnose_write(job->filename);
             }
+            job->result = r;
+            job->seconds = now_seconds() - job->start;
         }
         else
         {
-            r = fork_and_diagnose(filename, validate, test_write);
+            if (validate)
+            {
+                job->output = tmpfile();
+            }
+            job->start = now_seconds();
+            job->pid = fork_diagnose(
+                job->filename, validate, test_write, job->output);
+            if (job->pid < 0)
+            {
+                job->result = CF_CHECK_PID_ERROR;
+                job->pid = -1;
+            }
+            else
+            {
+                running += 1;
+            }
         }
+    }
 
-        if (symlink_target != NULL)
+    // Reap children in completion order:
+    while (running > 0)
+    {
+        int status;
+        const pid_t pid = wait(&status);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        for (size_t i = 0; i < length; ++i)
+        {
+            DiagnoseJob *job = &jobs[i];
+            if (job->pid != pid)
+            {
+                continue;
+            }
+            job->seconds = now_seconds() - job->start;
+            job->pid = -1;
+            if (WIFEXITED(status) && WEXITSTATUS(status) != CF_CHECK_OK)
+            {
+                job->result = WEXITSTATUS(status);
+            }
+            else if (WIFSIGNALED(status))
+            {
+                job->result = signal_to_cf_check_code(WTERMSIG(status));
+            }
+            break;
+        }
+        running -= 1;
+    }
+
+    // Report in the order the files were given, not completion order:
+    for (size_t i = 0; i < length; ++i)
+    {
+        DiagnoseJob *job = &jobs[i];
+        const int r = (job->pid == -1) ? job->result : CF_CHECK_PID_ERROR;
+
+        if (job->output != NULL)
+        {
+            rewind(job->output);
+            char buf[4096];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), job->output)) > 0)
+            {
+                fwrite(buf, 1, n, stdout);
+            }
+            fclose(job->output);
+        }
+
+        int usage = 0;
+        bool needs_rotation = lmdb_file_needs_rotation(job->filename, &usage);
+        if (job->symlink != NULL)
         {
-            int usage = 0;
-            bool needs_rotation = lmdb_file_needs_rotation(symlink_target, &usage);
             Log(LOG_LEVEL_INFO,
-                "Status of '%s' -> '%s': %s [%d%% usage%s]\n",
-                symlink,
-                symlink_target,
+                "Status of '%s' -> '%s': %s [%d%% usage%s] (%.2fs)\n",
+                job->symlink,
+                job->filename,
                 CF_CHECK_STRING(r),
                 usage,
-                needs_rotation ? ", needs rotation" : "");
+                needs_rotation ? ", needs rotation" : "",
+                job->seconds);
         }
         else
         {
-            int usage = 0;
-            bool needs_rotation = lmdb_file_needs_rotation(filename, &usage);
             Log(LOG_LEVEL_INFO,
-                "Status of '%s': %s [%d%% usage%s]\n",
-                filename,
+                "Status of '%s': %s [%d%% usage%s] (%.2fs)\n",
+                job->filename,
                 CF_CHECK_STRING(r),
                 usage,
-                needs_rotation ? ", needs rotation" : "");
+                needs_rotation ? ", needs rotation" : "",
+                job->seconds);
         }
 
-
         if (r != CF_CHECK_OK && r != CF_CHECK_OK_DOES_NOT_EXIST)
         {
             ++corruptions;
             if (corrupt != NULL)
             {
-                SeqAppend(*corrupt, xstrdup(filename));
+                SeqAppend(*corrupt, xstrdup(job->filename));
             }
         }
-        free(symlink_target);
+        free(job->symlink_target);
     }
+    free(jobs);
+
+    const double total_seconds = now_seconds() - total_start;
     if (corruptions == 0)
     {
-        Log(LOG_LEVEL_INFO, "All %zu databases healthy", length);
+        Log(LOG_LEVEL_INFO, "All %zu databases healthy (checked in %.2fs)",
+            length, total_seconds);
     }
     else
     {
         Log(LOG_LEVEL_ERR,
-            "Problems detected in %zu/%zu databases",
+            "Problems detected in %zu/%zu databases (checked in %.2fs)",
             corruptions,
-            length);
+            length,
+            total_seconds);
     }
     return corruptions;
 }
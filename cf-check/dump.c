@@ -6,6 +6,7 @@
 #include <string_lib.h>
 #include <json.h>
 #include <db_structs.h>
+#include <averages_pack.h>
 #include <utilities.h>
 #include <known_dirs.h> // GetStateDir() for usage printout
 #include <file_lib.h>   // FILE_SEPARATOR
@@ -162,18 +163,32 @@ static void print_struct_lock_data(
 static void print_struct_averages(
     const MDB_val value, const bool strip_strings, const char *tskey_filename)
 {
-    assert(sizeof(Averages) == value.mv_size);
-    if (sizeof(Averages) != value.mv_size)
+    // TODO: clean up Averages
+    Averages averages;
+    bool valid = false;
+    if (sizeof(Averages) == value.mv_size)
     {
-        // Fall back to simple printing in release builds:
+        // Raw struct, as written by cf_observations.lmdb and old history.lmdb:
+        memcpy(&averages, value.mv_data, sizeof(averages));
+        valid = true;
+    }
+    else
+    {
+        // Packed record, as newer history.lmdb entries are written:
+        valid = AveragesUnpackValues(
+            value.mv_data, value.mv_size, &averages.last_seen,
+            (double *) averages.Q,
+            CF_OBSERVABLES * (sizeof(QPoint) / sizeof(double)));
+    }
+
+    if (!valid)
+    {
+        // Fall back to simple printing:
         print_json_string(value.mv_data, value.mv_size, strip_strings);
     }
     else
     {
-        // TODO: clean up Averages
         char **obnames = NULL;
-        Averages averages;
-        memcpy(&averages, value.mv_data, sizeof(averages));
         const time_t last_seen = averages.last_seen;
 
         obnames = GetObservableNames(tskey_filename);
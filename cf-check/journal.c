@@ -0,0 +1,216 @@
+#include <platform.h> // #define LMDB
+#include <journal.h>
+#include <logging.h>
+
+#if defined(__MINGW32__) || !defined(LMDB)
+
+int sync_main(ARG_UNUSED int argc, ARG_UNUSED const char *const *const argv)
+{
+    Log(LOG_LEVEL_ERR,
+        "cf-check sync not available on this platform/build");
+    return 1;
+}
+
+#else
+
+#include <stdio.h>
+#include <lmdb.h>
+#include <diagnose.h>
+#include <string_lib.h>
+#include <alloc.h>
+
+/* NOTE: Must be in sync with LMDB_MAXSIZE in libpromises/dbm_lmdb.c. */
+#ifndef LMDB_MAXSIZE
+#define LMDB_MAXSIZE    104857600
+#endif
+
+static void print_usage(void)
+{
+    printf("Usage: cf-check sync JOURNAL_FILE DB_FILE\n");
+    printf("Example: cf-check sync cf_lastseen.lmdb.journal "
+           "/var/cfengine/state/cf_lastseen.lmdb\n");
+}
+
+/**
+ * Replay a database change journal (written by the LMDB backend when the
+ * journaling flag file is present, see libpromises/dbm_journal.h) into a
+ * database file.  Records are applied in order inside one write
+ * transaction; replaying the same journal twice converges to the same
+ * state, so partially shipped journals can simply be re-applied.
+ *
+ * @return CFCheckCode code
+ */
+static int apply_journal(const char *journal_file, const char *db_file)
+{
+    MDB_env *env = NULL;
+    MDB_txn *txn = NULL;
+    MDB_dbi dbi;
+    bool close_dbi = false;
+    char *key_buf = NULL;
+    char *value_buf = NULL;
+
+    int ret = 0;
+    int rc;
+
+    FILE *journal = fopen(journal_file, "rb");
+    if (journal == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Could not open journal file '%s' (fopen: %s)",
+            journal_file, GetErrorStr());
+        return lmdb_errno_to_cf_check_code(CF_CHECK_ERRNO_VALIDATE_FAILED);
+    }
+
+    Log(LOG_LEVEL_INFO, "Applying journal '%s' to '%s'",
+        journal_file, db_file);
+
+    rc = mdb_env_create(&env);
+    if (rc != 0)
+    {
+        ret = rc;
+        report_mdb_error(db_file, "mdb_env_create", rc);
+        goto cleanup;
+    }
+    mdb_env_set_mapsize(env, LMDB_MAXSIZE);
+
+    rc = mdb_env_open(env, db_file, MDB_NOSUBDIR, 0600);
+    if (rc != 0)
+    {
+        ret = rc;
+        report_mdb_error(db_file, "mdb_env_open", rc);
+        goto cleanup;
+    }
+
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc != 0)
+    {
+        ret = rc;
+        report_mdb_error(db_file, "mdb_txn_begin", rc);
+        goto cleanup;
+    }
+
+    rc = mdb_dbi_open(txn, NULL, MDB_CREATE, &dbi);
+    if (rc != 0)
+    {
+        ret = rc;
+        report_mdb_error(db_file, "mdb_dbi_open", rc);
+        goto cleanup;
+    }
+    else
+    {
+        close_dbi = true;
+    }
+
+    size_t applied = 0;
+    DBJournalRecord record;
+    while (fread(&record, sizeof(record), 1, journal) == 1)
+    {
+        if (record.magic != DB_JOURNAL_MAGIC)
+        {
+            Log(LOG_LEVEL_ERR,
+                "Bad record magic in journal '%s' after %zu records, "
+                "file truncated or damaged",
+                journal_file, applied);
+            ret = CF_CHECK_ERRNO_VALIDATE_FAILED;
+            break;
+        }
+
+        free(key_buf);
+        free(value_buf);
+        key_buf = xmalloc(record.key_size);
+        value_buf = (record.value_size > 0) ? xmalloc(record.value_size) : NULL;
+
+        if (fread(key_buf, 1, record.key_size, journal) != record.key_size ||
+            (record.value_size > 0 &&
+             fread(value_buf, 1, record.value_size, journal) != record.value_size))
+        {
+            Log(LOG_LEVEL_ERR,
+                "Short read in journal '%s' after %zu records, "
+                "file truncated or damaged",
+                journal_file, applied);
+            ret = CF_CHECK_ERRNO_VALIDATE_FAILED;
+            break;
+        }
+
+        MDB_val key = { .mv_size = record.key_size, .mv_data = key_buf };
+        if (record.op == DB_JOURNAL_OP_WRITE)
+        {
+            MDB_val data = { .mv_size = record.value_size, .mv_data = value_buf };
+            rc = mdb_put(txn, dbi, &key, &data, 0);
+            if (rc != MDB_SUCCESS)
+            {
+                report_mdb_error(db_file, "mdb_put", rc);
+                ret = rc;
+                break;
+            }
+        }
+        else if (record.op == DB_JOURNAL_OP_DELETE)
+        {
+            rc = mdb_del(txn, dbi, &key, NULL);
+            /* The entry may already be gone (journal replayed before): */
+            if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND)
+            {
+                report_mdb_error(db_file, "mdb_del", rc);
+                ret = rc;
+                break;
+            }
+        }
+        else
+        {
+            Log(LOG_LEVEL_ERR,
+                "Unknown operation '%c' in journal '%s' after %zu records",
+                record.op, journal_file, applied);
+            ret = CF_CHECK_ERRNO_VALIDATE_FAILED;
+            break;
+        }
+        applied++;
+    }
+
+    if (ret == 0)
+    {
+        rc = mdb_txn_commit(txn);
+        txn = NULL;
+        if (rc != MDB_SUCCESS)
+        {
+            report_mdb_error(db_file, "mdb_txn_commit", rc);
+            ret = rc;
+        }
+        else
+        {
+            Log(LOG_LEVEL_INFO, "Applied %zu journal records to '%s'",
+                applied, db_file);
+        }
+    }
+
+  cleanup:
+    free(key_buf);
+    free(value_buf);
+    fclose(journal);
+
+    if (txn != NULL)
+    {
+        mdb_txn_abort(txn);
+    }
+    if (close_dbi)
+    {
+        mdb_close(env, dbi);
+    }
+    if (env != NULL)
+    {
+        mdb_env_close(env);
+    }
+
+    ret = lmdb_errno_to_cf_check_code(ret);
+    return ret;
+}
+
+int sync_main(int argc, const char *const *const argv)
+{
+    if (argc != 3)
+    {
+        print_usage();
+        return 1;
+    }
+    return apply_journal(argv[1], argv[2]);
+}
+
+#endif /* LMDB */
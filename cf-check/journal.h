@@ -0,0 +1,26 @@
+#ifndef CF_CHECK_JOURNAL_H
+#define CF_CHECK_JOURNAL_H
+
+#include <stdint.h>
+
+/* On-disk database change journal record.
+ * NOTE: Must be kept in sync with DBJournalRecord in
+ * libpromises/dbm_journal.h (cf-check does not link against
+ * libpromises, same as db_structs.h). */
+
+#define DB_JOURNAL_MAGIC 0x4C4A4643 /* "CFJL" */
+
+#define DB_JOURNAL_OP_WRITE 'w'
+#define DB_JOURNAL_OP_DELETE 'd'
+
+typedef struct
+{
+    uint32_t magic;      // DB_JOURNAL_MAGIC, for resynchronization checks
+    uint8_t op;          // DB_JOURNAL_OP_WRITE or DB_JOURNAL_OP_DELETE
+    uint32_t key_size;   // number of key bytes following the header
+    uint32_t value_size; // number of value bytes following the key (0 for deletions)
+} DBJournalRecord;
+
+int sync_main(int argc, const char *const *argv);
+
+#endif
@@ -0,0 +1,167 @@
+#include <platform.h>
+#include <records.h>
+
+#include <known_dirs.h> // GetStateDir() for usage printout
+#include <file_lib.h>   // FILE_SEPARATOR
+#include <logging.h>
+
+#include <sys/mman.h>
+
+/* Reader for the columnar promise outcome files written per agent run by
+ * libpromises/run_record.c; the layout is documented in
+ * libpromises/run_record.h.  (cf-check does not link against libpromises,
+ * same as db_structs.h, so the format constants are repeated here.) */
+
+#define RUN_RECORD_MAGIC "CFRR"
+#define RUN_RECORD_VERSION 1
+#define RUN_RECORD_HEADER_SIZE 32
+
+static void print_usage(void)
+{
+    printf("Usage: cf-check records FILE [FILE ...]\n");
+    printf("\n");
+    printf("Prints one tab-separated line per promise outcome record:\n");
+    printf("timestamp, outcome character, duration in milliseconds, handle.\n");
+    printf("\n");
+    printf("Example: cf-check records %s%crun_records%crun-*.crr\n",
+           GetStateDir(), FILE_SEPARATOR, FILE_SEPARATOR);
+}
+
+static uint32_t GetLE32(const uint8_t *p)
+{
+    return (uint32_t) p[0] |
+           ((uint32_t) p[1] << 8) |
+           ((uint32_t) p[2] << 16) |
+           ((uint32_t) p[3] << 24);
+}
+
+static uint64_t GetLE64(const uint8_t *p)
+{
+    return (uint64_t) GetLE32(p) | ((uint64_t) GetLE32(p + 4) << 32);
+}
+
+/* The file stays mapped read-only; every offset is validated against the
+ * mapping size before use so a truncated or corrupt file is rejected
+ * instead of read out of bounds. */
+static int records_dump_file(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Could not open '%s' (open: %s)",
+            path, GetErrorStr());
+        return 1;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Could not stat '%s' (fstat: %s)",
+            path, GetErrorStr());
+        close(fd);
+        return 1;
+    }
+    const uint64_t size = (uint64_t) sb.st_size;
+
+    if (size < RUN_RECORD_HEADER_SIZE)
+    {
+        Log(LOG_LEVEL_ERR, "'%s' is too short to be a run record file", path);
+        close(fd);
+        return 1;
+    }
+
+    uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        Log(LOG_LEVEL_ERR, "Could not map '%s' (mmap: %s)",
+            path, GetErrorStr());
+        return 1;
+    }
+
+    int ret = 1;
+    if (memcmp(data, RUN_RECORD_MAGIC, strlen(RUN_RECORD_MAGIC)) != 0)
+    {
+        Log(LOG_LEVEL_ERR, "'%s' is not a run record file (bad magic)", path);
+        goto out;
+    }
+    if (data[4] != RUN_RECORD_VERSION)
+    {
+        Log(LOG_LEVEL_ERR, "'%s' has unsupported version %u",
+            path, (unsigned) data[4]);
+        goto out;
+    }
+
+    const uint64_t n = GetLE32(data + 8);
+    const uint64_t h = GetLE32(data + 12);
+
+    /* Column offsets, in the order the columns are laid out. */
+    const uint64_t timestamps = RUN_RECORD_HEADER_SIZE;
+    const uint64_t durations = timestamps + (n * 8);
+    const uint64_t handle_ids = durations + (n * 4);
+    const uint64_t outcomes = handle_ids + (n * 4);
+    const uint64_t strtab = (outcomes + n + 7) / 8 * 8;
+
+    if ((strtab + 4 + (h * 4)) > size)
+    {
+        Log(LOG_LEVEL_ERR, "'%s' is truncated", path);
+        goto out;
+    }
+
+    const uint64_t blob_size = GetLE32(data + strtab);
+    const uint64_t blob = strtab + 4 + (h * 4);
+    if ((blob + blob_size) > size ||
+        (blob_size > 0 && data[blob + blob_size - 1] != '\0'))
+    {
+        Log(LOG_LEVEL_ERR, "'%s' has a corrupt handle table", path);
+        goto out;
+    }
+
+    ret = 0;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        const uint64_t timestamp = GetLE64(data + timestamps + (i * 8));
+        const uint32_t duration = GetLE32(data + durations + (i * 4));
+        const uint32_t handle_id = GetLE32(data + handle_ids + (i * 4));
+        const char outcome = (char) data[outcomes + i];
+
+        const char *handle = "?";
+        if (handle_id < h)
+        {
+            const uint64_t offset =
+                GetLE32(data + strtab + 4 + (handle_id * 4));
+            if (offset < blob_size)
+            {
+                handle = (const char *) (data + blob + offset);
+            }
+        }
+
+        printf("%ju\t%c\t%u\t%s\n",
+               (uintmax_t) timestamp, outcome, duration, handle);
+    }
+
+out:
+    munmap(data, size);
+    return ret;
+}
+
+int records_main(int argc, const char *const *const argv)
+{
+    assert(argc >= 1);
+    if (argc < 2)
+    {
+        print_usage();
+        Log(LOG_LEVEL_ERR, "No file argument given");
+        return EXIT_FAILURE;
+    }
+
+    int ret = EXIT_SUCCESS;
+    for (int i = 1; i < argc; i++)
+    {
+        if (records_dump_file(argv[i]) != 0)
+        {
+            ret = EXIT_FAILURE;
+        }
+    }
+    return ret;
+}
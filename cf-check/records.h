@@ -0,0 +1,6 @@
+#ifndef CF_CHECK_RECORDS_H
+#define CF_CHECK_RECORDS_H
+
+int records_main(int argc, const char *const *argv);
+
+#endif
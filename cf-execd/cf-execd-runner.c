@@ -166,7 +166,7 @@ static bool IsReadReady(int fd, int timeout_sec)
 
 #endif  /* __MINGW32__ */
 
-void LocalExec(const ExecConfig *config)
+bool LocalExec(const ExecConfig *config)
 {
     time_t starttime = time(NULL);
 
@@ -222,7 +222,7 @@ void LocalExec(const ExecConfig *config)
     if (fp == NULL)
     {
         Log(LOG_LEVEL_ERR, "Couldn't open '%s' - aborting exec. (fopen: %s)", filename, GetErrorStr());
-        return;
+        return false;
     }
 
 /*
@@ -241,7 +241,7 @@ void LocalExec(const ExecConfig *config)
     {
         Log(LOG_LEVEL_ERR, "Couldn't open pipe to command '%s'. (cf_popen: %s)", cmd, GetErrorStr());
         fclose(fp);
-        return;
+        return false;
     }
 
     Log(LOG_LEVEL_VERBOSE, "Command is executing...%s", esc_command);
@@ -381,7 +381,7 @@ void LocalExec(const ExecConfig *config)
     }
 
     free(line);
-    cf_pclose(pp);
+    int exec_status = cf_pclose(pp);
     Log(LOG_LEVEL_VERBOSE,
         complete ? "Command is complete" : "Terminated command");
 
@@ -398,6 +398,14 @@ void LocalExec(const ExecConfig *config)
         unlink(filename);
         fclose(fp);
     }
+
+    if (complete && exec_status != 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Command returned non-zero status %d",
+            exec_status);
+    }
+
+    return complete && (exec_status == 0);
 }
 
 // Returns true if line is filtered, IOW should not be included.
@@ -27,7 +27,14 @@
 
 #include <exec-config.h>
 
-void LocalExec(const ExecConfig *config);
+/**
+ * Run #config->exec_command and capture its output.
+ *
+ * @return true if the command ran to completion and exited with status 0,
+ *         false if it could not be started, was terminated (termination
+ *         signal or agent_expireafter timeout) or exited non-zero.
+ */
+bool LocalExec(const ExecConfig *config);
 
 int ConnectToSmtpSocket(const ExecConfig *config);
 
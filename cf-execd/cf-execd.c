@@ -59,8 +59,12 @@
 #include <cleanup.h>
 #include <repair.h>
 #include <dbm_api.h>            /* CheckDBRepairFlagFile() */
+#include <locks.h>              /* PurgeLocks() */
+#include <lastseen.h>           /* LastSeenPurgeStale() */
+#include <tree_watch.h>         /* TreeWatchDaemonStart() */
 #include <string_lib.h>
 #include <acl_tools.h>          /* AllowAccessForUsers() */
+#include <module_pool.h>        /* ModulePool*() */
 
 #include <cf-windows-functions.h>
 
@@ -83,6 +87,13 @@ static char *RUNAGENT_SOCKET_DIR = NULL;
 
 static pthread_attr_t threads_attrs; /* GLOBAL_T, initialized by pthread_attr_init */
 
+/* Set when the last agent run did not complete cleanly (exec_command could
+ * not be started, timed out, or exited non-zero): ScheduleRun() then triggers
+ * one early re-run on the next pulse instead of waiting for the next schedule
+ * class, so a host that failed to converge is retried quickly. Promise locks
+ * (ifelapsed) on the agent side keep the extra run cheap. */
+static bool RERUN_PENDING = false; /* GLOBAL_X */
+
 /*******************************************************************/
 
 static GenericAgentConfig *CheckOpts(int argc, char **argv);
@@ -469,7 +480,8 @@ static inline bool UsingRunagentSocket()
  * @return Whether to terminate (skip any further actions) or not.
  */
 static bool HandleRequestsOrSleep(time_t seconds, const char *reason,
-                                  int runagent_socket, const char *local_run_command)
+                                  int runagent_socket, int module_pool_socket,
+                                  const char *local_run_command)
 {
     if (IsPendingTermination())
     {
@@ -478,7 +490,7 @@ static bool HandleRequestsOrSleep(time_t seconds, const char *reason,
 
     Log(LOG_LEVEL_VERBOSE, "Sleeping for %s %ju seconds", reason, (intmax_t) seconds);
 
-    if (runagent_socket >= 0)
+    if ((runagent_socket >= 0) || (module_pool_socket >= 0))
     {
         time_t sleep_started = time(NULL);
         struct timeval remaining = {seconds, 0};
@@ -486,9 +498,17 @@ static bool HandleRequestsOrSleep(time_t seconds, const char *reason,
         {
             fd_set rfds;
             FD_ZERO(&rfds);
-            FD_SET(runagent_socket, &rfds);
+            if (runagent_socket >= 0)
+            {
+                FD_SET(runagent_socket, &rfds);
+            }
+            if (module_pool_socket >= 0)
+            {
+                FD_SET(module_pool_socket, &rfds);
+            }
 
-            int ret = select(runagent_socket + 1, &rfds, NULL, NULL, &remaining);
+            int ret = select(MAX(runagent_socket, module_pool_socket) + 1,
+                             &rfds, NULL, NULL, &remaining);
             if ((ret == -1) && (errno != EINTR))
             {
                 /* unexpected error */
@@ -511,9 +531,9 @@ static bool HandleRequestsOrSleep(time_t seconds, const char *reason,
                     return true;
                 }
 
-                if (ret > 0)
+                if ((ret > 0) && (runagent_socket >= 0) &&
+                    FD_ISSET(runagent_socket, &rfds))
                 {
-                    assert(FD_ISSET(runagent_socket, &rfds));
                     int data_socket = accept(runagent_socket, NULL, NULL);
                     pid_t pid = fork();
                     if (pid == 0)
@@ -532,6 +552,19 @@ static bool HandleRequestsOrSleep(time_t seconds, const char *reason,
                     /* parent: nothing more to do, go back to sleep */
                 }
 
+                if ((ret > 0) && (module_pool_socket >= 0) &&
+                    FD_ISSET(module_pool_socket, &rfds))
+                {
+                    /* Handled in the main process: it must hold the pooled
+                     * module descriptors across agent runs. */
+                    int data_socket = accept(module_pool_socket, NULL, NULL);
+                    if (data_socket >= 0)
+                    {
+                        ModulePoolHandleRequest(data_socket);
+                        close(data_socket);
+                    }
+                }
+
                 remaining.tv_sec = MAX(0, seconds - (time(NULL) - sleep_started));
             }
         }
@@ -551,24 +584,57 @@ static bool HandleRequestsOrSleep(time_t seconds, const char *reason,
     return false;
 }
 
+/* How often the main loop purges stale locks and lastseen entries.  The
+ * purges are incremental (each only deletes entries past its horizon), so
+ * running them a few times a day keeps the databases at steady-state size
+ * without noticeable pauses. */
+#define CF_EXECD_DB_MAINTENANCE_INTERVAL (6 * SECONDS_PER_HOUR)
+
+static void MaintainStateDatabases(void)
+{
+    Log(LOG_LEVEL_VERBOSE, "Performing scheduled state database maintenance");
+    PurgeLocks();
+    LastSeenPurgeStale(LASTSEENEXPIREAFTER);
+}
+
 // Non-windows version of main loop:
 static void CFExecdMainLoop(EvalContext *ctx, Policy **policy, GenericAgentConfig *config,
                             ExecdConfig **execd_config, ExecConfig **exec_config,
-                            int runagent_socket)
+                            int runagent_socket, int module_pool_socket)
 {
     bool terminate = false;
+    pid_t local_exec_pid = -1;
+    time_t last_db_maintenance = 0;
     while (!IsPendingTermination())
     {
+        if (time(NULL) - last_db_maintenance >= CF_EXECD_DB_MAINTENANCE_INTERVAL)
+        {
+            MaintainStateDatabases();
+            last_db_maintenance = time(NULL);
+        }
+
+        /* heartbeat: drop pooled promise modules whose process died */
+        ModulePoolMaintain();
+
         /* reap child processes (if any) */
-        while (waitpid(-1, NULL, WNOHANG) > 0)
+        pid_t reaped_pid;
+        int reaped_status;
+        while ((reaped_pid = waitpid(-1, &reaped_status, WNOHANG)) > 0)
         {
             Log(LOG_LEVEL_DEBUG, "Reaped child process");
+            if (reaped_pid == local_exec_pid)
+            {
+                RERUN_PENDING = (!WIFEXITED(reaped_status) ||
+                                 (WEXITSTATUS(reaped_status) != 0));
+                local_exec_pid = -1;
+            }
         }
 
         if (ScheduleRun(ctx, policy, config, execd_config, exec_config))
         {
             terminate = HandleRequestsOrSleep((*execd_config)->splay_time, "splay time",
-                                              runagent_socket, (*execd_config)->local_run_command);
+                                              runagent_socket, module_pool_socket,
+                                              (*execd_config)->local_run_command);
             if (terminate)
             {
                 break;
@@ -578,11 +644,16 @@ static void CFExecdMainLoop(EvalContext *ctx, Policy **policy, GenericAgentConfi
             {
                 Log(LOG_LEVEL_INFO,
                     "Unable to run agent in a fork, falling back to blocking execution");
-                LocalExec(*exec_config);
+                RERUN_PENDING = !LocalExec(*exec_config);
+            }
+            else
+            {
+                local_exec_pid = child_pid;
             }
         }
         /* 1 Minute resolution is enough */
         terminate = HandleRequestsOrSleep(GetPulseTime(), "pulse time", runagent_socket,
+                                          module_pool_socket,
                                           (*execd_config)->local_run_command);
         if (terminate)
         {
@@ -599,6 +670,13 @@ static void CFExecdMainLoop(EvalContext *ctx, Policy **policy, GenericAgentConfi
             unlink(sock_info.sun_path);
         }
     }
+
+    /* Terminate pooled promise modules and remove the pool socket. */
+    if (module_pool_socket >= 0)
+    {
+        ModulePoolShutdown();
+        close(module_pool_socket);
+    }
 }
 
 static inline bool GetRunagentSocketInfo(struct sockaddr_un *sock_info)
@@ -720,7 +798,8 @@ static inline unsigned int MaybeSleepLog(LogLevel level, const char *msg_format,
 // Windows version of main loop:
 static void CFExecdMainLoop(EvalContext *ctx, Policy **policy, GenericAgentConfig *config,
                             ExecdConfig **execd_config, ExecConfig **exec_config,
-                            ARG_UNUSED int runagent_socket)
+                            ARG_UNUSED int runagent_socket,
+                            ARG_UNUSED int module_pool_socket)
 {
     while (!IsPendingTermination())
     {
@@ -740,7 +819,7 @@ static void CFExecdMainLoop(EvalContext *ctx, Policy **policy, GenericAgentConfi
             {
                 Log(LOG_LEVEL_INFO,
                     "Unable to run agent in thread, falling back to blocking execution");
-                LocalExec(*exec_config);
+                RERUN_PENDING = !LocalExec(*exec_config);
             }
         }
         // This is not just a log message, it maybe sleeps and maybe logs something:
@@ -798,12 +877,18 @@ void StartServer(EvalContext *ctx, Policy *policy, GenericAgentConfig *config, E
     umask(077);
 
     int runagent_socket = -1;
+    int module_pool_socket = -1;
 
 #ifndef __MINGW32__
     if (UsingRunagentSocket())
     {
         runagent_socket = SetupRunagentSocket(*execd_config);
     }
+    if (!ONCE)
+    {
+        /* Holds resident promise modules between agent runs. */
+        module_pool_socket = ModulePoolSetupSocket();
+    }
 #endif
 
     if (ONCE)
@@ -813,7 +898,12 @@ void StartServer(EvalContext *ctx, Policy *policy, GenericAgentConfig *config, E
     }
     else
     {
-        CFExecdMainLoop(ctx, &policy, config, execd_config, exec_config, runagent_socket);
+        /* Watch file trees registered by agent runs (body depth_search
+         * monitor) so subsequent runs can skip scanning unchanged ones. */
+        TreeWatchDaemonStart();
+
+        CFExecdMainLoop(ctx, &policy, config, execd_config, exec_config,
+                        runagent_socket, module_pool_socket);
     }
     PolicyDestroy(policy);
 }
@@ -834,10 +924,11 @@ static pid_t LocalExecInFork(const ExecConfig *config)
     }
     else if (pid == 0)
     {
-        /* child */
-        LocalExec(config);
+        /* child: pass the run's outcome up through the exit status so the
+         * main loop can schedule an early re-run after a failed run */
+        bool success = LocalExec(config);
         Log(LOG_LEVEL_VERBOSE, "Finished exec_command execution, terminating the forked process");
-        _exit(0);
+        _exit(success ? 0 : 1);
     }
     else
     {
@@ -850,7 +941,9 @@ static pid_t LocalExecInFork(const ExecConfig *config)
 static void *LocalExecThread(void *param)
 {
     ExecConfig *config = (ExecConfig *) param;
-    LocalExec(config);
+    /* Unsynchronized write of a plain bool read by the main loop: worst case
+     * the early re-run happens one pulse later, which is harmless. */
+    RERUN_PENDING = !LocalExec(config);
     ExecConfigDestroy(config);
 
     Log(LOG_LEVEL_VERBOSE, "Finished exec_command execution, terminating thread");
@@ -1075,11 +1168,21 @@ static bool ScheduleRun(EvalContext *ctx, Policy **policy, GenericAgentConfig *c
             if (IsDefinedClass(ctx, time_context))
             {
                 Log(LOG_LEVEL_VERBOSE, "Waking up the agent at %s ~ %s", ctime(&CFSTARTTIME), time_context);
+                RERUN_PENDING = false;
                 return true;
             }
         }
     }
 
+    if (RERUN_PENDING)
+    {
+        RERUN_PENDING = false;
+        Log(LOG_LEVEL_VERBOSE,
+            "Previous agent run did not complete cleanly, waking up the agent early at %s",
+            ctime(&CFSTARTTIME));
+        return true;
+    }
+
     Log(LOG_LEVEL_VERBOSE, "Nothing to do at %s", ctime(&CFSTARTTIME));
     return false;
 }
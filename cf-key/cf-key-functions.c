@@ -40,6 +40,9 @@
 #include <crypto.h>
 #include <file_lib.h>
 #include <known_dirs.h>
+#include <sequence.h>
+#include <string_lib.h>
+#include <writer.h>
 
 
 /*****************************************************************************/
@@ -229,7 +232,31 @@ int RemoveKeys(const char *input, bool must_be_coherent)
     return -1;
 }
 
-static bool KeepKeyPromisesRSA(RSA *pair, const char *public_key_file, const char *private_key_file)
+static bool WriteRandseed(void)
+{
+    char vbuff[CF_BUFSIZE];
+    snprintf(vbuff, CF_BUFSIZE, "%s%crandseed", GetWorkDir(), FILE_SEPARATOR);
+    Log(LOG_LEVEL_VERBOSE, "Using '%s' for randseed", vbuff);
+
+    if (RAND_write_file(vbuff) != 1024)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to write randseed");
+        unlink(vbuff); /* randseed isn't safe to use */
+        return false;
+    }
+
+    if (chmod(vbuff, 0600) != 0)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Unable to set permissions on '%s' (chmod: %s)",
+            vbuff, GetErrorStr());
+        return false;
+    }
+
+    return true;
+}
+
+static bool WriteKeyPairFiles(RSA *pair, const char *public_key_file, const char *private_key_file)
 {
     FILE *fp = safe_fopen_create_perms(private_key_file, "w", 0600);
     if (fp == NULL)
@@ -274,26 +301,45 @@ static bool KeepKeyPromisesRSA(RSA *pair, const char *public_key_file, const cha
 
     fclose(fp);
 
-    char vbuff[CF_BUFSIZE];
-    snprintf(vbuff, CF_BUFSIZE, "%s%crandseed", GetWorkDir(), FILE_SEPARATOR);
-    Log(LOG_LEVEL_VERBOSE, "Using '%s' for randseed", vbuff);
+    return true;
+}
 
-    if (RAND_write_file(vbuff) != 1024)
+static bool KeepKeyPromisesRSA(RSA *pair, const char *public_key_file, const char *private_key_file)
+{
+    if (!WriteKeyPairFiles(pair, public_key_file, private_key_file))
     {
-        Log(LOG_LEVEL_ERR, "Unable to write randseed");
-        unlink(vbuff); /* randseed isn't safe to use */
         return false;
     }
 
-    if (chmod(vbuff, 0600) != 0)
+    return WriteRandseed();
+}
+
+static RSA *GenerateRSAKeyPair(const int key_size)
+{
+    RSA *pair = RSA_new();
+    BIGNUM *rsa_bignum = BN_new();
+    if (pair != NULL && rsa_bignum != NULL)
     {
-        Log(LOG_LEVEL_ERR,
-            "Unable to set permissions on '%s' (chmod: %s)",
-            vbuff, GetErrorStr());
-        return false;
+        BN_set_word(rsa_bignum, RSA_F4);
+        int res = RSA_generate_key_ex(pair, key_size, rsa_bignum, NULL);
+        if (res == 0)
+        {
+            DESTROY_AND_NULL(RSA_free, pair); // pair = NULL
+        }
+    }
+    else
+    {
+        DESTROY_AND_NULL(RSA_free, pair); // pair = NULL
     }
 
-    return true;
+    BN_clear_free(rsa_bignum);
+
+    if (pair == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to generate cryptographic key (RSA_generate_key: %s)",
+            CryptoLastErrorString());
+    }
+    return pair;
 }
 
 bool KeepKeyPromises(const char *public_key_file, const char *private_key_file, const int key_size)
@@ -314,33 +360,261 @@ bool KeepKeyPromises(const char *public_key_file, const char *private_key_file,
 
     Log(LOG_LEVEL_INFO, "Making a key pair for CFEngine, please wait, this could take a minute...");
 
-    RSA *pair = RSA_new();
-    BIGNUM *rsa_bignum = BN_new();
-    if (pair != NULL && rsa_bignum != NULL)
+    RSA *pair = GenerateRSAKeyPair(key_size);
+    if (pair == NULL)
     {
-        BN_set_word(rsa_bignum, RSA_F4);
-        int res = RSA_generate_key_ex(pair, key_size, rsa_bignum, NULL);
-        if (res == 0)
+        return false;
+    }
+    bool ret = KeepKeyPromisesRSA(pair, public_key_file, private_key_file);
+    RSA_free(pair);
+    return ret;
+}
+
+/*****************************************************************************/
+/* Batch operations                                                          */
+/*****************************************************************************/
+
+typedef struct
+{
+    pthread_t t_id;
+    const Seq *paths;           /* shared, read-only */
+    size_t *next_index;         /* shared, under batch_keygen_lock */
+    int key_size;
+    size_t generated;
+    size_t skipped;
+    bool failed;
+} BatchKeygenWorker;
+
+static pthread_mutex_t batch_keygen_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Pull paths off the shared work list and generate one key pair per path.
+ * RSA_generate_key_ex() is safe to run concurrently on independent RSA
+ * structures, so the workers only synchronize on the list index.
+ */
+static void *BatchKeygenWorkerRun(void *arg)
+{
+    BatchKeygenWorker *worker = arg;
+
+    while (true)
+    {
+        pthread_mutex_lock(&batch_keygen_lock);
+        const size_t index = (*worker->next_index)++;
+        pthread_mutex_unlock(&batch_keygen_lock);
+
+        if (index >= SeqLength(worker->paths))
         {
-            DESTROY_AND_NULL(RSA_free, pair); // pair = NULL
+            return NULL;
+        }
+        const char *path = SeqAt(worker->paths, index);
+
+        char *public_key_file, *private_key_file;
+        xasprintf(&public_key_file, "%s.pub", path);
+        xasprintf(&private_key_file, "%s.priv", path);
+
+        struct stat statbuf;
+        if (stat(public_key_file, &statbuf) != -1 ||
+            stat(private_key_file, &statbuf) != -1)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Skipping '%s': a key file already exists", path);
+            worker->skipped++;
+            free(public_key_file);
+            free(private_key_file);
+            continue;
+        }
+
+        RSA *pair = GenerateRSAKeyPair(worker->key_size);
+        if (pair == NULL ||
+            !WriteKeyPairFiles(pair, public_key_file, private_key_file))
+        {
+            worker->failed = true;
+        }
+        else
+        {
+            worker->generated++;
         }
+
+        RSA_free(pair);
+        free(public_key_file);
+        free(private_key_file);
     }
-    else
+
+    return NULL;
+}
+
+bool BatchKeyGeneration(const char *list_file, int jobs, const int key_size)
+{
+    assert(list_file != NULL);
+
+    Writer *contents = FileRead(list_file, SIZE_MAX, NULL);
+    if (contents == NULL)
     {
-        DESTROY_AND_NULL(RSA_free, pair); // pair = NULL
+        Log(LOG_LEVEL_ERR, "Error reading key list file '%s'", list_file);
+        return false;
     }
+    char *data = StringWriterClose(contents);
+    Seq *lines = SeqStringFromString(data, '\n');
+    free(data);
 
-    BN_clear_free(rsa_bignum);
+    /* drop empty lines (e.g. the one after a trailing newline) */
+    Seq *paths = SeqNew(SeqLength(lines), free);
+    for (size_t i = 0; i < SeqLength(lines); i++)
+    {
+        const char *line = SeqAt(lines, i);
+        if (!NULL_OR_EMPTY(line))
+        {
+            SeqAppend(paths, xstrdup(line));
+        }
+    }
+    SeqDestroy(lines);
 
-    if (pair == NULL)
+    if (SeqLength(paths) == 0)
     {
-        Log(LOG_LEVEL_ERR, "Unable to generate cryptographic key (RSA_generate_key: %s)",
-            CryptoLastErrorString());
+        Log(LOG_LEVEL_ERR, "Key list file '%s' contained no paths", list_file);
+        SeqDestroy(paths);
         return false;
     }
-    bool ret = KeepKeyPromisesRSA(pair, public_key_file, private_key_file);
-    RSA_free(pair);
-    return ret;
+
+    if (jobs < 1)
+    {
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+        jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if (jobs < 1)
+        {
+            jobs = 1;
+        }
+    }
+    if ((size_t) jobs > SeqLength(paths))
+    {
+        jobs = SeqLength(paths);
+    }
+
+    Log(LOG_LEVEL_INFO,
+        "Making %zu key pairs for CFEngine on %d thread(s),"
+        " please wait, this could take a while...",
+        SeqLength(paths), jobs);
+
+    size_t next_index = 0;
+    BatchKeygenWorker *workers = xcalloc(jobs, sizeof(BatchKeygenWorker));
+    int launched = 0;
+    for (int i = 0; i < jobs; i++)
+    {
+        workers[i].paths = paths;
+        workers[i].next_index = &next_index;
+        workers[i].key_size = key_size;
+
+        int ret = pthread_create(&workers[i].t_id, NULL,
+                                 BatchKeygenWorkerRun, &workers[i]);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to create key generation thread: %s",
+                GetErrorStrFromCode(ret));
+            break;
+        }
+        launched++;
+    }
+
+    size_t generated = 0, skipped = 0;
+    bool failed = (launched == 0);
+    for (int i = 0; i < launched; i++)
+    {
+        pthread_join(workers[i].t_id, NULL);
+        generated += workers[i].generated;
+        skipped += workers[i].skipped;
+        failed = failed || workers[i].failed;
+    }
+    free(workers);
+    SeqDestroy(paths);
+
+    /* The workers share one entropy pool, reseed the file once at the end
+     * rather than once per key. */
+    if (generated > 0 && !WriteRandseed())
+    {
+        failed = true;
+    }
+
+    Log(LOG_LEVEL_INFO,
+        "Generated %zu key pair(s), skipped %zu existing", generated, skipped);
+    return !failed;
+}
+
+bool TrustDirImport(const char *dir_path)
+{
+    assert(dir_path != NULL);
+
+    Dir *dirh = DirOpen(dir_path);
+    if (dirh == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to open key directory '%s' (opendir: %s)",
+            dir_path, GetErrorStr());
+        return false;
+    }
+
+    size_t imported = 0, failures = 0;
+    for (const struct dirent *dirp = DirRead(dirh); dirp != NULL;
+         dirp = DirRead(dirh))
+    {
+        if (!StringEndsWith(dirp->d_name, ".pub"))
+        {
+            continue;
+        }
+
+        char filename[PATH_MAX];
+        int ret = snprintf(filename, sizeof(filename), "%s%c%s",
+                           dir_path, FILE_SEPARATOR, dirp->d_name);
+        if (ret < 0 || (size_t) ret >= sizeof(filename))
+        {
+            Log(LOG_LEVEL_ERR, "Key file path too long: %s%c%s",
+                dir_path, FILE_SEPARATOR, dirp->d_name);
+            failures++;
+            continue;
+        }
+
+        /* The base name carries the same "[user@]ipaddr" information as the
+         * --trust-key argument, e.g. "203.0.113.1.pub" or
+         * "admin@203.0.113.1.pub". */
+        char *base = xstrdup(dirp->d_name);
+        base[strlen(base) - strlen(".pub")] = '\0';
+
+        char *username = "root";
+        char *ipaddr = base;
+        char *s = strchr(base, '@');
+        if (s != NULL)
+        {
+            *s = '\0';
+            username = base;
+            ipaddr = s + 1;
+        }
+        if (NULL_OR_EMPTY(ipaddr))
+        {
+            ipaddr = NULL;
+        }
+
+        if (TrustKey(filename, ipaddr, username))
+        {
+            imported++;
+        }
+        else
+        {
+            Log(LOG_LEVEL_ERR, "Failed to trust key file '%s'", filename);
+            failures++;
+        }
+        free(base);
+    }
+    DirClose(dirh);
+
+    if (imported == 0 && failures == 0)
+    {
+        Log(LOG_LEVEL_ERR, "No public key files (*.pub) found in '%s'",
+            dir_path);
+        return false;
+    }
+
+    Log(LOG_LEVEL_INFO, "Imported %zu key(s) from '%s', %zu failure(s)",
+        imported, dir_path, failures);
+    return (failures == 0);
 }
 
 
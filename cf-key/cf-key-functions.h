@@ -47,6 +47,8 @@ void ParseKeyArg(char *keyarg, char **filename, char **ipaddr, char **username);
 void ShowLastSeenHosts(bool truncate);
 int RemoveKeys(const char *input, bool must_be_coherent);
 bool KeepKeyPromises(const char *public_key_file, const char *private_key_file, const int key_size);
+bool BatchKeyGeneration(const char *list_file, int jobs, const int key_size);
+bool TrustDirImport(const char *dir_path);
 int ForceKeyRemoval(const char *key);
 int ForceIpAddressRemoval(const char *ip);
 
@@ -55,6 +55,9 @@ char LICENSE_SOURCE[MAX_FILENAME] = "";                         /* GLOBAL_A */
 const char *remove_keys_host = NULL;                            /* GLOBAL_A */
 static char *print_digest_arg = NULL;                           /* GLOBAL_A */
 static char *trust_key_arg = NULL;                              /* GLOBAL_A */
+static char *trust_dir_arg = NULL;                              /* GLOBAL_A */
+static char *batch_keygen_arg = NULL;                           /* GLOBAL_A */
+static int BATCH_JOBS = 0;                                      /* GLOBAL_A */
 static char *KEY_PATH = NULL;                                   /* GLOBAL_A */
 static int KEY_SIZE = 2048;                                     /* GLOBAL_A */
 bool LOOKUP_HOSTS = true;                                       /* GLOBAL_A */
@@ -96,6 +99,9 @@ static const struct option OPTIONS[] =
     {"install-license", required_argument, 0, 'l'},
     {"print-digest", optional_argument, 0, 'p'},
     {"trust-key", required_argument, 0, 't'},
+    {"trust-dir", required_argument, 0, 'D'},
+    {"batch-keygen", required_argument, 0, 'b'},
+    {"jobs", required_argument, 0, 'j'},
     {"color", optional_argument, 0, 'C'},
     {"timestamp", no_argument, 0, TIMESTAMP_VAL},
     {"numeric", no_argument, 0, 'n'},
@@ -119,6 +125,9 @@ static const char *const HINTS[] =
     "Install license file on Enterprise server (CFEngine Enterprise Only)",
     "Print digest of the specified public key",
     "Make cf-serverd/cf-agent trust the specified public key. Argument value is of the form [[USER@]IPADDR:]FILENAME where FILENAME is the local path of the public key for client at IPADDR address.",
+    "Make cf-serverd/cf-agent trust every public key (*.pub) in the specified directory in one pass. File names of the form [USER@]IPADDR.pub also record a lastseen entry for IPADDR.",
+    "Generate key pairs in bulk. Argument is a file with one output path per line; each line gets a PATH.priv/PATH.pub pair, generated in parallel (see --jobs). Existing key files are skipped.",
+    "Number of threads to use for --batch-keygen. Defaults to the number of CPUs.",
     "Enable colorized output. Possible values: 'always', 'auto', 'never'. If option is used, the default value is 'auto'",
     "Log timestamps on each line of log output",
     "Do not lookup host names",
@@ -243,6 +252,22 @@ int main(int argc, char *argv[])
         return ret ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
+    if (trust_dir_arg != NULL)
+    {
+        bool ret = TrustDirImport(trust_dir_arg);
+        GenericAgentFinalize(ctx, config);
+        CallCleanupFunctions();
+        return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (batch_keygen_arg != NULL)
+    {
+        bool ret = BatchKeyGeneration(batch_keygen_arg, BATCH_JOBS, KEY_SIZE);
+        GenericAgentFinalize(ctx, config);
+        CallCleanupFunctions();
+        return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     char *public_key_file, *private_key_file;
 
     if (KEY_PATH)
@@ -284,7 +309,7 @@ static GenericAgentConfig *CheckOpts(int argc, char **argv)
     int c;
     GenericAgentConfig *config = GenericAgentConfigNewDefault(AGENT_TYPE_KEYGEN, GetTTYInteractive());
 
-    while ((c = getopt_long(argc, argv, "dvIf:g:T:VMp::sNr:xt:hl:C::n",
+    while ((c = getopt_long(argc, argv, "dvIf:g:T:VMp::sNr:xt:D:b:j:hl:C::n",
                             OPTIONS, NULL))
            != -1)
     {
@@ -360,6 +385,18 @@ static GenericAgentConfig *CheckOpts(int argc, char **argv)
             trust_key_arg = optarg;
             break;
 
+        case 'D':
+            trust_dir_arg = optarg;
+            break;
+
+        case 'b':
+            batch_keygen_arg = optarg;
+            break;
+
+        case 'j':
+            BATCH_JOBS = StringToLongExitOnError(optarg);
+            break;
+
         case 'h':
             PrintHelp();
             GenericAgentConfigDestroy(config);
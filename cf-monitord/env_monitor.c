@@ -105,8 +105,8 @@ static void ArmClasses(EvalContext *ctx, const Averages *newvals);
 static void GatherPromisedMeasures(EvalContext *ctx, const Policy *policy);
 
 static void LeapDetection(void);
-static Averages *GetCurrentAverages(char *timekey);
-static void UpdateAverages(EvalContext *ctx, char *timekey, const Averages *newvals);
+static Averages *GetCurrentAverages(CF_DB *dbp, char *timekey);
+static void UpdateAverages(CF_DB *dbp, char *timekey, const Averages *newvals);
 static void UpdateDistributions(EvalContext *ctx, char *timekey, Averages *av);
 static double WAverage(double new_val, double old_val, double age);
 static double SetClasses(EvalContext *ctx, char *name, double variable, double av_expect, double av_var, double localav_expect,
@@ -371,12 +371,18 @@ static Averages EvalAvQ(EvalContext *ctx, char *t)
 
     Banner("Evaluating and storing new weekly averages");
 
-    if ((lastweek_vals = GetCurrentAverages(t)) == NULL)
+    /* One database transaction covers the whole read-modify-write cycle of a
+     * sample, instead of separate open/commit rounds for reading last week's
+     * slot and writing the new one. */
+    CF_DB *dbp;
+    if (!OpenDB(&dbp, dbid_observations))
     {
         Log(LOG_LEVEL_ERR, "Error reading average database");
         DoCleanupAndExit(EXIT_FAILURE);
     }
 
+    lastweek_vals = GetCurrentAverages(dbp, t);
+
 /* Discard any apparently anomalous behaviour before renormalizing database */
 
     for (i = 0; i < CF_OBSERVABLES; i++)
@@ -465,7 +471,10 @@ static Averages EvalAvQ(EvalContext *ctx, char *t)
         }
     }
 
-    UpdateAverages(ctx, t, &newvals);
+    UpdateAverages(dbp, t, &newvals);
+    CloseDB(dbp);
+
+    HistoryUpdate(ctx, &newvals);
     UpdateDistributions(ctx, t, lastweek_vals);        /* Distribution about mean */
 
     return newvals;
@@ -726,16 +735,10 @@ static void ArmClasses(EvalContext *ctx, const Averages *const av)
 
 /*****************************************************************************/
 
-static Averages *GetCurrentAverages(char *timekey)
+static Averages *GetCurrentAverages(CF_DB *dbp, char *timekey)
 {
-    CF_DB *dbp;
     static Averages entry; /* No need to initialize */
 
-    if (!OpenDB(&dbp, dbid_observations))
-    {
-        return NULL;
-    }
-
     memset(&entry, 0, sizeof(entry));
 
     AGE++;
@@ -755,29 +758,19 @@ static Averages *GetCurrentAverages(char *timekey)
         Log(LOG_LEVEL_DEBUG, "No previous value for time index '%s'", timekey);
     }
 
-    CloseDB(dbp);
     return &entry;
 }
 
 /*****************************************************************************/
 
-static void UpdateAverages(EvalContext *ctx, char *timekey, const Averages *const newvals)
+static void UpdateAverages(CF_DB *dbp, char *timekey, const Averages *const newvals)
 {
     assert(newvals != NULL);
-    CF_DB *dbp;
-
-    if (!OpenDB(&dbp, dbid_observations))
-    {
-        return;
-    }
 
     Log(LOG_LEVEL_INFO, "Updated averages at '%s'", timekey);
 
     WriteDB(dbp, timekey, newvals, sizeof(Averages));
     WriteDB(dbp, "DATABASE_AGE", &AGE, sizeof(double));
-
-    CloseDB(dbp);
-    HistoryUpdate(ctx, newvals);
 }
 
 static int Day2Number(const char *datestring)
@@ -26,6 +26,7 @@
 #include <history.h>
 
 #include <monitoring.h>                                      /* MakeTimekey */
+#include <monitoring_read.h>                            /* PutRecordForTime */
 #include <actuator.h>
 #include <promises.h>
 #include <ornaments.h>
@@ -65,15 +66,6 @@ typedef struct
 static int MONITOR_RESTARTED = true;
 static CustomMeasurement ENTERPRISE_DATA[CF_DUNBAR_WORK];
 
-static void PutRecordForTime(CF_DB *db, time_t time, const Averages *values)
-{
-    char timekey[CF_MAXVARSIZE];
-
-    MakeTimekey(time, timekey);
-
-    WriteDB(db, timekey, values, sizeof(Averages));
-}
-
 static void Nova_SaveFilePosition(const char *handle, const char *name, long fileptr)
 {
     CF_DB *dbp;
@@ -31,6 +31,7 @@
 #include <pipes.h>
 #include <systype.h>
 #include <known_dirs.h>
+#include <unix.h>                                            /* GetUserName */
 
 #include <cf-windows-functions.h>
 
@@ -74,8 +75,117 @@ void MonProcessesGatherData(double *cf_this)
 
 #ifndef __MINGW32__
 
+#ifdef __linux__
+
+/* Resolved uid -> username mappings, kept across samples: distinct uids
+ * stay few even with thousands of processes, and each resolution can be an
+ * NSS or LDAP round trip. cf-monitord samples single-threaded. */
+typedef struct
+{
+    uid_t uid;
+    char name[64];
+} UidName;
+
+static Seq *UID_NAMES = NULL;                                   /* GLOBAL_X */
+
+static const char *GetCachedUserName(uid_t uid)
+{
+    if (UID_NAMES == NULL)
+    {
+        UID_NAMES = SeqNew(16, free);
+    }
+
+    const size_t length = SeqLength(UID_NAMES);
+    for (size_t i = 0; i < length; i++)
+    {
+        UidName *entry = SeqAt(UID_NAMES, i);
+        if (entry->uid == uid)
+        {
+            return entry->name;
+        }
+    }
+
+    UidName *entry = xcalloc(1, sizeof(UidName));
+    entry->uid = uid;
+    if (!GetUserName(uid, entry->name, sizeof(entry->name), LOG_LEVEL_DEBUG))
+    {
+        xsnprintf(entry->name, sizeof(entry->name), "%ju", (uintmax_t) uid);
+    }
+    SeqAppend(UID_NAMES, entry);
+    return entry->name;
+}
+
+/* Single pass over /proc: the owner of each /proc/<pid> directory is the
+ * process's uid, so one fstatat() per process replaces forking ps and
+ * parsing its output line by line. */
+static bool GatherProcessUsersProcfs(Item **userList, int *userListSz,
+                                     int *numRootProcs, int *numOtherProcs)
+{
+    DIR *dirh = opendir("/proc");
+    if (dirh == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Could not open /proc while gathering process data, "
+            "falling back to ps. (opendir: %s)", GetErrorStr());
+        return false;
+    }
+
+    const int proc_fd = dirfd(dirh);
+
+    const struct dirent *dirp;
+    while ((dirp = readdir(dirh)) != NULL)
+    {
+        if (!isdigit((unsigned char) dirp->d_name[0]))
+        {
+            continue;
+        }
+
+        struct stat sb;
+        if (fstatat(proc_fd, dirp->d_name, &sb, 0) != 0)
+        {
+            /* Process exited since readdir() */
+            continue;
+        }
+
+        const char *user = GetCachedUserName(sb.st_uid);
+
+        if (!IsItemIn(*userList, user))
+        {
+            PrependItem(userList, user, NULL);
+            (*userListSz)++;
+        }
+
+        if (sb.st_uid == 0)
+        {
+            (*numRootProcs)++;
+        }
+        else
+        {
+            (*numOtherProcs)++;
+        }
+    }
+
+    closedir(dirh);
+    return true;
+}
+
+#endif /* __linux__ */
+
 static bool GatherProcessUsers(Item **userList, int *userListSz, int *numRootProcs, int *numOtherProcs)
 {
+#ifdef __linux__
+    if (GatherProcessUsersProcfs(userList, userListSz, numRootProcs, numOtherProcs))
+    {
+        if (LogGetGlobalLevel() >= LOG_LEVEL_DEBUG)
+        {
+            char *s = ItemList2CSV(*userList);
+            Log(LOG_LEVEL_DEBUG, "Users in the process table: (%s)", s);
+            free(s);
+        }
+        return true;
+    }
+#endif
+
     char pscomm[CF_BUFSIZE];
     xsnprintf(pscomm, sizeof(pscomm), "%s %s",
               VPSCOMM[VPSHARDCLASS], VPSOPTS[VPSHARDCLASS]);
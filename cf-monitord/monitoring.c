@@ -280,14 +280,13 @@ static int NovaGetSlot(const char *name)
 
     Nova_LoadSlots();
 
-/* First try to find existing slot */
-    for (i = 0; i < CF_OBSERVABLES - ob_spare; ++i)
+/* First try to find existing slot: hashed, since registration is repeated
+ * for every measurement every sample pass */
+    i = Nova_FindSlotByName(name);
+    if (i >= 0)
     {
-        if (SLOTS[i] && !strcmp(SLOTS[i]->name, name))
-        {
-            Log(LOG_LEVEL_VERBOSE, "Using slot ob_spare+%d (%d) for %s", i, i + ob_spare, name);
-            return i + ob_spare;
-        }
+        Log(LOG_LEVEL_VERBOSE, "Using slot ob_spare+%d (%d) for %s", i, i + ob_spare, name);
+        return i + ob_spare;
     }
 
 /* Then find the spare one */
@@ -321,6 +320,7 @@ int NovaRegisterSlot(const char *name, const char *description,
 
     Nova_FreeSlot(SLOTS[slot - ob_spare]);
     SLOTS[slot - ob_spare] = Nova_MakeSlot(name, description, units, expected_minimum, expected_maximum, consolidable);
+    Nova_InvalidateSlotIndex();
     Nova_DumpSlots();
 
     return slot;
@@ -45,6 +45,9 @@
 #include <protocol.h>
 #include <sequence.h>
 #include <files_lib.h>
+#include <json.h>               // JsonElement (bench reports)
+#include <protocol_trace.h>     // ProtocolTraceHeader (replay)
+#include <file_lib.h>           // safe_fopen
 
 #define ARG_UNUSED __attribute__((unused))
 
@@ -103,6 +106,14 @@ static const Description COMMANDS[] =
                 "cf-net opendir masterfiles"},
     {"getdir", "Recursively downloads files and folders in a directory",
                 "cf-net getdir masterfiles/ -o /tmp/"},
+    {"bench-connect", "Measure connection/handshake throughput of a server",
+                "cf-net bench-connect [-jTHREADS] [-tSECONDS]"},
+    {"bench-stat",    "Measure STAT request throughput of a server",
+                "cf-net bench-stat [-jTHREADS] [-tSECONDS] masterfiles/update.cf"},
+    {"bench-get",     "Measure GET download throughput of a server",
+                "cf-net bench-get [-jTHREADS] [-tSECONDS] masterfiles/update.cf"},
+    {"replay",  "Replay a recorded protocol trace against a server",
+                "cf-net replay [--no-delay] [--server-trace] trace.bin"},
     {NULL, NULL, NULL}
 };
 
@@ -148,6 +159,10 @@ static const char *const HINTS[] =
         generator_macro(GET)             \
         generator_macro(OPENDIR)         \
         generator_macro(GETDIR)          \
+        generator_macro(BENCH_CONNECT)   \
+        generator_macro(BENCH_STAT)      \
+        generator_macro(BENCH_GET)       \
+        generator_macro(REPLAY)          \
         generator_macro(MULTI)           \
         generator_macro(MULTITLS)        \
         generator_macro(HELP)            \
@@ -208,6 +223,9 @@ static int CFNetOpenDir(CFNetOptions *opts, const char *hostname, char **args);
 static int CFNetMulti(const char *server);
 static int CFNetMultiTLS(const char *server, const char *use_protocol_version);
 static int CFNetGetDir(CFNetOptions *opts, const char *hostname, char **args);
+static int CFNetBench(CFNetOptions *opts, const char *hostname, char **args,
+                      enum command_enum cmd);
+static int CFNetReplay(CFNetOptions *opts, const char *hostname, char **args);
 
 
 //*******************************************************************
@@ -424,6 +442,12 @@ static int CFNetCommandSwitch(CFNetOptions *opts, const char *hostname,
             return CFNetOpenDir(opts, hostname, args);
         case CFNET_CMD_GETDIR:
             return CFNetGetDir(opts, hostname, args);
+        case CFNET_CMD_BENCH_CONNECT:
+        case CFNET_CMD_BENCH_STAT:
+        case CFNET_CMD_BENCH_GET:
+            return CFNetBench(opts, hostname, args, cmd);
+        case CFNET_CMD_REPLAY:
+            return CFNetReplay(opts, hostname, args);
         case CFNET_CMD_MULTI:
             return CFNetMulti(hostname);
         case CFNET_CMD_MULTITLS:
@@ -469,6 +493,15 @@ static int CFNetRun(CFNetOptions *opts, char **args, char *hostnames)
         DoCleanupAndExit(EXIT_FAILURE);
     }
     ToUpperStrInplace(command_name);
+    // Subcommand names use '-' on the command line ("bench-get"), but the
+    // generated enum identifiers cannot, so map to the "BENCH_GET" form:
+    for (char *ch = command_name; *ch != '\0'; ++ch)
+    {
+        if (*ch == '-')
+        {
+            *ch = '_';
+        }
+    }
 
     Log(LOG_LEVEL_VERBOSE, "Running command '%s' with argument(s):\n",
         command_name);
@@ -614,6 +647,29 @@ static int CFNetHelpTopic(const char *topic)
            "\n\nUsage: cf-net getdir [-o output_path] <remote_directory>"
            "\n\nExample: cf-net getdir -o /tmp/backup masterfiles/\n");
     }
+    else if (strncmp("bench-", topic, strlen("bench-")) == 0)
+    {
+        printf("\nThe bench commands drive a fixed number of worker threads"
+               "\n(-j, default 1) against the server for a fixed duration"
+               "\n(-t seconds, default 10) and print a JSON report to stdout:"
+               "\nrequest and error counts, throughput, latency percentiles"
+               "\nand a latency histogram (microseconds, power-of-two bucket"
+               "\nupper bounds). bench-connect opens and closes a full TLS"
+               "\nconnection per request; bench-stat and bench-get reuse one"
+               "\nconnection per thread, like cf-agent does within a run.\n");
+    }
+    else if (strcmp("replay", topic) == 0)
+    {
+        printf("\ncf-net replay re-issues the transactions from a binary"
+               "\nprotocol trace (body server control \"protocol_trace_file\""
+               "\non cf-serverd, or any process using libcfnet with tracing"
+               "\nenabled) against a server, preserving the recorded pauses"
+               "\nbetween requests unless --no-delay is given. Pass"
+               "\n--server-trace if the trace was captured on the server, so"
+               "\nthe received transactions are the ones to re-send. The"
+               "\nhandshake preamble up to the server's \"OK WELCOME\" is"
+               "\nskipped, since connecting performs a fresh handshake.\n");
+    }
     else
     {
         if (found == false)
@@ -1310,6 +1366,658 @@ static int CFNetGetDir(CFNetOptions *opts, const char *hostname, char **args)
     return (ret == GET_DIR_OK) ? 0 : -1;
 }
 
+//*******************************************************************
+// BENCHMARKING:
+//*******************************************************************
+
+#define BENCH_HISTOGRAM_BUCKETS 64
+
+typedef struct
+{
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t sum_usec;
+    uint64_t min_usec;
+    uint64_t max_usec;
+    // Bucket b counts successful requests that took at most 2^(b+1)-1
+    // microseconds (and more than the previous bucket's upper bound):
+    uint64_t histogram[BENCH_HISTOGRAM_BUCKETS];
+} BenchStats;
+
+typedef struct
+{
+    pthread_t id;
+    const char *hostname;
+    const char *use_protocol_version;
+    const char *remote_file;
+    char local_file[PATH_MAX];
+    enum command_enum cmd;
+    int64_t deadline; // nanoseconds, BenchClock() domain
+    BenchStats stats;
+    bool failed;      // could not set up (e.g. connect), no measurements
+} BenchWorker;
+
+static int64_t BenchClock(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    // As in libcfnet/net.c some OS-es don't have monotonic clock,
+    // realtime clock is best we can do.
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void BenchStatsRecord(BenchStats *stats, uint64_t usec,
+                             uint64_t bytes, bool ok)
+{
+    stats->requests += 1;
+    if (!ok)
+    {
+        stats->errors += 1;
+        return;
+    }
+    stats->bytes += bytes;
+    stats->sum_usec += usec;
+    if (usec < stats->min_usec)
+    {
+        stats->min_usec = usec;
+    }
+    if (usec > stats->max_usec)
+    {
+        stats->max_usec = usec;
+    }
+    int bucket = 0;
+    while ((usec >> (bucket + 1)) != 0 && bucket < BENCH_HISTOGRAM_BUCKETS - 1)
+    {
+        ++bucket;
+    }
+    stats->histogram[bucket] += 1;
+}
+
+static void BenchStatsMerge(BenchStats *total, const BenchStats *part)
+{
+    total->requests += part->requests;
+    total->errors   += part->errors;
+    total->bytes    += part->bytes;
+    total->sum_usec += part->sum_usec;
+    if (part->requests > part->errors) // had at least one success
+    {
+        if (part->min_usec < total->min_usec)
+        {
+            total->min_usec = part->min_usec;
+        }
+        if (part->max_usec > total->max_usec)
+        {
+            total->max_usec = part->max_usec;
+        }
+    }
+    for (int i = 0; i < BENCH_HISTOGRAM_BUCKETS; ++i)
+    {
+        total->histogram[i] += part->histogram[i];
+    }
+}
+
+// Upper latency bound (usec) below which #fraction of successes fall,
+// resolved to histogram bucket granularity:
+static uint64_t BenchPercentile(const BenchStats *stats, double fraction)
+{
+    const uint64_t samples = stats->requests - stats->errors;
+    if (samples == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) (fraction * (double) samples);
+    if (rank >= samples)
+    {
+        rank = samples - 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < BENCH_HISTOGRAM_BUCKETS; ++b)
+    {
+        seen += stats->histogram[b];
+        if (seen > rank)
+        {
+            const uint64_t upper = (UINT64_C(2) << b) - 1;
+            return (upper < stats->max_usec) ? upper : stats->max_usec;
+        }
+    }
+    return stats->max_usec;
+}
+
+static void *CFNetBenchWorker(void *arg)
+{
+    BenchWorker *worker = (BenchWorker *) arg;
+
+    AgentConnection *conn = NULL;
+    if (worker->cmd != CFNET_CMD_BENCH_CONNECT)
+    {
+        // stat/get reuse one connection per thread, like cf-agent
+        // does within a run; bench-connect measures the setup itself.
+        conn = CFNetOpenConnection(worker->hostname,
+                                   worker->use_protocol_version);
+        if (conn == NULL)
+        {
+            worker->failed = true;
+            return NULL;
+        }
+    }
+
+    while (BenchClock() < worker->deadline)
+    {
+        const int64_t start = BenchClock();
+        bool ok = false;
+        uint64_t bytes = 0;
+        switch (worker->cmd)
+        {
+            case CFNET_CMD_BENCH_CONNECT:
+            {
+                AgentConnection *c =
+                    CFNetOpenConnection(worker->hostname,
+                                        worker->use_protocol_version);
+                ok = (c != NULL);
+                if (c != NULL)
+                {
+                    CFNetDisconnect(c);
+                }
+                break;
+            }
+            case CFNET_CMD_BENCH_STAT:
+            {
+                struct stat sb;
+                ok = ProtocolStat(conn, worker->remote_file, &sb);
+                break;
+            }
+            case CFNET_CMD_BENCH_GET:
+            {
+                struct stat sb;
+                ok = ProtocolStat(conn, worker->remote_file, &sb) &&
+                     ProtocolGet(conn, worker->remote_file,
+                                 worker->local_file,
+                                 sb.st_size, sb.st_mode, false);
+                if (ok)
+                {
+                    bytes = (uint64_t) sb.st_size;
+                }
+                break;
+            }
+            default:
+            {
+                break; // unreachable, see CFNetCommandSwitch()
+            }
+        }
+        const uint64_t usec = (uint64_t) (BenchClock() - start) / 1000;
+        BenchStatsRecord(&worker->stats, usec, bytes, ok);
+    }
+
+    if (conn != NULL)
+    {
+        CFNetDisconnect(conn);
+    }
+    return NULL;
+}
+
+static void BenchPrintReport(const char *command, const char *hostname,
+                             long n_threads, double elapsed,
+                             const BenchStats *stats)
+{
+    const uint64_t successes = stats->requests - stats->errors;
+
+    JsonElement *report = JsonObjectCreate(10);
+    JsonObjectAppendString(report, "command", command);
+    JsonObjectAppendString(report, "host", hostname);
+    JsonObjectAppendInteger(report, "threads", (int) n_threads);
+    JsonObjectAppendReal(report, "seconds", elapsed);
+    JsonObjectAppendInteger64(report, "requests", (int64_t) stats->requests);
+    JsonObjectAppendInteger64(report, "errors", (int64_t) stats->errors);
+    JsonObjectAppendInteger64(report, "bytes", (int64_t) stats->bytes);
+    JsonObjectAppendReal(report, "requestsPerSecond",
+                         (double) stats->requests / elapsed);
+    JsonObjectAppendReal(report, "bytesPerSecond",
+                         (double) stats->bytes / elapsed);
+
+    JsonElement *latency = JsonObjectCreate(7);
+    JsonObjectAppendInteger64(latency, "min",
+                              (int64_t) ((successes > 0) ? stats->min_usec : 0));
+    JsonObjectAppendReal(latency, "mean",
+                         (successes > 0)
+                         ? ((double) stats->sum_usec / (double) successes)
+                         : 0.0);
+    JsonObjectAppendInteger64(latency, "p50",
+                              (int64_t) BenchPercentile(stats, 0.50));
+    JsonObjectAppendInteger64(latency, "p90",
+                              (int64_t) BenchPercentile(stats, 0.90));
+    JsonObjectAppendInteger64(latency, "p99",
+                              (int64_t) BenchPercentile(stats, 0.99));
+    JsonObjectAppendInteger64(latency, "p999",
+                              (int64_t) BenchPercentile(stats, 0.999));
+    JsonObjectAppendInteger64(latency, "max", (int64_t) stats->max_usec);
+    JsonObjectAppendObject(report, "latencyMicroseconds", latency);
+
+    JsonElement *histogram = JsonArrayCreate(16);
+    for (int b = 0; b < BENCH_HISTOGRAM_BUCKETS; ++b)
+    {
+        if (stats->histogram[b] > 0)
+        {
+            JsonElement *bucket = JsonObjectCreate(2);
+            JsonObjectAppendInteger64(bucket, "le",
+                                      (int64_t) ((UINT64_C(2) << b) - 1));
+            JsonObjectAppendInteger64(bucket, "count",
+                                      (int64_t) stats->histogram[b]);
+            JsonArrayAppendObject(histogram, bucket);
+        }
+    }
+    JsonObjectAppendArray(report, "histogram", histogram);
+
+    Writer *w = FileWriter(stdout);
+    JsonWrite(w, report, 0);
+    FileWriterDetach(w);
+    JsonDestroy(report);
+}
+
+static int CFNetBench(CFNetOptions *opts, const char *hostname, char **args,
+                      enum command_enum cmd)
+{
+    assert(opts != NULL);
+    assert(hostname != NULL);
+    assert(args != NULL);
+
+    const char *command = (cmd == CFNET_CMD_BENCH_CONNECT) ? "bench-connect"
+                        : (cmd == CFNET_CMD_BENCH_STAT)    ? "bench-stat"
+                                                           : "bench-get";
+
+    // TODO: Propagate argv and argc from main()
+    int argc = 0;
+    while (args[argc] != NULL)
+    {
+        ++argc;
+    }
+
+    static struct option longopts[] = {
+         { "jobs",       required_argument,      NULL,           'j' },
+         { "duration",   required_argument,      NULL,           't' },
+         { NULL,         0,                      NULL,           0   }
+    };
+    extern int optind;
+    optind = 0;
+    extern char *optarg;
+    int c = 0;
+    const char *optstr = "j:t:";
+    long n_threads = 1;
+    long duration = 10; // seconds
+    while ((c = getopt_long(argc, args, optstr, longopts, NULL))
+            != -1)
+    {
+        switch (c)
+        {
+            case 'j':
+            {
+                int ret = StringToLong(optarg, &n_threads);
+                if (ret != 0)
+                {
+                    printf("Failed to parse number of threads/jobs from '%s'\n", optarg);
+                    n_threads = 1;
+                }
+                break;
+            }
+            case 't':
+            {
+                int ret = StringToLong(optarg, &duration);
+                if (ret != 0)
+                {
+                    printf("Failed to parse duration from '%s'\n", optarg);
+                    duration = 10;
+                }
+                break;
+            }
+            case ':':
+            case '?':
+            {
+                return invalid_command(command);
+            }
+            default:
+            {
+                printf("Default optarg = '%s', c = '%c' = %i\n",
+                       optarg, c, (int)c);
+                break;
+            }
+        }
+    }
+    args = &(args[optind]);
+    argc -= optind;
+
+    const char *remote_file = args[0];
+    if ((cmd != CFNET_CMD_BENCH_CONNECT) && (remote_file == NULL))
+    {
+        return invalid_command(command);
+    }
+    if (n_threads < 1 || duration < 1)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Thread count and duration must be positive "
+            "(got %ld thread(s), %ld second(s))", n_threads, duration);
+        return -1;
+    }
+
+    BenchWorker *workers =
+        (BenchWorker *) xcalloc((size_t) n_threads, sizeof(BenchWorker));
+    const int64_t start = BenchClock();
+    const int64_t deadline = start + duration * 1000000000LL;
+
+    bool failure = false;
+    for (long i = 0; !failure && (i < n_threads); i++)
+    {
+        workers[i].hostname = hostname;
+        workers[i].use_protocol_version = opts->use_protocol_version;
+        workers[i].remote_file = remote_file;
+        workers[i].cmd = cmd;
+        workers[i].deadline = deadline;
+        workers[i].stats.min_usec = UINT64_MAX;
+        if (cmd == CFNET_CMD_BENCH_GET)
+        {
+            snprintf(workers[i].local_file, PATH_MAX,
+                     "cf-net-bench.%ld.tmp", i);
+        }
+        int ret = pthread_create(&(workers[i].id), NULL,
+                                 CFNetBenchWorker, &workers[i]);
+        if (ret != 0)
+        {
+            printf("Failed to create a new benchmark thread: %s\n",
+                   strerror(ret));
+            failure = true;
+        }
+    }
+
+    BenchStats total = { 0 };
+    total.min_usec = UINT64_MAX;
+    bool any_worker_ran = false;
+    for (long i = 0; i < n_threads; i++)
+    {
+        int ret = pthread_join(workers[i].id, NULL);
+        if (ret != 0)
+        {
+            printf("Failed to join the thread: %s\n", strerror(ret));
+            continue;
+        }
+        if (workers[i].failed)
+        {
+            failure = true;
+            continue;
+        }
+        any_worker_ran = true;
+        BenchStatsMerge(&total, &workers[i].stats);
+        if (cmd == CFNET_CMD_BENCH_GET)
+        {
+            unlink(workers[i].local_file);
+        }
+    }
+    const double elapsed = (double) (BenchClock() - start) / 1.0e9;
+    free(workers);
+
+    if (!any_worker_ran)
+    {
+        Log(LOG_LEVEL_ERR, "No benchmark worker could connect to '%s'",
+            hostname);
+        return -1;
+    }
+
+    BenchPrintReport(command, hostname, n_threads, elapsed, &total);
+    return failure ? -1 : 0;
+}
+
+//*******************************************************************
+// TRACE REPLAY:
+//*******************************************************************
+
+typedef struct
+{
+    ProtocolTraceHeader header;
+    char *payload; // header.len bytes plus a terminating '\0'
+} ReplayRecord;
+
+static void ReplayRecordDestroy(void *record)
+{
+    if (record != NULL)
+    {
+        free(((ReplayRecord *) record)->payload);
+        free(record);
+    }
+}
+
+// Load all records of a trace file (see protocol_trace.h for the format),
+// or return NULL after logging what was wrong with it:
+static Seq *ReplayLoadTrace(const char *path)
+{
+    FILE *file = safe_fopen(path, "rb");
+    if (file == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Could not open trace file '%s' (fopen: %s)",
+            path, GetErrorStr());
+        return NULL;
+    }
+
+    char magic[PROTOCOL_TRACE_MAGIC_LEN];
+    if (fread(magic, sizeof(magic), 1, file) != 1 ||
+        memcmp(magic, PROTOCOL_TRACE_MAGIC, sizeof(magic)) != 0)
+    {
+        Log(LOG_LEVEL_ERR, "'%s' is not a protocol trace file", path);
+        fclose(file);
+        return NULL;
+    }
+
+    Seq *records = SeqNew(256, ReplayRecordDestroy);
+    ProtocolTraceHeader header;
+    while (fread(&header, sizeof(header), 1, file) == 1)
+    {
+        if (header.len == 0 ||
+            header.len > CF_BUFSIZE - CF_INBAND_OFFSET ||
+            (header.direction != 'S' && header.direction != 'R'))
+        {
+            Log(LOG_LEVEL_ERR,
+                "Corrupt trace record %zu in '%s' (direction '%c', %u bytes)",
+                SeqLength(records), path, header.direction, header.len);
+            SeqDestroy(records);
+            fclose(file);
+            return NULL;
+        }
+        char *payload = xmalloc(header.len + 1);
+        if (fread(payload, header.len, 1, file) != 1)
+        {
+            Log(LOG_LEVEL_ERR, "Trace file '%s' is truncated", path);
+            free(payload);
+            SeqDestroy(records);
+            fclose(file);
+            return NULL;
+        }
+        payload[header.len] = '\0';
+
+        ReplayRecord *record = xmalloc(sizeof(ReplayRecord));
+        record->header = header;
+        record->payload = payload;
+        SeqAppend(records, record);
+    }
+    fclose(file);
+
+    if (SeqLength(records) == 0)
+    {
+        Log(LOG_LEVEL_ERR, "Trace file '%s' contains no records", path);
+        SeqDestroy(records);
+        return NULL;
+    }
+    return records;
+}
+
+// Connecting performs a fresh handshake, so the recorded one (version
+// exchange up to the server's welcome) must not be replayed. Returns the
+// index to start from: right after an early "OK WELCOME" response, or 0
+// for traces that begin mid-session.
+static size_t ReplaySkipHandshake(const Seq *records, char recv_direction)
+{
+    const size_t length = SeqLength(records);
+    const size_t horizon = (length < 10) ? length : 10;
+    for (size_t i = 0; i < horizon; i++)
+    {
+        const ReplayRecord *record = SeqAt(records, i);
+        if (record->header.direction == (uint8_t) recv_direction &&
+            strncmp(record->payload, "OK WELCOME", strlen("OK WELCOME")) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static int CFNetReplay(CFNetOptions *opts, const char *hostname, char **args)
+{
+    assert(opts != NULL);
+    assert(hostname != NULL);
+    assert(args != NULL);
+
+    // TODO: Propagate argv and argc from main()
+    int argc = 0;
+    while (args[argc] != NULL)
+    {
+        ++argc;
+    }
+
+    static struct option longopts[] = {
+         { "no-delay",     no_argument,          NULL,           'n' },
+         { "server-trace", no_argument,          NULL,           'S' },
+         { NULL,           0,                    NULL,           0   }
+    };
+    extern int optind;
+    optind = 0;
+    extern char *optarg;
+    int c = 0;
+    const char *optstr = "nS";
+    bool no_delay = false;
+    bool server_trace = false;
+    while ((c = getopt_long(argc, args, optstr, longopts, NULL))
+            != -1)
+    {
+        switch (c)
+        {
+            case 'n':
+            {
+                no_delay = true;
+                break;
+            }
+            case 'S':
+            {
+                server_trace = true;
+                break;
+            }
+            case ':':
+            case '?':
+            {
+                return invalid_command("replay");
+            }
+            default:
+            {
+                printf("Default optarg = '%s', c = '%c' = %i\n",
+                       optarg, c, (int)c);
+                break;
+            }
+        }
+    }
+    args = &(args[optind]);
+    argc -= optind;
+
+    const char *trace_path = args[0];
+    if (trace_path == NULL)
+    {
+        return invalid_command("replay");
+    }
+
+    Seq *records = ReplayLoadTrace(trace_path);
+    if (records == NULL)
+    {
+        return -1;
+    }
+
+    // In a trace captured on the server the agent's requests are the
+    // received ('R') records; in an agent's trace they are the sent ones.
+    const char send_direction = server_trace ? 'R' : 'S';
+    const char recv_direction = server_trace ? 'S' : 'R';
+    const size_t start = ReplaySkipHandshake(records, recv_direction);
+    const size_t length = SeqLength(records);
+
+    AgentConnection *conn = CFNetOpenConnection(hostname, opts->use_protocol_version);
+    if (conn == NULL)
+    {
+        SeqDestroy(records);
+        return -1;
+    }
+
+    const int64_t replay_start = BenchClock();
+    long sent = 0;
+    long received = 0;
+    bool failure = false;
+    int64_t prev_usec = 0;
+
+    for (size_t i = start; !failure && (i < length); i++)
+    {
+        const ReplayRecord *record = SeqAt(records, i);
+        if (record->header.direction == (uint8_t) send_direction)
+        {
+            if (!no_delay && prev_usec != 0 && record->header.usec > prev_usec)
+            {
+                const int64_t delay_usec = record->header.usec - prev_usec;
+                const struct timespec delay = {
+                    .tv_sec = delay_usec / 1000000,
+                    .tv_nsec = (delay_usec % 1000000) * 1000
+                };
+                nanosleep(&delay, NULL);
+            }
+            if (SendTransaction(conn->conn_info, record->payload,
+                                record->header.len,
+                                (char) record->header.status) != 0)
+            {
+                Log(LOG_LEVEL_ERR,
+                    "Replay aborted: could not send record %zu", i);
+                failure = true;
+            }
+            else
+            {
+                ++sent;
+            }
+        }
+        else
+        {
+            char recvbuffer[CF_BUFSIZE];
+            if (ReceiveTransaction(conn->conn_info, recvbuffer, NULL) == -1)
+            {
+                Log(LOG_LEVEL_ERR,
+                    "Replay aborted: no response for record %zu", i);
+                failure = true;
+            }
+            else
+            {
+                ++received;
+            }
+        }
+        prev_usec = record->header.usec;
+    }
+    const double replay_seconds =
+        (double) (BenchClock() - replay_start) / 1.0e9;
+
+    const ReplayRecord *first = SeqAt(records, start);
+    const ReplayRecord *last = SeqAt(records, length - 1);
+    const double trace_seconds =
+        (double) (last->header.usec - first->header.usec) / 1.0e6;
+
+    printf("Replayed %ld sent / %ld received transaction(s) in %.2f seconds "
+           "(original span %.2f seconds)\n",
+           sent, received, replay_seconds, trace_seconds);
+
+    CFNetDisconnect(conn);
+    SeqDestroy(records);
+    return failure ? -1 : 0;
+}
+
 static int CFNetMulti(const char *server)
 {
     time_t start;
@@ -38,9 +38,11 @@
 #include <string_lib.h>
 #include <file_lib.h>                                     /* FILE_SEPARATOR */
 #include <loading.h>
+#include <policy_cache.h>                                 /* PolicyCacheStore */
 #include <regex.h>                                        /* CompileRegex */
 #include <match_scope.h>
 #include <cleanup.h>
+#include <validate_data.h>
 
 #include <time.h>
 
@@ -71,7 +73,9 @@ enum
 {
     OPT_EVAL_FUNCTIONS = 256,
     OPT_SHOW_CLASSES,
-    OPT_SHOW_VARS
+    OPT_SHOW_VARS,
+    OPT_COMPILE,
+    OPT_VALIDATE_DATA
 };
 
 static const struct option OPTIONS[] =
@@ -80,6 +84,8 @@ static const struct option OPTIONS[] =
     {"eval-functions", optional_argument, 0, OPT_EVAL_FUNCTIONS },
     {"show-classes", optional_argument, 0, OPT_SHOW_CLASSES },
     {"show-vars", optional_argument, 0, OPT_SHOW_VARS },
+    {"compile", no_argument, 0, OPT_COMPILE },
+    {"validate-data", no_argument, 0, OPT_VALIDATE_DATA },
     {"help", no_argument, 0, 'h'},
     {"bundlesequence", required_argument, 0, 'b'},
     {"debug", no_argument, 0, 'd'},
@@ -111,6 +117,8 @@ static const char *const HINTS[] =
     "Evaluate functions during syntax checking (may catch more run-time errors). Possible values: 'yes', 'no'. Default is 'yes'",
     "Show discovered classes, including those defined in common bundles in policy. Optionally can take a regular expression.",
     "Show discovered variables, including those defined without dependency to user-defined classes in policy. Optionally can take a regular expression.",
+    "Write a compiled policy cache to the state directory after validation, so later runs can skip parsing unchanged inputs",
+    "Validate the data files referenced by read function calls in the policy (readjson, readcsv, ...) and print a pass/fail report",
     "Print the help message",
     "Use the specified bundlesequence for verification",
     "Enable debugging output",
@@ -162,6 +170,24 @@ int main(int argc, char *argv[])
 
     GenericAgentPostLoadInit(ctx);
 
+    if (config->agent_specific.common.compile_policy_cache)
+    {
+        if (!PolicyCacheStore(config, policy))
+        {
+            Log(LOG_LEVEL_ERR, "Could not write the compiled policy cache");
+            DoCleanupAndExit(EXIT_FAILURE);
+        }
+    }
+
+    if (config->agent_specific.common.validate_data)
+    {
+        if (!ValidateReferencedDataFiles(policy))
+        {
+            Log(LOG_LEVEL_ERR, "Referenced data files contain errors.");
+            DoCleanupAndExit(EXIT_FAILURE);
+        }
+    }
+
     if (config->tag_release_dir != NULL)
     {
         // write the validated file and the release ID
@@ -193,9 +219,7 @@ int main(int argc, char *argv[])
     case GENERIC_AGENT_CONFIG_COMMON_POLICY_OUTPUT_FORMAT_JSON_FULL:
     {
         Writer *writer = FileWriter(stdout);
-        JsonElement *json_policy = PolicyToJson(policy);
-        JsonWrite(writer, json_policy, 2);
-        JsonDestroy(json_policy);
+        PolicyToJsonStreamed(policy, writer);
         WriterClose(writer);
         break;
     }
@@ -221,9 +245,7 @@ int main(int argc, char *argv[])
         }
         else
         {
-            JsonElement *json_policy = PolicyToJson(output_policy);
-            JsonWrite(writer, json_policy, 2);
-            JsonDestroy(json_policy);
+            PolicyToJsonStreamed(output_policy, writer);
         }
         WriterClose(writer);
         PolicyDestroy(output_policy);
@@ -293,6 +315,14 @@ GenericAgentConfig *CheckOpts(int argc, char **argv)
             config->agent_specific.common.show_variables = xstrdup(optarg);
             break;
 
+        case OPT_COMPILE:
+            config->agent_specific.common.compile_policy_cache = true;
+            break;
+
+        case OPT_VALIDATE_DATA:
+            config->agent_specific.common.validate_data = true;
+            break;
+
         case 'w':
         {
             Log(LOG_LEVEL_INFO, "Setting workdir to '%s'", optarg);
@@ -363,11 +393,9 @@ GenericAgentConfig *CheckOpts(int argc, char **argv)
             }
             else if (strcmp("json", optarg) == 0)
             {
-                JsonElement *json_syntax = SyntaxToJson();
                 Writer *out = FileWriter(stdout);
-                JsonWrite(out, json_syntax, 0);
+                SyntaxDescriptionWriteJson(out);
                 FileWriterDetach(out);
-                JsonDestroy(json_syntax);
                 DoCleanupAndExit(EXIT_SUCCESS);
             }
             else
@@ -0,0 +1,378 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <platform.h>
+#include <validate_data.h>
+
+#include <cf3.defs.h>                                        /* CF_INFINITY */
+#include <fncall.h>
+#include <rlist.h>
+#include <json.h>
+#include <json-utils.h>               /* JsonReadDataFile, DataFileType */
+#include <sequence.h>
+#include <set.h>                                             /* StringSet */
+#include <string_lib.h>
+#include <writer.h>
+#include <mutex.h>                                           /* ThreadLock */
+#include <misc_lib.h>                                        /* MIN */
+#include <logging.h>
+
+
+/* Validation is I/O bound until the files are in cache, and parsing is
+ * cheap; more workers than this has not been worth the thundering herd on
+ * the policy directory. */
+#define VALIDATE_DATA_MAX_WORKERS 8
+
+/* Functions whose file argument is plain text: there is no grammar to
+ * check, so only existence and readability are verified. */
+static const char *const READABILITY_ONLY_FUNCTIONS[] =
+{
+    "readfile", "read_module_protocol",
+    "readstringlist", "readintlist", "readreallist",
+    "readstringarray", "readstringarrayidx",
+    "readintarray", "readrealarray",
+    "data_readstringarray", "data_readstringarrayidx",
+    NULL
+};
+
+typedef struct
+{
+    char *path;
+    DataFileType type;          /* DATAFILETYPE_UNKNOWN: readability only */
+    char *function;             /* function call referencing the file */
+    char *source_path;          /* policy file containing the call */
+    bool ok;
+} DataFileCheck;
+
+typedef struct
+{
+    Seq *checks;
+    size_t next;                /* index of the next check to run */
+    pthread_mutex_t *lock;
+} DataFileWorkQueue;
+
+static pthread_mutex_t work_queue_lock = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
+
+
+static void DataFileCheckDestroy(void *p)
+{
+    DataFileCheck *check = p;
+    if (check != NULL)
+    {
+        free(check->path);
+        free(check->function);
+        free(check->source_path);
+        free(check);
+    }
+}
+
+/**
+ * Decide whether #fp is a call that reads a data file, and if so which
+ * parser its file argument must satisfy.
+ */
+static bool CallReadsDataFile(const FnCall *fp, const char *path,
+                              DataFileType *type_out)
+{
+    if (StringEqual(fp->name, "readjson"))
+    {
+        *type_out = DATAFILETYPE_JSON;
+    }
+    else if (StringEqual(fp->name, "readyaml"))
+    {
+        *type_out = DATAFILETYPE_YAML;
+    }
+    else if (StringEqual(fp->name, "readcsv"))
+    {
+        *type_out = DATAFILETYPE_CSV;
+    }
+    else if (StringEqual(fp->name, "readenvfile"))
+    {
+        *type_out = DATAFILETYPE_ENV;
+    }
+    else if (StringEqual(fp->name, "readdata"))
+    {
+        /* Mirror FnCallReadData(): an explicit mode argument wins, "auto"
+         * or an unresolved mode falls back to the filename suffix. */
+        const Rlist *mode = fp->args->next;
+        if (mode != NULL && mode->val.type == RVAL_TYPE_SCALAR &&
+            !StringEqual(RlistScalarValue(mode), "auto") &&
+            strchr(RlistScalarValue(mode), '$') == NULL)
+        {
+            *type_out = GetDataFileTypeFromString(RlistScalarValue(mode));
+        }
+        else
+        {
+            *type_out = GetDataFileTypeFromSuffix(path);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; READABILITY_ONLY_FUNCTIONS[i] != NULL; i++)
+        {
+            if (StringEqual(fp->name, READABILITY_ONLY_FUNCTIONS[i]))
+            {
+                *type_out = DATAFILETYPE_UNKNOWN;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    return true;
+}
+
+static void CollectFromCall(Seq *checks, StringSet *seen, const FnCall *fp,
+                            const char *source_path)
+{
+    if (fp->args == NULL || fp->args->val.type != RVAL_TYPE_SCALAR)
+    {
+        return;
+    }
+
+    const char *path = RlistScalarValue(fp->args);
+
+    DataFileType type;
+    if (!CallReadsDataFile(fp, path, &type))
+    {
+        return;
+    }
+
+    if (strchr(path, '$') != NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Not validating argument '%s' of %s(): the path is not a"
+            " resolved literal", path, fp->name);
+        return;
+    }
+
+    /* The same file may legitimately be read with different parsers, so
+     * deduplicate on the (parser, path) pair. */
+    char *key = StringFormat("%d|%s", (int) type, path);
+    if (StringSetContains(seen, key))
+    {
+        free(key);
+        return;
+    }
+    StringSetAdd(seen, key);                         /* takes ownership */
+
+    DataFileCheck *check = xcalloc(1, sizeof(*check));
+    check->path = xstrdup(path);
+    check->type = type;
+    check->function = xstrdup(fp->name);
+    check->source_path = xstrdup(source_path != NULL ? source_path : "?");
+    SeqAppend(checks, check);
+}
+
+static void CollectFromRval(Seq *checks, StringSet *seen, const Rval rval,
+                            const char *source_path)
+{
+    switch (rval.type)
+    {
+    case RVAL_TYPE_FNCALL:
+    {
+        const FnCall *fp = RvalFnCallValue(rval);
+        CollectFromCall(checks, seen, fp, source_path);
+
+        /* Calls nest, e.g. mergedata(readjson(...), ...). */
+        for (const Rlist *rp = fp->args; rp != NULL; rp = rp->next)
+        {
+            CollectFromRval(checks, seen, rp->val, source_path);
+        }
+        break;
+    }
+
+    case RVAL_TYPE_LIST:
+        for (const Rlist *rp = RvalRlistValue(rval); rp != NULL; rp = rp->next)
+        {
+            CollectFromRval(checks, seen, rp->val, source_path);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void CollectFromSections(Seq *checks, StringSet *seen,
+                                const Seq *sections, const char *source_path)
+{
+    const size_t n_sections = SeqLength(sections);
+    for (size_t i = 0; i < n_sections; i++)
+    {
+        const BundleSection *section = SeqAt(sections, i);
+        const size_t n_promises = SeqLength(section->promises);
+        for (size_t j = 0; j < n_promises; j++)
+        {
+            const Promise *pp = SeqAt(section->promises, j);
+            CollectFromRval(checks, seen, pp->promisee, source_path);
+
+            const size_t n_constraints = SeqLength(pp->conlist);
+            for (size_t k = 0; k < n_constraints; k++)
+            {
+                const Constraint *cp = SeqAt(pp->conlist, k);
+                CollectFromRval(checks, seen, cp->rval, source_path);
+            }
+        }
+    }
+}
+
+static void CollectDataFileChecks(Seq *checks, StringSet *seen,
+                                  const Policy *policy)
+{
+    const size_t n_bundles = SeqLength(policy->bundles);
+    for (size_t i = 0; i < n_bundles; i++)
+    {
+        const Bundle *bp = SeqAt(policy->bundles, i);
+        CollectFromSections(checks, seen, bp->sections, bp->source_path);
+        CollectFromSections(checks, seen, bp->custom_sections, bp->source_path);
+    }
+
+    const size_t n_bodies = SeqLength(policy->bodies);
+    for (size_t i = 0; i < n_bodies; i++)
+    {
+        const Body *bdp = SeqAt(policy->bodies, i);
+        const size_t n_constraints = SeqLength(bdp->conlist);
+        for (size_t j = 0; j < n_constraints; j++)
+        {
+            const Constraint *cp = SeqAt(bdp->conlist, j);
+            CollectFromRval(checks, seen, cp->rval, bdp->source_path);
+        }
+    }
+}
+
+static void *ValidateWorker(void *arg)
+{
+    DataFileWorkQueue *queue = arg;
+
+    while (true)
+    {
+        ThreadLock(queue->lock);
+        const size_t i = queue->next;
+        if (i >= SeqLength(queue->checks))
+        {
+            ThreadUnlock(queue->lock);
+            break;
+        }
+        queue->next++;
+        ThreadUnlock(queue->lock);
+
+        DataFileCheck *check = SeqAt(queue->checks, i);
+        if (check->type == DATAFILETYPE_UNKNOWN)
+        {
+            check->ok = (access(check->path, R_OK) == 0);
+            if (!check->ok)
+            {
+                Log(LOG_LEVEL_ERR, "Cannot read '%s'. (access: %s)",
+                    check->path, GetErrorStr());
+            }
+        }
+        else
+        {
+            /* Logs its own parse errors with file and position. */
+            JsonElement *json = JsonReadDataFile("validate-data", check->path,
+                                                 check->type, CF_INFINITY);
+            check->ok = (json != NULL);
+            JsonDestroy(json);
+        }
+    }
+
+    return NULL;
+}
+
+bool ValidateReferencedDataFiles(const Policy *policy)
+{
+    assert(policy != NULL);
+
+    Seq *checks = SeqNew(64, DataFileCheckDestroy);
+    StringSet *seen = StringSetNew();
+    CollectDataFileChecks(checks, seen, policy);
+    StringSetDestroy(seen);
+
+    const size_t n = SeqLength(checks);
+    if (n == 0)
+    {
+        Log(LOG_LEVEL_INFO,
+            "Policy references no data files by literal path,"
+            " nothing to validate");
+        SeqDestroy(checks);
+        return true;
+    }
+
+    DataFileWorkQueue queue = {
+        .checks = checks,
+        .next = 0,
+        .lock = &work_queue_lock,
+    };
+
+    const size_t n_workers = MIN(n, (size_t) VALIDATE_DATA_MAX_WORKERS);
+    pthread_t workers[VALIDATE_DATA_MAX_WORKERS];
+    size_t started = 0;
+    for (size_t i = 0; i < n_workers; i++)
+    {
+        int ret = pthread_create(&workers[i], NULL, &ValidateWorker, &queue);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Could not create data validation thread (pthread_create: %s)",
+                GetErrorStrFromCode(ret));
+            break;
+        }
+        started++;
+    }
+
+    if (started == 0)
+    {
+        ValidateWorker(&queue);     /* fall back to checking sequentially */
+    }
+
+    for (size_t i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    size_t failures = 0;
+    Writer *w = FileWriter(stdout);
+    for (size_t i = 0; i < n; i++)
+    {
+        const DataFileCheck *check = SeqAt(checks, i);
+        if (check->ok)
+        {
+            WriterWriteF(w, "PASS\t%s\n", check->path);
+        }
+        else
+        {
+            WriterWriteF(w, "FAIL\t%s\t(%s() in %s)\n",
+                         check->path, check->function, check->source_path);
+            failures++;
+        }
+    }
+    FileWriterDetach(w);
+
+    Log(failures > 0 ? LOG_LEVEL_ERR : LOG_LEVEL_NOTICE,
+        "Validated %zu data files: %zu passed, %zu failed",
+        n, n - failures, failures);
+
+    SeqDestroy(checks);
+    return (failures == 0);
+}
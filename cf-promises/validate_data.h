@@ -0,0 +1,43 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_VALIDATE_DATA_H
+#define CFENGINE_VALIDATE_DATA_H
+
+#include <policy.h>
+
+/**
+ * Discover the data files referenced by read function calls in the parsed
+ * #policy (readjson(), readyaml(), readcsv(), readdata(), ...) and validate
+ * each one, in parallel, with the same parser the agent would use at run
+ * time.  A pass/fail line per file is written to stdout.
+ *
+ * Only calls whose file argument is a resolved literal can be checked;
+ * paths still containing unexpanded variables are skipped.
+ *
+ * @return true if every discovered data file validated.
+ */
+bool ValidateReferencedDataFiles(const Policy *policy);
+
+#endif
@@ -263,11 +263,25 @@ int main(int argc, char *argv[])
             {
                 if (count < MAXCHILD)
                 {
-                    if (fork() == 0)    /* child process */
+                    pid_t child = fork();
+                    if (child == 0)     /* child process */
                     {
                         int remote_exit_code = HailServer(ctx, config, RlistScalarValue(rp));
                         DoCleanupAndExit(remote_exit_code >= 0 ? remote_exit_code : CF_RA_EXIT_CODE_OTHER_ERR);
                     }
+                    else if (child == -1)
+                    {
+                        /* Don't silently skip the host and don't count a
+                         * child that was never started: hail it from this
+                         * process instead. */
+                        Log(LOG_LEVEL_ERR,
+                            "Failed to start child process for host '%s',"
+                            " running in foreground (fork: %s)",
+                            RlistScalarValue(rp), GetErrorStr());
+                        int remote_exit_code = HailServer(ctx, config, RlistScalarValue(rp));
+                        UpdateExitCode(&exit_code, remote_exit_code, one_host, true);
+                        rp = rp->next;
+                    }
                     else        /* parent process */
                     {
                         rp = rp->next;
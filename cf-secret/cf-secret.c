@@ -65,6 +65,11 @@
 
 #define BUFSIZE 1024
 
+/* Payload is encrypted/decrypted in batches of this size rather than per
+ * cipher block; large batches keep the AES pipeline (AES-NI) busy and avoid
+ * a read/EVP/write round trip per 16 bytes. */
+#define CRYPT_BATCH_SIZE (64 * 1024)
+
 #define MAX_HEADER_LEN 256      /* "Key[126]: Value[128]" */
 #define MAX_HEADER_KEY_LEN 126
 #define MAX_HEADER_VAL_LEN 128
@@ -136,6 +141,7 @@ static const Description COMMANDS[] =
     {"encrypt", "Encrypt data for one or more hosts/keys", "cf-secret encrypt [-k/-H KEY/HOST] -o OUTPUT INPUT"},
     {"decrypt", "Decrypt data", "cf-secret decrypt [-k/-H KEY/HOST] -o OUTPUT INPUT"},
     {"print-headers", "Print headers from an encrypted file", "cf-secret print-headers ENCRYPTED_FILE"},
+    {"re-wrap", "Re-encrypt the file key for a new set of hosts/keys without re-encrypting the payload (requires the localhost private key)", "cf-secret re-wrap [-k/-H KEY/HOST] -o OUTPUT INPUT"},
     {NULL, NULL, NULL}
 };
 
@@ -358,7 +364,8 @@ static bool RSAEncrypt(Seq *rsa_keys, const char *input_path, const char *output
     unsigned char iv[iv_size];
 
     const int block_size = EVP_CIPHER_block_size(cipher);
-    char plaintext[block_size], ciphertext[2 * block_size];
+    char *plaintext = xmalloc(CRYPT_BATCH_SIZE);
+    char *ciphertext = xmalloc(CRYPT_BATCH_SIZE + block_size);
     int ct_len;
 
     int ret = EVP_SealInit(ctx, cipher,
@@ -429,7 +436,7 @@ static bool RSAEncrypt(Seq *rsa_keys, const char *input_path, const char *output
     size_t processed = 0;
     while (success && !feof(input_file))
     {
-        ssize_t n_read = ReadFileStreamToBuffer(input_file, block_size, plaintext);
+        ssize_t n_read = ReadFileStreamToBuffer(input_file, CRYPT_BATCH_SIZE, plaintext);
         if (n_read == FILE_ERROR_READ)
         {
             Log(LOG_LEVEL_ERR, "Could not read file '%s'", input_path);
@@ -471,13 +478,15 @@ static bool RSAEncrypt(Seq *rsa_keys, const char *input_path, const char *output
             success = false;
         }
     }
-    OPENSSL_cleanse(plaintext, block_size);
+    OPENSSL_cleanse(plaintext, CRYPT_BATCH_SIZE);
 
   cleanup:
     fclose(input_file);
     fclose(output_file);
     SeqDestroy(evp_keys);
     SeqDestroy(enc_keys);
+    free(plaintext);
+    free(ciphertext);
     EVP_CIPHER_CTX_free(ctx);
     return success;
 }
@@ -707,7 +716,8 @@ static bool RSADecrypt(RSA *privkey, const char *input_path, const char *output_
 
     const int block_size = EVP_CIPHER_block_size(cipher);
 
-    char plaintext[block_size], ciphertext[2 * block_size];
+    char *plaintext = xmalloc(CRYPT_BATCH_SIZE + block_size);
+    char *ciphertext = xmalloc(CRYPT_BATCH_SIZE);
     int pt_len;
 
     ssize_t n_read = ReadFileStreamToBuffer(input_file, iv_size, iv);
@@ -765,7 +775,7 @@ static bool RSADecrypt(RSA *privkey, const char *input_path, const char *output_
     ssize_t n_written;
     while (success && !feof(input_file))
     {
-        n_read = ReadFileStreamToBuffer(input_file, block_size, ciphertext);
+        n_read = ReadFileStreamToBuffer(input_file, CRYPT_BATCH_SIZE, ciphertext);
         if (n_read == FILE_ERROR_READ)
         {
             Log(LOG_LEVEL_ERR, "Could not read file '%s'", input_path);
@@ -807,16 +817,236 @@ static bool RSADecrypt(RSA *privkey, const char *input_path, const char *output_
             success = false;
         }
     }
-    OPENSSL_cleanse(plaintext, block_size);
+    OPENSSL_cleanse(plaintext, CRYPT_BATCH_SIZE + block_size);
 
   cleanup:
     fclose(input_file);
     fclose(output_file);
+    free(plaintext);
+    free(ciphertext);
     EVP_PKEY_free(evp_key);
     EVP_CIPHER_CTX_free(ctx);
     return success;
 }
 
+/**
+ * Re-encrypt the file key of an already encrypted file for a new set of
+ * recipients, copying the payload ciphertext verbatim. \p privkey must be one
+ * of the keys the file was originally encrypted for; it is used to unwrap the
+ * session key, which is then wrapped for each key in \p new_rsa_keys. Changing
+ * the recipient list of a large file this way costs a few RSA operations
+ * instead of a full decrypt+encrypt pass.
+ */
+static bool RSARewrap(RSA *privkey, Seq *new_rsa_keys, const char *input_path, const char *output_path)
+{
+    assert((new_rsa_keys != NULL) && (SeqLength(new_rsa_keys) > 0));
+
+    FILE *input_file = OpenInputOutput(input_path, "r");
+    if (input_file == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Cannot open input file '%s'", input_path);
+        return false;
+    }
+
+    FILE *output_file = OpenInputOutput(output_path, "w");
+    if (output_file == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Cannot open output file '%s'", output_path);
+        fclose(input_file);
+        return false;
+    }
+
+    EVP_PKEY *evp_key = EVP_PKEY_new();
+    if (EVP_PKEY_set1_RSA(evp_key, privkey) == 0)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to initialize decryption context");
+        fclose(input_file);
+        fclose(output_file);
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Parsing headers");
+    size_t our_key_pos;
+    size_t n_enc_keys;
+    if (!ParseHeaders(input_file, privkey, &our_key_pos, &n_enc_keys))
+    {
+        fclose(input_file);
+        fclose(output_file);
+        EVP_PKEY_free(evp_key);
+        return false;
+    }
+
+    bool success = true;
+
+    const EVP_CIPHER *cipher = EVP_aes_256_cbc();
+
+    const int iv_size = EVP_CIPHER_iv_length(cipher);
+    unsigned char iv[iv_size];
+
+    const int key_size = EVP_PKEY_size(evp_key);
+    unsigned char ek[key_size];
+    unsigned char dev_null[key_size];
+
+    unsigned char session_key[EVP_MAX_KEY_LENGTH];
+    size_t session_key_len = sizeof(session_key);
+
+    EVP_PKEY_CTX *pkey_ctx = NULL;
+    char *payload = xmalloc(CRYPT_BATCH_SIZE);
+
+    ssize_t n_read = ReadFileStreamToBuffer(input_file, iv_size, iv);
+    if (n_read != iv_size)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to read the IV from '%s'", input_path);
+        success = false;
+        goto cleanup;
+    }
+
+    /* find our wrapped copy of the session key, skipping the others */
+    for (size_t nth_key = 0; nth_key < n_enc_keys; nth_key++)
+    {
+        unsigned char *const dst = (nth_key == our_key_pos) ? ek : dev_null;
+        n_read = ReadFileStreamToBuffer(input_file, key_size, dst);
+        if (n_read != key_size)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to read the key from '%s'", input_path);
+            success = false;
+            goto cleanup;
+        }
+    }
+
+    /* EVP_SealInit() wraps the session key with PKCS#1 v1.5 (the default RSA
+     * padding), so a plain EVP_PKEY_decrypt() recovers it. */
+    pkey_ctx = EVP_PKEY_CTX_new(evp_key, NULL);
+    if (pkey_ctx == NULL ||
+        EVP_PKEY_decrypt_init(pkey_ctx) <= 0 ||
+        EVP_PKEY_decrypt(pkey_ctx, session_key, &session_key_len,
+                         ek, key_size) <= 0 ||
+        session_key_len != (size_t) EVP_CIPHER_key_length(cipher))
+    {
+        char *key_digest = GetPubkeyDigest(privkey);
+        Log(LOG_LEVEL_ERR, "Failed to unwrap the session key using key '%s'", key_digest);
+        free(key_digest);
+        success = false;
+        goto cleanup;
+    }
+    EVP_PKEY_CTX_free(pkey_ctx);
+    pkey_ctx = NULL;
+
+    /* newline and NUL-byte => +2 */
+    Log(LOG_LEVEL_VERBOSE, "Writing headers");
+    char header[MAX_HEADER_LEN + 2] = "Version: 1.0\n";
+    size_t header_len = strlen(header);
+    ssize_t n_written = FullWrite(fileno(output_file), header, header_len);
+    if (n_written < 0 || (size_t) n_written != header_len)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to write header to the output file '%s'", output_path);
+        success = false;
+        goto cleanup;
+    }
+    Log(LOG_LEVEL_VERBOSE, "Writing Encrypted-for headers");
+    const size_t n_new_keys = SeqLength(new_rsa_keys);
+    for (size_t i = 0; i < n_new_keys; i++)
+    {
+        char *key_digest = GetPubkeyDigest(SeqAt(new_rsa_keys, i));
+        header_len = snprintf(header, MAX_HEADER_LEN + 2, "Encrypted-for: %s\n", key_digest);
+        free(key_digest);
+        assert(header_len <= (MAX_HEADER_LEN + 2));
+        n_written = FullWrite(fileno(output_file), header, header_len);
+        if ((size_t) n_written != header_len)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to write header to the output file '%s'", output_path);
+            success = false;
+            goto cleanup;
+        }
+    }
+    n_written = FullWrite(fileno(output_file), "\n", 1);
+    if (n_written != 1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to write header to the output file '%s'", output_path);
+        success = false;
+        goto cleanup;
+    }
+    Log(LOG_LEVEL_VERBOSE, "Writing IV");
+    n_written = FullWrite(fileno(output_file), iv, iv_size);
+    if (n_written != iv_size)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to write IV to the output file '%s'", output_path);
+        success = false;
+        goto cleanup;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Writing keys");
+    for (size_t i = 0; i < n_new_keys; i++)
+    {
+        EVP_PKEY *new_key = EVP_PKEY_new();
+        if (EVP_PKEY_set1_RSA(new_key, SeqAt(new_rsa_keys, i)) == 0)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to initialize encryption context");
+            EVP_PKEY_free(new_key);
+            success = false;
+            goto cleanup;
+        }
+
+        unsigned char wrapped[EVP_PKEY_size(new_key)];
+        size_t wrapped_len = sizeof(wrapped);
+        pkey_ctx = EVP_PKEY_CTX_new(new_key, NULL);
+        const bool wrap_ok =
+            (pkey_ctx != NULL &&
+             EVP_PKEY_encrypt_init(pkey_ctx) > 0 &&
+             EVP_PKEY_encrypt(pkey_ctx, wrapped, &wrapped_len,
+                              session_key, session_key_len) > 0);
+        EVP_PKEY_CTX_free(pkey_ctx);
+        pkey_ctx = NULL;
+        EVP_PKEY_free(new_key);
+        if (!wrap_ok)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to wrap the session key: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+            success = false;
+            goto cleanup;
+        }
+
+        n_written = FullWrite(fileno(output_file), wrapped, wrapped_len);
+        if (n_written < 0 || (size_t) n_written != wrapped_len)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to write key to the output file '%s'", output_path);
+            success = false;
+            goto cleanup;
+        }
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Copying payload");
+    size_t processed = 0;
+    while (success && !feof(input_file))
+    {
+        n_read = ReadFileStreamToBuffer(input_file, CRYPT_BATCH_SIZE, payload);
+        if (n_read == FILE_ERROR_READ)
+        {
+            Log(LOG_LEVEL_ERR, "Could not read file '%s'", input_path);
+            success = false;
+            break;
+        }
+        n_written = FullWrite(fileno(output_file), payload, n_read);
+        if (n_written < 0)
+        {
+            Log(LOG_LEVEL_ERR, "Could not write file '%s'", output_path);
+            success = false;
+            break;
+        }
+        processed += n_read;
+        Log(LOG_LEVEL_VERBOSE, "%zu bytes processed", processed);
+    }
+
+  cleanup:
+    OPENSSL_cleanse(session_key, sizeof(session_key));
+    fclose(input_file);
+    fclose(output_file);
+    free(payload);
+    EVP_PKEY_CTX_free(pkey_ctx);
+    EVP_PKEY_free(evp_key);
+    return success;
+}
+
 static Seq *LoadPublicKeys(Seq *key_paths)
 {
     const size_t n_keys = SeqLength(key_paths);
@@ -869,6 +1099,7 @@ int main(int argc, char *argv[])
     bool encrypt = false;
     bool decrypt = false;
     bool print_headers = false;
+    bool rewrap = false;
 
     size_t offset = 0;
     if (StringEqual(argv[1], "encrypt"))
@@ -886,6 +1117,11 @@ int main(int argc, char *argv[])
         print_headers = true;
         offset++;
     }
+    else if (StringEqual(argv[1], "re-wrap"))
+    {
+        rewrap = true;
+        offset++;
+    }
 
     int c = 0;
     while ((c = getopt_long(argc - offset, argv + offset, "hMedk:o:H:", OPTIONS, NULL)) != -1)
@@ -931,9 +1167,9 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (!(decrypt || encrypt || print_headers))
+    if (!(decrypt || encrypt || print_headers || rewrap))
     {
-        printf("Command required. Specify either 'encrypt', 'decrypt' or 'print-headers'\n");
+        printf("Command required. Specify either 'encrypt', 'decrypt', 'print-headers' or 're-wrap'\n");
         CFKeyCryptHelp();
         DoCleanupAndExit(EXIT_FAILURE);
     }
@@ -987,7 +1223,7 @@ int main(int argc, char *argv[])
     }
 
     // Default to localhost
-    if ((encrypt || decrypt) && (host_arg == NULL) && (key_path_arg == NULL))
+    if ((encrypt || decrypt || rewrap) && (host_arg == NULL) && (key_path_arg == NULL))
     {
         Log(LOG_LEVEL_VERBOSE, "Using the localhost private key as default");
         host_arg = "localhost";
@@ -1032,7 +1268,7 @@ int main(int argc, char *argv[])
         const size_t n_hosts = SeqLength(hosts);
         for (size_t i = 0; i < n_hosts; i++)
         {
-            HostRSAKeyType key_type = encrypt ? HOST_RSA_KEY_PUBLIC : HOST_RSA_KEY_PRIVATE;
+            HostRSAKeyType key_type = (encrypt || rewrap) ? HOST_RSA_KEY_PUBLIC : HOST_RSA_KEY_PRIVATE;
             char *host = SeqAt(hosts, i);
             char *host_key_path = GetHostRSAKey(host, key_type);
             if (!host_key_path)
@@ -1089,6 +1325,36 @@ int main(int argc, char *argv[])
             DoCleanupAndExit(EXIT_FAILURE);
         }
     }
+    else if (rewrap)
+    {
+        Log(LOG_LEVEL_DEBUG, "Re-wrapping");
+        Seq *pub_keys = LoadPublicKeys(key_paths);
+        SeqDestroy(key_paths);
+        if (pub_keys == NULL)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to load public key(s)");
+            DoCleanupAndExit(EXIT_FAILURE);
+        }
+
+        char *priv_key_path = GetHostRSAKey("localhost", HOST_RSA_KEY_PRIVATE);
+        if (priv_key_path == NULL)
+        {
+            Log(LOG_LEVEL_ERR, "Unable to locate the localhost private key");
+            SeqDestroy(pub_keys);
+            DoCleanupAndExit(EXIT_FAILURE);
+        }
+        RSA *private_key = ReadPrivateKey(priv_key_path);
+        free(priv_key_path);
+
+        success = RSARewrap(private_key, pub_keys, input_path, output_path);
+        RSA_free(private_key);
+        SeqDestroy(pub_keys);
+        if (!success)
+        {
+            Log(LOG_LEVEL_ERR, "Re-wrapping failed");
+            DoCleanupAndExit(EXIT_FAILURE);
+        }
+    }
     else
     {
         ProgrammingError("Unexpected error in cf-secret");
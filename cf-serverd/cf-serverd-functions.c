@@ -44,6 +44,8 @@
 #include <unix.h>
 #include <man.h>
 #include <server_tls.h>                              /* ServerTLSInitialize */
+#include <server_stats.h>                          /* ServerStatsMaybeDump */
+#include <server_heartbeat.h>                       /* ServerHeartbeatOpen */
 #include <timeout.h>
 #include <known_dirs.h>
 #include <sysinfo.h>
@@ -410,7 +412,205 @@ static void ClearAuthAndACLs(void)
     acl_Free(roles_acl);    roles_acl    = NULL;
 }
 
-static void CheckFileChanges(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
+/* Double-buffered policy reload.
+ *
+ * Validating and parsing a hub-sized policy set takes seconds, and doing it
+ * inline in CheckFileChanges() stalled the accept loop -- and thus every new
+ * connection -- for that long.  Instead the expensive phase runs in a
+ * detached loader thread against a scratch EvalContext while the old policy
+ * keeps serving, and the finished tree is parked in STAGED_RELOAD.
+ * PolicyUpdateIfSafe() installs it once the connection threads have drained:
+ * clearing the live context, swapping the ACL globals and re-running
+ * KeepPromises() is cheap compared to the parse, so the service pause
+ * shrinks from seconds to roughly a select() timeout.  STAGED_RELOAD is
+ * shared between the loader thread and the accept loop and is protected by
+ * cft_policy. */
+
+static struct
+{
+    bool running;   /* a loader thread is parsing */
+    bool ready;     /* the parse finished and 'policy' below is valid */
+    Policy *policy; /* staged pre-parsed tree, NULL if the parse failed */
+} STAGED_RELOAD = { 0 }; /* GLOBAL_X */
+
+static void *PolicyLoaderThread(void *arg)
+{
+    GenericAgentConfig *config = arg;
+
+    Policy *policy = NULL;
+    if (GenericAgentArePromisesValid(config))
+    {
+        Log(LOG_LEVEL_NOTICE, "Rereading policy file '%s'",
+            config->input_file);
+
+        /* Parse against a scratch context: the live one belongs to the
+         * connection threads and must not be touched until they drain.
+         * TODO BUG: LoadPolicy() modifies config, but previous config has
+         * not been reset/free'd. Ideally we would want LoadPolicy to not
+         * modify config at all, but only modify ctx. */
+        EvalContext *scratch = EvalContextNew();
+        EvalContextClassPutHard(scratch, CF_AGENTTYPES[AGENT_TYPE_SERVER],
+                                "cfe_internal,source=agent");
+        policy = LoadPolicy(scratch, config);
+        EvalContextDestroy(scratch);
+    }
+    else
+    {
+        Log(LOG_LEVEL_INFO, "File changes contain errors -- ignoring");
+    }
+
+    ThreadLock(cft_policy);
+    STAGED_RELOAD.policy = policy;
+    STAGED_RELOAD.running = false;
+    STAGED_RELOAD.ready = true;
+    ThreadUnlock(cft_policy);
+    return NULL;
+}
+
+static void StartPolicyLoader(GenericAgentConfig *config)
+{
+    ThreadLock(cft_policy);
+    assert(!STAGED_RELOAD.running && !STAGED_RELOAD.ready);
+    STAGED_RELOAD.running = true;
+    ThreadUnlock(cft_policy);
+
+    pthread_t tid;
+    pthread_attr_t threadattrs;
+    int ret = pthread_attr_init(&threadattrs);
+    if (ret == 0)
+    {
+        pthread_attr_setdetachstate(&threadattrs, PTHREAD_CREATE_DETACHED);
+        ret = pthread_create(&tid, &threadattrs, PolicyLoaderThread, config);
+        pthread_attr_destroy(&threadattrs);
+    }
+
+    if (ret != 0)
+    {
+        errno = ret;
+        Log(LOG_LEVEL_ERR,
+            "Unable to spawn policy loader thread, parsing in the"
+            " accept loop instead. (pthread_create: %s)", GetErrorStr());
+        PolicyLoaderThread(config);
+    }
+}
+
+/* Policies replaced by a control-only reload (below). The running
+ * EvalContext still holds pointers into them (cached bodies, promise
+ * backreferences in variables), so they are kept alive until the next full
+ * reload clears the context. */
+static Seq *retired_policies = NULL; /* GLOBAL_X */
+
+/* Swap the staged policy tree in.
+ *
+ * Runs with cft_server_children held and zero active connection threads:
+ * everything below frees or rewrites state the connection threads read (the
+ * EvalContext, SERVER_ACCESS, the acl globals). */
+static void InstallStagedPolicy(EvalContext *ctx, Policy **policy,
+                                GenericAgentConfig *config, Policy *new_policy)
+{
+    if (PolicyBundlesEqual(*policy, new_policy))
+    {
+        /* Only bodies changed, i.e. control settings: apply them against
+         * the running context instead of clearing it, so that tuning a
+         * setting like bwlimit mid-incident does not dump the discovered
+         * environment and the caches the connection threads have warmed
+         * up.  The ACLs are rebuilt either way since access promises can
+         * reference the changed bodies. */
+        Log(LOG_LEVEL_INFO,
+            "Policy change only affects bodies, applying control settings"
+            " without a full reload");
+
+        if (retired_policies == NULL)
+        {
+            retired_policies = SeqNew(2, PolicyDestroy);
+        }
+        SeqAppend(retired_policies, *policy);
+        *policy = new_policy;
+
+        ClearAuthAndACLs();
+
+        bool unresolved_constraints;
+        KeepPromises(ctx, *policy, config, &unresolved_constraints);
+        Summarize();
+        if (unresolved_constraints)
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Unresolved variables found in cf-serverd policy,"
+                " scheduling policy reload");
+            RequestReloadConfig();
+        }
+        return;
+    }
+
+    /* STEP 1: Free everything */
+
+    EvalContextClear(ctx);
+
+    /* Nothing references the retired trees anymore. */
+    if (retired_policies != NULL)
+    {
+        SeqClear(retired_policies);
+    }
+
+    strcpy(VDOMAIN, "undefined.domain");
+
+    ClearAuthAndACLs();
+    PolicyDestroy(*policy);
+    *policy = new_policy;
+
+    /* STEP 2: Set Environment and evaluate the pre-parsed policy */
+
+    /*
+     * TODO why is this done separately here? What's the difference to
+     * calling the same steps as in cf-serverd.c:main()? Those are:
+     *   GenericAgentConfigApply();     // not here!
+     *   GenericAgentDiscoverContext(); // not here!
+     *   EvalContextClassPutHard("server");             // only here!
+     *   if (GenericAgentCheckPolicy()) // not here!
+     *     policy = LoadPolicy();       // in PolicyLoaderThread()
+     *   ThisAgentInit();               // not here, only calls umask()
+     *   ReloadHAConfig();                              // only here!
+     *   KeepPromises();
+     *   Summarize();
+     * Plus the following from within StartServer() which is only
+     * called during startup:
+     *   InitSignals();                  // not here
+     *   ServerTLSInitialize();          // not here
+     *   SetServerListenState();         // not here
+     *   InitServer()                    // not here
+     *   PolicyNew()+AcquireServerLock() // not here
+     *   PrepareServer(sd);              // not here
+     *   CollectCallStart();  // both
+     */
+
+    EvalContextSetPolicyServerFromFile(ctx, GetWorkDir());
+
+    UpdateLastPolicyUpdateTime(ctx);
+
+    DetectEnvironment(ctx);
+    GenericAgentDiscoverContext(ctx, config, NULL);
+
+    /* During startup this is done in GenericAgentDiscoverContext(). */
+    EvalContextClassPutHard(ctx, CF_AGENTTYPES[AGENT_TYPE_SERVER], "cfe_internal,source=agent");
+
+    time_t t = SetReferenceTime();
+    UpdateTimeClasses(ctx, t);
+
+    /* Reload HA related configuration */
+    ReloadHAConfig();
+
+    bool unresolved_constraints;
+    KeepPromises(ctx, *policy, config, &unresolved_constraints);
+    Summarize();
+    if (unresolved_constraints)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Unresolved variables found in cf-serverd policy, scheduling policy reload");
+        RequestReloadConfig();
+    }
+}
+
+static void CheckFileChanges(EvalContext *ctx, GenericAgentConfig *config)
 {
     Log(LOG_LEVEL_DEBUG, "Checking file updates for input file '%s'",
         config->input_file);
@@ -437,80 +637,7 @@ static void CheckFileChanges(EvalContext *ctx, Policy **policy, GenericAgentConf
         /* Rereading policies now, so update timestamp. */
         config->agent_specific.daemon.last_validated_at = validated_at;
 
-        if (GenericAgentArePromisesValid(config))
-        {
-            Log(LOG_LEVEL_NOTICE, "Rereading policy file '%s'",
-                config->input_file);
-
-            /* STEP 1: Free everything */
-
-            EvalContextClear(ctx);
-
-            strcpy(VDOMAIN, "undefined.domain");
-
-            ClearAuthAndACLs();
-            PolicyDestroy(*policy);               *policy = NULL;
-
-            /* STEP 2: Set Environment, Parse and Evaluate policy */
-
-            /*
-             * TODO why is this done separately here? What's the difference to
-             * calling the same steps as in cf-serverd.c:main()? Those are:
-             *   GenericAgentConfigApply();     // not here!
-             *   GenericAgentDiscoverContext(); // not here!
-             *   EvalContextClassPutHard("server");             // only here!
-             *   if (GenericAgentCheckPolicy()) // not here!
-             *     policy = LoadPolicy();
-             *   ThisAgentInit();               // not here, only calls umask()
-             *   ReloadHAConfig();                              // only here!
-             *   KeepPromises();
-             *   Summarize();
-             * Plus the following from within StartServer() which is only
-             * called during startup:
-             *   InitSignals();                  // not here
-             *   ServerTLSInitialize();          // not here
-             *   SetServerListenState();         // not here
-             *   InitServer()                    // not here
-             *   PolicyNew()+AcquireServerLock() // not here
-             *   PrepareServer(sd);              // not here
-             *   CollectCallStart();  // both
-             */
-
-            EvalContextSetPolicyServerFromFile(ctx, GetWorkDir());
-
-            UpdateLastPolicyUpdateTime(ctx);
-
-            DetectEnvironment(ctx);
-            GenericAgentDiscoverContext(ctx, config, NULL);
-
-            /* During startup this is done in GenericAgentDiscoverContext(). */
-            EvalContextClassPutHard(ctx, CF_AGENTTYPES[AGENT_TYPE_SERVER], "cfe_internal,source=agent");
-
-            time_t t = SetReferenceTime();
-            UpdateTimeClasses(ctx, t);
-
-            /* TODO BUG: this modifies config, but previous config has not
-             * been reset/free'd. Ideally we would want LoadPolicy to not
-             * modify config at all, but only modify ctx. */
-            *policy = LoadPolicy(ctx, config);
-
-            /* Reload HA related configuration */
-            ReloadHAConfig();
-
-            bool unresolved_constraints;
-            KeepPromises(ctx, *policy, config, &unresolved_constraints);
-            Summarize();
-            if (unresolved_constraints)
-            {
-                Log(LOG_LEVEL_WARNING,
-                    "Unresolved variables found in cf-serverd policy, scheduling policy reload");
-                RequestReloadConfig();
-            }
-        }
-        else
-        {
-            Log(LOG_LEVEL_INFO, "File changes contain errors -- ignoring");
-        }
+        StartPolicyLoader(config);
     }
     else
     {
@@ -747,21 +874,68 @@ static void CollectCallIfDue(EvalContext *ctx)
     }
 }
 
-/* Check for new policy just before spawning a thread.
+/* Drive the double-buffered policy reload from the accept loop.
  *
- * Server reconfiguration can only happen when no threads are active,
- * so this is a good time to do it; but we do still have to check for
- * running threads. */
+ * Detecting and parsing new policy happens in the background while
+ * connections are being served; only the final swap of the live context and
+ * ACLs (InstallStagedPolicy()) needs the connection threads to have
+ * drained, and that phase is cheap. */
 static void PolicyUpdateIfSafe(EvalContext *ctx, Policy **policy,
                                GenericAgentConfig *config)
 {
-    ThreadLock(cft_server_children);
     int prior = COLLECT_INTERVAL;
-    if (ACTIVE_THREADS == 0)
+
+#if HAVE_SYSTEMD_SD_DAEMON_H
+    if (ReloadConfigRequested() && GRACEFUL != 0)
     {
-        CheckFileChanges(ctx, policy, config);
+        ThreadLock(cft_server_children);
+        const bool busy = (ACTIVE_THREADS > 0);
+        ThreadUnlock(cft_server_children);
+        if (busy)
+        {
+            /* StartServer() turns the still-pending reload request into a
+             * graceful restart; don't swallow it by staging a reload. */
+            return;
+        }
+    }
+#endif
+
+    ThreadLock(cft_policy);
+    const bool staging = STAGED_RELOAD.running;
+    const bool ready = STAGED_RELOAD.ready;
+    ThreadUnlock(cft_policy);
+
+    if (ready)
+    {
+        /* Connection threads are only ever spawned by this thread, so once
+         * the count is seen as zero it stays zero until we are done. */
+        ThreadLock(cft_server_children);
+        if (ACTIVE_THREADS == 0)
+        {
+            ThreadLock(cft_policy);
+            Policy *staged = STAGED_RELOAD.policy;
+            STAGED_RELOAD.policy = NULL;
+            STAGED_RELOAD.ready = false;
+            ThreadUnlock(cft_policy);
+
+            if (staged != NULL)
+            {
+                /* No connection threads are active here, but take the
+                 * writer side anyway so the install stays correct if the
+                 * drain requirement is ever relaxed. */
+                EvalContextWriteLock(ctx);
+                InstallStagedPolicy(ctx, policy, config, staged);
+                EvalContextWriteUnlock(ctx);
+            }
+        }
+        /* else: keep serving the old policy until the last connection
+         * thread drains; retried on the next pass of the accept loop. */
+        ThreadUnlock(cft_server_children);
+    }
+    else if (!staging)
+    {
+        CheckFileChanges(ctx, config);
     }
-    ThreadUnlock(cft_server_children);
 
     /* Check for change in call-collect interval: */
     if (prior != COLLECT_INTERVAL)
@@ -829,6 +1003,10 @@ int StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
 {
     InitSignals();
 
+    /* The evaluation context is shared with the connection threads; see the
+     * concurrency contract in eval_context.h. */
+    EvalContextSetupConcurrency(ctx);
+
     bool tls_init_ok = ServerTLSInitialize(NULL, NULL, NULL);
     if (!tls_init_ok)
     {
@@ -857,9 +1035,15 @@ int StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
     PrepareServer(sd);
     CollectCallStart(COLLECT_INTERVAL);
 
+    /* Heartbeat datagrams queue in the socket buffer and are drained once
+     * per loop pass, so their latency is bounded by WAIT_INCOMING_TIMEOUT
+     * without adding a descriptor to WaitForIncoming(). */
+    int hb_sd = ServerHeartbeatOpen();
+
     while (!IsPendingTermination())
     {
         CollectCallIfDue(ctx);
+        ServerStatsMaybeDump();
 
         int selected = WaitForIncoming(sd, WAIT_INCOMING_TIMEOUT);
 
@@ -875,6 +1059,8 @@ int StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
         {
             PolicyUpdateIfSafe(ctx, policy, config);
 
+            ServerHeartbeatDrain(hb_sd);
+
             /* Is there a new connection pending at our listening socket? */
             if (selected > 0)
             {
@@ -893,12 +1079,19 @@ int StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
     }
     Log(LOG_LEVEL_NOTICE, "Cleaning up and exiting...");
 
+    /* Flush what accumulated since the last periodic dump. */
+    ServerStatsDump();
+
     CollectCallStop();
     if (sd != -1)
     {
         Log(LOG_LEVEL_VERBOSE, "Closing listening socket");
         cf_closesocket(sd);                       /* Close listening socket */
     }
+    if (hb_sd != -1)
+    {
+        cf_closesocket(hb_sd);                  /* Close heartbeat socket */
+    }
 
     int threads_left;
 
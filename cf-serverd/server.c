@@ -48,8 +48,13 @@
 #include <cf-windows-functions.h>
 #include <logging_priv.h>                          /* LoggingPrivSetContext */
 #include <printsize.h>
+#include <sequence.h>                                                /* Seq */
+#include <timer_wheel.h>                  /* TimerWheelArm,TimerWheelDisarm */
 
 #include "server_classic.h"                    /* BusyWithClassicConnection */
+#include "server_stats.h"                         /* ServerStatsRecordLatency */
+#include "server_revdns_cache.h"                        /* RevDnsCacheLookup */
+#include "server_admission.h"                          /* AdmissionRetryHint */
 
 
 /*
@@ -194,21 +199,97 @@ static void PurgeOldConnections(Item **list, time_t now)
 
 /*********************************************************************/
 
-static void SpawnConnection(EvalContext *ctx, const char *ipaddr, ConnectionInfo *info)
+/* ==================== Connection worker pool ==================== */
+
+/* Accepted connections are handed to a pool of persistent worker threads
+ * instead of paying a pthread_create() plus a 1 MB stack for every single
+ * connection. Workers are started on demand up to CFD_MAXPROCESSES and exit
+ * again after WORKER_IDLE_TIMEOUT seconds without work, so an idle server
+ * keeps no extra threads around. */
+
+#define WORKER_IDLE_TIMEOUT 30                                  /* seconds */
+
+static pthread_mutex_t workers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workers_cond = PTHREAD_COND_INITIALIZER;
+static Seq *workers_queue = NULL;          /* ServerConnectionState * FIFO */
+static int workers_alive = 0;
+static int workers_idle = 0;
+
+static void *ConnectionWorker(ARG_UNUSED void *unused)
 {
-    ServerConnectionState *conn = NULL;
-    int ret;
-    pthread_t tid;
-    pthread_attr_t threadattrs;
+    pthread_mutex_lock(&workers_lock);
+    while (true)
+    {
+        while (SeqLength(workers_queue) == 0)
+        {
+            struct timespec deadline = {
+                .tv_sec = time(NULL) + WORKER_IDLE_TIMEOUT
+            };
+
+            workers_idle++;
+            int ret = pthread_cond_timedwait(&workers_cond, &workers_lock,
+                                             &deadline);
+            workers_idle--;
+
+            if (ret == ETIMEDOUT && SeqLength(workers_queue) == 0)
+            {
+                workers_alive--;
+                pthread_mutex_unlock(&workers_lock);
+                Log(LOG_LEVEL_DEBUG, "Idle connection worker exiting");
+                return NULL;
+            }
+        }
+
+        ServerConnectionState *conn = SeqAt(workers_queue, 0);
+        SeqRemove(workers_queue, 0);
+        pthread_mutex_unlock(&workers_lock);
+
+        HandleConnection(conn);
+        /* HandleConnection() installed a logging context pointing into its
+         * (now dead) stack frame; drop it before handling the next one. */
+        LoggingPrivSetContext(NULL);
+
+        pthread_mutex_lock(&workers_lock);
+    }
+}
 
-    conn = NewConn(ctx, info);                 /* freed in HandleConnection */
+static void SpawnConnection(EvalContext *ctx, const char *ipaddr, ConnectionInfo *info)
+{
+    ServerConnectionState *conn = NewConn(ctx, info);
+                                               /* freed in HandleConnection */
     int sd_accepted = ConnectionInfoSocket(info);
     strlcpy(conn->ipaddr, ipaddr, CF_MAX_IP_LEN );
 
     Log(LOG_LEVEL_VERBOSE,
-        "New connection (from %s, sd %d), spawning new thread...",
+        "New connection (from %s, sd %d), queueing to worker pool...",
         conn->ipaddr, sd_accepted);
 
+    pthread_mutex_lock(&workers_lock);
+    if (workers_queue == NULL)
+    {
+        workers_queue = SeqNew(64, NULL);
+    }
+    SeqAppend(workers_queue, conn);
+
+    /* Only start a new worker if nobody idle is about to pick this up. */
+    bool need_worker = (workers_idle == 0 &&
+                        workers_alive < MAX(CFD_MAXPROCESSES, 1));
+    if (need_worker)
+    {
+        workers_alive++;
+    }
+    pthread_mutex_unlock(&workers_lock);
+    pthread_cond_signal(&workers_cond);
+
+    if (!need_worker)
+    {
+        return;
+    }
+
+    int ret;
+    pthread_t tid;
+    pthread_attr_t threadattrs;
+
     ret = pthread_attr_init(&threadattrs);
     if (ret != 0)
     {
@@ -234,7 +315,7 @@ static void SpawnConnection(EvalContext *ctx, const char *ipaddr, ConnectionInfo
         /* Continue with default thread stack size. */
     }
 
-    ret = pthread_create(&tid, &threadattrs, HandleConnection, conn);
+    ret = pthread_create(&tid, &threadattrs, ConnectionWorker, NULL);
     if (ret != 0)
     {
         errno = ret;
@@ -249,8 +330,24 @@ static void SpawnConnection(EvalContext *ctx, const char *ipaddr, ConnectionInfo
   err:
     if (ret != 0)
     {
-        Log(LOG_LEVEL_WARNING, "Thread is being handled from main loop!");
-        HandleConnection(conn);
+        /* Could not start a worker; if no other worker is alive to drain
+         * the queue, fall back to handling the connection right here. */
+        pthread_mutex_lock(&workers_lock);
+        workers_alive--;
+        ServerConnectionState *orphan = NULL;
+        if (workers_alive == 0 && SeqLength(workers_queue) > 0)
+        {
+            orphan = SeqAt(workers_queue, 0);
+            SeqRemove(workers_queue, 0);
+        }
+        pthread_mutex_unlock(&workers_lock);
+
+        if (orphan != NULL)
+        {
+            Log(LOG_LEVEL_WARNING, "Thread is being handled from main loop!");
+            HandleConnection(orphan);
+            LoggingPrivSetContext(NULL);
+        }
     }
 }
 
@@ -280,10 +377,72 @@ static char *LogHook(LoggingPrivContext *log_ctx,
 /* TRIES: counts the number of consecutive connections dropped. */
 static int TRIES = 0;
 
+/**
+ * Account the request just served by a BusyWith* dispatcher, if it parsed
+ * one, against its verb's latency histogram.
+ */
+static void ServerStatsAccountRequest(ServerConnectionState *conn)
+{
+    if (conn->request_verb != NULL)
+    {
+        ServerStatsRecordLatency(conn->request_verb,
+                                 ServerStatsTimestamp() - conn->request_start);
+        conn->request_verb = NULL;
+    }
+}
+
+/**
+ * Refuse a connection over capacity with a protocol-level retry hint
+ * instead of a cold drop, so refused agents come back staggered rather
+ * than hammering us again on their own schedule.
+ *
+ * Delivering the hint to a TLS peer requires completing the handshake (the
+ * server hello carrying the refusal is the first thing sent inside the
+ * session); that cost is bounded by the connect timeout and is the price of
+ * turning a reconnection storm into a spread.  Classic-protocol peers keep
+ * the old drop: the client speaks first there and would misparse an
+ * unsolicited reply.
+ */
+static void ServerRefuseBusy(ServerConnectionState *conn, int active_threads)
+{
+    if (conn->conn_info->status != CONNECTIONINFO_STATUS_ESTABLISHED &&
+        !ServerTLSPeek(conn->conn_info))
+    {
+        return;
+    }
+
+    if (!ProtocolIsTLS(ConnectionInfoProtocolVersion(conn->conn_info)))
+    {
+        return;
+    }
+
+    TimerWheelEntry *deadline =
+        TimerWheelArm(ConnectionInfoSocket(conn->conn_info),
+                      (int64_t) CONNTIMEOUT * 1000);
+
+    if (BasicServerTLSSessionEstablish(conn, NULL))
+    {
+        const unsigned int hint =
+            AdmissionRetryHint(conn->ipaddr, active_threads,
+                               CFD_MAXPROCESSES);
+        char line[128];
+        const int len = snprintf(line, sizeof(line),
+                                 "BAD: server too busy, "
+                                 "retry after %u seconds\n", hint);
+        assert(len > 0 && (size_t) len < sizeof(line));
+        if (TLSSend(conn->conn_info->ssl, line, len) == len)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Refused connection with retry hint of %u seconds", hint);
+        }
+    }
+
+    TimerWheelDisarm(deadline);
+}
+
 static void *HandleConnection(void *c)
 {
     ServerConnectionState *conn = c;
-    int ret;
 
     /* Set logging prefix to be the IP address for all of thread's lifetime. */
     /* These stack-allocated variables should be valid for all the lifetime of
@@ -333,7 +492,9 @@ static void *HandleConnection(void *c)
             "Increase server maxconnections?",
             ACTIVE_THREADS, CFD_MAXPROCESSES);
 
+        const int active = ACTIVE_THREADS;
         ThreadUnlock(cft_server_children);
+        ServerRefuseBusy(conn, active);
         goto conndone;
     }
 
@@ -363,7 +524,26 @@ static void *HandleConnection(void *c)
 
     if (ProtocolIsTLS(protocol_version))
     {
+        /* A peer that goes silent mid-handshake would otherwise hold this
+         * thread for the full receive timeout; the wheel shuts the socket
+         * down after the plain connect timeout instead. */
+        TimerWheelEntry *deadline =
+            TimerWheelArm(ConnectionInfoSocket(conn->conn_info),
+                          (int64_t) CONNTIMEOUT * 1000);
+
+        const int64_t handshake_start = ServerStatsTimestamp();
         bool established = ServerTLSSessionEstablish(conn, NULL);
+        ServerStatsRecordLatency("TLS_HANDSHAKE",
+                                 ServerStatsTimestamp() - handshake_start);
+
+        if (TimerWheelDisarm(deadline))
+        {
+            Log(LOG_LEVEL_INFO,
+                "Closing connection from '%s': "
+                "TLS handshake timed out after %jd seconds",
+                conn->ipaddr, (intmax_t) CONNTIMEOUT);
+            goto dethread;
+        }
         if (!established)
         {
             goto dethread;
@@ -392,20 +572,15 @@ static void *HandleConnection(void *c)
     if (ProtocolIsTLS(protocol_version))
     {
         /* New protocol does DNS reverse look up of the connected
-         * IP address, to check hostname access_rules. */
+         * IP address, to check hostname access_rules.  The lookup goes
+         * through a TTL cache shared across connection threads, so during
+         * connection storms reconnecting agents do not each block on
+         * resolver latency. */
         if (NEED_REVERSE_LOOKUP)
         {
-            ret = getnameinfo((const struct sockaddr *) &conn->conn_info->ss,
-                              conn->conn_info->ss_len,
-                              conn->revdns, sizeof(conn->revdns),
-                              NULL, 0, NI_NAMEREQD);
-            if (ret != 0)
-            {
-                Log(LOG_LEVEL_INFO,
-                    "Reverse lookup failed (getnameinfo: %s)!",
-                    gai_strerror(ret));
-            }
-            else
+            if (RevDnsCacheLookup((const struct sockaddr *) &conn->conn_info->ss,
+                                  conn->conn_info->ss_len, conn->ipaddr,
+                                  conn->revdns, sizeof(conn->revdns)))
             {
                 Log(LOG_LEVEL_INFO,
                     "Hostname (reverse looked up): %s",
@@ -413,14 +588,20 @@ static void *HandleConnection(void *c)
             }
         }
 
-        while (BusyWithNewProtocol(conn->ctx, conn))
+        bool busy = true;
+        while (busy)
         {
+            busy = BusyWithNewProtocol(conn->ctx, conn);
+            ServerStatsAccountRequest(conn);
         }
     }
     else if (ProtocolIsClassic(protocol_version))
     {
-        while (BusyWithClassicConnection(conn->ctx, conn))
+        bool busy = true;
+        while (busy)
         {
+            busy = BusyWithClassicConnection(conn->ctx, conn);
+            ServerStatsAccountRequest(conn);
         }
     }
     else
@@ -124,6 +124,12 @@ struct ServerConnectionState_
     EvalContext *ctx;
 
     bool dump_reports;
+
+    /* Verb and receive timestamp (monotonic ns) of the request currently
+     * being served, for the latency histograms in server_stats.c.  Set when
+     * the request has been parsed, cleared when it has been accounted. */
+    const char *request_verb;
+    int64_t request_start;
 };
 
 typedef struct
@@ -34,6 +34,7 @@
 #include <misc_lib.h>
 #include <file_lib.h>
 #include <regex.h>
+#include <matching.h>                               /* CompileRegexCached */
 
 
 struct acl *paths_acl;
@@ -45,6 +46,25 @@ struct acl *bundles_acl;
 struct acl *roles_acl;
 
 
+/**
+ * Match an ACL rule as an anchored regular expression, compiling it through
+ * the process-wide regex cache: the rule set is fixed between policy
+ * reloads, but these matches run for every resource a client requests.
+ */
+static bool AclRuleMatch(const char *pattern, const char *string)
+{
+    /* Path rules mostly differ in their literal prefix, so reject on it
+     * before paying for a PCRE execution. */
+    if (!StringMatchFullLiteralPrefilter(pattern, string))
+    {
+        return false;
+    }
+
+    Regex *rx = CompileRegexCached(pattern);
+    return (rx != NULL && StringMatchFullWithPrecompiledRegex(rx, string));
+}
+
+
 /**
  * Run this function on every resource (file, class, var etc) access to
  * grant/deny rights. Currently it checks if:
@@ -92,7 +112,7 @@ static bool access_CheckResource(const struct resource_acl *acl,
         {
             if (FuzzySetMatch(StrList_At(acl->admit.ips, i), ipaddr) == 0 ||
                 /* Legacy regex matching, TODO DEPRECATE */
-                StringMatchFull(StrList_At(acl->admit.ips, i), ipaddr))
+                AclRuleMatch(StrList_At(acl->admit.ips, i), ipaddr))
             {
                 rule = StrList_At(acl->admit.ips, i);
                 break;
@@ -120,8 +140,8 @@ static bool access_CheckResource(const struct resource_acl *acl,
         {
             for (size_t i = 0; i < StrList_Len(acl->admit.hostnames); i++)
             {
-                if (StringMatchFull(StrList_At(acl->admit.hostnames, i),
-                                    hostname))
+                if (AclRuleMatch(StrList_At(acl->admit.hostnames, i),
+                                 hostname))
                 {
                     pos = i;
                     break;
@@ -198,7 +218,7 @@ static bool access_CheckResource(const struct resource_acl *acl,
         {
             if (FuzzySetMatch(StrList_At(acl->deny.ips, i), ipaddr) == 0 ||
                 /* Legacy regex matching, TODO DEPRECATE */
-                StringMatchFull(StrList_At(acl->deny.ips, i), ipaddr))
+                AclRuleMatch(StrList_At(acl->deny.ips, i), ipaddr))
             {
                 rule = StrList_At(acl->deny.ips, i);
                 break;
@@ -227,8 +247,8 @@ static bool access_CheckResource(const struct resource_acl *acl,
         {
             for (size_t i = 0; i < StrList_Len(acl->deny.hostnames); i++)
             {
-                if (StringMatchFull(StrList_At(acl->deny.hostnames, i),
-                                    hostname))
+                if (AclRuleMatch(StrList_At(acl->deny.hostnames, i),
+                                 hostname))
                 {
                     pos = i;
                     break;
@@ -405,7 +425,7 @@ bool acl_CheckRegex(const struct acl *acl, const char *req_string,
         const char *regex = acl->resource_names->list[i]->str;
 
         /* Does this ACL matches the req_string? */
-        if (StringMatchFull(regex, req_string))
+        if (AclRuleMatch(regex, req_string))
         {
             const struct resource_acl *racl = &acl->acls[i];
 
@@ -0,0 +1,162 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <platform.h>
+
+#include "server_admission.h"
+
+#include <logging.h>                                    /* Log */
+#include <alloc.h>                                      /* xstrdup,xcalloc */
+#include <map.h>                                        /* TYPED_MAP_* */
+#include <string_lib.h>                     /* StringHash,StringEqual */
+
+/* Smallest hint handed out, when barely over capacity. */
+#define RETRY_HINT_BASE 5
+
+/* The base grows up to this as the overload grows. */
+#define RETRY_HINT_BASE_MAX 30
+
+/* Seconds between successive slots handed to the same subnet. */
+#define RETRY_HINT_STRIDE 3
+
+/* Largest hint ever handed out; beyond this the agents' own schedule is a
+ * better spreader than our guess. */
+#define RETRY_HINT_MAX 120
+
+/* Subnets tracked before the slot table is flushed wholesale; see the
+ * reverse DNS cache for why no LRU is kept. */
+#define ADMISSION_MAX_SUBNETS 4096
+
+typedef struct
+{
+    time_t window_start;
+    unsigned int slots;         /* hints handed out in the current window */
+} SubnetSlots;
+
+static void SubnetSlotsDestroy_untyped(void *p)
+{
+    free(p);
+}
+
+/**
+   Define "SubnetMap" hash table.
+       Key:   subnet prefix of the peer address
+       Value: SubnetSlots
+*/
+TYPED_MAP_DECLARE(Subnet, char *, SubnetSlots *)
+TYPED_MAP_DEFINE(Subnet, char *, SubnetSlots *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 SubnetSlotsDestroy_untyped)
+
+static SubnetMap *subnet_slots = NULL;                  /* GLOBAL_X */
+static pthread_mutex_t admission_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+/* The subnet key is the printable address with its last component dropped:
+ * the /24 for IPv4, the upper hextets for IPv6.  Coarse, but agents behind
+ * one NAT or site link share it, which is what the fairness is for. */
+static char *SubnetKey(const char *ipaddr)
+{
+    char *key = xstrdup(ipaddr);
+    char *sep = strrchr(key, '.');
+    if (sep == NULL)
+    {
+        sep = strrchr(key, ':');
+    }
+    if (sep != NULL && sep != key)
+    {
+        *sep = '\0';
+    }
+    return key;
+}
+
+unsigned int AdmissionRetryHint(const char *ipaddr,
+                                int active_threads, int max_threads)
+{
+    assert(ipaddr != NULL);
+    assert(max_threads > 0);
+
+    /* Base hint proportional to how far over capacity we are: at the edge
+     * it is RETRY_HINT_BASE, at double capacity and beyond the maximum. */
+    unsigned int base = RETRY_HINT_BASE;
+    if (active_threads > max_threads)
+    {
+        base += (unsigned int)
+            ((RETRY_HINT_BASE_MAX - RETRY_HINT_BASE) *
+             (active_threads - max_threads) / max_threads);
+        if (base > RETRY_HINT_BASE_MAX)
+        {
+            base = RETRY_HINT_BASE_MAX;
+        }
+    }
+
+    char *key = SubnetKey(ipaddr);
+    const time_t now = time(NULL);
+
+    pthread_mutex_lock(&admission_lock);
+
+    if (subnet_slots == NULL)
+    {
+        subnet_slots = SubnetMapNew();
+    }
+
+    SubnetSlots *entry = SubnetMapGet(subnet_slots, key);
+    if (entry == NULL)
+    {
+        if (SubnetMapSize(subnet_slots) >= ADMISSION_MAX_SUBNETS)
+        {
+            SubnetMapClear(subnet_slots);
+        }
+        entry = xcalloc(1, sizeof(*entry));
+        entry->window_start = now;
+        SubnetMapInsert(subnet_slots, key, entry);
+        key = NULL;                                    /* map owns it now */
+    }
+    else if (now >= entry->window_start + RETRY_HINT_BASE_MAX)
+    {
+        /* The agents told to wait in the previous window have had their
+         * turn; start assigning slots from the front again. */
+        entry->window_start = now;
+        entry->slots = 0;
+    }
+
+    unsigned int hint = base + entry->slots * RETRY_HINT_STRIDE;
+    if (hint > RETRY_HINT_MAX)
+    {
+        /* Slots are exhausted; wrap instead of hinting past the point where
+         * the agents' own schedule takes over anyway. */
+        hint = RETRY_HINT_MAX;
+        entry->slots = 0;
+    }
+    else
+    {
+        entry->slots++;
+    }
+
+    pthread_mutex_unlock(&admission_lock);
+
+    free(key);
+    return hint;
+}
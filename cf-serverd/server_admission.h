@@ -0,0 +1,50 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_SERVER_ADMISSION_H
+#define CFENGINE_SERVER_ADMISSION_H
+
+#include <platform.h>
+
+/**
+ * Retry-hint scheduling for connections refused over capacity.
+ *
+ * When the server is saturated it used to drop surplus connections cold;
+ * every refused agent then retried on its own schedule and the herd hit the
+ * server again at once.  Instead, each refused connection gets a "retry
+ * after N seconds" hint to take home.  The base of the hint grows with how
+ * far over capacity the server is, and consecutive refusals from the same
+ * subnet are assigned successive slots on top of it, so the agents behind
+ * one NAT or site link come back staggered rather than together, and no
+ * subnet can claim all the early slots.
+ */
+
+/**
+ * Compute the retry hint, in seconds, for a connection from #ipaddr refused
+ * while #active_threads of #max_threads connection threads are busy.
+ */
+unsigned int AdmissionRetryHint(const char *ipaddr,
+                                int active_threads, int max_threads);
+
+#endif
@@ -0,0 +1,354 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <server_bundle.h>
+
+#include <server_access.h>                       /* acl_CheckPath,paths_acl */
+#include <connection_info.h>         /* ConnectionInfoKey,KeyPrintableHash */
+#include <dir.h>
+#include <file_lib.h>
+#include <net.h>                         /* SendTransaction,...Cork/Uncork */
+
+/* How long a built bundle is reused before the directory is walked again.
+ * The bundle is only a bootstrap warm-up - the failsafe update reconciles
+ * divergence - so a short staleness window is harmless and is exactly what
+ * lets N simultaneous bootstraps share one construction. */
+#define BUNDLE_TTL 10                                            /* seconds */
+
+/* Refuse to serialize policy sets larger than this. */
+#define BUNDLE_MAX_BYTES (64 * 1024 * 1024)
+
+/* Payload bytes per content frame; must fit in one SendTransaction(). */
+#define BUNDLE_CHUNK 4000
+
+typedef struct
+{
+    char *data;
+    int len;
+    /* Absolute path on "FILE ..." header frames, NULL on content frames.
+     * ACL verdicts are per client, so the shared bundle stores everything
+     * and each path is checked again at send time. */
+    char *path;
+} BundleFrame;
+
+typedef struct
+{
+    char *dir;
+    time_t built_at;
+    Seq *frames;                                       /* of BundleFrame * */
+    size_t total_bytes;
+    unsigned int refcount;        /* threads currently sending this bundle */
+    bool stale;             /* superseded; destroy when refcount drops to 0 */
+} PolicyBundle;
+
+static PolicyBundle *CURRENT_BUNDLE = NULL;                     /* GLOBAL_X */
+static pthread_mutex_t bundle_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+
+static void BundleFrameDestroy(void *frame)
+{
+    BundleFrame *f = frame;
+    if (f != NULL)
+    {
+        free(f->data);
+        free(f->path);
+        free(f);
+    }
+}
+
+static void PolicyBundleDestroy(PolicyBundle *bundle)
+{
+    if (bundle != NULL)
+    {
+        assert(bundle->refcount == 0);
+        SeqDestroy(bundle->frames);
+        free(bundle->dir);
+        free(bundle);
+    }
+}
+
+static BundleFrame *AppendFrame(Seq *frames, const void *data, int len)
+{
+    BundleFrame *f = xcalloc(1, sizeof(*f));
+    f->data = xmalloc(len);
+    memcpy(f->data, data, len);
+    f->len = len;
+    SeqAppend(frames, f);
+    return f;
+}
+
+static bool AppendFileFrames(Seq *frames, const char *path, const char *rel,
+                             const struct stat *sb, size_t *total_bytes)
+{
+    *total_bytes += (size_t) sb->st_size;
+    if (*total_bytes > BUNDLE_MAX_BYTES)
+    {
+        Log(LOG_LEVEL_INFO,
+            "Policy bundle exceeds %d bytes, refusing to serialize it",
+            BUNDLE_MAX_BYTES);
+        return false;
+    }
+
+    char header[CF_BUFSIZE];
+    int len = snprintf(header, sizeof(header), "FILE %jo %jd %s",
+                       (uintmax_t) (sb->st_mode & 07777),
+                       (intmax_t) sb->st_size, rel);
+    if (len < 0 || (size_t) len >= sizeof(header))
+    {
+        Log(LOG_LEVEL_INFO, "Path too long for policy bundle: %s", rel);
+        return false;
+    }
+    BundleFrame *header_frame = AppendFrame(frames, header, len);
+    header_frame->path = xstrdup(path);
+
+    int fd = safe_open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_INFO,
+            "Could not open '%s' for policy bundle (open: %s)",
+            path, GetErrorStr());
+        return false;
+    }
+
+    off_t remaining = sb->st_size;
+    char chunk[BUNDLE_CHUNK];
+    while (remaining > 0)
+    {
+        ssize_t got = read(fd, chunk, MIN(remaining, (off_t) sizeof(chunk)));
+        if (got <= 0)
+        {
+            /* Short file (truncated since stat) or read error: either way
+             * the bundle would be malformed. */
+            Log(LOG_LEVEL_INFO,
+                "Could not read '%s' for policy bundle (read: %s)",
+                path, GetErrorStr());
+            close(fd);
+            return false;
+        }
+        AppendFrame(frames, chunk, got);
+        remaining -= got;
+    }
+
+    close(fd);
+    return true;
+}
+
+static bool AppendDirFrames(Seq *frames, const char *root, const char *rel,
+                            size_t *total_bytes, size_t *file_count)
+{
+    char path[CF_BUFSIZE];
+    int ret = snprintf(path, sizeof(path), "%s%s%s",
+                       root, (rel[0] == '\0') ? "" : "/", rel);
+    if (ret < 0 || (size_t) ret >= sizeof(path))
+    {
+        return false;
+    }
+
+    Dir *dirh = DirOpen(path);
+    if (dirh == NULL)
+    {
+        Log(LOG_LEVEL_INFO,
+            "Could not open '%s' for policy bundle (DirOpen: %s)",
+            path, GetErrorStr());
+        return false;
+    }
+
+    bool ok = true;
+    const struct dirent *dirp;
+    while (ok && (dirp = DirRead(dirh)) != NULL)
+    {
+        if (strcmp(dirp->d_name, ".") == 0 ||
+            strcmp(dirp->d_name, "..") == 0 ||
+            strcmp(dirp->d_name, ".git") == 0)
+        {
+            continue;
+        }
+
+        char child_rel[CF_BUFSIZE], child_path[CF_BUFSIZE];
+        ret = snprintf(child_rel, sizeof(child_rel), "%s%s%s",
+                       rel, (rel[0] == '\0') ? "" : "/", dirp->d_name);
+        if (ret < 0 || (size_t) ret >= sizeof(child_rel))
+        {
+            ok = false;
+            break;
+        }
+        ret = snprintf(child_path, sizeof(child_path), "%s/%s",
+                       root, child_rel);
+        if (ret < 0 || (size_t) ret >= sizeof(child_path))
+        {
+            ok = false;
+            break;
+        }
+
+        struct stat sb;
+        if (lstat(child_path, &sb) != 0)
+        {
+            continue;                           /* raced removal, skip it */
+        }
+
+        if (S_ISDIR(sb.st_mode))
+        {
+            ok = AppendDirFrames(frames, root, child_rel,
+                                 total_bytes, file_count);
+        }
+        else if (S_ISREG(sb.st_mode))
+        {
+            ok = AppendFileFrames(frames, child_path, child_rel,
+                                  &sb, total_bytes);
+            if (ok)
+            {
+                (*file_count)++;
+            }
+        }
+        /* Symlinks and special files are not part of a policy set. */
+    }
+
+    DirClose(dirh);
+    return ok;
+}
+
+static PolicyBundle *PolicyBundleNew(const char *dirname)
+{
+    PolicyBundle *bundle = xcalloc(1, sizeof(PolicyBundle));
+    bundle->dir = xstrdup(dirname);
+    bundle->built_at = time(NULL);
+    bundle->frames = SeqNew(256, BundleFrameDestroy);
+
+    size_t file_count = 0;
+    if (!AppendDirFrames(bundle->frames, dirname, "",
+                         &bundle->total_bytes, &file_count))
+    {
+        PolicyBundleDestroy(bundle);
+        return NULL;
+    }
+
+    /* No "END <count>" frame here: the count depends on each client's ACL
+     * verdicts, so PolicyBundleSend() emits it per connection. */
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Built policy bundle of '%s': %zu files, %zu bytes",
+        dirname, file_count, bundle->total_bytes);
+    return bundle;
+}
+
+bool PolicyBundleSend(ServerConnectionState *conn, const char *dirname)
+{
+    pthread_mutex_lock(&bundle_lock);
+
+    if (CURRENT_BUNDLE != NULL &&
+        (strcmp(CURRENT_BUNDLE->dir, dirname) != 0 ||
+         time(NULL) - CURRENT_BUNDLE->built_at > BUNDLE_TTL))
+    {
+        if (CURRENT_BUNDLE->refcount == 0)
+        {
+            PolicyBundleDestroy(CURRENT_BUNDLE);
+        }
+        else
+        {
+            CURRENT_BUNDLE->stale = true;
+        }
+        CURRENT_BUNDLE = NULL;
+    }
+
+    if (CURRENT_BUNDLE == NULL)
+    {
+        /* Built while holding the lock: concurrent requests for the same
+         * directory wait here and then reuse the result, which is the
+         * whole point during a provisioning storm. */
+        CURRENT_BUNDLE = PolicyBundleNew(dirname);
+        if (CURRENT_BUNDLE == NULL)
+        {
+            pthread_mutex_unlock(&bundle_lock);
+            SendTransaction(conn->conn_info,
+                            "BAD: could not build policy bundle", 0, CF_DONE);
+            return false;
+        }
+    }
+
+    PolicyBundle *bundle = CURRENT_BUNDLE;
+    bundle->refcount++;
+    pthread_mutex_unlock(&bundle_lock);
+
+    bool ok = true;
+    const size_t frames = SeqLength(bundle->frames);
+    size_t sent_files = 0;
+    bool admitted = false;
+
+    SendTransactionCork(conn->conn_info);
+    for (size_t i = 0; ok && i < frames; i++)
+    {
+        const BundleFrame *f = SeqAt(bundle->frames, i);
+
+        if (f->path != NULL)
+        {
+            /* A new file starts: re-run the ACL check for its full path, so
+             * that deny rules nested under the admitted root still apply
+             * (longest-prefix match), as they do for per-file GETs. Denied
+             * files are skipped together with their content frames. */
+            admitted = acl_CheckPath(
+                paths_acl, f->path, conn->ipaddr, conn->revdns,
+                KeyPrintableHash(ConnectionInfoKey(conn->conn_info)));
+            if (admitted)
+            {
+                sent_files++;
+            }
+            else
+            {
+                Log(LOG_LEVEL_INFO,
+                    "access denied to bundled policy file: %s", f->path);
+            }
+        }
+
+        if (!admitted)
+        {
+            continue;
+        }
+
+        if (SendTransaction(conn->conn_info, f->data, f->len, CF_MORE) == -1)
+        {
+            ok = false;
+        }
+    }
+
+    if (ok)
+    {
+        char end[64];
+        int len = snprintf(end, sizeof(end), "END %zu", sent_files);
+        if (SendTransaction(conn->conn_info, end, len, CF_DONE) == -1)
+        {
+            ok = false;
+        }
+    }
+    SendTransactionUncork(conn->conn_info);
+
+    pthread_mutex_lock(&bundle_lock);
+    bundle->refcount--;
+    if (bundle->stale && bundle->refcount == 0)
+    {
+        PolicyBundleDestroy(bundle);
+    }
+    pthread_mutex_unlock(&bundle_lock);
+
+    return ok;
+}
@@ -0,0 +1,53 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_SERVER_BUNDLE_H
+#define CFENGINE_SERVER_BUNDLE_H
+
+#include <server.h>
+
+/**
+ * POLICYBUNDLE: stream every regular file under a directory in a single
+ * request, so that a bootstrapping agent fetches the whole policy set in
+ * one round trip instead of one GET per file.
+ *
+ * The serialized bundle is built once and shared by every connection that
+ * asks for the same directory while it is fresh, so a provisioning storm
+ * of simultaneous bootstraps costs one directory walk, not N.  ACL
+ * verdicts are per client, so the shared bundle holds every file and each
+ * file's path is re-checked against paths_acl at send time; files denied
+ * to the requesting client (e.g. by deny rules nested under the admitted
+ * root) are skipped.  The bundle is advisory for the client - the regular
+ * failsafe update still runs and reconciles any divergence - so briefly
+ * serving a just-superseded bundle is harmless.
+ *
+ * Wire format, one transaction per frame:
+ *   "FILE <octal mode> <size> <relative path>"  followed by the file's
+ *   content in chunks, repeated per admitted file, then
+ *   "END <file count>" with the count of files sent to this client.
+ *   Errors are reported as a single "BAD: <reason>" frame.
+ */
+bool PolicyBundleSend(ServerConnectionState *conn, const char *dirname);
+
+#endif
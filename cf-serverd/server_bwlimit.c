@@ -0,0 +1,236 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <platform.h>
+
+#include "server_bwlimit.h"
+
+#include <logging.h>                                    /* Log */
+#include <alloc.h>                                      /* xstrdup,xcalloc */
+#include <sequence.h>                                   /* Seq */
+#include <string_lib.h>                                 /* strlcpy */
+#include <addr_lib.h>                                   /* FuzzySetMatch */
+#include <misc_lib.h>                                   /* MIN */
+#include <cfnet.h>                                      /* CF_MAX_IP_LEN */
+
+/* Drop buckets that have not been used for this long, so that a hub serving
+ * many different subnets over time does not accumulate them without bound. */
+#define BWLIMIT_BUCKET_IDLE_SECONDS (10 * 60)
+
+/* Upper bound on the accumulated debt of a bucket, mirroring the 20 second
+ * penalty cap of EnforceBwLimit(): protects against huge sleeps after a
+ * backwards clock jump. */
+#define BWLIMIT_MAX_DEBT_SECONDS 20
+
+#ifdef CLOCK_MONOTONIC
+# define PREFERRED_CLOCK CLOCK_MONOTONIC
+#else
+# define PREFERRED_CLOCK CLOCK_REALTIME
+#endif
+
+typedef struct
+{
+    char *subnet;
+    double tokens;              /* bytes available; negative means debt */
+    struct timespec last_refill;
+} BwBucket;
+
+static uint32_t bwlimit_rate = 0;       /* bytes/s per subnet */ /* GLOBAL_P */
+static Seq *bwlimit_exempt = NULL;                      /* GLOBAL_P */
+static Seq *buckets = NULL;                             /* GLOBAL_X */
+static pthread_mutex_t bwlimit_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+void ServerBwLimitSetRate(uint32_t bytes_per_sec)
+{
+    pthread_mutex_lock(&bwlimit_lock);
+    bwlimit_rate = bytes_per_sec;
+    pthread_mutex_unlock(&bwlimit_lock);
+}
+
+void ServerBwLimitAddExempt(const char *pattern)
+{
+    assert(pattern != NULL);
+
+    pthread_mutex_lock(&bwlimit_lock);
+    if (bwlimit_exempt == NULL)
+    {
+        bwlimit_exempt = SeqNew(8, free);
+    }
+
+    bool known = false;
+    for (size_t i = 0; !known && i < SeqLength(bwlimit_exempt); i++)
+    {
+        known = (strcmp(SeqAt(bwlimit_exempt, i), pattern) == 0);
+    }
+    if (!known)
+    {
+        SeqAppend(bwlimit_exempt, xstrdup(pattern));
+    }
+    pthread_mutex_unlock(&bwlimit_lock);
+}
+
+/* Shared-bucket granularity: peers in the same IPv4 /24 or IPv6 /64 share
+ * one bucket, approximating "site" without any extra configuration.  Works
+ * on the textual address as cf-serverd stores it, so compressed IPv6 forms
+ * bucket by their textual prefix, which is consistent per peer. */
+static void SubnetKey(const char *ipaddr, char *key, size_t key_size)
+{
+    strlcpy(key, ipaddr, key_size);
+
+    if (strchr(key, ':') == NULL)
+    {
+        char *sep = strrchr(key, '.');
+        if (sep != NULL)
+        {
+            *sep = '\0';                          /* strip the host octet */
+        }
+        return;
+    }
+
+    int groups = 0;
+    for (char *sp = key; *sp != '\0'; sp++)
+    {
+        if (*sp == ':' && ++groups == 4)
+        {
+            *sp = '\0';
+            return;
+        }
+    }
+}
+
+/* Called with bwlimit_lock held. */
+static BwBucket *FindOrCreateBucket(const char *subnet, const struct timespec *now)
+{
+    if (buckets == NULL)
+    {
+        buckets = SeqNew(16, NULL);     /* entries are destroyed manually */
+    }
+
+    for (size_t i = 0; i < SeqLength(buckets); i++)
+    {
+        BwBucket *bucket = SeqAt(buckets, i);
+        if (strcmp(bucket->subnet, subnet) == 0)
+        {
+            return bucket;
+        }
+    }
+
+    /* Prune idle buckets before adding a new one. */
+    for (size_t i = SeqLength(buckets); i > 0; i--)
+    {
+        BwBucket *bucket = SeqAt(buckets, i - 1);
+        if (now->tv_sec - bucket->last_refill.tv_sec > BWLIMIT_BUCKET_IDLE_SECONDS)
+        {
+            SeqRemove(buckets, i - 1);
+            free(bucket->subnet);
+            free(bucket);
+        }
+    }
+
+    BwBucket *bucket = xcalloc(1, sizeof(BwBucket));
+    bucket->subnet = xstrdup(subnet);
+    bucket->tokens = bwlimit_rate;      /* allow an initial one second burst */
+    bucket->last_refill = *now;
+    SeqAppend(buckets, bucket);
+    return bucket;
+}
+
+void ServerBwLimitThrottle(const char *ipaddr, int tosend)
+{
+    if (bwlimit_rate == 0 || ipaddr == NULL || ipaddr[0] == '\0')
+    {
+        /* early return, before locking or any expensive syscalls */
+        return;
+    }
+
+#ifdef _WIN32
+    /* As with EnforceBwLimit(): no bandwidth shaping on Windows. */
+    (void) tosend;
+    return;
+#else
+
+    struct timespec now;
+    clock_gettime(PREFERRED_CLOCK, &now);
+
+    double wait_seconds = 0.0;
+
+    pthread_mutex_lock(&bwlimit_lock);
+
+    if (bwlimit_rate == 0)                       /* re-check under the lock */
+    {
+        pthread_mutex_unlock(&bwlimit_lock);
+        return;
+    }
+
+    if (bwlimit_exempt != NULL)
+    {
+        for (size_t i = 0; i < SeqLength(bwlimit_exempt); i++)
+        {
+            if (FuzzySetMatch(SeqAt(bwlimit_exempt, i), ipaddr) == 0)
+            {
+                pthread_mutex_unlock(&bwlimit_lock);
+                return;
+            }
+        }
+    }
+
+    char subnet[CF_MAX_IP_LEN];
+    SubnetKey(ipaddr, subnet, sizeof(subnet));
+
+    BwBucket *bucket = FindOrCreateBucket(subnet, &now);
+
+    double elapsed = (double) (now.tv_sec - bucket->last_refill.tv_sec) +
+                     (double) (now.tv_nsec - bucket->last_refill.tv_nsec) / 1e9;
+    if (elapsed > 0.0)
+    {
+        /* Burst capacity is one second's worth of tokens. */
+        bucket->tokens = MIN((double) bwlimit_rate,
+                             bucket->tokens + elapsed * bwlimit_rate);
+        bucket->last_refill = now;
+    }
+
+    bucket->tokens -= tosend;
+    if (bucket->tokens < -((double) BWLIMIT_MAX_DEBT_SECONDS * bwlimit_rate))
+    {
+        bucket->tokens = -((double) BWLIMIT_MAX_DEBT_SECONDS * bwlimit_rate);
+    }
+    if (bucket->tokens < 0.0)
+    {
+        wait_seconds = -bucket->tokens / bwlimit_rate;
+    }
+
+    pthread_mutex_unlock(&bwlimit_lock);
+
+    /* Sub-millisecond penalties are not worth a nanosleep(): the network
+     * buffers burst them out regardless (see EnforceBwLimit()). */
+    if (wait_seconds >= 0.001)
+    {
+        struct timespec delay = {
+            .tv_sec = (time_t) wait_seconds,
+            .tv_nsec = (long) ((wait_seconds - (time_t) wait_seconds) * 1e9),
+        };
+        nanosleep(&delay, NULL);
+    }
+#endif /* !_WIN32 */
+}
@@ -0,0 +1,60 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_SERVER_BWLIMIT_H
+#define CFENGINE_SERVER_BWLIMIT_H
+
+#include <platform.h>
+
+/**
+ * Outgoing transfer shaping for cf-serverd, configured in body server
+ * control ("bwlimit" and "bwlimit_exempt").
+ *
+ * Unlike the process-global limiter in libcfnet (EnforceBwLimit(), driven by
+ * body common control on the agent side), this one keeps a token bucket per
+ * peer subnet: all connections from the same IPv4 /24 (or IPv6 /64) share one
+ * bucket, so a WAN branch site pulling a policy update is held to the
+ * configured rate while peers on other subnets transfer at full speed.
+ */
+
+/**
+ * Set the per-subnet rate in bytes per second.  0 (the default) disables
+ * shaping.
+ */
+void ServerBwLimitSetRate(uint32_t bytes_per_sec);
+
+/**
+ * Exempt peers matching #pattern (an IP, subnet like "192.168.0.0/16", or
+ * wildcard form as in ACLs) from shaping, e.g. the LAN.
+ */
+void ServerBwLimitAddExempt(const char *pattern);
+
+/**
+ * Account #tosend bytes about to be sent to #ipaddr against its subnet's
+ * bucket and sleep if the bucket is exhausted.  Cheap no-op when no limit is
+ * configured.
+ */
+void ServerBwLimitThrottle(const char *ipaddr, int tosend);
+
+#endif
@@ -41,6 +41,7 @@
 
 #include "server.h"                                /* ServerConnectionState */
 #include "server_common.h"                         /* ListPersistentClasses */
+#include "server_stats.h"                          /* ServerStatsTimestamp */
 
 
 /* Functionality needed exclusively for the classic protocol. */
@@ -1079,6 +1080,12 @@ bool BusyWithClassicConnection(EvalContext *ctx, ServerConnectionState *conn)
 
     ProtocolCommandClassic command = GetCommandClassic(recvbuffer);
 
+    /* Start the latency clock only now: the blocking receive above mostly
+     * measures the client thinking, not us serving.  Our caller accounts the
+     * request once we return.  (NULL verb if the command is bad.) */
+    conn->request_verb = PROTOCOL_CLASSIC[command];
+    conn->request_start = ServerStatsTimestamp();
+
     switch (command)
     {
     /* Plain text authentication; this MUST be the first command client
@@ -56,6 +56,16 @@ static const int CF_NOSIZE = -1;
 #include <unix.h>                                  /* GetUserID() */
 #include <file_stream.h>
 #include "server_access.h"
+#include "server_file_cache.h"
+#include "server_bwlimit.h"
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#include <sys/sendfile.h>
+#endif
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
 
 
 /* NOTE: Always Log(LOG_LEVEL_INFO) before calling RefuseAccess(), so that
@@ -204,6 +214,10 @@ bool MatchClasses(const EvalContext *ctx, ServerConnectionState *conn)
 
         classlist = SplitStringAsItemList(recvbuffer, ' ');
 
+        /* Class table query section; the lock is never held across the
+         * network I/O above or the replies below. */
+        EvalContextReadLock(ctx);
+
         for (ip = classlist; ip != NULL; ip = ip->next)
         {
             Log(LOG_LEVEL_VERBOSE, "Checking whether class %s can be identified as me...", ip->name);
@@ -211,6 +225,7 @@ bool MatchClasses(const EvalContext *ctx, ServerConnectionState *conn)
             if (IsDefinedClass(ctx, ip->name))
             {
                 Log(LOG_LEVEL_DEBUG, "Class '%s' matched, accepting...", ip->name);
+                EvalContextReadUnlock(ctx);
                 DeleteItemList(classlist);
                 return true;
             }
@@ -235,6 +250,8 @@ bool MatchClasses(const EvalContext *ctx, ServerConnectionState *conn)
                     if (match)
                     {
                         Log(LOG_LEVEL_DEBUG, "Class matched regular expression '%s', accepting...", ip->name);
+                        ClassTableIteratorDestroy(iter);
+                        EvalContextReadUnlock(ctx);
                         DeleteItemList(classlist);
                         return true;
                     }
@@ -245,11 +262,14 @@ bool MatchClasses(const EvalContext *ctx, ServerConnectionState *conn)
             if (strncmp(ip->name, CFD_TERMINATOR, strlen(CFD_TERMINATOR)) == 0)
             {
                 Log(LOG_LEVEL_VERBOSE, "No classes matched, rejecting....");
+                EvalContextReadUnlock(ctx);
                 ReplyNothing(conn);
                 DeleteItemList(classlist);
                 return false;
             }
         }
+
+        EvalContextReadUnlock(ctx);
     }
 
     ReplyNothing(conn);
@@ -408,6 +428,194 @@ static void FailedTransfer(ConnectionInfo *connection)
     }
 }
 
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+/**
+ * Zero-copy transfer of @a fd over the classic (cleartext) protocol. The
+ * byte stream on the wire is identical to the read()/send() loop in
+ * CfGetFile(), including the "file is changing" abort marker, so receivers
+ * cannot tell the difference.
+ *
+ * @return true if the transfer was handled here (completely or aborted
+ *         mid-stream), false if sendfile(2) is not applicable to this
+ *         file/socket and no bytes were sent, in which case the caller must
+ *         fall back to the portable loop.
+ */
+static bool ServeFileSendfile(ServerFileGetState *args, int fd,
+                              const char *filename, struct stat *sb)
+{
+    const int sock = ConnectionInfoSocket(args->conn->conn_info);
+    const int blocksize = MAX(args->buf_size, 2048);  /* as in CfGetFile() */
+
+    /* Re-stat between segments to preserve the change-at-source check of
+     * the portable loop, without doing it on every block.  The receiver
+     * only recognizes the abort marker at block starts, so the segment is
+     * a whole number of blocks and the marker is only ever emitted with
+     * 'total' block-aligned. */
+    const off_t segment = ((off_t) (1024 * 1024) / blocksize) * blocksize;
+
+    off_t total = 0;
+    off_t offset = 0;
+
+    while (total < sb->st_size)
+    {
+        off_t savedlen = sb->st_size;
+        off_t chunk = MIN(segment, savedlen - total);
+
+        /* Coarser than the block-wise loops (one segment at a time), but the
+         * token bucket absorbs the burst and averages out correctly. */
+        ServerBwLimitThrottle(args->conn->ipaddr, chunk);
+
+        ssize_t sent = sendfile(sock, fd, &offset, (size_t) chunk);
+        if (sent == -1)
+        {
+            if (total == 0 && (errno == EINVAL || errno == ENOSYS))
+            {
+                /* Filesystem or socket does not support sendfile; nothing
+                 * has hit the wire, safe to fall back. */
+                return false;
+            }
+            Log(LOG_LEVEL_VERBOSE,
+                "Send failed in GetFile. (sendfile: %s)", GetErrorStr());
+            return true;
+        }
+        total += sent;
+
+        if (total < savedlen)
+        {
+            /* sendfile() returning 0 short of savedlen means the source hit
+             * EOF under us: the file shrank and must be aborted. */
+            const bool at_eof = (sent == 0);
+
+            if (total % blocksize != 0)
+            {
+                if (!at_eof)
+                {
+                    /* Short send: top the segment up to a block boundary
+                     * before considering a re-stat. */
+                    continue;
+                }
+
+                /* Pad to the boundary so the marker lands at a block start;
+                 * the receiver discards the data on abort anyway. */
+                char zeros[CF_BUFSIZE] = { 0 };
+                size_t pad = blocksize - (size_t) (total % blocksize);
+                if (SendSocketStream(sock, zeros, pad) == -1)
+                {
+                    Log(LOG_LEVEL_VERBOSE,
+                        "Send failed in GetFile. (send: %s)", GetErrorStr());
+                    return true;
+                }
+                total += pad;
+            }
+
+            if (stat(filename, sb) == -1)
+            {
+                Log(LOG_LEVEL_ERR, "Cannot stat file '%s'. (stat: %s)",
+                    filename, GetErrorStr());
+                return true;
+            }
+
+            if (at_eof || sb->st_size != savedlen)
+            {
+                char sendbuffer[CF_BUFSIZE];
+                memset(sendbuffer, 0, CF_BUFSIZE);
+                snprintf(sendbuffer, CF_BUFSIZE, "%s%s: %s",
+                         CF_CHANGEDSTR1, CF_CHANGEDSTR2, filename);
+
+                if (SendSocketStream(sock, sendbuffer, blocksize) == -1)
+                {
+                    Log(LOG_LEVEL_VERBOSE,
+                        "Send failed in GetFile. (send: %s)", GetErrorStr());
+                }
+
+                Log(LOG_LEVEL_DEBUG,
+                    "Aborting transfer after %jd: file is changing rapidly at source.",
+                    (intmax_t) total);
+                return true;
+            }
+        }
+    }
+
+    Log(LOG_LEVEL_DEBUG,
+        "Transferred %jd bytes of '%s' with sendfile",
+        (intmax_t) total, filename);
+    return true;
+}
+#endif /* HAVE_SENDFILE && HAVE_SYS_SENDFILE_H */
+
+/**
+ * Serve #cached, a shared in-memory mapping of #filename, over TLS. The byte
+ * stream is identical to the read()/send() loop in CfGetFile(), including
+ * the "file is changing" abort marker.
+ */
+static void ServeFileFromCache(ServerFileGetState *args,
+                               const FileCacheEntry *cached,
+                               const char *filename)
+{
+    SSL *ssl = ConnectionInfoSSL(args->conn->conn_info);
+    const int blocksize = MAX(args->buf_size, 2048);  /* as in CfGetFile() */
+    const char *data = FileCache_Data(cached);
+    const off_t size = FileCache_Size(cached);
+
+    /* Re-stat between segments to preserve the change-at-source check of
+     * the read() loop, without doing it on every block.  The mapping was
+     * validated against the file when acquired, but a concurrent rewrite of
+     * the file can still show through it. */
+    const off_t segment = 1024 * 1024;
+    off_t next_check = segment;
+
+    /* Coalesce the block sends into full-size segments, as in CfGetFile(). */
+    SendTransactionCork(args->conn->conn_info);
+
+    off_t total = 0;
+    while (total < size)
+    {
+        const off_t chunk = MIN((off_t) blocksize, size - total);
+
+        ServerBwLimitThrottle(args->conn->ipaddr, chunk);
+
+        if (TLSSend(ssl, data + total, chunk) == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)",
+                GetErrorStr());
+            SendTransactionUncork(args->conn->conn_info);
+            return;
+        }
+        total += chunk;
+
+        if (total < size && total >= next_check)
+        {
+            next_check += segment;
+
+            struct stat sb;
+            if (stat(filename, &sb) == -1 || sb.st_size != size)
+            {
+                char sendbuffer[CF_BUFSIZE];
+                memset(sendbuffer, 0, CF_BUFSIZE);
+                snprintf(sendbuffer, CF_BUFSIZE, "%s%s: %s",
+                         CF_CHANGEDSTR1, CF_CHANGEDSTR2, filename);
+
+                if (TLSSend(ssl, sendbuffer, blocksize) == -1)
+                {
+                    Log(LOG_LEVEL_VERBOSE,
+                        "Send failed in GetFile. (send: %s)", GetErrorStr());
+                }
+
+                Log(LOG_LEVEL_DEBUG,
+                    "Aborting transfer after %jd: file is changing rapidly at source.",
+                    (intmax_t) total);
+                SendTransactionUncork(args->conn->conn_info);
+                return;
+            }
+        }
+    }
+
+    SendTransactionUncork(args->conn->conn_info);
+
+    Log(LOG_LEVEL_DEBUG, "Transferred %jd bytes of '%s' from the file cache",
+        (intmax_t) total, filename);
+}
+
 void CfGetFile(ServerFileGetState *args)
 {
     assert(args != NULL);
@@ -417,7 +625,14 @@ void CfGetFile(ServerFileGetState *args)
     off_t n_read, total = 0, sendlen = 0, count = 0;
     char sendbuffer[CF_BUFSIZE + 256], filename[CF_BUFSIZE - 128];
     struct stat sb;
-    int blocksize = 2048;
+
+    /* Stream in blocks of the size the client asked for in "GET %d". Old
+     * clients request 2048, newer ones up to CF_BUFSIZE - 1 to cut the
+     * number of read()/send() round trips per file. Sending larger blocks
+     * than requested would break the client's lockstep; the floor keeps the
+     * historical size for degenerate requests, which is what every server
+     * has always sent. */
+    int blocksize = MAX(args->buf_size, 2048);
 
     ConnectionInfo *conn_info = args->conn->conn_info;
 
@@ -468,6 +683,21 @@ void CfGetFile(ServerFileGetState *args)
         return;
     }
 
+    /* Serve small hot files (the policy payloads requested by every agent in
+     * a splay window) from the shared in-memory cache instead of an
+     * open()/read() cycle per connection.  The cleartext classic protocol
+     * already goes zero-copy through the page cache via sendfile below. */
+    if (ProtocolIsTLS(version))
+    {
+        FileCacheEntry *cached = FileCache_Acquire(filename, &sb);
+        if (cached != NULL)
+        {
+            ServeFileFromCache(args, cached, filename);
+            FileCache_Release(cached);
+            return;
+        }
+    }
+
     if ((fd = safe_open(filename, O_RDONLY)) == -1)
     {
         Log(LOG_LEVEL_ERR, "Open error of file '%s'. (open: %s)",
@@ -487,6 +717,17 @@ void CfGetFile(ServerFileGetState *args)
     }
     else
     {
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+        /* TLS connections encrypt in userspace and cannot use sendfile;
+         * the cleartext classic protocol can go zero-copy. */
+        if (ProtocolIsClassic(version) &&
+            ServeFileSendfile(args, fd, filename, &sb))
+        {
+            close(fd);
+            return;
+        }
+#endif
+
         int div = 3;
 
         if (sb.st_size > 10485760L) /* File larger than 10 MB, checks every 64kB */
@@ -494,6 +735,10 @@ void CfGetFile(ServerFileGetState *args)
             div = 32;
         }
 
+        /* Coalesce the block sends (often only 2048 bytes each for old
+         * clients) into full-size segments; works below TLS too. */
+        SendTransactionCork(conn_info);
+
         while (true)
         {
             memset(sendbuffer, 0, CF_BUFSIZE);
@@ -565,6 +810,8 @@ void CfGetFile(ServerFileGetState *args)
 
             total += n_read;
 
+            ServerBwLimitThrottle(args->conn->ipaddr, sendlen);
+
             const ProtocolVersion version = ConnectionInfoProtocolVersion(conn_info);
 
             if (ProtocolIsClassic(version))
@@ -585,10 +832,300 @@ void CfGetFile(ServerFileGetState *args)
             }
         }
 
+        SendTransactionUncork(conn_info);
+
         close(fd);
     }
 }
 
+/**
+ * Serve an "RGET" (ranged GET) request: like CfGetFile(), but stream the
+ * file starting at #offset so a client can resume an interrupted transfer
+ * instead of starting over.  The reply uses GET's raw block framing, so
+ * the client reads it with the same receive loop.  Only reachable over the
+ * TLS protocol (the command does not exist in the classic dialect), which
+ * spares this simpler loop the sendfile and file-cache special cases.
+ */
+void CfGetFileRange(ServerFileGetState *args, off_t offset)
+{
+    assert(args != NULL);
+    assert(args->conn != NULL);
+
+    char sendbuffer[CF_BUFSIZE + 256], filename[CF_BUFSIZE - 128];
+    struct stat sb;
+
+    const int blocksize = MAX(args->buf_size, 2048);  /* as in CfGetFile() */
+
+    ConnectionInfo *conn_info = args->conn->conn_info;
+
+    TranslatePath(args->replyfile, filename, sizeof(filename));
+
+    stat(filename, &sb);
+
+    Log(LOG_LEVEL_DEBUG, "CfGetFileRange('%s'), offset = %jd, size = %jd",
+        filename, (intmax_t) offset, (intmax_t) sb.st_size);
+
+    const ProtocolVersion version = ConnectionInfoProtocolVersion(conn_info);
+    assert(ProtocolIsTLS(version));
+
+    /* Refusals are a single "BAD: ..." transaction (unlike CfGetFile's
+     * padded block): no classic client ever sends RGET, and the client must
+     * be able to fall back to a plain GET on the same stream.  An offset
+     * beyond the file means the client resumes a stale copy; the refusal
+     * makes it restart from scratch, which fetches the new file. */
+    if (!TransferRights(args->conn, filename, &sb) ||
+        !ProtocolIsTLS(version) ||
+        offset < 0 || offset >= sb.st_size)
+    {
+        Log(LOG_LEVEL_INFO, "REFUSE ranged access to file: %s", filename);
+        RefuseAccess(args->conn, args->replyfile);
+        return;
+    }
+
+    int fd = safe_open(filename, O_RDONLY);
+    if (fd == -1 || lseek(fd, offset, SEEK_SET) != offset)
+    {
+        Log(LOG_LEVEL_ERR, "Open error of file '%s'. (open: %s)",
+            filename, GetErrorStr());
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        SendTransaction(conn_info, CF_FAILEDSTR, 0, CF_DONE);
+        return;
+    }
+
+    int div = 3;
+
+    if (sb.st_size > 10485760L) /* File larger than 10 MB, checks every 64kB */
+    {
+        div = 32;
+    }
+
+    off_t total = offset, count = 0;
+    SendTransactionCork(conn_info);
+
+    while (true)
+    {
+        memset(sendbuffer, 0, CF_BUFSIZE);
+
+        off_t n_read = read(fd, sendbuffer, blocksize);
+        if (n_read == -1)
+        {
+            Log(LOG_LEVEL_ERR, "Read failed in CfGetFileRange. (read: %s)",
+                GetErrorStr());
+            break;
+        }
+        if (n_read == 0)
+        {
+            break;
+        }
+
+        off_t savedlen = sb.st_size;
+
+        /* Check the file is not changing at source (as in CfGetFile()). */
+        if (count++ % div == 0)
+        {
+            if (stat(filename, &sb) != 0)
+            {
+                Log(LOG_LEVEL_ERR, "Cannot stat file '%s'. (stat: %s)",
+                    filename, GetErrorStr());
+                break;
+            }
+        }
+
+        if (sb.st_size != savedlen)
+        {
+            snprintf(sendbuffer, CF_BUFSIZE, "%s%s: %s",
+                     CF_CHANGEDSTR1, CF_CHANGEDSTR2, filename);
+            if (TLSSend(ConnectionInfoSSL(conn_info), sendbuffer, blocksize) == -1)
+            {
+                Log(LOG_LEVEL_VERBOSE,
+                    "Send failed in CfGetFileRange. (send: %s)", GetErrorStr());
+            }
+            Log(LOG_LEVEL_DEBUG,
+                "Aborting transfer after %jd: file is changing rapidly at source.",
+                (intmax_t) total);
+            break;
+        }
+
+        off_t sendlen = 0;
+        if ((savedlen - total) / blocksize > 0)
+        {
+            sendlen = blocksize;
+        }
+        else if (savedlen != 0)
+        {
+            sendlen = (savedlen - total);
+        }
+
+        total += n_read;
+
+        ServerBwLimitThrottle(args->conn->ipaddr, sendlen);
+
+        if (TLSSend(ConnectionInfoSSL(conn_info), sendbuffer, sendlen) == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Send failed in CfGetFileRange. (send: %s)", GetErrorStr());
+            break;
+        }
+    }
+
+    SendTransactionUncork(conn_info);
+
+    close(fd);
+}
+
+/**
+ * Serve a "CGET" (compressed GET) request. The reply is a sequence of
+ * transactions carrying a single zstd frame with the file contents; the
+ * last transaction is flagged CF_DONE. A transfer aborted mid-way (file
+ * changing at source) ends the stream before the frame is complete, which
+ * the receiver detects when decompressing. A "BAD: ..." first transaction
+ * refuses the transfer; servers built without libzstd always refuse, so
+ * clients fall back to plain GET.
+ */
+void CfCompressedGetFile(ServerFileGetState *args)
+{
+    assert(args != NULL);
+    assert(args->conn != NULL);
+
+    ConnectionInfo *conn_info = args->conn->conn_info;
+    char filename[CF_BUFSIZE - 128];
+    struct stat sb;
+
+    TranslatePath(args->replyfile, filename, sizeof(filename));
+
+    stat(filename, &sb);
+
+    Log(LOG_LEVEL_DEBUG, "CfCompressedGetFile('%s'), size = %jd",
+        filename, (intmax_t) sb.st_size);
+
+    if (!TransferRights(args->conn, filename, &sb))
+    {
+        Log(LOG_LEVEL_INFO, "REFUSE access to file: %s", filename);
+        RefuseAccess(args->conn, args->replyfile);     /* sends "BAD: ..." */
+        return;
+    }
+
+#ifndef HAVE_LIBZSTD
+    SendTransaction(conn_info, "BAD: Server not built with libzstd", 0,
+                    CF_DONE);
+#else
+    int fd = safe_open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Open error of file '%s'. (open: %s)",
+            filename, GetErrorStr());
+        SendTransaction(conn_info, CF_FAILEDSTR, 0, CF_DONE);
+        return;
+    }
+
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (cctx == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to allocate compression context");
+        SendTransaction(conn_info, CF_FAILEDSTR, 0, CF_DONE);
+        close(fd);
+        return;
+    }
+
+    int div = 3;
+    if (sb.st_size > 10485760L) /* File larger than 10 MB, checks every 64kB */
+    {
+        div = 32;
+    }
+
+    off_t count = 0;
+    bool done = false, aborted = false, send_failed = false;
+
+    /* The compressed frames are a burst of small packets; coalesce them. */
+    SendTransactionCork(conn_info);
+
+    while (!done && !aborted && !send_failed)
+    {
+        char inbuf[CF_MSGSIZE];
+        ssize_t n_read = read(fd, inbuf, sizeof(inbuf));
+        if (n_read == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            Log(LOG_LEVEL_ERR, "Read failed in CfCompressedGetFile. (read: %s)",
+                GetErrorStr());
+            aborted = true;
+            break;
+        }
+
+        /* Check the file is not changing at source (as in CfGetFile()). */
+        if (n_read > 0 && count++ % div == 0)
+        {
+            struct stat newsb;
+            if (stat(filename, &newsb) == -1 || newsb.st_size != sb.st_size)
+            {
+                Log(LOG_LEVEL_DEBUG,
+                    "Aborting transfer: %s is changing rapidly at source.",
+                    filename);
+                aborted = true;
+                break;
+            }
+        }
+
+        const ZSTD_EndDirective op =
+            (n_read == 0) ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer in = { inbuf, (size_t) n_read, 0 };
+
+        bool flushed = false;
+        while (!flushed && !aborted && !send_failed)
+        {
+            char outbuf[CF_MSGSIZE];
+            ZSTD_outBuffer out = { outbuf, sizeof(outbuf), 0 };
+
+            size_t remaining = ZSTD_compressStream2(cctx, &out, &in, op);
+            if (ZSTD_isError(remaining))
+            {
+                Log(LOG_LEVEL_ERR, "Compression of '%s' failed (%s)",
+                    filename, ZSTD_getErrorName(remaining));
+                aborted = true;
+                break;
+            }
+
+            const bool last = (op == ZSTD_e_end && remaining == 0);
+            if (out.pos > 0 || last)
+            {
+                if (SendTransaction(conn_info, outbuf, out.pos,
+                                    last ? CF_DONE : CF_MORE) == -1)
+                {
+                    Log(LOG_LEVEL_VERBOSE,
+                        "Send failed in CfCompressedGetFile. (send: %s)",
+                        GetErrorStr());
+                    send_failed = true;
+                    break;
+                }
+            }
+
+            flushed = (op == ZSTD_e_end) ? (remaining == 0)
+                                         : (in.pos == in.size);
+        }
+
+        done = (op == ZSTD_e_end);
+    }
+
+    if (aborted && !send_failed)
+    {
+        /* End the stream mid-frame; the receiver notices the incomplete
+         * zstd frame and discards the destination file. */
+        SendTransaction(conn_info, "", 0, CF_DONE);
+    }
+
+    SendTransactionUncork(conn_info);
+
+    ZSTD_freeCCtx(cctx);
+    close(fd);
+#endif  /* HAVE_LIBZSTD */
+}
+
 void CfEncryptGetFile(ServerFileGetState *args)
 /* Because the stream doesn't end for each file, we need to know the
    exact number of bytes transmitted, which might change during
@@ -699,6 +1236,8 @@ void CfEncryptGetFile(ServerFileGetState *args)
                 }
             }
 
+            ServerBwLimitThrottle(args->conn->ipaddr, cipherlen + finlen);
+
             if (total >= savedlen)
             {
                 if (SendTransaction(conn_info, (const char *) out, cipherlen + finlen, CF_DONE) == -1)
@@ -727,35 +1266,40 @@ void CfEncryptGetFile(ServerFileGetState *args)
     close(fd);
 }
 
-int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename)
 /* Because we do not know the size or structure of remote datatypes,*/
 /* the simplest way to transfer the data is to convert them into */
 /* plain text and interpret them on the other side. */
+
+/**
+ * Stat @a filename and format the plain text representation that the STAT
+ * command replies with into @a statline (of CF_MSGSIZE bytes). The symlink
+ * target, if any, is copied into @a linkbuf (of CF_BUFSIZE bytes, empty
+ * string otherwise).
+ *
+ * @return false if the file could not be examined; @a statline then holds
+ *         the corresponding "BAD: ..." reply.
+ */
+static bool StatLine(const char *filename, char *statline, char *linkbuf)
 {
-    assert(conn != NULL);
     Stat cfst;
     struct stat statbuf, statlinkbuf;
-    char linkbuf[CF_BUFSIZE], filename[CF_BUFSIZE - 128];
     int islink = false;
 
-    TranslatePath(ofilename, filename, sizeof(filename));
-
     memset(&cfst, 0, sizeof(Stat));
+    linkbuf[0] = '\0';
 
     if (strlen(ReadLastNode(filename)) > CF_MAXLINKSIZE)
     {
-        snprintf(sendbuffer, CF_MSGSIZE, "BAD: Filename suspiciously long [%s]", filename);
-        Log(LOG_LEVEL_ERR, "%s", sendbuffer);
-        SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE);
-        return -1;
+        snprintf(statline, CF_MSGSIZE, "BAD: Filename suspiciously long [%s]", filename);
+        Log(LOG_LEVEL_ERR, "%s", statline);
+        return false;
     }
 
     if (lstat(filename, &statbuf) == -1)
     {
-        snprintf(sendbuffer, CF_MSGSIZE, "BAD: unable to stat file %s", filename);
-        Log(LOG_LEVEL_VERBOSE, "%s. (lstat: %s)", sendbuffer, GetErrorStr());
-        SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE);
-        return -1;
+        snprintf(statline, CF_MSGSIZE, "BAD: unable to stat file %s", filename);
+        Log(LOG_LEVEL_VERBOSE, "%s. (lstat: %s)", statline, GetErrorStr());
+        return false;
     }
 
     cfst.cf_readlink = NULL;
@@ -774,10 +1318,9 @@ int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename)
 
         if (readlink(filename, linkbuf, CF_BUFSIZE - 1) == -1)
         {
-            strcpy(sendbuffer, "BAD: unable to read link");
-            Log(LOG_LEVEL_ERR, "%s. (readlink: %s)", sendbuffer, GetErrorStr());
-            SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE);
-            return -1;
+            strcpy(statline, "BAD: unable to read link");
+            Log(LOG_LEVEL_ERR, "%s. (readlink: %s)", statline, GetErrorStr());
+            return false;
         }
 
         Log(LOG_LEVEL_DEBUG, "readlink '%s'", linkbuf);
@@ -854,7 +1397,7 @@ int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename)
         cfst.cf_makeholes = 0;
     }
 
-    memset(sendbuffer, 0, CF_MSGSIZE);
+    memset(statline, 0, CF_MSGSIZE);
 
     /* send as plain text */
 
@@ -864,13 +1407,29 @@ int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename)
         (uintmax_t) cfst.cf_uid, (uintmax_t) cfst.cf_gid, (intmax_t) cfst.cf_size,
         (intmax_t) cfst.cf_atime, (intmax_t) cfst.cf_mtime);
 
-    snprintf(sendbuffer, CF_MSGSIZE,
+    snprintf(statline, CF_MSGSIZE,
              "OK: %d %ju %ju %ju %ju %jd %jd %jd %jd %d %d %d %jd",
              cfst.cf_type, (uintmax_t) cfst.cf_mode, (uintmax_t) cfst.cf_lmode,
              (uintmax_t) cfst.cf_uid, (uintmax_t) cfst.cf_gid,   (intmax_t) cfst.cf_size,
              (intmax_t) cfst.cf_atime, (intmax_t) cfst.cf_mtime, (intmax_t) cfst.cf_ctime,
              cfst.cf_makeholes, cfst.cf_ino, cfst.cf_nlink, (intmax_t) cfst.cf_dev);
 
+    return true;
+}
+
+int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename)
+{
+    assert(conn != NULL);
+    char linkbuf[CF_BUFSIZE], filename[CF_BUFSIZE - 128];
+
+    TranslatePath(ofilename, filename, sizeof(filename));
+
+    if (!StatLine(filename, sendbuffer, linkbuf))
+    {
+        SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE);
+        return -1;
+    }
+
     SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE);
 
     memset(sendbuffer, 0, CF_MSGSIZE);
@@ -882,15 +1441,11 @@ int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename)
         SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE);
         return -1;
     }
-    if (cfst.cf_readlink != NULL)
     {
+        /* Empty linkbuf (not a symlink) yields the plain "OK:" reply. */
         NDEBUG_UNUSED int ret = snprintf(sendbuffer, CF_MSGSIZE, "OK:%s", linkbuf);
         assert(ret > 0 && ret < CF_MSGSIZE);
     }
-    else
-    {
-        strcpy(sendbuffer, "OK:");
-    }
 
     SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE);
     return 0;
@@ -929,7 +1484,11 @@ void GetServerLiteral(EvalContext *ctx, ServerConnectionState *conn, char *sendb
 
     sscanf(recvbuffer, "VAR %255[^\n]", handle);
 
-    if (ReturnLiteralData(ctx, handle, out))
+    EvalContextReadLock(ctx);
+    const bool found = ReturnLiteralData(ctx, handle, out);
+    EvalContextReadUnlock(ctx);
+
+    if (found)
     {
         memset(sendbuffer, 0, CF_BUFSIZE);
         snprintf(sendbuffer, CF_BUFSIZE, "%s", out);
@@ -1022,6 +1581,9 @@ int CfOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *oldDirn
 
 /* Pack names for transmission */
 
+    /* The listing is a burst of small packets; coalesce them. */
+    SendTransactionCork(conn->conn_info);
+
     offset = 0;
     for (dirp = DirRead(dirh); dirp != NULL; dirp = DirRead(dirh))
     {
@@ -1045,6 +1607,115 @@ int CfOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *oldDirn
     /* Double '\0' indicates end of packet. */
     sendbuffer[offset] = '\0';
     SendTransaction(conn->conn_info, sendbuffer, offset + 1, CF_DONE);
+    SendTransactionUncork(conn->conn_info);
+
+    DirClose(dirh);
+    return 0;
+}
+
+/**************************************************************/
+
+int CfStatDirectory(ServerConnectionState *conn, char *sendbuffer, char *oldDirname)
+{
+    Dir *dirh;
+    const struct dirent *dirp;
+    int offset;
+    char dirname[CF_BUFSIZE - 128];
+
+    TranslatePath(oldDirname, dirname, sizeof(dirname));
+
+    if (!IsAbsoluteFileName(dirname))
+    {
+        strcpy(sendbuffer, "BAD: request to access a non-absolute filename");
+        SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE);
+        return -1;
+    }
+
+    if ((dirh = DirOpen(dirname)) == NULL)
+    {
+        Log(LOG_LEVEL_INFO, "Couldn't open directory '%s' (DirOpen:%s)",
+            dirname, GetErrorStr());
+        snprintf(sendbuffer, CF_BUFSIZE, "BAD: cfengine, couldn't open dir %s", dirname);
+        SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE);
+        return -1;
+    }
+
+/* Pack (name, stat line, link target) string triples for transmission,
+ * framed like the OPENDIR reply. A triple never spans packets. */
+
+    /* The listing is a burst of small packets; coalesce them. */
+    SendTransactionCork(conn->conn_info);
+
+    offset = 0;
+    for (dirp = DirRead(dirh); dirp != NULL; dirp = DirRead(dirh))
+    {
+        char path[CF_BUFSIZE], statline[CF_MSGSIZE], linkbuf[CF_BUFSIZE];
+
+        /* The dispatcher appended a trailing slash to the directory. */
+        int ret = snprintf(path, sizeof(path), "%s%s%s", dirname,
+                           IsFileSep(dirname[strlen(dirname) - 1]) ? "" : FILE_SEPARATOR_STR,
+                           dirp->d_name);
+        if (ret < 0 || (size_t) ret >= sizeof(path))
+        {
+            strcpy(statline, "BAD: Filename suspiciously long");
+            linkbuf[0] = '\0';
+        }
+        /* The dir itself passed the ACL check, but deeper paths can still
+         * be denied; refuse those entries exactly like STAT would. */
+        else if (acl_CheckPath(paths_acl, path,
+                               conn->ipaddr, conn->revdns,
+                               KeyPrintableHash(conn->conn_info->remote_key))
+                 == false)
+        {
+            Log(LOG_LEVEL_INFO, "access denied to STATDIR entry: %s", path);
+            strcpy(statline, "BAD: Access denied");
+            linkbuf[0] = '\0';
+        }
+        else
+        {
+            StatLine(path, statline, linkbuf);
+        }
+
+        size_t need = strlen(dirp->d_name) + 1
+            + strlen(statline) + 1
+            + strlen(linkbuf) + 1;
+
+        if (need + offset >= CF_BUFSIZE - CF_MAXLINKSIZE)
+        {
+            if (offset > 0)
+            {
+                /* Double '\0' indicates end of packet. */
+                sendbuffer[offset] = '\0';
+                SendTransaction(conn->conn_info, sendbuffer, offset + 1, CF_MORE);
+                offset = 0;                                   /* new packet */
+            }
+
+            if (need >= CF_BUFSIZE - CF_MAXLINKSIZE)
+            {
+                /* Even an empty packet can't hold this entry (enormous
+                 * symlink target); degrade it like STAT does. */
+                strcpy(statline, "BAD: Symlink resolves to a path too long"
+                       " to send over the protocol.");
+                linkbuf[0] = '\0';
+            }
+        }
+
+        /* The flush above guarantees the whole triple fits, so plain
+         * strcpy keeps the framing intact (no truncation gaps). */
+        strcpy(sendbuffer + offset, dirp->d_name);
+        offset += strlen(dirp->d_name) + 1;                  /* +1 for '\0' */
+        strcpy(sendbuffer + offset, statline);
+        offset += strlen(statline) + 1;
+        strcpy(sendbuffer + offset, linkbuf);
+        offset += strlen(linkbuf) + 1;
+    }
+
+    strcpy(sendbuffer + offset, CFD_TERMINATOR);
+    offset += strlen(CFD_TERMINATOR) + 1;                    /* +1 for '\0' */
+    /* Double '\0' indicates end of packet. */
+    sendbuffer[offset] = '\0';
+    SendTransaction(conn->conn_info, sendbuffer, offset + 1, CF_DONE);
+    SendTransactionUncork(conn->conn_info);
 
     DirClose(dirh);
     return 0;
@@ -43,10 +43,13 @@ bool IsUserNameValid(const char *username);
 bool MatchClasses(const EvalContext *ctx, ServerConnectionState *conn);
 void Terminate(ConnectionInfo *connection);
 void CfGetFile(ServerFileGetState *args);
+void CfGetFileRange(ServerFileGetState *args, off_t offset);
+void CfCompressedGetFile(ServerFileGetState *args);
 void CfEncryptGetFile(ServerFileGetState *args);
 int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename);
 void ReplyServerContext(ServerConnectionState *conn, int encrypted, Item *classes);
 int CfOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *oldDirname);
+int CfStatDirectory(ServerConnectionState *conn, char *sendbuffer, char *oldDirname);
 int CfSecOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *dirname);
 void GetServerLiteral(EvalContext *ctx, ServerConnectionState *conn, char *sendbuffer, char *recvbuffer, int encrypted);
 bool GetServerQuery(ServerConnectionState *conn, char *recvbuffer, int encrypted);
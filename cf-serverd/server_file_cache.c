@@ -0,0 +1,288 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <platform.h>
+
+#include "server_file_cache.h"
+
+#include <logging.h>                                    /* Log */
+#include <alloc.h>                                      /* xstrdup,xcalloc */
+#include <sequence.h>                                   /* Seq */
+#include <file_lib.h>                                   /* safe_open */
+#include <misc_lib.h>                                   /* GetErrorStr */
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+# include <sys/mman.h>                                  /* mmap,munmap */
+# define USE_FILE_CACHE 1
+#else
+# define USE_FILE_CACHE 0
+#endif
+
+/* Only cache files up to this size: the hot files during a splay window are
+ * policy payloads in the kilobyte range, and large artifacts would push them
+ * out while gaining little (their transfer time dwarfs the open/read
+ * overhead). */
+#define FILE_CACHE_MAX_FILE_SIZE (4 * 1024 * 1024)
+
+/* Upper bound on the total bytes mapped by the cache.  When exceeded, the
+ * least recently used idle entry is evicted; if every entry is busy, new
+ * files are simply served from disk. */
+#define FILE_CACHE_MAX_TOTAL_BYTES (64 * 1024 * 1024)
+
+struct FileCacheEntry_
+{
+    char *path;
+
+    /* Identity of the file contents the mapping was made from; a mismatch
+     * with a fresh stat means the masterfile was updated and the entry is
+     * replaced on the next acquisition. */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+
+    char *map;
+    unsigned int refcount;    /* threads currently serving from the mapping */
+    bool stale;               /* superseded; destroy when refcount drops to 0 */
+    time_t last_used;
+};
+
+#if USE_FILE_CACHE
+
+static Seq *cache = NULL;                               /* GLOBAL_X */
+static off_t cache_total_bytes = 0;                     /* GLOBAL_X */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+/* Called with cache_lock held and the entry already removed from the cache
+ * sequence and the byte accounting. */
+static void DestroyEntry(FileCacheEntry *entry)
+{
+    assert(entry->refcount == 0);
+
+    munmap(entry->map, entry->size);
+    free(entry->path);
+    free(entry);
+}
+
+/* Called with cache_lock held. */
+static void MarkEntryStale(size_t index)
+{
+    FileCacheEntry *entry = SeqAt(cache, index);
+
+    SeqRemove(cache, index);
+    cache_total_bytes -= entry->size;
+
+    if (entry->refcount == 0)
+    {
+        DestroyEntry(entry);
+    }
+    else
+    {
+        /* The last FileCache_Release() destroys it. */
+        entry->stale = true;
+    }
+}
+
+/* Evict the least recently used idle entry.  Called with cache_lock held.
+ * Returns false if every entry is currently being served from. */
+static bool EvictOneEntry(void)
+{
+    const size_t length = SeqLength(cache);
+    size_t victim = length;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        const FileCacheEntry *entry = SeqAt(cache, i);
+        if (entry->refcount == 0 &&
+            (victim == length ||
+             entry->last_used < ((FileCacheEntry *) SeqAt(cache, victim))->last_used))
+        {
+            victim = i;
+        }
+    }
+
+    if (victim == length)
+    {
+        return false;
+    }
+
+    Log(LOG_LEVEL_DEBUG, "Evicting '%s' from the file cache",
+        ((FileCacheEntry *) SeqAt(cache, victim))->path);
+    MarkEntryStale(victim);
+    return true;
+}
+
+FileCacheEntry *FileCache_Acquire(const char *path, const struct stat *sb)
+{
+    assert(path != NULL);
+    assert(sb != NULL);
+
+    if (!S_ISREG(sb->st_mode) ||
+        sb->st_size == 0 || sb->st_size > FILE_CACHE_MAX_FILE_SIZE)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+
+    if (cache == NULL)
+    {
+        cache = SeqNew(64, NULL);       /* entries are destroyed manually */
+    }
+
+    const time_t now = time(NULL);
+
+    for (size_t i = 0; i < SeqLength(cache); i++)
+    {
+        FileCacheEntry *entry = SeqAt(cache, i);
+        if (strcmp(entry->path, path) != 0)
+        {
+            continue;
+        }
+
+        if (entry->dev == sb->st_dev && entry->ino == sb->st_ino &&
+            entry->size == sb->st_size &&
+            entry->mtime == sb->st_mtime && entry->ctime == sb->st_ctime)
+        {
+            entry->refcount++;
+            entry->last_used = now;
+            pthread_mutex_unlock(&cache_lock);
+            return entry;
+        }
+
+        /* The file was updated: drop the old mapping (once idle) and map the
+         * new contents below. */
+        MarkEntryStale(i);
+        break;
+    }
+
+    int fd = safe_open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        pthread_mutex_unlock(&cache_lock);
+        return NULL;
+    }
+
+    /* Take the identity from the opened file descriptor so that the mapping
+     * can never be associated with stat information from a different file
+     * (the caller's stat and our open are not atomic). */
+    struct stat fsb;
+    if (fstat(fd, &fsb) == -1 || !S_ISREG(fsb.st_mode) ||
+        fsb.st_size == 0 || fsb.st_size > FILE_CACHE_MAX_FILE_SIZE)
+    {
+        close(fd);
+        pthread_mutex_unlock(&cache_lock);
+        return NULL;
+    }
+
+    char *map = mmap(NULL, fsb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not map file '%s' for the file cache. (mmap: %s)",
+            path, GetErrorStr());
+        pthread_mutex_unlock(&cache_lock);
+        return NULL;
+    }
+
+    bool room = true;
+    while (room && (cache_total_bytes + fsb.st_size > FILE_CACHE_MAX_TOTAL_BYTES))
+    {
+        room = EvictOneEntry();
+    }
+    if (!room)
+    {
+        /* Every cached mapping is busy: let this request stream from disk
+         * rather than growing without bound. */
+        munmap(map, fsb.st_size);
+        pthread_mutex_unlock(&cache_lock);
+        return NULL;
+    }
+
+    FileCacheEntry *entry = xcalloc(1, sizeof(FileCacheEntry));
+    entry->path = xstrdup(path);
+    entry->dev = fsb.st_dev;
+    entry->ino = fsb.st_ino;
+    entry->size = fsb.st_size;
+    entry->mtime = fsb.st_mtime;
+    entry->ctime = fsb.st_ctime;
+    entry->map = map;
+    entry->refcount = 1;
+    entry->last_used = now;
+
+    SeqAppend(cache, entry);
+    cache_total_bytes += entry->size;
+
+    Log(LOG_LEVEL_DEBUG, "Cached '%s' (%jd bytes, cache total %jd bytes)",
+        path, (intmax_t) entry->size, (intmax_t) cache_total_bytes);
+
+    pthread_mutex_unlock(&cache_lock);
+    return entry;
+}
+
+void FileCache_Release(FileCacheEntry *entry)
+{
+    if (entry == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+
+    assert(entry->refcount > 0);
+    entry->refcount--;
+    if (entry->stale && entry->refcount == 0)
+    {
+        DestroyEntry(entry);
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+}
+
+#else  /* !USE_FILE_CACHE */
+
+FileCacheEntry *FileCache_Acquire(ARG_UNUSED const char *path,
+                                  ARG_UNUSED const struct stat *sb)
+{
+    return NULL;
+}
+
+void FileCache_Release(ARG_UNUSED FileCacheEntry *entry)
+{
+}
+
+#endif /* USE_FILE_CACHE */
+
+const char *FileCache_Data(const FileCacheEntry *entry)
+{
+    assert(entry != NULL);
+    return entry->map;
+}
+
+off_t FileCache_Size(const FileCacheEntry *entry)
+{
+    assert(entry != NULL);
+    return entry->size;
+}
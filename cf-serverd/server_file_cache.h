@@ -0,0 +1,60 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_SERVER_FILE_CACHE_H
+#define CFENGINE_SERVER_FILE_CACHE_H
+
+#include <platform.h>
+
+/**
+ * Shared cache of read-only file mappings for serving the same files to many
+ * connections.  During a splay window thousands of agents fetch the same
+ * (small) policy files; instead of an open()/read() cycle per connection, the
+ * file is mapped once and every serving thread reads from the shared mapping.
+ *
+ * Entries are validated against the file's stat information on every
+ * acquisition, so an updated masterfile is picked up by the next request.
+ * Mappings are reference-counted: a mapping superseded or evicted while a
+ * thread is still serving from it stays alive until that thread releases it.
+ */
+
+typedef struct FileCacheEntry_ FileCacheEntry;
+
+/**
+ * Get a shared mapping of #path, either from the cache or by mapping the
+ * file.  #sb must be a fresh stat of #path and is used to validate a cached
+ * entry.  Returns NULL if the file is not cacheable (empty, too big, not a
+ * regular file, cache full of busy entries, or mmap unavailable); the caller
+ * should then stream the file from disk as usual.
+ *
+ * Must be paired with FileCache_Release() when the data is no longer needed.
+ */
+FileCacheEntry *FileCache_Acquire(const char *path, const struct stat *sb);
+
+const char *FileCache_Data(const FileCacheEntry *entry);
+off_t FileCache_Size(const FileCacheEntry *entry);
+
+void FileCache_Release(FileCacheEntry *entry);
+
+#endif
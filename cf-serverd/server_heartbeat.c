@@ -0,0 +1,350 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <platform.h>
+#include <server_heartbeat.h>
+
+#include <openssl/rsa.h>                                      /* RSA_verify */
+#include <openssl/sha.h>                  /* SHA256, SHA256_DIGEST_LENGTH */
+#include <openssl/obj_mac.h>                                  /* NID_sha256 */
+
+#include <cf3.defs.h>
+#include <cf3.extern.h>                                    /* BINDINTERFACE */
+#include <cfnet.h>                      /* CFENGINE_PORT_STR, CF_MAX_IP_LEN */
+#include <conversion.h>                                       /* MapAddress */
+#include <crypto.h>                                        /* HavePublicKey */
+#include <lastseen.h>                                            /* LastSaw1 */
+#include <logging.h>
+#include <ctype.h>                                               /* isalnum */
+
+/* A heartbeat datagram is one text line followed by a raw RSA signature:
+ *
+ *     CFHB2 <key-digest> <address> <unix-time>\n<signature>
+ *
+ * <key-digest> is the sender's key hash in the usual printable form
+ * ("SHA=...", as stored in ppkeys and cf_lastseen), <address> is the
+ * sender's own numeric address as the server sees it, <unix-time> is the
+ * decimal time at which the sender signed the packet, and <signature> is
+ * the RSA signature (SHA-256, PKCS#1 v1.5) over every byte up to and
+ * including the newline, made with the sender's private key.
+ *
+ * The address is part of the signed bytes and must match the datagram's
+ * source: without it, a captured heartbeat replayed from a spoofed source
+ * inside the freshness window would rebind the key's cf_lastseen entry to
+ * an address of the attacker's choosing. */
+
+#define HEARTBEAT_MAGIC "CFHB2"
+
+/* The header line is short; anything longer is garbage. */
+#define HEARTBEAT_MAX_HEADER 128
+
+/* Header plus the signature of a 4096-bit key. */
+#define HEARTBEAT_MAX_DATAGRAM (HEARTBEAT_MAX_HEADER + 512)
+
+/* Tolerated difference between the signed timestamp and our clock.  A
+ * heartbeat only asserts liveness, so a replay inside this window merely
+ * restates a fact that was true when the packet was signed. */
+#define HEARTBEAT_MAX_SKEW 300
+
+/* Upper bound on datagrams handled per drain, so that a flood degrades
+ * into delayed heartbeats instead of a busy accept loop. */
+#define HEARTBEAT_MAX_PER_DRAIN 128
+
+/**
+ * The digest becomes part of a ppkeys filename in HavePublicKey(), so
+ * accept nothing but the characters a printable key hash consists of.
+ */
+static bool HeartbeatDigestSyntaxOK(const char *digest)
+{
+    if (digest[0] == '\0')
+    {
+        return false;
+    }
+    for (const char *c = digest; *c != '\0'; c++)
+    {
+        if (!isalnum((unsigned char) *c) && (*c != '='))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Split a datagram into its header fields and signature.  On success
+ * #signed_len is the number of leading bytes the signature covers (the
+ * header line including its newline).
+ */
+static bool HeartbeatParse(const unsigned char *buf, size_t len,
+                           char *digest, size_t digest_size,
+                           char *claimed, size_t claimed_size, time_t *tstamp,
+                           const unsigned char **sig, size_t *sig_len,
+                           size_t *signed_len)
+{
+    const unsigned char *newline =
+        memchr(buf, '\n', MIN(len, (size_t) HEARTBEAT_MAX_HEADER));
+    if (newline == NULL)
+    {
+        return false;
+    }
+
+    const size_t line_len = newline - buf;
+    char header[HEARTBEAT_MAX_HEADER + 1];
+    memcpy(header, buf, line_len);
+    header[line_len] = '\0';
+
+    char digest_buf[HEARTBEAT_MAX_HEADER + 1];
+    char claimed_buf[HEARTBEAT_MAX_HEADER + 1];
+    long long stamp;
+    if (sscanf(header, HEARTBEAT_MAGIC " %128s %128s %lld",
+               digest_buf, claimed_buf, &stamp) != 3)
+    {
+        return false;
+    }
+    if (strlen(digest_buf) >= digest_size ||
+        !HeartbeatDigestSyntaxOK(digest_buf) ||
+        strlen(claimed_buf) >= claimed_size)
+    {
+        return false;
+    }
+
+    *sig = newline + 1;
+    *sig_len = len - (line_len + 1);
+    if (*sig_len == 0 || *sig_len > HEARTBEAT_MAX_DATAGRAM - line_len - 1)
+    {
+        return false;
+    }
+
+    strcpy(digest, digest_buf);
+    strcpy(claimed, claimed_buf);
+    *tstamp = (time_t) stamp;
+    *signed_len = line_len + 1;
+    return true;
+}
+
+static void HandleHeartbeat(const unsigned char *buf, size_t len,
+                            const char *ipaddr)
+{
+    char digest[CF_MAXVARSIZE];
+    char claimed[CF_MAX_IP_LEN];
+    time_t tstamp;
+    const unsigned char *sig;
+    size_t sig_len, signed_len;
+
+    if (!HeartbeatParse(buf, len, digest, sizeof(digest),
+                        claimed, sizeof(claimed), &tstamp,
+                        &sig, &sig_len, &signed_len))
+    {
+        Log(LOG_LEVEL_DEBUG, "Dropping malformed heartbeat from '%s'", ipaddr);
+        return;
+    }
+
+    const time_t now = time(NULL);
+    if (tstamp > now + HEARTBEAT_MAX_SKEW || tstamp < now - HEARTBEAT_MAX_SKEW)
+    {
+        Log(LOG_LEVEL_DEBUG,
+            "Dropping stale heartbeat from '%s' (signed at %jd, now %jd)",
+            ipaddr, (intmax_t) tstamp, (intmax_t) now);
+        return;
+    }
+
+    /* The signed address claim ties the signature to this source; a
+     * mismatch means the datagram was replayed from somewhere else. */
+    if (strcmp(MapAddress(claimed), ipaddr) != 0)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Dropping heartbeat from '%s' whose signed address is '%s'",
+            ipaddr, claimed);
+        return;
+    }
+
+    /* Look up the claimed identity before doing any signature work; a
+     * heartbeat from a host we have never exchanged keys with is dropped
+     * unverified. */
+    RSA *pubkey = HavePublicKey("root", ipaddr, digest);
+    if (pubkey == NULL)
+    {
+        Log(LOG_LEVEL_DEBUG,
+            "Dropping heartbeat from '%s': key '%s' not found in ppkeys",
+            ipaddr, digest);
+        return;
+    }
+
+    unsigned char md[SHA256_DIGEST_LENGTH];
+    SHA256(buf, signed_len, md);
+    const int valid = RSA_verify(NID_sha256, md, sizeof(md),
+                                 sig, (unsigned int) sig_len, pubkey);
+    RSA_free(pubkey);
+
+    if (valid != 1)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Dropping heartbeat from '%s' with bad signature for key '%s'",
+            ipaddr, digest);
+        return;
+    }
+
+    Log(LOG_LEVEL_DEBUG, "Heartbeat from '%s' (%s)", digest, ipaddr);
+    LastSaw1(ipaddr, digest, LAST_SEEN_ROLE_ACCEPT);
+}
+
+int ServerHeartbeatOpen(void)
+{
+    struct addrinfo *response = NULL;
+    struct addrinfo query = {
+        .ai_flags = AI_PASSIVE,
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_DGRAM
+    };
+
+    /* Same interface selection as the TCP listening socket. */
+    char *ptr = NULL;
+    if (BINDINTERFACE[0] != '\0')
+    {
+        ptr = BINDINTERFACE;
+    }
+
+    int gres = getaddrinfo(ptr, CFENGINE_PORT_STR, &query, &response);
+    if (gres != 0)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Not listening for heartbeats (getaddrinfo: %s)",
+            gai_strerror(gres));
+        if (response != NULL)
+        {
+            freeaddrinfo(response);
+        }
+        return -1;
+    }
+
+    int sd = -1;
+
+    /* Prefer an IPv6 wildcard bind, which (with IPV6_V6ONLY cleared)
+     * accepts IPv4 senders too; see OpenReceiverChannel(). */
+    for (int want_ipv6 = 1; want_ipv6 >= 0 && sd == -1; want_ipv6--)
+    {
+        for (struct addrinfo *ap = response; ap != NULL; ap = ap->ai_next)
+        {
+            if ((ap->ai_family == AF_INET6) != want_ipv6)
+            {
+                continue;
+            }
+
+            sd = socket(ap->ai_family, ap->ai_socktype, ap->ai_protocol);
+            if (sd == -1)
+            {
+                continue;
+            }
+
+#ifdef IPV6_V6ONLY
+            if (ptr == NULL && ap->ai_family == AF_INET6)
+            {
+                int no = 0;
+                if (setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY,
+                               &no, sizeof(no)) == -1)
+                {
+                    Log(LOG_LEVEL_VERBOSE,
+                        "Failed to clear IPv6-only flag on heartbeat socket"
+                        " (setsockopt: %s)", GetErrorStr());
+                }
+            }
+#endif
+
+            int yes = 1;
+            if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR,
+                           &yes, sizeof(yes)) == -1)
+            {
+                Log(LOG_LEVEL_VERBOSE,
+                    "Socket option SO_REUSEADDR was not accepted"
+                    " (setsockopt: %s)", GetErrorStr());
+            }
+
+            if (bind(sd, ap->ai_addr, ap->ai_addrlen) != -1)
+            {
+                break;
+            }
+
+            cf_closesocket(sd);
+            sd = -1;
+        }
+    }
+
+    freeaddrinfo(response);
+
+    if (sd == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Not listening for heartbeats: could not bind %s/udp (bind: %s)",
+            CFENGINE_PORT_STR, GetErrorStr());
+        return -1;
+    }
+
+    int arg = fcntl(sd, F_GETFL, NULL);
+    if (arg == -1 || fcntl(sd, F_SETFL, arg | O_NONBLOCK) == -1)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Failed to set heartbeat socket to non-blocking mode (fcntl: %s)",
+            GetErrorStr());
+        cf_closesocket(sd);
+        return -1;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Listening for heartbeats on port %s/udp",
+        CFENGINE_PORT_STR);
+    return sd;
+}
+
+void ServerHeartbeatDrain(int hb_sd)
+{
+    if (hb_sd == -1)
+    {
+        return;
+    }
+
+    for (int i = 0; i < HEARTBEAT_MAX_PER_DRAIN; i++)
+    {
+        unsigned char buf[HEARTBEAT_MAX_DATAGRAM];
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+
+        ssize_t got = recvfrom(hb_sd, buf, sizeof(buf), 0,
+                               (struct sockaddr *) &addr, &addr_len);
+        if (got <= 0)
+        {
+            /* Drained (EAGAIN) or a transient error; either way there is
+             * nothing more to read right now. */
+            return;
+        }
+
+        char txtaddr[CF_MAX_IP_LEN] = "";
+        if (getnameinfo((struct sockaddr *) &addr, addr_len,
+                        txtaddr, sizeof(txtaddr),
+                        NULL, 0, NI_NUMERICHOST) != 0)
+        {
+            continue;
+        }
+
+        HandleHeartbeat(buf, (size_t) got, MapAddress(txtaddr));
+    }
+}
@@ -0,0 +1,68 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_SERVER_HEARTBEAT_H
+#define CFENGINE_SERVER_HEARTBEAT_H
+
+#include <platform.h>
+
+/**
+ * Authenticated UDP liveness heartbeats.
+ *
+ * Hosts normally refresh their cf_lastseen entry only when they make a full
+ * protocol connection, so liveness granularity is bound to the agent
+ * schedule and every refresh costs a TCP+TLS handshake and a serving
+ * thread.  The heartbeat endpoint accepts a single signed datagram instead:
+ * a host that wants to advertise liveness between connections sends one
+ * packet signed with its private key, and the server records it through
+ * UpdateLastSawHost() exactly as if the host had connected.  Those updates
+ * are already coalesced in memory and flushed to the database in batches,
+ * so sub-minute heartbeats from a large fleet do not translate into
+ * per-packet LMDB commits.
+ *
+ * Only hosts whose public key is already in ppkeys can register a
+ * heartbeat; an unknown or invalid signature is dropped silently.  The
+ * signed header includes the sender's own address, which must match the
+ * datagram's source: a captured heartbeat replayed within its freshness
+ * window can then only reassert the address-to-key binding the sender
+ * itself signed, never rebind the key to a spoofed source address.
+ */
+
+/**
+ * Open and bind the heartbeat UDP socket on the standard port, following
+ * the same bind-interface selection as the listening TCP socket.  The
+ * socket is non-blocking; datagrams queue in the socket buffer between
+ * drains.  Returns -1 on failure, which is not fatal: the server simply
+ * runs without the heartbeat endpoint.
+ */
+int ServerHeartbeatOpen(void);
+
+/**
+ * Receive, verify and record whatever heartbeats have queued up on #hb_sd
+ * since the last call.  Bounded per call, so a datagram flood cannot starve
+ * the accept loop.  Does nothing if #hb_sd is -1.
+ */
+void ServerHeartbeatDrain(int hb_sd);
+
+#endif
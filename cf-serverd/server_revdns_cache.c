@@ -0,0 +1,207 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <platform.h>
+
+#include "server_revdns_cache.h"
+
+#include <logging.h>                                    /* Log */
+#include <alloc.h>                                      /* xstrdup,xcalloc */
+#include <map.h>                                        /* TYPED_MAP_* */
+#include <string_lib.h>                   /* StringHash,StringEqual,strlcpy */
+
+/* How long a successful lookup stays fresh.  Agents on the default schedule
+ * reconnect every five minutes, so ten minutes means roughly one resolver
+ * round trip per host per two connections, refreshed off the stale copy. */
+#define REVDNS_CACHE_TTL 600
+
+/* Failed lookups are retried sooner: a host may simply not have had its PTR
+ * record published yet. */
+#define REVDNS_CACHE_NEGATIVE_TTL 60
+
+/* When the cache grows past this many addresses it is dropped wholesale and
+ * rebuilt.  Scanning for an LRU victim per insert is not worth it here: a
+ * hub's agent population fits comfortably, and a flush merely costs one
+ * lookup per address again. */
+#define REVDNS_CACHE_MAX_ENTRIES 16384
+
+typedef struct
+{
+    char *hostname;             /* NULL for a cached resolution failure */
+    time_t resolved_at;
+    bool refreshing;            /* one thread is re-resolving this entry */
+} RevDnsEntry;
+
+static void RevDnsEntryDestroy_untyped(void *p)
+{
+    RevDnsEntry *entry = p;
+    if (entry != NULL)
+    {
+        free(entry->hostname);
+        free(entry);
+    }
+}
+
+/**
+   Define "RevDnsMap" hash table.
+       Key:   printable peer address
+       Value: RevDnsEntry
+*/
+TYPED_MAP_DECLARE(RevDns, char *, RevDnsEntry *)
+TYPED_MAP_DEFINE(RevDns, char *, RevDnsEntry *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 RevDnsEntryDestroy_untyped)
+
+static RevDnsMap *cache = NULL;                         /* GLOBAL_X */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+static time_t EntryTTL(const RevDnsEntry *entry)
+{
+    return (entry->hostname != NULL)
+        ? REVDNS_CACHE_TTL : REVDNS_CACHE_NEGATIVE_TTL;
+}
+
+/* The blocking part, done outside the lock.  Returns the resolved name or
+ * NULL on failure. */
+static char *ResolveName(const struct sockaddr *sa, socklen_t sa_len,
+                         const char *ipaddr)
+{
+    char hostname[NI_MAXHOST];
+    int ret = getnameinfo(sa, sa_len, hostname, sizeof(hostname),
+                          NULL, 0, NI_NAMEREQD);
+    if (ret != 0)
+    {
+        Log(LOG_LEVEL_INFO,
+            "Reverse lookup of '%s' failed (getnameinfo: %s)",
+            ipaddr, gai_strerror(ret));
+        return NULL;
+    }
+    return xstrdup(hostname);
+}
+
+/* Called with cache_lock held. */
+static void CacheStore(const char *ipaddr, char *hostname, bool existed)
+{
+    if (!existed && RevDnsMapSize(cache) >= REVDNS_CACHE_MAX_ENTRIES)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Reverse DNS cache full (%d addresses), flushing",
+            REVDNS_CACHE_MAX_ENTRIES);
+        RevDnsMapClear(cache);
+    }
+
+    RevDnsEntry *entry = RevDnsMapGet(cache, ipaddr);
+    if (entry == NULL)
+    {
+        entry = xcalloc(1, sizeof(*entry));
+        RevDnsMapInsert(cache, xstrdup(ipaddr), entry);
+    }
+    else
+    {
+        free(entry->hostname);
+    }
+    entry->hostname = hostname;
+    entry->resolved_at = time(NULL);
+    entry->refreshing = false;
+}
+
+bool RevDnsCacheLookup(const struct sockaddr *sa, socklen_t sa_len,
+                       const char *ipaddr,
+                       char *revdns, size_t revdns_size)
+{
+    assert(sa != NULL);
+    assert(ipaddr != NULL);
+    assert(revdns != NULL);
+
+    bool resolve = false;                 /* this thread does the lookup */
+    bool have_stale = false;
+
+    pthread_mutex_lock(&cache_lock);
+
+    if (cache == NULL)
+    {
+        cache = RevDnsMapNew();
+    }
+
+    RevDnsEntry *entry = RevDnsMapGet(cache, ipaddr);
+    if (entry != NULL &&
+        time(NULL) < entry->resolved_at + EntryTTL(entry))
+    {
+        /* Fresh hit. */
+        const bool resolved = (entry->hostname != NULL);
+        if (resolved)
+        {
+            strlcpy(revdns, entry->hostname, revdns_size);
+        }
+        pthread_mutex_unlock(&cache_lock);
+        return resolved;
+    }
+
+    if (entry != NULL)
+    {
+        /* Expired: serve the stale name immediately and let exactly one
+         * thread block on re-resolving it.  A hostname honoured a moment
+         * ago being honoured one TTL longer is the price of not stacking
+         * threads up behind a slow resolver. */
+        if (entry->hostname != NULL)
+        {
+            strlcpy(revdns, entry->hostname, revdns_size);
+            have_stale = true;
+        }
+        if (!entry->refreshing)
+        {
+            entry->refreshing = true;
+            resolve = true;
+        }
+    }
+    else
+    {
+        /* True miss: resolve, as before the cache existed. */
+        resolve = true;
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+
+    if (!resolve)
+    {
+        return have_stale;
+    }
+
+    char *hostname = ResolveName(sa, sa_len, ipaddr);
+    const bool resolved = (hostname != NULL);
+    if (resolved)
+    {
+        strlcpy(revdns, hostname, revdns_size);
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    CacheStore(ipaddr, hostname, (entry != NULL));      /* takes ownership */
+    pthread_mutex_unlock(&cache_lock);
+
+    /* If the refresh failed but we had a stale name, keep serving it this
+     * once; the negative entry now stored governs the next connection. */
+    return resolved || have_stale;
+}
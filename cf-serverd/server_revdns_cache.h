@@ -0,0 +1,56 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_SERVER_REVDNS_CACHE_H
+#define CFENGINE_SERVER_REVDNS_CACHE_H
+
+#include <platform.h>
+
+/**
+ * TTL cache of reverse DNS lookups shared across connection threads.
+ *
+ * When access rules use hostname patterns, every admitted connection needs
+ * the peer's reverse-resolved name.  Agents reconnect on a schedule, so the
+ * same addresses come back every few minutes; without a cache each reconnect
+ * blocks its serving thread on resolver latency, which during connection
+ * storms means hundreds of threads stuck in getnameinfo() at once.
+ *
+ * Entries are served from the cache while fresh.  An expired entry is served
+ * stale while a single thread refreshes it, so a slow resolver delays at
+ * most one connection per address per TTL.  Failed lookups are cached too
+ * (with a shorter TTL) so an unresolvable peer does not pay the full
+ * resolver timeout on every reconnect.
+ */
+
+/**
+ * Reverse-resolve the peer address #sa/#sa_len, identified by its printable
+ * form #ipaddr, through the cache.  On success copies the hostname into
+ * #revdns (of size #revdns_size) and returns true.  Returns false when the
+ * address does not resolve; #revdns is left untouched.
+ */
+bool RevDnsCacheLookup(const struct sockaddr *sa, socklen_t sa_len,
+                       const char *ipaddr,
+                       char *revdns, size_t revdns_size);
+
+#endif
@@ -0,0 +1,250 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <platform.h>
+
+#include "server_stats.h"
+
+#include <logging.h>                                    /* Log */
+#include <known_dirs.h>                                 /* GetStateDir */
+#include <file_lib.h>                                   /* safe_fopen */
+#include <json.h>
+#include <writer.h>
+#include <misc_lib.h>                                   /* xsnprintf */
+#include <mutex.h>                                      /* ThreadLock */
+
+/* How often the accept loop writes the stats file. */
+#define SERVER_STATS_DUMP_INTERVAL 60                            /* seconds */
+
+/* The protocol has ~25 verbs across both dialects; the table never needs to
+ * grow at runtime. */
+#define STATS_MAX_VERBS 32
+
+/* Bucket i counts requests with latency in [2^i, 2^(i+1)) nanoseconds, so
+ * the full int64 range fits and relative precision is a constant factor of
+ * two at every magnitude -- good enough to tell a 10 ms cliff from a 100 ms
+ * one without storing raw samples. */
+#define STATS_BUCKETS 64
+
+#ifdef CLOCK_MONOTONIC
+# define PREFERRED_CLOCK CLOCK_MONOTONIC
+#else
+# define PREFERRED_CLOCK CLOCK_REALTIME
+#endif
+
+typedef struct
+{
+    const char *verb;                          /* static storage, not owned */
+    uint64_t count;
+    int64_t total_ns;
+    int64_t max_ns;
+    uint64_t buckets[STATS_BUCKETS];
+} VerbStats;
+
+static VerbStats STATS[STATS_MAX_VERBS];                /* GLOBAL_T */
+static size_t STATS_USED = 0;                           /* GLOBAL_T */
+static time_t STATS_LAST_DUMP = 0;                      /* GLOBAL_T */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int64_t ServerStatsTimestamp(void)
+{
+    struct timespec ts;
+    clock_gettime(PREFERRED_CLOCK, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static size_t BucketIndex(int64_t elapsed_ns)
+{
+    size_t i = 0;
+    uint64_t v = (uint64_t) elapsed_ns;
+    while ((v >>= 1) != 0 && i < STATS_BUCKETS - 1)
+    {
+        i++;
+    }
+    return i;
+}
+
+void ServerStatsRecordLatency(const char *verb, int64_t elapsed_ns)
+{
+    assert(verb != NULL);
+
+    if (elapsed_ns < 0)
+    {
+        /* Backwards clock jump on platforms without a monotonic clock. */
+        return;
+    }
+
+    ThreadLock(&stats_lock);
+
+    VerbStats *vs = NULL;
+    for (size_t i = 0; i < STATS_USED; i++)
+    {
+        if (strcmp(STATS[i].verb, verb) == 0)
+        {
+            vs = &STATS[i];
+            break;
+        }
+    }
+    if (vs == NULL)
+    {
+        if (STATS_USED == STATS_MAX_VERBS)
+        {
+            /* Can't happen with the fixed verb tables; don't grow. */
+            ThreadUnlock(&stats_lock);
+            return;
+        }
+        vs = &STATS[STATS_USED++];
+        vs->verb = verb;
+    }
+
+    vs->count++;
+    vs->total_ns += elapsed_ns;
+    if (elapsed_ns > vs->max_ns)
+    {
+        vs->max_ns = elapsed_ns;
+    }
+    vs->buckets[BucketIndex(elapsed_ns)]++;
+
+    ThreadUnlock(&stats_lock);
+}
+
+/**
+ * Upper bound of the bucket containing the #fraction quantile.  Caller must
+ * hold stats_lock.
+ */
+static int64_t BucketPercentile(const VerbStats *vs, double fraction)
+{
+    assert(vs->count > 0);
+
+    uint64_t rank = (uint64_t) (vs->count * fraction);
+    if (rank >= vs->count)
+    {
+        rank = vs->count - 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += vs->buckets[i];
+        if (seen > rank)
+        {
+            return (i >= 62) ? INT64_MAX : ((int64_t) 1) << (i + 1);
+        }
+    }
+    return vs->max_ns;
+}
+
+void ServerStatsDump(void)
+{
+    char path[PATH_MAX], tmp_path[PATH_MAX];
+    xsnprintf(path, sizeof(path), "%s%ccf-serverd-stats.json",
+              GetStateDir(), FILE_SEPARATOR);
+    xsnprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    JsonElement *verbs = JsonObjectCreate(STATS_MAX_VERBS);
+
+    ThreadLock(&stats_lock);
+    const size_t used = STATS_USED;
+    for (size_t i = 0; i < used; i++)
+    {
+        const VerbStats *vs = &STATS[i];
+
+        JsonElement *entry = JsonObjectCreate(7);
+        JsonObjectAppendInteger64(entry, "count", (int64_t) vs->count);
+        JsonObjectAppendInteger64(entry, "total_ns", vs->total_ns);
+        JsonObjectAppendInteger64(entry, "max_ns", vs->max_ns);
+        JsonObjectAppendInteger64(entry, "p50_ns", BucketPercentile(vs, 0.50));
+        JsonObjectAppendInteger64(entry, "p95_ns", BucketPercentile(vs, 0.95));
+        JsonObjectAppendInteger64(entry, "p99_ns", BucketPercentile(vs, 0.99));
+
+        /* Keyed by bucket upper bound, empty buckets omitted. */
+        JsonElement *histogram = JsonObjectCreate(8);
+        for (size_t b = 0; b < STATS_BUCKETS; b++)
+        {
+            if (vs->buckets[b] > 0)
+            {
+                char upper[32];
+                xsnprintf(upper, sizeof(upper), "%" PRIi64,
+                          (b >= 62) ? INT64_MAX : ((int64_t) 1) << (b + 1));
+                JsonObjectAppendInteger64(histogram, upper,
+                                          (int64_t) vs->buckets[b]);
+            }
+        }
+        JsonObjectAppendObject(entry, "histogram_upper_ns", histogram);
+
+        JsonObjectAppendObject(verbs, vs->verb, entry);
+    }
+    ThreadUnlock(&stats_lock);
+
+    if (used == 0)
+    {
+        /* Nothing served yet, don't leave an empty stats file around. */
+        JsonDestroy(verbs);
+        return;
+    }
+
+    JsonElement *root = JsonObjectCreate(2);
+    JsonObjectAppendInteger64(root, "time", (int64_t) time(NULL));
+    JsonObjectAppendObject(root, "verbs", verbs);
+
+    /* Write-then-rename, so readers never see a half-written file. */
+    FILE *file = safe_fopen(tmp_path, "w");
+    if (file == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Could not write server stats to '%s'. (fopen: %s)",
+            tmp_path, GetErrorStr());
+        JsonDestroy(root);
+        return;
+    }
+
+    Writer *writer = FileWriter(file);
+    JsonWrite(writer, root, 2);
+    WriterClose(writer);
+    JsonDestroy(root);
+
+    if (rename(tmp_path, path) != 0)
+    {
+        Log(LOG_LEVEL_ERR, "Could not rename '%s' to '%s'. (rename: %s)",
+            tmp_path, path, GetErrorStr());
+        unlink(tmp_path);
+    }
+}
+
+void ServerStatsMaybeDump(void)
+{
+    ThreadLock(&stats_lock);
+    const time_t now = time(NULL);
+    const bool due = (STATS_USED > 0 &&
+                      now - STATS_LAST_DUMP >= SERVER_STATS_DUMP_INTERVAL);
+    if (due)
+    {
+        STATS_LAST_DUMP = now;
+    }
+    ThreadUnlock(&stats_lock);
+
+    if (due)
+    {
+        ServerStatsDump();
+    }
+}
@@ -0,0 +1,63 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_SERVER_STATS_H
+#define CFENGINE_SERVER_STATS_H
+
+#include <platform.h>
+
+/**
+ * Per-verb request latency histograms for cf-serverd.
+ *
+ * Connection threads record the time each protocol request (GET, SYNCH,
+ * OPENDIR, the TLS handshake, ...) took to serve; the accept loop
+ * periodically dumps the aggregate as JSON to
+ * "<statedir>/cf-serverd-stats.json".  Latencies are kept in power-of-two
+ * buckets, so tail percentiles survive aggregation and a single slow verb
+ * cannot hide behind a healthy mean.
+ */
+
+/**
+ * Current monotonic timestamp in nanoseconds, for request timing.
+ */
+int64_t ServerStatsTimestamp(void);
+
+/**
+ * Account one request of #verb taking #elapsed_ns.  #verb must point to
+ * static storage (the protocol command tables qualify).  Thread-safe.
+ */
+void ServerStatsRecordLatency(const char *verb, int64_t elapsed_ns);
+
+/**
+ * Write the histograms to "<statedir>/cf-serverd-stats.json".
+ */
+void ServerStatsDump(void);
+
+/**
+ * Call ServerStatsDump() if enough time has passed since the last dump.
+ * Meant to be called from the accept loop; cheap no-op in between.
+ */
+void ServerStatsMaybeDump(void);
+
+#endif
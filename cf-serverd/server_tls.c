@@ -37,6 +37,7 @@
 #include <net.h>                      /* SendTransaction,ReceiveTransaction */
 #include <tls_generic.h>              /* TLSSend */
 #include <patch_stream.h>             /* PatchStreamRefuse */
+#include <set_sync.h>                 /* SetSyncSketch,SetSyncDigest */
 #include <cf-serverd-enterprise-stubs.h>
 #include <connection_info.h>
 #include <regex.h>                                       /* StringMatchFull */
@@ -45,6 +46,9 @@
 #include <string_lib.h>
 
 #include "server_access.h"          /* access_CheckResource, acl_CheckExact */
+#include "server_stats.h"                            /* ServerStatsTimestamp */
+#include "server_treedigest.h"                            /* TreeDigestGet */
+#include "server_bundle.h"                              /* PolicyBundleSend */
 
 
 static SSL_CTX *SSLSERVERCONTEXT = NULL;
@@ -127,6 +131,20 @@ bool ServerTLSInitialize(RSA *priv_key, RSA *pub_key, SSL_CTX **ssl_ctx)
         goto err;
     }
 
+    /* cf-agent opens a fresh connection, and with it a fresh TLS session,
+     * for every run, so the server-side session cache is never hit.  OpenSSL
+     * enables the cache by default and serializes every handshake on the
+     * SSL_CTX lock to insert and expire entries, which is measurable
+     * contention when many hosts connect at once -- switch it off. */
+    SSL_CTX_set_session_cache_mode(*ssl_ctx, SSL_SESS_CACHE_OFF);
+
+#ifdef SSL_MODE_RELEASE_BUFFERS
+    /* Return the ~34kB of per-connection I/O buffers to the allocator when
+     * they are idle, instead of holding them for the connection's lifetime.
+     * This keeps the footprint of a connection storm bounded. */
+    SSL_CTX_set_mode(*ssl_ctx, SSL_MODE_RELEASE_BUFFERS);
+#endif
+
     /* Create cert into memory and load it into SSL context. */
     X509 *cert = TLSGenerateCertFromPrivKey(priv_key);
     if (cert == NULL)
@@ -696,7 +714,15 @@ bool BusyWithNewProtocol(EvalContext *ctx, ServerConnectionState *conn)
 
     /* TODO break recvbuffer here: command, param1, param2 etc. */
 
-    switch (GetCommandNew(recvbuffer))
+    const ProtocolCommandNew command = GetCommandNew(recvbuffer);
+
+    /* Start the latency clock only now: the blocking receive above mostly
+     * measures the client thinking, not us serving.  Our caller accounts the
+     * request once we return.  (NULL verb if the command is bad.) */
+    conn->request_verb = PROTOCOL_NEW[command];
+    conn->request_start = ServerStatsTimestamp();
+
+    switch (command)
     {
     case PROTOCOL_COMMAND_EXEC:
     {
@@ -792,6 +818,207 @@ bool BusyWithNewProtocol(EvalContext *ctx, ServerConnectionState *conn)
 
         return true;
     }
+    case PROTOCOL_COMMAND_RGET:
+    {
+        intmax_t offset = -1;
+        int ret = sscanf(recvbuffer, "RGET %d %jd %[^\n]",
+                         &(get_args.buf_size), &offset, filename);
+
+        if (ret != 3 ||
+            get_args.buf_size <= 0 || get_args.buf_size > CF_BUFSIZE ||
+            offset < 0)
+        {
+            goto protocol_error;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Received:", "RGET", filename);
+
+        size_t zret = ShortcutsExpand(filename, sizeof(filename),
+                                     SERVER_ACCESS.path_shortcuts,
+                                     conn->ipaddr, conn->revdns,
+                                     KeyPrintableHash(ConnectionInfoKey(conn->conn_info)));
+        if (zret == (size_t) -1)
+        {
+            goto protocol_error;
+        }
+
+        zret = PreprocessRequestPath(filename, sizeof(filename));
+        if (zret == (size_t) -1)
+        {
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        PathRemoveTrailingSlash(filename, strlen(filename));
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Translated to:", "RGET", filename);
+
+        if (acl_CheckPath(paths_acl, filename,
+                          conn->ipaddr, conn->revdns,
+                          KeyPrintableHash(ConnectionInfoKey(conn->conn_info)))
+            == false)
+        {
+            Log(LOG_LEVEL_INFO, "access denied to RGET: %s", filename);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        memset(sendbuffer, 0, sizeof(sendbuffer));
+
+        if (get_args.buf_size >= CF_BUFSIZE)
+        {
+            get_args.buf_size = 2048;
+        }
+
+        get_args.conn = conn;
+        get_args.encrypt = false;
+        get_args.replybuff = sendbuffer;
+        get_args.replyfile = filename;
+
+        CfGetFileRange(&get_args, (off_t) offset);
+
+        return true;
+    }
+    case PROTOCOL_COMMAND_CGET:
+    {
+        memset(filename, 0, sizeof(filename));
+        int ret = sscanf(recvbuffer, "CGET %[^\n]", filename);
+        if (ret != 1)
+        {
+            goto protocol_error;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Received:", "CGET", filename);
+
+        size_t zret = ShortcutsExpand(filename, sizeof(filename),
+                                     SERVER_ACCESS.path_shortcuts,
+                                     conn->ipaddr, conn->revdns,
+                                     KeyPrintableHash(ConnectionInfoKey(conn->conn_info)));
+        if (zret == (size_t) -1)
+        {
+            goto protocol_error;
+        }
+
+        zret = PreprocessRequestPath(filename, sizeof(filename));
+        if (zret == (size_t) -1)
+        {
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        PathRemoveTrailingSlash(filename, strlen(filename));
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Translated to:", "CGET", filename);
+
+        if (acl_CheckPath(paths_acl, filename,
+                          conn->ipaddr, conn->revdns,
+                          KeyPrintableHash(ConnectionInfoKey(conn->conn_info)))
+            == false)
+        {
+            Log(LOG_LEVEL_INFO, "access denied to CGET: %s", filename);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        memset(sendbuffer, 0, sizeof(sendbuffer));
+
+        /* TODO eliminate! */
+        get_args.conn = conn;
+        get_args.encrypt = false;
+        get_args.buf_size = 2048;                               /* unused */
+        get_args.replybuff = sendbuffer;
+        get_args.replyfile = filename;
+
+        CfCompressedGetFile(&get_args);
+
+        return true;
+    }
+    case PROTOCOL_COMMAND_MD5GET:
+    {
+        /* Conditional GET: compare the digest the client sent, reply
+         * CFD_TRUE/CFD_FALSE as for MD5, and on a mismatch stream the file
+         * right away, saving the client the separate GET round trip. */
+        int ret = sscanf(recvbuffer, "MD5GET %d %[^\n]",
+                         &(get_args.buf_size), filename);
+
+        if (ret != 2 ||
+            get_args.buf_size <= 0 || get_args.buf_size > CF_BUFSIZE)
+        {
+            goto protocol_error;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Received:", "MD5GET", filename);
+
+        size_t zret = ShortcutsExpand(filename, sizeof(filename),
+                                     SERVER_ACCESS.path_shortcuts,
+                                     conn->ipaddr, conn->revdns,
+                                     KeyPrintableHash(ConnectionInfoKey(conn->conn_info)));
+        if (zret == (size_t) -1)
+        {
+            goto protocol_error;
+        }
+
+        zret = PreprocessRequestPath(filename, sizeof(filename));
+        if (zret == (size_t) -1)
+        {
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        PathRemoveTrailingSlash(filename, strlen(filename));
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Translated to:", "MD5GET", filename);
+
+        if (acl_CheckPath(paths_acl, filename,
+                          conn->ipaddr, conn->revdns,
+                          KeyPrintableHash(ConnectionInfoKey(conn->conn_info)))
+            == false)
+        {
+            Log(LOG_LEVEL_INFO, "access denied to MD5GET: %s", filename);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        assert(CF_DEFAULT_DIGEST_LEN <= EVP_MAX_MD_SIZE);
+        unsigned char digest[EVP_MAX_MD_SIZE + 1];
+
+        assert(CF_BUFSIZE + CF_SMALL_OFFSET + (size_t) CF_DEFAULT_DIGEST_LEN
+               <= sizeof(recvbuffer));
+        memcpy(digest, recvbuffer + strlen(recvbuffer) + CF_SMALL_OFFSET,
+               CF_DEFAULT_DIGEST_LEN);
+
+        memset(sendbuffer, 0, sizeof(sendbuffer));
+        const bool match = CompareLocalHash(filename, digest, sendbuffer);
+        SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE);
+
+        if (match)
+        {
+            return true;
+        }
+
+        memset(sendbuffer, 0, sizeof(sendbuffer));
+
+        if (get_args.buf_size >= CF_BUFSIZE)
+        {
+            get_args.buf_size = 2048;
+        }
+
+        /* TODO eliminate! */
+        get_args.conn = conn;
+        get_args.encrypt = false;
+        get_args.replybuff = sendbuffer;
+        get_args.replyfile = filename;
+
+        CfGetFile(&get_args);
+
+        return true;
+    }
     case PROTOCOL_COMMAND_OPENDIR:
     {
         memset(filename, 0, sizeof(filename));
@@ -841,6 +1068,168 @@ bool BusyWithNewProtocol(EvalContext *ctx, ServerConnectionState *conn)
         CfOpenDirectory(conn, sendbuffer, filename);
         return true;
     }
+    case PROTOCOL_COMMAND_STATDIR:
+    {
+        memset(filename, 0, sizeof(filename));
+        int ret = sscanf(recvbuffer, "STATDIR %[^\n]", filename);
+        if (ret != 1)
+        {
+            goto protocol_error;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Received:", "STATDIR", filename);
+
+        /* sizeof()-1 because we need one extra byte for
+           appending '/' afterwards. */
+        size_t zret = ShortcutsExpand(filename, sizeof(filename) - 1,
+                                      SERVER_ACCESS.path_shortcuts,
+                                      conn->ipaddr, conn->revdns,
+                                      KeyPrintableHash(ConnectionInfoKey(conn->conn_info)));
+        if (zret == (size_t) -1)
+        {
+            goto protocol_error;
+        }
+
+        zret = PreprocessRequestPath(filename, sizeof(filename) - 1);
+        if (zret == (size_t) -1)
+        {
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        /* STATDIR *must* be directory. */
+        PathAppendTrailingSlash(filename, strlen(filename));
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Translated to:", "STATDIR", filename);
+
+        if (acl_CheckPath(paths_acl, filename,
+                          conn->ipaddr, conn->revdns,
+                          KeyPrintableHash(ConnectionInfoKey(conn->conn_info)))
+            == false)
+        {
+            Log(LOG_LEVEL_INFO, "access denied to STATDIR: %s", filename);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        CfStatDirectory(conn, sendbuffer, filename);
+        return true;
+    }
+    case PROTOCOL_COMMAND_TREEDIGEST:
+    {
+        memset(filename, 0, sizeof(filename));
+        int ret = sscanf(recvbuffer, "TREEDIGEST %[^\n]", filename);
+        if (ret != 1)
+        {
+            goto protocol_error;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Received:", "TREEDIGEST", filename);
+
+        /* sizeof()-1 because we need one extra byte for
+           appending '/' afterwards. */
+        size_t zret = ShortcutsExpand(filename, sizeof(filename) - 1,
+                                      SERVER_ACCESS.path_shortcuts,
+                                      conn->ipaddr, conn->revdns,
+                                      KeyPrintableHash(ConnectionInfoKey(conn->conn_info)));
+        if (zret == (size_t) -1)
+        {
+            goto protocol_error;
+        }
+
+        zret = PreprocessRequestPath(filename, sizeof(filename) - 1);
+        if (zret == (size_t) -1)
+        {
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        /* TREEDIGEST *must* be directory. */
+        PathAppendTrailingSlash(filename, strlen(filename));
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Translated to:", "TREEDIGEST", filename);
+
+        if (acl_CheckPath(paths_acl, filename,
+                          conn->ipaddr, conn->revdns,
+                          KeyPrintableHash(ConnectionInfoKey(conn->conn_info)))
+            == false)
+        {
+            Log(LOG_LEVEL_INFO, "access denied to TREEDIGEST: %s", filename);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        char digest_str[TREE_DIGEST_STRING_SIZE];
+        if (!TreeDigestGet(filename, digest_str))
+        {
+            SendTransaction(conn->conn_info,
+                            "BAD: could not compute tree digest", 0, CF_DONE);
+            return true;
+        }
+
+        SendTransaction(conn->conn_info, digest_str, 0, CF_DONE);
+        return true;
+    }
+    case PROTOCOL_COMMAND_POLICYBUNDLE:
+    {
+        memset(filename, 0, sizeof(filename));
+        int ret = sscanf(recvbuffer, "POLICYBUNDLE %[^\n]", filename);
+        if (ret != 1)
+        {
+            goto protocol_error;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Received:", "POLICYBUNDLE", filename);
+
+        /* sizeof()-1 because we need one extra byte for
+           appending '/' afterwards. */
+        size_t zret = ShortcutsExpand(filename, sizeof(filename) - 1,
+                                      SERVER_ACCESS.path_shortcuts,
+                                      conn->ipaddr, conn->revdns,
+                                      KeyPrintableHash(ConnectionInfoKey(conn->conn_info)));
+        if (zret == (size_t) -1)
+        {
+            goto protocol_error;
+        }
+
+        zret = PreprocessRequestPath(filename, sizeof(filename) - 1);
+        if (zret == (size_t) -1)
+        {
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        /* POLICYBUNDLE *must* be directory. */
+        PathAppendTrailingSlash(filename, strlen(filename));
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Translated to:", "POLICYBUNDLE", filename);
+
+        if (acl_CheckPath(paths_acl, filename,
+                          conn->ipaddr, conn->revdns,
+                          KeyPrintableHash(ConnectionInfoKey(conn->conn_info)))
+            == false)
+        {
+            Log(LOG_LEVEL_INFO, "access denied to POLICYBUNDLE: %s", filename);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        /* Drop the trailing slash again for the directory walk. */
+        size_t flen = strlen(filename);
+        if (flen > 1 && filename[flen - 1] == FILE_SEPARATOR)
+        {
+            filename[flen - 1] = '\0';
+        }
+
+        PolicyBundleSend(conn, filename);
+        return true;
+    }
     case PROTOCOL_COMMAND_SYNCH:
     {
         long time_no_see = 0;
@@ -1063,6 +1452,100 @@ bool BusyWithNewProtocol(EvalContext *ctx, ServerConnectionState *conn)
         ReplyServerContext(conn, encrypted, matched_classes);
         return true;
     }
+    case PROTOCOL_COMMAND_SETSYNC:
+    {
+        /* Delta-sync variant of CONTEXT: the client sends the digest of the
+         * class set it last acknowledged plus a Bloom sketch of the entries
+         * it holds, and gets back either "unchanged" or only the entries
+         * its sketch is missing.  See libcfnet/set_sync.h. */
+        char client_digest[SET_SYNC_DIGEST_LEN + 2];
+        char sketch_str[CF_BUFSIZE];
+        char client_regex[256];
+        int ret = sscanf(recvbuffer, "SETSYNC %41s %4095s %255[^\n]",
+                         client_digest, sketch_str, client_regex);
+        if (ret != 3)
+        {
+            goto protocol_error;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "%14s %8s %s",
+            "Received:", "SETSYNC", client_regex);
+
+        SetSyncSketch *sketch = SetSyncSketchDeserialize(sketch_str);
+        if (sketch == NULL)
+        {
+            goto protocol_error;
+        }
+
+        /* Same selection and per-class access checks as CONTEXT */
+        Item *persistent_classes = ListPersistentClasses();
+        Item *matched_classes = NULL;
+        for (Item *ip = persistent_classes; ip != NULL; ip = ip->next)
+        {
+            const char *class_name = ip->name;
+            if (StringMatchFull(client_regex, class_name) &&
+                acl_CheckRegex(classes_acl, class_name,
+                               conn->ipaddr, conn->revdns,
+                               KeyPrintableHash(ConnectionInfoKey(conn->conn_info)),
+                               NULL))
+            {
+                PrependItem(&matched_classes, class_name, NULL);
+            }
+        }
+        DeleteItemList(persistent_classes);
+
+        if (matched_classes == NULL)
+        {
+            Log(LOG_LEVEL_INFO,
+                "No allowed classes for SETSYNC: %s", client_regex);
+            SetSyncSketchDestroy(sketch);
+            RefuseAccess(conn, recvbuffer);
+            return true;
+        }
+
+        char digest[SET_SYNC_DIGEST_LEN + 1];
+        SetSyncDigest(matched_classes, digest);
+
+        if (strcmp(digest, client_digest) == 0)
+        {
+            strcpy(sendbuffer, "OK: unchanged");
+        }
+        else
+        {
+            /* Ship only the entries the client's sketch does not already
+             * hold; deletions and sketch false positives surface as a
+             * digest mismatch on the client, which then does a full
+             * CONTEXT fetch. */
+            Item *missing_classes = NULL;
+            for (Item *ip = matched_classes; ip != NULL; ip = ip->next)
+            {
+                if (!SetSyncSketchContains(sketch, ip->name))
+                {
+                    PrependItem(&missing_classes, ip->name, NULL);
+                }
+            }
+
+            int offset = snprintf(sendbuffer, sizeof(sendbuffer),
+                                  "OK: %s ", digest);
+            assert(offset > 0 && (size_t) offset < sizeof(sendbuffer));
+            size_t zret = ItemList2CSV_bound(missing_classes,
+                                             sendbuffer + offset,
+                                             sizeof(sendbuffer) - offset,
+                                             ',');
+            if (zret >= sizeof(sendbuffer) - offset)
+            {
+                Log(LOG_LEVEL_ERR,
+                    "Overflow: classes don't fit in send buffer");
+            }
+            DeleteItemList(missing_classes);
+        }
+
+        DeleteItemList(matched_classes);
+        SetSyncSketchDestroy(sketch);
+
+        SendTransaction(conn->conn_info, sendbuffer, 0, CF_DONE);
+        return true;
+    }
     case PROTOCOL_COMMAND_QUERY:
     {
         char query[256], name[128];
@@ -47,6 +47,13 @@ typedef enum
     PROTOCOL_COMMAND_CALL_ME_BACK,
     PROTOCOL_COMMAND_COOKIE,
     PROTOCOL_COMMAND_GETPATCH,
+    PROTOCOL_COMMAND_STATDIR,
+    PROTOCOL_COMMAND_CGET,
+    PROTOCOL_COMMAND_MD5GET,
+    PROTOCOL_COMMAND_TREEDIGEST,
+    PROTOCOL_COMMAND_POLICYBUNDLE,
+    PROTOCOL_COMMAND_RGET,
+    PROTOCOL_COMMAND_SETSYNC,
     PROTOCOL_COMMAND_BAD
 } ProtocolCommandNew;
 
@@ -64,6 +71,13 @@ static const char *const PROTOCOL_NEW[PROTOCOL_COMMAND_BAD + 1] =
     "SCALLBACK",
     "COOKIE",
     "GETPATCH",
+    "STATDIR",
+    "CGET",
+    "MD5GET",
+    "TREEDIGEST",
+    "POLICYBUNDLE",
+    "RGET",
+    "SETSYNC",
     NULL
 };
 
@@ -51,10 +51,12 @@
 #include <net.h>
 #include <client_code.h>
 #include <cfnet.h>
+#include <protocol_trace.h> /* ProtocolTraceEnable */
 #include <known_dirs.h> // GetWorkDir()
 
 #include "server_common.h"                         /* PreprocessRequestPath */
 #include "server_access.h"
+#include "server_bwlimit.h"
 #include "strlist.h"
 #include <cleanup.h>
 
@@ -546,6 +548,34 @@ static void KeepControlPromises(EvalContext *ctx, const Policy *policy, GenericA
                 Log(LOG_LEVEL_VERBOSE, "Setting allowtlsversion to: %s",
                     SERVER_ACCESS.allowtlsversion);
             }
+            else if (IsControlBody(SERVER_CONTROL_BWLIMIT))
+            {
+                double bval;
+                if (DoubleFromString(value, &bval))
+                {
+                    ServerBwLimitSetRate((uint32_t) bval);
+                    Log(LOG_LEVEL_VERBOSE,
+                        "Setting per-subnet rate limit to %u Bytes/sec",
+                        (uint32_t) bval);
+                }
+            }
+            else if (IsControlBody(SERVER_CONTROL_BWLIMIT_EXEMPT))
+            {
+                Log(LOG_LEVEL_VERBOSE, "Setting bwlimit exemptions ...");
+
+                for (const Rlist *rp = value; rp != NULL; rp = rp->next)
+                {
+                    ServerBwLimitAddExempt(RlistScalarValue(rp));
+                }
+            }
+            else if (IsControlBody(SERVER_CONTROL_PROTOCOL_TRACE_FILE))
+            {
+                if (ProtocolTraceEnable(value))
+                {
+                    Log(LOG_LEVEL_VERBOSE,
+                        "Writing protocol trace to: %s", (const char *) value);
+                }
+            }
         }
 
 #undef IsControlBody
@@ -0,0 +1,209 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <server_treedigest.h>
+
+#include <definitions.h>        /* CF_BUFSIZE */
+#include <dir.h>
+#include <hash.h>               /* HashDigestFromId, HashPrintSafe */
+#include <logging.h>
+#include <map.h>
+#include <mutex.h>              /* ThreadLock */
+#include <sequence.h>
+#include <string_lib.h>
+
+#define TREE_DIGEST_RECURSION_LIMIT 64
+
+/* How long a computed digest is served without rescanning the tree. Long
+ * enough to absorb a splay storm of identical queries, short enough that a
+ * masterfiles change is visible on the next agent run. */
+#define TREE_DIGEST_CACHE_TTL 10 /* seconds */
+
+typedef struct
+{
+    char digest[TREE_DIGEST_STRING_SIZE];
+    time_t computed;
+} TreeDigestEntry;
+
+static Map *tree_digest_cache = NULL; /* GLOBAL_X, path -> TreeDigestEntry */
+static pthread_mutex_t tree_digest_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+/**
+ * Mix the metadata of every entry under #path into #md_ctx, depth first.
+ * Entry names are sorted so the digest does not depend on readdir() order.
+ * Only metadata is hashed — a content change that preserves name, size and
+ * mtime is invisible, the same tradeoff the mtime comparators make.
+ */
+static bool TreeDigestWalk(EVP_MD_CTX *md_ctx, const char *path, int depth)
+{
+    if (depth <= 0)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Tree digest recursion limit reached under '%s'", path);
+        return false;
+    }
+
+    Dir *dirh = DirOpen(path);
+    if (dirh == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Couldn't open directory '%s' for tree digest (DirOpen: %s)",
+            path, GetErrorStr());
+        return false;
+    }
+
+    Seq *names = SeqNew(64, free);
+    for (const struct dirent *dirp = DirRead(dirh); dirp != NULL;
+         dirp = DirRead(dirh))
+    {
+        if (strcmp(dirp->d_name, ".") == 0 || strcmp(dirp->d_name, "..") == 0)
+        {
+            continue;
+        }
+        SeqAppend(names, xstrdup(dirp->d_name));
+    }
+    DirClose(dirh);
+    SeqSort(names, StrCmpWrapper, NULL);
+
+    bool success = true;
+    const size_t n_names = SeqLength(names);
+    for (size_t i = 0; success && (i < n_names); i++)
+    {
+        const char *name = SeqAt(names, i);
+
+        char entry_path[PATH_MAX];
+        int ret = snprintf(entry_path, sizeof(entry_path), "%s/%s", path, name);
+        if (ret < 0 || (size_t) ret >= sizeof(entry_path))
+        {
+            Log(LOG_LEVEL_ERR, "Path too long for tree digest: %s/%s",
+                path, name);
+            success = false;
+            break;
+        }
+
+        struct stat sb;
+        if (lstat(entry_path, &sb) == -1)
+        {
+            /* Entry disappeared mid-walk; digest the fact instead of
+             * failing, the next query sees the settled tree. */
+            char line[CF_BUFSIZE];
+            ret = snprintf(line, sizeof(line), "%s gone", name);
+            EVP_DigestUpdate(md_ctx, line, ret + 1);
+            continue;
+        }
+
+        char line[CF_BUFSIZE];
+        ret = snprintf(line, sizeof(line), "%s %jo %jd %jd",
+                       name,
+                       (uintmax_t) sb.st_mode,
+                       (intmax_t) sb.st_size,
+                       (intmax_t) sb.st_mtime);
+        /* '\0' included as entry separator: */
+        EVP_DigestUpdate(md_ctx, line, ret + 1);
+
+        if (S_ISDIR(sb.st_mode))
+        {
+            success = TreeDigestWalk(md_ctx, entry_path, depth - 1);
+        }
+    }
+
+    SeqDestroy(names);
+    return success;
+}
+
+static bool TreeDigestCompute(const char *path, char *digest_str)
+{
+    const EVP_MD *const md = HashDigestFromId(HASH_METHOD_SHA256);
+    if (md == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Could not determine function for tree digest");
+        return false;
+    }
+
+    EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+    if (md_ctx == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Could not allocate openssl hash context");
+        return false;
+    }
+    EVP_DigestInit(md_ctx, md);
+
+    const bool success = TreeDigestWalk(md_ctx, path,
+                                        TREE_DIGEST_RECURSION_LIMIT);
+
+    int md_len;
+    unsigned char digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+    EVP_DigestFinal(md_ctx, digest, &md_len);
+    EVP_MD_CTX_free(md_ctx);
+
+    if (success)
+    {
+        HashPrintSafe(digest_str, TREE_DIGEST_STRING_SIZE, digest,
+                      HASH_METHOD_SHA256, false);
+    }
+    return success;
+}
+
+bool TreeDigestGet(const char *path, char *digest_str)
+{
+    assert(path != NULL);
+    assert(digest_str != NULL);
+
+    const time_t now = time(NULL);
+
+    ThreadLock(&tree_digest_lock);
+    if (tree_digest_cache == NULL)
+    {
+        tree_digest_cache = MapNew(StringHash_untyped, StringEqual_untyped,
+                                   free, free);
+    }
+    TreeDigestEntry *entry = MapGet(tree_digest_cache, path);
+    if (entry != NULL && (now - entry->computed) < TREE_DIGEST_CACHE_TTL)
+    {
+        strlcpy(digest_str, entry->digest, TREE_DIGEST_STRING_SIZE);
+        ThreadUnlock(&tree_digest_lock);
+        return true;
+    }
+    ThreadUnlock(&tree_digest_lock);
+
+    /* Walk outside the lock, concurrent queries for different paths should
+     * not serialize on each other. */
+    if (!TreeDigestCompute(path, digest_str))
+    {
+        return false;
+    }
+
+    ThreadLock(&tree_digest_lock);
+    entry = MapGet(tree_digest_cache, path);
+    if (entry == NULL)
+    {
+        entry = xcalloc(1, sizeof(TreeDigestEntry));
+        MapInsert(tree_digest_cache, xstrdup(path), entry);
+    }
+    strlcpy(entry->digest, digest_str, sizeof(entry->digest));
+    entry->computed = now;
+    ThreadUnlock(&tree_digest_lock);
+
+    return true;
+}
@@ -0,0 +1,50 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_SERVER_TREEDIGEST_H
+#define CFENGINE_SERVER_TREEDIGEST_H
+
+#include <platform.h>
+
+#include <openssl/evp.h>                                /* EVP_MAX_MD_SIZE */
+
+/* Hex digest plus terminating '\0'. */
+#define TREE_DIGEST_STRING_SIZE (2 * EVP_MAX_MD_SIZE + 1)
+
+/**
+ * Answer a TREEDIGEST protocol query: a SHA-256 digest over the metadata
+ * (sorted names, type, mode, size, mtime) of every entry under #path,
+ * recursively. Any change to the tree's shape or to a file's metadata
+ * changes the digest, so an agent holding the digest of its last fully
+ * synchronized copy can skip the per-file comparison when it still matches.
+ *
+ * Results are cached for a few seconds per path, so a splay storm of
+ * identical queries costs one walk instead of thousands.
+ *
+ * @param digest_str must have room for #TREE_DIGEST_STRING_SIZE bytes
+ * @return false if the tree could not be walked (e.g. path not a directory)
+ */
+bool TreeDigestGet(const char *path, char *digest_str);
+
+#endif
@@ -25,9 +25,10 @@
 #include <platform.h>
 #include <getopt.h>
 
-#include <client_code.h>        // cfnet_init
+#include <client_code.h>        // cfnet_init, ServerConnection
 #include <crypto.h>             // CryptoInitialize
 
+#include <addr_lib.h>           // ParseHostPort
 #include <bootstrap.h>          // GetAmPolicyHub
 #include <cf-serverd-enterprise-stubs.h>
 #include <conversion.h>         // MapAddress
@@ -42,6 +43,7 @@
 #include <openssl/err.h>        // ERR_get_error
 #include <policy_server.h>      // PolicyServerReadFile
 #include <printsize.h>          // PRINTSIZE
+#include <protocol.h>           // ProtocolStat, ProtocolGet (storm mode)
 #include <server_access.h>      // acl_Free
 #include <server_code.h>        // InitServer
 #include <server_common.h>
@@ -88,6 +90,12 @@ typedef struct
     char *address;
     pthread_t t_id;
     int ret;
+    /* storm (load generation) mode, see CFTestD_RunStorm(): */
+    char *storm_host;
+    char *manifest_file;
+    long storm_count;
+    long storm_ramp;
+    long storm_stat_burst;
 } CFTestD_Config;
 
 /*******************************************************************/
@@ -103,6 +111,7 @@ static const Component COMPONENT =
 
 static const struct option OPTIONS[] = {
     {"address", required_argument, 0, 'a'},
+    {"count", required_argument, 0, 'c'},
     {"debug", no_argument, 0, 'd'},
     {"log-level", required_argument, 0, 'g'},
     {"help", no_argument, 0, 'h'},
@@ -110,14 +119,19 @@ static const struct option OPTIONS[] = {
     {"jobs", required_argument, 0, 'j'},
     {"key-file", required_argument, 0, 'k'},
     {"timestamp", no_argument, 0, 'l'},
+    {"manifest", required_argument, 0, 'm'},
     {"port", required_argument, 0, 'p'},
+    {"ramp", required_argument, 0, 'R'},
     {"report", required_argument, 0, 'r'},
+    {"stat-burst", required_argument, 0, 'B'},
+    {"storm", required_argument, 0, 's'},
     {"verbose", no_argument, 0, 'v'},
     {"version", no_argument, 0, 'V'},
     {NULL, 0, 0, '\0'}};
 
 static const char *const HINTS[] = {
     "Bind to a specific address",
+    "Number of agent sessions to run in storm mode (default 100)",
     "Enable debugging output",
     "Specify how detailed logs should be. Possible values: 'error', 'warning', 'notice', 'info', 'verbose', 'debug'",
     "Print the help message",
@@ -127,8 +141,12 @@ static const char *const HINTS[] = {
     " 0). Threads will bind to different addresses incrementally.",
     "Specify a path to the key (private) to use for communication",
     "Log timestamps on each line of log output",
+    "File with remote paths (one per line) to STAT and GET per storm session",
     "Set the port cf-testd will listen on",
+    "Number of new sessions to launch per second in storm mode (default 10)",
     "Read report from file",
+    "Number of STAT requests each storm session issues before its GETs (default 10)",
+    "Run as a load generator against HOST[:PORT] instead of serving",
     "Output verbose information about the behaviour of the agent",
     "Output the version of the software",
     NULL};
@@ -137,6 +155,9 @@ CFTestD_Config *CFTestD_ConfigInit()
 {
     CFTestD_Config *r =
         (CFTestD_Config *)(xcalloc(1, sizeof(CFTestD_Config)));
+    r->storm_count = 100;
+    r->storm_ramp = 10;
+    r->storm_stat_burst = 10;
     return r;
 }
 
@@ -146,6 +167,8 @@ void CFTestD_ConfigDestroy(CFTestD_Config *config)
     SeqDestroy(config->report);
     free(config->key_file);
     free(config->address);
+    free(config->storm_host);
+    free(config->manifest_file);
     free(config);
 }
 
@@ -163,13 +186,33 @@ CFTestD_Config *CFTestD_CheckOpts(int argc, char **argv, long *n_threads)
     CFTestD_Config *config = CFTestD_ConfigInit();
     assert(config != NULL);
 
-    while ((c = getopt_long(argc, argv, "a:df:g:hIj:k:lp:vV", OPTIONS, NULL)) != -1)
+    while ((c = getopt_long(argc, argv, "a:B:c:df:g:hIj:k:lm:p:R:r:s:vV", OPTIONS, NULL)) != -1)
     {
         switch (c)
         {
         case 'a':
             config->address = xstrdup(optarg);
             break;
+        case 'B':
+        {
+            int ret = StringToLong(optarg, &(config->storm_stat_burst));
+            if (ret != 0)
+            {
+                Log(LOG_LEVEL_ERR, "Failed to parse STAT burst size from '%s'\n", optarg);
+                config->storm_stat_burst = 10;
+            }
+            break;
+        }
+        case 'c':
+        {
+            int ret = StringToLong(optarg, &(config->storm_count));
+            if (ret != 0)
+            {
+                Log(LOG_LEVEL_ERR, "Failed to parse session count from '%s'\n", optarg);
+                config->storm_count = 100;
+            }
+            break;
+        }
         case 'd':
             LogSetGlobalLevel(LOG_LEVEL_DEBUG);
             break;
@@ -198,6 +241,9 @@ CFTestD_Config *CFTestD_CheckOpts(int argc, char **argv, long *n_threads)
         case 'l':
             LoggingEnableTimestamps(true);
             break;
+        case 'm':
+            config->manifest_file = xstrdup(optarg);
+            break;
         case 'p':
         {
             bool ret = SetCfenginePort(optarg);
@@ -208,9 +254,22 @@ CFTestD_Config *CFTestD_CheckOpts(int argc, char **argv, long *n_threads)
             }
             break;
         }
+        case 'R':
+        {
+            int ret = StringToLong(optarg, &(config->storm_ramp));
+            if (ret != 0)
+            {
+                Log(LOG_LEVEL_ERR, "Failed to parse ramp rate from '%s'\n", optarg);
+                config->storm_ramp = 10;
+            }
+            break;
+        }
         case 'r':
             config->report_file = xstrdup(optarg);
             break;
+        case 's':
+            config->storm_host = xstrdup(optarg);
+            break;
         case 'v':
             LogSetGlobalLevel(LOG_LEVEL_VERBOSE);
             break;
@@ -724,6 +783,270 @@ static void *CFTestD_ServeReport(void *config_arg)
     return NULL;
 }
 
+/*******************************************************************/
+/* Connection storm (load generation) mode                         */
+/*******************************************************************/
+
+typedef struct
+{
+    const char *host;
+    const Seq *manifest;    /* remote paths, shared and read-only */
+    long stat_burst;
+    long session_id;
+    pthread_t t_id;
+} CFTestD_StormSession;
+
+typedef struct
+{
+    long sessions_ok;
+    long handshake_failures;
+    long stats_ok;
+    long stats_failed;
+    long gets_ok;
+    long gets_failed;
+} CFTestD_StormTotals;
+
+/* Aggregated across all session threads, hence the lock. */
+static CFTestD_StormTotals STORM_TOTALS = { 0 };
+static pthread_mutex_t STORM_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * One simulated agent session: TLS handshake and identification, a burst of
+ * STAT requests and one STAT+GET per manifest entry — the shape of an
+ * agent's policy-update run, minus the policy evaluation in between.
+ */
+static void *CFTestD_StormSessionRun(void *arg)
+{
+    CFTestD_StormSession *session = (CFTestD_StormSession *) arg;
+
+    ConnectionFlags connflags = {
+        .protocol_version = CF_PROTOCOL_LATEST,
+        .trust_server = true,
+        .off_the_record = true
+    };
+    int err;
+    char *buf = xstrdup(session->host);
+    char *host, *port;
+    ParseHostPort(buf, &host, &port);
+    if (port == NULL)
+    {
+        port = CFENGINE_PORT_STR;
+    }
+    AgentConnection *conn = ServerConnection(host, port, NULL, 30, connflags, &err);
+    free(buf);
+
+    if (conn == NULL)
+    {
+        ThreadLock(&STORM_LOCK);
+        STORM_TOTALS.handshake_failures++;
+        ThreadUnlock(&STORM_LOCK);
+        return NULL;
+    }
+
+    CFTestD_StormTotals totals = { 0 };
+    const size_t n_paths =
+        (session->manifest != NULL) ? SeqLength(session->manifest) : 0;
+
+    for (long i = 0; n_paths > 0 && i < session->stat_burst && !TERMINATE; i++)
+    {
+        const char *path = SeqAt(session->manifest, i % n_paths);
+        struct stat sb;
+        if (ProtocolStat(conn, path, &sb))
+        {
+            totals.stats_ok++;
+        }
+        else
+        {
+            totals.stats_failed++;
+        }
+    }
+
+    for (size_t i = 0; i < n_paths && !TERMINATE; i++)
+    {
+        const char *path = SeqAt(session->manifest, i);
+        char local_file[PATH_MAX];
+        snprintf(local_file, sizeof(local_file),
+                 "cf-testd-storm.%ld.tmp", session->session_id);
+
+        struct stat sb;
+        if (ProtocolStat(conn, path, &sb) &&
+            ProtocolGet(conn, path, local_file, sb.st_size, sb.st_mode, false))
+        {
+            totals.gets_ok++;
+        }
+        else
+        {
+            totals.gets_failed++;
+        }
+        unlink(local_file);
+    }
+
+    DisconnectServer(conn);
+
+    ThreadLock(&STORM_LOCK);
+    STORM_TOTALS.sessions_ok++;
+    STORM_TOTALS.stats_ok += totals.stats_ok;
+    STORM_TOTALS.stats_failed += totals.stats_failed;
+    STORM_TOTALS.gets_ok += totals.gets_ok;
+    STORM_TOTALS.gets_failed += totals.gets_failed;
+    ThreadUnlock(&STORM_LOCK);
+    return NULL;
+}
+
+static Seq *CFTestD_LoadManifest(const char *manifest_file)
+{
+    if (!FileCanOpen(manifest_file, "r"))
+    {
+        Log(LOG_LEVEL_ERR,
+            "Can't open manifest file '%s' for reading", manifest_file);
+        return NULL;
+    }
+    Writer *contents = FileRead(manifest_file, SIZE_MAX, NULL);
+    if (contents == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Error reading manifest file '%s'", manifest_file);
+        return NULL;
+    }
+    char *data = StringWriterClose(contents);
+    Seq *lines = SeqStringFromString(data, '\n');
+    free(data);
+
+    /* drop empty lines (e.g. the one after a trailing newline) */
+    Seq *manifest = SeqNew(SeqLength(lines), free);
+    for (size_t i = 0; i < SeqLength(lines); i++)
+    {
+        const char *line = SeqAt(lines, i);
+        if (!NULL_OR_EMPTY(line))
+        {
+            SeqAppend(manifest, xstrdup(line));
+        }
+    }
+    SeqDestroy(lines);
+
+    if (SeqLength(manifest) == 0)
+    {
+        Log(LOG_LEVEL_ERR, "Manifest file '%s' contained no paths",
+            manifest_file);
+        SeqDestroy(manifest);
+        return NULL;
+    }
+    return manifest;
+}
+
+/**
+ * Launch #storm_count simulated agent sessions against #storm_host at a rate
+ * of #storm_ramp new sessions per second and report totals at the end, to
+ * characterize where the server's connection handling collapses. Each session
+ * runs on its own (blocking) thread, so concurrency at the server equals the
+ * launch rate times the session duration — raise --ramp to push it up.
+ */
+static int CFTestD_RunStorm(CFTestD_Config *config)
+{
+    assert(config != NULL);
+    assert(config->storm_host != NULL);
+
+    if (config->storm_count < 1 || config->storm_ramp < 1)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Session count and ramp rate must be positive "
+            "(got %ld session(s) at %ld/s)",
+            config->storm_count, config->storm_ramp);
+        return -1;
+    }
+
+    Seq *manifest = NULL;
+    if (config->manifest_file != NULL)
+    {
+        manifest = CFTestD_LoadManifest(config->manifest_file);
+        if (manifest == NULL)
+        {
+            /* Already logged */
+            return -1;
+        }
+    }
+    else
+    {
+        Log(LOG_LEVEL_NOTICE,
+            "No manifest given (-m), sessions will only handshake");
+    }
+
+    /* The sessions act as agents, so they need the client key pair. */
+    CryptoInitialize();
+    LoadSecretKeys(NULL, NULL, NULL, NULL);
+
+    const long count = config->storm_count;
+    Log(LOG_LEVEL_NOTICE,
+        "Starting connection storm against '%s': "
+        "%ld sessions at %ld/s, %ld STATs and %zu GETs each",
+        config->storm_host, count, config->storm_ramp,
+        (manifest != NULL) ? config->storm_stat_burst : 0,
+        (manifest != NULL) ? SeqLength(manifest) : (size_t) 0);
+
+    CFTestD_StormSession *sessions = (CFTestD_StormSession *)
+        xcalloc(count, sizeof(CFTestD_StormSession));
+    const struct timespec interval = {
+        .tv_sec = 0,
+        .tv_nsec = 1000000000L / config->storm_ramp
+    };
+
+    time_t start;
+    time(&start);
+
+    long launched = 0;
+    for (long s = 0; s < count && !TERMINATE; s++)
+    {
+        sessions[s].host = config->storm_host;
+        sessions[s].manifest = manifest;
+        sessions[s].stat_burst = config->storm_stat_burst;
+        sessions[s].session_id = s;
+        int ret = pthread_create(&(sessions[s].t_id), NULL,
+                                 CFTestD_StormSessionRun, &sessions[s]);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_ERR,
+                "Failed to create session thread nr. %ld: %s\n",
+                s, strerror(ret));
+            break;
+        }
+        launched++;
+        nanosleep(&interval, NULL);
+    }
+
+    for (long s = 0; s < launched; s++)
+    {
+        int ret = pthread_join(sessions[s].t_id, NULL);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to join the thread nr. %ld: %s\n",
+                s, strerror(ret));
+        }
+    }
+    free(sessions);
+
+    time_t stop;
+    time(&stop);
+    const double seconds = difftime(stop, start);
+
+    Log(LOG_LEVEL_NOTICE,
+        "Storm finished in %.f seconds: "
+        "%ld/%ld sessions completed, %ld handshake failure(s), "
+        "%ld/%ld STATs ok, %ld/%ld GETs ok",
+        seconds,
+        STORM_TOTALS.sessions_ok, launched,
+        STORM_TOTALS.handshake_failures,
+        STORM_TOTALS.stats_ok,
+        STORM_TOTALS.stats_ok + STORM_TOTALS.stats_failed,
+        STORM_TOTALS.gets_ok,
+        STORM_TOTALS.gets_ok + STORM_TOTALS.gets_failed);
+
+    SeqDestroy(manifest);
+
+    const bool all_ok = (STORM_TOTALS.sessions_ok == launched &&
+                         STORM_TOTALS.stats_failed == 0 &&
+                         STORM_TOTALS.gets_failed == 0);
+    return all_ok ? 0 : -1;
+}
+
 static void HandleSignal(int signum)
 {
     switch (signum)
@@ -795,6 +1118,14 @@ int main(int argc, char *argv[])
         config->address = xstrdup("127.0.0.1");
     }
 
+    if (config->storm_host != NULL)
+    {
+        int ret = CFTestD_RunStorm(config);
+        CFTestD_ConfigDestroy(config);
+        CallCleanupFunctions();
+        return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     CFTestD_Config **thread_configs = (CFTestD_Config**) xcalloc(n_threads, sizeof(CFTestD_Config*));
     for (int i = 0; i < n_threads; i++)
     {
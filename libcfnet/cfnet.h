@@ -58,6 +58,10 @@ typedef struct
     bool            force_ipv4       : 1;
     bool            trust_server     : 1;
     bool            off_the_record   : 1;
+    /* A busy server's retry-after hint has already been honoured once for
+     * this connection attempt; not part of the connection's cache identity,
+     * so excluded from ConnectionFlagsEqual(). */
+    bool            busy_retry_done  : 1;
 } ConnectionFlags;
 
 static inline bool ConnectionFlagsEqual(const ConnectionFlags *f1,
@@ -105,6 +109,16 @@ typedef struct
     char encryption_type;
     short error;
     struct Stat_ *cache;                          /* cache for remote STATs */
+    size_t cache_negative;       /* number of failed entries in the cache */
+    bool statdir_unsupported;        /* server replied BAD to STATDIR once */
+    bool cget_unsupported;           /* server replied BAD to CGET once */
+    bool md5get_unsupported;         /* server replied BAD to MD5GET once */
+    bool rget_unsupported;           /* server replied BAD to RGET once */
+    char *prefetched_source;         /* remote path spooled by an MD5GET */
+    char *prefetched_file;           /* local spool file holding its data */
+    /* Large receive buffer shared by the block-stream transfers on this
+     * connection; allocated on first use, reused across files. */
+    char *xfer_buffer;
 
     /* The following consistutes the ID of a server host, mostly taken from
      * the copy_from connection attributes. */
@@ -31,6 +31,8 @@
 #include <openssl/err.h>                                   /* ERR_get_error */
 #include <protocol.h>                              /* ProtocolIsUndefined() */
 #include <tls_client.h>               /* TLSTry */
+#include <timer_wheel.h>              /* TimerWheelArm,TimerWheelDisarm */
+#include <tls_session_cache.h>        /* TLSSessionCacheStore */
 #include <tls_generic.h>              /* TLSVerifyPeer */
 #include <dir.h>
 #include <unix.h>
@@ -45,11 +47,20 @@
 #include <misc_lib.h>                                   /* ProgrammingError */
 #include <printsize.h>                                         /* PRINTSIZE */
 #include <lastseen.h>                                            /* LastSaw */
+#include <stat_cache.h>                     /* StatCacheInsertParsed */
 #include <file_stream.h>
 
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
 
 #define CFENGINE_SERVICE "cfengine"
 
+/* Upper bound on how long we are willing to sleep on a busy server's
+ * retry-after hint before reconnecting once. */
+#define MAX_BUSY_RETRY_WAIT 60
+
 
 /**
  * Initialize client's network library.
@@ -138,7 +149,7 @@ int TLSConnect(ConnectionInfo *conn_info, bool trust_server, const Rlist *restri
 {
     int ret;
 
-    ret = TLSTry(conn_info);
+    ret = TLSTry(conn_info, ipaddr);
     if (ret == -1)
     {
         return -1;
@@ -195,9 +206,168 @@ int TLSConnect(ConnectionInfo *conn_info, bool trust_server, const Rlist *restri
      * identification data. */
     ret = TLSClientIdentificationDialog(conn_info, username);
 
+    if (ret == 1)
+    {
+        /* Application data has flowed both ways by now, so TLS 1.3 session
+         * tickets have been processed; store for the next agent run. */
+        TLSSessionCacheStore(ipaddr, conn_info->ssl);
+    }
+
     return ret;
 }
 
+/* Circuit breaker for outgoing connections.
+ *
+ * When a server is down every attempt to reach it costs a full connect (or
+ * handshake) timeout, and the promises depending on it pay that cost one
+ * after another.  After BREAKER_THRESHOLD failures within BREAKER_WINDOW
+ * seconds the breaker for that server opens and further attempts fail
+ * immediately for BREAKER_COOLDOWN seconds; then a single probe is let
+ * through (half-open) and its outcome decides whether the breaker closes
+ * or re-opens for another cool-down.  Only failures to reach or complete a
+ * handshake with the server count -- an authentication refusal means the
+ * server is alive and resets the breaker like any other success. */
+
+#define BREAKER_THRESHOLD 3                                     /* failures */
+#define BREAKER_WINDOW 60                                        /* seconds */
+#define BREAKER_COOLDOWN 60                                      /* seconds */
+
+typedef struct ServerBreaker_
+{
+    char *server;
+    int failures;                 /* failures since the window started */
+    time_t window_start;
+    time_t opened;                /* when the breaker opened, 0 = closed */
+    bool probing;                 /* a half-open probe is under way */
+    struct ServerBreaker_ *next;
+} ServerBreaker;
+
+static ServerBreaker *BREAKERS = NULL; /* GLOBAL_X */
+static pthread_mutex_t breakers_lock = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
+
+/* Caller must hold breakers_lock. */
+static ServerBreaker *BreakerLookup(const char *server, bool create)
+{
+    for (ServerBreaker *b = BREAKERS; b != NULL; b = b->next)
+    {
+        if (strcmp(b->server, server) == 0)
+        {
+            return b;
+        }
+    }
+
+    if (!create)
+    {
+        return NULL;
+    }
+
+    ServerBreaker *b = xcalloc(1, sizeof(*b));
+    b->server = xstrdup(server);
+    b->next = BREAKERS;
+    BREAKERS = b;
+    return b;
+}
+
+/**
+ * @return true if a connection attempt to #server should be refused without
+ *         touching the network.  At most one probe per cool-down period is
+ *         let through once the cool-down has expired.
+ */
+static bool BreakerSuppresses(const char *server)
+{
+    bool suppress = false;
+
+    ThreadLock(&breakers_lock);
+
+    ServerBreaker *b = BreakerLookup(server, false);
+    if (b != NULL && b->opened != 0)
+    {
+        if (time(NULL) < b->opened + BREAKER_COOLDOWN)
+        {
+            suppress = true;
+        }
+        else if (b->probing)
+        {
+            /* Another thread's probe is in flight; keep failing fast. */
+            suppress = true;
+        }
+        else
+        {
+            b->probing = true;          /* half-open: this attempt probes */
+        }
+    }
+
+    ThreadUnlock(&breakers_lock);
+    return suppress;
+}
+
+static void BreakerRecordFailure(const char *server)
+{
+    const time_t now = time(NULL);
+
+    ThreadLock(&breakers_lock);
+
+    ServerBreaker *b = BreakerLookup(server, true);
+    if (b->opened != 0)
+    {
+        /* The half-open probe failed: re-open for a fresh cool-down. */
+        b->opened = now;
+        b->probing = false;
+    }
+    else
+    {
+        if (now - b->window_start > BREAKER_WINDOW)
+        {
+            b->failures = 0;
+            b->window_start = now;
+        }
+        b->failures++;
+
+        if (b->failures >= BREAKER_THRESHOLD)
+        {
+            b->opened = now;
+            Log(LOG_LEVEL_NOTICE,
+                "Server '%s' failed to respond %d times in %jd seconds,"
+                " failing fast for the next %d seconds",
+                server, b->failures, (intmax_t) (now - b->window_start),
+                BREAKER_COOLDOWN);
+        }
+    }
+
+    ThreadUnlock(&breakers_lock);
+}
+
+static void BreakerRecordSuccess(const char *server)
+{
+    ThreadLock(&breakers_lock);
+
+    ServerBreaker *b = BreakerLookup(server, false);
+    if (b != NULL)
+    {
+        if (b->opened != 0)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Server '%s' is reachable again, closing circuit breaker",
+                server);
+        }
+        b->failures = 0;
+        b->window_start = 0;
+        b->opened = 0;
+        b->probing = false;
+    }
+
+    ThreadUnlock(&breakers_lock);
+}
+
+bool ServerBreakerIsOpen(const char *server)
+{
+    ThreadLock(&breakers_lock);
+    const ServerBreaker *b = BreakerLookup(server, false);
+    const bool open = (b != NULL && b->opened != 0);
+    ThreadUnlock(&breakers_lock);
+    return open;
+}
+
 /**
  * @NOTE if #flags.protocol_version is CF_PROTOCOL_UNDEFINED, then latest
  *       protocol is used by default.
@@ -210,6 +380,15 @@ AgentConnection *ServerConnection(const char *server, const char *port, const Rl
     int ret;
     *err = 0;
 
+    if (BreakerSuppresses(server))
+    {
+        Log(LOG_LEVEL_INFO,
+            "Not attempting connection to '%s':"
+            " circuit breaker is open after repeated failures", server);
+        *err = -1;
+        return NULL;
+    }
+
     conn = NewAgentConn(server, port, flags);
 
 #if !defined(__MINGW32__) && !defined(__ANDROID__)
@@ -240,6 +419,7 @@ AgentConnection *ServerConnection(const char *server, const char *port, const Rl
     {
         Log(LOG_LEVEL_INFO, "No server is responding on port: %s",
             port);
+        BreakerRecordFailure(server);
         DisconnectServer(conn);
         *err = -1;
         return NULL;
@@ -260,18 +440,62 @@ AgentConnection *ServerConnection(const char *server, const char *port, const Rl
          * TLSConnect() it will have the version we finally ended up with. */
         conn->conn_info->protocol = protocol_version;
 
+        /* connect() above has its own timeout, but a server that accepts
+         * and then stalls mid-handshake would block us for much longer;
+         * bound the handshake by the same connect timeout. */
+        TimerWheelEntry *deadline = (connect_timeout > 0)
+            ? TimerWheelArm(conn->conn_info->sd,
+                            (int64_t) connect_timeout * 1000)
+            : NULL;
+
         ret = TLSConnect(conn->conn_info, flags.trust_server, restrict_keys,
                          conn->remoteip, conn->username);
 
+        if (TimerWheelDisarm(deadline))
+        {
+            Log(LOG_LEVEL_INFO,
+                "TLS handshake with server '%s' timed out after %u seconds",
+                server, connect_timeout);
+            ret = -1;                /* socket was shut down by the timer */
+        }
+
         if (ret == -1)                                      /* Error */
         {
+            BreakerRecordFailure(server);
             DisconnectServer(conn);
             *err = -1;
             return NULL;
         }
-        else if (ret == 0)                             /* Auth/ID error */
+
+        /* The server completed a handshake, so it is alive: close the
+         * breaker even if it refuses us below for its own reasons. */
+        BreakerRecordSuccess(server);
+
+        if (ret == 0)                                  /* Auth/ID error */
         {
+            const unsigned int retry_after =
+                conn->conn_info->retry_after_hint;
             DisconnectServer(conn);
+
+            if (retry_after > 0 && !flags.busy_retry_done)
+            {
+                /* The server refused us for being over capacity, not by
+                 * policy, and hinted when to come back.  Honouring the hint
+                 * spreads a reconnection storm out instead of having every
+                 * agent hammer the server again immediately. */
+                const unsigned int wait =
+                    MIN(retry_after, MAX_BUSY_RETRY_WAIT);
+                Log(LOG_LEVEL_NOTICE,
+                    "Server '%s' is busy, retrying in %u seconds as hinted",
+                    server, wait);
+                sleep(wait);
+
+                ConnectionFlags retry_flags = flags;
+                retry_flags.busy_retry_done = true;
+                return ServerConnection(server, port, restrict_keys,
+                                        connect_timeout, retry_flags, err);
+            }
+
             errno = EPERM;
             *err = -2;
             return NULL;
@@ -287,6 +511,10 @@ AgentConnection *ServerConnection(const char *server, const char *port, const Rl
     }
     else if (ProtocolIsClassic(protocol_version))
     {
+        /* The TCP connection is up, which is all the breaker tracks for the
+         * classic protocol. */
+        BreakerRecordSuccess(server);
+
         conn->conn_info->protocol = CF_PROTOCOL_CLASSIC;
         conn->encryption_type = CfEnterpriseOptions();
 
@@ -341,6 +569,140 @@ void DisconnectServer(AgentConnection *conn)
 
 /*********************************************************************/
 
+/**
+ * List a remote directory with one "STATDIR" exchange, which returns
+ * (name, stat line, link target) triples for every entry; the stat data is
+ * inserted into the connection's stat cache so that no per-entry STAT
+ * round trips are needed afterwards.
+ *
+ * @param unsupported set to true if the server rejected the command, which
+ *        old servers do for any unknown command. That is indistinguishable
+ *        from a genuine denial, so the caller should retry with OPENDIR,
+ *        which will surface the real error if there is one.
+ * @return the entry list, or NULL on error (a directory is never empty,
+ *         it contains at least . and ..).
+ */
+static Item *RemoteDirListStat(const char *dirname, AgentConnection *conn,
+                               bool *unsupported)
+{
+    char sendbuffer[CF_BUFSIZE];
+    char recvbuffer[CF_BUFSIZE];
+
+    *unsupported = false;
+
+    snprintf(sendbuffer, CF_BUFSIZE, "STATDIR %s", dirname);
+
+    if (SendTransaction(conn->conn_info, sendbuffer,
+                        strlen(sendbuffer), CF_DONE) == -1)
+    {
+        return NULL;
+    }
+
+    Item *start = NULL, *end = NULL;                  /* NULL is empty list */
+    bool first_packet = true;
+    while (true)
+    {
+        int nbytes = ReceiveTransaction(conn->conn_info, recvbuffer, NULL);
+
+        /* If recv error or socket closed before receiving CFD_TERMINATOR. */
+        if (nbytes == -1)
+        {
+            /* TODO mark connection in the cache as closed. */
+            goto err;
+        }
+
+        if (recvbuffer[0] == '\0')
+        {
+            Log(LOG_LEVEL_ERR,
+                "Empty%s server packet when listing directory '%s'!",
+                (start == NULL) ? " first" : "",
+                dirname);
+            goto err;
+        }
+
+        if (first_packet &&
+            (FailedProtoReply(recvbuffer) || BadProtoReply(recvbuffer)))
+        {
+            *unsupported = true;
+            goto err;
+        }
+        first_packet = false;
+
+        /* Double '\0' means end of packet. */
+        char *sp = recvbuffer;
+        while (*sp != '\0')
+        {
+            if (strcmp(sp, CFD_TERMINATOR) == 0)      /* end of all packets */
+            {
+                return start;
+            }
+
+            /* A triple never spans packets, so all three strings must be
+             * here; refuse to read past what was actually received. */
+            const char *name = sp;
+            sp += strlen(sp) + 1;
+            if (sp >= recvbuffer + nbytes || *sp == '\0')
+            {
+                Log(LOG_LEVEL_ERR,
+                    "Malformed STATDIR reply when listing directory '%s'!",
+                    dirname);
+                goto err;
+            }
+            const char *statline = sp;
+            sp += strlen(sp) + 1;
+            if (sp >= recvbuffer + nbytes)
+            {
+                Log(LOG_LEVEL_ERR,
+                    "Malformed STATDIR reply when listing directory '%s'!",
+                    dirname);
+                goto err;
+            }
+            const char *linktarget = sp;              /* "" if not a link */
+            sp += strlen(sp) + 1;
+
+            if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+            {
+                char path[CF_BUFSIZE];
+                int ret = snprintf(path, sizeof(path), "%s/%s",
+                                   dirname, name);
+                if (ret >= 0 && (size_t) ret < sizeof(path) &&
+                    StatCacheLookup(conn, path, conn->this_server) == NULL)
+                {
+                    StatCacheInsertParsed(conn, path, statline, linktarget);
+                }
+            }
+
+            Item *ip = xcalloc(1, sizeof(Item));
+            ip->name = (char *) AllocateDirentForFilename(name);
+
+            if (start == NULL)  /* First element */
+            {
+                start = ip;
+                end = ip;
+            }
+            else
+            {
+                end->next = ip;
+                end = ip;
+            }
+        }
+    }
+
+    return start;
+
+  err:                                                         /* free list */
+    for (Item *ip = start; ip != NULL; ip = start)
+    {
+        start = ip->next;
+        free(ip->name);
+        free(ip);
+    }
+
+    return NULL;
+}
+
+/*********************************************************************/
+
 /* Returning NULL (an empty list) does not mean empty directory but ERROR,
  * since every directory has to contain at least . and .. */
 Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
@@ -357,6 +719,22 @@ Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
         return NULL;
     }
 
+    /* One STATDIR exchange returns the listing together with the stat
+     * information for every entry, saving the per-entry STAT round trips
+     * that follow a directory listing. */
+    if (ProtocolIsTLS(conn->conn_info->protocol) && !conn->statdir_unsupported)
+    {
+        bool unsupported = false;
+        Item *list = RemoteDirListStat(dirname, conn, &unsupported);
+        if (!unsupported)
+        {
+            return list;
+        }
+        conn->statdir_unsupported = true;
+        Log(LOG_LEVEL_VERBOSE,
+            "Server does not support STATDIR, falling back to OPENDIR");
+    }
+
     /* We encrypt only for CLASSIC protocol. The TLS protocol is always over
      * encrypted layer, so it does not support encrypted (S*) commands. */
     encrypt = encrypt && conn->conn_info->protocol == CF_PROTOCOL_CLASSIC;
@@ -569,6 +947,129 @@ bool CompareHashNet(const char *file1, const char *file2, bool encrypt, AgentCon
 
 /*********************************************************************/
 
+static bool ReceiveGetStream(const char *source, const char *dest,
+                             off_t size, int buf_size, mode_t mode,
+                             AgentConnection *conn, off_t start_offset,
+                             bool *refused);
+static void FlushFileStream(int sd, int toget);
+
+/**
+ * Like CompareHashNet(), but when the server supports the "MD5GET" verb the
+ * hash comparison and the download are pipelined into a single exchange: on
+ * a digest mismatch the server streams the file immediately and we spool it
+ * next to #file2 for the subsequent CopyRegularFileNet() call to pick up,
+ * halving the round trips per changed file.
+ *
+ * @param size  Size of the remote file (known from the preceding STAT; the
+ *              caller only compares hashes when the sizes are equal).
+ * @return True if the remote file differs from #file2, i.e. a copy is
+ *         needed, mirroring CompareHashNet().
+ */
+bool CompareHashAndFetchNet(const char *file1, const char *file2, off_t size,
+                            bool encrypt, AgentConnection *conn)
+{
+    assert(conn != NULL);
+
+    /* The fused verb only exists on the TLS protocol versions that still
+     * use GET's block framing; otherwise do the separate hash query. */
+    if (conn->md5get_unsupported ||
+        !ProtocolIsTLS(conn->conn_info->protocol) ||
+        ProtocolSupportsFileStream(conn->conn_info->protocol))
+    {
+        return CompareHashNet(file1, file2, encrypt, conn);
+    }
+
+    const int buf_size = CF_BUFSIZE - 1;
+
+    char sendbuffer[CF_BUFSIZE] = {0};
+    int prefix = snprintf(sendbuffer, sizeof(sendbuffer), "MD5GET %d %s",
+                          buf_size, file1);
+    if (prefix <= 0 ||
+        (size_t) prefix + CF_SMALL_OFFSET + CF_DEFAULT_DIGEST_LEN
+        >= sizeof(sendbuffer))
+    {
+        return CompareHashNet(file1, file2, encrypt, conn);
+    }
+
+    unsigned char d[EVP_MAX_MD_SIZE + 1];
+    HashFile(file2, d, CF_DEFAULT_DIGEST, false);
+    memcpy(sendbuffer + prefix + CF_SMALL_OFFSET, d, CF_DEFAULT_DIGEST_LEN);
+    int tosend = prefix + CF_SMALL_OFFSET + CF_DEFAULT_DIGEST_LEN;
+
+    if (SendTransaction(conn->conn_info, sendbuffer, tosend, CF_DONE) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed send. (SendTransaction: %s)", GetErrorStr());
+        Log(LOG_LEVEL_VERBOSE, "Networking error, assuming different checksum");
+        return true;
+    }
+
+    char recvbuffer[CF_BUFSIZE] = {0};
+    if (ReceiveTransaction(conn->conn_info, recvbuffer, NULL) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed receive. (ReceiveTransaction: %s)", GetErrorStr());
+        Log(LOG_LEVEL_VERBOSE, "No answer from host, assuming different checksum");
+        return true;
+    }
+
+    if (strncmp(recvbuffer, "BAD", 3) == 0)
+    {
+        conn->md5get_unsupported = true;
+        Log(LOG_LEVEL_VERBOSE,
+            "Server does not support MD5GET, falling back to MD5");
+        return CompareHashNet(file1, file2, encrypt, conn);
+    }
+
+    if (strcmp(recvbuffer, CFD_FALSE) == 0)
+    {
+        return false;                               /* hashes matched */
+    }
+
+    if (strcmp(recvbuffer, CFD_TRUE) != 0)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Unexpected MD5GET reply from server '%s', "
+            "assuming different checksum", conn->this_server);
+        conn->error = true;
+        return true;
+    }
+
+    /* Hashes differ and the file stream follows right away: spool it next
+     * to the destination so CopyRegularFileNet() finds it there.  First
+     * discard any prefetch a previous comparison left unconsumed. */
+    if (conn->prefetched_file != NULL)
+    {
+        unlink(conn->prefetched_file);
+        free(conn->prefetched_file);
+        free(conn->prefetched_source);
+        conn->prefetched_file = NULL;
+        conn->prefetched_source = NULL;
+    }
+
+    char spool[CF_BUFSIZE];
+    int ret = snprintf(spool, sizeof(spool), "%s.cfmiss", file2);
+    if (ret < 0 || (size_t) ret >= sizeof(spool))
+    {
+        Log(LOG_LEVEL_ERR,
+            "Filename too long to spool MD5GET download: %s", file2);
+        FlushFileStream(conn->conn_info->sd, size);
+        return true;
+    }
+
+    unlink(spool);                                /* To avoid link attacks */
+    if (!ReceiveGetStream(file1, spool, size, buf_size, (mode_t) 0600, conn,
+                          0, NULL))
+    {
+        unlink(spool);
+        return true;         /* differs, the copy will fetch it normally */
+    }
+
+    conn->prefetched_source = xstrdup(file1);
+    conn->prefetched_file = xstrdup(spool);
+    return true;
+}
+
+/*********************************************************************/
+
 
 static bool EncryptCopyRegularFileNet(const char *source, const char *dest, off_t size, AgentConnection *conn)
 {
@@ -749,55 +1250,379 @@ static void FlushFileStream(int sd, int toget)
 
 /* TODO finalise socket or TLS session in all cases that this function fails
  * and the transaction protocol is out of sync. */
-bool CopyRegularFileNet(const char *source, const char *basis, const char *dest, off_t size,
-                        bool encrypt, AgentConnection *conn, mode_t mode)
-{
-    assert(conn != NULL);
+#ifdef HAVE_LIBZSTD
 
-    char *buf, workbuf[CF_BUFSIZE];
-    const char cfchangedstr[] = CF_CHANGEDSTR1 CF_CHANGEDSTR2;
-    const int buf_size = 2048;
+/**
+ * Per-file opt-out from compressed transfer: already-compressed formats
+ * only get slower and marginally bigger when recompressed.
+ */
+static bool FileIsCompressible(const char *file)
+{
+    static const char *const incompressible[] =
+    {
+        ".gz", ".tgz", ".bz2", ".xz", ".zst", ".lz4", ".zip", ".jar",
+        ".jpg", ".jpeg", ".png", ".gif", ".mp3", ".mp4", ".ogg", ".webm",
+        ".rpm", ".deb", NULL
+    };
 
-    /* We encrypt only for CLASSIC protocol. The TLS protocol is always over
-     * encrypted layer, so it does not support encrypted (S*) commands. */
-    encrypt = encrypt && conn->conn_info->protocol == CF_PROTOCOL_CLASSIC;
+    const char *ext = strrchr(file, '.');
+    if (ext == NULL)
+    {
+        return true;
+    }
 
-    if (encrypt)
+    for (int i = 0; incompressible[i] != NULL; i++)
     {
-        return EncryptCopyRegularFileNet(source, dest, size, conn);
+        if (strcasecmp(ext, incompressible[i]) == 0)
+        {
+            return false;
+        }
     }
 
-    if ((strlen(dest) > CF_BUFSIZE - 20))
+    return true;
+}
+
+/**
+ * Fetch @a source with one "CGET" exchange: the server streams a single
+ * zstd frame over transactions, the last one flagged CF_DONE. A stream
+ * that ends before the frame is complete means the server aborted the
+ * transfer (file changing at source) and the destination is discarded.
+ *
+ * @param unsupported set to true if the server rejected the command (old
+ *        servers and servers built without libzstd answer "BAD: ..."),
+ *        in which case the caller should fall back to plain GET.
+ */
+static bool CompressedCopyRegularFileNet(const char *source, const char *dest,
+                                         AgentConnection *conn, mode_t mode,
+                                         bool *unsupported)
+{
+    char workbuf[CF_BUFSIZE];
+    char recvbuffer[CF_BUFSIZE];
+
+    *unsupported = false;
+
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (dctx == NULL)
     {
-        Log(LOG_LEVEL_ERR, "Filename too long");
+        Log(LOG_LEVEL_ERR, "Failed to allocate decompression context");
         return false;
     }
 
     unlink(dest);                /* To avoid link attacks */
 
-    workbuf[0] = '\0';
-    int tosend = snprintf(workbuf, CF_BUFSIZE, "GET %d %s", buf_size, source);
+    int dd = safe_open_create_perms(dest, O_WRONLY | O_CREAT | O_TRUNC |
+                                    O_EXCL | O_BINARY, mode);
+    if (dd == -1)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Copy from server '%s' to destination '%s' failed (open: %s)",
+            conn->this_server, dest, GetErrorStr());
+        ZSTD_freeDCtx(dctx);
+        unlink(dest);
+        return false;
+    }
+
+    int tosend = snprintf(workbuf, CF_BUFSIZE, "CGET %s", source);
     if (tosend <= 0 || tosend >= CF_BUFSIZE)
     {
-        Log(LOG_LEVEL_ERR, "Failed to compose GET command for file %s",
+        Log(LOG_LEVEL_ERR, "Failed to compose CGET command for file %s",
             source);
+        ZSTD_freeDCtx(dctx);
+        close(dd);
+        unlink(dest);
         return false;
     }
 
-    /* Send proposition C0 */
-
     if (SendTransaction(conn->conn_info, workbuf, tosend, CF_DONE) == -1)
     {
-        Log(LOG_LEVEL_ERR, "Couldn't send GET command");
+        Log(LOG_LEVEL_ERR, "Couldn't send CGET command");
+        ZSTD_freeDCtx(dctx);
+        close(dd);
+        unlink(dest);
         return false;
     }
 
-    const ProtocolVersion version = ConnectionInfoProtocolVersion(conn->conn_info);
-    if (ProtocolSupportsFileStream(version)) {
-        return FileStreamFetch(conn->conn_info->ssl, basis, dest, mode, false);
+    Log(LOG_LEVEL_VERBOSE, "Copying remote file '%s:%s' (compressed)",
+        conn->this_server, source);
+
+    off_t n_wrote_total = 0;
+    size_t frame_remaining = 1;       /* zstd: 0 when the frame completes */
+    bool first = true;
+    bool recv_done = false, stream_error = false, write_failed = false;
+
+    while (!recv_done)
+    {
+        int more = 0;
+        int nbytes = ReceiveTransaction(conn->conn_info, recvbuffer, &more);
+        if (nbytes == -1)
+        {
+            stream_error = true;
+            break;
+        }
+        if (!more)
+        {
+            recv_done = true;
+        }
+
+        if (first)
+        {
+            recvbuffer[nbytes] = '\0';       /* so the checks can't overrun */
+            if (FailedProtoReply(recvbuffer) || BadProtoReply(recvbuffer))
+            {
+                *unsupported = true;
+                stream_error = true;
+                break;
+            }
+            first = false;
+        }
+
+        if (stream_error || write_failed)
+        {
+            continue;                 /* drain remaining transactions */
+        }
+
+        ZSTD_inBuffer in = { recvbuffer, (size_t) nbytes, 0 };
+        while (in.pos < in.size)
+        {
+            char outbuf[CF_BUFSIZE];
+            ZSTD_outBuffer out = { outbuf, sizeof(outbuf), 0 };
+
+            frame_remaining = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(frame_remaining))
+            {
+                Log(LOG_LEVEL_ERR, "Decompression of '%s:%s' failed (%s)",
+                    conn->this_server, source,
+                    ZSTD_getErrorName(frame_remaining));
+                stream_error = true;
+                break;
+            }
+
+            if (out.pos > 0)
+            {
+                ssize_t n_written = FullWrite(dd, outbuf, out.pos);
+                if (n_written < 0 || (size_t) n_written != out.pos)
+                {
+                    Log(LOG_LEVEL_ERR,
+                        "Local disk write failed copying '%s:%s' to '%s'",
+                        conn->this_server, source, dest);
+                    conn->error = true;
+                    write_failed = true;
+                    break;
+                }
+                n_wrote_total += out.pos;
+            }
+        }
+    }
+
+    ZSTD_freeDCtx(dctx);
+    close(dd);
+
+    if (stream_error || write_failed)
+    {
+        unlink(dest);
+        return false;
+    }
+
+    if (frame_remaining != 0)
+    {
+        /* The server ended the stream before completing the frame. */
+        Log(LOG_LEVEL_INFO, "Source '%s:%s' changed while copying",
+            conn->this_server, source);
+        unlink(dest);
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Copied remote file '%s:%s', %jd bytes after decompression",
+        conn->this_server, source, (intmax_t) n_wrote_total);
+    return true;
+}
+
+#endif  /* HAVE_LIBZSTD */
+
+/* A transfer that dies mid-way leaves its bytes in "<dest>.cfpartial" with a
+ * "<dest>.cfpartial.state" sidecar recording what they are, so the next
+ * attempt can resume with an "RGET" instead of starting over.  Only worth
+ * the stat+hash bookkeeping for files where a restart actually hurts. */
+#define CF_PARTIAL_SUFFIX ".cfpartial"
+#define CF_PARTIAL_STATE_SUFFIX ".cfpartial.state"
+#define CF_PARTIAL_MIN_SIZE (1024 * 1024)
+
+/* Received blocks are coalesced into disk writes of up to this size; see
+ * ReceiveGetStream(). */
+#define XFER_BUFFER_SIZE (16 * CF_BUFSIZE)
+
+/**
+ * Stash the partial download at #dest (first #got of #size bytes of remote
+ * #source) for a later resume.  The sidecar records source, sizes and the
+ * digest of the bytes we have, so the resume can refuse a stale or corrupt
+ * stash.  Best effort: on any failure the partial is simply deleted and the
+ * next attempt starts from zero, exactly as before.
+ */
+static void StashPartialTransfer(const char *dest, const char *source,
+                                 off_t size, off_t got)
+{
+    char partial[CF_BUFSIZE], state[CF_BUFSIZE];
+    int ret = snprintf(partial, sizeof(partial), "%s" CF_PARTIAL_SUFFIX, dest);
+    int ret2 = snprintf(state, sizeof(state), "%s" CF_PARTIAL_STATE_SUFFIX, dest);
+    if (ret < 0 || (size_t) ret >= sizeof(partial) ||
+        ret2 < 0 || (size_t) ret2 >= sizeof(state))
+    {
+        unlink(dest);
+        return;
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    HashFile(dest, digest, CF_DEFAULT_DIGEST, false);
+    char digest_str[CF_HOSTKEY_STRING_SIZE];
+    HashPrintSafe(digest_str, sizeof(digest_str), digest,
+                  CF_DEFAULT_DIGEST, true);
+
+    FILE *fp = safe_fopen(state, "w");
+    if (fp == NULL ||
+        fprintf(fp, "%s %jd %jd %s\n", digest_str,
+                (intmax_t) got, (intmax_t) size, source) < 0)
+    {
+        if (fp != NULL)
+        {
+            fclose(fp);
+        }
+        unlink(state);
+        unlink(dest);
+        return;
+    }
+    fclose(fp);
+
+    unlink(partial);
+    if (rename(dest, partial) != 0)
+    {
+        unlink(state);
+        unlink(dest);
+        return;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Stashed %jd of %jd bytes of '%s:%s' for a resumed transfer",
+        (intmax_t) got, (intmax_t) size, source, dest);
+}
+
+/**
+ * If a verifiable partial download of #source is stashed next to #dest,
+ * move it back into place and return the offset to resume from.  Returns 0
+ * (and cleans up the stash) when there is nothing usable: no stash, a stash
+ * for a different source or remote size (the file changed upstream), or
+ * bytes that no longer match their recorded digest.
+ */
+static off_t ResumePartialTransfer(const char *dest, const char *source,
+                                   off_t size)
+{
+    char partial[CF_BUFSIZE], state[CF_BUFSIZE];
+    int ret = snprintf(partial, sizeof(partial), "%s" CF_PARTIAL_SUFFIX, dest);
+    int ret2 = snprintf(state, sizeof(state), "%s" CF_PARTIAL_STATE_SUFFIX, dest);
+    if (ret < 0 || (size_t) ret >= sizeof(partial) ||
+        ret2 < 0 || (size_t) ret2 >= sizeof(state))
+    {
+        return 0;
+    }
+
+    FILE *fp = safe_fopen(state, "r");
+    if (fp == NULL)
+    {
+        unlink(partial);                   /* orphan data, if there is any */
+        return 0;
     }
 
-    int dd = safe_open_create_perms(dest, O_WRONLY | O_CREAT | O_TRUNC | O_EXCL | O_BINARY, mode);
+    char digest_str[CF_HOSTKEY_STRING_SIZE];
+    intmax_t got = -1, expected = -1;
+    char stashed_source[CF_BUFSIZE];
+    bool usable =
+        (fscanf(fp, "%127s %jd %jd %4095[^\n]",
+                digest_str, &got, &expected, stashed_source) == 4);
+    fclose(fp);
+
+    usable = usable &&
+        (got > 0 && got < size && expected == (intmax_t) size &&
+         strcmp(stashed_source, source) == 0);
+
+    struct stat sb;
+    usable = usable && (stat(partial, &sb) == 0 && sb.st_size == got);
+
+    if (usable)
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE + 1];
+        HashFile(partial, digest, CF_DEFAULT_DIGEST, false);
+        char check_str[CF_HOSTKEY_STRING_SIZE];
+        HashPrintSafe(check_str, sizeof(check_str), digest,
+                      CF_DEFAULT_DIGEST, true);
+        usable = (strcmp(check_str, digest_str) == 0);
+        if (!usable)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Stashed partial of '%s' does not match its digest, discarding",
+                source);
+        }
+    }
+
+    unlink(state);
+    if (!usable)
+    {
+        unlink(partial);
+        return 0;
+    }
+
+    unlink(dest);                                  /* To avoid link attacks */
+    if (rename(partial, dest) != 0)
+    {
+        unlink(partial);
+        return 0;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Resuming transfer of '%s' at offset %jd of %jd bytes",
+        source, got, (intmax_t) size);
+    return (off_t) got;
+}
+
+/**
+ * Receive the block stream a granted "GET"-style request returns and write
+ * it to #dest (created with #mode).  Exactly #size bytes are expected, in
+ * blocks of up to #buf_size bytes; shared by CopyRegularFileNet() and the
+ * conditional MD5GET fetch.
+ *
+ * With #start_offset > 0 the reply to an "RGET" is appended to the existing
+ * #dest, which must already hold the first #start_offset bytes.  A network
+ * failure mid-transfer stashes the bytes received so far for a later resume
+ * (large files only).  #refused, when non-NULL, is set if the server
+ * answered the request with a refusal instead of data, so the caller can
+ * fall back rather than treat it as a transfer error.
+ */
+static bool ReceiveGetStream(const char *source, const char *dest,
+                             off_t size, int buf_size, mode_t mode,
+                             AgentConnection *conn, off_t start_offset,
+                             bool *refused)
+{
+    char *buf;
+    const char cfchangedstr[] = CF_CHANGEDSTR1 CF_CHANGEDSTR2;
+
+    if (refused != NULL)
+    {
+        *refused = false;
+    }
+
+    int dd;
+    if (start_offset > 0)
+    {
+        dd = safe_open(dest, O_WRONLY | O_BINARY);
+        if (dd != -1 && lseek(dd, start_offset, SEEK_SET) != start_offset)
+        {
+            close(dd);
+            dd = -1;
+        }
+    }
+    else
+    {
+        dd = safe_open_create_perms(dest, O_WRONLY | O_CREAT | O_TRUNC | O_EXCL | O_BINARY, mode);
+    }
     if (dd == -1)
     {
         Log(LOG_LEVEL_ERR,
@@ -807,19 +1632,50 @@ bool CopyRegularFileNet(const char *source, const char *basis, const char *dest,
         return false;
     }
 
-    buf = xmalloc(CF_BUFSIZE + sizeof(int));    /* Note CF_BUFSIZE not buf_size !! */
+    /* Blocks arrive in chunks of at most #buf_size (the wire format caps
+     * transactions at CF_BUFSIZE), but are flushed to disk in segments of
+     * up to XFER_BUFFER_SIZE, cutting the number of write() calls per
+     * file.  The buffer lives on the connection and is reused by every
+     * transfer the connection carries.  Sparse-hole detection operates on
+     * the larger segments, which merely makes hole punching coarser. */
+    if (conn->xfer_buffer == NULL)
+    {
+        conn->xfer_buffer = xmalloc(XFER_BUFFER_SIZE);
+    }
+    buf = conn->xfer_buffer;
+    size_t fill = 0;
 
     Log(LOG_LEVEL_VERBOSE, "Copying remote file '%s:%s', expecting %jd bytes",
-          conn->this_server, source, (intmax_t)size);
+          conn->this_server, source, (intmax_t) (size - start_offset));
 
-    int n_wrote_total = 0;
+    off_t n_recv_total = start_offset;       /* received from the network */
+    off_t n_wrote_total = start_offset;      /* flushed to disk */
     bool last_write_made_hole = false;
-    while (n_wrote_total < size)
+    while (n_recv_total < size)
     {
-        int toget = MIN(size - n_wrote_total, buf_size);
+        if ((size_t) (XFER_BUFFER_SIZE - fill) < (size_t) buf_size)
+        {
+            if (!FileSparseWrite(dd, buf, fill, &last_write_made_hole))
+            {
+                Log(LOG_LEVEL_ERR,
+                    "Local disk write failed copying '%s:%s' to '%s'",
+                    conn->this_server, source, dest);
+                unlink(dest);
+                close(dd);
+                FlushFileStream(conn->conn_info->sd, size - n_recv_total);
+                conn->error = true;
+                return false;
+            }
+            n_wrote_total += fill;
+            fill = 0;
+        }
+
+        int toget = MIN(size - n_recv_total, buf_size);
 
         assert(toget > 0);
 
+        char *const block = buf + fill;
+
         /* Stage C1 - receive */
         int n_read;
 
@@ -827,15 +1683,15 @@ bool CopyRegularFileNet(const char *source, const char *basis, const char *dest,
 
         if (ProtocolIsClassic(version))
         {
-            n_read = RecvSocketStream(conn->conn_info->sd, buf, toget);
+            n_read = RecvSocketStream(conn->conn_info->sd, block, toget);
         }
         else if (ProtocolIsTLS(version))
         {
-            n_read = TLSRecv(conn->conn_info->ssl, buf, toget);
+            n_read = TLSRecv(conn->conn_info->ssl, block, toget);
         }
         else
         {
-            UnexpectedError("CopyRegularFileNet: ProtocolVersion %d!",
+            UnexpectedError("ReceiveGetStream: ProtocolVersion %d!",
                             conn->conn_info->protocol);
             n_read = -1;
         }
@@ -851,62 +1707,90 @@ bool CopyRegularFileNet(const char *source, const char *basis, const char *dest,
                 "Error in client-server stream, has %s:%s shrunk? (code %d)",
                 conn->this_server, source, n_read);
 
-            close(dd);
-            free(buf);
+            /* Flush the coalesced tail so a resume stash covers it. */
+            if (fill > 0 && FileSparseWrite(dd, buf, fill,
+                                            &last_write_made_hole))
+            {
+                n_wrote_total += fill;
+            }
+
+            /* Keep what we got if it is worth resuming later. */
+            const bool stash =
+                (n_wrote_total > start_offset &&
+                 size >= CF_PARTIAL_MIN_SIZE &&
+                 !conn->rget_unsupported && ProtocolIsTLS(version));
+            if (stash)
+            {
+                if (FileSparseClose(dd, dest, false,
+                                    n_wrote_total, last_write_made_hole))
+                {
+                    StashPartialTransfer(dest, source, size, n_wrote_total);
+                }
+            }
+            else
+            {
+                close(dd);
+            }
             return false;
         }
 
         /* If the first thing we get is an error message, break. */
 
-        if (n_wrote_total == 0
-            && strncmp(buf, CF_FAILEDSTR, strlen(CF_FAILEDSTR)) == 0)
+        if (n_recv_total == start_offset
+            && strncmp(block, CF_FAILEDSTR, strlen(CF_FAILEDSTR)) == 0)
         {
             Log(LOG_LEVEL_INFO, "Network access to '%s:%s' denied",
                 conn->this_server, source);
+            if (refused != NULL)
+            {
+                *refused = true;
+            }
             close(dd);
-            free(buf);
             return false;
         }
 
-        if (strncmp(buf, cfchangedstr, strlen(cfchangedstr)) == 0)
+        if (strncmp(block, cfchangedstr, strlen(cfchangedstr)) == 0)
         {
             Log(LOG_LEVEL_INFO, "Source '%s:%s' changed while copying",
                 conn->this_server, source);
             close(dd);
-            free(buf);
             return false;
         }
 
         /* Check for mismatch between encryption here and on server. */
 
         int value = -1;
-        sscanf(buf, "t %d", &value);
+        sscanf(block, "t %d", &value);
 
-        if ((value > 0) && (strncmp(buf + CF_INBAND_OFFSET, "BAD: ", 5) == 0))
+        if ((value > 0) && (strncmp(block + CF_INBAND_OFFSET, "BAD: ", 5) == 0))
         {
             Log(LOG_LEVEL_INFO, "Network access to cleartext '%s:%s' denied",
                 conn->this_server, source);
+            if (refused != NULL && n_recv_total == start_offset)
+            {
+                *refused = true;
+            }
             close(dd);
-            free(buf);
             return false;
         }
 
-        bool w_ok = FileSparseWrite(dd, buf, n_read,
-                                    &last_write_made_hole);
-        if (!w_ok)
+        fill += n_read;
+        n_recv_total += n_read;
+    }
+
+    if (fill > 0)
+    {
+        if (!FileSparseWrite(dd, buf, fill, &last_write_made_hole))
         {
             Log(LOG_LEVEL_ERR,
                 "Local disk write failed copying '%s:%s' to '%s'",
                 conn->this_server, source, dest);
-            free(buf);
             unlink(dest);
             close(dd);
-            FlushFileStream(conn->conn_info->sd, size - n_wrote_total - n_read);
             conn->error = true;
             return false;
         }
-
-        n_wrote_total += n_read;
+        n_wrote_total += fill;
     }
 
     const bool do_sync = false;
@@ -916,11 +1800,157 @@ bool CopyRegularFileNet(const char *source, const char *basis, const char *dest,
     if (!ret)
     {
         unlink(dest);
-        free(buf);
-        FlushFileStream(conn->conn_info->sd, size - n_wrote_total);
+        FlushFileStream(conn->conn_info->sd, size - n_recv_total);
         return false;
     }
 
-    free(buf);
     return true;
 }
+
+bool CopyRegularFileNet(const char *source, const char *basis, const char *dest, off_t size,
+                        bool encrypt, AgentConnection *conn, mode_t mode)
+{
+    assert(conn != NULL);
+
+    char workbuf[CF_BUFSIZE];
+
+    /* Request the largest transfer block the protocol allows (the server
+     * refuses buf_size >= CF_BUFSIZE). Servers that predate the negotiation
+     * ignore the hint and keep streaming 2048-byte blocks, which is
+     * indistinguishable on the byte stream we read below. */
+    const int buf_size = CF_BUFSIZE - 1;
+
+    /* We encrypt only for CLASSIC protocol. The TLS protocol is always over
+     * encrypted layer, so it does not support encrypted (S*) commands. */
+    encrypt = encrypt && conn->conn_info->protocol == CF_PROTOCOL_CLASSIC;
+
+    if (encrypt)
+    {
+        return EncryptCopyRegularFileNet(source, dest, size, conn);
+    }
+
+    /* A preceding hash comparison may have fetched the file already (one
+     * MD5GET exchange); if so, just move the spool into place. */
+    if (conn->prefetched_file != NULL)
+    {
+        char *spool = conn->prefetched_file;
+        char *spool_source = conn->prefetched_source;
+        conn->prefetched_file = NULL;
+        conn->prefetched_source = NULL;
+
+        if (strcmp(spool_source, source) == 0)
+        {
+            unlink(dest);                        /* To avoid link attacks */
+            if (rename(spool, dest) == 0)
+            {
+                chmod(dest, mode);
+                Log(LOG_LEVEL_VERBOSE,
+                    "Used copy of '%s:%s' already fetched by MD5GET",
+                    conn->this_server, source);
+                free(spool);
+                free(spool_source);
+                return true;
+            }
+            Log(LOG_LEVEL_VERBOSE,
+                "Failed to move prefetched copy of '%s:%s' into place, "
+                "fetching again (rename: %s)",
+                conn->this_server, source, GetErrorStr());
+        }
+
+        unlink(spool);
+        free(spool);
+        free(spool_source);
+    }
+
+    if ((strlen(dest) > CF_BUFSIZE - 20))
+    {
+        Log(LOG_LEVEL_ERR, "Filename too long");
+        return false;
+    }
+
+    /* A previous attempt at this file may have stashed a verified partial
+     * download next to the destination; if so, ask the server for the rest
+     * with an "RGET <buf_size> <offset> <file>" instead of starting over.
+     * The stream that follows is identical to GET's.  Servers that predate
+     * RGET refuse it, which costs one round trip once per connection. */
+    if (!conn->rget_unsupported &&
+        ProtocolIsTLS(conn->conn_info->protocol) &&
+        !ProtocolSupportsFileStream(conn->conn_info->protocol))
+    {
+        const off_t resume_offset = ResumePartialTransfer(dest, source, size);
+        if (resume_offset > 0)
+        {
+            int tosend = snprintf(workbuf, CF_BUFSIZE, "RGET %d %jd %s",
+                                  buf_size, (intmax_t) resume_offset, source);
+            if (tosend > 0 && tosend < CF_BUFSIZE &&
+                SendTransaction(conn->conn_info, workbuf, tosend, CF_DONE) != -1)
+            {
+                bool refused = false;
+                if (ReceiveGetStream(source, dest, size, buf_size, mode,
+                                     conn, resume_offset, &refused))
+                {
+                    return true;
+                }
+                if (!refused)
+                {
+                    return false;
+                }
+                conn->rget_unsupported = true;
+                Log(LOG_LEVEL_VERBOSE,
+                    "Server does not support RGET, restarting transfer");
+            }
+            unlink(dest);
+        }
+    }
+
+#ifdef HAVE_LIBZSTD
+    /* Compressed transfer cannot follow GET's block-lockstep framing and
+     * is superseded by the file stream protocol, so only try it on the TLS
+     * protocol versions in between. */
+    if (ProtocolIsTLS(conn->conn_info->protocol) &&
+        !ProtocolSupportsFileStream(conn->conn_info->protocol) &&
+        !conn->cget_unsupported &&
+        FileIsCompressible(source))
+    {
+        bool unsupported = false;
+        if (CompressedCopyRegularFileNet(source, dest, conn, mode,
+                                         &unsupported))
+        {
+            return true;
+        }
+        if (!unsupported)
+        {
+            return false;
+        }
+        conn->cget_unsupported = true;
+        Log(LOG_LEVEL_VERBOSE,
+            "Server does not support CGET, falling back to GET");
+    }
+#endif
+
+    unlink(dest);                /* To avoid link attacks */
+
+    workbuf[0] = '\0';
+    int tosend = snprintf(workbuf, CF_BUFSIZE, "GET %d %s", buf_size, source);
+    if (tosend <= 0 || tosend >= CF_BUFSIZE)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to compose GET command for file %s",
+            source);
+        return false;
+    }
+
+    /* Send proposition C0 */
+
+    if (SendTransaction(conn->conn_info, workbuf, tosend, CF_DONE) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't send GET command");
+        return false;
+    }
+
+    const ProtocolVersion version = ConnectionInfoProtocolVersion(conn->conn_info);
+    if (ProtocolSupportsFileStream(version)) {
+        return FileStreamFetch(conn->conn_info->ssl, basis, dest, mode, false);
+    }
+
+    return ReceiveGetStream(source, dest, size, buf_size, mode, conn, 0, NULL);
+}
@@ -46,7 +46,16 @@ AgentConnection *ServerConnection(const char *server, const char *port, const Rl
                                   ConnectionFlags flags, int *err);
 void DisconnectServer(AgentConnection *conn);
 
+/**
+  @return true if the circuit breaker for #server is open, i.e.
+          ServerConnection() is currently failing fast without touching the
+          network after repeated failures to reach the server.
+  */
+bool ServerBreakerIsOpen(const char *server);
+
 bool CompareHashNet(const char *file1, const char *file2, bool encrypt, AgentConnection *conn);
+bool CompareHashAndFetchNet(const char *file1, const char *file2, off_t size,
+                            bool encrypt, AgentConnection *conn);
 bool CopyRegularFileNet(const char *source, const char *basis, const char *dest, off_t size,
                         bool encrypt, AgentConnection *conn, mode_t mode);
 Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn);
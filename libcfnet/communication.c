@@ -60,6 +60,14 @@ void DeleteAgentConn(AgentConnection *conn)
     }
 
     ConnectionInfoDestroy(&conn->conn_info);
+    if (conn->prefetched_file != NULL)
+    {
+        /* Spooled by MD5GET but never consumed by a copy. */
+        unlink(conn->prefetched_file);
+    }
+    free(conn->prefetched_file);
+    free(conn->prefetched_source);
+    free(conn->xfer_buffer);
     free(conn->this_server);
     free(conn->this_port);
     free(conn->session_key);
@@ -130,9 +130,15 @@ AgentConnection *ConnCache_FindIdleMarkBusy(const char *server,
         }
         else if (svp->status == CONNCACHE_STATUS_BROKEN)
         {
+            /* A broken connection can never be handed out again, but it
+             * still holds a socket and a TLS session, and every later
+             * lookup has to walk past it. Harvest it now. */
             Log(LOG_LEVEL_DEBUG,
-                "FindIdle: connection %p is marked as broken.",
+                "FindIdle: pruning broken connection %p.",
                 svp->conn);
+            DisconnectServer(svp->conn);
+            SeqRemove(conn_cache, i);
+            i--;
         }
         else if (ConnCacheEntryMatchesConnection(svp, server, port, flags))
         {
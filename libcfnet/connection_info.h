@@ -63,6 +63,9 @@ struct ConnectionInfo {
     socklen_t ss_len;
     struct sockaddr_storage ss;
     bool is_call_collect;       /* Maybe replace with a bitfield later ... */
+    /* Seconds the server asked us to wait before reconnecting when it
+     * refused us for being over capacity; 0 when no hint was given. */
+    unsigned int retry_after_hint;
 };
 
 typedef struct ConnectionInfo ConnectionInfo;
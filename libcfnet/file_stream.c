@@ -38,6 +38,14 @@
 /* Common                                                */
 /*********************************************************/
 
+/**
+ * Size of the buffers facing the local disk.  The network-facing buffers
+ * must stay at message granularity (see stream_protocol.h), but reads from
+ * and writes to files have no such constraint, and draining multi-GB patch
+ * output in 4 KB chunks costs a write(2) per chunk.
+ */
+#define FILE_STREAM_FILE_BUFFER_SIZE (16 * PROTOCOL_MESSAGE_SIZE)
+
 /**
  * @brief Move leftover tail data in the input buffer to the front before next
  *        job iteration.
@@ -111,11 +119,12 @@ static bool FillInputBufferFromHost(
  *
  * @param bufs RS buffers
  * @param in_buf Input buffer
+ * @param buf_size Capacity of the input buffer
  * @param file The file
  * @return false in case of failure
  */
 static bool FillInputBufferFromFile(
-    rs_buffers_t *bufs, char *in_buf, FILE *file)
+    rs_buffers_t *bufs, char *in_buf, size_t buf_size, FILE *file)
 {
     assert(bufs != NULL);
     assert(in_buf != NULL);
@@ -129,8 +138,8 @@ static bool FillInputBufferFromFile(
         return true;
     }
 
-    assert(bufs->avail_in <= PROTOCOL_MESSAGE_SIZE);
-    const size_t remaining = PROTOCOL_MESSAGE_SIZE - bufs->avail_in;
+    assert(bufs->avail_in <= buf_size);
+    const size_t remaining = buf_size - bufs->avail_in;
     if (remaining == 0)
     {
         /* There is no more space in buffer */
@@ -190,13 +199,15 @@ static bool DrainOutputBufferToHost(
  *
  * @param bufs RS buffers
  * @param out_buf The output buffer
+ * @param buf_size Capacity of the output buffer
  * @param fd The file descriptor
  * @param last_write_made_hole Output parameter to tell whether last write
  *                             made a hole in the sparse file
  * @return false in case of failure
  */
 static bool DrainOutputBufferToFile(
-    rs_buffers_t *bufs, char *out_buf, int fd, bool *last_write_made_hole)
+    rs_buffers_t *bufs, char *out_buf, size_t buf_size, int fd,
+    bool *last_write_made_hole)
 {
     assert(bufs != NULL);
     assert(out_buf != NULL);
@@ -204,7 +215,7 @@ static bool DrainOutputBufferToFile(
 
     /* Drain output buffer, if there is data */
     size_t num_bytes = bufs->next_out - out_buf;
-    assert(num_bytes <= PROTOCOL_MESSAGE_SIZE);
+    assert(num_bytes <= buf_size);
     if (num_bytes == 0)
     {
         /* There is nothing to write */
@@ -218,7 +229,7 @@ static bool DrainOutputBufferToFile(
     }
 
     bufs->next_out = out_buf;
-    bufs->avail_out = PROTOCOL_MESSAGE_SIZE;
+    bufs->avail_out = buf_size;
     return true;
 }
 
@@ -307,9 +318,9 @@ static bool SendDelta(SSL *conn, rs_signature_t *sig, const char *filename)
     assert(sig != NULL);
     assert(filename != NULL);
 
-    /* In this case, the input buffer does not need to be twice the message
-     * size, because we can control how much we read into it */
-    char in_buf[PROTOCOL_MESSAGE_SIZE], out_buf[PROTOCOL_MESSAGE_SIZE];
+    /* The input buffer faces the source file, so it is not bound to the
+     * message size and can batch larger reads */
+    char in_buf[FILE_STREAM_FILE_BUFFER_SIZE], out_buf[PROTOCOL_MESSAGE_SIZE];
 
     /* Open source file */
     FILE *file = safe_fopen(filename, "rb");
@@ -352,7 +363,7 @@ static bool SendDelta(SSL *conn, rs_signature_t *sig, const char *filename)
 
     do
     {
-        if (!FillInputBufferFromFile(&bufs, in_buf, file))
+        if (!FillInputBufferFromFile(&bufs, in_buf, sizeof(in_buf), file))
         {
             Log(LOG_LEVEL_ERR,
                 "Failed to read the source file '%s' during file stream: %s",
@@ -476,9 +487,9 @@ static bool SendSignature(SSL *conn, const char *filename, bool print_stats)
     size_t bytes_in = 0;
     size_t bytes_out = 0;
 
-    /* In this case, the input buffer does not need to be twice the message
-     * size, because we can control how much we read into it */
-    char in_buf[PROTOCOL_MESSAGE_SIZE], out_buf[PROTOCOL_MESSAGE_SIZE];
+    /* The input buffer faces the basis file, so it is not bound to the
+     * message size and can batch larger reads */
+    char in_buf[FILE_STREAM_FILE_BUFFER_SIZE], out_buf[PROTOCOL_MESSAGE_SIZE];
 
     /* Open basis file */
     FILE *file = safe_fopen(filename, "rb");
@@ -528,7 +539,7 @@ static bool SendSignature(SSL *conn, const char *filename, bool print_stats)
 
     do
     {
-        if (!FillInputBufferFromFile(&bufs, in_buf, file))
+        if (!FillInputBufferFromFile(&bufs, in_buf, sizeof(in_buf), file))
         {
             Log(LOG_LEVEL_ERR,
                 "Failed to read the basis file '%s' during file stream: %s",
@@ -611,8 +622,11 @@ static bool RecvDelta(
     size_t bytes_out = 0;
 
     /* The input buffer has to be twice the message size, so that it can fit a
-     * new message, as well as some tail data from the last job iteration */
-    char in_buf[PROTOCOL_MESSAGE_SIZE * 2], out_buf[PROTOCOL_MESSAGE_SIZE];
+     * new message, as well as some tail data from the last job iteration.
+     * The output buffer faces the destination file, so it is not bound to the
+     * message size: a large buffer lets blocks copied from the basis file be
+     * written out in bigger batches */
+    char in_buf[PROTOCOL_MESSAGE_SIZE * 2], out_buf[FILE_STREAM_FILE_BUFFER_SIZE];
 
     /* Open/create the destination file */
     unlink(dest);
@@ -663,7 +677,7 @@ static bool RecvDelta(
     rs_buffers_t bufs = {0};
     bufs.next_in = in_buf;
     bufs.next_out = out_buf;
-    bufs.avail_out = PROTOCOL_MESSAGE_SIZE;
+    bufs.avail_out = sizeof(out_buf);
 
     /* Sparse file specific */
     bool last_write_made_hole = false;
@@ -707,7 +721,7 @@ static bool RecvDelta(
 
         /* Drain output buffer, if there is data */
         if (!DrainOutputBufferToFile(
-                &bufs, out_buf, new_fd, &last_write_made_hole))
+                &bufs, out_buf, sizeof(out_buf), new_fd, &last_write_made_hole))
         {
             /* Error is already logged */
             close(new_fd);
@@ -32,6 +32,7 @@
 #include <misc_lib.h>
 #include <cf3.defs.h>
 #include <protocol.h>
+#include <protocol_trace.h>
 
 
 /* TODO remove libpromises dependency. */
@@ -127,12 +128,51 @@ int SendTransaction(ConnectionInfo *conn_info,
         /* SSL_MODE_AUTO_RETRY guarantees no partial writes. */
         assert(ret == len + CF_INBAND_OFFSET);
 
+        ProtocolTraceAppend('S', status, conn_info->sd, buffer, len);
         return 0;
     }
 }
 
 /*************************************************************************/
 
+static void SetSocketCork(int sd, bool enable)
+{
+#if defined(TCP_CORK)
+    int state = enable ? 1 : 0;
+    if (setsockopt(sd, IPPROTO_TCP, TCP_CORK, &state, sizeof(state)) == -1)
+    {
+        /* Non-TCP socket or platform quirk; purely an optimization, so only
+         * worth a debug line. */
+        Log(LOG_LEVEL_DEBUG, "Failed to %s TCP_CORK (setsockopt: %s)",
+            enable ? "set" : "clear", GetErrorStr());
+    }
+#elif defined(TCP_NOPUSH) && !defined(__APPLE__)
+    /* BSD equivalent.  Excluded on macOS, where clearing TCP_NOPUSH does not
+     * reliably flush already buffered data. */
+    int state = enable ? 1 : 0;
+    if (setsockopt(sd, IPPROTO_TCP, TCP_NOPUSH, &state, sizeof(state)) == -1)
+    {
+        Log(LOG_LEVEL_DEBUG, "Failed to %s TCP_NOPUSH (setsockopt: %s)",
+            enable ? "set" : "clear", GetErrorStr());
+    }
+#else
+    (void) sd;
+    (void) enable;
+#endif
+}
+
+void SendTransactionCork(ConnectionInfo *conn_info)
+{
+    SetSocketCork(conn_info->sd, true);
+}
+
+void SendTransactionUncork(ConnectionInfo *conn_info)
+{
+    SetSocketCork(conn_info->sd, false);
+}
+
+/*************************************************************************/
+
 /**
  *  Receive a transaction packet of at most CF_BUFSIZE-1 bytes, and
  *  NULL-terminate it.
@@ -280,6 +320,8 @@ int ReceiveTransaction(ConnectionInfo *conn_info, char *buffer, int *more)
 
     LogRaw(LOG_LEVEL_DEBUG, "ReceiveTransaction data: ", buffer, ret);
 
+    ProtocolTraceAppend('R', status, conn_info->sd, buffer, ret);
+
     return ret;
 }
 
@@ -410,43 +452,262 @@ void EnforceBwLimit(int tosend)
                    textual representation
    @return Connected socket descriptor or -1 in case of failure.
 */
+/* Short-lived resolution cache for SocketConnect().  getaddrinfo() does not
+ * expose DNS TTLs, so positive results expire early after a fixed interval;
+ * an expired entry is kept around and still used when the resolver itself
+ * fails, so a DNS blip does not take down connections to a host we reached
+ * moments ago.  Failed resolutions are cached briefly too, to damp resolver
+ * hammering when a host name is genuinely bogus.  All entries are guarded
+ * by addr_cache_lock. */
+
+#define ADDR_CACHE_TTL 60                                        /* seconds */
+#define ADDR_CACHE_NEGATIVE_TTL 5                                /* seconds */
+#define ADDR_CACHE_MAX_ADDRS 8
+#define ADDR_CACHE_SIZE 16
+
+typedef struct
+{
+    char host[256];                       /* RFC 1035 name length limit */
+    char port[32];
+    bool force_ipv4;
+    time_t resolved;                      /* 0 marks an unused slot */
+    bool negative;                        /* resolution failed */
+    size_t count;
+    size_t preferred;                     /* address that connected last */
+    struct sockaddr_storage addr[ADDR_CACHE_MAX_ADDRS];
+    socklen_t addrlen[ADDR_CACHE_MAX_ADDRS];
+} AddrCacheEntry;
+
+typedef enum
+{
+    ADDR_CACHE_MISS,
+    ADDR_CACHE_HIT,
+    ADDR_CACHE_HIT_NEGATIVE
+} AddrCacheResult;
+
+static AddrCacheEntry ADDR_CACHE[ADDR_CACHE_SIZE]; /* GLOBAL_T */
+static pthread_mutex_t addr_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called with addr_cache_lock held. */
+static AddrCacheEntry *AddrCacheFind(const char *host, const char *port,
+                                     bool force_ipv4)
+{
+    for (size_t i = 0; i < ADDR_CACHE_SIZE; i++)
+    {
+        AddrCacheEntry *entry = &ADDR_CACHE[i];
+        if (entry->resolved != 0 &&
+            entry->force_ipv4 == force_ipv4 &&
+            strcmp(entry->host, host) == 0 &&
+            strcmp(entry->port, port) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void AddrListCopy(AddrCacheEntry *entry,
+                         const struct addrinfo *response)
+{
+    entry->count = 0;
+    entry->preferred = 0;
+    for (const struct addrinfo *ap = response;
+         ap != NULL && entry->count < ADDR_CACHE_MAX_ADDRS;
+         ap = ap->ai_next)
+    {
+        if (ap->ai_addrlen > sizeof(entry->addr[0]))
+        {
+            continue;
+        }
+        memcpy(&entry->addr[entry->count], ap->ai_addr, ap->ai_addrlen);
+        entry->addrlen[entry->count] = ap->ai_addrlen;
+        entry->count++;
+    }
+}
+
+/**
+ * @param allow_stale  Accept a positive entry past its TTL -- used as
+ *                     fallback when re-resolution fails.
+ */
+static AddrCacheResult AddrCacheLookup(const char *host, const char *port,
+                                       bool force_ipv4, bool allow_stale,
+                                       AddrCacheEntry *out)
+{
+    AddrCacheResult result = ADDR_CACHE_MISS;
+    const time_t now = time(NULL);
+
+    pthread_mutex_lock(&addr_cache_lock);
+
+    const AddrCacheEntry *entry = AddrCacheFind(host, port, force_ipv4);
+    if (entry != NULL)
+    {
+        if (entry->negative)
+        {
+            if (now - entry->resolved <= ADDR_CACHE_NEGATIVE_TTL)
+            {
+                result = ADDR_CACHE_HIT_NEGATIVE;
+            }
+        }
+        else if (entry->count > 0 &&
+                 (allow_stale || now - entry->resolved <= ADDR_CACHE_TTL))
+        {
+            *out = *entry;
+            result = ADDR_CACHE_HIT;
+        }
+    }
+
+    pthread_mutex_unlock(&addr_cache_lock);
+    return result;
+}
+
+/**
+ * Cache the outcome of a resolution; #response == NULL records a failure.
+ */
+static void AddrCacheStore(const char *host, const char *port,
+                           bool force_ipv4, const struct addrinfo *response)
+{
+    if (strlen(host) >= sizeof(ADDR_CACHE[0].host) ||
+        strlen(port) >= sizeof(ADDR_CACHE[0].port))
+    {
+        return;                                       /* not cacheable */
+    }
+
+    pthread_mutex_lock(&addr_cache_lock);
+
+    AddrCacheEntry *entry = AddrCacheFind(host, port, force_ipv4);
+    if (entry == NULL)
+    {
+        /* Take the oldest slot (covers unused ones, resolved == 0). */
+        entry = &ADDR_CACHE[0];
+        for (size_t i = 1; i < ADDR_CACHE_SIZE; i++)
+        {
+            if (ADDR_CACHE[i].resolved < entry->resolved)
+            {
+                entry = &ADDR_CACHE[i];
+            }
+        }
+        strcpy(entry->host, host);
+        strcpy(entry->port, port);
+        entry->force_ipv4 = force_ipv4;
+    }
+
+    entry->resolved = time(NULL);
+    entry->negative = (response == NULL);
+    if (response != NULL)
+    {
+        AddrListCopy(entry, response);
+    }
+    else
+    {
+        entry->count = 0;
+        entry->preferred = 0;
+    }
+
+    pthread_mutex_unlock(&addr_cache_lock);
+}
+
+static void AddrCacheMarkPreferred(const char *host, const char *port,
+                                   bool force_ipv4, size_t index)
+{
+    pthread_mutex_lock(&addr_cache_lock);
+
+    AddrCacheEntry *entry = AddrCacheFind(host, port, force_ipv4);
+    if (entry != NULL && !entry->negative && index < entry->count)
+    {
+        entry->preferred = index;
+    }
+
+    pthread_mutex_unlock(&addr_cache_lock);
+}
+
 int SocketConnect(const char *host, const char *port,
                   unsigned int connect_timeout, bool force_ipv4,
                   char *txtaddr, size_t txtaddr_size)
 {
-    struct addrinfo *response = NULL, *ap;
     bool connected = false;
     int sd = -1;
 
-    struct addrinfo query = {
-        .ai_family = force_ipv4 ? AF_INET : AF_UNSPEC,
-        .ai_socktype = SOCK_STREAM
-    };
+    AddrCacheEntry cached;
+    AddrCacheResult cres = AddrCacheLookup(host, port, force_ipv4,
+                                           false, &cached);
 
-    int ret = getaddrinfo(host, port, &query, &response);
-    if (ret != 0)
+    if (cres == ADDR_CACHE_HIT_NEGATIVE)
     {
         Log(LOG_LEVEL_INFO,
-              "Unable to find host '%s' service '%s' (%s)",
-              host, port, gai_strerror(ret));
-        if (response != NULL)
+            "Unable to find host '%s' service '%s'"
+            " (cached resolution failure)",
+            host, port);
+        return -1;
+    }
+
+    if (cres == ADDR_CACHE_MISS)
+    {
+        struct addrinfo *response = NULL;
+        struct addrinfo query = {
+            .ai_family = force_ipv4 ? AF_INET : AF_UNSPEC,
+            .ai_socktype = SOCK_STREAM
+        };
+
+        int ret = getaddrinfo(host, port, &query, &response);
+        if (ret != 0)
         {
+            if (response != NULL)
+            {
+                freeaddrinfo(response);
+            }
+
+            /* Resolver failure: fall back to addresses past their TTL if
+             * we resolved this host before. */
+            if (AddrCacheLookup(host, port, force_ipv4, true, &cached)
+                == ADDR_CACHE_HIT)
+            {
+                Log(LOG_LEVEL_INFO,
+                    "Unable to resolve host '%s' (%s),"
+                    " using previously resolved addresses",
+                    host, gai_strerror(ret));
+            }
+            else
+            {
+                AddrCacheStore(host, port, force_ipv4, NULL);
+                Log(LOG_LEVEL_INFO,
+                    "Unable to find host '%s' service '%s' (%s)",
+                    host, port, gai_strerror(ret));
+                return -1;
+            }
+        }
+        else
+        {
+            AddrCacheStore(host, port, force_ipv4, response);
+            AddrListCopy(&cached, response);
             freeaddrinfo(response);
+            if (cached.count == 0)
+            {
+                Log(LOG_LEVEL_INFO,
+                    "Unable to find host '%s' service '%s'"
+                    " (no usable addresses)",
+                    host, port);
+                return -1;
+            }
         }
-        return -1;
     }
 
-    for (ap = response; !connected && ap != NULL; ap = ap->ai_next)
+    /* Try the address that connected last time first, then the others in
+     * resolver order. */
+    for (size_t i = 0; !connected && i < cached.count; i++)
     {
+        const size_t idx = (cached.preferred + i) % cached.count;
+        struct sockaddr *sa = (struct sockaddr *) &cached.addr[idx];
+        const socklen_t sa_len = cached.addrlen[idx];
+
         /* Convert address to string. */
-        getnameinfo(ap->ai_addr, ap->ai_addrlen,
+        getnameinfo(sa, sa_len,
                     txtaddr, txtaddr_size,
                     NULL, 0, NI_NUMERICHOST);
         Log(LOG_LEVEL_VERBOSE,
             "Connecting to host %s, port %s as address %s",
             host, port, txtaddr);
 
-        sd = socket(ap->ai_family, ap->ai_socktype, ap->ai_protocol);
+        sd = socket(sa->sa_family, SOCK_STREAM, 0);
         if (sd == -1)
         {
             Log(LOG_LEVEL_ERR, "Couldn't open a socket to '%s' (socket: %s)",
@@ -476,8 +737,6 @@ int SocketConnect(const char *host, const char *port,
                     {
                         freeaddrinfo(response2);
                     }
-                    assert(response);   /* first getaddrinfo was successful */
-                    freeaddrinfo(response);
                     cf_closesocket(sd);
                     return -1;
                 }
@@ -499,9 +758,12 @@ int SocketConnect(const char *host, const char *port,
                 freeaddrinfo(response2);
             }
 
-            connected = TryConnect(sd, connect_timeout * 1000,
-                                   ap->ai_addr, ap->ai_addrlen);
-            if (!connected)
+            connected = TryConnect(sd, connect_timeout * 1000, sa, sa_len);
+            if (connected)
+            {
+                AddrCacheMarkPreferred(host, port, force_ipv4, idx);
+            }
+            else
             {
                 Log(LOG_LEVEL_VERBOSE, "Unable to connect to address %s (%s)",
                     txtaddr, GetErrorStr());
@@ -511,11 +773,21 @@ int SocketConnect(const char *host, const char *port,
         }
     }
 
-    assert(response != NULL);           /* first getaddrinfo was successful */
-    freeaddrinfo(response);
-
     if (connected)
     {
+        /* The protocol runs many small request/response transactions over
+         * this one socket; Nagle's algorithm would hold each small request
+         * back waiting for the ACK of the previous one. cf-serverd already
+         * disables it on its side (see DisableSendDelays()). */
+        int yes = 1;
+        if (setsockopt(sd, IPPROTO_TCP, TCP_NODELAY,
+                       (void *) &yes, sizeof(yes)) == -1)
+        {
+            Log(LOG_LEVEL_INFO,
+                "Unable to disable Nagle algorithm, expect performance"
+                " problems. (setsockopt(TCP_NODELAY): %s)", GetErrorStr());
+        }
+
         Log(LOG_LEVEL_VERBOSE,
             "Connected to host %s address %s port %s (socket descriptor %d)",
             host, txtaddr, port, sd);
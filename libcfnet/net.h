@@ -37,6 +37,18 @@ extern uint32_t bwlimit_kbytes;
 int SendTransaction(ConnectionInfo *conn_info, const char *buffer, int len, char status);
 int ReceiveTransaction(ConnectionInfo *conn_info, char *buffer, int *more);
 
+/**
+ * Cork/uncork the TCP stream under #conn_info around a burst of
+ * SendTransaction() calls.  Server sockets run with TCP_NODELAY, so every
+ * small transaction otherwise leaves as its own packet; corking lets the
+ * kernel pack a burst (directory listings, chunked file sends) into
+ * full-size segments, and uncorking flushes the remainder immediately.
+ * No-op on platforms without TCP_CORK/TCP_NOPUSH and on non-TCP sockets:
+ * purely an optimization, never affects correctness.
+ */
+void SendTransactionCork(ConnectionInfo *conn_info);
+void SendTransactionUncork(ConnectionInfo *conn_info);
+
 int SetReceiveTimeout(int fd, unsigned long ms);
 
 int SocketConnect(const char *host, const char *port,
@@ -27,6 +27,7 @@
 #include <client_code.h>
 #include <client_protocol.h>
 #include <definitions.h>
+#include <files_lib.h>                      /* FullWrite,safe_open_create_perms */
 #include <net.h>
 #include <stat_cache.h>
 #include <string_lib.h>
@@ -331,3 +332,232 @@ bool ProtocolStat(AgentConnection *const conn, const char *const remote_path,
 
     return true;
 }
+
+bool ProtocolTreeDigest(AgentConnection *const conn,
+                        const char *const remote_path,
+                        char *const digest_out, const size_t digest_size)
+{
+    assert(conn != NULL);
+    assert(remote_path != NULL);
+    assert(digest_out != NULL);
+
+    char buf[CF_BUFSIZE] = {0};
+    int to_send = snprintf(buf, CF_BUFSIZE, "TREEDIGEST %s", remote_path);
+
+    int ret = SendTransaction(conn->conn_info, buf, to_send, CF_DONE);
+    if (ret == -1)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Could not send tree digest request for remote path %s:%s.",
+            conn->this_server, remote_path);
+        return false;
+    }
+
+    ret = ReceiveTransaction(conn->conn_info, buf, NULL);
+    if (ret == -1)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Receiving tree digest from %s failed!",
+            conn->this_server);
+        return false;
+    }
+
+    if (BadProtoReply(buf))
+    {
+        /* Old server, or access denied; the caller falls back to the full
+         * comparison, so this is not a failure worth warning about. */
+        Log(LOG_LEVEL_VERBOSE,
+            "Could not get tree digest for %s:%s, response: %s",
+            conn->this_server, remote_path, buf);
+        return false;
+    }
+
+    if (buf[0] == '\0')
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Empty tree digest response from server %s for %s",
+            conn->this_server, remote_path);
+        return false;
+    }
+
+    const size_t len = strlcpy(digest_out, buf, digest_size);
+    if (len >= digest_size)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Tree digest from server %s for %s is too long (%zu bytes)",
+            conn->this_server, remote_path, len);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * A bundle entry path must stay below the target directory: relative, and
+ * free of ".." components.
+ */
+static bool BundlePathIsSafe(const char *rel)
+{
+    if (rel[0] == '\0' || rel[0] == '/')
+    {
+        return false;
+    }
+
+    const char *component = rel;
+    while (component != NULL)
+    {
+        if (strncmp(component, "..", 2) == 0 &&
+            (component[2] == '/' || component[2] == '\0'))
+        {
+            return false;
+        }
+        component = strchr(component, '/');
+        if (component != NULL)
+        {
+            component++;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * mkdir -p for the directories leading up to the file at #path.
+ */
+static bool BundleMakeParentDirs(char *path)
+{
+    for (char *sep = strchr(path + 1, '/'); sep != NULL;
+         sep = strchr(sep + 1, '/'))
+    {
+        *sep = '\0';
+        int ret = mkdir(path, 0700);
+        *sep = '/';
+        if (ret != 0 && errno != EEXIST)
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Could not create directory for '%s' (mkdir: %s)",
+                path, GetErrorStr());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ProtocolPolicyBundleFetch(AgentConnection *const conn,
+                               const char *const remote_dir,
+                               const char *const local_dir)
+{
+    assert(conn != NULL);
+    assert(remote_dir != NULL);
+    assert(local_dir != NULL);
+
+    char buf[CF_BUFSIZE] = {0};
+    int to_send = snprintf(buf, CF_BUFSIZE, "POLICYBUNDLE %s", remote_dir);
+
+    int ret = SendTransaction(conn->conn_info, buf, to_send, CF_DONE);
+    if (ret == -1)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Could not send policy bundle request for remote path %s:%s.",
+            conn->this_server, remote_dir);
+        return false;
+    }
+
+    bool first = true;
+    for (;;)
+    {
+        ret = ReceiveTransaction(conn->conn_info, buf, NULL);
+        if (ret <= 0)
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Receiving policy bundle from %s failed!", conn->this_server);
+            return false;
+        }
+        buf[MIN(ret, CF_BUFSIZE - 1)] = '\0';
+
+        if (first && BadProtoReply(buf))
+        {
+            /* Old server, or access denied; the caller falls back to the
+             * regular policy update, so no warning. */
+            Log(LOG_LEVEL_VERBOSE,
+                "Could not get policy bundle for %s:%s, response: %s",
+                conn->this_server, remote_dir, buf);
+            return false;
+        }
+        first = false;
+
+        size_t file_count;
+        if (sscanf(buf, "END %zu", &file_count) == 1)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Fetched policy bundle of %s:%s: %zu files",
+                conn->this_server, remote_dir, file_count);
+            return true;
+        }
+
+        uintmax_t mode;
+        intmax_t size;
+        char rel[CF_BUFSIZE];
+        if (sscanf(buf, "FILE %jo %jd %4000[^\n]", &mode, &size, rel) != 3 ||
+            size < 0 || !BundlePathIsSafe(rel))
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Malformed policy bundle entry from server %s: %s",
+                conn->this_server, buf);
+            return false;
+        }
+
+        char path[CF_BUFSIZE];
+        ret = snprintf(path, sizeof(path), "%s/%s", local_dir, rel);
+        if (ret < 0 || (size_t) ret >= sizeof(path))
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Policy bundle path too long: %s/%s", local_dir, rel);
+            return false;
+        }
+
+        if (!BundleMakeParentDirs(path))
+        {
+            return false;
+        }
+
+        int fd = safe_open_create_perms(path, O_WRONLY | O_CREAT | O_TRUNC,
+                                        (mode_t) mode);
+        if (fd == -1)
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Could not create '%s' from policy bundle (open: %s)",
+                path, GetErrorStr());
+            return false;
+        }
+
+        intmax_t received = 0;
+        bool write_ok = true;
+        while (received < size)
+        {
+            ret = ReceiveTransaction(conn->conn_info, buf, NULL);
+            if (ret <= 0 || (intmax_t) ret > size - received)
+            {
+                Log(LOG_LEVEL_WARNING,
+                    "Truncated policy bundle content for '%s'", path);
+                close(fd);
+                return false;
+            }
+            if (write_ok && FullWrite(fd, buf, ret) != ret)
+            {
+                Log(LOG_LEVEL_WARNING,
+                    "Could not write '%s' from policy bundle (write: %s)",
+                    path, GetErrorStr());
+                write_ok = false;
+            }
+            received += ret;
+        }
+
+        close(fd);
+        if (!write_ok)
+        {
+            return false;
+        }
+    }
+}
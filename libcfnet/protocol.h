@@ -156,4 +156,47 @@ bool ProtocolStatGet(AgentConnection *conn, const char *remote_path,
 bool ProtocolStat(AgentConnection *conn, const char *remote_path,
                   struct stat *stat_buf);
 
+/**
+ * Receives the server's metadata digest of a remote directory tree.
+ *
+ * The server walks the tree under \p remote_path and answers with a single
+ * hex digest over the sorted names, types, modes, sizes and mtimes of every
+ * entry (see TreeDigestGet() in cf-serverd). An agent that cached the digest
+ * of its last fully synchronized copy can skip the per-file comparison when
+ * the digest still matches, turning an unchanged recursive copy into one
+ * round trip.
+ *
+ * The function shall fail if connection is not established, if the server
+ * predates the TREEDIGEST command, or if access to the path is denied (both
+ * denoted by a message preceded by "BAD").
+ *
+ * @param [in]  conn         The connection to use
+ * @param [in]  remote_path  Directory path on remote host
+ * @param [out] digest_out   Where to store the hex digest string
+ * @param [in]  digest_size  Size of \p digest_out
+ * @return true on success, false on failure.
+ */
+bool ProtocolTreeDigest(AgentConnection *conn, const char *remote_path,
+                        char *digest_out, size_t digest_size);
+
+/**
+ * Fetches every regular file under \p remote_dir in one request and writes
+ * them below \p local_dir, creating directories as needed (see
+ * PolicyBundleSend() in cf-serverd for the frame format).  Used to warm a
+ * bootstrapping agent's inputs in a single round trip; the regular policy
+ * update afterwards remains authoritative, so a failed or partial fetch is
+ * not fatal to the caller.
+ *
+ * The function shall fail if the connection is not established, if the
+ * server predates the POLICYBUNDLE command, or if access to the path is
+ * denied (both denoted by a message preceded by "BAD").
+ *
+ * @param [in] conn        The connection to use
+ * @param [in] remote_dir  Directory path on remote host
+ * @param [in] local_dir   Local directory to populate
+ * @return true on success, false on failure.
+ */
+bool ProtocolPolicyBundleFetch(AgentConnection *conn, const char *remote_dir,
+                               const char *local_dir);
+
 #endif
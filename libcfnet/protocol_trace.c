@@ -0,0 +1,116 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <platform.h>
+#include <protocol_trace.h>
+
+#include <file_lib.h>           /* safe_fopen */
+#include <logging.h>
+
+
+/* Set once at startup (policy load), then only read by the record path, so
+ * the NULL check in ProtocolTraceAppend() can stay outside the lock. */
+static FILE *TRACE_FILE = NULL; /* GLOBAL_X */
+static pthread_mutex_t TRACE_LOCK = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+bool ProtocolTraceEnable(const char *path)
+{
+    assert(path != NULL);
+
+    FILE *file = safe_fopen(path, "ab");
+    if (file == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Could not open protocol trace file '%s' (fopen: %s)",
+            path, GetErrorStr());
+        return false;
+    }
+
+    if (ftell(file) == 0)
+    {
+        if (fwrite(PROTOCOL_TRACE_MAGIC, PROTOCOL_TRACE_MAGIC_LEN, 1, file) != 1)
+        {
+            Log(LOG_LEVEL_ERR,
+                "Could not write protocol trace header to '%s' (fwrite: %s)",
+                path, GetErrorStr());
+            fclose(file);
+            return false;
+        }
+    }
+
+    pthread_mutex_lock(&TRACE_LOCK);
+    if (TRACE_FILE != NULL)
+    {
+        fclose(TRACE_FILE);
+    }
+    TRACE_FILE = file;
+    pthread_mutex_unlock(&TRACE_LOCK);
+    return true;
+}
+
+void ProtocolTraceDisable(void)
+{
+    pthread_mutex_lock(&TRACE_LOCK);
+    if (TRACE_FILE != NULL)
+    {
+        fclose(TRACE_FILE);
+        TRACE_FILE = NULL;
+    }
+    pthread_mutex_unlock(&TRACE_LOCK);
+}
+
+void ProtocolTraceAppend(char direction, char status, int conn_fd,
+                         const char *data, size_t len)
+{
+    if (TRACE_FILE == NULL)
+    {
+        return;
+    }
+
+    assert(direction == 'S' || direction == 'R');
+    assert(len <= UINT16_MAX);
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    const ProtocolTraceHeader header = {
+        .usec = (int64_t) now.tv_sec * 1000000 + now.tv_usec,
+        .conn_fd = conn_fd,
+        .direction = (uint8_t) direction,
+        .status = (uint8_t) status,
+        .len = (uint16_t) len,
+    };
+
+    pthread_mutex_lock(&TRACE_LOCK);
+    if (TRACE_FILE != NULL &&
+        (fwrite(&header, sizeof(header), 1, TRACE_FILE) != 1 ||
+         fwrite(data, len, 1, TRACE_FILE) != 1))
+    {
+        Log(LOG_LEVEL_ERR,
+            "Could not append to protocol trace, disabling capture (fwrite: %s)",
+            GetErrorStr());
+        fclose(TRACE_FILE);
+        TRACE_FILE = NULL;
+    }
+    pthread_mutex_unlock(&TRACE_LOCK);
+}
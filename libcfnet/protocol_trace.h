@@ -0,0 +1,79 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_PROTOCOL_TRACE_H
+#define CFENGINE_PROTOCOL_TRACE_H
+
+
+#include <platform.h>
+
+
+/**
+ * Capture of framed protocol transactions, for later replay with
+ * `cf-net replay`. When enabled (body server control "protocol_trace_file"),
+ * every transaction going through SendTransaction() / ReceiveTransaction()
+ * is appended to a compact binary trace file.
+ *
+ * On-disk format: the 8-byte magic #PROTOCOL_TRACE_MAGIC followed by one
+ * record per transaction, each a #ProtocolTraceHeader immediately followed
+ * by the payload bytes. Multi-byte fields are in host byte order; traces are
+ * meant to be replayed on the same architecture class that recorded them.
+ *
+ * Only transaction-framed traffic is captured. The bulk payload of file
+ * transfers bypasses the transaction layer, so a trace carries the request
+ * pattern and its timing, not the file contents.
+ */
+
+#define PROTOCOL_TRACE_MAGIC "CFTRACE1"
+#define PROTOCOL_TRACE_MAGIC_LEN 8
+
+typedef struct
+{
+    int64_t usec;       /* wall-clock timestamp in microseconds */
+    int32_t conn_fd;    /* socket descriptor, distinguishes connections */
+    uint8_t direction;  /* 'S' sent by the tracing process, 'R' received */
+    uint8_t status;     /* CF_MORE / CF_DONE of the transaction */
+    uint16_t len;       /* payload length in bytes */
+} ProtocolTraceHeader;
+
+/**
+ * Start appending transactions to #path (created if missing, the magic is
+ * written only when the file is empty). Replaces any previously enabled
+ * trace file.
+ *
+ * @return true if the trace file could be opened
+ */
+bool ProtocolTraceEnable(const char *path);
+
+void ProtocolTraceDisable(void);
+
+/**
+ * Append one transaction record; no-op unless ProtocolTraceEnable() has been
+ * called. Thread-safe, records from concurrent connections interleave whole.
+ */
+void ProtocolTraceAppend(char direction, char status, int conn_fd,
+                         const char *data, size_t len);
+
+
+#endif
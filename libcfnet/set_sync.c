@@ -0,0 +1,312 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <platform.h>
+#include <set_sync.h>
+
+#include <net.h>                     /* SendTransaction,ReceiveTransaction */
+#include <hash.h>                                            /* HashString */
+#include <string_lib.h>                                         /* strlcpy */
+#include <logging.h>                                                /* Log */
+#include <alloc.h>                                              /* xmalloc */
+
+/* Bytes in the raw set digest (SHA-1) */
+#define SET_SYNC_DIGEST_BYTES 20
+
+/* Classic Bloom dimensioning: ~10 bits and 7 hash functions per entry give
+ * a false-positive rate around 1%. */
+#define SET_SYNC_BITS_PER_ENTRY 10
+#define SET_SYNC_NUM_HASHES 7
+
+struct SetSyncSketch_
+{
+    size_t num_bits;
+    size_t num_hashes;
+    unsigned char *bits;                            /* num_bits / 8 bytes */
+};
+
+/*********************************************************************/
+
+static uint64_t Fnv1aHash(const char *str, uint64_t basis)
+{
+    uint64_t hash = basis;
+    for (const unsigned char *p = (const unsigned char *) str; *p != '\0'; p++)
+    {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* The i-th bit index for an entry, by double hashing: two independent FNV-1a
+ * hashes combine into num_hashes indices without rehashing the string. */
+static size_t SketchBitIndex(const SetSyncSketch *sketch,
+                             const char *entry, size_t i)
+{
+    const uint64_t h1 = Fnv1aHash(entry, 0xcbf29ce484222325ULL);
+    const uint64_t h2 = Fnv1aHash(entry, 0x84222325cbf29ce4ULL) | 1;
+    return (size_t) ((h1 + i * h2) % sketch->num_bits);
+}
+
+SetSyncSketch *SetSyncSketchNew(size_t num_entries)
+{
+    size_t num_bits = num_entries * SET_SYNC_BITS_PER_ENTRY;
+    num_bits = ((num_bits + 7) / 8) * 8;             /* whole bytes */
+    if (num_bits < 64)
+    {
+        num_bits = 64;
+    }
+    if (num_bits > SET_SYNC_MAX_BITS)
+    {
+        Log(LOG_LEVEL_DEBUG,
+            "Set sync sketch capped at %d bits for %zu entries;"
+            " expect more false positives (harmless, entries get resent)",
+            SET_SYNC_MAX_BITS, num_entries);
+        num_bits = SET_SYNC_MAX_BITS;
+    }
+
+    SetSyncSketch *sketch = xmalloc(sizeof(SetSyncSketch));
+    sketch->num_bits = num_bits;
+    sketch->num_hashes = SET_SYNC_NUM_HASHES;
+    sketch->bits = xcalloc(1, num_bits / 8);
+    return sketch;
+}
+
+void SetSyncSketchDestroy(SetSyncSketch *sketch)
+{
+    if (sketch != NULL)
+    {
+        free(sketch->bits);
+        free(sketch);
+    }
+}
+
+void SetSyncSketchAdd(SetSyncSketch *sketch, const char *entry)
+{
+    assert(sketch != NULL);
+    assert(entry != NULL);
+
+    for (size_t i = 0; i < sketch->num_hashes; i++)
+    {
+        const size_t bit = SketchBitIndex(sketch, entry, i);
+        sketch->bits[bit / 8] |= (1 << (bit % 8));
+    }
+}
+
+bool SetSyncSketchContains(const SetSyncSketch *sketch, const char *entry)
+{
+    assert(sketch != NULL);
+    assert(entry != NULL);
+
+    for (size_t i = 0; i < sketch->num_hashes; i++)
+    {
+        const size_t bit = SketchBitIndex(sketch, entry, i);
+        if ((sketch->bits[bit / 8] & (1 << (bit % 8))) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+char *SetSyncSketchSerialize(const SetSyncSketch *sketch)
+{
+    assert(sketch != NULL);
+
+    const size_t num_bytes = sketch->num_bits / 8;
+    const size_t prefix_max = 64;
+    char *out = xmalloc(prefix_max + 2 * num_bytes + 1);
+
+    int offset = snprintf(out, prefix_max, "%zu:%zu:",
+                          sketch->num_bits, sketch->num_hashes);
+    assert(offset > 0 && (size_t) offset < prefix_max);
+
+    for (size_t i = 0; i < num_bytes; i++)
+    {
+        sprintf(out + offset + 2 * i, "%02x", sketch->bits[i]);
+    }
+
+    return out;
+}
+
+SetSyncSketch *SetSyncSketchDeserialize(const char *serialized)
+{
+    assert(serialized != NULL);
+
+    size_t num_bits, num_hashes;
+    if (sscanf(serialized, "%zu:%zu:", &num_bits, &num_hashes) != 2)
+    {
+        return NULL;
+    }
+
+    if (num_bits == 0 || num_bits > SET_SYNC_MAX_BITS || num_bits % 8 != 0 ||
+        num_hashes == 0 || num_hashes > 16)
+    {
+        return NULL;
+    }
+
+    /* sscanf() counts conversions, so "8:3" without the second colon still
+     * returns 2: find the colons explicitly, the input is untrusted. */
+    const char *hex = strchr(serialized, ':');
+    if (hex == NULL)
+    {
+        return NULL;
+    }
+    hex = strchr(hex + 1, ':');
+    if (hex == NULL)
+    {
+        return NULL;
+    }
+    hex++;
+
+    const size_t num_bytes = num_bits / 8;
+    if (strlen(hex) != 2 * num_bytes)
+    {
+        return NULL;
+    }
+
+    SetSyncSketch *sketch = xmalloc(sizeof(SetSyncSketch));
+    sketch->num_bits = num_bits;
+    sketch->num_hashes = num_hashes;
+    sketch->bits = xmalloc(num_bytes);
+
+    for (size_t i = 0; i < num_bytes; i++)
+    {
+        unsigned int byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1)
+        {
+            SetSyncSketchDestroy(sketch);
+            return NULL;
+        }
+        sketch->bits[i] = (unsigned char) byte;
+    }
+
+    return sketch;
+}
+
+void SetSyncDigest(const Item *entries,
+                   char digest_hex[SET_SYNC_DIGEST_LEN + 1])
+{
+    /* XOR of the per-entry digests: order independent, and incremental if a
+     * caller ever wants to maintain it across single additions/removals. */
+    unsigned char acc[SET_SYNC_DIGEST_BYTES] = { 0 };
+
+    for (const Item *ip = entries; ip != NULL; ip = ip->next)
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+        HashString(ip->name, strlen(ip->name), digest, HASH_METHOD_SHA1);
+        for (size_t i = 0; i < SET_SYNC_DIGEST_BYTES; i++)
+        {
+            acc[i] ^= digest[i];
+        }
+    }
+
+    for (size_t i = 0; i < SET_SYNC_DIGEST_BYTES; i++)
+    {
+        sprintf(digest_hex + 2 * i, "%02x", acc[i]);
+    }
+}
+
+/*********************************************************************/
+
+SetSyncResult SetSyncClasses(AgentConnection *conn, const char *regex,
+                             const Item *known_entries,
+                             const char *last_digest,
+                             Item **new_entries,
+                             char digest_out[SET_SYNC_DIGEST_LEN + 1])
+{
+    assert(conn != NULL);
+    assert(regex != NULL);
+    assert(new_entries != NULL);
+    assert(digest_out != NULL);
+
+    *new_entries = NULL;
+
+    size_t num_entries = 0;
+    for (const Item *ip = known_entries; ip != NULL; ip = ip->next)
+    {
+        num_entries++;
+    }
+
+    SetSyncSketch *sketch = SetSyncSketchNew(num_entries);
+    for (const Item *ip = known_entries; ip != NULL; ip = ip->next)
+    {
+        SetSyncSketchAdd(sketch, ip->name);
+    }
+    char *serialized = SetSyncSketchSerialize(sketch);
+    SetSyncSketchDestroy(sketch);
+
+    char request[CF_BUFSIZE - CF_INBAND_OFFSET];
+    int ret = snprintf(request, sizeof(request), "SETSYNC %s %s %s",
+                       NULL_OR_EMPTY(last_digest) ? "-" : last_digest,
+                       serialized, regex);
+    free(serialized);
+    if (ret < 0 || (size_t) ret >= sizeof(request))
+    {
+        Log(LOG_LEVEL_ERR, "SETSYNC request too long for regex '%s'", regex);
+        return SET_SYNC_ERROR;
+    }
+
+    if (SendTransaction(conn->conn_info, request, 0, CF_DONE) == -1)
+    {
+        return SET_SYNC_ERROR;
+    }
+
+    char recvbuffer[CF_BUFSIZE];
+    int received = ReceiveTransaction(conn->conn_info, recvbuffer, NULL);
+    if (received == -1)
+    {
+        return SET_SYNC_ERROR;
+    }
+    recvbuffer[MIN(received, CF_BUFSIZE - 1)] = '\0';
+
+    if (strncmp(recvbuffer, "BAD:", 4) == 0)
+    {
+        Log(LOG_LEVEL_INFO, "Server refused SETSYNC: %s", recvbuffer);
+        return SET_SYNC_DENIED;
+    }
+
+    if (strcmp(recvbuffer, "OK: unchanged") == 0)
+    {
+        return SET_SYNC_UNCHANGED;
+    }
+
+    char digest[SET_SYNC_DIGEST_LEN + 1];
+    if (sscanf(recvbuffer, "OK: %40s", digest) != 1 ||
+        strlen(digest) != SET_SYNC_DIGEST_LEN)
+    {
+        Log(LOG_LEVEL_ERR, "Unexpected SETSYNC reply: %.64s", recvbuffer);
+        return SET_SYNC_ERROR;
+    }
+
+    const char *list = recvbuffer + strlen("OK: ") + SET_SYNC_DIGEST_LEN;
+    list += strspn(list, " ");
+    if (list[0] != '\0')
+    {
+        *new_entries = SplitStringAsItemList(list, ',');
+    }
+
+    strlcpy(digest_out, digest, SET_SYNC_DIGEST_LEN + 1);
+    return SET_SYNC_DELTA;
+}
@@ -0,0 +1,127 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_SET_SYNC_H
+#define CFENGINE_SET_SYNC_H
+
+#include <platform.h>
+#include <item_lib.h>                                               /* Item */
+#include <cfnet.h>                                       /* AgentConnection */
+
+/**
+ * Delta synchronization of a set of strings between two hosts.
+ *
+ * Instead of shipping the full set on every exchange, the side that holds a
+ * copy sends a fixed-size Bloom sketch of the entries it has plus the digest
+ * of the set as it last acknowledged it.  The authoritative side answers
+ * "unchanged" when the digests match, and otherwise sends only the entries
+ * missing from the sketch, together with the new digest.  Traffic then
+ * scales with the delta, not with the set size.
+ *
+ * A Bloom sketch can claim to hold an entry it does not (false positive),
+ * and it cannot express deletions; both cases surface as a digest mismatch
+ * after the receiver merges the delta, at which point it falls back to a
+ * full fetch.  The digest is order independent, so both sides can compute
+ * it without agreeing on an ordering.
+ *
+ * The mechanism is generic: the SETSYNC protocol verb currently serves the
+ * persistent-class export set (the delta-sync variant of CONTEXT), and the
+ * same sketch/digest primitives fit any other named string set, such as
+ * package inventories.
+ */
+
+/* Hex characters in a set digest (SHA-1 sized, order independent) */
+#define SET_SYNC_DIGEST_LEN 40
+
+/* The serialized sketch must fit in one protocol transaction together with
+ * the verb, digest and selection argument, so the bit array is capped.  At
+ * ~10 bits per entry this holds roughly 800 entries at a ~1% false-positive
+ * rate; larger sets degrade gracefully into resending more entries. */
+#define SET_SYNC_MAX_BITS (8 * 1024)
+
+typedef struct SetSyncSketch_ SetSyncSketch;
+
+typedef enum
+{
+    SET_SYNC_UNCHANGED,              /* digest matched, nothing to transfer */
+    SET_SYNC_DELTA,                /* new digest and missing entries follow */
+    SET_SYNC_DENIED,                             /* server refused the query */
+    SET_SYNC_ERROR                        /* network or protocol level error */
+} SetSyncResult;
+
+/**
+ * @brief Allocate a sketch sized for #num_entries entries.
+ */
+SetSyncSketch *SetSyncSketchNew(size_t num_entries);
+
+void SetSyncSketchDestroy(SetSyncSketch *sketch);
+
+void SetSyncSketchAdd(SetSyncSketch *sketch, const char *entry);
+
+/**
+ * @return true if #entry is (probably) in the sketch; false answers are
+ *         always correct, true answers may be false positives.
+ */
+bool SetSyncSketchContains(const SetSyncSketch *sketch, const char *entry);
+
+/**
+ * @return malloc'ed wire form of the sketch ("num_bits:num_hashes:hexbits")
+ */
+char *SetSyncSketchSerialize(const SetSyncSketch *sketch);
+
+/**
+ * @return the parsed sketch, or NULL if #serialized is malformed
+ */
+SetSyncSketch *SetSyncSketchDeserialize(const char *serialized);
+
+/**
+ * @brief Order-independent digest of a whole set of entries.
+ */
+void SetSyncDigest(const Item *entries,
+                   char digest_hex[SET_SYNC_DIGEST_LEN + 1]);
+
+/**
+ * @brief Delta-sync the server's persistent-class export set over an open
+ * connection (the delta variant of the CONTEXT request).
+ *
+ * @param regex which classes to select, as in remoteclassesmatching()
+ * @param known_entries the entries the caller currently holds
+ * @param last_digest the digest from the last acknowledged exchange, or
+ *        NULL/"" on the first exchange
+ * @param new_entries on SET_SYNC_DELTA, the entries missing from the
+ *        caller's set (may be NULL when only deletions happened)
+ * @param digest_out on SET_SYNC_DELTA, the server's current set digest
+ *
+ * On SET_SYNC_DELTA the caller merges #new_entries into its set and
+ * recomputes SetSyncDigest(); a remaining mismatch against #digest_out
+ * means deletions or a sketch false positive, and the caller should fall
+ * back to a full CONTEXT fetch.
+ */
+SetSyncResult SetSyncClasses(AgentConnection *conn, const char *regex,
+                             const Item *known_entries,
+                             const char *last_digest,
+                             Item **new_entries,
+                             char digest_out[SET_SYNC_DIGEST_LEN + 1]);
+
+#endif /* CFENGINE_SET_SYNC_H */
@@ -33,6 +33,15 @@
 #include <logging.h>                          /* Log */
 #include <crypto.h>                           /* EncryptString */
 #include <misc_lib.h>                         /* ProgrammingError */
+#include <item_lib.h>                         /* Item */
+#include <sequence.h>                         /* Seq */
+
+/* Cap on negative (failed) cache entries per connection.  Templated copy
+ * promises with optional (missing_ok) sources can probe thousands of absent
+ * paths per run; caching the failures eliminates the repeated round trips,
+ * but an unbounded set of generated paths must not grow the cache without
+ * limit.  Past the cap, failed stats simply go back to asking the server. */
+#define STAT_CACHE_NEGATIVE_MAX 4096
 
 static void NewStatCache(Stat *data, AgentConnection *conn)
 {
@@ -41,6 +50,26 @@ static void NewStatCache(Stat *data, AgentConnection *conn)
     conn->cache = sp;
 }
 
+/**
+ * Cache a failed remote stat of #file so that repeated lookups within the
+ * run fail fast instead of repeating the request.  Honours the negative
+ * entry cap; past it the failure is simply not cached.
+ */
+static void NewStatCacheFailure(AgentConnection *conn, const char *file)
+{
+    if (conn->cache_negative >= STAT_CACHE_NEGATIVE_MAX)
+    {
+        return;
+    }
+    conn->cache_negative++;
+
+    Stat cfst = { 0 };
+    cfst.cf_filename = xstrdup(file);
+    cfst.cf_server = xstrdup(conn->this_server);
+    cfst.cf_failed = true;
+    NewStatCache(&cfst, conn);
+}
+
 void DestroyStatCache(Stat *data)
 {
     if (data != NULL)
@@ -100,49 +129,12 @@ static int StatFromCache(AgentConnection *conn, const char *file,
 }
 
 /**
- * @param #stattype should be either "link" or "file". If a link, this reads
- *                  readlink and sends it back in the same packet. It then
- *                  caches the value for each copy command.
- *
+ * Send one "SYNCH <time> STAT <file>" request, without waiting for the
+ * reply. @a encrypt must already be normalized for the protocol in use.
  */
-int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
-                   struct stat *statbuf, const char *stattype)
+static int SendStatRequest(AgentConnection *conn, bool encrypt,
+                           const char *file, time_t tloc)
 {
-    assert(conn != NULL);
-    assert(file != NULL);
-    assert(statbuf != NULL);
-    assert(strcmp(stattype, "file") == 0 ||
-           strcmp(stattype, "link") == 0);
-
-    /* We encrypt only for CLASSIC protocol. The TLS protocol is always over
-     * encrypted layer, so it does not support encrypted (S*) commands. */
-    encrypt = encrypt && conn->conn_info->protocol == CF_PROTOCOL_CLASSIC;
-
-    if (strlen(file) > CF_BUFSIZE - 30)
-    {
-        Log(LOG_LEVEL_ERR, "Filename too long");
-        return -1;
-    }
-
-    int ret = StatFromCache(conn, file, statbuf, stattype);
-    if (ret == 0 || ret == -1)                            /* found or error */
-    {
-        return ret;
-    }
-
-    /* Not found in cache */
-
-    char recvbuffer[CF_BUFSIZE];
-    memset(recvbuffer, 0, CF_BUFSIZE);
-
-    time_t tloc = time(NULL);
-    if (tloc == (time_t) -1)
-    {
-        Log(LOG_LEVEL_ERR, "Couldn't read system clock (time: %s)",
-            GetErrorStr());
-        tloc = 0;
-    }
-
     char sendbuffer[CF_BUFSIZE];
     int tosend;
     sendbuffer[0] = '\0';
@@ -193,6 +185,25 @@ int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
         return -1;
     }
 
+    return 0;
+}
+
+/**
+ * Receive the two-transaction reply for one STAT request and insert the
+ * result into the connection's stat cache.
+ *
+ * @param cache_failure if true, a BAD reply is recorded in the cache as a
+ *                      failed entry (so later lookups fail fast) instead of
+ *                      being reported as an error.
+ * @return 0 on success (entry cached), 1 on a BAD reply for this file,
+ *         -1 on connection/protocol error (no further replies readable).
+ */
+static int RecvStatResponse(AgentConnection *conn, const char *file,
+                            bool cache_failure)
+{
+    char recvbuffer[CF_BUFSIZE];
+    memset(recvbuffer, 0, CF_BUFSIZE);
+
     if (ReceiveTransaction(conn->conn_info, recvbuffer, NULL) == -1)
     {
         /* TODO mark connection in the cache as closed. */
@@ -211,8 +222,13 @@ int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
     {
         Log(LOG_LEVEL_VERBOSE, "Server returned error: %s",
             recvbuffer + strlen("BAD: "));
+
+        if (cache_failure)
+        {
+            NewStatCacheFailure(conn, file);
+        }
         errno = EPERM;
-        return -1;
+        return 1;
     }
 
     if (!OKProtoReply(recvbuffer))
@@ -226,8 +242,7 @@ int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
 
     Stat cfst;
 
-    ret = StatParseResponse(recvbuffer, &cfst);
-    if (!ret)
+    if (!StatParseResponse(recvbuffer, &cfst))
     {
         Log(LOG_LEVEL_ERR, "Cannot read STAT reply from '%s'",
             conn->this_server);
@@ -260,6 +275,7 @@ int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
     {
         Log(LOG_LEVEL_ERR, "Invalid file type identifier for file %s:%s, %u",
             conn->this_server, file, cfst.cf_type);
+        free(cfst.cf_readlink);
         return -1;
     }
 
@@ -276,25 +292,219 @@ int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
 
     NewStatCache(&cfst, conn);
 
-    if ((cfst.cf_lmode != 0) && (strcmp(stattype, "link") == 0))
+    return 0;
+}
+
+/**
+ * @param #stattype should be either "link" or "file". If a link, this reads
+ *                  readlink and sends it back in the same packet. It then
+ *                  caches the value for each copy command.
+ *
+ */
+int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
+                   struct stat *statbuf, const char *stattype)
+{
+    assert(conn != NULL);
+    assert(file != NULL);
+    assert(statbuf != NULL);
+    assert(strcmp(stattype, "file") == 0 ||
+           strcmp(stattype, "link") == 0);
+
+    /* We encrypt only for CLASSIC protocol. The TLS protocol is always over
+     * encrypted layer, so it does not support encrypted (S*) commands. */
+    encrypt = encrypt && conn->conn_info->protocol == CF_PROTOCOL_CLASSIC;
+
+    if (strlen(file) > CF_BUFSIZE - 30)
     {
-        statbuf->st_mode = cfst.cf_lmode;
+        Log(LOG_LEVEL_ERR, "Filename too long");
+        return -1;
     }
-    else
+
+    int ret = StatFromCache(conn, file, statbuf, stattype);
+    if (ret == 0 || ret == -1)                            /* found or error */
+    {
+        return ret;
+    }
+
+    /* Not found in cache */
+
+    time_t tloc = time(NULL);
+    if (tloc == (time_t) -1)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't read system clock (time: %s)",
+            GetErrorStr());
+        tloc = 0;
+    }
+
+    if (SendStatRequest(conn, encrypt, file, tloc) == -1)
+    {
+        return -1;
+    }
+
+    /* Cache BAD replies too: optional sources are often probed for the same
+     * missing path by every iteration of a templated promise, and the
+     * second probe can fail from the cache instead of the network. */
+    ret = RecvStatResponse(conn, file, true);
+    if (ret != 0)
+    {
+        return -1;
+    }
+
+    /* The entry was just inserted, so this cannot miss. */
+    ret = StatFromCache(conn, file, statbuf, stattype);
+    assert(ret != 1);
+    return ret;
+}
+
+/**
+ * Pipeline STAT requests for all @a entries of @a dirname that are not in
+ * the stat cache yet, and collect the replies into the cache. The request
+ * window is bounded so that neither side's socket buffer can fill up with
+ * unread data (which would deadlock both peers).
+ *
+ * Used right after a directory listing is received, where the copy engine
+ * is known to stat every entry next; turning the per-entry round trips
+ * into a streamed exchange. BAD replies (e.g. access denied) are cached as
+ * failed entries so the later lookup fails fast without another request.
+ *
+ * @return 0 on success, -1 if the connection broke mid-exchange.
+ */
+int StatCachePrefetch(AgentConnection *conn, bool encrypt,
+                      const char *dirname, const Item *entries)
+{
+    assert(conn != NULL);
+    assert(dirname != NULL);
+
+    const size_t window = 16;
+
+    encrypt = encrypt && conn->conn_info->protocol == CF_PROTOCOL_CLASSIC;
+
+    time_t tloc = time(NULL);
+    if (tloc == (time_t) -1)
+    {
+        tloc = 0;
+    }
+
+    /* Build the list of full paths that actually need fetching. */
+    Seq *paths = SeqNew(64, free);
+    for (const Item *ip = entries; ip != NULL; ip = ip->next)
+    {
+        const char *name = ip->name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            continue;
+        }
+
+        size_t len = strlen(dirname) + strlen(name) + 2;
+        if (len > CF_BUFSIZE - 30)
+        {
+            continue;                  /* cf_remote_stat will refuse it too */
+        }
+
+        char *path = xmalloc(len);
+        xsnprintf(path, len, "%s/%s", dirname, name);
+
+        if (StatCacheLookup(conn, path, conn->this_server) != NULL)
+        {
+            free(path);
+            continue;
+        }
+        SeqAppend(paths, path);
+    }
+
+    const size_t n = SeqLength(paths);
+    size_t sent = 0, received = 0;
+    int ret = 0;
+
+    while (received < n && ret != -1)
+    {
+        while (sent < n && (sent - received) < window)
+        {
+            if (SendStatRequest(conn, encrypt, SeqAt(paths, sent), tloc) == -1)
+            {
+                ret = -1;
+                break;
+            }
+            sent++;
+        }
+
+        while (received < sent)
+        {
+            if (RecvStatResponse(conn, SeqAt(paths, received), true) == -1)
+            {
+                ret = -1;
+                break;
+            }
+            received++;
+        }
+    }
+
+    if (n > 0)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Prefetched %zu/%zu stat entries for '%s' from %s",
+            received, n, dirname, conn->this_server);
+    }
+
+    SeqDestroy(paths);
+    return ret;
+}
+
+/**
+ * Insert one entry of a STATDIR reply into the connection's stat cache.
+ * @a statline is a "OK: ..." line in the STAT reply format, or a "BAD: ..."
+ * line which is cached as a failed entry (so later lookups fail fast, as
+ * with prefetched STATs). @a linktarget is the link destination, or the
+ * empty string if @a file is not a symlink.
+ *
+ * @return 0 on success, -1 if the line could not be parsed.
+ */
+int StatCacheInsertParsed(AgentConnection *conn, const char *file,
+                          const char *statline, const char *linktarget)
+{
+    assert(conn != NULL);
+    assert(file != NULL);
+    assert(statline != NULL);
+    assert(linktarget != NULL);
+
+    if (BadProtoReply(statline))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Server returned error for '%s': %s",
+            file, statline + strlen("BAD: "));
+
+        NewStatCacheFailure(conn, file);
+        return 0;
+    }
+
+    Stat cfst;
+    if (!StatParseResponse(statline, &cfst))
+    {
+        Log(LOG_LEVEL_ERR, "Cannot read STAT line from '%s'",
+            conn->this_server);
+        return -1;
+    }
+
+    mode_t file_type = FileTypeToMode(cfst.cf_type);
+    if (file_type == 0)
     {
-        statbuf->st_mode = cfst.cf_mode;
+        Log(LOG_LEVEL_ERR, "Invalid file type identifier for file %s:%s, %u",
+            conn->this_server, file, cfst.cf_type);
+        return -1;
     }
 
-    statbuf->st_uid = cfst.cf_uid;
-    statbuf->st_gid = cfst.cf_gid;
-    statbuf->st_size = cfst.cf_size;
-    statbuf->st_mtime = cfst.cf_mtime;
-    statbuf->st_ctime = cfst.cf_ctime;
-    statbuf->st_atime = cfst.cf_atime;
-    statbuf->st_ino = cfst.cf_ino;
-    statbuf->st_dev = cfst.cf_dev;
-    statbuf->st_nlink = cfst.cf_nlink;
+    cfst.cf_mode |= file_type;
+
+    cfst.cf_readlink = (linktarget[0] != '\0') ? xstrdup(linktarget) : NULL;
+    cfst.cf_filename = xstrdup(file);
+    cfst.cf_server = xstrdup(conn->this_server);
+    cfst.cf_failed = false;
+
+    if (cfst.cf_lmode != 0)
+    {
+        cfst.cf_lmode |= (mode_t) S_IFLNK;
+    }
 
+    NewStatCache(&cfst, conn);
     return 0;
 }
 
@@ -353,54 +563,109 @@ mode_t FileTypeToMode(const FileType type)
 
 /*********************************************************************/
 
+/**
+ * Parse one whitespace-preceded decimal field, consuming at most
+ * @a max_width characters (sign included) like a "%<N>jd" sscanf()
+ * conversion would.
+ */
+static bool ParseStatField(const char **pos, size_t max_width,
+                           intmax_t *value_out)
+{
+    const char *s = *pos;
+    while (isspace((unsigned char) *s))
+    {
+        s++;
+    }
+
+    size_t width = 0;
+    bool negative = false;
+    if ((*s == '-' || *s == '+') && width < max_width)
+    {
+        negative = (*s == '-');
+        s++;
+        width++;
+    }
+
+    intmax_t value = 0;
+    bool have_digit = false;
+    while (width < max_width && isdigit((unsigned char) *s))
+    {
+        value = value * 10 + (*s - '0');
+        s++;
+        width++;
+        have_digit = true;
+    }
+
+    if (!have_digit)
+    {
+        return false;
+    }
+
+    *value_out = negative ? -value : value;
+    *pos = s;
+    return true;
+}
+
 bool StatParseResponse(const char *const buf, Stat *const statbuf)
 {
     assert(buf != NULL);
     assert(statbuf != NULL);
 
+    /* Hand-rolled equivalent of the previous 13-conversion sscanf(): this
+     * parse runs once per remote stat, and sscanf() re-interprets its
+     * format string every call. The field widths of the text protocol are
+     * kept as-is. */
+    static const size_t widths[13] =
+    {
+        1,   // 01 statbuf->cf_type
+        5,   // 02 statbuf->cf_mode
+        14,  // 03 statbuf->cf_lmode
+        14,  // 04 statbuf->cf_uid
+        14,  // 05 statbuf->cf_gid
+        18,  // 06 statbuf->cf_size
+        14,  // 07 statbuf->cf_atime
+        14,  // 08 statbuf->cf_mtime
+        14,  // 09 statbuf->cf_ctime
+        1,   // 10 statbuf->cf_makeholes
+        14,  // 11 statbuf->cf_ino
+        14,  // 12 statbuf->cf_nlink
+        18,  // 13 statbuf->cf_dev
+    };
+
     // use intmax_t here to provide enough space for large values coming over the protocol
-    intmax_t d1, d2, d3, d4, d5, d6, d7, d8, d9, d10, d11, d12 = 0, d13 = 0;
-    int res = sscanf(buf, "OK:"
-                          " %1" PRIdMAX    // 01 statbuf->cf_type
-                          " %5" PRIdMAX    // 02 statbuf->cf_mode
-                          " %14" PRIdMAX   // 03 statbuf->cf_lmode
-                          " %14" PRIdMAX   // 04 statbuf->cf_uid
-                          " %14" PRIdMAX   // 05 statbuf->cf_gid
-                          " %18" PRIdMAX   // 06 statbuf->cf_size
-                          " %14" PRIdMAX   // 07 statbuf->cf_atime
-                          " %14" PRIdMAX   // 08 statbuf->cf_mtime
-                          " %14" PRIdMAX   // 09 statbuf->cf_ctime
-                          " %1" PRIdMAX    // 10 statbuf->cf_makeholes
-                          " %14" PRIdMAX   // 11 statbuf->cf_ino
-                          " %14" PRIdMAX   // 12 statbuf->cf_nlink
-                          " %18" PRIdMAX,  // 13 statbuf->cf_dev
-                     &d1, &d2, &d3, &d4, &d5, &d6, &d7,
-                     &d8, &d9, &d10, &d11, &d12, &d13);
-    if (res < 13)
-    {
-        if (res >= 0)
+    intmax_t d[13];
+    int parsed = 0;
+
+    if (strncmp(buf, "OK:", 3) == 0)
+    {
+        const char *pos = buf + 3;
+        while (parsed < 13 && ParseStatField(&pos, widths[parsed], &d[parsed]))
         {
-            Log(LOG_LEVEL_VERBOSE,
-                "STAT response parsing failed, only %d/13 elements parsed",
-                res);
+            parsed++;
         }
+    }
 
+    if (parsed < 13)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "STAT response parsing failed, only %d/13 elements parsed",
+            parsed);
         return false;
     }
 
-    statbuf->cf_type = (FileType) d1;
-    statbuf->cf_mode = (mode_t) d2;
-    statbuf->cf_lmode = (mode_t) d3;
-    statbuf->cf_uid = (uid_t) d4;
-    statbuf->cf_gid = (gid_t) d5;
-    statbuf->cf_size = (off_t) d6;
-    statbuf->cf_atime = (time_t) d7;
-    statbuf->cf_mtime = (time_t) d8;
-    statbuf->cf_ctime = (time_t) d9;
-    statbuf->cf_makeholes = (char) d10;
-    statbuf->cf_ino = d11;
-    statbuf->cf_nlink = d12;
-    statbuf->cf_dev = (dev_t)d13;
+    statbuf->cf_type = (FileType) d[0];
+    statbuf->cf_mode = (mode_t) d[1];
+    statbuf->cf_lmode = (mode_t) d[2];
+    statbuf->cf_uid = (uid_t) d[3];
+    statbuf->cf_gid = (gid_t) d[4];
+    statbuf->cf_size = (off_t) d[5];
+    statbuf->cf_atime = (time_t) d[6];
+    statbuf->cf_mtime = (time_t) d[7];
+    statbuf->cf_ctime = (time_t) d[8];
+    statbuf->cf_makeholes = (char) d[9];
+    statbuf->cf_ino = d[10];
+    statbuf->cf_nlink = d[11];
+    statbuf->cf_dev = (dev_t) d[12];
 
     return true;
 }
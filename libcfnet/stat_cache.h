@@ -26,6 +26,7 @@
 
 #include <platform.h>
 #include <cfnet.h>
+#include <item_lib.h>                                               /* Item */
 
 
 typedef enum
@@ -65,6 +66,10 @@ struct Stat_
 void DestroyStatCache(Stat *data);
 int cf_remote_stat(AgentConnection *conn, bool encrypt, const char *file,
                    struct stat *statbuf, const char *stattype);
+int StatCachePrefetch(AgentConnection *conn, bool encrypt,
+                      const char *dirname, const Item *entries);
+int StatCacheInsertParsed(AgentConnection *conn, const char *file,
+                          const char *statline, const char *linktarget);
 const Stat *StatCacheLookup(const AgentConnection *conn, const char *file_name,
                             const char *server_name);
 mode_t FileTypeToMode(const FileType type);
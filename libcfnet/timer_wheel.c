@@ -0,0 +1,247 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <platform.h>
+#include <timer_wheel.h>
+
+#include <logging.h>                                   /* Log */
+#include <alloc.h>                                     /* xcalloc */
+#include <misc_lib.h>                                  /* ProgrammingError */
+
+/* Hashed timing wheel: WHEEL_SLOTS lists, one tick of WHEEL_TICK_MS each.
+ * A deadline N ticks away hangs off slot (current + N) % WHEEL_SLOTS with a
+ * "rounds" counter recording how many full revolutions must pass first.
+ * Wheel horizon is 64 seconds per revolution; longer deadlines just carry a
+ * larger rounds count.  All state below is guarded by wheel_lock. */
+
+#define WHEEL_SLOTS 256
+#define WHEEL_TICK_MS 250
+
+struct TimerWheelEntry_
+{
+    int sd;                     /* socket to shut down on expiry */
+    uint32_t rounds;            /* full revolutions left before firing */
+    size_t slot;                /* wheel slot this entry is linked into */
+    bool fired;                 /* deadline expired, socket was shut down */
+    bool linked;                /* still on the wheel (not yet fired) */
+    TimerWheelEntry *prev;
+    TimerWheelEntry *next;
+};
+
+static TimerWheelEntry *WHEEL[WHEEL_SLOTS]; /* GLOBAL_T */
+static size_t WHEEL_CURRENT = 0; /* GLOBAL_T */
+static size_t WHEEL_PENDING = 0; /* GLOBAL_T, entries currently linked */
+static bool WHEEL_THREAD_RUNNING = false; /* GLOBAL_T */
+
+static pthread_mutex_t wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wheel_cond = PTHREAD_COND_INITIALIZER;
+
+static void WheelUnlink(TimerWheelEntry *entry)
+{
+    assert(entry->linked);
+
+    if (entry->prev != NULL)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        WHEEL[entry->slot] = entry->next;
+    }
+    if (entry->next != NULL)
+    {
+        entry->next->prev = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+    entry->linked = false;
+
+    assert(WHEEL_PENDING > 0);
+    WHEEL_PENDING--;
+}
+
+/**
+ * Advance the wheel one slot and expire what is due there.  Called with
+ * wheel_lock held.
+ */
+static void WheelTick(void)
+{
+    WHEEL_CURRENT = (WHEEL_CURRENT + 1) % WHEEL_SLOTS;
+
+    TimerWheelEntry *entry = WHEEL[WHEEL_CURRENT];
+    while (entry != NULL)
+    {
+        TimerWheelEntry *next = entry->next;
+
+        if (entry->rounds > 0)
+        {
+            entry->rounds--;
+        }
+        else
+        {
+            /* Wakes any thread blocked in recv()/send() on this socket,
+             * TLS or not.  The entry itself stays allocated until the
+             * owner calls TimerWheelDisarm() and learns it fired. */
+            WheelUnlink(entry);
+            entry->fired = true;
+            shutdown(entry->sd, SHUT_RDWR);
+        }
+
+        entry = next;
+    }
+}
+
+static void *TimerWheelThread(ARG_UNUSED void *param)
+{
+    pthread_mutex_lock(&wheel_lock);
+
+    while (true)
+    {
+        if (WHEEL_PENDING == 0)
+        {
+            /* Nothing armed: sleep until TimerWheelArm() signals.  The
+             * wheel position is meaningless while empty, so no catch-up
+             * ticking is needed on wakeup. */
+            pthread_cond_wait(&wheel_cond, &wheel_lock);
+            continue;
+        }
+
+        struct timespec wakeup;
+        clock_gettime(CLOCK_REALTIME, &wakeup);
+        wakeup.tv_nsec += (long) WHEEL_TICK_MS * 1000000;
+        if (wakeup.tv_nsec >= 1000000000)
+        {
+            wakeup.tv_sec += 1;
+            wakeup.tv_nsec -= 1000000000;
+        }
+
+        int ret = pthread_cond_timedwait(&wheel_cond, &wheel_lock, &wakeup);
+        if (ret == ETIMEDOUT)
+        {
+            WheelTick();
+        }
+        /* Otherwise an arm/disarm signalled us; just recompute the wait.
+         * Ticks therefore drift by processing time, which is fine for a
+         * watchdog with 250ms granularity. */
+    }
+
+    ProgrammingError("TimerWheelThread: unreachable");
+    return NULL;
+}
+
+/**
+ * Start the watchdog thread on first use.  Called with wheel_lock held.
+ */
+static bool WheelEnsureThread(void)
+{
+    if (WHEEL_THREAD_RUNNING)
+    {
+        return true;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_t tid;
+    int ret = pthread_create(&tid, &attr, &TimerWheelThread, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (ret != 0)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Failed to start timer wheel thread, "
+            "network deadlines will not be enforced. (pthread_create: %s)",
+            GetErrorStrFromCode(ret));
+        return false;
+    }
+
+    WHEEL_THREAD_RUNNING = true;
+    return true;
+}
+
+TimerWheelEntry *TimerWheelArm(int sd, int64_t timeout_ms)
+{
+    assert(sd >= 0);
+    assert(timeout_ms > 0);
+
+    pthread_mutex_lock(&wheel_lock);
+
+    if (!WheelEnsureThread())
+    {
+        pthread_mutex_unlock(&wheel_lock);
+        return NULL;
+    }
+
+    /* Round up to whole ticks, at least one, so a deadline can never fire
+     * early. */
+    int64_t ticks = (timeout_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    if (ticks < 1)
+    {
+        ticks = 1;
+    }
+
+    TimerWheelEntry *entry = xcalloc(1, sizeof(TimerWheelEntry));
+    entry->sd = sd;
+    entry->slot = (WHEEL_CURRENT + ticks) % WHEEL_SLOTS;
+    entry->rounds = (ticks - 1) / WHEEL_SLOTS;
+    entry->linked = true;
+
+    entry->next = WHEEL[entry->slot];
+    if (entry->next != NULL)
+    {
+        entry->next->prev = entry;
+    }
+    WHEEL[entry->slot] = entry;
+
+    WHEEL_PENDING++;
+    if (WHEEL_PENDING == 1)
+    {
+        /* Wake the thread from its empty-wheel sleep. */
+        pthread_cond_signal(&wheel_cond);
+    }
+
+    pthread_mutex_unlock(&wheel_lock);
+    return entry;
+}
+
+bool TimerWheelDisarm(TimerWheelEntry *entry)
+{
+    if (entry == NULL)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&wheel_lock);
+
+    const bool fired = entry->fired;
+    if (entry->linked)
+    {
+        WheelUnlink(entry);
+    }
+
+    pthread_mutex_unlock(&wheel_lock);
+
+    free(entry);
+    return fired;
+}
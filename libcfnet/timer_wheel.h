@@ -0,0 +1,72 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_TIMER_WHEEL_H
+#define CFENGINE_TIMER_WHEEL_H
+
+#include <platform.h>
+
+/**
+  @file timer_wheel.h
+
+  Central deadline service for blocking network I/O, shared by cf-serverd
+  and the client side of libcfnet.
+
+  All armed deadlines live in one hashed timing wheel serviced by a single
+  background thread, so arming and disarming are O(1) and cost two list-link
+  operations under a mutex -- no signals, no SIGALRM handlers and no
+  per-socket timer state.  When a deadline expires the watchdog calls
+  shutdown(sd, SHUT_RDWR) on the socket, which wakes any thread blocked in
+  recv()/send() (also under TLS) with an error, letting it fail the
+  operation cleanly on its normal error path.
+
+  Deadlines are rounded up to the wheel tick (250ms); this is a coarse
+  watchdog against stuck peers, not a precision timer.
+*/
+
+typedef struct TimerWheelEntry_ TimerWheelEntry;
+
+/**
+ * Arm a deadline of #timeout_ms milliseconds for socket #sd.  If it expires
+ * before TimerWheelDisarm() is called, the socket is shut down to wake
+ * whichever thread is blocked on it.
+ *
+ * @return An entry handle to pass to TimerWheelDisarm(), or NULL if the
+ *         watchdog thread could not be started -- the caller should simply
+ *         proceed without a deadline in that case.
+ */
+TimerWheelEntry *TimerWheelArm(int sd, int64_t timeout_ms);
+
+/**
+ * Cancel #entry (started by TimerWheelArm()) and free it.  Must be called
+ * exactly once for every non-NULL entry, whether or not the deadline fired.
+ *
+ * @param entry  Entry to disarm; NULL is ignored.
+ * @return True if the deadline had already fired, i.e. the socket was shut
+ *         down by the watchdog and any I/O error observed on it was caused
+ *         by the timeout.
+ */
+bool TimerWheelDisarm(TimerWheelEntry *entry);
+
+#endif
@@ -34,6 +34,7 @@
 
 #include <tls_client.h>
 #include <tls_generic.h>
+#include <tls_session_cache.h>             /* TLSSessionCacheFetch */
 #include <net.h>                     /* SendTransaction, ReceiveTransaction */
 #include <protocol.h>                      /* ParseProtocolVersionNetwork() */
 /* TODO move crypto.h to libutils */
@@ -203,6 +204,22 @@ int TLSClientIdentificationDialog(ConnectionInfo *conn_info,
         return -1;
     }
 
+    if (strncmp(line, "BAD: ", 5) == 0)
+    {
+        /* An overloaded server refuses with its hello, optionally hinting
+         * when to come back; the caller decides whether to honour it. */
+        Log(LOG_LEVEL_ERR, "Server refused connection: %s", line + 5);
+
+        unsigned int seconds = 0;
+        const char *hint = strstr(line + 5, "retry after ");
+        if (hint != NULL &&
+            sscanf(hint, "retry after %u", &seconds) == 1)
+        {
+            conn_info->retry_after_hint = seconds;
+        }
+        return 0;
+    }
+
     ProtocolVersion wanted_version;
     if (conn_info->protocol == CF_PROTOCOL_UNDEFINED)
     {
@@ -308,7 +325,7 @@ int TLSClientIdentificationDialog(ConnectionInfo *conn_info,
  *       non-blocking
  * @return -1 in case of error
  */
-int TLSTry(ConnectionInfo *conn_info)
+int TLSTry(ConnectionInfo *conn_info, const char *server)
 {
     assert(conn_info != NULL);
 
@@ -334,6 +351,22 @@ int TLSTry(ConnectionInfo *conn_info)
     /* Initiate the TLS handshake over the already open TCP socket. */
     SSL_set_fd(conn_info->ssl, conn_info->sd);
 
+    /* Offer a session stored by an earlier run for an abbreviated
+     * handshake; the server is free to refuse it. */
+    if (server != NULL)
+    {
+        SSL_SESSION *session = TLSSessionCacheFetch(server);
+        if (session != NULL)
+        {
+            if (SSL_set_session(conn_info->ssl, session) != 1)
+            {
+                Log(LOG_LEVEL_DEBUG, "SSL_set_session: %s",
+                    TLSErrorString(ERR_get_error()));
+            }
+            SSL_SESSION_free(session);
+        }
+    }
+
     bool connected = false;
     bool should_retry = true;
     int remaining_tries = MAX_CONNECT_RETRIES;
@@ -373,6 +406,10 @@ int TLSTry(ConnectionInfo *conn_info)
         SSL_get_version(conn_info->ssl),
         SSL_get_cipher_name(conn_info->ssl),
         SSL_get_cipher_version(conn_info->ssl));
+    if (SSL_session_reused(conn_info->ssl))
+    {
+        Log(LOG_LEVEL_VERBOSE, "TLS session resumed from previous run");
+    }
     Log(LOG_LEVEL_VERBOSE, "TLS session established, checking trust...");
 
     return 0;
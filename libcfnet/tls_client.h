@@ -36,7 +36,7 @@ bool TLSClientIsInitialized(void);
 
 int TLSClientIdentificationDialog(ConnectionInfo *conn_info,
                                   const char *username);
-int TLSTry(ConnectionInfo *conn_info);
+int TLSTry(ConnectionInfo *conn_info, const char *server);
 
 /* Exported for enterprise. */
 int TLSConnect(ConnectionInfo *conn_info, bool trust_server, const Rlist *restrict_keys,
@@ -0,0 +1,163 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <platform.h>
+#include <tls_session_cache.h>
+
+#include <logging.h>
+#include <known_dirs.h>                                      /* GetStateDir */
+#include <misc_lib.h>
+
+/* Serialized sessions are around 1-2 kB; anything bigger is corrupt. */
+#define TLS_SESSION_FILE_SIZE_MAX (64 * 1024)
+
+/**
+ * Build the session file path for @a server. Server names come from policy
+ * (IP addresses or hostnames), but get sanitized anyway since they end up
+ * as a filename.
+ */
+static void SessionFilePath(char *buf, size_t buf_size, const char *server)
+{
+    char sanitized[128];
+    size_t i;
+    for (i = 0; server[i] != '\0' && i < sizeof(sanitized) - 1; i++)
+    {
+        const char c = server[i];
+        sanitized[i] = (isalnum((unsigned char) c) || c == '.' || c == '-')
+                        ? c : '_';
+    }
+    sanitized[i] = '\0';
+
+    snprintf(buf, buf_size, "%s%ctls_session_%s.der",
+             GetStateDir(), FILE_SEPARATOR, sanitized);
+}
+
+SSL_SESSION *TLSSessionCacheFetch(const char *server)
+{
+    assert(server != NULL);
+
+    char filename[PATH_MAX];
+    SessionFilePath(filename, sizeof(filename), server);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        return NULL;                            /* no session stored, fine */
+    }
+
+    unsigned char der[TLS_SESSION_FILE_SIZE_MAX];
+    ssize_t len = read(fd, der, sizeof(der));
+    close(fd);
+    if (len <= 0 || len == sizeof(der))
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Discarding unreadable TLS session file '%s'", filename);
+        unlink(filename);
+        return NULL;
+    }
+
+    const unsigned char *p = der;
+    SSL_SESSION *session = d2i_SSL_SESSION(NULL, &p, len);
+    if (session == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Discarding corrupt TLS session file '%s'", filename);
+        unlink(filename);
+        return NULL;
+    }
+
+    time_t expires = (time_t) SSL_SESSION_get_time(session) +
+                     (time_t) SSL_SESSION_get_timeout(session);
+    if (time(NULL) >= expires)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Stored TLS session for '%s' has expired", server);
+        SSL_SESSION_free(session);
+        unlink(filename);
+        return NULL;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Offering stored TLS session for resumption to '%s'", server);
+    return session;
+}
+
+void TLSSessionCacheStore(const char *server, SSL *ssl)
+{
+    assert(server != NULL);
+    assert(ssl != NULL);
+
+    SSL_SESSION *session = SSL_get1_session(ssl);
+    if (session == NULL)
+    {
+        return;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    if (!SSL_SESSION_is_resumable(session))
+    {
+        SSL_SESSION_free(session);
+        return;
+    }
+#endif
+
+    unsigned char der[TLS_SESSION_FILE_SIZE_MAX];
+    unsigned char *p = der;
+    int len = i2d_SSL_SESSION(session, NULL);
+    if (len <= 0 || (size_t) len > sizeof(der))
+    {
+        SSL_SESSION_free(session);
+        return;
+    }
+    i2d_SSL_SESSION(session, &p);
+    SSL_SESSION_free(session);
+
+    char filename[PATH_MAX];
+    SessionFilePath(filename, sizeof(filename), server);
+
+    char tmp_filename[PATH_MAX + 8];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+
+    /* Session material allows impersonating this client: 0600 and atomic
+     * rename, like the ppkeys files. */
+    int fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not write TLS session file '%s' (%s)",
+            tmp_filename, GetErrorStr());
+        return;
+    }
+
+    ssize_t written = write(fd, der, len);
+    close(fd);
+    if (written != len || rename(tmp_filename, filename) != 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not store TLS session for '%s' (%s)",
+            server, GetErrorStr());
+        unlink(tmp_filename);
+        return;
+    }
+
+    Log(LOG_LEVEL_DEBUG, "Stored TLS session for '%s'", server);
+}
@@ -0,0 +1,57 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_TLS_SESSION_CACHE_H
+#define CFENGINE_TLS_SESSION_CACHE_H
+
+#include <openssl/ssl.h>
+
+/**
+ * Persistent TLS session cache for outgoing connections.
+ *
+ * Agent processes are short-lived, so OpenSSL's in-memory session cache
+ * never helps: every 5-minute run pays a full TLS handshake (including the
+ * RSA operations) to each server it talks to. Sessions are therefore
+ * serialized to one file per server under the state directory and offered
+ * for resumption on the next run. A stale or rejected session simply causes
+ * a normal full handshake, so the cache can never break connectivity.
+ */
+
+/**
+ * Look up a stored, still valid session for @a server (IP address or
+ * hostname, as passed to ServerConnection()).
+ *
+ * @return a session to pass to SSL_set_session(), with one reference owned
+ *         by the caller (release with SSL_SESSION_free()), or NULL.
+ */
+SSL_SESSION *TLSSessionCacheFetch(const char *server);
+
+/**
+ * Store the current session of @a ssl for later resumption to @a server.
+ * Call after application data has been exchanged, so that TLS 1.3 session
+ * tickets have been processed. No-op if the session is not resumable.
+ */
+void TLSSessionCacheStore(const char *server, SSL *ssl);
+
+#endif
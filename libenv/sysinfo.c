@@ -55,6 +55,7 @@
 #include <json-utils.h>
 #include <unix.h>               /* GetCurrentUserName() */
 #include <glob_lib.h>
+#include <dbm_api.h>            /* persisted hostname resolution cache */
 
 #ifdef HAVE_ZONE_H
 # include <zone.h>
@@ -342,6 +343,93 @@ void CalculateDomainName(const char *nodename, const char *dnsname,
 
 /*******************************************************************/
 
+/* Resolving our own node name is the one probe in environment discovery that
+ * leaves the machine: with a slow or absent resolver it can stall for
+ * seconds, and the long-running daemons (cf-execd, cf-serverd, cf-monitord)
+ * re-run discovery every schedule pulse. Cache the answers for a while,
+ * keyed on the node name so a host rename is picked up immediately. Negative
+ * answers are cached too, since a missing DNS entry otherwise makes every
+ * discovery pay the full resolver timeout. Short-lived components (cf-agent)
+ * still resolve once per run. */
+#define HOSTNAME_RESOLUTION_TTL (15 * SECONDS_PER_MINUTE)
+
+static struct
+{
+    char nodename[CF_BUFSIZE];
+    char dnsname[CF_BUFSIZE];
+    time_t resolved_at;
+} dnsname_cache = { .resolved_at = 0 }; /* GLOBAL_X */
+
+/* Same idea for the forward lookup of the fully qualified name that fills in
+ * VIPADDRESS and the host-alias classes in GetNameInfo3(). */
+static struct
+{
+    char fqhost[CF_BUFSIZE];
+    char ipaddress[CF_MAX_IP_LEN];
+    Rlist *aliases;
+    bool resolved;
+    time_t resolved_at;
+} ipaddress_cache = { .resolved_at = 0 }; /* GLOBAL_X */
+
+/* Controlled by startup_dns_resolution in body common control. When false,
+ * discovery never blocks on the resolver: any persisted answer is used
+ * regardless of age, and an unresolvable name degrades to the bare node
+ * name, just as if the resolver had failed. */
+static bool dns_resolution_allowed = true; /* GLOBAL_P */
+
+void SetDNSResolutionAllowed(bool allowed)
+{
+    dns_resolution_allowed = allowed;
+}
+
+/* The in-memory caches above only help the long-running daemons. The
+ * resolver answer is also persisted so that the short-lived components (one
+ * cf-agent run per schedule pulse) start without touching the resolver
+ * while the answer is fresh. */
+typedef struct
+{
+    time_t resolved_at;
+    char dnsname[CF_BUFSIZE];
+} HostnameCacheEntry;
+
+static bool HostnameCacheLoad(const char *nodename, char *dnsname, size_t dnsname_size, time_t now)
+{
+    CF_DB *db;
+    if (!OpenDB(&db, dbid_hostname))
+    {
+        return false;
+    }
+
+    HostnameCacheEntry entry;
+    bool usable = false;
+    if (ReadDB(db, nodename, &entry, sizeof(entry)))
+    {
+        entry.dnsname[sizeof(entry.dnsname) - 1] = '\0';
+        usable = ((now - entry.resolved_at < HOSTNAME_RESOLUTION_TTL) ||
+                  !dns_resolution_allowed);
+        if (usable)
+        {
+            strlcpy(dnsname, entry.dnsname, dnsname_size);
+        }
+    }
+    CloseDB(db);
+    return usable;
+}
+
+static void HostnameCacheStore(const char *nodename, const char *dnsname, time_t now)
+{
+    CF_DB *db;
+    if (!OpenDB(&db, dbid_hostname))
+    {
+        return;
+    }
+
+    HostnameCacheEntry entry = { .resolved_at = now };
+    strlcpy(entry.dnsname, dnsname, sizeof(entry.dnsname));
+    WriteDB(db, nodename, &entry, sizeof(entry));
+    CloseDB(db);
+}
+
 void DetectDomainName(EvalContext *ctx, const char *orig_nodename)
 {
     char nodename[CF_BUFSIZE];
@@ -354,12 +442,40 @@ void DetectDomainName(EvalContext *ctx, const char *orig_nodename)
 
     if (gethostname(fqn, sizeof(fqn)) != -1)
     {
-        struct hostent *hp;
+        time_t now = time(NULL);
 
-        if ((hp = gethostbyname(fqn)))
+        if ((dnsname_cache.resolved_at != 0) &&
+            (now - dnsname_cache.resolved_at < HOSTNAME_RESOLUTION_TTL) &&
+            (strcmp(fqn, dnsname_cache.nodename) == 0))
         {
-            strlcpy(dnsname, hp->h_name, sizeof(dnsname));
-            ToLowerStrInplace(dnsname);
+            strlcpy(dnsname, dnsname_cache.dnsname, sizeof(dnsname));
+        }
+        else
+        {
+            if (!HostnameCacheLoad(fqn, dnsname, sizeof(dnsname), now))
+            {
+                if (dns_resolution_allowed)
+                {
+                    struct hostent *hp;
+
+                    if ((hp = gethostbyname(fqn)))
+                    {
+                        strlcpy(dnsname, hp->h_name, sizeof(dnsname));
+                        ToLowerStrInplace(dnsname);
+                    }
+                    HostnameCacheStore(fqn, dnsname, now);
+                }
+                else
+                {
+                    Log(LOG_LEVEL_VERBOSE,
+                        "Not resolving '%s': DNS resolution during discovery is disabled and no cached answer exists",
+                        fqn);
+                }
+            }
+
+            strlcpy(dnsname_cache.nodename, fqn, sizeof(dnsname_cache.nodename));
+            strlcpy(dnsname_cache.dnsname, dnsname, sizeof(dnsname_cache.dnsname));
+            dnsname_cache.resolved_at = now;
         }
     }
 
@@ -824,25 +940,49 @@ static void GetNameInfo3(EvalContext *ctx)
     EvalContextClassPutHard(ctx, workbuf, "source=agent");
     Log(LOG_LEVEL_VERBOSE, "GNU autoconf class from compile time: %s", workbuf);
 
-/* Get IP address from nameserver */
+/* Get IP address from nameserver, with the same caching policy as the
+ * node-name resolution in DetectDomainName() above. */
+
+    time_t resolve_now = time(NULL);
+    if (dns_resolution_allowed &&
+        ((ipaddress_cache.resolved_at == 0) ||
+         (resolve_now - ipaddress_cache.resolved_at >= HOSTNAME_RESOLUTION_TTL) ||
+         (strcmp(VFQNAME, ipaddress_cache.fqhost) != 0)))
+    {
+        RlistDestroy(ipaddress_cache.aliases);
+        ipaddress_cache.aliases = NULL;
+        strlcpy(ipaddress_cache.fqhost, VFQNAME, sizeof(ipaddress_cache.fqhost));
+        ipaddress_cache.resolved_at = resolve_now;
+
+        hp = gethostbyname(VFQNAME);
+        ipaddress_cache.resolved = (hp != NULL);
+        if (hp != NULL)
+        {
+            memset(&cin, 0, sizeof(cin));
+            cin.sin_addr.s_addr = ((struct in_addr *) (hp->h_addr))->s_addr;
+            Log(LOG_LEVEL_VERBOSE, "Address given by nameserver: %s", inet_ntoa(cin.sin_addr));
+            strlcpy(ipaddress_cache.ipaddress, inet_ntoa(cin.sin_addr),
+                    sizeof(ipaddress_cache.ipaddress));
+
+            for (i = 0; hp->h_aliases[i] != NULL; i++)
+            {
+                RlistAppendString(&ipaddress_cache.aliases, hp->h_aliases[i]);
+            }
+        }
+    }
 
-    if ((hp = gethostbyname(VFQNAME)) == NULL)
+    if (!ipaddress_cache.resolved)
     {
         Log(LOG_LEVEL_VERBOSE, "Hostname lookup failed on node name '%s'", VSYSNAME.nodename);
         return;
     }
-    else
-    {
-        memset(&cin, 0, sizeof(cin));
-        cin.sin_addr.s_addr = ((struct in_addr *) (hp->h_addr))->s_addr;
-        Log(LOG_LEVEL_VERBOSE, "Address given by nameserver: %s", inet_ntoa(cin.sin_addr));
-        strcpy(VIPADDRESS, inet_ntoa(cin.sin_addr));
 
-        for (i = 0; hp->h_aliases[i] != NULL; i++)
-        {
-            Log(LOG_LEVEL_DEBUG, "Adding alias '%s'", hp->h_aliases[i]);
-            EvalContextClassPutHard(ctx, hp->h_aliases[i], "inventory,attribute_name=none,source=agent,based-on=sys.fqhost");
-        }
+    strcpy(VIPADDRESS, ipaddress_cache.ipaddress);
+
+    for (const Rlist *rp = ipaddress_cache.aliases; rp != NULL; rp = rp->next)
+    {
+        Log(LOG_LEVEL_DEBUG, "Adding alias '%s'", RlistScalarValue(rp));
+        EvalContextClassPutHard(ctx, RlistScalarValue(rp), "inventory,attribute_name=none,source=agent,based-on=sys.fqhost");
     }
 
 #ifdef HAVE_GETZONEID
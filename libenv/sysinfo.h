@@ -32,6 +32,13 @@ void DetectEnvironment(EvalContext *ctx);
 void DetectEnvironmentFromPolicy(EvalContext *ctx, Policy *policy);
 
 void CreateHardClassesFromCanonification(EvalContext *ctx, const char *canonified, char *tags);
+
+/**
+ * Allow or forbid blocking resolver calls during environment discovery, see
+ * startup_dns_resolution in body common control.
+ */
+void SetDNSResolutionAllowed(bool allowed);
+
 int GetUptimeMinutes(time_t now);
 int GetUptimeSeconds(time_t now);
 
@@ -26,8 +26,28 @@
 #include <eval_context.h>
 #include <alloc.h> // xvasprintf
 
+/* Names of the time classes the previous update defined, so that they can be
+ * removed by name instead of regex-scanning the whole class table for the
+ * autoremove tag. */
+static StringSet *current_time_classes = NULL; /* GLOBAL_X */
+static time_t last_update_minute = -1; /* GLOBAL_X */
+
 static void RemoveTimeClass(EvalContext *ctx, const char* tags)
 {
+    if (current_time_classes != NULL)
+    {
+        StringSetIterator it = StringSetIteratorInit(current_time_classes);
+        const char *element = NULL;
+        while ((element = StringSetIteratorNext(&it)))
+        {
+            EvalContextClassRemove(ctx, NULL, element);
+        }
+
+        StringSetDestroy(current_time_classes);
+        current_time_classes = NULL;
+        return;
+    }
+
     Rlist *tags_rlist = RlistFromSplitString(tags, ',');
     ClassTableIterator *iter = EvalContextClassTableIteratorNewGlobal(ctx, NULL, true, true);
     StringSet *global_matches = ClassesMatching(ctx, iter, ".*", tags_rlist, false);
@@ -143,18 +163,45 @@ static void AddTimeClass(EvalContext *ctx, time_t time, const char* tags)
         return;
     }
 
+    assert(current_time_classes == NULL);
+    current_time_classes = StringSetNew();
+
     StringMapIterator iter = StringMapIteratorInit(time_classes);
     MapKeyValue *item;
     while ((item = StringMapIteratorNext(&iter)) != NULL) {
         EvalContextClassPutHard(ctx, item->value, tags);
         EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, item->key, item->value, CF_DATA_TYPE_STRING, "noreport");
+        StringSetAdd(current_time_classes, xstrdup(item->value));
     }
 
     StringMapDestroy(time_classes);
 }
 
+static bool TimeClassesStillDefined(const EvalContext *ctx)
+{
+    if (current_time_classes == NULL)
+    {
+        return false;
+    }
+
+    StringSetIterator it = StringSetIteratorInit(current_time_classes);
+    const char *element = StringSetIteratorNext(&it);
+    return (element != NULL && EvalContextClassGet(ctx, NULL, element) != NULL);
+}
+
 void UpdateTimeClasses(EvalContext *ctx, time_t t)
 {
+    /* The finest-grained time class has one-minute granularity, so within
+     * the same minute a refresh removes and re-adds an identical set. The
+     * daemons call this from their main loops far more often than that;
+     * skip the churn when the classes cannot have changed and are still
+     * defined (a policy reload clears the class table). */
+    if ((t / 60) == last_update_minute && TimeClassesStillDefined(ctx))
+    {
+        return;
+    }
+    last_update_minute = t / 60;
+
     RemoveTimeClass(ctx, "cfengine_internal_time_based_autoremove");
     AddTimeClass(ctx, t, "time_based,cfengine_internal_time_based_autoremove,source=agent");
 }
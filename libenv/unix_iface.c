@@ -50,6 +50,9 @@
 # ifdef HAVE_NET_IF_DL_H
 #   include <net/if_dl.h>
 # endif
+# ifdef __linux__
+#   include <netpacket/packet.h>                  /* struct sockaddr_ll */
+# endif
 #endif
 
 #ifdef HAVE_NET_IF_ARP_H
@@ -61,6 +64,16 @@
 
 #define IPV6_PREFIX "ipv6_"
 
+/* getifaddrs()-based discovery needs link-layer entries in the result list
+ * (AF_LINK on BSD, AF_PACKET on Linux); Solaris getifaddrs() returns
+ * neither, so it keeps the ioctl path. */
+#if defined(HAVE_GETIFADDRS) && !defined(__sun) && \
+    (defined(AF_LINK) || defined(AF_PACKET))
+# define USE_GETIFADDRS_DISCOVERY 1
+#else
+# define USE_GETIFADDRS_DISCOVERY 0
+#endif
+
 #ifndef __MINGW32__
 
 # if defined(HAVE_STRUCT_SOCKADDR_SA_LEN) && !defined(__NetBSD__)
@@ -336,29 +349,30 @@ static void GetMacAddress(EvalContext *ctx, ARG_UNUSED int fd, struct ifreq *ifr
 
 /******************************************************************/
 
-static void GetInterfaceFlags(EvalContext *ctx, struct ifreq *ifr, Rlist **flags)
+static void GetInterfaceFlags(EvalContext *ctx, const char *iface_name,
+                              unsigned int iface_flags, Rlist **flags)
 {
     char name[CF_MAXVARSIZE];
     char buffer[CF_BUFSIZE] = "";
     char *fp = NULL;
 
-    snprintf(name, sizeof(name), "interface_flags[%s]", ifr->ifr_name);
+    snprintf(name, sizeof(name), "interface_flags[%s]", iface_name);
 
-    if (ifr->ifr_flags & IFF_UP) strcat(buffer, " up");
-    if (ifr->ifr_flags & IFF_BROADCAST) strcat(buffer, " broadcast");
-    if (ifr->ifr_flags & IFF_DEBUG) strcat(buffer, " debug");
-    if (ifr->ifr_flags & IFF_LOOPBACK) strcat(buffer, " loopback");
-    if (ifr->ifr_flags & IFF_POINTOPOINT) strcat(buffer, " pointopoint");
+    if (iface_flags & IFF_UP) strcat(buffer, " up");
+    if (iface_flags & IFF_BROADCAST) strcat(buffer, " broadcast");
+    if (iface_flags & IFF_DEBUG) strcat(buffer, " debug");
+    if (iface_flags & IFF_LOOPBACK) strcat(buffer, " loopback");
+    if (iface_flags & IFF_POINTOPOINT) strcat(buffer, " pointopoint");
 
 #ifdef IFF_NOTRAILERS
-    if (ifr->ifr_flags & IFF_NOTRAILERS) strcat(buffer, " notrailers");
+    if (iface_flags & IFF_NOTRAILERS) strcat(buffer, " notrailers");
 #endif
 
-    if (ifr->ifr_flags & IFF_RUNNING) strcat(buffer, " running");
-    if (ifr->ifr_flags & IFF_NOARP) strcat(buffer, " noarp");
-    if (ifr->ifr_flags & IFF_PROMISC) strcat(buffer, " promisc");
-    if (ifr->ifr_flags & IFF_ALLMULTI) strcat(buffer, " allmulti");
-    if (ifr->ifr_flags & IFF_MULTICAST) strcat(buffer, " multicast");
+    if (iface_flags & IFF_RUNNING) strcat(buffer, " running");
+    if (iface_flags & IFF_NOARP) strcat(buffer, " noarp");
+    if (iface_flags & IFF_PROMISC) strcat(buffer, " promisc");
+    if (iface_flags & IFF_ALLMULTI) strcat(buffer, " allmulti");
+    if (iface_flags & IFF_MULTICAST) strcat(buffer, " multicast");
 
     // If a least 1 flag is found
     if (strlen(buffer) > 1)
@@ -372,7 +386,262 @@ static void GetInterfaceFlags(EvalContext *ctx, struct ifreq *ifr, Rlist **flags
 
 /******************************************************************/
 
-void GetInterfacesInfo(EvalContext *ctx)
+#if USE_GETIFADDRS_DISCOVERY
+
+/**
+ * Append one link-layer address to the discovery results, mirroring what
+ * GetMacAddress() defines on the ioctl path.
+ */
+static void GetMacAddressIfaddrs(EvalContext *ctx, const struct ifaddrs *ifa,
+                                 const unsigned char *mac_bytes,
+                                 Rlist **interfaces, Rlist **hardware)
+{
+    char name[CF_MAXVARSIZE];
+
+    // mac address on a loopback interface doesn't make sense
+    if (ifa->ifa_flags & IFF_LOOPBACK)
+    {
+        return;
+    }
+
+    snprintf(name, sizeof(name), "hardware_mac[%s]", CanonifyName(ifa->ifa_name));
+
+    char hw_mac[CF_MAXVARSIZE];
+    snprintf(hw_mac, sizeof(hw_mac), "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
+             mac_bytes[0], mac_bytes[1], mac_bytes[2],
+             mac_bytes[3], mac_bytes[4], mac_bytes[5]);
+
+    EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, name, hw_mac, CF_DATA_TYPE_STRING, "source=agent");
+    if (!RlistContainsString(*hardware, hw_mac))
+    {
+        RlistAppend(hardware, hw_mac, RVAL_TYPE_SCALAR);
+    }
+    if (!RlistContainsString(*interfaces, ifa->ifa_name))
+    {
+        RlistAppend(interfaces, ifa->ifa_name, RVAL_TYPE_SCALAR);
+    }
+
+    snprintf(name, sizeof(name), "mac_%s", CanonifyName(hw_mac));
+    EvalContextClassPutHard(ctx, name, "inventory,attribute_name=none,source=agent");
+}
+
+/**
+ * Interface discovery from a single getifaddrs() walk. On Linux getifaddrs()
+ * is implemented as two batched netlink dumps (RTM_GETLINK + RTM_GETADDR), so
+ * unlike the ioctl path below this costs a couple of syscalls no matter how
+ * many interfaces the host has, is not silently truncated at CF_IFREQ
+ * entries, and already carries the flags, link-layer and IPv6 addresses that
+ * the fallback has to collect via per-interface ioctls and by parsing
+ * ifconfig(8) output.
+ *
+ * @return false if getifaddrs() itself failed and the caller should fall
+ *         back to the ioctl path.
+ */
+static bool GetInterfacesInfoIfaddrs(EvalContext *ctx, Rlist **interfaces,
+                                     Rlist **hardware, Rlist **flags,
+                                     Rlist **ips)
+{
+    struct ifaddrs *ifaddr;
+
+    if (getifaddrs(&ifaddr) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't get interfaces (getifaddrs: %s)",
+            GetErrorStr());
+        return false;
+    }
+
+    bool address_set = false;
+    int i, j = 0;
+    char *sp, workbuf[CF_BUFSIZE];
+    char ip[CF_MAXVARSIZE];
+    char name[CF_MAXVARSIZE];
+    char last_name[CF_MAXVARSIZE] = "";
+
+    for (const struct ifaddrs *ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next, j++)
+    {
+        if (ifa->ifa_name == NULL || strlen(ifa->ifa_name) == 0)
+        {
+            continue;
+        }
+
+        /* Skip network interfaces listed in ignore_interfaces.rx */
+
+        if (IgnoreInterface(ifa->ifa_name))
+        {
+            continue;
+        }
+        else
+        {
+            Log(LOG_LEVEL_VERBOSE, "Interface %d: %s", j + 1, ifa->ifa_name);
+        }
+
+        /* Interfaces with several addresses produce one entry per address,
+           consecutively. The variable is already added so don't set it
+           again. */
+        if (strcmp(last_name, ifa->ifa_name) != 0)
+        {
+            strlcpy(last_name, ifa->ifa_name, sizeof(last_name));
+            EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, "interface", last_name, CF_DATA_TYPE_STRING, "source=agent");
+        }
+
+        snprintf(workbuf, sizeof(workbuf), "net_iface_%s", CanonifyName(ifa->ifa_name));
+        EvalContextClassPutHard(ctx, workbuf, "source=agent");
+
+        if (ifa->ifa_addr == NULL)
+        {
+            continue;
+        }
+
+        if (ifa->ifa_addr->sa_family == AF_INET)
+        {
+            GetInterfaceFlags(ctx, ifa->ifa_name, ifa->ifa_flags, flags);
+
+            if (ifa->ifa_flags & IFF_UP)
+            {
+                struct sockaddr_in *sin = (struct sockaddr_in *) ifa->ifa_addr;
+
+                if (IgnoreJailInterface(j + 1, sin))
+                {
+                    Log(LOG_LEVEL_VERBOSE, "Ignoring interface %d", j + 1);
+                    continue;
+                }
+
+                /* No DNS lookup, just convert IP address to string. */
+                char txtaddr[CF_MAX_IP_LEN] = "";
+                nt_static_assert(sizeof(VIPADDRESS) >= sizeof(txtaddr));
+
+                getnameinfo((struct sockaddr *) sin, sizeof(*sin),
+                            txtaddr, sizeof(txtaddr),
+                            NULL, 0, NI_NUMERICHOST);
+
+                Log(LOG_LEVEL_DEBUG, "Adding hostip '%s'", txtaddr);
+                EvalContextClassPutHard(ctx, txtaddr, "inventory,attribute_name=none,source=agent");
+
+                nt_static_assert(sizeof(ip) >= sizeof(txtaddr) + sizeof("ipv4_"));
+                strcpy(ip, "ipv4_");
+                strcat(ip, txtaddr);
+                EvalContextClassPutHard(ctx, ip, "inventory,attribute_name=none,source=agent");
+
+                /* VIPADDRESS has already been set to the DNS address of
+                 * VFQNAME by GetNameInfo3() during initialisation. Here we
+                 * reset VIPADDRESS to the address of the first non-loopback
+                 * interface. */
+                if (!address_set && !(ifa->ifa_flags & IFF_LOOPBACK))
+                {
+                    EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, "ipv4", txtaddr, CF_DATA_TYPE_STRING, "inventory,source=agent,attribute_name=none");
+
+                    strcpy(VIPADDRESS, txtaddr);
+                    Log(LOG_LEVEL_VERBOSE, "IP address of host set to %s",
+                        VIPADDRESS);
+                    address_set = true;
+                }
+
+                EvalContextAddIpAddress(ctx, txtaddr, CanonifyName(ifa->ifa_name));
+                RlistAppendScalar(ips, txtaddr);
+
+                for (sp = ip + strlen(ip) - 1; (sp > ip); sp--)
+                {
+                    if (*sp == '.')
+                    {
+                        *sp = '\0';
+                        EvalContextClassPutHard(ctx, ip, "inventory,attribute_name=none,source=agent");
+                    }
+                }
+
+                // Set the IPv4 on interface array
+
+                strcpy(ip, txtaddr);
+
+                snprintf(name, sizeof(name), "ipv4[%s]", CanonifyName(ifa->ifa_name));
+
+                EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, name, ip, CF_DATA_TYPE_STRING, "source=agent");
+
+                // generate the reverse mapping
+                snprintf(name, sizeof(name), "ip2iface[%s]", txtaddr);
+
+                EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, name, CanonifyName(ifa->ifa_name), CF_DATA_TYPE_STRING, "source=agent");
+
+                i = 3;
+
+                for (sp = ip + strlen(ip) - 1; (sp > ip); sp--)
+                {
+                    if (*sp == '.')
+                    {
+                        *sp = '\0';
+
+                        snprintf(name, sizeof(name), "ipv4_%d[%s]", i--, CanonifyName(ifa->ifa_name));
+
+                        EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, name, ip, CF_DATA_TYPE_STRING, "source=agent");
+                    }
+                }
+            }
+        }
+        else if (ifa->ifa_addr->sa_family == AF_INET6)
+        {
+            char txtaddr[CF_MAX_IP_LEN] = "";
+
+            getnameinfo(ifa->ifa_addr, sizeof(struct sockaddr_in6),
+                        txtaddr, sizeof(txtaddr),
+                        NULL, 0, NI_NUMERICHOST);
+
+            /* Strip the scope suffix from link-local addresses, the ifconfig
+             * parsing never saw one. */
+            sp = strchr(txtaddr, '%');
+            if (sp != NULL)
+            {
+                *sp = '\0';
+            }
+
+            if ((IsIPV6Address(txtaddr)) && ((strcmp(txtaddr, "::1") != 0)))
+            {
+                char prefixed_ip[CF_MAX_IP_LEN + sizeof(IPV6_PREFIX)] = {0};
+                Log(LOG_LEVEL_VERBOSE, "Found IPv6 address %s", txtaddr);
+
+                EvalContextAddIpAddress(ctx, txtaddr, ifa->ifa_name);
+                EvalContextClassPutHard(ctx, txtaddr,
+                                        "inventory,attribute_name=none,source=agent");
+
+                xsnprintf(prefixed_ip, sizeof(prefixed_ip),
+                          IPV6_PREFIX "%s", txtaddr);
+                EvalContextClassPutHard(ctx, prefixed_ip,
+                                        "inventory,attribute_name=none,source=agent");
+
+                // Add IPv6 address to sys.ip_addresses
+                RlistAppendString(ips, txtaddr);
+
+                if (!RlistContainsString(*interfaces, ifa->ifa_name))
+                {
+                    RlistAppendString(interfaces, ifa->ifa_name);
+                }
+            }
+        }
+#if defined(AF_LINK)
+        else if (ifa->ifa_addr->sa_family == AF_LINK)
+        {
+            struct sockaddr_dl *sdl = (struct sockaddr_dl *) ifa->ifa_addr;
+            GetMacAddressIfaddrs(ctx, ifa, (const unsigned char *) LLADDR(sdl),
+                                 interfaces, hardware);
+        }
+#elif defined(AF_PACKET)
+        else if (ifa->ifa_addr->sa_family == AF_PACKET)
+        {
+            struct sockaddr_ll *sll = (struct sockaddr_ll *) ifa->ifa_addr;
+            GetMacAddressIfaddrs(ctx, ifa, (const unsigned char *) sll->sll_addr,
+                                 interfaces, hardware);
+        }
+#endif
+    }
+
+    freeifaddrs(ifaddr);
+
+    return true;
+}
+
+#endif /* USE_GETIFADDRS_DISCOVERY */
+
+static void GetInterfacesInfoIoctl(EvalContext *ctx, Rlist **interfaces,
+                                   Rlist **hardware, Rlist **flags,
+                                   Rlist **ips)
 {
     bool address_set = false;
     int fd, len, i, j;
@@ -382,16 +651,9 @@ void GetInterfacesInfo(EvalContext *ctx)
     char *sp, workbuf[CF_BUFSIZE];
     char ip[CF_MAXVARSIZE];
     char name[CF_MAXVARSIZE];
-    Rlist *interfaces = NULL, *hardware = NULL, *flags = NULL, *ips = NULL;
-
-    /* This function may be called many times, while interfaces come and go */
-    /* TODO cache results for non-daemon processes? */
-    EvalContextDeleteIpAddresses(ctx);
 
     memset(ifbuf, 0, sizeof(ifbuf));
 
-    InitIgnoreInterfaces();
-
     if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
     {
         Log(LOG_LEVEL_ERR, "Couldn't open socket. (socket: %s)", GetErrorStr());
@@ -477,7 +739,7 @@ void GetInterfacesInfo(EvalContext *ctx)
             }
             else
             {
-              GetInterfaceFlags(ctx, &ifr, &flags);
+              GetInterfaceFlags(ctx, ifr.ifr_name, ifr.ifr_flags, flags);
             }
 
             if (ifr.ifr_flags & IFF_UP)
@@ -510,7 +772,7 @@ void GetInterfacesInfo(EvalContext *ctx)
                     strcpy(ip, "ipv4_");
                     strcat(ip, VIPADDRESS);
                     EvalContextAddIpAddress(ctx, VIPADDRESS, NULL); // we don't know the interface
-                    RlistAppendScalar(&ips, VIPADDRESS);
+                    RlistAppendScalar(ips, VIPADDRESS);
 
                     for (sp = ip + strlen(ip) - 1; (sp > ip); sp--)
                     {
@@ -556,7 +818,7 @@ void GetInterfacesInfo(EvalContext *ctx)
                 }
 
                 EvalContextAddIpAddress(ctx, txtaddr, CanonifyName(ifp->ifr_name));
-                RlistAppendScalar(&ips, txtaddr);
+                RlistAppendScalar(ips, txtaddr);
 
                 for (sp = ip + strlen(ip) - 1; (sp > ip); sp--)
                 {
@@ -596,13 +858,32 @@ void GetInterfacesInfo(EvalContext *ctx)
             }
 
             // Set the hardware/mac address array
-            GetMacAddress(ctx, fd, &ifr, ifp, &interfaces, &hardware);
+            GetMacAddress(ctx, fd, &ifr, ifp, interfaces, hardware);
         }
     }
 
     close(fd);
+}
 
-    FindV6InterfacesInfo(ctx, &interfaces, &hardware, &ips);
+void GetInterfacesInfo(EvalContext *ctx)
+{
+    Rlist *interfaces = NULL, *hardware = NULL, *flags = NULL, *ips = NULL;
+
+    /* This function may be called many times, while interfaces come and go */
+    /* TODO cache results for non-daemon processes? */
+    EvalContextDeleteIpAddresses(ctx);
+
+    InitIgnoreInterfaces();
+
+    bool done = false;
+#if USE_GETIFADDRS_DISCOVERY
+    done = GetInterfacesInfoIfaddrs(ctx, &interfaces, &hardware, &flags, &ips);
+#endif
+    if (!done)
+    {
+        GetInterfacesInfoIoctl(ctx, &interfaces, &hardware, &flags, &ips);
+        FindV6InterfacesInfo(ctx, &interfaces, &hardware, &ips);
+    }
 
     if (interfaces)
     {
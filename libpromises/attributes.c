@@ -39,6 +39,58 @@
 static FilePerms GetPermissionConstraints(const EvalContext *ctx, const Promise *pp);
 static TransactionContext GetTransactionConstraints(const EvalContext *ctx, const Promise *pp);
 
+/**
+ * Every Get*Attributes() call runs GetTransactionConstraints() and
+ * GetClassDefinitionConstraints(), yet the vast majority of promises carry
+ * neither an action nor a classes body.  For those the results are pure
+ * defaults, so instead of performing a dozen constraint lookups each we
+ * start from a prebuilt constant image and only patch in the fields that
+ * depend on run-time state.  The images below must mirror what the
+ * functions produce for a promise without the relevant constraints.
+ */
+
+static const TransactionContext DEFAULT_TRANSACTION_CONTEXT =
+{
+    .action = cfa_fix,
+    /* ifelapsed/expireafter come from body common control and are patched
+     * in at copy time. */
+    .log_priority = 3,            /* SyslogPriorityFromString(NULL): error */
+    .log_level = LOG_LEVEL_ERR,   /* ActionAttributeLogLevelFromString(NULL) */
+    .report_level = LOG_LEVEL_ERR,
+};
+
+static const DefineClasses DEFAULT_DEFINE_CLASSES =
+{
+    .scope = CONTEXT_SCOPE_NONE,          /* ContextScopeFromString(NULL) */
+    .timer = CONTEXT_STATE_POLICY_RESET,
+};
+
+/* Lvals that influence GetTransactionConstraints(). */
+static const char *const TRANSACTION_LVALS[] =
+{
+    "action_policy", "background", "ifelapsed", "expireafter", "audit",
+    "log_string", "log_priority", "log_kept", "log_repaired", "log_failed",
+    "log_level", "report_level", "measurement_class", NULL
+};
+
+static bool PromiseHasAnyConstraintOf(const Promise *pp,
+                                      const char *const lvals[])
+{
+    const size_t n = SeqLength(pp->conlist);
+    for (size_t i = 0; i < n; i++)
+    {
+        const Constraint *cp = SeqAt(pp->conlist, i);
+        for (size_t j = 0; lvals[j] != NULL; j++)
+        {
+            if (strcmp(cp->lval, lvals[j]) == 0)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 void ClearFilesAttributes(Attributes *whom)
 {
     UidListDestroy(whom->perms.owners);
@@ -341,6 +393,8 @@ Attributes GetMethodAttributes(const EvalContext *ctx, const Promise *pp)
 
     attr.inherit = PromiseGetConstraintAsBoolean(ctx, "inherit", pp);
 
+    attr.cache_method = PromiseGetConstraintAsBoolean(ctx, "cache_method", pp);
+
 /* Common ("included") */
 
     attr.havetrans = PromiseGetConstraintAsBoolean(ctx, CF_TRANSACTION, pp);
@@ -453,6 +507,7 @@ DirectoryRecursion GetRecursionConstraints(const EvalContext *ctx, const Promise
     r.include_dirs = PromiseGetConstraintAsList(ctx, "include_dirs", pp);
     r.exclude_dirs = PromiseGetConstraintAsList(ctx, "exclude_dirs", pp);
     r.include_basedir = PromiseGetConstraintAsBoolean(ctx, "include_basedir", pp);
+    r.monitor = PromiseGetConstraintAsBoolean(ctx, "monitor", pp);
     return r;
 }
 
@@ -671,6 +726,14 @@ static TransactionContext GetTransactionConstraints(const EvalContext *ctx, cons
     TransactionContext t;
     char *value;
 
+    if (!PromiseHasAnyConstraintOf(pp, TRANSACTION_LVALS))
+    {
+        t = DEFAULT_TRANSACTION_CONTEXT;
+        t.ifelapsed = VIFELAPSED;
+        t.expireafter = VEXPIREAFTER;
+        return t;
+    }
+
     value = PromiseGetConstraintAsRval(pp, "action_policy", RVAL_TYPE_SCALAR);
 
     if (value && ((strcmp(value, "warn") == 0) || (strcmp(value, "nop") == 0)))
@@ -771,6 +834,20 @@ DefineClasses GetClassDefinitionConstraints(const EvalContext *ctx, const Promis
     DefineClasses c;
     char *pt = NULL;
 
+    {
+        bool has_classes_body = false;
+        const size_t n = SeqLength(pp->conlist);
+        for (size_t i = 0; i < n && !has_classes_body; i++)
+        {
+            const Constraint *cp = SeqAt(pp->conlist, i);
+            has_classes_body = IsClassesBodyConstraint(cp->lval);
+        }
+        if (!has_classes_body)
+        {
+            return DEFAULT_DEFINE_CLASSES;
+        }
+    }
+
     {
         const char *context_scope = PromiseGetConstraintAsRval(pp, "scope", RVAL_TYPE_SCALAR);
         c.scope = ContextScopeFromString(context_scope);
@@ -1031,6 +1108,7 @@ FileCopy GetCopyConstraints(const EvalContext *ctx, const Promise *pp)
     f.verify = PromiseGetConstraintAsBoolean(ctx, "verify", pp);
     f.purge = PromiseGetConstraintAsBoolean(ctx, "purge", pp);
     f.missing_ok = PromiseGetConstraintAsBoolean(ctx, "missing_ok", pp);
+    f.tree_digest_check = PromiseGetConstraintAsBoolean(ctx, "tree_digest_check", pp);
     f.destination = NULL;
 
     return f;
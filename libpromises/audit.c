@@ -23,10 +23,13 @@
 */
 
 #include <audit.h>
+#include <run_record.h>                                  /* RunRecordCommit */
 #include <misc_lib.h>
 #include <conversion.h>
 #include <logging.h>
 #include <string_lib.h>
+#include <sequence.h>
+#include <file_lib.h>           /* safe_fopen() */
 #include <cleanup.h>
 
 int PR_KEPT = 0; /* GLOBAL_X */
@@ -40,6 +43,138 @@ void BeginAudit()
     END_AUDIT_REQUIRED = true;
 }
 
+/* Group-committed sink for the per-promise private logs (the log_kept /
+ * log_repaired / log_failed transaction attributes).  The old path opened,
+ * appended one record to, and closed the log file for every single promise,
+ * which is what made full audit mode so expensive on policies that log
+ * everything.  Records are now accumulated in the stdio buffer of a stream
+ * that stays open per log file for the rest of the run, and committed in
+ * batches: AuditLogFlush() pushes all buffered records out and fsyncs each
+ * file, so after a crash every log holds a prefix of whole records.  Should
+ * an earlier crash have left a record cut off mid-write, it is repaired on
+ * open by terminating it with a newline so it cannot run into the record
+ * appended after it. */
+
+typedef struct
+{
+    char *logname;
+    FILE *stream;
+} AuditLog;
+
+static Seq *audit_logs = NULL; /* GLOBAL_X */
+
+static void AuditLogClose(void *entry)
+{
+    AuditLog *log = entry;
+
+    fclose(log->stream);
+    free(log->logname);
+    free(log);
+}
+
+static void AuditLogShutdown(void)
+{
+    if (audit_logs != NULL)
+    {
+        AuditLogFlush();
+        SeqDestroy(audit_logs);
+        audit_logs = NULL;
+    }
+}
+
+/* Terminate a record that a crash left without its trailing newline. */
+static void AuditLogRepairTail(int fd)
+{
+    struct stat sb;
+    char last;
+
+    if ((fstat(fd, &sb) == 0) && (sb.st_size > 0) &&
+        (pread(fd, &last, 1, sb.st_size - 1) == 1) && (last != '\n'))
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Repairing incomplete trailing record in private log");
+        if (write(fd, "\n", 1) != 1)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to repair private log. (write: %s)",
+                GetErrorStr());
+        }
+    }
+}
+
+bool AuditLogAppend(const char *logname, const char *record)
+{
+    if (audit_logs == NULL)
+    {
+        audit_logs = SeqNew(4, AuditLogClose);
+        RegisterCleanupFunction(AuditLogShutdown);
+    }
+
+    AuditLog *log = NULL;
+    const size_t n_logs = SeqLength(audit_logs);
+    for (size_t i = 0; i < n_logs; i++)
+    {
+        AuditLog *candidate = SeqAt(audit_logs, i);
+        if (StringEqual(candidate->logname, logname))
+        {
+            log = candidate;
+            break;
+        }
+    }
+
+    if (log == NULL)
+    {
+        struct stat dsb;
+
+        // Does the file exist already?
+        if (lstat(logname, &dsb) == -1)
+        {
+            mode_t filemode = 0600;     /* Mode for log file creation */
+            int fd = creat(logname, filemode);
+            if (fd >= 0)
+            {
+                Log(LOG_LEVEL_VERBOSE,
+                    "Created log file '%s' with requested permissions %jo",
+                    logname, (intmax_t) filemode);
+                close(fd);
+            }
+        }
+
+        FILE *stream = safe_fopen(logname, "a");
+        if (stream == NULL)
+        {
+            return false;
+        }
+        AuditLogRepairTail(fileno(stream));
+
+        log = xmalloc(sizeof(AuditLog));
+        log->logname = xstrdup(logname);
+        log->stream = stream;
+        SeqAppend(audit_logs, log);
+    }
+
+    fprintf(log->stream, "%s\n", record);
+    return true;
+}
+
+void AuditLogFlush(void)
+{
+    if (audit_logs == NULL)
+    {
+        return;
+    }
+
+    const size_t n_logs = SeqLength(audit_logs);
+    for (size_t i = 0; i < n_logs; i++)
+    {
+        AuditLog *log = SeqAt(audit_logs, i);
+        if ((fflush(log->stream) != 0) || (fsync(fileno(log->stream)) != 0))
+        {
+            Log(LOG_LEVEL_ERR, "Failed to commit private log '%s'. (%s)",
+                log->logname, GetErrorStr());
+        }
+    }
+}
+
 void UpdatePromiseCounters(PromiseResult status)
 {
     switch (status)
@@ -67,11 +202,17 @@ void UpdatePromiseCounters(PromiseResult status)
 
 void EndAudit(const EvalContext *ctx, int background_tasks)
 {
+    /* Commit this run's batch of private log records. */
+    AuditLogFlush();
+
     if (!END_AUDIT_REQUIRED)
     {
         return;
     }
 
+    /* Write this run's columnar promise outcome records. */
+    RunRecordCommit();
+
     double total = (double) (PR_KEPT + PR_NOTKEPT + PR_REPAIRED) / 100.0;
 
     const char *version = EvalContextVariableControlCommonGet(ctx, COMMON_CONTROL_VERSION);
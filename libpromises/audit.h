@@ -39,6 +39,17 @@ void UpdatePromiseCounters(PromiseResult status);
 
 void EndAudit(const EvalContext *ctx, int background_tasks);
 
+/**
+ * Append a record to a private (promise-level) log file.  Records are
+ * buffered and group-committed by AuditLogFlush() / process cleanup rather
+ * than being written and synced one at a time.
+ *
+ * @return false if the log file could not be opened
+ */
+bool AuditLogAppend(const char *logname, const char *record);
+
+void AuditLogFlush(void);
+
 /*
  * FatalError causes EndAudit, so don't call it from the low-memory or corrupted stack situations.
  */
@@ -39,6 +39,7 @@
 #include <addr_lib.h>
 #include <communication.h>
 #include <client_code.h>
+#include <protocol.h>                         /* ProtocolPolicyBundleFetch */
 #include <assert.h>
 #include <crypto.h>
 #include <openssl/rand.h>
@@ -353,6 +354,47 @@ bool MasterfileExists(const char *masterdir)
     return true;
 }
 
+/**
+ * @brief Fetches the policy server's masterfiles into \p inputdir in a single
+ *        round trip, so the first failsafe run starts from a warm copy.
+ *
+ * The connection performs the usual trust establishment (honouring \p
+ * trust_server just like the failsafe run will), then issues one
+ * POLICYBUNDLE request instead of a per-file copy. The fetch is purely
+ * advisory: the failsafe policy update that follows remains authoritative,
+ * so any failure here only costs the shortcut.
+ *
+ * @return True if the bundle was fetched, false otherwise (not fatal)
+ */
+bool BootstrapPrefetchPolicy(const char *policy_server, const char *inputdir,
+                             bool trust_server)
+{
+    assert(policy_server != NULL);
+    assert(inputdir != NULL);
+
+    ConnectionFlags connflags = {
+        .protocol_version = CF_PROTOCOL_LATEST,
+        .trust_server = trust_server,
+    };
+    int err = 0;
+    AgentConnection *conn = ServerConnection(policy_server, CFENGINE_PORT_STR,
+                                             NULL, CONNTIMEOUT, connflags,
+                                             &err);
+    if (conn == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Could not connect to '%s' for policy prefetch (error %d)",
+            policy_server, err);
+        return false;
+    }
+
+    const bool fetched = ProtocolPolicyBundleFetch(conn, "masterfiles",
+                                                   inputdir);
+    DisconnectServer(conn);
+
+    return fetched;
+}
+
 static char *BootstrapIDFilename(const char *workdir)
 {
     assert(workdir != NULL);
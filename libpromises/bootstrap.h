@@ -43,6 +43,8 @@ bool WriteBuiltinFailsafePolicyToPath(const char *filename);
 // POLICY FILE FUNCTIONS:
 bool RemoveAllExistingPolicyInInputs(const char *inputdir);
 bool MasterfileExists(const char *masterdir);
+bool BootstrapPrefetchPolicy(const char *policy_server, const char *inputdir,
+                             bool trust_server);
 
 // BOOTSTRAP ID FUNCTIONS:
 char *CreateBootstrapIDFile(const char *workdir);
@@ -51,6 +51,22 @@
 /* Various defines                                                 */
 /*******************************************************************/
 
+/* Log() evaluates its format arguments before the level filter inside the
+ * logging module gets a say. That is fine for one-off messages, but in hot
+ * loops (per directory entry, per promise iteration) arguments that are
+ * themselves function calls get computed just to be thrown away. LogLazy()
+ * checks the level first, so the arguments are only evaluated when the
+ * message will actually be emitted. Use it where the arguments do real work;
+ * plain Log() stays the default everywhere else. */
+#define LogLazy(level, ...)                     \
+    do                                          \
+    {                                           \
+        if (WouldLog(level))                    \
+        {                                       \
+            Log(level, __VA_ARGS__);            \
+        }                                       \
+    } while (0)
+
 #define CF_MAXFRAGMENT 19       /* abbreviate long promise names to 2*MAXFRAGMENT+3 */
 #define CF_NONCELEN (CF_BUFSIZE/16)
 #define CF_MAXLINKSIZE 256
@@ -100,6 +116,7 @@
 #define CF_ENV_FILE      "env_data"
 
 #define CF_DB_REPAIR_TRIGGER "db_repair_required"
+#define CF_DB_JOURNAL_TRIGGER "db_journal_enabled"
 
 #define CF_SAVED ".cfsaved"
 #define CF_EDITED ".cfedited"
@@ -440,6 +457,7 @@ typedef enum
     COMMON_CONTROL_PACKAGE_INVENTORY,
     COMMON_CONTROL_PACKAGE_MODULE,
     COMMON_CONTROL_EVALUATION_ORDER,
+    COMMON_CONTROL_STARTUP_DNS_RESOLUTION,
     COMMON_CONTROL_MAX
 } CommonControl;
 
@@ -495,6 +513,10 @@ typedef enum
     AGENT_CONTROL_COPYFROM_RESTRICT_KEYS,
     AGENT_CONTROL_EVALUATION_ORDER,
     AGENT_CONTROL_DEFAULT_DIRECTORY_CREATE_MODE,
+    AGENT_CONTROL_PROFILE,
+    AGENT_CONTROL_MEMORY_BUDGET,
+    AGENT_CONTROL_BUNDLE_TIME_BUDGET,
+    AGENT_CONTROL_FS_OPERATION_TIMEOUT,
     AGENT_CONTROL_NONE
 } AgentControl;
 
@@ -924,6 +946,7 @@ typedef struct
     int depth;
     int xdev;
     int include_basedir;
+    int monitor;
     Rlist *include_dirs;
     Rlist *exclude_dirs;
 } DirectoryRecursion;
@@ -1379,6 +1402,9 @@ typedef struct
     int updates_ifelapsed;
     int installed_ifelapsed;
     Rlist *options;
+    Rlist *installed_state_files; /* package manager state files whose
+                                   * modification invalidates the cached
+                                   * installed-package list */
     char *interpreter;
     char *module_path;
 } PackageModuleBody;
@@ -1545,6 +1571,7 @@ typedef struct
     short timeout;
     ProtocolVersion protocol_version;
     bool missing_ok;
+    bool tree_digest_check;
 } FileCopy;
 
 typedef struct
@@ -1580,6 +1607,7 @@ typedef struct
     int create;
     int move_obstructions;
     int inherit;
+    int cache_method;
 
     DirectoryRecursion recursion;
     TransactionContext transaction;
@@ -636,8 +636,13 @@ static inline void MagicRvalTransformations(
 
 static inline void ParserAppendCurrentConstraint()
 {
+    bool rval_interned;
     Constraint *cp = PromiseAppendConstraint(
-        P.currentpromise, P.lval, RvalCopy(P.rval), P.references_body);
+        P.currentpromise,
+        P.lval,
+        RvalCopyHashConsed(P.lval, P.rval, &rval_interned),
+        P.references_body);
+    cp->rval_interned = rval_interned;
     cp->offset.line = P.line_no;
     cp->offset.start = P.offsets.last_id;
     cp->offset.end = P.offsets.current;
@@ -944,12 +949,14 @@ static inline void ParserHandleBlockAttributeRval()
             case SYNTAX_STATUS_CUSTOM:
             {
                 Constraint *cp = NULL;
+                bool rval_interned;
+                Rval rval_copy = RvalCopyHashConsed(P.lval, P.rval, &rval_interned);
                 if (P.currentclasses == NULL)
                 {
                     cp = BodyAppendConstraint(
                         P.currentbody,
                         P.lval,
-                        RvalCopy(P.rval),
+                        rval_copy,
                         "any",
                         P.references_body);
                 }
@@ -958,10 +965,11 @@ static inline void ParserHandleBlockAttributeRval()
                     cp = BodyAppendConstraint(
                         P.currentbody,
                         P.lval,
-                        RvalCopy(P.rval),
+                        rval_copy,
                         P.currentclasses,
                         P.references_body);
                 }
+                cp->rval_interned = rval_interned;
 
                 if (P.currentvarclasses != NULL)
                 {
@@ -35,6 +35,11 @@
 #include <string_sequence.h>    /* WriteLenPrefixedString() */
 #include <writer.h>             /* FileWriter(), Writer */
 #include <csv_writer.h>         /* CsvWriter */
+#include <set.h>                /* StringSet */
+
+#ifdef __linux__
+#include <sys/mount.h>          /* mount(), umount2() */
+#endif
 
 #include <changes_chroot.h>
 
@@ -162,6 +167,99 @@ static void ChrootSymlinkDeep(const char *path, const char *chrooted_path, struc
 }
 #endif  /* __MINGW32__ */
 
+#ifdef __linux__
+/* Overlayfs-backed directory preparation.
+ *
+ * Recursively copying a promised directory tree into the changes chroot can
+ * move gigabytes before the simulated run even starts.  When the kernel lets
+ * us mount (CAP_SYS_ADMIN), the chrooted directory is instead an overlay
+ * with the real directory as its read-only lower layer: nothing is
+ * materialized until the simulated run writes, at which point overlayfs
+ * copies up just the touched files.  The mounts are recorded so that
+ * UnmountChangesChrootOverlays() can take them down before the chroot is
+ * deleted -- removing files through the mount would only produce whiteouts
+ * in the upper layer.  Any failure falls back to the recursive copy. */
+
+static StringSet *chroot_overlay_mounts = NULL; /* GLOBAL_X */
+
+static bool OverlayDirToChroot(const char *path, const char *chrooted)
+{
+    /* The mount option string cannot represent these characters. */
+    if (strpbrk(path, ",:") != NULL || strpbrk(chrooted, ",:") != NULL)
+    {
+        return false;
+    }
+
+    char upper[PATH_MAX];
+    char work[PATH_MAX];
+    int ret = snprintf(upper, sizeof(upper), "%s.overlay-upper", chrooted);
+    if ((ret < 0) || ((size_t) ret >= sizeof(upper)))
+    {
+        return false;
+    }
+    ret = snprintf(work, sizeof(work), "%s.overlay-work", chrooted);
+    if ((ret < 0) || ((size_t) ret >= sizeof(work)))
+    {
+        return false;
+    }
+
+    if ((mkdir(upper, 0700) != 0) || (mkdir(work, 0700) != 0))
+    {
+        rmdir(upper);
+        return false;
+    }
+
+    char options[3 * PATH_MAX];
+    snprintf(options, sizeof(options), "lowerdir=%s,upperdir=%s,workdir=%s",
+             path, upper, work);
+
+    if (mount("overlay", chrooted, "overlay", 0, options) != 0)
+    {
+        Log(LOG_LEVEL_DEBUG,
+            "Could not prepare '%s' as an overlay of '%s' (mount: %s),"
+            " falling back to copying", chrooted, path, GetErrorStr());
+        rmdir(upper);
+        rmdir(work);
+        return false;
+    }
+
+    if (chroot_overlay_mounts == NULL)
+    {
+        chroot_overlay_mounts = StringSetNew();
+    }
+    StringSetAdd(chroot_overlay_mounts, xstrdup(chrooted));
+
+    Log(LOG_LEVEL_VERBOSE, "Prepared '%s' as an overlay of '%s'",
+        chrooted, path);
+    return true;
+}
+#endif  /* __linux__ */
+
+void UnmountChangesChrootOverlays(void)
+{
+#ifdef __linux__
+    if (chroot_overlay_mounts == NULL)
+    {
+        return;
+    }
+
+    StringSetIterator it = StringSetIteratorInit(chroot_overlay_mounts);
+    const char *mount_point;
+    while ((mount_point = StringSetIteratorNext(&it)) != NULL)
+    {
+        /* Lazy detach so that a straggler holding a file open cannot block
+         * the chroot deletion that follows. */
+        if (umount2(mount_point, MNT_DETACH) != 0)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to unmount changes chroot overlay '%s' (umount2: %s)",
+                mount_point, GetErrorStr());
+        }
+    }
+    StringSetDestroy(chroot_overlay_mounts);
+    chroot_overlay_mounts = NULL;
+#endif  /* __linux__ */
+}
+
 void PrepareChangesChroot(const char *path)
 {
     struct stat sb;
@@ -200,6 +298,14 @@ void PrepareChangesChroot(const char *path)
     if (S_ISDIR(sb.st_mode))
     {
         mkdir(chrooted, sb.st_mode);
+#ifdef __linux__
+        if (OverlayDirToChroot(path, chrooted))
+        {
+            /* The lower layer provides the contents and permissions. */
+            free(chrooted);
+            return;
+        }
+#endif
         Dir *dir = DirOpen(path);
         if (dir == NULL)
         {
@@ -31,6 +31,7 @@
 #define CHROOT_PKGS_OPS_FILE "/pkgs_ops"
 
 void PrepareChangesChroot(const char *path);
+void UnmountChangesChrootOverlays(void);
 bool RecordFileChangedInChroot(const char *path);
 bool RecordFileRenamedInChroot(const char *old_name, const char *new_name);
 bool RecordFileEvaluatedInChroot(const char *path);
@@ -29,6 +29,7 @@
 #include <string_lib.h>
 #include <known_dirs.h>         /* GetDataDir() */
 #include <var_expressions.h>    /* VarRef, StringContainsUnresolved() */
+#include <string_intern.h>      /* StringIntern() */
 #include <eval_context.h>       /* EvalContext*() */
 #include <files_names.h>        /* JoinPaths() */
 
@@ -98,7 +99,8 @@ static VarRef *GetCMDBVariableRef(const char *key)
     VarRef *ref = VarRefParse(key);
     if (ref->ns == NULL)
     {
-        ref->ns = xstrdup(CMDB_NAMESPACE);
+        ref->ns = (char *) StringIntern(CMDB_NAMESPACE);
+        ref->hash = 0;
     }
     else
     {
@@ -113,7 +115,8 @@ static VarRef *GetCMDBVariableRef(const char *key)
 
     if (ref->scope == NULL)
     {
-        ref->scope = xstrdup("variables");
+        ref->scope = (char *) StringIntern("variables");
+        ref->hash = 0;
     }
     return ref;
 }
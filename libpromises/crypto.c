@@ -34,6 +34,7 @@
 
 #include <cf3.defs.h>
 #include <lastseen.h>
+#include <map.h>
 #include <files_interfaces.h>
 #include <hash.h>
 #include <pipes.h>
@@ -361,6 +362,83 @@ RSA *HavePublicKeyByIP(const char *username, const char *ipaddress)
 
 static const char *const pub_passphrase = "public";
 
+/* Cache of parsed public keys, keyed by "username-digest".  On hubs with
+ * tens of thousands of known hosts, the stat() + PEM parse that every
+ * incoming connection's trust check performs shows up in profiles.  Entries
+ * are validated against the key file's current size and mtime on every hit,
+ * so key removal ('cf-key -r') and replacement are honoured at the cost of
+ * a single stat(). */
+
+typedef struct
+{
+    RSA *key;
+    time_t mtime;
+    off_t size;
+} CachedPublicKey;
+
+static Map *public_key_cache = NULL; /* GLOBAL_X */
+static pthread_mutex_t public_key_cache_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+static void CachedPublicKeyDestroy_untyped(void *entry)
+{
+    CachedPublicKey *cached = entry;
+    RSA_free(cached->key);
+    free(cached);
+}
+
+/**
+ * @return a copy of the cached key (owned by the caller), or NULL if the
+ *         key is not cached or the file changed since it was cached
+ */
+static RSA *PublicKeyCacheGet(const char *keyname, const struct stat *sb)
+{
+    RSA *key = NULL;
+
+    ThreadLock(&public_key_cache_lock);
+    if (public_key_cache != NULL)
+    {
+        CachedPublicKey *cached = MapGet(public_key_cache, (void *) keyname);
+        if (cached != NULL)
+        {
+            if ((cached->mtime == sb->st_mtime) && (cached->size == sb->st_size))
+            {
+                key = RSAPublicKey_dup(cached->key);
+            }
+            else
+            {
+                /* stale, force a re-read */
+                MapRemove(public_key_cache, (void *) keyname);
+            }
+        }
+    }
+    ThreadUnlock(&public_key_cache_lock);
+
+    return key;
+}
+
+static void PublicKeyCachePut(const char *keyname, const RSA *key, const struct stat *sb)
+{
+    RSA *copy = RSAPublicKey_dup((RSA *) key);
+    if (copy == NULL)
+    {
+        return;
+    }
+
+    CachedPublicKey *cached = xmalloc(sizeof(CachedPublicKey));
+    cached->key = copy;
+    cached->mtime = sb->st_mtime;
+    cached->size = sb->st_size;
+
+    ThreadLock(&public_key_cache_lock);
+    if (public_key_cache == NULL)
+    {
+        public_key_cache = MapNew(StringHash_untyped, StringEqual_untyped,
+                                  free, CachedPublicKeyDestroy_untyped);
+    }
+    MapInsert(public_key_cache, xstrdup(keyname), cached);
+    ThreadUnlock(&public_key_cache_lock);
+}
+
 /**
  * @brief Search for a key:
  *        1. username-hash.pub
@@ -379,7 +457,16 @@ RSA *HavePublicKey(const char *username, const char *ipaddress, const char *dige
     snprintf(newname, CF_BUFSIZE, "%s/ppkeys/%s.pub", workdir, keyname);
     MapName(newname);
 
-    if (stat(newname, &statbuf) == -1)
+    if (stat(newname, &statbuf) != -1)
+    {
+        RSA *cached = PublicKeyCacheGet(keyname, &statbuf);
+        if (cached != NULL)
+        {
+            Log(LOG_LEVEL_DEBUG, "Found public key '%s' in cache", keyname);
+            return cached;
+        }
+    }
+    else
     {
         Log(LOG_LEVEL_VERBOSE, "Did not find new key format '%s'", newname);
 
@@ -447,6 +534,11 @@ RSA *HavePublicKey(const char *username, const char *ipaddress, const char *dige
         }
     }
 
+    if (strlen(digest) > 0)
+    {
+        PublicKeyCachePut(keyname, newkey, &statbuf);
+    }
+
     return newkey;
 }
 
@@ -626,6 +718,79 @@ bool TrustKey(const char *filename, const char *ipaddress, const char *username)
     return ret;
 }
 
+/* Classic-protocol connections encrypt every transaction with the same
+ * session key, but allocating a fresh cipher context and redoing the key
+ * schedule per call is pure overhead on that path. Each connection is served
+ * by a single thread, so a thread-local cache of the initialized context
+ * gives per-connection reuse: when cipher and key match the previous call
+ * only the IV is reset (EVP_*Init_ex with NULL cipher/key), keeping the key
+ * schedule and leaving OpenSSL's hardware-dispatched (e.g. AES-NI) code
+ * paths free of per-transaction setup cost. */
+typedef struct
+{
+    EVP_CIPHER_CTX *ctx;
+    char type;
+    int key_len;
+    unsigned char key[EVP_MAX_KEY_LENGTH];
+} CachedCipherCtx;
+
+static __thread CachedCipherCtx cached_encrypt_ctx; /* GLOBAL_X, thread-local */
+static __thread CachedCipherCtx cached_decrypt_ctx; /* GLOBAL_X, thread-local */
+
+static EVP_CIPHER_CTX *CipherCtxGet(CachedCipherCtx *cache, bool encrypt,
+                                    char type, const unsigned char *key,
+                                    const unsigned char *iv)
+{
+    const EVP_CIPHER *cipher = CfengineCipher(type);
+    const int key_len = EVP_CIPHER_key_length(cipher);
+    assert(key_len <= EVP_MAX_KEY_LENGTH);
+
+    if (cache->ctx != NULL && cache->type == type &&
+        cache->key_len == key_len && memcmp(cache->key, key, key_len) == 0)
+    {
+        /* Same cipher and key as the previous transaction on this thread:
+         * just reset the IV, keeping the key schedule. */
+        int ret = encrypt
+            ? EVP_EncryptInit_ex(cache->ctx, NULL, NULL, NULL, iv)
+            : EVP_DecryptInit_ex(cache->ctx, NULL, NULL, NULL, iv);
+        if (ret == 1)
+        {
+            return cache->ctx;
+        }
+        /* fall through to a full re-initialization */
+    }
+
+    if (cache->ctx == NULL)
+    {
+        cache->ctx = EVP_CIPHER_CTX_new();
+        if (cache->ctx == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    int ret = encrypt
+        ? EVP_EncryptInit_ex(cache->ctx, cipher, NULL, key, iv)
+        : EVP_DecryptInit_ex(cache->ctx, cipher, NULL, key, iv);
+    if (ret != 1)
+    {
+        DESTROY_AND_NULL(EVP_CIPHER_CTX_free, cache->ctx);
+        return NULL;
+    }
+
+    cache->type = type;
+    cache->key_len = key_len;
+    memcpy(cache->key, key, key_len);
+    return cache->ctx;
+}
+
+/* A failed EVP operation may leave the context in an undefined state, so
+ * drop it rather than reusing it for the next transaction. */
+static void CipherCtxInvalidate(CachedCipherCtx *cache)
+{
+    DESTROY_AND_NULL(EVP_CIPHER_CTX_free, cache->ctx);
+}
+
 int EncryptString(char *out, size_t out_size, const char *in, int plainlen,
                   char type, unsigned char *key)
 {
@@ -644,18 +809,24 @@ int EncryptString(char *out, size_t out_size, const char *in, int plainlen,
                           max_ciphertext_size, out_size);
     }
 
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    EVP_EncryptInit_ex(ctx, CfengineCipher(type), NULL, key, iv);
+    EVP_CIPHER_CTX *ctx = CipherCtxGet(&cached_encrypt_ctx, true,
+                                       type, key, iv);
+    if (ctx == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to initialize cipher context. (EVP_EncryptInit_ex: %s)",
+            CryptoLastErrorString());
+        return -1;
+    }
 
     if (!EVP_EncryptUpdate(ctx, out, &cipherlen, in, plainlen))
     {
-        EVP_CIPHER_CTX_free(ctx);
+        CipherCtxInvalidate(&cached_encrypt_ctx);
         return -1;
     }
 
     if (!EVP_EncryptFinal_ex(ctx, out + cipherlen, &tmplen))
     {
-        EVP_CIPHER_CTX_free(ctx);
+        CipherCtxInvalidate(&cached_encrypt_ctx);
         return -1;
     }
 
@@ -671,7 +842,6 @@ int EncryptString(char *out, size_t out_size, const char *in, int plainlen,
                           cipherlen, max_ciphertext_size);
     }
 
-    EVP_CIPHER_CTX_free(ctx);
     return cipherlen;
 }
 
@@ -730,13 +900,19 @@ int DecryptString(char *out, size_t out_size, const char *in, int cipherlen,
                           max_plaintext_size, out_size);
     }
 
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    EVP_DecryptInit_ex(ctx, CfengineCipher(type), NULL, key, iv);
+    EVP_CIPHER_CTX *ctx = CipherCtxGet(&cached_decrypt_ctx, false,
+                                       type, key, iv);
+    if (ctx == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to initialize cipher context. (EVP_DecryptInit_ex: %s)",
+            CryptoLastErrorString());
+        return -1;
+    }
 
     if (!EVP_DecryptUpdate(ctx, out, &plainlen, in, cipherlen))
     {
         Log(LOG_LEVEL_ERR, "Failed to decrypt string");
-        EVP_CIPHER_CTX_free(ctx);
+        CipherCtxInvalidate(&cached_decrypt_ctx);
         return -1;
     }
 
@@ -745,7 +921,7 @@ int DecryptString(char *out, size_t out_size, const char *in, int cipherlen,
         unsigned long err = ERR_get_error();
 
         Log(LOG_LEVEL_ERR, "Failed to decrypt at final of cipher length %d. (EVP_DecryptFinal_ex: %s)", cipherlen, ERR_error_string(err, NULL));
-        EVP_CIPHER_CTX_free(ctx);
+        CipherCtxInvalidate(&cached_decrypt_ctx);
         return -1;
     }
 
@@ -761,7 +937,6 @@ int DecryptString(char *out, size_t out_size, const char *in, int cipherlen,
                           plainlen, max_plaintext_size);
     }
 
-    EVP_CIPHER_CTX_free(ctx);
     return plainlen;
 }
 
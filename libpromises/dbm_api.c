@@ -120,6 +120,9 @@ static const char *const DB_PATHS_STATEDIR[] = {
     [dbid_packages_installed] = "packages_installed",
     [dbid_packages_updates] = "packages_updates",
     [dbid_cookies] = "nova_cookies",
+    [dbid_copy_digests] = "copy_digests",
+    [dbid_class_diff] = "class_diff",
+    [dbid_hostname] = "hostname_cache",
 };
 
 /*
@@ -336,6 +339,12 @@ void CloseDBInstance(DBHandle *handle)
     }
     else /* TODO: can we clean this up unconditionally ? */
     {
+        if (handle->priv != NULL)
+        {
+            /* Environment cached by CloseDB() past the last user. */
+            DBPrivCloseDB(handle->priv);
+            handle->priv = NULL;
+        }
         free(handle->filename);
         free(handle->subname);
         handle->filename = NULL;
@@ -378,9 +387,45 @@ void CloseAllDBExit()
     }
 }
 
+/**
+ * Forget cached (refcount == 0) database environments in a forked child.
+ *
+ * LMDB environments must not be used after fork(), so a child that goes on
+ * to call OpenDB() has to build its own. We only *forget* the inherited
+ * environments instead of closing them: the mappings are copy-on-write and
+ * the child either exec()s or exits shortly, while calling into LMDB here
+ * could touch lock state owned by the parent. Handles that are still in use
+ * (refcount > 0) at fork time are left alone, as before.
+ *
+ * @note Runs in the child right after fork(), where only the forking thread
+ *       exists; the handle mutexes may be held by threads that no longer
+ *       exist, so they are deliberately not taken.
+ */
+static void AbandonDBEnvironmentsAtFork(void)
+{
+    for (int i = 0; i < dbid_max; i++)
+    {
+        if (db_handles[i].refcount == 0 && db_handles[i].priv != NULL)
+        {
+            db_handles[i].priv = NULL;
+            db_handles[i].open_tstamp = -1;
+        }
+    }
+    for (DynamicDBHandles *dynamic = db_dynamic_handles;
+         dynamic != NULL; dynamic = dynamic->next)
+    {
+        if (dynamic->handle->refcount == 0 && dynamic->handle->priv != NULL)
+        {
+            dynamic->handle->priv = NULL;
+            dynamic->handle->open_tstamp = -1;
+        }
+    }
+}
+
 static void RegisterShutdownHandler(void)
 {
     RegisterCleanupFunction(&CloseAllDBExit);
+    pthread_atfork(NULL, NULL, &AbandonDBEnvironmentsAtFork);
 }
 
 /**
@@ -408,7 +453,15 @@ bool OpenDBInstance(DBHandle **dbp, dbid id, DBHandle *handle)
         ThreadUnlock(&handle->lock);
         return false;
     }
-    if (handle->refcount == 0)
+    if (handle->refcount == 0 && handle->priv != NULL)
+    {
+        /* Environment kept alive by CloseDB() after the last user left --
+         * skip the expensive setup (file lock, environment creation,
+         * migration) and just hand it out again. */
+        Log(LOG_LEVEL_DEBUG, "Reusing cached database environment '%s'",
+            handle->filename);
+    }
+    else if (handle->refcount == 0)
     {
         FileLock lock = EMPTY_FILE_LOCK;
         if (DBPathLock(&lock, handle->filename))
@@ -530,17 +583,15 @@ void CloseDB(DBHandle *handle)
     else
     {
         handle->refcount--;
-        if (handle->refcount == 0)
-        {
-            FileLock lock = EMPTY_FILE_LOCK;
-            bool locked = DBPathLock(&lock, handle->filename);
-            DBPrivCloseDB(handle->priv);
-            handle->open_tstamp = -1;
-            if (locked)
-            {
-                DBPathUnLock(&lock);
-            }
-        }
+
+        /* Deliberately keep handle->priv open when the refcount drops to
+         * zero: re-creating the LMDB environment costs tens of milliseconds
+         * per database, and agents cycle the locks and performance DBs many
+         * times per run. The cached environment is handed out again by
+         * OpenDBInstance(), dropped in forked children by
+         * AbandonDBEnvironmentsAtFork(), and finally closed by
+         * CloseAllDBExit(). open_tstamp intentionally keeps the first-open
+         * time, which is what the corruption-repair checks compare against. */
     }
 
     ThreadUnlock(&handle->lock);
@@ -645,6 +696,19 @@ bool NewDBCursor(DBHandle *handle, DBCursor **cursor)
     return true;
 }
 
+bool NewDBReadCursor(DBHandle *handle, DBCursor **cursor)
+{
+    DBCursorPriv *priv = DBPrivOpenReadCursor(handle->priv);
+    if (!priv)
+    {
+        return false;
+    }
+
+    *cursor = xcalloc(1, sizeof(DBCursor));
+    (*cursor)->cursor = priv;
+    return true;
+}
+
 bool NextDB(DBCursor *cursor, char **key, int *ksize,
             void **value, int *vsize)
 {
@@ -723,7 +787,7 @@ StringMap *LoadDatabaseToStringMap(dbid database_id)
         return NULL;
     }
 
-    if (!NewDBCursor(db_conn, &db_cursor))
+    if (!NewDBReadCursor(db_conn, &db_cursor))
     {
         Log(LOG_LEVEL_ERR, "Unable to scan db");
         CloseDB(db_conn);
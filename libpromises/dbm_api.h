@@ -59,6 +59,9 @@ typedef enum
     dbid_packages_installed = 21, // new package promise installed packages list
     dbid_packages_updates   = 22, // new package promise list of available updates
     dbid_cookies            = 23, // Enterprise reporting cookies for duplicate host detection
+    dbid_copy_digests       = 24, // digests of copy promise destination files, keyed by stat info
+    dbid_class_diff         = 25, // class set of the previous agent run, for --show-class-diff
+    dbid_hostname           = 26, // cached node-name resolution, for resolver-free startup
 
     dbid_max
 } dbid;
@@ -105,6 +108,16 @@ void FreezeDB(DBHandle *handle);
  * key.
  */
 bool NewDBCursor(CF_DB *dbp, CF_DBC **dbcp);
+/*
+ * Read-only cursor for scans that never call DBCursorDeleteEntry() or
+ * DBCursorWriteEntry().  On LMDB it iterates a snapshot transaction, so
+ * long scans neither stall concurrent writers nor get stalled by them;
+ * backends without snapshot isolation fall back to a regular cursor.
+ * The snapshot pins database pages for its lifetime, so copy the data
+ * out and close the cursor promptly rather than doing per-entry work
+ * while it is open (see LoadDatabaseToStringMap()).
+ */
+bool NewDBReadCursor(CF_DB *dbp, CF_DBC **dbcp);
 bool NextDB(CF_DBC *dbcp, char **key, int *ksize, void **value, int *vsize);
 bool DBCursorDeleteEntry(CF_DBC *cursor);
 bool DBCursorWriteEntry(CF_DBC *cursor, const void *value, int value_size);
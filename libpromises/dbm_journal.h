@@ -0,0 +1,59 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_DBM_JOURNAL_H
+#define CFENGINE_DBM_JOURNAL_H
+
+#include <stdint.h>
+
+/* On-disk format of the database change journal.
+ *
+ * When journaling is enabled (by creating the CF_DB_JOURNAL_TRIGGER flag
+ * file in the state directory), the LMDB backend appends every committed
+ * write and deletion of a database to a sidecar file '<db-path>.journal'.
+ * Records belonging to one transaction are appended together after the
+ * transaction commits, so the journal never contains aborted work.
+ *
+ * Each record is a DBJournalRecord header followed by the key bytes and,
+ * for writes, the value bytes.  Fields are in host-native layout: the
+ * databases themselves store raw C structs, so a journal is only ever
+ * meaningful on a standby of the same architecture as the source hub,
+ * which is also what replaying into an LMDB file requires.
+ *
+ * 'cf-check sync' replays a journal into a database file. */
+
+#define DB_JOURNAL_MAGIC 0x4C4A4643 /* "CFJL" */
+
+#define DB_JOURNAL_OP_WRITE 'w'
+#define DB_JOURNAL_OP_DELETE 'd'
+
+typedef struct
+{
+    uint32_t magic;      // DB_JOURNAL_MAGIC, for resynchronization checks
+    uint8_t op;          // DB_JOURNAL_OP_WRITE or DB_JOURNAL_OP_DELETE
+    uint32_t key_size;   // number of key bytes following the header
+    uint32_t value_size; // number of value bytes following the key (0 for deletions)
+} DBJournalRecord;
+
+#endif
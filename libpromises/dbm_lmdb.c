@@ -42,6 +42,8 @@
 #include <global_mutex.h> /* cf_db_corruption_lock */
 #include <mutex.h>
 #include <time.h>               /* time() */
+#include <sequence.h>
+#include <dbm_journal.h>
 
 // Shared between threads.
 struct DBPriv_
@@ -61,6 +63,10 @@ typedef struct DBTxn_
     // Whether txn is a read/write (true) or read-only (false) transaction.
     bool rw_txn;
     bool cursor_open;
+    // Change records captured in this transaction, appended to the journal
+    // file if (and only if) the transaction commits.  NULL unless journaling
+    // is enabled and the transaction has written something.
+    Seq *journal_ops;
 } DBTxn;
 
 struct DBCursorPriv_
@@ -71,6 +77,9 @@ struct DBCursorPriv_
     void *curkv;
     size_t curks;
     bool pending_delete;
+    // Opened by DBPrivOpenReadCursor() on a read-only snapshot
+    // transaction; entry deletes/writes are rejected.
+    bool read_only;
 };
 
 static int DB_MAX_READERS = -1;
@@ -94,6 +103,112 @@ static inline void CheckLMDBUsable(int rc, MDB_env *env)
     }
 }
 
+/* Change journaling for hot-standby replication (see dbm_journal.h).
+ * Enabled by creating the CF_DB_JOURNAL_TRIGGER flag file in the state
+ * directory.  Operations are captured per transaction and appended to
+ * '<db-path>.journal' only after the transaction commits, so the journal
+ * never contains aborted work. */
+
+static bool JournalingEnabled(void)
+{
+    /* Checked once per process; enabling journaling requires restarting
+     * the components, same as most cf-serverd settings. */
+    static int enabled = -1; /* GLOBAL_X */
+    if (enabled == -1)
+    {
+        char flag_file[PATH_MAX] = { 0 };
+        xsnprintf(flag_file, PATH_MAX, "%s%c%s",
+                  GetStateDir(), FILE_SEPARATOR, CF_DB_JOURNAL_TRIGGER);
+        enabled = (access(flag_file, F_OK) == 0) ? 1 : 0;
+    }
+    return (enabled == 1);
+}
+
+static void JournalCaptureOp(
+    DBTxn *const txn,
+    const char op,
+    const void *const key, const size_t key_size,
+    const void *const value, const size_t value_size)
+{
+    assert(txn != NULL);
+
+    if (!JournalingEnabled())
+    {
+        return;
+    }
+
+    if (txn->journal_ops == NULL)
+    {
+        txn->journal_ops = SeqNew(16, free);
+    }
+
+    DBJournalRecord record = {
+        .magic = DB_JOURNAL_MAGIC,
+        .op = op,
+        .key_size = key_size,
+        .value_size = value_size,
+    };
+    char *blob = xmalloc(sizeof(record) + key_size + value_size);
+    memcpy(blob, &record, sizeof(record));
+    memcpy(blob + sizeof(record), key, key_size);
+    if (value_size > 0)
+    {
+        memcpy(blob + sizeof(record) + key_size, value, value_size);
+    }
+    SeqAppend(txn->journal_ops, blob);
+}
+
+static void JournalDiscard(DBTxn *const txn)
+{
+    if (txn != NULL && txn->journal_ops != NULL)
+    {
+        SeqDestroy(txn->journal_ops);
+        txn->journal_ops = NULL;
+    }
+}
+
+static void JournalFlush(DBPriv *const db, DBTxn *const txn)
+{
+    assert(db != NULL);
+    assert(txn != NULL);
+
+    if (txn->journal_ops == NULL)
+    {
+        return;
+    }
+
+    const char *db_path = mdb_env_get_userctx(db->env);
+    char journal_path[PATH_MAX] = { 0 };
+    xsnprintf(journal_path, PATH_MAX, "%s.journal", db_path);
+
+    int fd = open(journal_path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Could not open database journal '%s' (open: %s)",
+            journal_path, GetErrorStr());
+        JournalDiscard(txn);
+        return;
+    }
+
+    const size_t n = SeqLength(txn->journal_ops);
+    for (size_t i = 0; i < n; i++)
+    {
+        const char *blob = SeqAt(txn->journal_ops, i);
+        DBJournalRecord record;
+        memcpy(&record, blob, sizeof(record));
+        const size_t size = sizeof(record) + record.key_size + record.value_size;
+        if (FullWrite(fd, blob, size) < 0)
+        {
+            Log(LOG_LEVEL_ERR,
+                "Could not append to database journal '%s' (write: %s)",
+                journal_path, GetErrorStr());
+            break;
+        }
+    }
+    close(fd);
+    JournalDiscard(txn);
+}
+
 static int GetReadTransaction(DBPriv *const db, DBTxn **const txn)
 {
     assert(db != NULL);
@@ -181,6 +296,7 @@ static void AbortTransaction(DBPriv *const db)
             mdb_txn_abort(db_txn->txn);
         }
 
+        JournalDiscard(db_txn);
         pthread_setspecific(db->txn_key, NULL);
         free(db_txn);
     }
@@ -195,6 +311,7 @@ static void DestroyTransaction(void *const ptr)
         UnexpectedError("Transaction still open when terminating thread!");
         mdb_txn_abort(db_txn->txn);
     }
+    JournalDiscard(db_txn);
     free(db_txn);
 }
 
@@ -800,6 +917,14 @@ DBPriv *DBPrivOpenDB(const char *const dbpath, const dbid id)
     }
 
     unsigned int open_flags = MDB_NOSUBDIR;
+
+#ifdef MDB_NORDAHEAD
+    /* Our access patterns are point lookups, so OS readahead on the memory
+     * map mostly pulls in pages we never touch. Guarded because ancient
+     * system LMDBs predate the flag. */
+    open_flags |= MDB_NORDAHEAD;
+#endif
+
 #if !defined(_AIX) && !defined(__sun)
     /* The locks and lastseen (on hubs) DBs are heavily used and using
      * MDB_NOSYNC increases performance. However, AIX and Solaris often suffer
@@ -985,6 +1110,14 @@ void DBPrivCommit(DBPriv *db)
             Log(LOG_LEVEL_ERR, "Could not commit database transaction to '%s': %s",
                 (char *) mdb_env_get_userctx(db->env), mdb_strerror(rc));
         }
+        if (rc == MDB_SUCCESS)
+        {
+            JournalFlush(db, db_txn);
+        }
+    }
+    if (db_txn != NULL)
+    {
+        JournalDiscard(db_txn);
     }
     pthread_setspecific(db->txn_key, NULL);
     free(db_txn);
@@ -1119,6 +1252,11 @@ bool DBPrivWrite(
                 (char *) mdb_env_get_userctx(db->env), mdb_strerror(rc));
             AbortTransaction(db);
         }
+        else
+        {
+            JournalCaptureOp(txn, DB_JOURNAL_OP_WRITE,
+                             key, key_size, value, value_size);
+        }
     }
     return (rc == MDB_SUCCESS);
 }
@@ -1192,6 +1330,7 @@ bool DBPrivOverwrite(DBPriv *db, const char *key, int key_size, const void *valu
         AbortTransaction(db);
         return false;
     }
+    JournalCaptureOp(txn, DB_JOURNAL_OP_WRITE, key, key_size, value, value_size);
     DBPrivCommit(db);
     return true;
 }
@@ -1211,6 +1350,10 @@ bool DBPrivDelete(DBPriv *const db, const void *const key, const int key_size)
         mkey.mv_size = key_size;
         rc = mdb_del(txn->txn, db->dbi, &mkey, NULL);
         CheckLMDBUsable(rc, db->env);
+        if (rc == MDB_SUCCESS)
+        {
+            JournalCaptureOp(txn, DB_JOURNAL_OP_DELETE, key, key_size, NULL, 0);
+        }
         if (rc == MDB_NOTFOUND)
         {
             Log(LOG_LEVEL_DEBUG, "Entry not found in '%s': %s",
@@ -1259,6 +1402,44 @@ DBCursorPriv *DBPrivOpenCursor(DBPriv *const db)
     return cursor;
 }
 
+DBCursorPriv *DBPrivOpenReadCursor(DBPriv *const db)
+{
+    assert(db != NULL);
+
+    DBCursorPriv *cursor = NULL;
+    DBTxn *txn;
+    MDB_cursor *mc;
+
+    /* MVCC: the cursor iterates a snapshot of the database as of this
+     * moment, and concurrent writers proceed against newer versions
+     * instead of stalling until the scan is done (as they would behind
+     * the write transaction DBPrivOpenCursor takes). */
+    int rc = GetReadTransaction(db, &txn);
+    if (rc == MDB_SUCCESS)
+    {
+        assert(!txn->cursor_open);
+        rc = mdb_cursor_open(txn->txn, db->dbi, &mc);
+        CheckLMDBUsable(rc, db->env);
+        if (rc == MDB_SUCCESS)
+        {
+            cursor = xcalloc(1, sizeof(DBCursorPriv));
+            cursor->db = db;
+            cursor->mc = mc;
+            cursor->read_only = true;
+            txn->cursor_open = true;
+        }
+        else
+        {
+            Log(LOG_LEVEL_ERR, "Could not open read cursor in '%s': %s",
+                (char *) mdb_env_get_userctx(db->env), mdb_strerror(rc));
+            AbortTransaction(db);
+        }
+        /* txn remains with cursor */
+    }
+
+    return cursor;
+}
+
 bool DBPrivAdvanceCursor(
     DBCursorPriv *const cursor,
     void **const key,
@@ -1313,6 +1494,16 @@ bool DBPrivAdvanceCursor(
         {
             r2 = mdb_cursor_del(cursor->mc, 0);
             // TODO: Should the return value be checked?
+            if (r2 == MDB_SUCCESS)
+            {
+                DBTxn *db_txn = pthread_getspecific(cursor->db->txn_key);
+                if (db_txn != NULL)
+                {
+                    JournalCaptureOp(db_txn, DB_JOURNAL_OP_DELETE,
+                                     cursor->delkey.mv_data,
+                                     cursor->delkey.mv_size, NULL, 0);
+                }
+            }
         }
         /* Reposition the cursor if it was valid before */
         if (rc == MDB_SUCCESS)
@@ -1330,6 +1521,15 @@ bool DBPrivAdvanceCursor(
 bool DBPrivDeleteCursorEntry(DBCursorPriv *const cursor)
 {
     assert(cursor != NULL);
+    assert(!cursor->read_only);
+
+    if (cursor->read_only)
+    {
+        Log(LOG_LEVEL_ERR, "Could not delete cursor entry in '%s':"
+            " cursor is read-only",
+            (char *) mdb_env_get_userctx(cursor->db->env));
+        return false;
+    }
 
     int rc = mdb_cursor_get(cursor->mc, &cursor->delkey, NULL, MDB_GET_CURRENT);
     CheckLMDBUsable(rc, cursor->db->env);
@@ -1345,6 +1545,15 @@ bool DBPrivWriteCursorEntry(
 {
     assert(cursor != NULL);
     assert(cursor->db != NULL);
+    assert(!cursor->read_only);
+
+    if (cursor->read_only)
+    {
+        Log(LOG_LEVEL_ERR, "Could not write cursor entry to '%s':"
+            " cursor is read-only",
+            (char *) mdb_env_get_userctx(cursor->db->env));
+        return false;
+    }
 
     MDB_val data;
     int rc;
@@ -1366,6 +1575,16 @@ bool DBPrivWriteCursorEntry(
             Log(LOG_LEVEL_ERR, "Could not write cursor entry to '%s': %s",
                 (char *) mdb_env_get_userctx(cursor->db->env), mdb_strerror(rc));
         }
+        else
+        {
+            DBTxn *db_txn = pthread_getspecific(cursor->db->txn_key);
+            if (db_txn != NULL)
+            {
+                JournalCaptureOp(db_txn, DB_JOURNAL_OP_WRITE,
+                                 cursor->curkv, cursor->curks,
+                                 value, value_size);
+            }
+        }
     }
     else
     {
@@ -1382,8 +1601,21 @@ void DBPrivCloseCursor(DBCursorPriv *const cursor)
     assert(cursor->db != NULL);
 
     DBTxn *txn;
-    const int rc = GetWriteTransaction(cursor->db, &txn);
-    CF_ASSERT(rc == MDB_SUCCESS, "Could not get write transaction");
+    if (cursor->read_only)
+    {
+        /* Must not call GetWriteTransaction() here: it would commit the
+         * snapshot transaction the cursor is iterating and open a write
+         * transaction in its place.  Read cursors never have pending
+         * deletes either (rejected in DBPrivDeleteCursorEntry). */
+        txn = pthread_getspecific(cursor->db->txn_key);
+        CF_ASSERT(txn != NULL, "Transaction not open");
+        assert(!cursor->pending_delete);
+    }
+    else
+    {
+        const int rc = GetWriteTransaction(cursor->db, &txn);
+        CF_ASSERT(rc == MDB_SUCCESS, "Could not get write transaction");
+    }
     CF_ASSERT(txn->cursor_open, "Transaction not open");
     txn->cursor_open = false;
 
@@ -1394,7 +1626,12 @@ void DBPrivCloseCursor(DBCursorPriv *const cursor)
 
     if (cursor->pending_delete)
     {
-        mdb_cursor_del(cursor->mc, 0);
+        if (mdb_cursor_del(cursor->mc, 0) == MDB_SUCCESS)
+        {
+            JournalCaptureOp(txn, DB_JOURNAL_OP_DELETE,
+                             cursor->delkey.mv_data, cursor->delkey.mv_size,
+                             NULL, 0);
+        }
     }
 
     mdb_cursor_close(cursor->mc);
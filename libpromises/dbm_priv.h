@@ -74,6 +74,14 @@ bool DBPrivDelete(DBPriv *db, const void *key, int key_size);
 
 
 DBCursorPriv *DBPrivOpenCursor(DBPriv *db);
+/*
+ * Read-only variant for scans that never modify entries.  Backends with
+ * MVCC (LMDB) serve it from a snapshot read transaction, so concurrent
+ * writers are not stalled behind the scan; other backends may fall back
+ * to a regular cursor.  DBPrivDeleteCursorEntry/DBPrivWriteCursorEntry
+ * must not be used on such a cursor.
+ */
+DBCursorPriv *DBPrivOpenReadCursor(DBPriv *db);
 bool DBPrivAdvanceCursor(DBCursorPriv *cursor, void **key, int *key_size,
                      void **value, int *value_size);
 bool DBPrivDeleteCursorEntry(DBCursorPriv *cursor);
@@ -376,6 +376,13 @@ DBCursorPriv *DBPrivOpenCursor(DBPriv *db)
     return cursor;
 }
 
+DBCursorPriv *DBPrivOpenReadCursor(DBPriv *db)
+{
+    /* QuickDB has no snapshot isolation, a read scan takes the same
+     * cursor lock as a read-write one. */
+    return DBPrivOpenCursor(db);
+}
+
 bool DBPrivAdvanceCursor(DBCursorPriv *cursor, void **key, int *ksize, void **value, int *vsize)
 {
     if (!Lock(cursor->db))
@@ -375,6 +375,13 @@ DBCursorPriv *DBPrivOpenCursor(DBPriv *db)
     return cursor;
 }
 
+DBCursorPriv *DBPrivOpenReadCursor(DBPriv *db)
+{
+    /* Tokyo Cabinet has no snapshot isolation, a read scan takes the
+     * same cursor lock as a read-write one. */
+    return DBPrivOpenCursor(db);
+}
+
 bool DBPrivAdvanceCursor(DBCursorPriv *cursor, void **key, int *key_size,
                      void **value, int *value_size)
 {
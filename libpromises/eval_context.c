@@ -32,6 +32,7 @@
 #include <expand.h>                                    /* ExpandPrivateRval */
 #include <matching.h>
 #include <string_lib.h>
+#include <string_intern.h>
 #include <misc_lib.h>
 #include <file_lib.h>
 #include <assoc.h>
@@ -39,6 +40,7 @@
 #include <vars.h>
 #include <syslog_client.h>
 #include <audit.h>
+#include <run_record.h>                                  /* RunRecordAppend */
 #include <rlist.h>
 #include <buffer.h>
 #include <promises.h>
@@ -49,8 +51,10 @@
 #include <printsize.h>
 #include <regex.h>
 #include <map.h>
+#include <mutex.h>                                         /* ThreadLock   */
 #include <conversion.h>                               /* DataTypeIsIterable */
 #include <cleanup.h>
+#include <mem_accounting.h>                      /* MemOverBudget */
 
 /* If we need to put a scoped variable into a special scope, use the string
  * below to replace the original scope separator.
@@ -110,8 +114,125 @@ TYPED_MAP_DEFINE(RemoteVarPromises, char *, Seq *,
                  SeqDestroy_untyped)
 
 
+/**
+   Define BodyChainMap.
+   Key:   "<policy>:<body-type>:<ns>:<name>" of a referenced body (the policy
+          address is part of the key so a different policy cannot alias
+          cached chains)
+   Value: the body inheritance chain as resolved by
+          EvalContextResolveBodyExpression(); empty when no such body exists.
+          The bodies and rvals in it stay owned by the policy.
+
+   Standard library bodies inherit several levels deep and are referenced
+   from nearly every promise. Resolving a chain scans the policy's body list
+   once per inheritance level, for every constraint of every promise copied
+   by DeRefCopyPromise(), so chains are resolved once and memoized.
+ */
+
+TYPED_MAP_DECLARE(BodyChain, char *, Seq *)
+
+TYPED_MAP_DEFINE(BodyChain, char *, Seq *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 SeqDestroy_untyped)
+
+
 static Regex *context_expression_whitespace_rx = NULL;
 
+/**
+   Define ExpressionCacheMap.
+   Key:   a class guard string, exactly as written in policy
+   Value: the guard parsed to an Expression tree (of the whitespace-condensed
+          string), plus the folded verdict when the guard is constant
+
+   Guards are fixed policy literals, but each is evaluated once per promise
+   per pass, so the same few hundred expressions go through the parser
+   millions of times per run. Parsing each distinct guard once and re-walking
+   the (read-only) tree takes the parser and its allocations out of the
+   evaluator's hottest path. Capped like the regex cache in matching.c in
+   case a policy generates guard strings dynamically.
+
+   A guard whose every token is a defined hard class can additionally be
+   folded to a constant: soft classes defined later cannot change what those
+   tokens evaluate to, so the verdict is computed once and replayed without
+   walking the tree. Hard classes normally never change after platform
+   discovery, but the time classes (Hr*, Min*, ...) are hard too and
+   long-running daemons refresh them, so folded verdicts carry the
+   hard-class generation they were computed against.
+ */
+
+typedef struct
+{
+    Expression *expr;
+    bool constant;             /* every token was a defined hard class */
+    ExpressionValue value;               /* the verdict, when constant */
+    uint64_t generation;    /* hard_class_generation it was folded for */
+} CachedExpression;
+
+static void CachedExpressionDestroy_untyped(void *entry)
+{
+    CachedExpression *cached = entry;
+    FreeExpression(cached->expr);
+    free(cached);
+}
+
+TYPED_MAP_DECLARE(ExpressionCache, char *, CachedExpression *)
+
+TYPED_MAP_DEFINE(ExpressionCache, char *, CachedExpression *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 CachedExpressionDestroy_untyped)
+
+#define EXPRESSION_CACHE_SIZE_MAX 4096
+
+static ExpressionCacheMap *expression_cache = NULL; /* GLOBAL_X */
+static size_t expression_cache_entries = 0; /* GLOBAL_X */
+static pthread_mutex_t expression_cache_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+static uint64_t hard_class_generation = 0; /* GLOBAL_X */
+
+/**
+   Define PersistentClassMap — pending updates to the persistent classes
+   database.
+   Key:   class name as stored in the state database
+   Value: the update to apply at flush time
+
+   Persisting a class used to mean a full open/read/write/close cycle against
+   the state database, one transaction per class, as each promise fired.
+   Policies that persist thousands of classes per run pay for thousands of
+   commits.  Updates are therefore coalesced here, last one per class wins,
+   and written in a single database session by
+   EvalContextHeapPersistentFlush(), which skips records whose stored state
+   already matches.
+ */
+typedef struct
+{
+    time_t expires;
+    unsigned int ttl_minutes;               /* only for logging */
+    PersistentClassPolicy policy;
+    bool remove;                 /* remove the record instead of writing it */
+    char *tags;
+} PersistentClassUpdate;
+
+static void PersistentClassUpdateDestroy_untyped(void *update)
+{
+    PersistentClassUpdate *u = update;
+    if (u != NULL)
+    {
+        free(u->tags);
+        free(u);
+    }
+}
+
+TYPED_MAP_DECLARE(PersistentClass, char *, PersistentClassUpdate *)
+
+TYPED_MAP_DEFINE(PersistentClass, char *, PersistentClassUpdate *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 PersistentClassUpdateDestroy_untyped)
+
 #include <policy.h>
 
 static bool BundleAborted(const EvalContext *ctx);
@@ -125,6 +246,7 @@ static bool EvalContextClassPut(EvalContext *ctx, const char *ns, const char *na
                                 bool is_soft, ContextScope scope,
                                 const char *tags, const char *comment);
 static const char *EvalContextCurrentNamespace(const EvalContext *ctx);
+static bool VariableScopeIsTransient(const char *scope);
 static ClassRef IDRefQualify(const EvalContext *ctx, const char *id);
 
 static void EventFrameDestroy(EventFrame *event);
@@ -146,6 +268,17 @@ struct EvalContext_
     int pass;
     Rlist *args;
 
+    /* Wall-clock deadline for the bundle currently being actuated, 0 when
+     * no time budget is armed. Checked at safe points between promise
+     * actuations and iterations; see ScheduleAgentOperations(). */
+    time_t bundle_deadline;
+
+    /* Bumped whenever a class or a persistent-scope variable is added,
+     * changed or removed. The per-bundle convergence passes compare it
+     * between passes to detect that re-evaluating cannot produce new
+     * results (see ScheduleAgentOperations()). */
+    size_t state_generation;
+
     Rlist *restrict_keys;
 
     Item *heap_abort;
@@ -161,12 +294,28 @@ struct EvalContext_
     StringSet *promise_lock_cache;
     StringSet *dependency_handles;
     FuncCacheMap *function_cache;
+    /* Memoized results of FNCALL_OPTION_PURE functions. Kept apart from
+     * function_cache because it must be dropped whenever a promise repairs
+     * something (pure functions like readfile() are only deterministic as
+     * long as the system state they read is unchanged). */
+    FuncCacheMap *pure_function_cache;
+    /* Memoized body inheritance chains, see
+     * EvalContextResolveBodyExpression(). */
+    BodyChainMap *body_chain_cache;
 
     uid_t uid;
     uid_t gid;
     pid_t pid;
     pid_t ppid;
 
+    /* Fixed slots for the process-identity 'this' variables (promiser_uid,
+     * promiser_gid, promiser_pid, promiser_ppid). They never change for the
+     * lifetime of the process, so they are bound once here instead of being
+     * formatted and re-put into every promise frame's variable table;
+     * VariableResolve2() consults this table when a promise frame lookup
+     * misses. */
+    VariableTable *this_constants;
+
     // Full path to directory that the binary was launched from.
     char *launch_directory;
 
@@ -193,6 +342,11 @@ struct EvalContext_
     /* ONLY INITIALIZED WHEN NON-EMPTY, OTHERWISE NULL */
     RemoteVarPromisesMap *remote_var_promises;
 
+    /* Pending persistent class updates, coalesced per class and flushed in
+     * one database session. */
+    /* ONLY INITIALIZED WHEN NON-EMPTY, OTHERWISE NULL */
+    PersistentClassMap *persistent_class_updates;
+
     bool dump_reports;
 
     /* These are needed for policy profiling */
@@ -202,6 +356,11 @@ struct EvalContext_
 
     EvalOrder common_eval_order;
     EvalOrder agent_eval_order;
+
+    /* Non-NULL once EvalContextSetupConcurrency() has run: read/write lock
+     * guarding the global class and variable tables when the context is
+     * shared between threads; see the contract in eval_context.h. */
+    pthread_rwlock_t *shared_lock;
 };
 
 void EvalContextSetConfig(EvalContext *ctx, const GenericAgentConfig *config)
@@ -216,6 +375,74 @@ const GenericAgentConfig *EvalContextGetConfig(EvalContext *ctx)
     return ctx->config;
 }
 
+/* See the concurrency contract in eval_context.h. */
+void EvalContextSetupConcurrency(EvalContext *ctx)
+{
+    assert(ctx != NULL);
+
+    if (ctx->shared_lock != NULL)
+    {
+        return;
+    }
+
+    pthread_rwlock_t *lock = xmalloc(sizeof(*lock));
+    int ret = pthread_rwlock_init(lock, NULL);
+    if (ret != 0)
+    {
+        /* Fall back to the unguarded single-threaded behaviour. */
+        Log(LOG_LEVEL_ERR,
+            "Could not initialize evaluation context lock"
+            " (pthread_rwlock_init: %s)", GetErrorStrFromCode(ret));
+        free(lock);
+        return;
+    }
+    ctx->shared_lock = lock;
+}
+
+void EvalContextReadLock(const EvalContext *ctx)
+{
+    if (ctx != NULL && ctx->shared_lock != NULL)
+    {
+        int ret = pthread_rwlock_rdlock(ctx->shared_lock);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_ERR, "Could not acquire evaluation context lock"
+                " for reading (pthread_rwlock_rdlock: %s)",
+                GetErrorStrFromCode(ret));
+        }
+    }
+}
+
+void EvalContextReadUnlock(const EvalContext *ctx)
+{
+    if (ctx != NULL && ctx->shared_lock != NULL)
+    {
+        pthread_rwlock_unlock(ctx->shared_lock);
+    }
+}
+
+void EvalContextWriteLock(EvalContext *ctx)
+{
+    if (ctx != NULL && ctx->shared_lock != NULL)
+    {
+        int ret = pthread_rwlock_wrlock(ctx->shared_lock);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_ERR, "Could not acquire evaluation context lock"
+                " for writing (pthread_rwlock_wrlock: %s)",
+                GetErrorStrFromCode(ret));
+        }
+    }
+}
+
+void EvalContextWriteUnlock(EvalContext *ctx)
+{
+    if (ctx != NULL && ctx->shared_lock != NULL)
+    {
+        pthread_rwlock_unlock(ctx->shared_lock);
+    }
+}
+
 bool EvalContextGetSelectEndMatchEof(const EvalContext *ctx)
 {
     return ctx->select_end_match_eof;
@@ -535,6 +762,30 @@ static void EvalContextStackFrameAddSoft(EvalContext *ctx, const char *context,
 static ExpressionValue EvalTokenAsClass(const char *classname, void *param)
 {
     const EvalContext *ctx = param;
+
+    /* Fast path: an unqualified name (no namespace separator). This is the
+     * overwhelming majority of guard tokens, and it needs none of the
+     * ClassRefParse()/ClassRefQualify() string allocations below -- the
+     * table lookups take ns and name separately. Same checks, same order. */
+    if (strchr(classname, ':') == NULL)
+    {
+        if (EvalContextHeapContainsHard(ctx, classname))
+        {
+            return EXPRESSION_VALUE_TRUE;
+        }
+
+        const char *ns = EvalContextCurrentNamespace(ctx);
+        if (ns == NULL)
+        {
+            ns = NamespaceDefault();
+        }
+
+        bool classy = (strcmp("any", classname) == 0 ||
+                       EvalContextHeapContainsSoft(ctx, ns, classname) ||
+                       EvalContextStackFrameContainsSoft(ctx, classname));
+        return (ExpressionValue) classy; // ExpressionValue extends bool
+    }
+
     ClassRef ref = ClassRefParse(classname);
     if (ClassRefIsQualified(ref))
     {
@@ -594,6 +845,62 @@ bool ClassCharIsWhitespace(char ch)
     return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
 }
 
+/**
+ * @return true if every token in the (whitespace-free) guard is a defined
+ *         hard class, i.e. the guard's verdict cannot be changed by any
+ *         soft class defined later in the run
+ *
+ * An undefined token disqualifies the guard: policy may legally define a
+ * soft class of that name later, so "provably false" does not exist here.
+ * Namespaced tokens and variable references disqualify it too.
+ */
+static bool ClassExpressionIsHardConstant(const EvalContext *ctx, const char *context)
+{
+    const char *sp = context;
+    while (*sp != '\0')
+    {
+        if (isalnum((unsigned char) *sp) || (*sp == '_'))
+        {
+            const char *start = sp;
+            while (isalnum((unsigned char) *sp) || (*sp == '_'))
+            {
+                sp++;
+            }
+            if (*sp == ':')
+            {
+                /* namespaced class, never in the hard table */
+                return false;
+            }
+
+            char token[CF_MAXVARSIZE];
+            const size_t len = sp - start;
+            if (len >= sizeof(token))
+            {
+                return false;
+            }
+            memcpy(token, start, len);
+            token[len] = '\0';
+
+            if (!EvalContextHeapContainsHard(ctx, token))
+            {
+                return false;
+            }
+        }
+        else if ((*sp == '.') || (*sp == '&') || (*sp == '|') ||
+                 (*sp == '!') || (*sp == '(') || (*sp == ')'))
+        {
+            sp++;
+        }
+        else
+        {
+            /* '$', whitespace, or anything else we do not understand */
+            return false;
+        }
+    }
+
+    return true;
+}
+
 ExpressionValue CheckClassExpression(const EvalContext *ctx, const char *context)
 {
     assert(context != NULL);
@@ -605,42 +912,113 @@ ExpressionValue CheckClassExpression(const EvalContext *ctx, const char *context
         return EXPRESSION_VALUE_TRUE;
     }
 
-    if (context_expression_whitespace_rx == NULL)
+    /* Fast path: the overwhelming majority of guards are "any" or a single
+     * class name with no operators. Those resolve with one hash lookup in
+     * the class table, so skip the whitespace regex, the Buffer copy and
+     * the expression parser. Any character that could mean an operator or
+     * malformed input falls through to the full parse below. */
+    if (StringEqual(context, "any"))
+    {
+        return EXPRESSION_VALUE_TRUE;
+    }
     {
-        context_expression_whitespace_rx = CompileRegex(CFENGINE_REGEX_WHITESPACE_IN_CONTEXTS);
+        bool single_token = (context[0] != '\0');
+        for (const char *sp = context; single_token && *sp != '\0'; sp++)
+        {
+            single_token = (isalnum((unsigned char) *sp) ||
+                            *sp == '_' || *sp == ':');
+        }
+        if (single_token)
+        {
+            /* Exactly what EvalExpression() would do for one token. */
+            return EvalTokenAsClass(context, (void *) ctx);
+        }
     }
 
-    if (context_expression_whitespace_rx == NULL)
+    /* Parse-once cache: look the guard up before running the whitespace
+     * check and the parser; on a hit all of that is skipped, and if the
+     * guard folded to a constant even the tree walk is skipped. */
+    ThreadLock(&expression_cache_lock);
+    if (expression_cache == NULL)
     {
-        Log(LOG_LEVEL_ERR, "The context expression whitespace regular expression could not be compiled, aborting.");
-        return EXPRESSION_VALUE_ERROR;
+        expression_cache = ExpressionCacheMapNew();
     }
+    CachedExpression *cached = ExpressionCacheMapGet(expression_cache, context);
+    if ((cached != NULL) && cached->constant &&
+        (cached->generation == hard_class_generation))
+    {
+        ExpressionValue value = cached->value;
+        ThreadUnlock(&expression_cache_lock);
+        return value;
+    }
+    ThreadUnlock(&expression_cache_lock);
 
-    if (StringMatchFullWithPrecompiledRegex(context_expression_whitespace_rx, context))
+    if (cached == NULL)
     {
-        Log(LOG_LEVEL_ERR, "class expressions can't be separated by whitespace without an intervening operator in expression '%s'", context);
-        return EXPRESSION_VALUE_ERROR;
+        if (context_expression_whitespace_rx == NULL)
+        {
+            context_expression_whitespace_rx = CompileRegex(CFENGINE_REGEX_WHITESPACE_IN_CONTEXTS);
+        }
+
+        if (context_expression_whitespace_rx == NULL)
+        {
+            Log(LOG_LEVEL_ERR, "The context expression whitespace regular expression could not be compiled, aborting.");
+            return EXPRESSION_VALUE_ERROR;
+        }
+
+        if (StringMatchFullWithPrecompiledRegex(context_expression_whitespace_rx, context))
+        {
+            Log(LOG_LEVEL_ERR, "class expressions can't be separated by whitespace without an intervening operator in expression '%s'", context);
+            return EXPRESSION_VALUE_ERROR;
+        }
+
+        Buffer *condensed = BufferNewFrom(context, strlen(context));
+        BufferRewrite(condensed, &ClassCharIsWhitespace, true);
+        res = ParseExpression(BufferData(condensed), 0, BufferSize(condensed));
+        BufferDestroy(condensed);
+
+        if (!res.result)
+        {
+            Log(LOG_LEVEL_ERR, "Couldn't find any class matching '%s'", context);
+            return EXPRESSION_VALUE_ERROR;
+        }
+
+        cached = xcalloc(1, sizeof(CachedExpression));
+        cached->expr = res.result;
+
+        ThreadLock(&expression_cache_lock);
+        if (expression_cache_entries >= EXPRESSION_CACHE_SIZE_MAX)
+        {
+            Log(LOG_LEVEL_DEBUG,
+                "Class expression cache full (%zu expressions), flushing",
+                expression_cache_entries);
+            ExpressionCacheMapDestroy(expression_cache);
+            expression_cache = ExpressionCacheMapNew();
+            expression_cache_entries = 0;
+        }
+        ExpressionCacheMapInsert(expression_cache, xstrdup(context), cached);
+        expression_cache_entries++;
+        ThreadUnlock(&expression_cache_lock);
     }
 
-    Buffer *condensed = BufferNewFrom(context, strlen(context));
-    BufferRewrite(condensed, &ClassCharIsWhitespace, true);
-    res = ParseExpression(BufferData(condensed), 0, BufferSize(condensed));
-    BufferDestroy(condensed);
+    ExpressionValue value =
+        EvalExpression(cached->expr,
+                       &EvalTokenAsClass, &EvalVarRef,
+                       (void *)ctx); // controlled cast. None of these should modify EvalContext
 
-    if (!res.result)
+    /* Fold the verdict if the guard only depends on hard classes; the next
+     * lookup then returns it without walking the tree. */
+    if ((value != EXPRESSION_VALUE_ERROR) &&
+        ClassExpressionIsHardConstant(ctx, context))
     {
-        Log(LOG_LEVEL_ERR, "Couldn't find any class matching '%s'", context);
-        return EXPRESSION_VALUE_ERROR;
+        ThreadLock(&expression_cache_lock);
+        cached->value = value;
+        cached->generation = hard_class_generation;
+        cached->constant = true;
+        ThreadUnlock(&expression_cache_lock);
     }
-    else
-    {
-        ExpressionValue r = EvalExpression(res.result,
-                                           &EvalTokenAsClass, &EvalVarRef,
-                                           (void *)ctx); // controlled cast. None of these should modify EvalContext
 
-        FreeExpression(res.result);
-        return r;
-    }
+    return value;
 }
 
 /**********************************************************************/
@@ -706,107 +1084,175 @@ bool EvalFileResult(const char *file_result, StringSet *leaf_attr)
 void EvalContextHeapPersistentSave(EvalContext *ctx, const char *name, unsigned int ttl_minutes,
                                    PersistentClassPolicy policy, const char *tags)
 {
+    assert(ctx != NULL);
     assert(tags);
 
+    ClassRef ref = IDRefQualify(ctx, name);
+    char *key = ClassRefToString(ref.ns, ref.name);
+    ClassRefDestroy(ref);
+
+    if (ctx->persistent_class_updates == NULL)
+    {
+        ctx->persistent_class_updates = PersistentClassMapNew();
+    }
+
+    PersistentClassUpdate *update =
+        PersistentClassMapGet(ctx->persistent_class_updates, key);
+    if (update == NULL)
+    {
+        update = xcalloc(1, sizeof(PersistentClassUpdate));
+        PersistentClassMapInsert(ctx->persistent_class_updates, key, update);
+    }
+    else
+    {
+        free(update->tags);
+        free(key);
+    }
+
+    update->expires = time(NULL) + ttl_minutes * 60;
+    update->ttl_minutes = ttl_minutes;
+    update->policy = policy;
+    update->remove = false;
+    update->tags = xstrdup(tags);
+
+    Log(LOG_LEVEL_DEBUG, "Queued persistent class update for '%s' (%u minutes)",
+        name, ttl_minutes);
+}
+
+/*****************************************************************************/
+
+void EvalContextHeapPersistentRemove(EvalContext *ctx, const char *context)
+{
+    assert(ctx != NULL);
+
+    if (ctx->persistent_class_updates == NULL)
+    {
+        ctx->persistent_class_updates = PersistentClassMapNew();
+    }
+
+    PersistentClassUpdate *update =
+        PersistentClassMapGet(ctx->persistent_class_updates, context);
+    if (update == NULL)
+    {
+        update = xcalloc(1, sizeof(PersistentClassUpdate));
+        PersistentClassMapInsert(ctx->persistent_class_updates,
+                                 xstrdup(context), update);
+    }
+    else
+    {
+        free(update->tags);
+        update->tags = NULL;
+    }
+
+    update->remove = true;
+
+    Log(LOG_LEVEL_DEBUG, "Queued removal of persistent class '%s'", context);
+}
+
+/*****************************************************************************/
+
+void EvalContextHeapPersistentFlush(EvalContext *ctx)
+{
+    assert(ctx != NULL);
+
+    if (ctx->persistent_class_updates == NULL)
+    {
+        return;
+    }
+
     time_t now = time(NULL);
 
     CF_DB *dbp;
     if (!OpenDB(&dbp, dbid_state))
     {
         char *db_path = DBIdToPath(dbid_state);
-        Log(LOG_LEVEL_ERR, "While persisting class, unable to open database at '%s' (OpenDB: %s)",
+        Log(LOG_LEVEL_ERR, "While persisting classes, unable to open database at '%s' (OpenDB: %s)",
             db_path, GetErrorStr());
         free(db_path);
         return;
     }
 
-    ClassRef ref = IDRefQualify(ctx, name);
-    char *key = ClassRefToString(ref.ns, ref.name);
-    ClassRefDestroy(ref);
+    MapIterator iter = MapIteratorInit(ctx->persistent_class_updates->impl);
+    MapKeyValue *item;
+    while ((item = MapIteratorNext(&iter)) != NULL)
+    {
+        const char *key = item->key;
+        const PersistentClassUpdate *update = item->value;
 
-    size_t tags_length = strlen(tags) + 1;
-    size_t new_info_size = sizeof(PersistentClassInfo) + tags_length;
+        if (update->remove)
+        {
+            DeleteDB(dbp, key);
+            Log(LOG_LEVEL_DEBUG, "Deleted persistent class '%s'", key);
+            continue;
+        }
 
-    PersistentClassInfo *new_info = xcalloc(1, new_info_size);
+        size_t tags_length = strlen(update->tags) + 1;
+        size_t new_info_size = sizeof(PersistentClassInfo) + tags_length;
 
-    new_info->expires = now + ttl_minutes * 60;
-    new_info->policy = policy;
-    strlcpy(new_info->tags, tags, tags_length);
+        PersistentClassInfo *new_info = xcalloc(1, new_info_size);
 
-    // first see if we have an existing record, and if we should bother to update
-    {
-        int existing_info_size = ValueSizeDB(dbp, key, strlen(key) + 1);
-        if (existing_info_size > 0)
+        new_info->expires = update->expires;
+        new_info->policy = update->policy;
+        strlcpy(new_info->tags, update->tags, tags_length);
+
+        // first see if we have an existing record, and if we should bother to update
+        bool skip_write = false;
         {
-            PersistentClassInfo *existing_info = xcalloc(existing_info_size, 1);
-            if (ReadDB(dbp, key, existing_info, existing_info_size))
+            int existing_info_size = ValueSizeDB(dbp, key, strlen(key) + 1);
+            if (existing_info_size > 0)
             {
-                if (existing_info->policy == CONTEXT_STATE_POLICY_PRESERVE &&
-                    now < existing_info->expires &&
-                    strcmp(existing_info->tags, new_info->tags) == 0)
-                {
-                    Log(LOG_LEVEL_VERBOSE, "Persistent class '%s' is already in a preserved state --  %jd minutes to go",
-                        key, (intmax_t)((existing_info->expires - now) / 60));
-                    CloseDB(dbp);
-                    free(existing_info);
-                    free(key);
-                    free(new_info);
-                    return;
-                }
-                else if (policy == CONTEXT_STATE_POLICY_RESET)
+                PersistentClassInfo *existing_info = xcalloc(existing_info_size, 1);
+                if (ReadDB(dbp, key, existing_info, existing_info_size))
                 {
-                    Log(LOG_LEVEL_VERBOSE,
-                        "Resetting persistent class '%s' timer to %u minutes (was %jd minutes remaining)",
-                        key, ttl_minutes, (intmax_t)((existing_info->expires - now) / 60));
+                    if (existing_info->policy == CONTEXT_STATE_POLICY_PRESERVE &&
+                        now < existing_info->expires &&
+                        strcmp(existing_info->tags, new_info->tags) == 0)
+                    {
+                        Log(LOG_LEVEL_VERBOSE, "Persistent class '%s' is already in a preserved state --  %jd minutes to go",
+                            key, (intmax_t)((existing_info->expires - now) / 60));
+                        skip_write = true;
+                    }
+                    else if (update->policy == CONTEXT_STATE_POLICY_RESET)
+                    {
+                        Log(LOG_LEVEL_VERBOSE,
+                            "Resetting persistent class '%s' timer to %u minutes (was %jd minutes remaining)",
+                            key, update->ttl_minutes, (intmax_t)((existing_info->expires - now) / 60));
+                    }
+                    else
+                    {
+                        Log(LOG_LEVEL_VERBOSE,
+                            "Updating persistent class '%s' (%u minutes, policy preserve)",
+                            key, update->ttl_minutes);
+                    }
                 }
                 else
                 {
-                    Log(LOG_LEVEL_VERBOSE,
-                        "Updating persistent class '%s' (%u minutes, policy preserve)",
-                        key, ttl_minutes);
+                    Log(LOG_LEVEL_ERR, "While persisting class '%s', error reading existing value", key);
+                    skip_write = true;
                 }
+                free(existing_info);
             }
             else
             {
-                Log(LOG_LEVEL_ERR, "While persisting class '%s', error reading existing value", key);
-                CloseDB(dbp);
-                free(existing_info);
-                free(key);
-                free(new_info);
-                return;
+                Log(LOG_LEVEL_VERBOSE,
+                    "Creating persistent class '%s' (%u minutes, policy %s)",
+                    key, update->ttl_minutes,
+                    update->policy == CONTEXT_STATE_POLICY_PRESERVE ? "preserve" : "reset");
             }
-            free(existing_info);
         }
-        else
+
+        if (!skip_write)
         {
-            Log(LOG_LEVEL_VERBOSE,
-                "Creating persistent class '%s' (%u minutes, policy %s)",
-                key, ttl_minutes,
-                policy == CONTEXT_STATE_POLICY_PRESERVE ? "preserve" : "reset");
+            WriteDB(dbp, key, new_info, new_info_size);
         }
-    }
-
-    WriteDB(dbp, key, new_info, new_info_size);
-
-    CloseDB(dbp);
-    free(key);
-    free(new_info);
-}
 
-/*****************************************************************************/
-
-void EvalContextHeapPersistentRemove(const char *context)
-{
-    CF_DB *dbp;
-
-    if (!OpenDB(&dbp, dbid_state))
-    {
-        return;
+        free(new_info);
     }
 
-    DeleteDB(dbp, context);
-    Log(LOG_LEVEL_DEBUG, "Deleted persistent class '%s'", context);
     CloseDB(dbp);
+
+    PersistentClassMapDestroy(ctx->persistent_class_updates);
+    ctx->persistent_class_updates = NULL;
 }
 
 /*****************************************************************************/
@@ -815,6 +1261,9 @@ void EvalContextHeapPersistentLoadAll(EvalContext *ctx)
 {
     assert(ctx != NULL);
 
+    /* Make any queued updates visible before scanning the database. */
+    EvalContextHeapPersistentFlush(ctx);
+
     time_t now = time(NULL);
 
     Log(LOG_LEVEL_VERBOSE, "Loading persistent classes");
@@ -936,6 +1385,25 @@ bool EvalAborted(const EvalContext *ctx)
     return ctx->eval_aborted;
 }
 
+void EvalContextSetBundleDeadline(EvalContext *ctx, time_t deadline)
+{
+    assert(ctx != NULL);
+    ctx->bundle_deadline = deadline;
+}
+
+time_t EvalContextGetBundleDeadline(const EvalContext *ctx)
+{
+    assert(ctx != NULL);
+    return ctx->bundle_deadline;
+}
+
+bool EvalContextBundleDeadlineExceeded(const EvalContext *ctx)
+{
+    assert(ctx != NULL);
+    return (ctx->bundle_deadline != 0 &&
+            time(NULL) > ctx->bundle_deadline);
+}
+
 void EvalContextHeapAddAbort(EvalContext *ctx, const char *context, const char *activated_on_context)
 {
     assert(ctx != NULL);
@@ -1056,6 +1524,7 @@ void FreePackageManager(PackageModuleBody *manager)
     free(manager->interpreter);
     free(manager->module_path);
     RlistDestroy(manager->options);
+    RlistDestroy(manager->installed_state_files);
     free(manager);
 }
 
@@ -1103,6 +1572,17 @@ ENTERPRISE_VOID_FUNC_1ARG_DEFINE_STUB(void, EvalContextSetupMissionPortalLogHook
 {
 }
 
+static void ThisConstantPut(VariableTable *table, const char *lval, int value)
+{
+    char v[PRINTSIZE(int)];
+    xsnprintf(v, sizeof(v), "%d", value);
+
+    const VarRef ref = VarRefConst(NULL, SpecialScopeToString(SPECIAL_SCOPE_THIS), lval);
+    Rval rval = (Rval) { v, RVAL_TYPE_SCALAR };
+    VariableTablePut(table, &ref, &rval, CF_DATA_TYPE_INT,
+                     StringSetFromString("source=agent", ','), NULL, NULL);
+}
+
 EvalContext *EvalContextNew(void)
 {
     EvalContext *ctx = xcalloc(1, sizeof(EvalContext));
@@ -1122,8 +1602,16 @@ EvalContext *EvalContextNew(void)
     ctx->ppid = getppid();
 #endif
 
+    ctx->this_constants = VariableTableNew();
+    ThisConstantPut(ctx->this_constants, "promiser_uid", (int) ctx->uid);
+    ThisConstantPut(ctx->this_constants, "promiser_gid", (int) ctx->gid);
+    ThisConstantPut(ctx->this_constants, "promiser_pid", (int) ctx->pid);
+    ThisConstantPut(ctx->this_constants, "promiser_ppid", (int) ctx->ppid);
+
     ctx->promise_lock_cache = StringSetNew();
     ctx->function_cache = FuncCacheMapNew();
+    ctx->pure_function_cache = FuncCacheMapNew();
+    ctx->body_chain_cache = BodyChainMapNew();
 
     EvalContextSetupMissionPortalLogHook(ctx);
 
@@ -1152,6 +1640,8 @@ void EvalContextDestroy(EvalContext *ctx)
 {
     if (ctx != NULL)
     {
+        EvalContextHeapPersistentFlush(ctx);
+
         free(ctx->launch_directory);
         free(ctx->entry_point);
 
@@ -1175,11 +1665,14 @@ void EvalContextDestroy(EvalContext *ctx)
         ClassTableDestroy(ctx->global_classes);
         VariableTableDestroy(ctx->global_variables);
         VariableTableDestroy(ctx->match_variables);
+        VariableTableDestroy(ctx->this_constants);
 
         StringSetDestroy(ctx->dependency_handles);
         StringSetDestroy(ctx->promise_lock_cache);
 
         FuncCacheMapDestroy(ctx->function_cache);
+        FuncCacheMapDestroy(ctx->pure_function_cache);
+        BodyChainMapDestroy(ctx->body_chain_cache);
 
         FreePackagePromiseContext(ctx->package_promise_context);
 
@@ -1193,6 +1686,13 @@ void EvalContextDestroy(EvalContext *ctx)
         }
 
         SeqDestroy(ctx->events);
+
+        if (ctx->shared_lock != NULL)
+        {
+            pthread_rwlock_destroy(ctx->shared_lock);
+            free(ctx->shared_lock);
+        }
+
         free(ctx);
     }
 }
@@ -1244,11 +1744,13 @@ bool EvalContextHeapRemoveSoft(EvalContext *ctx, const char *ns, const char *nam
 
 bool EvalContextHeapRemoveHard(EvalContext *ctx, const char *name)
 {
+    hard_class_generation++;  /* invalidates constant-folded guard verdicts */
     return ClassTableRemove(ctx->global_classes, NULL, name);
 }
 
 void EvalContextClear(EvalContext *ctx)
 {
+    hard_class_generation++;  /* invalidates constant-folded guard verdicts */
     ClassTableClear(ctx->global_classes);
     EvalContextDeleteIpAddresses(ctx);
     VariableTableClear(ctx->global_variables, NULL, NULL, NULL);
@@ -1256,6 +1758,8 @@ void EvalContextClear(EvalContext *ctx)
     StringSetClear(ctx->promise_lock_cache);
     SeqClear(ctx->stack);
     FuncCacheMapClear(ctx->function_cache);
+    FuncCacheMapClear(ctx->pure_function_cache);
+    BodyChainMapClear(ctx->body_chain_cache);
 }
 
 Rlist *EvalContextGetPromiseCallerMethods(EvalContext *ctx) {
@@ -1369,6 +1873,11 @@ int EvalContextGetPass(EvalContext *ctx)
     return ctx->pass;
 }
 
+size_t EvalContextGetStateGeneration(const EvalContext *ctx)
+{
+    return ctx->state_generation;
+}
+
 static StackFrame *StackFrameNew(StackFrameType type, bool inherit_previous)
 {
     StackFrame *frame = xmalloc(sizeof(StackFrame));
@@ -1582,15 +2091,8 @@ void EvalContextStackPushPromiseFrame(EvalContext *ctx, const Promise *owner)
         EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "promise_linenumber", number, CF_DATA_TYPE_STRING, "source=promise");
     }
 
-    char v[PRINTSIZE(int)];
-    xsnprintf(v, sizeof(v), "%d", (int) ctx->uid);
-    EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "promiser_uid", v, CF_DATA_TYPE_INT, "source=agent");
-    xsnprintf(v, sizeof(v), "%d", (int) ctx->gid);
-    EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "promiser_gid", v, CF_DATA_TYPE_INT, "source=agent");
-    xsnprintf(v, sizeof(v), "%d", (int) ctx->pid);
-    EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "promiser_pid", v, CF_DATA_TYPE_INT, "source=agent");
-    xsnprintf(v, sizeof(v), "%d", (int) ctx->ppid);
-    EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "promiser_ppid", v, CF_DATA_TYPE_INT, "source=agent");
+    /* promiser_uid, promiser_gid, promiser_pid and promiser_ppid are bound
+     * once per run in ctx->this_constants, not per promise frame. */
 
     EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "bundle", PromiseGetBundle(owner)->name, CF_DATA_TYPE_STRING, "source=promise");
     EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "namespace", PromiseGetNamespace(owner), CF_DATA_TYPE_STRING, "source=promise");
@@ -1701,6 +2203,8 @@ void EvalContextStackPopFrame(EvalContext *ctx)
 
 bool EvalContextClassRemove(EvalContext *ctx, const char *ns, const char *name)
 {
+    bool removed = false;
+
     for (size_t i = 0; i < SeqLength(ctx->stack); i++)
     {
         StackFrame *frame = SeqAt(ctx->stack, i);
@@ -1709,10 +2213,15 @@ bool EvalContextClassRemove(EvalContext *ctx, const char *ns, const char *name)
             continue;
         }
 
-        ClassTableRemove(frame->data.bundle.classes, ns, name);
+        removed = ClassTableRemove(frame->data.bundle.classes, ns, name) || removed;
     }
 
-    return ClassTableRemove(ctx->global_classes, ns, name);
+    bool ret = ClassTableRemove(ctx->global_classes, ns, name);
+    if (ret || removed)
+    {
+        ctx->state_generation++;
+    }
+    return ret;
 }
 
 Class *EvalContextClassGet(const EvalContext *ctx, const char *ns, const char *name)
@@ -1828,6 +2337,11 @@ static bool EvalContextClassPutTagsSet(EvalContext *ctx, const char *ns, const c
 
     case CONTEXT_SCOPE_NAMESPACE:
         ClassTablePut(ctx->global_classes, ns, name, is_soft, scope, tags, comment);
+        if (!is_soft)
+        {
+            /* invalidates constant-folded guard verdicts */
+            hard_class_generation++;
+        }
         break;
 
     case CONTEXT_SCOPE_NONE:
@@ -1849,6 +2363,8 @@ static bool EvalContextClassPutTagsSet(EvalContext *ctx, const char *ns, const c
         }
     }
 
+    ctx->state_generation++;                          /* new class defined */
+
     return true;
 }
 
@@ -2263,7 +2779,7 @@ const char *EvalContextVariableGetSpecialString(
     return (type_out == CF_DATA_TYPE_STRING) ? result : NULL;
 }
 
-bool EvalContextVariableRemoveSpecial(const EvalContext *ctx, SpecialScope scope, const char *lval)
+bool EvalContextVariableRemoveSpecial(EvalContext *ctx, SpecialScope scope, const char *lval)
 {
     switch (scope)
     {
@@ -2344,10 +2860,28 @@ static VariableTable *GetVariableTableForScope(const EvalContext *ctx,
     }
 }
 
-bool EvalContextVariableRemove(const EvalContext *ctx, const VarRef *ref)
+bool EvalContextVariableRemove(EvalContext *ctx, const VarRef *ref)
 {
     VariableTable *table = GetVariableTableForScope(ctx, ref->ns, ref->scope);
-    return VariableTableRemove(table, ref);
+    bool ret = VariableTableRemove(table, ref);
+    if (ret && !VariableScopeIsTransient(ref->scope))
+    {
+        ctx->state_generation++;
+    }
+    return ret;
+}
+
+/**
+ * Per-promise scopes are rebuilt for every promise evaluation, so their
+ * churn says nothing about whether another convergence pass could
+ * produce different results.
+ */
+static bool VariableScopeIsTransient(const char *scope)
+{
+    return (StringEqual(scope, "this") ||
+            StringEqual(scope, "body") ||
+            StringEqual(scope, "match") ||
+            StringEqual(scope, "edit"));
 }
 
 static bool IsVariableSelfReferential(const VarRef *ref, const void *value, RvalType rval_type)
@@ -2488,6 +3022,28 @@ bool EvalContextVariablePutTagsSetWithComment(EvalContext *ctx,
 
     Rval rval = (Rval) { (void *)value, DataTypeToRvalType(type) };
     VariableTable *table = GetVariableTableForScope(ctx, ref->ns, ref->scope);
+
+    /* Convergence-pass bookkeeping: only state that survives into the
+     * next pass matters, and re-putting an identical scalar changes
+     * nothing. */
+    if (!VariableScopeIsTransient(ref->scope))
+    {
+        const Variable *existing = VariableTableGet(table, ref);
+        bool unchanged = false;
+        if (existing != NULL &&
+            VariableGetType(existing) == type &&
+            rval.type == RVAL_TYPE_SCALAR)
+        {
+            Rval old = VariableGetRval(existing, true);
+            unchanged = (old.type == RVAL_TYPE_SCALAR &&
+                         StringEqual(RvalScalarValue(old), value));
+        }
+        if (!unchanged)
+        {
+            ctx->state_generation++;
+        }
+    }
+
     const Promise *pp = EvalContextStackCurrentPromise(ctx);
     VariableTablePut(table, ref, &rval, type, tags, SafeStringDuplicate(comment), pp ? pp->org_pp : pp);
     return true;
@@ -2504,10 +3060,10 @@ static inline VarRef *MangledThisScopedRef(const VarRef *ref)
     char *scope_underscores_lval = StringConcatenate(3, mangled_this_ref->scope,
                                                      NESTED_SCOPE_SEP,
                                                      mangled_this_ref->lval);
-    free(mangled_this_ref->lval);
-    mangled_this_ref->lval = scope_underscores_lval;
-    free(mangled_this_ref->scope);
-    mangled_this_ref->scope = xstrdup("this");
+    mangled_this_ref->lval = (char *) StringIntern(scope_underscores_lval);
+    free(scope_underscores_lval);
+    mangled_this_ref->scope = (char *) StringIntern("this");
+    mangled_this_ref->hash = 0;
 
     return mangled_this_ref;
 }
@@ -2532,8 +3088,8 @@ static Variable *VariableResolve2(const EvalContext *ctx, const VarRef *ref)
             (ref->ns != NULL))
         {
             VarRef *ref2 = VarRefCopy(ref);
-            free(ref2->ns);
-            ref2->ns = NULL;
+            ref2->ns = NULL;    /* interned, not owned */
+            ref2->hash = 0;
             var = VariableTableGet(table, ref2);
             VarRefDestroy(ref2);
         }
@@ -2545,6 +3101,19 @@ static Variable *VariableResolve2(const EvalContext *ctx, const VarRef *ref)
         {
             return var;
         }
+        else if (ref->num_indices == 0 &&
+                 SpecialScopeFromString(ref->scope) == SPECIAL_SCOPE_THIS)
+        {
+            /* The process-identity variables (this.promiser_uid and friends)
+             * are bound once per run in a fixed table instead of each promise
+             * frame, see EvalContextNew(). */
+            const VarRef const_ref = VarRefConst(NULL, SpecialScopeToString(SPECIAL_SCOPE_THIS), ref->lval);
+            var = VariableTableGet(ctx->this_constants, &const_ref);
+            if (var)
+            {
+                return var;
+            }
+        }
         else if (ref->num_indices > 0)
         {
             /* Iteration over slists creates special variables in the 'this.'
@@ -2673,8 +3242,9 @@ const void *EvalContextVariableGet(const EvalContext *ctx, const VarRef *ref, Da
                  ref->num_indices > 0     &&
             var_type == CF_DATA_TYPE_CONTAINER)
         {
-            JsonElement *child = JsonSelect(RvalContainerValue(var_rval),
-                                            ref->num_indices, ref->indices);
+            JsonElement *child = VariableSelectContainerChild(var,
+                                                              ref->num_indices,
+                                                              ref->indices);
             if (child)
             {
                 if (type_out)
@@ -2873,18 +3443,47 @@ Seq *EvalContextResolveBodyExpression(const EvalContext *ctx, const Policy *poli
                                       const char *callee_reference, const char *callee_type)
 {
     ClassRef ref = IDRefQualify(ctx, callee_reference);
-    Seq *bodies = NULL;
 
-    const Body *bp = EvalContextFindFirstMatchingBody(policy, callee_type, ref.ns, ref.name);
-    if (bp)
+    /* The chain only depends on the parsed policy, so it is resolved once
+     * and memoized (an empty chain records that no such body exists, which
+     * the package_method "generic" probe hits for every package promise).
+     * Callers get a fresh shallow copy that they may reverse and destroy as
+     * before. */
+    char *key = StringFormat("%p:%s:%s:%s", (const void *) policy, callee_type,
+                             ref.ns != NULL ? ref.ns : "", ref.name);
+    Seq *chain = BodyChainMapGet(ctx->body_chain_cache, key);
+    if (chain != NULL)
+    {
+        free(key);
+    }
+    else
     {
-        bodies = SeqNew(2, NULL);
-        SeqAppend(bodies, (void *)bp);
-        SeqAppend(bodies, (void *)NULL);
-        EvalContextAppendBodyParentsAndArgs(ctx, policy, bodies, bp, callee_type, 1);
+        chain = SeqNew(2, NULL);
+
+        const Body *bp = EvalContextFindFirstMatchingBody(policy, callee_type, ref.ns, ref.name);
+        if (bp)
+        {
+            SeqAppend(chain, (void *)bp);
+            SeqAppend(chain, (void *)NULL);
+            EvalContextAppendBodyParentsAndArgs(ctx, policy, chain, bp, callee_type, 1);
+        }
+
+        BodyChainMapInsert(ctx->body_chain_cache, key, chain);
     }
 
     ClassRefDestroy(ref);
+
+    const size_t chain_len = SeqLength(chain);
+    if (chain_len == 0)
+    {
+        return NULL;
+    }
+
+    Seq *bodies = SeqNew(chain_len, NULL);
+    for (size_t i = 0; i < chain_len; i++)
+    {
+        SeqAppend(bodies, SeqAt(chain, i));
+    }
     return bodies;
 }
 
@@ -2903,15 +3502,25 @@ void EvalContextPromiseLockCacheRemove(EvalContext *ctx, const char *key)
     StringSetRemove(ctx->promise_lock_cache, key);
 }
 
+/* Pure functions are always safe to memoize, so they bypass the
+ * EVAL_OPTION_CACHE_SYSTEM_FUNCTIONS opt-in and use a separate map that is
+ * invalidated whenever a promise changes system state. */
+static bool FunctionIsPure(const FnCall *fp)
+{
+    const FnCallType *fp_type = FnCallTypeGet(fp->name);
+    return (fp_type != NULL && (fp_type->options & FNCALL_OPTION_PURE));
+}
+
 bool EvalContextFunctionCacheGet(const EvalContext *ctx,
-                                 const FnCall *fp ARG_UNUSED,
+                                 const FnCall *fp,
                                  const Rlist *args, Rval *rval_out)
 {
     assert(fp != NULL);
     assert(fp->name != NULL);
     assert(ctx != NULL);
 
-    if (!(ctx->eval_options & EVAL_OPTION_CACHE_SYSTEM_FUNCTIONS))
+    const bool pure = FunctionIsPure(fp);
+    if (!pure && !(ctx->eval_options & EVAL_OPTION_CACHE_SYSTEM_FUNCTIONS))
     {
         return false;
     }
@@ -2919,7 +3528,8 @@ bool EvalContextFunctionCacheGet(const EvalContext *ctx,
     // The cache key is made of the function name and all args values
     Rlist *args_copy = RlistCopy(args);
     Rlist *key = RlistPrepend(&args_copy, fp->name, RVAL_TYPE_SCALAR);
-    Rval *rval = FuncCacheMapGet(ctx->function_cache, key);
+    Rval *rval = FuncCacheMapGet(pure ? ctx->pure_function_cache
+                                      : ctx->function_cache, key);
     RlistDestroy(key);
     if (rval)
     {
@@ -2936,25 +3546,70 @@ bool EvalContextFunctionCacheGet(const EvalContext *ctx,
 }
 
 void EvalContextFunctionCachePut(EvalContext *ctx,
-                                 const FnCall *fp ARG_UNUSED,
+                                 const FnCall *fp,
                                  const Rlist *args, const Rval *rval)
 {
     assert(fp != NULL);
     assert(fp->name != NULL);
     assert(ctx != NULL);
 
-    if (!(ctx->eval_options & EVAL_OPTION_CACHE_SYSTEM_FUNCTIONS))
+    const bool pure = FunctionIsPure(fp);
+    if (!pure && !(ctx->eval_options & EVAL_OPTION_CACHE_SYSTEM_FUNCTIONS))
     {
         return;
     }
 
+    /* On memory-constrained hosts the function caches are the largest pool
+     * of reclaimable state; shed them rather than growing past the budget
+     * towards the OOM killer. Re-computing evicted results costs time, not
+     * correctness. */
+    if (MemOverBudget())
+    {
+        Log(LOG_LEVEL_NOTICE,
+            "Memory budget of %zu bytes exceeded (RSS %zu bytes),"
+            " clearing function caches (%zu entries)",
+            MemBudgetGet(), MemCurrentRSS(),
+            FuncCacheMapSize(ctx->function_cache) +
+            FuncCacheMapSize(ctx->pure_function_cache));
+        FuncCacheMapClear(ctx->function_cache);
+        FuncCacheMapClear(ctx->pure_function_cache);
+        MemBudgetRecordEviction();
+    }
+
     Rval *rval_copy = xmalloc(sizeof(Rval));
     *rval_copy = RvalCopy(*rval);
 
     Rlist *args_copy = RlistCopy(args);
     Rlist *key = RlistPrepend(&args_copy, fp->name, RVAL_TYPE_SCALAR);
 
-    FuncCacheMapInsert(ctx->function_cache, key, rval_copy);
+    FuncCacheMapInsert(pure ? ctx->pure_function_cache : ctx->function_cache,
+                       key, rval_copy);
+}
+
+void EvalContextPureFunctionCacheInvalidate(EvalContext *ctx)
+{
+    assert(ctx != NULL);
+
+    Log(LOG_LEVEL_DEBUG,
+        "Invalidating pure function cache after repaired promise");
+    FuncCacheMapClear(ctx->pure_function_cache);
+}
+
+/* Subsystem gauges for the run-end memory report. */
+
+size_t EvalContextFunctionCacheEntries(const EvalContext *ctx)
+{
+    assert(ctx != NULL);
+
+    return FuncCacheMapSize(ctx->function_cache) +
+           FuncCacheMapSize(ctx->pure_function_cache);
+}
+
+size_t EvalContextGlobalVariablesCount(const EvalContext *ctx)
+{
+    assert(ctx != NULL);
+
+    return VariableTableCount(ctx->global_variables, NULL, NULL, NULL);
 }
 
 /* cfPS and associated machinery */
@@ -3065,7 +3720,7 @@ static void DeleteAllClasses(EvalContext *ctx, const Rlist *list)
 
         Log(LOG_LEVEL_VERBOSE, "Cancelling class '%s'", string);
 
-        EvalContextHeapPersistentRemove(string);
+        EvalContextHeapPersistentRemove(ctx, string);
 
         {
             ClassRef ref = ClassRefParse(CanonifyName(string));
@@ -3137,36 +3792,13 @@ static void SummarizeTransaction(EvalContext *ctx, const TransactionContext *tc,
         {
             Log(LOG_LEVEL_INFO, "L: %s", BufferData(buffer));
         }
-        else
+        else if (AuditLogAppend(logname, BufferData(buffer)))
         {
-            struct stat dsb;
-
-            // Does the file exist already?
-            if (lstat(logname, &dsb) == -1)
-            {
-                mode_t filemode = 0600;     /* Mode for log file creation */
-                int fd = creat(logname, filemode);
-                if (fd >= 0)
-                {
-                    Log(LOG_LEVEL_VERBOSE,
-                        "Created log file '%s' with requested permissions %jo",
-                        logname, (intmax_t) filemode);
-                    close(fd);
-                }
-            }
-
-            FILE *fout = safe_fopen(logname, "a");
-
-            if (fout == NULL)
-            {
-                Log(LOG_LEVEL_ERR, "Unable to open private log '%s'", logname);
-                return;
-            }
-
             Log(LOG_LEVEL_VERBOSE, "Logging string '%s' to '%s'", BufferData(buffer), logname);
-            fprintf(fout, "%s\n", BufferData(buffer));
-
-            fclose(fout);
+        }
+        else
+        {
+            Log(LOG_LEVEL_ERR, "Unable to open private log '%s'", logname);
         }
 
         BufferDestroy(buffer);
@@ -3242,10 +3874,18 @@ void ClassAuditLog(EvalContext *ctx, const Promise *pp, const Attributes *attr,
     {
         TrackTotalCompliance(status, pp);
         UpdatePromiseCounters(status);
+        RunRecordAppend(pp, status);
     }
 
     SetPromiseOutcomeClasses(ctx, status, &(attr->classes));
     DoSummarizeTransaction(ctx, status, pp, &(attr->transaction));
+
+    if (status == PROMISE_RESULT_CHANGE)
+    {
+        /* The system just changed under us; memoized pure functions that
+         * read system state (readfile() & co) may now be stale. */
+        EvalContextPureFunctionCacheInvalidate(ctx);
+    }
 }
 
 static void LogPromiseContext(const EvalContext *ctx, const Promise *pp)
@@ -4033,6 +4673,76 @@ void EvalContextProfilingStart(EvalContext *ctx)
     ctx->elapsed = EvalContextEventStart();
 }
 
+/**
+ * Write the recorded events in the collapsed-stack format consumed by flame
+ * graph tooling (e.g. flamegraph.pl --countname=ns): one line per distinct
+ * call stack, frame ids joined by ';', followed by the time spent in that
+ * stack in nanoseconds.  Event times are inclusive of callees, so each event
+ * is credited to its own stack and debited from its parent's, leaving self
+ * time per line.
+ */
+static void WriteCollapsedStacks(const Seq *events, const char *path)
+{
+    Map *self_time = MapNew(StringHash_untyped, StringEqual_untyped, free, free);
+
+    for (size_t i = 0; i < SeqLength(events); i++)
+    {
+        const EventFrame *event = SeqAt(events, i);
+
+        int64_t *total = MapGet(self_time, event->callstack);
+        if (total == NULL)
+        {
+            total = xcalloc(1, sizeof(int64_t));
+            MapInsert(self_time, xstrdup(event->callstack), total);
+        }
+        *total += event->elapsed;
+
+        const char *last_sep = strrchr(event->callstack, ';');
+        if (last_sep != NULL)
+        {
+            char *parent = xstrndup(event->callstack, last_sep - event->callstack);
+            int64_t *parent_total = MapGet(self_time, parent);
+            if (parent_total == NULL)
+            {
+                parent_total = xcalloc(1, sizeof(int64_t));
+                MapInsert(self_time, parent, parent_total);
+            }
+            else
+            {
+                free(parent);
+            }
+            *parent_total -= event->elapsed;
+        }
+    }
+
+    FILE *file = safe_fopen(path, "w");
+    if (file == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Could not write profile to '%s'. (fopen: %s)",
+            path, GetErrorStr());
+        MapDestroy(self_time);
+        return;
+    }
+
+    MapIterator iter = MapIteratorInit(self_time);
+    MapKeyValue *item;
+    while ((item = MapIteratorNext(&iter)) != NULL)
+    {
+        const int64_t elapsed = *(const int64_t *) item->value;
+        /* Clock jitter can leave a stack with slightly negative self time;
+         * such stacks carry no information of their own. */
+        if (elapsed > 0)
+        {
+            fprintf(file, "%s %" PRIi64 "\n", (const char *) item->key, elapsed);
+        }
+    }
+
+    fclose(file);
+    MapDestroy(self_time);
+
+    Log(LOG_LEVEL_INFO, "Wrote collapsed-stack profile for flame graphs to '%s'", path);
+}
+
 void EvalContextProfilingEnd(EvalContext *ctx)
 {
     assert(ctx != NULL);
@@ -4062,6 +4772,11 @@ void EvalContextProfilingEnd(EvalContext *ctx)
     WriterClose(writer);
 
     JsonDestroy(events);
+
+    char *collapsed_path = StringFormat("%s%ccf-agent-profile.folded",
+                                        GetStateDir(), FILE_SEPARATOR);
+    WriteCollapsedStacks(ctx->events, collapsed_path);
+    free(collapsed_path);
 }
 
 EventFrame *EvalContextGetLastEventFrame(EvalContext *ctx)
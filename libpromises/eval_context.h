@@ -135,6 +135,31 @@ void EvalContextDestroy(EvalContext *ctx);
 void EvalContextSetConfig(EvalContext *ctx, const GenericAgentConfig *config);
 const GenericAgentConfig *EvalContextGetConfig(EvalContext *ctx);
 
+/**
+ * Concurrency contract for sharing one EvalContext between threads:
+ *
+ * - The parsed Policy and everything reachable from it are immutable once
+ *   resolved; threads may read them freely.
+ * - The global class and variable tables are read-mostly.  A component
+ *   that shares the context calls EvalContextSetupConcurrency() once,
+ *   before spawning any thread; thereafter every reader brackets its
+ *   query sections with EvalContextReadLock()/EvalContextReadUnlock() and
+ *   every mutation -- including installing a reloaded policy -- is
+ *   bracketed with EvalContextWriteLock()/EvalContextWriteUnlock().
+ *   Writers are serialized by the lock.
+ * - Locks must never be held across blocking I/O.
+ * - Per-promise evaluation state (stack frames, iteration context) stays
+ *   single-threaded and must not be shared.
+ *
+ * All four lock functions are no-ops unless EvalContextSetupConcurrency()
+ * has been called, so single-threaded components pay only a NULL check.
+ */
+void EvalContextSetupConcurrency(EvalContext *ctx);
+void EvalContextReadLock(const EvalContext *ctx);
+void EvalContextReadUnlock(const EvalContext *ctx);
+void EvalContextWriteLock(EvalContext *ctx);
+void EvalContextWriteUnlock(EvalContext *ctx);
+
 Rlist *EvalContextGetRestrictKeys(const EvalContext *ctx);
 void EvalContextSetRestrictKeys(EvalContext *ctx, const Rlist *restrict_keys);
 
@@ -142,8 +167,14 @@ void EvalContextHeapAddAbort(EvalContext *ctx, const char *context, const char *
 void EvalContextHeapAddAbortCurrentBundle(EvalContext *ctx, const char *context, const char *activated_on_context);
 
 void EvalContextHeapPersistentSave(EvalContext *ctx, const char *name, unsigned int ttl_minutes, PersistentClassPolicy policy, const char *tags);
-void EvalContextHeapPersistentRemove(const char *context);
+void EvalContextHeapPersistentRemove(EvalContext *ctx, const char *context);
 void EvalContextHeapPersistentLoadAll(EvalContext *ctx);
+/**
+ * Write all queued persistent class updates to the state database in one
+ * session.  Called automatically before persistent classes are loaded and
+ * when the context is destroyed.
+ */
+void EvalContextHeapPersistentFlush(EvalContext *ctx);
 
 void EvalContextOverrideImmutableSet(EvalContext *ctx, bool should_override);
 bool EvalContextOverrideImmutableGet(EvalContext *ctx);
@@ -201,6 +232,13 @@ void EvalContextSetPass(EvalContext *ctx, int pass);
 Rlist *EvalContextGetBundleArgs(EvalContext *ctx);
 int EvalContextGetPass(EvalContext *ctx);
 
+/**
+ * Counter bumped whenever a class or a persistent-scope variable is
+ * added, changed or removed. Two equal readings around an evaluation
+ * pass mean the pass changed no state that a later pass could react to.
+ */
+size_t EvalContextGetStateGeneration(const EvalContext *ctx);
+
 char *EvalContextStackPath(const EvalContext *ctx);
 StringSet *EvalContextStackPromisees(const EvalContext *ctx);
 const Promise *EvalContextStackCurrentPromise(const EvalContext *ctx);
@@ -227,8 +265,8 @@ const void *EvalContextVariableGetSpecial(const EvalContext *ctx, const SpecialS
 const char *EvalContextVariableGetSpecialString(const EvalContext *ctx, const SpecialScope scope, const char *varname);
 const void *EvalContextVariableGet(const EvalContext *ctx, const VarRef *ref, DataType *type_out);
 const Promise *EvalContextVariablePromiseGet(const EvalContext *ctx, const VarRef *ref);
-bool EvalContextVariableRemoveSpecial(const EvalContext *ctx, SpecialScope scope, const char *lval);
-bool EvalContextVariableRemove(const EvalContext *ctx, const VarRef *ref);
+bool EvalContextVariableRemoveSpecial(EvalContext *ctx, SpecialScope scope, const char *lval);
+bool EvalContextVariableRemove(EvalContext *ctx, const VarRef *ref);
 StringSet *EvalContextVariableTags(const EvalContext *ctx, const VarRef *ref);
 bool EvalContextVariableClearMatch(EvalContext *ctx);
 VariableTableIterator *EvalContextVariableTableIteratorNew(const EvalContext *ctx, const char *ns, const char *scope, const char *lval);
@@ -239,6 +277,13 @@ void EvalContextPromiseLockCachePut(EvalContext *ctx, const char *key);
 void EvalContextPromiseLockCacheRemove(EvalContext *ctx, const char *key);
 bool EvalContextFunctionCacheGet(const EvalContext *ctx, const FnCall *fp, const Rlist *args, Rval *rval_out);
 void EvalContextFunctionCachePut(EvalContext *ctx, const FnCall *fp, const Rlist *args, const Rval *rval);
+/**
+ * Drop all memoized results of FNCALL_OPTION_PURE functions, e.g. after a
+ * promise has repaired something on the system.
+ */
+void EvalContextPureFunctionCacheInvalidate(EvalContext *ctx);
+size_t EvalContextFunctionCacheEntries(const EvalContext *ctx);
+size_t EvalContextGlobalVariablesCount(const EvalContext *ctx);
 
 const void  *EvalContextVariableControlCommonGet(const EvalContext *ctx, CommonControl lval);
 
@@ -305,6 +350,12 @@ const char *EvalContextGetEntryPoint(EvalContext* ctx);
 
 bool BundleAbort(EvalContext *ctx);
 bool EvalAborted(const EvalContext *ctx);
+
+/* Wall-clock deadline for the bundle currently being actuated (0 disarms);
+ * checked at safe points between promise actuations and iterations. */
+void EvalContextSetBundleDeadline(EvalContext *ctx, time_t deadline);
+time_t EvalContextGetBundleDeadline(const EvalContext *ctx);
+bool EvalContextBundleDeadlineExceeded(const EvalContext *ctx);
 void NotifyDependantPromises(EvalContext *ctx, const Promise *pp, PromiseResult result);
 bool MissingDependencies(EvalContext *ctx, const Promise *pp);
 
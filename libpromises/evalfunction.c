@@ -77,6 +77,9 @@
 #include <json.h>
 #include <json-yaml.h>
 #include <json-utils.h>
+#include <rval_flat.h>      /* RvalFlatReadFile */
+#include <map.h>            /* TYPED_MAP_DECLARE */
+#include <mutex.h>          /* ThreadLock */
 #include <known_dirs.h>
 #include <mustache.h>
 #include <processes_select.h>
@@ -333,8 +336,8 @@ static JsonElement* VarRefValueToJson(const EvalContext *ctx, const FnCall *fp,
                     }
                     else if (var_ref->num_indices - ref_num_indices > 1)
                     {
-                        Log(LOG_LEVEL_DEBUG, "%s: got ref with starting depth %zu and index count %zu",
-                            fp_name, ref_num_indices, var_ref->num_indices);
+                        LogLazy(LOG_LEVEL_DEBUG, "%s: got ref with starting depth %zu and index count %zu",
+                                fp_name, ref_num_indices, var_ref->num_indices);
                         for (size_t index = ref_num_indices; index < var_ref->num_indices-1; index++)
                         {
                             JsonElement *local = JsonObjectGet(holder, var_ref->indices[index]);
@@ -4615,7 +4618,14 @@ static FnCallResult FnCallMergeData(EvalContext *ctx, ARG_UNUSED const Policy *p
         }
     }
 
-    Seq *containers = SeqNew(10, &JsonDestroy);
+    /* JsonMerge() reads its inputs and returns an independent tree, so
+     * borrowed containers (plain variable references, by far the common
+     * case) can be merged in place without the defensive deep copy this
+     * function used to make of each argument -- which hurts when the
+     * arguments are hundred-MB CMDB exports. Only the entries we allocated
+     * ourselves need to be freed afterwards. */
+    Seq *containers = SeqNew(10, NULL);             /* borrowed and owned */
+    Seq *owned = SeqNew(10, &JsonDestroy);      /* allocated entries only */
 
     for (const Rlist *arg = args; arg; arg = arg->next)
     {
@@ -4627,6 +4637,7 @@ static FnCallResult FnCallMergeData(EvalContext *ctx, ARG_UNUSED const Policy *p
         if (json == NULL)
         {
             SeqDestroy(containers);
+            SeqDestroy(owned);
 
             return FnFailure();
         }
@@ -4642,24 +4653,31 @@ static FnCallResult FnCallMergeData(EvalContext *ctx, ARG_UNUSED const Policy *p
             Log(LOG_LEVEL_ERR, "%s is not mergeable as it it not a container", as_string);
             free(as_string);
             SeqDestroy(containers);
+            SeqDestroy(owned);
             return FnFailure();
         }
 
-        // This can be optimized better
+        SeqAppend(containers, json);
         if (allocated)
         {
-            SeqAppend(containers, json);
-        }
-        else
-        {
-            SeqAppend(containers, JsonCopy(json));
+            SeqAppend(owned, json);
         }
 
     } // end of args loop
 
     if (SeqLength(containers) == 1)
     {
-        JsonElement *first = JsonCopy(SeqAt(containers, 0));
+        JsonElement *first = SeqAt(containers, 0);
+        if (SeqLength(owned) == 1)
+        {
+            /* We allocated it, so hand it over instead of copying it. */
+            SeqSoftDestroy(owned);
+        }
+        else
+        {
+            first = JsonCopy(first);
+            SeqDestroy(owned);
+        }
         SeqDestroy(containers);
         return FnReturnContainerNoCopy(first);
     }
@@ -4678,6 +4696,7 @@ static FnCallResult FnCallMergeData(EvalContext *ctx, ARG_UNUSED const Policy *p
         }
 
         SeqDestroy(containers);
+        SeqDestroy(owned);
         return FnReturnContainerNoCopy(result);
     }
 
@@ -7792,6 +7811,40 @@ static FnCallResult FnCallReadRealList(EvalContext *ctx, ARG_UNUSED const Policy
     return ReadList(ctx, fp, args, CF_DATA_TYPE_REAL);
 }
 
+/* Parsed data-file cache for readjson()/readdata() and friends.
+ * Policies routinely evaluate the same readjson() call once per
+ * convergence pass, re-reading and re-parsing the file each time.
+ * Cache the parsed document, keyed on path and requested mode, and
+ * validate it cheaply by stat() identity.  Callers always receive a
+ * private copy, since FnReturnContainerNoCopy() hands ownership of
+ * the tree to the evaluator. */
+
+typedef struct
+{
+    JsonElement *json;
+    ino_t inode;
+    off_t size;
+    time_t mtime;
+} DataFileCacheEntry;
+
+static void DataFileCacheEntryDestroy_untyped(void *p)
+{
+    DataFileCacheEntry *entry = p;
+    JsonDestroy(entry->json);
+    free(entry);
+}
+
+TYPED_MAP_DECLARE(DataFileCache, char *, DataFileCacheEntry *)
+TYPED_MAP_DEFINE(DataFileCache, char *, DataFileCacheEntry *,
+                 StringHash_untyped, StringEqual_untyped,
+                 free, DataFileCacheEntryDestroy_untyped)
+
+#define DATA_FILE_CACHE_SIZE_MAX 64
+
+static DataFileCacheMap *data_file_cache = NULL; /* GLOBAL_X */
+static size_t data_file_cache_entries = 0; /* GLOBAL_X */
+static pthread_mutex_t data_file_cache_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
 static FnCallResult ReadDataGeneric(const char *const fname,
                                      const char *const input_path,
                                      const size_t size_max,
@@ -7800,12 +7853,73 @@ static FnCallResult ReadDataGeneric(const char *const fname,
     assert(fname != NULL);
     assert(input_path != NULL);
 
+    struct stat sb;
+    if (stat(input_path, &sb) == -1)
+    {
+        /* Missing or unreadable file: let JsonReadDataFile() produce
+         * the usual error message. */
+        JsonElement *json = JsonReadDataFile(fname, input_path, requested_mode, size_max);
+        if (json == NULL)
+        {
+            return FnFailure();
+        }
+        return FnReturnContainerNoCopy(json);
+    }
+
+    char *key = StringFormat("%d:%s", (int) requested_mode, input_path);
+
+    ThreadLock(&data_file_cache_lock);
+    if (data_file_cache == NULL)
+    {
+        data_file_cache = DataFileCacheMapNew();
+    }
+    DataFileCacheEntry *entry = DataFileCacheMapGet(data_file_cache, key);
+    if ((entry != NULL) &&
+        (entry->inode == sb.st_ino) &&
+        (entry->size == sb.st_size) &&
+        (entry->mtime == sb.st_mtime))
+    {
+        JsonElement *json = JsonCopy(entry->json);
+        ThreadUnlock(&data_file_cache_lock);
+        free(key);
+        return FnReturnContainerNoCopy(json);
+    }
+    ThreadUnlock(&data_file_cache_lock);
+
     JsonElement *json = JsonReadDataFile(fname, input_path, requested_mode, size_max);
     if (json == NULL)
     {
+        free(key);
         return FnFailure();
     }
 
+    ThreadLock(&data_file_cache_lock);
+    entry = DataFileCacheMapGet(data_file_cache, key);
+    if (entry != NULL)
+    {
+        JsonDestroy(entry->json);
+    }
+    else
+    {
+        if (data_file_cache_entries >= DATA_FILE_CACHE_SIZE_MAX)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Data file cache reached %d entries, flushing",
+                DATA_FILE_CACHE_SIZE_MAX);
+            DataFileCacheMapDestroy(data_file_cache);
+            data_file_cache = DataFileCacheMapNew();
+            data_file_cache_entries = 0;
+        }
+        entry = xmalloc(sizeof(DataFileCacheEntry));
+        DataFileCacheMapInsert(data_file_cache, xstrdup(key), entry);
+        data_file_cache_entries++;
+    }
+    entry->json = JsonCopy(json);
+    entry->inode = sb.st_ino;
+    entry->size = sb.st_size;
+    entry->mtime = sb.st_mtime;
+    ThreadUnlock(&data_file_cache_lock);
+    free(key);
+
     return FnReturnContainerNoCopy(json);
 }
 
@@ -9328,8 +9442,6 @@ static bool SingleLine(const char *s)
 
 static char *CfReadFile(const char *filename, size_t maxsize)
 {
-    /* TODO remove this stat() call, it's a remnant from old code
-       that examined sb.st_size. */
     struct stat sb;
     if (stat(filename, &sb) == -1)
     {
@@ -9356,15 +9468,64 @@ static char *CfReadFile(const char *filename, size_t maxsize)
     /* 0 means 'read until the end of file' */
     size_t limit = maxsize > 0 ? maxsize : SIZE_MAX;
     bool truncated = false;
-    Writer *w = NULL;
+    size_t size = 0;
+    char *result = NULL;
+
     int fd = safe_open(filename, O_RDONLY | O_TEXT);
     if (fd >= 0)
     {
-        w = FileReadFromFd(fd, limit, &truncated);
+        if (S_ISREG(sb.st_mode) && sb.st_size > 0)
+        {
+            /* Regular file of known size: read into one exact-size buffer.
+             * The Writer path below grows by doubling and copies once more on
+             * close, which triples the peak footprint for the hundred-MB
+             * inventory dumps this function gets pointed at.  st_size is an
+             * upper bound even with O_TEXT newline translation; data appended
+             * after the stat() above is deliberately not picked up. */
+            size_t wanted = MIN((size_t) sb.st_size, limit);
+            truncated = ((size_t) sb.st_size > limit);
+
+            result = xmalloc(wanted + 1);
+            size = 0;
+            while (size < wanted)
+            {
+                ssize_t num = read(fd, result + size, wanted - size);
+                if (num == 0)
+                {
+                    break;                      /* EOF (e.g. O_TEXT shrank it) */
+                }
+                if (num < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    free(result);
+                    result = NULL;
+                    break;
+                }
+                size += num;
+            }
+            if (result != NULL)
+            {
+                result[size] = '\0';
+            }
+        }
+        else
+        {
+            /* Pipes, devices, /proc files with st_size 0: size unknown up
+             * front, stream through a Writer as before. */
+            Writer *w = FileReadFromFd(fd, limit, &truncated);
+            if (w != NULL)
+            {
+                size = StringWriterLength(w);
+                result = StringWriterClose(w);
+            }
+        }
         close(fd);
     }
 
-    if (!w)
+    if (result == NULL)
     {
         Log(LOG_LEVEL_ERR, "CfReadFile: Error while reading file '%s' (%s)",
             filename, GetErrorStr());
@@ -9377,9 +9538,6 @@ static char *CfReadFile(const char *filename, size_t maxsize)
             "requested by maxsize parameter", filename, maxsize);
     }
 
-    size_t size = StringWriterLength(w);
-    char *result = StringWriterClose(w);
-
     /* FIXME: Is it necessary here? Move to caller(s) */
     if (SingleLine(result))
     {
@@ -10210,6 +10368,34 @@ void ModuleProtocol(EvalContext *ctx, const char *command, const char *line, int
         {
             if (FileCanOpen(content, "r"))
             {
+                /* Flat-encoded values (rval_flat.h) skip the text loaders
+                 * entirely; the variable type follows from the decoded
+                 * value. */
+                if (StringEndsWith(content, ".rvf"))
+                {
+                    Rval rval;
+                    if (RvalFlatReadFile(content, &rval))
+                    {
+                        const DataType dtype =
+                            (rval.type == RVAL_TYPE_SCALAR) ? CF_DATA_TYPE_STRING :
+                            (rval.type == RVAL_TYPE_LIST) ? CF_DATA_TYPE_SLIST :
+                                                            CF_DATA_TYPE_CONTAINER;
+
+                        Log(LOG_LEVEL_VERBOSE,
+                            "Defined variable '%s' in context '%s' from flat file '%s'",
+                            name, context, content);
+
+                        Buffer *tagbuf = StringSetToBuffer(tags, ',');
+                        VarRef *ref = VarRefParseFromScope(name, context);
+
+                        EvalContextVariablePut(ctx, ref, rval.item, dtype, BufferData(tagbuf));
+                        VarRefDestroy(ref);
+                        BufferDestroy(tagbuf);
+                        RvalDestroy(rval);
+                    }
+                    break;
+                }
+
                 const int size_max = IntFromString("inf");
                 const DataFileType requested_mode = GetDataFileTypeFromSuffix(content);
 
@@ -11534,27 +11720,27 @@ const FnCallType CF_FNCALL_TYPES[] =
     FnCallTypeNew("and", CF_DATA_TYPE_CONTEXT, AND_ARGS, &FnCallAnd, "Calculate whether all arguments evaluate to true",
                   FNCALL_OPTION_VARARG, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(0, -1)),
     FnCallTypeNew("basename", CF_DATA_TYPE_STRING, BASENAME_ARGS, &FnCallBasename, "Retrieves the basename of a filename.",
-                  FNCALL_OPTION_VARARG, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
+                  FNCALL_OPTION_VARARG | FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
     FnCallTypeNew("bundlesmatching", CF_DATA_TYPE_STRING_LIST, BUNDLESMATCHING_ARGS, &FnCallBundlesMatching, "Find all the bundles that match a regular expression and tags.",
                   FNCALL_OPTION_VARARG, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(1, -1)),
     FnCallTypeNew("bundlestate", CF_DATA_TYPE_CONTAINER, BUNDLESTATE_ARGS, &FnCallBundlestate, "Construct a container of the variables in a bundle and the global class state",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("canonify", CF_DATA_TYPE_STRING, CANONIFY_ARGS, &FnCallCanonify, "Convert an abitrary string into a legal class name",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("canonifyuniquely", CF_DATA_TYPE_STRING, CANONIFY_ARGS, &FnCallCanonify, "Convert an abitrary string into a unique legal class name",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("concat", CF_DATA_TYPE_STRING, CONCAT_ARGS, &FnCallConcat, "Concatenate all arguments into string",
-                  FNCALL_OPTION_VARARG, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(0, -1)),
+                  FNCALL_OPTION_VARARG | FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(0, -1)),
     FnCallTypeNew("cf_version_minimum", CF_DATA_TYPE_CONTEXT, CFVERSION_ARGS, &FnCallVersionMinimum, "True if local CFEngine version is newer than or equal to input",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("cf_version_after", CF_DATA_TYPE_CONTEXT, CFVERSION_ARGS, &FnCallVersionAfter, "True if local CFEngine version is newer than input",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("cf_version_maximum", CF_DATA_TYPE_CONTEXT, CFVERSION_ARGS, &FnCallVersionMaximum, "True if local CFEngine version is older than or equal to input",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("cf_version_before", CF_DATA_TYPE_CONTEXT, CFVERSION_ARGS, &FnCallVersionBefore, "True if local CFEngine version is older than input",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("cf_version_at", CF_DATA_TYPE_CONTEXT, CFVERSION_ARGS, &FnCallVersionAt, "True if local CFEngine version is the same as input",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("cf_version_between", CF_DATA_TYPE_CONTEXT, CFVERSIONBETWEEN_ARGS, &FnCallVersionBetween, "True if local CFEngine version is between two input versions (inclusive)",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("changedbefore", CF_DATA_TYPE_CONTEXT, CHANGEDBEFORE_ARGS, &FnCallIsChangedBefore, "True if arg1 was changed before arg2 (ctime)",
@@ -11580,13 +11766,13 @@ const FnCallType CF_FNCALL_TYPES[] =
     FnCallTypeNew("difference", CF_DATA_TYPE_STRING_LIST, SETOP_ARGS, &FnCallSetop, "Returns all the unique elements of list or array or data container arg1 that are not in list or array or data container arg2",
                   FNCALL_OPTION_COLLECTING, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("dirname", CF_DATA_TYPE_STRING, DIRNAME_ARGS, &FnCallDirname, "Return the parent directory name for given path",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_FILES, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_FILES, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("diskfree", CF_DATA_TYPE_INT, DISKFREE_ARGS, &FnCallDiskFree, "Return the free space (in KB) available on the directory's current partition (0 if not found)",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_FILES, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("escape", CF_DATA_TYPE_STRING, ESCAPE_ARGS, &FnCallEscape, "Escape regular expression characters in a string",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("eval", CF_DATA_TYPE_STRING, EVAL_ARGS, &FnCallEval, "Evaluate a mathematical expression",
-                  FNCALL_OPTION_VARARG, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(1, 3)),
+                  FNCALL_OPTION_VARARG | FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(1, 3)),
     FnCallTypeNew("every", CF_DATA_TYPE_CONTEXT, EVERY_SOME_NONE_ARGS, &FnCallEverySomeNone, "True if every element in the list or array or data container matches the given regular expression",
                   FNCALL_OPTION_COLLECTING, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("execresult", CF_DATA_TYPE_STRING, EXECRESULT_ARGS, &FnCallExecResult, "Execute named command and assign output to variable",
@@ -11612,7 +11798,7 @@ const FnCallType CF_FNCALL_TYPES[] =
     FnCallTypeNew("findprocesses", CF_DATA_TYPE_CONTAINER, PROCESSEXISTS_ARGS, &FnCallProcessExists, "Returns data container of processes matching the regular expression",
                   FNCALL_OPTION_CACHED, FNCALL_CATEGORY_SYSTEM, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("format", CF_DATA_TYPE_STRING, FORMAT_ARGS, &FnCallFormat, "Applies a list of string values in arg2,arg3... to a string format in arg1 with sprintf() rules",
-                  FNCALL_OPTION_VARARG, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(1, -1)),
+                  FNCALL_OPTION_VARARG | FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(1, -1)),
     FnCallTypeNew("getclassmetatags", CF_DATA_TYPE_STRING_LIST, GETCLASSMETATAGS_ARGS, &FnCallGetMetaTags, "Collect the class arg1's meta tags into an slist, optionally collecting only tag key arg2",
                   FNCALL_OPTION_VARARG, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, ARGC(1, -1)),
     FnCallTypeNew("getenv", CF_DATA_TYPE_STRING, GETENV_ARGS, &FnCallGetEnv, "Return the environment variable named arg1, truncated at arg2 characters",
@@ -11644,7 +11830,7 @@ const FnCallType CF_FNCALL_TYPES[] =
     FnCallTypeNew("groupexists", CF_DATA_TYPE_CONTEXT, GROUPEXISTS_ARGS, &FnCallGroupExists, "True if group or numerical id exists on this host",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_SYSTEM, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("hash", CF_DATA_TYPE_STRING, HASH_ARGS, &FnCallHandlerHash, "Return the hash of arg1, type arg2 and assign to a variable",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("hashmatch", CF_DATA_TYPE_CONTEXT, HASHMATCH_ARGS, &FnCallHashMatch, "Compute the hash of arg1, of type arg2 and test if it matches the value in arg3",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("host2ip", CF_DATA_TYPE_STRING, HOST2IP_ARGS, &FnCallHost2IP, "Returns the primary name-service IP address for the named host",
@@ -11698,7 +11884,7 @@ const FnCallType CF_FNCALL_TYPES[] =
     FnCallTypeNew("join", CF_DATA_TYPE_STRING, JOIN_ARGS, &FnCallJoin, "Join the items of list or array or data container arg2 into a string, using the conjunction in arg1",
                   FNCALL_OPTION_COLLECTING, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("lastnode", CF_DATA_TYPE_STRING, LASTNODE_ARGS, &FnCallLastNode, "Extract the last of a separated string, e.g. filename from a path",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("laterthan", CF_DATA_TYPE_CONTEXT, LATERTHAN_ARGS, &FnCallLaterThan, "True if the current time is later than the given date",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_FILES, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("ldaparray", CF_DATA_TYPE_CONTEXT, LDAPARRAY_ARGS, &FnCallLDAPArray, "Extract all values from an ldap record",
@@ -11766,33 +11952,33 @@ const FnCallType CF_FNCALL_TYPES[] =
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     // read functions for reading from file
     FnCallTypeNew("readdata", CF_DATA_TYPE_CONTAINER, READDATA_ARGS, &FnCallReadData, "Parse a YAML, JSON, CSV, etc. file and return a JSON data container with the contents",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("readfile", CF_DATA_TYPE_STRING, READFILE_ARGS, &FnCallReadFile,       "Read max number of bytes from named file and assign to variable",
-                  FNCALL_OPTION_VARARG, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
+                  FNCALL_OPTION_VARARG | FNCALL_OPTION_PURE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
     FnCallTypeNew("readcsv", CF_DATA_TYPE_CONTAINER, READFILE_ARGS, &FnCallReadCsv,     "Parse a CSV file and return a JSON data container with the contents",
-                  FNCALL_OPTION_VARARG, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
+                  FNCALL_OPTION_VARARG | FNCALL_OPTION_PURE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
     FnCallTypeNew("readenvfile", CF_DATA_TYPE_CONTAINER, READFILE_ARGS, &FnCallReadEnvFile, "Parse a ENV-style file and return a JSON data container with the contents",
                   FNCALL_OPTION_VARARG, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
     FnCallTypeNew("readjson", CF_DATA_TYPE_CONTAINER, READFILE_ARGS, &FnCallReadJson,    "Read a JSON data container from a file",
-                  FNCALL_OPTION_VARARG, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
+                  FNCALL_OPTION_VARARG | FNCALL_OPTION_PURE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
     FnCallTypeNew("readyaml", CF_DATA_TYPE_CONTAINER, READFILE_ARGS, &FnCallReadYaml,    "Read a data container from a YAML file",
-                  FNCALL_OPTION_VARARG, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
+                  FNCALL_OPTION_VARARG | FNCALL_OPTION_PURE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
     FnCallTypeNew("read_module_protocol", CF_DATA_TYPE_CONTEXT, READMODULE_ARGS, &FnCallReadModuleProtocol, "Parse a file containing module protocol output (for cached modules)",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("readintarray", CF_DATA_TYPE_INT, READSTRINGARRAY_ARGS, &FnCallReadIntArray, "Read an array of integers from a file, indexed by first entry on line and sequentially on each line; return line count",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("readintlist", CF_DATA_TYPE_INT_LIST, READSTRINGLIST_ARGS, &FnCallReadIntList, "Read and assign a list variable from a file of separated ints",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("readrealarray", CF_DATA_TYPE_INT, READSTRINGARRAY_ARGS, &FnCallReadRealArray, "Read an array of real numbers from a file, indexed by first entry on line and sequentially on each line; return line count",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("readreallist", CF_DATA_TYPE_REAL_LIST, READSTRINGLIST_ARGS, &FnCallReadRealList, "Read and assign a list variable from a file of separated real numbers",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("readstringarray", CF_DATA_TYPE_INT, READSTRINGARRAY_ARGS, &FnCallReadStringArray, "Read an array of strings from a file, indexed by first entry on line and sequentially on each line; return line count",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("readstringarrayidx", CF_DATA_TYPE_INT, READSTRINGARRAY_ARGS, &FnCallReadStringArrayIndex, "Read an array of strings from a file, indexed by line number and sequentially on each line; return line count",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("readstringlist", CF_DATA_TYPE_STRING_LIST, READSTRINGLIST_ARGS, &FnCallReadStringList, "Read and assign a list variable from a file of separated strings",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_IO, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("readtcp", CF_DATA_TYPE_STRING, READTCP_ARGS, &FnCallReadTcp, "Connect to tcp port, send string and assign result to variable",
                   FNCALL_OPTION_CACHED, FNCALL_CATEGORY_COMM, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
 
@@ -11833,11 +12019,11 @@ const FnCallType CF_FNCALL_TYPES[] =
     FnCallTypeNew("splayclass", CF_DATA_TYPE_CONTEXT, SPLAYCLASS_ARGS, &FnCallSplayClass, "True if the first argument's time-slot has arrived, according to a policy in arg2",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("splitstring", CF_DATA_TYPE_STRING_LIST, SPLITSTRING_ARGS, &FnCallSplitString, "Convert a string in arg1 into a list of max arg3 strings by splitting on a regular expression in arg2",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_DEPRECATED, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_DEPRECATED, DEFAULT_ARGC),
     FnCallTypeNew("storejson", CF_DATA_TYPE_STRING, STOREJSON_ARGS, &FnCallStoreJson, "Convert a list or array or data container to a JSON string",
                   FNCALL_OPTION_COLLECTING, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("strcmp", CF_DATA_TYPE_CONTEXT, STRCMP_ARGS, &FnCallStrCmp, "True if the two strings match exactly",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("strftime", CF_DATA_TYPE_STRING, STRFTIME_ARGS, &FnCallStrftime, "Format a date and time string",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("sublist", CF_DATA_TYPE_STRING_LIST, SUBLIST_ARGS, &FnCallSublist, "Returns arg3 element from either the head or the tail (according to arg2) of list or array or data container arg1.",
@@ -11847,7 +12033,7 @@ const FnCallType CF_FNCALL_TYPES[] =
     FnCallTypeNew("data_sysctlvalues", CF_DATA_TYPE_CONTAINER, DATA_SYSCTLVALUES_ARGS, &FnCallSysctlValue, "Returns a data container map of all the sysctl key,value pairs",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_SYSTEM, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("translatepath", CF_DATA_TYPE_STRING, TRANSLATEPATH_ARGS, &FnCallTranslatePath, "Translate path separators from Unix style to the host's native",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_FILES, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_FILES, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("unique", CF_DATA_TYPE_STRING_LIST, UNIQUE_ARGS, &FnCallSetop, "Returns all the unique elements of list or array or data container arg1",
                   FNCALL_OPTION_COLLECTING, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("usemodule", CF_DATA_TYPE_CONTEXT, USEMODULE_ARGS, &FnCallUseModule, "Execute cfengine module script and set class if successful",
@@ -11855,13 +12041,13 @@ const FnCallType CF_FNCALL_TYPES[] =
     FnCallTypeNew("userexists", CF_DATA_TYPE_CONTEXT, USEREXISTS_ARGS, &FnCallUserExists, "True if user name or numerical id exists on this host",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_SYSTEM, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("validdata", CF_DATA_TYPE_CONTEXT, VALIDDATA_ARGS, &FnCallValidData, "Check for errors in JSON or YAML data",
-                  FNCALL_OPTION_VARARG, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(2, 3)),
+                  FNCALL_OPTION_VARARG | FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(2, 3)),
     FnCallTypeNew("validjson", CF_DATA_TYPE_CONTEXT, VALIDJSON_ARGS, &FnCallValidJson, "Check for errors in JSON data",
-                  FNCALL_OPTION_VARARG, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
+                  FNCALL_OPTION_VARARG | FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
     FnCallTypeNew("variablesmatching", CF_DATA_TYPE_STRING_LIST, CLASSMATCH_ARGS, &FnCallVariablesMatching, "List the variables matching regex arg1 and tag regexes arg2,arg3,...",
                   FNCALL_OPTION_VARARG, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(1, -1)),
     FnCallTypeNew("version_compare", CF_DATA_TYPE_CONTEXT, VERSION_COMPARE_ARGS, &FnCallVersionCompare, "Compare two version numbers with a specified operator",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_UTILS, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("findlocalusers", CF_DATA_TYPE_CONTAINER, FIND_LOCAL_USERS_ARGS, &FnCallFindLocalUsers, "Find matching local users",
                   FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("findlocalgroups", CF_DATA_TYPE_CONTAINER, FIND_LOCAL_USERS_ARGS, &FnCallFindLocalGroups, "Find matching local groups",
@@ -11871,27 +12057,27 @@ const FnCallType CF_FNCALL_TYPES[] =
     FnCallTypeNew("string_mustache", CF_DATA_TYPE_STRING, STRING_MUSTACHE_ARGS, &FnCallStringMustache, "Expand a Mustache template from arg1 into a string using the optional data container in arg2 or datastate()",
                   FNCALL_OPTION_COLLECTING|FNCALL_OPTION_VARARG, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, ARGC(1, 2)),
     FnCallTypeNew("string_split", CF_DATA_TYPE_STRING_LIST, SPLITSTRING_ARGS, &FnCallStringSplit, "Convert a string in arg1 into a list of at most arg3 strings by splitting on a regular expression in arg2",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("string_replace", CF_DATA_TYPE_STRING, STRING_REPLACE_ARGS, &FnCallStringReplace, "Search through arg1, replacing occurences of arg2 with arg3.",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("string_trim", CF_DATA_TYPE_STRING, STRING_TRIM_ARGS, &FnCallStringTrim, "Trim whitespace from beginning and end of string",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("regex_replace", CF_DATA_TYPE_STRING, REGEX_REPLACE_ARGS, &FnCallRegReplace, "Replace occurrences of arg1 in arg2 with arg3, allowing backreferences.  Perl-style options accepted in arg4.",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
 
     // Text xform functions
     FnCallTypeNew("string_downcase", CF_DATA_TYPE_STRING, XFORM_ARGS, &FnCallTextXform, "Convert a string to lowercase",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("string_head", CF_DATA_TYPE_STRING, XFORM_SUBSTR_ARGS, &FnCallTextXform, "Extract characters from the head of the string",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("string_reverse", CF_DATA_TYPE_STRING, XFORM_ARGS, &FnCallTextXform, "Reverse a string",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("string_length", CF_DATA_TYPE_INT, XFORM_ARGS, &FnCallTextXform, "Return the length of a string",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("string_tail", CF_DATA_TYPE_STRING, XFORM_SUBSTR_ARGS, &FnCallTextXform, "Extract characters from the tail of the string",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
     FnCallTypeNew("string_upcase", CF_DATA_TYPE_STRING, XFORM_ARGS, &FnCallTextXform, "Convert a string to UPPERCASE",
-                  FNCALL_OPTION_NONE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
+                  FNCALL_OPTION_PURE, FNCALL_CATEGORY_DATA, SYNTAX_STATUS_NORMAL, DEFAULT_ARGC),
 
     // List folding functions
     FnCallTypeNew("length", CF_DATA_TYPE_INT, STAT_FOLD_ARGS, &FnCallLength, "Return the length of a list or array or data container",
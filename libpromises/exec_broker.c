@@ -0,0 +1,318 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <exec_broker.h>
+
+#include <exec_tools.h>                     /* ArgSplitCommand, ArgFree */
+#include <passopenfile.h>                   /* PassOpenFile_Put/_Get */
+#include <string_lib.h>
+#include <logging.h>
+#include <alloc.h>
+
+#ifndef __MINGW32__
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static int BROKER_SOCKET = -1; /* GLOBAL_X */
+static pid_t BROKER_PID = -1; /* GLOBAL_X */
+static pthread_mutex_t broker_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+/**
+ * Set up the output descriptors in the command child: stdin from
+ * /dev/null, stdout/stderr either to #outfd or discarded, depending on
+ * #output_select (mirrors ChildOutputSelectDupClose() in pipes_unix.c).
+ */
+static void BrokerChildSetupFds(int outfd, OutputSelect output_select)
+{
+    int nullfd = open(NULLFILE, O_RDWR);
+    if (nullfd != -1)
+    {
+        dup2(nullfd, 0);
+    }
+
+    if ((output_select == OUTPUT_SELECT_BOTH)
+        || (output_select == OUTPUT_SELECT_STDOUT))
+    {
+        dup2(outfd, 1);
+    }
+    else if (nullfd != -1)
+    {
+        dup2(nullfd, 1);
+    }
+
+    if ((output_select == OUTPUT_SELECT_BOTH)
+        || (output_select == OUTPUT_SELECT_STDERR))
+    {
+        dup2(outfd, 2);
+    }
+    else if (nullfd != -1)
+    {
+        dup2(nullfd, 2);
+    }
+
+    if (nullfd != -1)
+    {
+        close(nullfd);
+    }
+    close(outfd);
+}
+
+/**
+ * One request: "<shell> <output_select> <command>". Forks, execs and
+ * waits for the command, then reports its wait status back on the
+ * socket. Returns false when the requesting side is gone.
+ */
+static bool BrokerServeOne(int sock)
+{
+    char *request = NULL;
+    int outfd = PassOpenFile_Get(sock, &request);
+    if (outfd < 0 || request == NULL)
+    {
+        free(request);
+        return false;                /* peer closed the socket (or error) */
+    }
+
+    /* Parse the command in place: expanded command lines have no length
+     * limit, so copying into a fixed-size buffer would overflow. */
+    int shell, output_select;
+    int command_offset = -1;
+    if (sscanf(request, "%d %d %n", &shell, &output_select,
+               &command_offset) != 2 ||
+        command_offset < 0 || request[command_offset] == '\0')
+    {
+        free(request);
+        close(outfd);
+        return true;                        /* malformed, drop the request */
+    }
+    const char *command = request + command_offset;
+
+    pid_t pid = fork();
+    if (pid == 0)                                               /* command */
+    {
+        signal(SIGPIPE, SIG_DFL);
+        close(sock);
+        BrokerChildSetupFds(outfd, (OutputSelect) output_select);
+
+        if ((ShellType) shell == SHELL_TYPE_USE)
+        {
+            execl(SHELL_PATH, "sh", "-c", command, NULL);
+        }
+        else
+        {
+            char **argv = ArgSplitCommand(command, NULL);
+            if (argv != NULL)
+            {
+                execv(argv[0], argv);
+            }
+        }
+        _exit(EXIT_FAILURE);
+    }
+
+    free(request);          /* the command child has its own copy */
+    close(outfd);           /* command holds the only remaining write end */
+
+    int status = -1;
+    if (pid > 0)
+    {
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+        {
+        }
+        status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+    char reply[32];
+    snprintf(reply, sizeof(reply), "%d\n", status);
+    ssize_t ret = write(sock, reply, strlen(reply));
+    return (ret > 0);
+}
+
+bool ExecBrokerStart(void)
+{
+    assert(BROKER_PID == -1);
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Failed to create executor broker socket. (socketpair: %s)",
+            GetErrorStr());
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Failed to fork executor broker. (fork: %s)", GetErrorStr());
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+
+    if (pid == 0)                                                /* broker */
+    {
+        close(sv[0]);
+        signal(SIGINT, SIG_IGN);      /* exits when the socket closes */
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGPIPE, SIG_IGN);
+
+        while (BrokerServeOne(sv[1]))
+        {
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(sv[1]);
+    BROKER_SOCKET = sv[0];
+    BROKER_PID = pid;
+    Log(LOG_LEVEL_VERBOSE,
+        "Started executor broker (PID %jd)", (intmax_t) pid);
+    return true;
+}
+
+bool ExecBrokerIsRunning(void)
+{
+    return (BROKER_PID != -1);
+}
+
+FILE *ExecBrokerPopen(const char *command, ShellType shell,
+                      OutputSelect output_select)
+{
+    assert(BROKER_PID != -1);
+
+    int pd[2];
+    if (pipe(pd) == -1)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Failed to create pipe for brokered command. (pipe: %s)",
+            GetErrorStr());
+        return NULL;
+    }
+
+    char *request = StringFormat("%d %d %s",
+                                 (int) shell, (int) output_select, command);
+
+    /* Held until the matching ExecBrokerPclose(): one command in flight. */
+    pthread_mutex_lock(&broker_lock);
+
+    bool sent = PassOpenFile_Put(BROKER_SOCKET, pd[1], request);
+    free(request);
+    close(pd[1]);
+
+    if (!sent)
+    {
+        pthread_mutex_unlock(&broker_lock);
+        Log(LOG_LEVEL_ERR, "Failed to pass command to executor broker");
+        close(pd[0]);
+        return NULL;
+    }
+
+    FILE *fp = fdopen(pd[0], "r");
+    if (fp == NULL)
+    {
+        /* Still need to consume the broker's status reply. */
+        close(pd[0]);
+        char c;
+        while (read(BROKER_SOCKET, &c, 1) == 1 && c != '\n')
+        {
+        }
+        pthread_mutex_unlock(&broker_lock);
+    }
+    return fp;
+}
+
+int ExecBrokerPclose(FILE *fp)
+{
+    assert(BROKER_PID != -1);
+
+    fclose(fp);
+
+    char reply[32];
+    size_t len = 0;
+    while (len < sizeof(reply) - 1)
+    {
+        ssize_t got = read(BROKER_SOCKET, reply + len, 1);
+        if (got != 1 || reply[len] == '\n')
+        {
+            break;
+        }
+        len++;
+    }
+    reply[len] = '\0';
+
+    pthread_mutex_unlock(&broker_lock);
+
+    int status = -1;
+    sscanf(reply, "%d", &status);
+    return status;
+}
+
+void ExecBrokerShutdown(void)
+{
+    if (BROKER_PID == -1)
+    {
+        return;
+    }
+
+    close(BROKER_SOCKET);              /* makes the broker's loop return */
+    BROKER_SOCKET = -1;
+
+    while (waitpid(BROKER_PID, NULL, 0) == -1 && errno == EINTR)
+    {
+    }
+    BROKER_PID = -1;
+}
+
+#else  /* __MINGW32__ */
+
+/* No fork() on Windows: commands always go through the direct paths. */
+
+bool ExecBrokerStart(void)
+{
+    return false;
+}
+
+bool ExecBrokerIsRunning(void)
+{
+    return false;
+}
+
+FILE *ExecBrokerPopen(ARG_UNUSED const char *command,
+                      ARG_UNUSED ShellType shell,
+                      ARG_UNUSED OutputSelect output_select)
+{
+    return NULL;
+}
+
+int ExecBrokerPclose(ARG_UNUSED FILE *fp)
+{
+    return -1;
+}
+
+void ExecBrokerShutdown(void)
+{
+}
+
+#endif  /* __MINGW32__ */
@@ -0,0 +1,77 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_EXEC_BROKER_H
+#define CFENGINE_EXEC_BROKER_H
+
+#include <cf3.defs.h>                       /* ShellType, OutputSelect */
+
+/**
+ * @file exec_broker.h
+ *
+ * Command execution through an early-forked helper process.
+ *
+ * fork()ing a grown cf-agent copies the page tables of its whole
+ * address space for every commands promise. The broker is forked once
+ * at startup, while the process is still small, and from then on does
+ * the fork()+exec() on the agent's behalf: the agent hands it a command
+ * and the write end of a pipe (over a socketpair, using the
+ * passopenfile fd-passing helpers) and reads the output back through
+ * the pipe as usual.
+ *
+ * Only the plain cf_popen_select()/cf_popen_sh_select() cases are
+ * brokered; executions needing setuid/chroot containment keep the
+ * direct fork() path.
+ */
+
+/**
+ * Fork the broker process. Call as early as possible, before the
+ * process image grows. Failure is not fatal: callers fall back to
+ * direct fork().
+ */
+bool ExecBrokerStart(void);
+
+bool ExecBrokerIsRunning(void);
+
+/**
+ * Run #command via the broker, returning a stream of its output (as
+ * cf_popen_select(command, "rt", ...)). Serializes callers: the broker
+ * handles one command at a time and the matching ExecBrokerPclose()
+ * releases it for the next.
+ */
+FILE *ExecBrokerPopen(const char *command, ShellType shell,
+                      OutputSelect output_select);
+
+/**
+ * Close a stream from ExecBrokerPopen() and return the command's exit
+ * code (-1 on abnormal termination), like cf_pclose().
+ */
+int ExecBrokerPclose(FILE *fp);
+
+/**
+ * Stop the broker process (waits for it to exit).
+ */
+void ExecBrokerShutdown(void);
+
+#endif
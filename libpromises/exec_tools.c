@@ -24,6 +24,7 @@
 
 #include <exec_tools.h>
 
+#include <exec_broker.h>
 #include <files_names.h>
 #include <files_interfaces.h>
 #include <pipes.h>
@@ -37,9 +38,21 @@
 bool GetExecOutput(const char *command, char **buffer, size_t *buffer_size, ShellType shell, OutputSelect output_select, int *ret_out)
 /* Buffer initially contains whole exec string */
 {
-    FILE *pp;
+    FILE *pp = NULL;
+    bool brokered = false;
 
-    if (shell == SHELL_TYPE_USE)
+    if (ExecBrokerIsRunning() && shell != SHELL_TYPE_POWERSHELL)
+    {
+        /* Fork from the small broker image instead of this process. */
+        pp = ExecBrokerPopen(command, shell, output_select);
+        brokered = (pp != NULL);
+    }
+
+    if (brokered)
+    {
+        /* stream already open */
+    }
+    else if (shell == SHELL_TYPE_USE)
     {
         pp = cf_popen_sh_select(command, "rt", output_select);
     }
@@ -76,7 +89,14 @@ bool GetExecOutput(const char *command, char **buffer, size_t *buffer_size, Shel
             if (!feof(pp))
             {
                 Log(LOG_LEVEL_ERR, "Unable to read output of command '%s'. (fread: %s)", command, GetErrorStr());
-                cf_pclose(pp);
+                if (brokered)
+                {
+                    ExecBrokerPclose(pp);
+                }
+                else
+                {
+                    cf_pclose(pp);
+                }
                 free(line);
                 return false;
             }
@@ -106,13 +126,10 @@ bool GetExecOutput(const char *command, char **buffer, size_t *buffer_size, Shel
 
     Log(LOG_LEVEL_DEBUG, "GetExecOutput got '%s'", *buffer);
 
+    int status = brokered ? ExecBrokerPclose(pp) : cf_pclose(pp);
     if (ret_out != NULL)
     {
-        *ret_out = cf_pclose(pp);
-    }
-    else
-    {
-        cf_pclose(pp);
+        *ret_out = status;
     }
 
     free(line);
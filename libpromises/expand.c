@@ -41,6 +41,7 @@
 #include <verify_vars.h>
 #include <string_lib.h>
 #include <conversion.h>
+#include <sysinfo.h>            /* SetDNSResolutionAllowed() */
 #include <verify_classes.h>
 
 /**
@@ -204,6 +205,19 @@ static PromiseResult ExpandPromiseAndDo(EvalContext *ctx, PromiseIterator *iterc
      *      act_on_promise is CommonEvalPromise(). */
     while (PromiseIteratorNext(iterctx, ctx) || !ifelse_actuated)
     {
+        /* Safe point: the bundle's wall-clock budget is checked between
+         * iterations, so a promise iterating over a large list cannot
+         * overrun the deadline by more than one actuation. The bundle-level
+         * skip is announced by ScheduleAgentOperations(). */
+        if (EvalContextBundleDeadlineExceeded(ctx))
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Bundle time budget exceeded, "
+                "skipping remaining iterations of promise");
+            result = PromiseResultUpdate(result, PROMISE_RESULT_SKIPPED);
+            break;
+        }
+
         /*
          * ACTUAL WORK PART 1: Get a (another) copy of the promise.
          *
@@ -261,12 +275,12 @@ PromiseResult ExpandPromise(EvalContext *ctx, const Promise *pp,
 
     if (!IsDefinedClass(ctx, pp->classes))
     {
-        Log(LOG_LEVEL_DEBUG,
-            "Skipping %s promise expansion with promiser '%s' due to class guard '%s::' (pass %d)",
-            PromiseGetPromiseType(pp),
-            pp->promiser,
-            pp->classes,
-            EvalContextGetPass(ctx));
+        LogLazy(LOG_LEVEL_DEBUG,
+                "Skipping %s promise expansion with promiser '%s' due to class guard '%s::' (pass %d)",
+                PromiseGetPromiseType(pp),
+                pp->promiser,
+                pp->classes,
+                EvalContextGetPass(ctx));
         return PROMISE_RESULT_SKIPPED;
     }
 
@@ -524,34 +538,61 @@ Rval ExpandBundleReference(EvalContext *ctx,
 char *ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope,
                    const char *string, Buffer *out)
 {
+    assert(string != NULL);
+
     bool out_belongs_to_us = false;
+    const size_t string_len = strlen(string);
 
     if (out == NULL)
     {
-        out               = BufferNew();
+        /* The result is rarely shorter than the input, so size the buffer
+         * for it up front instead of growing it append by append. */
+        out               = BufferNewWithCapacity(string_len + 1);
         out_belongs_to_us = true;
     }
 
-    assert(string != NULL);
     assert(out != NULL);
     Buffer *current_item = BufferNew();
 
-    for (const char *sp = string; *sp != '\0'; sp++)
+    const char *sp        = string;
+    const char *const end = string + string_len;
+
+    while (sp < end)
     {
-        BufferClear(current_item);
-        ExtractScalarPrefix(current_item, sp, strlen(sp));
+        /* Single pass: find the next "$(" or "${" with memchr() and copy
+         * the literal run before it straight into the output. The previous
+         * implementation re-ran strlen() on the remaining string and staged
+         * the literal prefix through an intermediate buffer on every loop
+         * round, which was quadratic on large templated strings. */
+        const char *next_ref = NULL;
+        for (const char *dp = memchr(sp, '$', end - sp);
+             dp != NULL && dp + 1 < end;
+             dp = memchr(dp + 1, '$', end - dp - 1))
+        {
+            if (dp[1] == '(' || dp[1] == '{')
+            {
+                next_ref = dp;
+                break;
+            }
+        }
 
-        BufferAppend(out, BufferData(current_item), BufferSize(current_item));
-        sp += BufferSize(current_item);
-        if (*sp == '\0')
+        if (next_ref == NULL)
         {
+            BufferAppend(out, sp, end - sp);
             break;
         }
 
+        if (next_ref > sp)
+        {
+            BufferAppend(out, sp, next_ref - sp);
+            sp = next_ref;
+        }
+
         BufferClear(current_item);
         char varstring = sp[1];
-        ExtractScalarReference(current_item,  sp, strlen(sp), true);
-        sp += BufferSize(current_item) + 2;
+        ExtractScalarReference(current_item,  sp, end - sp, true);
+        /* "$(" + extracted name + ")" */
+        sp += BufferSize(current_item) + 3;
 
         if (IsCf3VarString(BufferData(current_item)))
         {
@@ -757,7 +798,7 @@ static int PointerCmp(const void *a, const void *b, ARG_UNUSED void *user_data)
     }
 }
 
-static void RemoveRemotelyInjectedVars(const EvalContext *ctx, const Bundle *bundle)
+static void RemoveRemotelyInjectedVars(EvalContext *ctx, const Bundle *bundle)
 {
     const Seq *remote_var_promises = EvalContextGetRemoteVarPromises(ctx, bundle->name);
     if ((remote_var_promises == NULL) || SeqLength(remote_var_promises) == 0)
@@ -1000,6 +1041,17 @@ static void ResolveControlBody(EvalContext *ctx, GenericAgentConfig *config,
                                      cache_system_functions);
         }
 
+        if (strcmp(lval, CFG_CONTROLBODY[COMMON_CONTROL_STARTUP_DNS_RESOLUTION].lval) == 0)
+        {
+            Log(LOG_LEVEL_VERBOSE, "SET startup_dns_resolution %s",
+                RvalScalarValue(evaluated_rval));
+            if (StringIsBoolean(RvalScalarValue(evaluated_rval)))
+            {
+                SetDNSResolutionAllowed(BooleanFromString(
+                    RvalScalarValue(evaluated_rval)));
+            }
+        }
+
         if (strcmp(lval, CFG_CONTROLBODY[COMMON_CONTROL_PROTOCOL_VERSION].lval) == 0)
         {
             config->protocol_version = ProtocolVersionParse(
@@ -1089,6 +1141,11 @@ static void ResolvePackageManagerBody(EvalContext *ctx, const Body *pm_body)
         {
             new_manager->options = RlistCopy(RvalRlistValue(returnval));
         }
+        else if (strcmp(cp->lval, "query_installed_state_files") == 0)
+        {
+            new_manager->installed_state_files =
+                    RlistCopy(RvalRlistValue(returnval));
+        }
         else if (strcmp(cp->lval, "interpreter") == 0)
         {
             assert(new_manager->interpreter == NULL);
@@ -1161,6 +1218,33 @@ void PolicyResolve(EvalContext *ctx, const Policy *policy,
     }
 }
 
+bool RvalIsExpandable(Rval rval)
+{
+    switch (rval.type)
+    {
+    case RVAL_TYPE_SCALAR:
+        return (IsNakedVar(rval.item, '@') ||
+                IsExpandable(rval.item));
+
+    case RVAL_TYPE_LIST:
+        for (const Rlist *rp = rval.item; rp != NULL; rp = rp->next)
+        {
+            if (rp->val.type != RVAL_TYPE_SCALAR ||
+                IsNakedVar(rp->val.item, '@') ||
+                IsExpandable(rp->val.item))
+            {
+                return true;
+            }
+        }
+        return false;
+
+    default:
+        /* Function calls must always be evaluated, and containers are not
+         * worth scanning -- treat both as expandable. */
+        return true;
+    }
+}
+
 bool IsExpandable(const char *str)
 {
     char left = 'x', right = 'x';
@@ -1216,8 +1300,8 @@ bool IsExpandable(const char *str)
 
     if (vars > 0)
     {
-        Log(LOG_LEVEL_DEBUG,
-            "Expanding variable '%s': found %d variables", str, vars);
+        LogLazy(LOG_LEVEL_DEBUG,
+                "Expanding variable '%s': found %d variables", str, vars);
     }
     return (vars > 0);
 }
@@ -39,6 +39,12 @@ Rval ExpandDanglers(EvalContext *ctx, const char *ns, const char *scope, Rval rv
 
 bool IsExpandable(const char *str);
 
+/**
+ * Whether expanding @a rval could yield anything other than a plain copy.
+ * Conservative: function calls and containers always count as expandable.
+ */
+bool RvalIsExpandable(Rval rval);
+
 char *ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope,
                    const char *string, Buffer *out);
 Rval ExpandBundleReference(EvalContext *ctx, const char *ns, const char *scope, Rval rval);
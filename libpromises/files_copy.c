@@ -35,6 +35,160 @@
 #include <file_lib.h>
 #include <string_lib.h>
 #include <acl_tools.h>
+#include <hash.h>                                      /* HashDigestFromId */
+
+#ifdef HAVE_LINUX_FS_H
+#include <sys/ioctl.h>                                             /* ioctl */
+#include <linux/fs.h>                                            /* FICLONE */
+#endif
+
+#if HAVE_DECL_FICLONE
+/**
+ * Try to clone (reflink) @a sd into @a dd instead of copying the contents.
+ * Only possible when both files are on the same filesystem and it supports
+ * cloning (btrfs, XFS with reflink, ...).  A clone shares the source's
+ * extents, so it is O(1) regardless of file size and preserves sparseness.
+ *
+ * @return true if the destination now holds a clone of the source; false
+ *         means no harm done, fall back to copying the contents.
+ */
+static bool FileCloneContents(int sd, int dd,
+                              const char *source, const char *destination)
+{
+    if (ioctl(dd, FICLONE, sd) == -1)
+    {
+        Log(LOG_LEVEL_DEBUG,
+            "Could not clone '%s' to '%s' (ioctl(FICLONE): %s),"
+            " falling back to copying the contents",
+            source, destination, GetErrorStr());
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Cloned '%s' to '%s'", source, destination);
+    return true;
+}
+#else
+static bool FileCloneContents(ARG_UNUSED int sd, ARG_UNUSED int dd,
+                              ARG_UNUSED const char *source,
+                              ARG_UNUSED const char *destination)
+{
+    return false;
+}
+#endif  /* HAVE_DECL_FICLONE */
+
+#if defined(HAVE_COPY_FILE_RANGE) && HAVE_DECL_SEEK_DATA
+/**
+ * Copy the contents of @a sd into @a dd by walking the source's extent map
+ * with lseek(SEEK_DATA/SEEK_HOLE) and handing each data extent to
+ * copy_file_range(2).  The data never crosses into user space, holes are
+ * skipped without reading them, and the destination's layout mirrors the
+ * source's instead of being rediscovered by scanning for zero blocks.
+ *
+ * On success @a total_bytes_written and @a last_write_was_hole are set for
+ * FileSparseClose() just like FileSparseCopy() would set them.
+ *
+ * @return true on success; false means no harm done (the destination is
+ *         truncated back to empty), fall back to FileSparseCopy().
+ */
+static bool FileExtentCopy(int sd, int dd, const char *source,
+                           const char *destination, size_t size,
+                           size_t *total_bytes_written,
+                           bool *last_write_was_hole)
+{
+    off_t end_of_data = 0;
+
+    off_t data = lseek(sd, 0, SEEK_DATA);
+    if ((data == (off_t) -1) && (errno != ENXIO))
+    {
+        /* The filesystem does not support SEEK_DATA */
+        Log(LOG_LEVEL_DEBUG,
+            "Cannot walk extents of '%s' (lseek(SEEK_DATA): %s),"
+            " falling back to copying block by block",
+            source, GetErrorStr());
+        lseek(sd, 0, SEEK_SET);
+        return false;
+    }
+
+    while (data != (off_t) -1)
+    {
+        /* Every file has a virtual hole at EOF, so this always succeeds on
+         * filesystems that got us this far. */
+        const off_t hole = lseek(sd, data, SEEK_HOLE);
+        if (hole == (off_t) -1)
+        {
+            Log(LOG_LEVEL_DEBUG,
+                "Cannot walk extents of '%s' (lseek(SEEK_HOLE): %s),"
+                " falling back to copying block by block",
+                source, GetErrorStr());
+            goto fail;
+        }
+
+        off_t off_in = data;
+        off_t off_out = data;
+        while (off_in < hole)
+        {
+            ssize_t copied = copy_file_range(sd, &off_in, dd, &off_out,
+                                             hole - off_in, 0);
+            if (copied == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (copied <= 0)
+            {
+                /* E.g. EXDEV or ENOSYS; a short positive return just loops */
+                Log(LOG_LEVEL_DEBUG,
+                    "Cannot copy extent of '%s' to '%s' (copy_file_range: %s),"
+                    " falling back to copying block by block",
+                    source, destination, GetErrorStr());
+                goto fail;
+            }
+        }
+        end_of_data = hole;
+
+        data = lseek(sd, hole, SEEK_DATA);
+        if ((data == (off_t) -1) && (errno != ENXIO))
+        {
+            Log(LOG_LEVEL_DEBUG,
+                "Cannot walk extents of '%s' (lseek(SEEK_DATA): %s),"
+                " falling back to copying block by block",
+                source, GetErrorStr());
+            goto fail;
+        }
+    }
+
+    /* ENXIO: no data between the last extent and EOF.  If that gap is
+     * non-empty the file ends in a hole, which FileSparseClose() will
+     * materialize by truncating the destination up to the full size. */
+    *total_bytes_written = size;
+    *last_write_was_hole = ((size_t) end_of_data < size);
+
+    Log(LOG_LEVEL_VERBOSE, "Copied extents of '%s' to '%s'",
+        source, destination);
+    return true;
+
+  fail:
+    /* Leave both descriptors the way FileSparseCopy() expects them */
+    if (ftruncate(dd, 0) == -1)
+    {
+        Log(LOG_LEVEL_INFO,
+            "Failed to truncate '%s' after aborted extent copy"
+            " (ftruncate: %s)", destination, GetErrorStr());
+    }
+    lseek(sd, 0, SEEK_SET);
+    lseek(dd, 0, SEEK_SET);
+    return false;
+}
+#else
+static bool FileExtentCopy(ARG_UNUSED int sd, ARG_UNUSED int dd,
+                           ARG_UNUSED const char *source,
+                           ARG_UNUSED const char *destination,
+                           ARG_UNUSED size_t size,
+                           ARG_UNUSED size_t *total_bytes_written,
+                           ARG_UNUSED bool *last_write_was_hole)
+{
+    return false;
+}
+#endif /* HAVE_COPY_FILE_RANGE && HAVE_DECL_SEEK_DATA */
 
 bool CopyRegularFileDiskPerms(const char *source, const char *destination,
                               int mode)
@@ -77,12 +231,25 @@ bool CopyRegularFileDiskPerms(const char *source, const char *destination,
         return false;
     }
 
+    if (FileCloneContents(sd, dd, source, destination))
+    {
+        close(sd);
+        close(dd);
+        return true;
+    }
+
     size_t total_bytes_written;
     bool last_write_was_hole;
-    bool ret = FileSparseCopy(sd, source, dd, destination,
-                              ST_BLKSIZE(statbuf),
+    bool ret = FileExtentCopy(sd, dd, source, destination,
+                              (size_t) statbuf.st_size,
                               &total_bytes_written, &last_write_was_hole);
     if (!ret)
+    {
+        ret = FileSparseCopy(sd, source, dd, destination,
+                             ST_BLKSIZE(statbuf),
+                             &total_bytes_written, &last_write_was_hole);
+    }
+    if (!ret)
     {
         unlink(destination);
         close(sd);
@@ -141,11 +308,24 @@ bool CopyRegularFileDisk(const char *source, const char *destination)
         goto end;
     }
 
+    if (FileCloneContents(sd, dd, source, destination))
+    {
+        close(dd);
+        ok1 = ok2 = true;
+        goto end;
+    }
+
     size_t total_bytes_written;
     bool   last_write_was_hole;
-    ok1 = FileSparseCopy(sd, source, dd, destination,
-                         ST_BLKSIZE(statbuf),
+    ok1 = FileExtentCopy(sd, dd, source, destination,
+                         (size_t) statbuf.st_size,
                          &total_bytes_written, &last_write_was_hole);
+    if (!ok1)
+    {
+        ok1 = FileSparseCopy(sd, source, dd, destination,
+                             ST_BLKSIZE(statbuf),
+                             &total_bytes_written, &last_write_was_hole);
+    }
     bool do_sync = false;
     ok2 = FileSparseClose(dd, destination, do_sync,
                           total_bytes_written, last_write_was_hole);
@@ -163,6 +343,170 @@ bool CopyRegularFileDisk(const char *source, const char *destination)
     return ok1 && ok2;
 }
 
+/* Read size for the digest-while-copy path: large reads keep the syscall
+ * count low and hand OpenSSL's digest code full buffers. */
+#define COPY_DIGEST_BUFFER_SIZE (1024 * 1024)
+
+static bool BufferIsAllZero(const char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (buf[i] != '\0')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CopyRegularFileDiskDigest(const char *source, const char *destination,
+                               int mode, HashMethod hash_method,
+                               unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    assert(source != NULL);
+    assert(destination != NULL);
+    assert(digest != NULL);
+
+    const EVP_MD *const md = HashDigestFromId(hash_method);
+    if (md == NULL)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Could not determine hash function for digest type %d",
+            hash_method);
+        return false;
+    }
+
+    int sd = safe_open(source, O_RDONLY | O_BINARY);
+    if (sd == -1)
+    {
+        Log(LOG_LEVEL_INFO, "Can't copy '%s' (open: %s)",
+            source, GetErrorStr());
+        return false;
+    }
+
+    struct stat statbuf;
+    if (fstat(sd, &statbuf) == -1)
+    {
+        Log(LOG_LEVEL_INFO, "Can't copy '%s' (fstat: %s)",
+            source, GetErrorStr());
+        close(sd);
+        return false;
+    }
+
+    if (mode == -1)
+    {
+        /* Preserve the source file's permissions */
+        mode = statbuf.st_mode;
+    }
+
+    /* unlink() + safe_open(O_CREAT|O_EXCL) to avoid
+       symlink attacks and races. */
+    unlink(destination);
+
+    int dd = safe_open_create_perms(destination,
+                                    O_WRONLY | O_CREAT | O_EXCL | O_BINARY,
+                                    mode);
+    if (dd == -1)
+    {
+        Log(LOG_LEVEL_INFO,
+            "Unable to open destination file while copying '%s' to '%s'"
+            " (open: %s)", source, destination, GetErrorStr());
+        close(sd);
+        return false;
+    }
+
+    EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+    if ((md_ctx == NULL) || (EVP_DigestInit(md_ctx, md) != 1))
+    {
+        Log(LOG_LEVEL_ERR, "Could not initialize openssl hash context");
+        EVP_MD_CTX_free(md_ctx);
+        close(sd);
+        close(dd);
+        unlink(destination);
+        return false;
+    }
+
+    char *buf = xmalloc(COPY_DIGEST_BUFFER_SIZE);
+    size_t total = 0;
+    bool last_write_was_hole = false;
+    bool ok = true;
+
+    ssize_t n_read;
+    while ((n_read = read(sd, buf, COPY_DIGEST_BUFFER_SIZE)) > 0)
+    {
+        EVP_DigestUpdate(md_ctx, buf, n_read);
+
+        if (BufferIsAllZero(buf, n_read))
+        {
+            /* Keep the destination sparse, the same way FileSparseCopy()
+             * does it: seek over the zeroes instead of writing them. */
+            if (lseek(dd, n_read, SEEK_CUR) == (off_t) -1)
+            {
+                Log(LOG_LEVEL_ERR,
+                    "Failed to seek over hole in '%s' (lseek: %s)",
+                    destination, GetErrorStr());
+                ok = false;
+                break;
+            }
+            last_write_was_hole = true;
+        }
+        else
+        {
+            if (FullWrite(dd, buf, n_read) != n_read)
+            {
+                Log(LOG_LEVEL_ERR,
+                    "Failed to write to destination file '%s' (write: %s)",
+                    destination, GetErrorStr());
+                ok = false;
+                break;
+            }
+            last_write_was_hole = false;
+        }
+
+        total += n_read;
+    }
+    if (n_read == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Error reading file '%s' (read: %s)",
+            source, GetErrorStr());
+        ok = false;
+    }
+    free(buf);
+    close(sd);
+
+    if (ok && last_write_was_hole)
+    {
+        /* Materialize a trailing hole */
+        if (ftruncate(dd, total) == -1)
+        {
+            Log(LOG_LEVEL_ERR,
+                "Failed to set length of destination file '%s'"
+                " (ftruncate: %s)", destination, GetErrorStr());
+            ok = false;
+        }
+    }
+
+    if (close(dd) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to close destination file '%s' (close: %s)",
+            destination, GetErrorStr());
+        ok = false;
+    }
+
+    if (ok)
+    {
+        unsigned int md_len;
+        EVP_DigestFinal(md_ctx, digest, &md_len);
+    }
+    else
+    {
+        unlink(destination);
+    }
+    EVP_MD_CTX_free(md_ctx);
+
+    return ok;
+}
+
 bool CopyFilePermissionsDisk(const char *source, const char *destination)
 {
     struct stat statbuf;
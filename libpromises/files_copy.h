@@ -39,6 +39,21 @@
 bool CopyRegularFileDiskPerms(const char *source, const char *destination,
                               const int mode);
 bool CopyRegularFileDisk(const char *source, const char *destination);
+
+/**
+ * Copy #source to #destination like CopyRegularFileDiskPerms(), additionally
+ * computing the digest of the written contents with #hash_method on the way
+ * through.  On success #digest holds the destination's digest without the
+ * destination ever being read back.  This path always pumps the data through
+ * user space (the digest has to see it), so it skips reflinks and
+ * copy_file_range(); sparseness is preserved by seeking over all-zero blocks.
+ *
+ * @param mode the destination's creation mode, or -1 to copy the source's
+ * @return true on success; #digest is only valid on success
+ */
+bool CopyRegularFileDiskDigest(const char *source, const char *destination,
+                               int mode, HashMethod hash_method,
+                               unsigned char digest[EVP_MAX_MD_SIZE + 1]);
 bool CopyFilePermissionsDisk(const char *source, const char *destination);
 bool CopyFileExtendedAttributesDisk(const char *source, const char *destination, bool *change);
 
@@ -37,12 +37,13 @@
 #include <string_lib.h>
 #include <rlist.h>
 #include <stat_cache.h>                                      /* remote_stat */
+#include <files_timeout.h>                                    /* TimedLstat */
 
 int cf_lstat(const char *file, struct stat *buf, const FileCopy *fc, AgentConnection *conn)
 {
     if (conn == NULL)
     {
-        int ret = lstat(file, buf);
+        int ret = TimedLstat(file, buf);
         if (ret == -1)
         {
             Log(LOG_LEVEL_ERR, "lstat: %s", GetErrorStr());
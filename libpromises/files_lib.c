@@ -463,6 +463,11 @@ bool LoadFileAsItemList(Item **liststart, const char *file, EditDefaults edits,
     char *line = xmalloc(line_size);
     bool result = true;
 
+    /* Build the list back to front and reverse it at the end: appending to
+     * the tail walks the whole list each time, which is quadratic on large
+     * files (see the note above AppendItem()). */
+    Item *lines = NULL;
+
     for (;;)
     {
         ssize_t num_read = CfReadLine(&line, &line_size, fp);
@@ -489,7 +494,7 @@ bool LoadFileAsItemList(Item **liststart, const char *file, EditDefaults edits,
             BufferAppend(concat, line, num_read);
             if (!feof(fp) || (BufferSize(concat) > 0))
             {
-                AppendItem(liststart, BufferData(concat), NULL);
+                PrependItem(&lines, BufferData(concat), NULL);
             }
         }
 
@@ -499,6 +504,17 @@ bool LoadFileAsItemList(Item **liststart, const char *file, EditDefaults edits,
     free(line);
     BufferDestroy(concat);
     fclose(fp);
+
+    lines = ReverseItemList(lines);
+    if (*liststart == NULL)
+    {
+        *liststart = lines;
+    }
+    else if (lines != NULL)
+    {
+        ConcatLists(*liststart, lines);
+    }
+
     return result;
 }
 
@@ -0,0 +1,299 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <files_timeout.h>
+
+#include <cf3.defs.h>
+#include <files_names.h>                                   /* ChopLastNode */
+#include <misc_lib.h>                              /* GetErrorStrFromCode */
+#include <string_lib.h>                                    /* StringEqual */
+#include <sequence.h>                                      /* Seq */
+#include <logging.h>                                       /* Log */
+#include <alloc.h>                                         /* xstrdup */
+
+/* How long a directory that swallowed a stat stays blocklisted.  Long
+ * enough to cover the rest of a depth_search, short enough that a mount
+ * that comes back is noticed within the same scheduling window. */
+#define DEAD_DIR_TTL 60
+
+/* Blocklist bound; a run hitting this many distinct dead directories has
+ * bigger problems than our bookkeeping, so the oldest entry is dropped. */
+#define DEAD_DIRS_MAX 64
+
+static unsigned int FS_TIMEOUT = 0;                        /* GLOBAL_P */
+
+typedef struct
+{
+    char *dir;
+    time_t expires;
+} DeadDir;
+
+static Seq *dead_dirs = NULL;                              /* GLOBAL_X */
+static pthread_mutex_t dead_dirs_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+void FsTimeoutSet(unsigned int seconds)
+{
+    FS_TIMEOUT = seconds;
+}
+
+unsigned int FsTimeoutGet(void)
+{
+    return FS_TIMEOUT;
+}
+
+static void DeadDirDestroy_untyped(void *p)
+{
+    DeadDir *entry = p;
+    if (entry != NULL)
+    {
+        free(entry->dir);
+        free(entry);
+    }
+}
+
+/* Does blocklist entry #dir cover #path: equal, or an ancestor of it? */
+static bool DirCoversPath(const char *dir, const char *path)
+{
+    const size_t dir_len = strlen(dir);
+    return (strncmp(dir, path, dir_len) == 0 &&
+            (path[dir_len] == '\0' || path[dir_len] == FILE_SEPARATOR));
+}
+
+static bool DeadDirCovers(const char *path)
+{
+    const time_t now = time(NULL);
+    bool covered = false;
+
+    pthread_mutex_lock(&dead_dirs_lock);
+
+    if (dead_dirs != NULL)
+    {
+        for (size_t i = SeqLength(dead_dirs); i > 0; i--)
+        {
+            DeadDir *entry = SeqAt(dead_dirs, i - 1);
+            if (now >= entry->expires)
+            {
+                SeqRemove(dead_dirs, i - 1);
+            }
+            else if (DirCoversPath(entry->dir, path))
+            {
+                covered = true;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&dead_dirs_lock);
+    return covered;
+}
+
+static void DeadDirAdd(const char *dir)
+{
+    DeadDir *entry = xmalloc(sizeof(DeadDir));
+    entry->dir = xstrdup(dir);
+    entry->expires = time(NULL) + DEAD_DIR_TTL;
+
+    pthread_mutex_lock(&dead_dirs_lock);
+
+    if (dead_dirs == NULL)
+    {
+        dead_dirs = SeqNew(DEAD_DIRS_MAX, DeadDirDestroy_untyped);
+    }
+    if (SeqLength(dead_dirs) >= DEAD_DIRS_MAX)
+    {
+        SeqRemove(dead_dirs, 0);
+    }
+    SeqAppend(dead_dirs, entry);
+
+    pthread_mutex_unlock(&dead_dirs_lock);
+}
+
+/**
+ * A stat in flight on a helper thread.  Owned jointly: whichever side is
+ * last to touch it (the caller normally, the abandoned helper after a
+ * timeout) destroys it.
+ */
+typedef struct
+{
+    char *path;
+    bool use_lstat;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+    bool abandoned;
+
+    struct stat sb;
+    int ret;
+    int err;
+} StatJob;
+
+static void StatJobDestroy(StatJob *job)
+{
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->cond);
+    free(job->path);
+    free(job);
+}
+
+static void *StatJobRun(void *arg)
+{
+    StatJob *job = arg;
+
+    struct stat sb;
+    const int ret = job->use_lstat
+        ? lstat(job->path, &sb) : stat(job->path, &sb);
+    const int err = errno;
+
+    pthread_mutex_lock(&job->lock);
+    if (job->abandoned)
+    {
+        /* Nobody is waiting any more; the result goes with us. */
+        pthread_mutex_unlock(&job->lock);
+        StatJobDestroy(job);
+        return NULL;
+    }
+    job->sb = sb;
+    job->ret = ret;
+    job->err = err;
+    job->done = true;
+    pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+
+    return NULL;
+}
+
+/**
+ * Run the stat on a helper thread and wait at most the armed timeout.
+ * #dir_key names the directory blamed (and blocklisted) if it hangs.
+ */
+static int StatWithTimeout(const char *dir_key, const char *path,
+                           bool use_lstat, struct stat *sb)
+{
+    if (DeadDirCovers(dir_key))
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Skipping stat of '%s': '%s' is blocklisted as unresponsive",
+            path, dir_key);
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    StatJob *job = xcalloc(1, sizeof(StatJob));
+    job->path = xstrdup(path);
+    job->use_lstat = use_lstat;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->cond, NULL);
+
+    pthread_attr_t attrs;
+    pthread_attr_init(&attrs);
+    pthread_attr_setdetachstate(&attrs, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attrs, 128 * 1024);
+
+    pthread_mutex_lock(&job->lock);
+
+    pthread_t tid;
+    int ret = pthread_create(&tid, &attrs, StatJobRun, job);
+    pthread_attr_destroy(&attrs);
+    if (ret != 0)
+    {
+        /* No helper, no timeout: better a blocking stat than none. */
+        Log(LOG_LEVEL_WARNING,
+            "Could not create stat helper thread (pthread_create: %s)",
+            GetErrorStrFromCode(ret));
+        pthread_mutex_unlock(&job->lock);
+        StatJobDestroy(job);
+        return use_lstat ? lstat(path, sb) : stat(path, sb);
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += FS_TIMEOUT;
+
+    ret = 0;
+    while (!job->done && ret != ETIMEDOUT)
+    {
+        ret = pthread_cond_timedwait(&job->cond, &job->lock, &deadline);
+    }
+
+    if (job->done)
+    {
+        const int stat_ret = job->ret;
+        const int stat_err = job->err;
+        *sb = job->sb;
+        pthread_mutex_unlock(&job->lock);
+        StatJobDestroy(job);
+        errno = stat_err;
+        return stat_ret;
+    }
+
+    /* The helper is stuck in the syscall; it destroys the job if it ever
+     * returns. */
+    job->abandoned = true;
+    pthread_mutex_unlock(&job->lock);
+
+    Log(LOG_LEVEL_NOTICE,
+        "Stat of '%s' did not return within %u seconds, "
+        "treating '%s' as unresponsive for %d seconds",
+        path, FS_TIMEOUT, dir_key, DEAD_DIR_TTL);
+    DeadDirAdd(dir_key);
+
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+static int TimedStatInternal(const char *path, bool use_lstat,
+                             struct stat *sb)
+{
+    if (FS_TIMEOUT == 0)
+    {
+        return use_lstat ? lstat(path, sb) : stat(path, sb);
+    }
+
+    /* Blame the containing directory: it is the mount that hangs, and the
+     * siblings a depth_search would try next are under the same parent. */
+    char dir_key[CF_BUFSIZE];
+    strlcpy(dir_key, path, sizeof(dir_key));
+    ChopLastNode(dir_key);
+
+    return StatWithTimeout(dir_key, path, use_lstat, sb);
+}
+
+int TimedStat(const char *path, struct stat *sb)
+{
+    return TimedStatInternal(path, false, sb);
+}
+
+int TimedLstat(const char *path, struct stat *sb)
+{
+    return TimedStatInternal(path, true, sb);
+}
+
+int TimedLstatAt(const char *dir, const char *leaf, struct stat *sb)
+{
+    if (FS_TIMEOUT == 0)
+    {
+        return lstat(leaf, sb);
+    }
+    return StatWithTimeout(dir, leaf, true, sb);
+}
@@ -0,0 +1,68 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_FILES_TIMEOUT_H
+#define CFENGINE_FILES_TIMEOUT_H
+
+#include <platform.h>
+
+/**
+ * Timeout-protected stat calls for files promises.
+ *
+ * A stat() against a dead network mount blocks uninterruptibly until the
+ * transport gives up, which can be minutes; one such mount inside a
+ * depth_search used to stall the whole agent run.  When a timeout is armed
+ * (body agent control fs_operation_timeout, disabled by default), the stat
+ * is performed by a short-lived helper thread; if it does not return in
+ * time, the helper is abandoned to its fate, the call fails with ETIMEDOUT,
+ * and the containing directory is remembered as unresponsive for a while so
+ * the rest of the search skips it without waiting again.
+ */
+
+/**
+ * Arm (or, with 0, disarm) the timeout, in seconds, applied by the Timed*()
+ * calls below.  Set from body agent control fs_operation_timeout.
+ */
+void FsTimeoutSet(unsigned int seconds);
+unsigned int FsTimeoutGet(void);
+
+/**
+ * stat()/lstat() replacements honouring the armed timeout.  With no timeout
+ * armed they are the plain syscalls.  On timeout they return -1 with errno
+ * ETIMEDOUT and blocklist the path's directory; calls under a blocklisted
+ * directory fail the same way immediately.
+ */
+int TimedStat(const char *path, struct stat *sb);
+int TimedLstat(const char *path, struct stat *sb);
+
+/**
+ * As TimedLstat() for directory entry #leaf, to be resolved relative to the
+ * current working directory, with #dir (the caller's name for that
+ * directory) used for the unresponsive-directory bookkeeping.  This is the
+ * DepthSearch() flavour: it stats entries relative to the directory it has
+ * chdir'd into.
+ */
+int TimedLstatAt(const char *dir, const char *leaf, struct stat *sb);
+
+#endif
@@ -394,7 +394,8 @@ FnCallResult FnCallEvaluate(EvalContext *ctx, const Policy *policy, FnCall *fp,
     if (if_elapsed != 0)
     {
         Rval cached_rval;
-        if ((fp_type->options & FNCALL_OPTION_CACHED) && EvalContextFunctionCacheGet(ctx, fp, expargs, &cached_rval))
+        if ((fp_type->options & (FNCALL_OPTION_CACHED | FNCALL_OPTION_PURE)) &&
+            EvalContextFunctionCacheGet(ctx, fp, expargs, &cached_rval))
         {
             if (LogGetGlobalLevel() >= LOG_LEVEL_DEBUG)
             {
@@ -433,12 +434,15 @@ FnCallResult FnCallEvaluate(EvalContext *ctx, const Policy *policy, FnCall *fp,
         return (FnCallResult) { FNCALL_FAILURE, { FnCallCopy(fp), RVAL_TYPE_FNCALL } };
     }
 
-    if (fp_type->options & FNCALL_OPTION_CACHED)
+    if (fp_type->options & (FNCALL_OPTION_CACHED | FNCALL_OPTION_PURE))
     {
-        Writer *w = StringWriter();
-        FnCallWrite(w, fp);
-        Log(LOG_LEVEL_VERBOSE, "Caching result for function '%s'", StringWriterData(w));
-        WriterClose(w);
+        if (fp_type->options & FNCALL_OPTION_CACHED)
+        {
+            Writer *w = StringWriter();
+            FnCallWrite(w, fp);
+            Log(LOG_LEVEL_VERBOSE, "Caching result for function '%s'", StringWriterData(w));
+            WriterClose(w);
+        }
 
         EvalContextFunctionCachePut(ctx, fp, expargs, &result.rval);
     }
@@ -78,6 +78,13 @@ typedef enum
     // Unsafe functions (with side effects) that should not be evaluated in
     // simulate mode(s).
     FNCALL_OPTION_UNSAFE = 1 << 4,
+    // Pure functions have no side effects and return the same result for the
+    // same (expanded) arguments as long as the system is unchanged. They are
+    // memoized for the whole run in a dedicated cache that is invalidated
+    // whenever a promise repairs something. Must not be combined with
+    // FNCALL_OPTION_COLLECTING or FNCALL_OPTION_DELAYED_EVALUATION, since
+    // those see unexpanded arguments and the cache key would be ambiguous.
+    FNCALL_OPTION_PURE = 1 << 5,
 } FnCallOption;
 
 typedef struct
@@ -50,6 +50,7 @@
 #include <unix.h>
 #include <client_code.h>
 #include <string_lib.h> // StringCopy()
+#include <string_intern.h>
 #include <regex.h>      // CompileRegex()
 #include <writer.h>
 #include <exec_tools.h>
@@ -73,6 +74,7 @@
 #include <libgen.h>
 #include <cleanup.h>
 #include <cmdb.h>               /* LoadCMDBData() */
+#include <changes_chroot.h>     /* UnmountChangesChrootOverlays() */
 #include "cf3.defs.h"
 
 #define AUGMENTS_VARIABLES_TAGS "tags"
@@ -86,6 +88,11 @@ static pthread_once_t pid_cleanup_once = PTHREAD_ONCE_INIT; /* GLOBAL_T */
 
 static char PIDFILE[CF_BUFSIZE] = ""; /* GLOBAL_C */
 
+/* Every augments file probed while loading def.json (expanded paths, whether
+ * or not the file existed), so that the compiled policy cache can detect
+ * augments additions, removals and edits. */
+static StringSet *AUGMENTS_FILES = NULL; /* GLOBAL_X */
+
 /* Used for 'ident' argument to openlog() */
 static char CF_PROGRAM_NAME[256] = "";
 
@@ -445,7 +452,8 @@ static bool LoadAugmentsData(EvalContext *ctx, const char *filename, const JsonE
                 }
                 if (ref->scope == NULL)
                 {
-                    ref->scope = xstrdup("def");
+                    ref->scope = (char *) StringIntern("def");
+                    ref->hash = 0;
                 }
 
                 JsonElement *data = JsonObjectGet(vars, vkey);
@@ -565,7 +573,8 @@ static bool LoadAugmentsData(EvalContext *ctx, const char *filename, const JsonE
                 }
                 if (ref->scope == NULL)
                 {
-                    ref->scope = xstrdup("def");
+                    ref->scope = (char *) StringIntern("def");
+                    ref->hash = 0;
                 }
 
                 const JsonElement *const var_info = JsonObjectGet(variables, vkey);
@@ -911,6 +920,15 @@ static bool LoadAugmentsFiles(EvalContext *ctx, const char *unexpanded_filename)
     {
         Log(LOG_LEVEL_DEBUG, "Searching for augments file '%s' (original '%s')",
             filename, unexpanded_filename);
+
+        /* Record the probe even if the file does not exist: an augments file
+         * appearing later must invalidate the compiled policy cache. */
+        if (AUGMENTS_FILES == NULL)
+        {
+            AUGMENTS_FILES = StringSetNew();
+        }
+        StringSetAdd(AUGMENTS_FILES, xstrdup(filename));
+
         if (FileCanOpen(filename, "r"))
         {
             // 5 MB should be enough for most reasonable def.json data
@@ -978,6 +996,11 @@ void LoadAugments(EvalContext *ctx, GenericAgentConfig *config)
     free(def_json);
 }
 
+const StringSet *GenericAgentGetAugmentsFiles(void)
+{
+    return AUGMENTS_FILES;
+}
+
 static void AddPolicyEntryVariables (EvalContext *ctx, const GenericAgentConfig *config)
 {
     char *abs_input_path = GetAbsolutePath(config->input_file);
@@ -1101,6 +1124,24 @@ void GenericAgentDiscoverContext(EvalContext *ctx, GenericAgentConfig *config,
                     "Bootstrap mode: implicitly trusting server, "
                     "use --trust-server=no if server trust is already established");
             }
+
+            /* Warm the inputs with the server's masterfiles in one round
+             * trip, so the failsafe run mostly verifies instead of copying.
+             * This is best effort: the failsafe policy update is still the
+             * authoritative copy, so failure here is not fatal. */
+            if (BootstrapPrefetchPolicy(
+                    bootstrap_arg, GetInputDir(),
+                    config->agent_specific.agent.bootstrap_trust_server))
+            {
+                Log(LOG_LEVEL_INFO,
+                    "Prefetched policy from server: %s", bootstrap_arg);
+            }
+            else
+            {
+                Log(LOG_LEVEL_VERBOSE,
+                    "Could not prefetch policy from server %s,"
+                    " continuing with regular bootstrap", bootstrap_arg);
+            }
         }
 
         WriteAmPolicyHubFile(am_policy_server);
@@ -1790,6 +1831,11 @@ static void DeleteChangesChroot()
     char changes_chroot[PATH_MAX] = {0};
     GetChangesChrootDir(changes_chroot, sizeof(changes_chroot));
     Log(LOG_LEVEL_VERBOSE, "Deleting changes chroot '%s'", changes_chroot);
+
+    /* Overlay mounts must go away first -- deleting through them would only
+     * produce whiteouts in their upper layers. */
+    UnmountChangesChrootOverlays();
+
     DeleteDirectoryTree(changes_chroot);
 
     /* DeleteDirectoryTree() doesn't delete the root of the tree. */
@@ -2619,6 +2665,8 @@ GenericAgentConfig *GenericAgentConfigNewDefault(AgentType agent_type, bool tty_
 
     config->agent_specific.common.no_augments = false;
     config->agent_specific.common.no_host_specific = false;
+    config->agent_specific.common.compile_policy_cache = false;
+    config->agent_specific.common.validate_data = false;
 
     switch (agent_type)
     {
@@ -2635,6 +2683,7 @@ GenericAgentConfig *GenericAgentConfigNewDefault(AgentType agent_type, bool tty_
     case AGENT_TYPE_AGENT:
         config->agent_specific.agent.show_evaluated_classes = NULL;
         config->agent_specific.agent.show_evaluated_variables = NULL;
+        config->agent_specific.agent.show_class_diff = false;
         break;
 
     default:
@@ -2883,6 +2932,94 @@ void GenericAgentShowContextsFormatted(EvalContext *ctx, const char *regexp)
     ClassTableIteratorDestroy(iter);
 }
 
+/**
+ * Compare the class set of this run against the set persisted by the
+ * previous run, optionally print the delta, and persist the current set for
+ * the next run to diff against.  The same global class table that
+ * --show-evaluated-classes walks is considered.  The database stores one
+ * record per class name with an empty value, and only the delta is written,
+ * so a run with no drift costs a read-only scan.
+ */
+void GenericAgentTrackClassDiff(EvalContext *ctx, bool show)
+{
+    CF_DB *db = NULL;
+    if (!OpenDB(&db, dbid_class_diff))
+    {
+        Log(LOG_LEVEL_ERR, "Unable to open class diff database");
+        return;
+    }
+
+    StringSet *current = StringSetNew();
+    ClassTableIterator *iter = EvalContextClassTableIteratorNewGlobal(ctx, NULL, true, true);
+    Class *cls = NULL;
+    while ((cls = ClassTableIteratorNext(iter)) != NULL)
+    {
+        StringSetAdd(current, ClassRefToString(cls->ns, cls->name));
+    }
+    ClassTableIteratorDestroy(iter);
+
+    Seq *added = SeqNew(100, NULL);     /* entries owned by 'current' */
+    Seq *removed = SeqNew(100, free);
+
+    CF_DBC *cursor;
+    if (NewDBCursor(db, &cursor))
+    {
+        char *key;
+        void *value;
+        int ksize, vsize;
+        while (NextDB(cursor, &key, &ksize, &value, &vsize))
+        {
+            if (!StringSetContains(current, key))
+            {
+                SeqAppend(removed, xstrdup(key));
+            }
+        }
+        DeleteDBCursor(cursor);
+    }
+
+    StringSetIterator si = StringSetIteratorInit(current);
+    const char *name;
+    while ((name = StringSetIteratorNext(&si)) != NULL)
+    {
+        if (!HasKeyDB(db, name, strlen(name) + 1))
+        {
+            SeqAppend(added, (void *) name);
+        }
+    }
+
+    const size_t n_added = SeqLength(added);
+    const size_t n_removed = SeqLength(removed);
+
+    for (size_t i = 0; i < n_removed; i++)
+    {
+        DeleteDB(db, SeqAt(removed, i));
+    }
+    for (size_t i = 0; i < n_added; i++)
+    {
+        WriteDB(db, SeqAt(added, i), "", 1);
+    }
+    CloseDB(db);
+
+    if (show)
+    {
+        SeqSort(added, StrCmpWrapper, NULL);
+        SeqSort(removed, StrCmpWrapper, NULL);
+
+        for (size_t i = 0; i < n_removed; i++)
+        {
+            printf("- %s\n", (const char *) SeqAt(removed, i));
+        }
+        for (size_t i = 0; i < n_added; i++)
+        {
+            printf("+ %s\n", (const char *) SeqAt(added, i));
+        }
+    }
+
+    SeqDestroy(added);
+    SeqDestroy(removed);
+    StringSetDestroy(current);
+}
+
 void GenericAgentShowVariablesFormatted(EvalContext *ctx, const char *regexp)
 {
     assert(regexp != NULL);
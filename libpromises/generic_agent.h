@@ -78,6 +78,8 @@ typedef struct
             unsigned int parser_warnings;
             unsigned int parser_warnings_error;
             bool eval_functions;
+            bool compile_policy_cache;  // --compile
+            bool validate_data;         // --validate-data
             char *show_classes;
             char *show_variables;
             bool no_augments;
@@ -94,6 +96,7 @@ typedef struct
             bool skip_bootstrap_service_start;
             char *show_evaluated_classes;
             char *show_evaluated_variables;
+            bool show_class_diff;
 
             // BODY AGENT CONTROL
             bool report_class_log;
@@ -155,8 +158,16 @@ void SetupSignalsForAgent(void);
 
 void LoadAugments(EvalContext *ctx, GenericAgentConfig *config);
 
+/**
+ * @return the expanded paths of every augments file probed by LoadAugments()
+ *         (including ones that did not exist), or NULL if augments were
+ *         never loaded. Owned by this module.
+ */
+const StringSet *GenericAgentGetAugmentsFiles(void);
+
 void GenericAgentShowContextsFormatted(EvalContext *ctx, const char *regexp);
 void GenericAgentShowVariablesFormatted(EvalContext *ctx, const char *regexp);
+void GenericAgentTrackClassDiff(EvalContext *ctx, bool show);
 
 void GenericAgentDetectEnvironmentFromPolicy(EvalContext *ctx, Policy *policy);
 
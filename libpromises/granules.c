@@ -30,6 +30,16 @@ char *GenTimeKey(time_t now)
 {
     struct tm tm;
     static char buf[18]; /* GLOBAL_R, no initialization needed */
+    static time_t last_window = -1; /* GLOBAL_X */
+
+    /* The key only changes every five minutes (Unix time has no leap
+     * seconds, so the division lines up with the tm_min boundaries). */
+    time_t window = now / (5 * 60);
+    if (window == last_window)
+    {
+        return buf;
+    }
+    last_window = window;
 
     gmtime_r(&now, &tm);
 
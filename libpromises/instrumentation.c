@@ -31,9 +31,24 @@
 #include <policy.h>
 
 #include <math.h>
+#include <sequence.h>
+#include <mutex.h>                                            /* ThreadLock */
 
 static void NotePerformance(char *eventname, time_t t, double value);
 
+/* Measured events are buffered here and merged into performance.lmdb in one
+ * batch by InstrumentationFlush(), so that promise actuation never blocks on
+ * a write transaction of its own. */
+typedef struct
+{
+    char *eventname;
+    time_t t;
+    double value;
+} PerfEvent;
+
+static Seq *perf_events = NULL; /* GLOBAL_X */
+static pthread_mutex_t perf_events_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
 /* Alter this code at your peril. Berkeley DB is very sensitive to errors. */
 
 bool TIMING = false;
@@ -139,19 +154,39 @@ int EndMeasureValueMs(struct timespec start)
 
 /***************************************************************/
 
+static void PerfEventDestroy(PerfEvent *event)
+{
+    if (event != NULL)
+    {
+        free(event->eventname);
+        free(event);
+    }
+}
+
 static void NotePerformance(char *eventname, time_t t, double value)
 {
-    CF_DB *dbp;
+    PerfEvent *event = xmalloc(sizeof(PerfEvent));
+    event->eventname = xstrdup(eventname);
+    event->t = t;
+    event->value = value;
+
+    ThreadLock(&perf_events_lock);
+    if (perf_events == NULL)
+    {
+        perf_events = SeqNew(64, PerfEventDestroy);
+    }
+    SeqAppend(perf_events, event);
+    ThreadUnlock(&perf_events_lock);
+}
+
+static void NotePerformanceCommit(CF_DB *dbp, const char *eventname,
+                                  time_t t, double value)
+{
     Event e, newe;
     double lastseen;
     int lsea = SECONDS_PER_WEEK;
     time_t now = time(NULL);
 
-    if (!OpenDB(&dbp, dbid_performance))
-    {
-        return;
-    }
-
     if (ReadDB(dbp, eventname, &e, sizeof(e)))
     {
         lastseen = now - e.t;
@@ -193,6 +228,44 @@ static void NotePerformance(char *eventname, time_t t, double value)
             Log(LOG_LEVEL_VERBOSE, "T:   Average execution time %lf +/- %lf seconds\n", newe.Q.expect, sqrt(newe.Q.var));
         }
     }
+}
+
+/***************************************************************/
+
+void InstrumentationFlush(void)
+{
+    ThreadLock(&perf_events_lock);
+    Seq *events = perf_events;
+    perf_events = NULL;
+    ThreadUnlock(&perf_events_lock);
+
+    if (events == NULL)
+    {
+        return;
+    }
+
+    const size_t length = SeqLength(events);
+
+    CF_DB *dbp;
+    if (OpenDB(&dbp, dbid_performance))
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            const PerfEvent *event = SeqAt(events, i);
+            NotePerformanceCommit(dbp, event->eventname,
+                                  event->t, event->value);
+        }
+        CloseDB(dbp);
+
+        Log(LOG_LEVEL_DEBUG,
+            "Flushed %zu performance measurement(s) to the database", length);
+    }
+    else
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Could not open performance database, dropping %zu measurement(s)",
+            length);
+    }
 
-    CloseDB(dbp);
+    SeqDestroy(events);
 }
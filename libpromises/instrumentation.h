@@ -34,5 +34,13 @@ struct timespec BeginMeasure(void);
 void EndMeasure(char *eventname, struct timespec start);
 int EndMeasureValueMs(struct timespec start);
 void EndMeasurePromise(struct timespec start, const Promise *pp);
+
+/**
+ * Write all measurements buffered by EndMeasure() to the performance
+ * database in one batch. Call once at the end of the run; measurements
+ * recorded after the flush stay buffered until the next call.
+ */
+void InstrumentationFlush(void);
+
 extern bool TIMING;
 #endif
@@ -31,6 +31,7 @@
 #include <regex.h> /* StringMatchFull,CompileRegex,StringMatchWithPrecompiledRegex */
 #include <file_lib.h>
 #include <files_interfaces.h>
+#include <set.h>
 
 #ifdef CYCLE_DETECTION
 /* While looping over entry lp in an Item list, advance slow half as
@@ -245,6 +246,73 @@ bool IsItemIn(const Item *list, const char *item)
     return false;
 }
 
+/*********************************************************************/
+/* An ItemIndex gives constant-time membership tests over an Item
+ * list, for callers that would otherwise call IsItemIn() once per
+ * entry and degrade quadratically on large lists.  The index does not
+ * own the list and only tracks names that were in the list when it
+ * was built, or were added through ItemIndexPrependUnique(); it must
+ * be discarded if the list is modified behind its back. */
+
+struct ItemIndex_
+{
+    StringSet *names;
+};
+
+ItemIndex *ItemIndexNew(const Item *list)
+{
+    ItemIndex *index = xmalloc(sizeof(ItemIndex));
+    index->names = StringSetNew();
+
+    for (const Item *ip = list; ip != NULL; ip = ip->next)
+    {
+        StringSetAdd(index->names, xstrdup(ip->name));
+    }
+
+    return index;
+}
+
+bool ItemIndexContains(const ItemIndex *index, const char *item)
+{
+    assert(index != NULL);
+
+    if (item == NULL || item[0] == '\0')
+    {
+        /* Compatible with IsItemIn(). */
+        return true;
+    }
+
+    return StringSetContains(index->names, item);
+}
+
+/**
+ * Prepend @a itemstring to the list unless the index already knows it,
+ * keeping the index up to date.  Returns the new item, or NULL if the
+ * name was already present.
+ */
+Item *ItemIndexPrependUnique(ItemIndex *index, Item **liststart,
+                             const char *itemstring, const char *classes)
+{
+    assert(index != NULL);
+
+    if (ItemIndexContains(index, itemstring))
+    {
+        return NULL;
+    }
+
+    StringSetAdd(index->names, xstrdup(itemstring));
+    return PrependItem(liststart, itemstring, classes);
+}
+
+void ItemIndexDestroy(ItemIndex *index)
+{
+    if (index != NULL)
+    {
+        StringSetDestroy(index->names);
+        free(index);
+    }
+}
+
 /*********************************************************************/
 /* True precisely if the lists are of equal length and every entry of
  * the first appears in the second.  As long as each list is known to
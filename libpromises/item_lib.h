@@ -72,6 +72,13 @@ bool DeleteItemContaining(Item **list, const char *string);
 bool DeleteItemNotContaining(Item **list, const char *string);
 size_t ListLen(const Item *list);
 bool IsItemIn(const Item *list, const char *item);
+/* Optional hash index over an Item list, for callers doing many
+ * membership tests against a large list (IsItemIn() is linear). */
+typedef struct ItemIndex_ ItemIndex;
+ItemIndex *ItemIndexNew(const Item *list);
+bool ItemIndexContains(const ItemIndex *index, const char *item);
+Item *ItemIndexPrependUnique(ItemIndex *index, Item **liststart, const char *itemstring, const char *classes);
+void ItemIndexDestroy(ItemIndex *index);
 bool ListsCompare(const Item *list1, const Item *list2);
 bool ListSubsetOfList(const Item *list1, const Item *list2);
 bool IsMatchItemIn(const Item *list, const char *item);
@@ -136,6 +136,18 @@ struct PromiseIterator_ {
     Seq *wheels;
     const Promise *pp;                                   /* not owned by us */
     size_t count;                                 /* total iterations count */
+    size_t skipped;       /* combinations skipped because of empty wheels */
+
+    /* Scratch buffer for expanding wheel variable names, reused across all
+     * iterations so that iterating a 50k-element slist doesn't allocate and
+     * free a Buffer 50k times. Scoped to the iterator's lifetime. */
+    Buffer *scratch;
+
+    /* The promise's "with" constraints (borrowed from pp->conlist), found
+     * once at construction. They must be re-evaluated on every iteration,
+     * but scanning the whole constraint list once per iteration adds up
+     * over a 10,000-element slist. NULL if the promise has none. */
+    Seq *with_cps;
 };
 
 
@@ -198,15 +210,34 @@ static int WheelCompareUnexpanded(const void *wheel1, const void *wheel2,
 PromiseIterator *PromiseIteratorNew(const Promise *pp)
 {
     PromiseIterator iterctx = {
-        .wheels = SeqNew(4, WheelDestroy),
-        .pp     = pp,
-        .count  = 0
+        .wheels   = SeqNew(4, WheelDestroy),
+        .pp       = pp,
+        .count    = 0,
+        .skipped  = 0,
+        .scratch  = BufferNew(),
+        .with_cps = NULL
     };
+
+    for (size_t i = 0; i < SeqLength(pp->conlist); i++)
+    {
+        Constraint *cp = SeqAt(pp->conlist, i);
+        if (StringEqual(cp->lval, "with"))
+        {
+            if (iterctx.with_cps == NULL)
+            {
+                iterctx.with_cps = SeqNew(2, NULL);
+            }
+            SeqAppend(iterctx.with_cps, cp);
+        }
+    }
+
     return xmemdup(&iterctx, sizeof(iterctx));
 }
 
 void PromiseIteratorDestroy(PromiseIterator *iterctx)
 {
+    SeqDestroy(iterctx->with_cps);
+    BufferDestroy(iterctx->scratch);
     SeqDestroy(iterctx->wheels);
     free(iterctx);
 }
@@ -216,6 +247,11 @@ size_t PromiseIteratorIndex(const PromiseIterator *iter_ctx)
     return iter_ctx->count;
 }
 
+size_t PromiseIteratorSkipped(const PromiseIterator *iter_ctx)
+{
+    return iter_ctx->skipped;
+}
+
 
 /**
  * Returns offset to "$(" or "${" in the string.
@@ -904,10 +940,18 @@ static void ExpandAndPutWheelVariablesAfter(
     assert(iterctx->pp != NULL);
     assert(iterctx->pp->promiser != NULL);
 
-    /* Buffer to store the expanded wheel variable name, for each wheel. */
-    Buffer *tmpbuf = BufferNew();
-
     size_t wheels_num = SeqLength(iterctx->wheels);
+    if (wheel_idx >= wheels_num)
+    {
+        /* Common case: the rightmost wheel was incremented and there is
+         * nothing to its right, so there is nothing to re-expand. */
+        return;
+    }
+
+    /* Buffer to store the expanded wheel variable name, for each wheel.
+     * Reused across iterations, see PromiseIterator_.scratch. */
+    Buffer *tmpbuf = iterctx->scratch;
+
     for (size_t i = wheel_idx; i < wheels_num; i++)
     {
         Wheel *wheel = SeqAt(iterctx->wheels, i);
@@ -1016,8 +1060,6 @@ static void ExpandAndPutWheelVariablesAfter(
             }
         }
     }
-
-    BufferDestroy(tmpbuf);
 }
 
 static bool IteratorHasEmptyWheel(const PromiseIterator *iterctx)
@@ -1046,6 +1088,44 @@ static bool IteratorHasEmptyWheel(const PromiseIterator *iterctx)
     return false;
 }
 
+/**
+ * Like IteratorHasEmptyWheel(), but only counts wheels whose unexpanded name
+ * contains no inner expansions.  Such a wheel resolves the same way on every
+ * combination, so if it is empty (or unresolved) the whole iteration product
+ * is empty and the engine can return immediately instead of spinning through
+ * every combination of the other wheels only to skip each one.
+ */
+static bool IteratorHasStaticEmptyWheel(const PromiseIterator *iterctx)
+{
+    size_t wheels_num = SeqLength(iterctx->wheels);
+    for (size_t i = 0; i < wheels_num; i++)
+    {
+        const Wheel *wheel = SeqAt(iterctx->wheels, i);
+        assert(wheel != NULL);
+
+        if (VarIsSpecial(wheel->varname_unexp))
+        {
+            continue;
+        }
+
+        const size_t name_len = strlen(wheel->varname_unexp);
+        if (FindDollarParen(wheel->varname_unexp, name_len) != name_len)
+        {
+            continue;     /* inner expansions, may differ on next combination */
+        }
+
+        if ((wheel->values != NULL &&
+             SeqLength(wheel->values) == 0)
+            ||
+            wheel->vartype == CF_DATA_TYPE_NONE)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /* Try incrementing the rightmost wheel first that has values left to iterate on.
    (rightmost  i.e. the most dependent variable). */
 static size_t WheelRightmostIncrement(PromiseIterator *iterctx)
@@ -1115,6 +1195,15 @@ bool PromiseIteratorNext(PromiseIterator *iterctx, EvalContext *evalctx)
         ExpandAndPutWheelVariablesAfter(iterctx, evalctx, 0);
 
         done = ! IteratorHasEmptyWheel(iterctx);
+
+        /* A statically empty wheel empties every combination: return now
+         * instead of looping over the full product below just to skip it. */
+        if (!done && IteratorHasStaticEmptyWheel(iterctx))
+        {
+            Log(LOG_LEVEL_DEBUG, "Iteration product is empty,"
+                " skipping promise evaluations   ---   WARPING OUT");
+            return false;
+        }
     }
 
     while (!done)
@@ -1122,8 +1211,10 @@ bool PromiseIteratorNext(PromiseIterator *iterctx, EvalContext *evalctx)
         size_t i = WheelRightmostIncrement(iterctx);
         if (i == (size_t) -1)       /* all combinations have been tried */
         {
-            Log(LOG_LEVEL_DEBUG, "Iteration engine finished"
-                "   ---   WARPING OUT");
+            Log(LOG_LEVEL_DEBUG, "Iteration engine finished,"
+                " %zu combinations yielded, %zu skipped"
+                "   ---   WARPING OUT",
+                iterctx->count, iterctx->skipped);
             return false;
         }
 
@@ -1147,6 +1238,10 @@ bool PromiseIteratorNext(PromiseIterator *iterctx, EvalContext *evalctx)
          * should be skipped completely; so the function doesn't yield any
          * result yet, it just loops over until it finds a meaningful one. */
         done = ! IteratorHasEmptyWheel(iterctx);
+        if (!done)
+        {
+            iterctx->skipped++;
+        }
 
         LogDebug(LOG_MOD_ITERATIONS, "PromiseIteratorNext():"
                  " count=%zu wheels_num=%zu current_wheel=%zd",
@@ -1157,11 +1252,11 @@ bool PromiseIteratorNext(PromiseIterator *iterctx, EvalContext *evalctx)
     }
 
     // Recompute `with`
-    for (size_t i = 0; i < SeqLength(iterctx->pp->conlist); i++)
+    if (iterctx->with_cps != NULL)
     {
-        Constraint *cp = SeqAt(iterctx->pp->conlist, i);
-        if (StringEqual(cp->lval, "with"))
+        for (size_t i = 0; i < SeqLength(iterctx->with_cps); i++)
         {
+            const Constraint *cp = SeqAt(iterctx->with_cps, i);
             Rval final = EvaluateFinalRval(evalctx, PromiseGetPolicy(iterctx->pp), NULL,
                                            "this", cp->rval, false, iterctx->pp);
             if (final.type == RVAL_TYPE_SCALAR && !IsCf3VarString(RvalScalarValue(final)))
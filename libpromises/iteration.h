@@ -40,6 +40,11 @@ void PromiseIteratorPrepare(PromiseIterator *iterctx,
 bool PromiseIteratorNext(PromiseIterator *iterctx,
                          EvalContext *evalctx);
 size_t PromiseIteratorIndex(const PromiseIterator *iter_ctx);
+/**
+ * Number of wheel combinations that were skipped (instead of yielded)
+ * because some wheel resolved to an empty iterable, e.g. cf_null entries.
+ */
+size_t PromiseIteratorSkipped(const PromiseIterator *iter_ctx);
 
 
 #endif
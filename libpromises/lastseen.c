@@ -29,6 +29,9 @@
 #include <hash.h>
 #include <locks.h>
 #include <item_lib.h>
+#include <set.h>
+#include <map.h>
+#include <mutex.h>
 #include <known_dirs.h>
 #ifdef LMDB
 #include <lmdb.h>
@@ -76,6 +79,143 @@ void UpdateLastSawHost(const char *hostkey, const char *address,
 
 /*****************************************************************************/
 
+/* Write coalescing for UpdateLastSawHost().
+ *
+ * On a hub every connecting agent triggers several lastseen updates within
+ * a few seconds (one per network connection of the agent run), each opening
+ * a write transaction on cf_lastseen.lmdb to store the same mapping and a
+ * near-identical quality entry.  With thousands of agents this dominates
+ * hub database traffic, so repeats for the same host, address and direction
+ * within a short window are dropped in-process; the burst is recorded once.
+ *
+ * The cache only ever suppresses writes, it is never consulted for reads,
+ * so lookups always reflect changes made by other processes (cf-key,
+ * cf-hub).  An update is suppressed only while this process's own record
+ * of the address entry still names the same hostkey, so interleaved
+ * updates from a host whose key changed are written out immediately. */
+
+typedef struct
+{
+    char *address;     /* address last written for this hostkey */
+    time_t written[2]; /* last write per direction: [0] outgoing, [1] incoming */
+} LastSawCacheEntry;
+
+static void LastSawCacheEntryDestroy_untyped(void *p)
+{
+    LastSawCacheEntry *entry = p;
+    if (entry != NULL)
+    {
+        free(entry->address);
+        free(entry);
+    }
+}
+
+TYPED_MAP_DECLARE(LastSawCache, char *, LastSawCacheEntry *)
+TYPED_MAP_DEFINE(LastSawCache, char *, LastSawCacheEntry *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 LastSawCacheEntryDestroy_untyped)
+
+#define LASTSEEN_COALESCE_INTERVAL 60 /* seconds */
+#define LASTSEEN_CACHE_SIZE_MAX 8192
+
+static LastSawCacheMap *last_saw_cache = NULL; /* GLOBAL_X */
+static size_t last_saw_cache_entries = 0; /* GLOBAL_X */
+/* What this process last wrote to each "a<address>" entry. */
+static StringMap *last_saw_address_owner = NULL; /* GLOBAL_X */
+static pthread_mutex_t last_saw_cache_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+void FlushLastSawCache(void)
+{
+    ThreadLock(&last_saw_cache_lock);
+    if (last_saw_cache != NULL)
+    {
+        LastSawCacheMapDestroy(last_saw_cache);
+        last_saw_cache = NULL;
+        last_saw_cache_entries = 0;
+    }
+    if (last_saw_address_owner != NULL)
+    {
+        StringMapDestroy(last_saw_address_owner);
+        last_saw_address_owner = NULL;
+    }
+    ThreadUnlock(&last_saw_cache_lock);
+}
+
+/**
+ * @return true if this update repeats what was recently written and can be
+ *         dropped.
+ */
+static bool LastSawCoalesce(const char *hostkey, const char *address,
+                            bool incoming, time_t timestamp)
+{
+    bool coalesce = false;
+
+    ThreadLock(&last_saw_cache_lock);
+    if (last_saw_cache != NULL)
+    {
+        const LastSawCacheEntry *entry =
+            LastSawCacheMapGet(last_saw_cache, hostkey);
+        const char *owner =
+            StringMapGet(last_saw_address_owner, address);
+
+        coalesce = (entry != NULL &&
+                    strcmp(entry->address, address) == 0 &&
+                    owner != NULL && strcmp(owner, hostkey) == 0 &&
+                    timestamp - entry->written[incoming ? 1 : 0]
+                        < LASTSEEN_COALESCE_INTERVAL);
+    }
+    ThreadUnlock(&last_saw_cache_lock);
+
+    return coalesce;
+}
+
+/* Record a completed update so the next connection in the burst can be
+ * coalesced. */
+static void LastSawCacheRecord(const char *hostkey, const char *address,
+                               bool incoming, time_t timestamp)
+{
+    ThreadLock(&last_saw_cache_lock);
+    if (last_saw_cache == NULL)
+    {
+        last_saw_cache = LastSawCacheMapNew();
+        last_saw_address_owner = StringMapNew();
+        last_saw_cache_entries = 0;
+    }
+
+    LastSawCacheEntry *entry = LastSawCacheMapGet(last_saw_cache, hostkey);
+    if (entry == NULL)
+    {
+        if (last_saw_cache_entries >= LASTSEEN_CACHE_SIZE_MAX)
+        {
+            LastSawCacheMapDestroy(last_saw_cache);
+            StringMapDestroy(last_saw_address_owner);
+            last_saw_cache = LastSawCacheMapNew();
+            last_saw_address_owner = StringMapNew();
+            last_saw_cache_entries = 0;
+        }
+
+        entry = xcalloc(1, sizeof(LastSawCacheEntry));
+        entry->address = xstrdup(address);
+        LastSawCacheMapInsert(last_saw_cache, xstrdup(hostkey), entry);
+        last_saw_cache_entries++;
+    }
+    else if (strcmp(entry->address, address) != 0)
+    {
+        free(entry->address);
+        entry->address = xstrdup(address);
+        entry->written[0] = 0;
+        entry->written[1] = 0;
+    }
+    entry->written[incoming ? 1 : 0] = timestamp;
+
+    StringMapInsert(last_saw_address_owner, xstrdup(address), xstrdup(hostkey));
+    ThreadUnlock(&last_saw_cache_lock);
+}
+
+/*****************************************************************************/
+
 /**
  * @brief Same as LastSaw() but the digest parameter is the hash as a
  *        "SHA=..." string, to avoid converting twice.
@@ -109,6 +249,14 @@ void LastSaw(const char *ipaddress, const unsigned char *digest, LastSeenRole ro
 void UpdateLastSawHost(const char *hostkey, const char *address,
                        bool incoming, time_t timestamp)
 {
+    if (LastSawCoalesce(hostkey, address, incoming, timestamp))
+    {
+        Log(LOG_LEVEL_DEBUG,
+            "Coalesced lastseen update for host '%s' (%s)",
+            hostkey, address);
+        return;
+    }
+
     DBHandle *db = NULL;
     if (!OpenDB(&db, dbid_lastseen))
     {
@@ -153,6 +301,8 @@ void UpdateLastSawHost(const char *hostkey, const char *address,
     WriteDB(db, address_key, hostkey, strlen(hostkey) + 1);
 
     CloseDB(db);
+
+    LastSawCacheRecord(hostkey, address, incoming, timestamp);
 }
 /*****************************************************************************/
 
@@ -348,7 +498,7 @@ bool IsLastSeenCoherent(void)
         return false;
     }
 
-    if (!NewDBCursor(db, &cursor))
+    if (!NewDBReadCursor(db, &cursor))
     {
         Log(LOG_LEVEL_ERR, "Unable to create lastseen database cursor");
         CloseDB(db);
@@ -365,6 +515,14 @@ bool IsLastSeenCoherent(void)
     Item *aIPS = NULL;
     Item *kIPS = NULL;
 
+    /* One database record per host and direction, so these lists grow
+     * with the fleet; index them instead of scanning per record. */
+    ItemIndex *qkeys_index = ItemIndexNew(NULL);
+    ItemIndex *akeys_index = ItemIndexNew(NULL);
+    ItemIndex *kkeys_index = ItemIndexNew(NULL);
+    ItemIndex *aips_index = ItemIndexNew(NULL);
+    ItemIndex *kips_index = ItemIndexNew(NULL);
+
     bool result = true;
     while (NextDB(cursor, &key, &ksize, &value, &vsize))
     {
@@ -385,10 +543,7 @@ bool IsLastSeenCoherent(void)
             if (strncmp(key,"qiSHA=",5)==0 || strncmp(key,"qoSHA=",5)==0 ||
                 strncmp(key,"qiMD5=",5)==0 || strncmp(key,"qoMD5=",5)==0)
             {
-                if (!IsItemIn(qKEYS, key+2))
-                {
-                    PrependItem(&qKEYS, key+2, NULL);
-                }
+                ItemIndexPrependUnique(qkeys_index, &qKEYS, key+2, NULL);
             }
         }
 
@@ -396,27 +551,15 @@ bool IsLastSeenCoherent(void)
         {
             if (strncmp(key, "kSHA=", 4)==0 || strncmp(key, "kMD5=", 4)==0)
             {
-                if (!IsItemIn(kKEYS, key+1))
-                {
-                    PrependItem(&kKEYS, key+1, NULL);
-                }
-                if (!IsItemIn(kIPS, value))
-                {
-                    PrependItem(&kIPS, value, NULL);
-                }
+                ItemIndexPrependUnique(kkeys_index, &kKEYS, key+1, NULL);
+                ItemIndexPrependUnique(kips_index, &kIPS, value, NULL);
             }
         }
 
         if (key[0] == 'a' )
         {
-            if (!IsItemIn(aIPS, key+1))
-            {
-                PrependItem(&aIPS, key+1, NULL);
-            }
-            if (!IsItemIn(aKEYS, value))
-            {
-                PrependItem(&aKEYS, value, NULL);
-            }
+            ItemIndexPrependUnique(aips_index, &aIPS, key+1, NULL);
+            ItemIndexPrependUnique(akeys_index, &aKEYS, value, NULL);
         }
     }
 
@@ -429,7 +572,7 @@ bool IsLastSeenCoherent(void)
     Item *kip = kIPS;
     while (kip != NULL)
     {
-        if (!IsItemIn(aIPS, kip->name))
+        if (!ItemIndexContains(aips_index, kip->name))
         {
             Log(LOG_LEVEL_WARNING,
                 "lastseen db inconsistency, found kKEY -> '%s' entry, "
@@ -447,7 +590,7 @@ bool IsLastSeenCoherent(void)
     Item *akey = aKEYS;
     while (akey != NULL)
     {
-        if (!IsItemIn(kKEYS, akey->name))
+        if (!ItemIndexContains(kkeys_index, akey->name))
         {
             Log(LOG_LEVEL_WARNING,
                 "lastseen db inconsistency, found aIP -> '%s' entry, "
@@ -460,6 +603,12 @@ bool IsLastSeenCoherent(void)
         akey = akey->next;
     }
 
+    ItemIndexDestroy(qkeys_index);
+    ItemIndexDestroy(akeys_index);
+    ItemIndexDestroy(kkeys_index);
+    ItemIndexDestroy(aips_index);
+    ItemIndexDestroy(kips_index);
+
     DeleteItemList(qKEYS);
     DeleteItemList(aKEYS);
     DeleteItemList(kKEYS);
@@ -534,6 +683,10 @@ bool DeleteIpFromLastSeen(const char *ip, char *digest, size_t digest_size)
 
 clean:
     CloseDB(db);
+    if (res)
+    {
+        FlushLastSawCache();
+    }
     return res;
 }
 
@@ -603,6 +756,10 @@ bool DeleteDigestFromLastSeen(const char *key, char *ip, size_t ip_size, bool a_
 
 clean:
     CloseDB(db);
+    if (res)
+    {
+        FlushLastSawCache();
+    }
     return res;
 }
 
@@ -691,7 +848,7 @@ int LastSeenHostKeyCount(void)
     {
         memset(&entry, 0, sizeof(entry));
 
-        if (NewDBCursor(dbp, &dbcp))
+        if (NewDBReadCursor(dbp, &dbcp))
         {
             while (NextDB(dbcp, &key, &ksize, &value, &vsize))
             {
@@ -713,6 +870,117 @@ int LastSeenHostKeyCount(void)
 
     return count;
 }
+
+/*****************************************************************************/
+
+/**
+ * @brief Remove entries for hosts not seen within the given horizon.
+ *
+ * A host is purged only when every quality-of-connection entry it has
+ * (incoming and outgoing) is older than @a horizon seconds, so a host
+ * still connecting in one direction is kept whole.  Hosts with a key
+ * entry but no quality entries carry no timestamp and are left alone.
+ *
+ * @param[in] horizon maximum age in seconds before a host is considered stale
+ * @return the number of hosts purged, or -1 on error
+ */
+int LastSeenPurgeStale(time_t horizon)
+{
+    assert(horizon > 0);
+
+    const time_t now = time(NULL);
+
+    CF_DB *db;
+    if (!OpenDB(&db, dbid_lastseen))
+    {
+        Log(LOG_LEVEL_ERR, "Unable to open lastseen database");
+        return -1;
+    }
+
+    CF_DBC *cursor;
+    if (!NewDBReadCursor(db, &cursor))
+    {
+        Log(LOG_LEVEL_ERR, "Unable to create lastseen database cursor");
+        CloseDB(db);
+        return -1;
+    }
+
+    /* Collect first, delete after: writes must not be mixed into an open
+     * cursor scan. */
+    StringSet *stale = StringSetNew();
+    StringSet *fresh = StringSetNew();
+
+    char *key;
+    void *value;
+    int ksize, vsize;
+    while (NextDB(cursor, &key, &ksize, &value, &vsize))
+    {
+        if ((strncmp(key, "qi", 2) != 0) && (strncmp(key, "qo", 2) != 0))
+        {
+            continue;
+        }
+        if (value == NULL || (size_t) vsize < sizeof(KeyHostSeen))
+        {
+            continue;
+        }
+
+        KeyHostSeen quality;
+        memcpy(&quality, value, sizeof(quality)); /* may be unaligned */
+
+        if (now - quality.lastseen > horizon)
+        {
+            StringSetAdd(stale, xstrdup(key + 2));
+        }
+        else
+        {
+            StringSetAdd(fresh, xstrdup(key + 2));
+        }
+    }
+    DeleteDBCursor(cursor);
+
+    int purged = 0;
+    StringSetIterator it = StringSetIteratorInit(stale);
+    const char *hostkey;
+    while ((hostkey = StringSetIteratorNext(&it)) != NULL)
+    {
+        if (StringSetContains(fresh, hostkey))
+        {
+            continue;
+        }
+
+        char bufkey[CF_BUFSIZE];
+        snprintf(bufkey, sizeof(bufkey), "k%s", hostkey);
+
+        char address[CF_BUFSIZE];
+        if (ReadDB(db, bufkey, &address, sizeof(address)))
+        {
+            char bufhost[CF_BUFSIZE];
+            snprintf(bufhost, sizeof(bufhost), "a%s", address);
+            DeleteDB(db, bufhost);
+        }
+        DeleteDB(db, bufkey);
+
+        snprintf(bufkey, sizeof(bufkey), "qi%s", hostkey);
+        DeleteDB(db, bufkey);
+        snprintf(bufkey, sizeof(bufkey), "qo%s", hostkey);
+        DeleteDB(db, bufkey);
+
+        Log(LOG_LEVEL_VERBOSE, "Purged lastseen entries for '%s'", hostkey);
+        purged++;
+    }
+
+    StringSetDestroy(stale);
+    StringSetDestroy(fresh);
+    CloseDB(db);
+
+    if (purged > 0)
+    {
+        Log(LOG_LEVEL_INFO, "Purged lastseen entries for %d stale hosts", purged);
+        FlushLastSawCache();
+    }
+    return purged;
+}
+
 /**
  * @brief removes all traces of entry 'input' from lastseen DB
  *
@@ -50,6 +50,15 @@ void LastSaw(const char *ipaddress, const unsigned char *digest, LastSeenRole ro
 bool DeleteIpFromLastSeen(const char *ip, char *digest, size_t digest_size);
 bool DeleteDigestFromLastSeen(const char *key, char *ip, size_t ip_size, bool a_entry_required);
 
+/**
+ * @brief Drop the in-process write-coalescing cache for lastseen updates.
+ *
+ * Must be called after the lastseen database is modified behind the back of
+ * LastSaw()/LastSaw1() (entries deleted, database repaired or replaced), so
+ * that subsequent updates are written out instead of being coalesced.
+ */
+void FlushLastSawCache(void);
+
 /*
  * Return false in order to stop iteration
  */
@@ -59,6 +68,7 @@ typedef bool (*LastSeenQualityCallback)(const char *hostkey, const char *address
 
 bool ScanLastSeenQuality(LastSeenQualityCallback callback, void *ctx);
 int LastSeenHostKeyCount(void);
+int LastSeenPurgeStale(time_t horizon);
 bool IsLastSeenCoherent(void);
 int RemoveKeysFromLastSeen(const char *input, bool must_be_coherent,
                            char *equivalent, size_t equivalent_size);
@@ -38,6 +38,7 @@
 #include <known_dirs.h>
 #include <ornaments.h>
 #include <policy.h>
+#include <policy_cache.h>
 #include <cleanup.h>
 
 // TODO: remove
@@ -47,7 +48,26 @@
 
 static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, const char *policy_file,
                               StringMap *policy_files_hashes, StringSet *parsed_files_checksums,
-                              StringSet *failed_files);
+                              StringSet *failed_files, bool *dynamic_inputs);
+
+/**
+ * @return true if any 'inputs' candidate carries a class guard: which one is
+ *         effective then depends on parse-time class state, which the
+ *         compiled policy cache does not record.
+ */
+static bool InputsAreClassGuarded(const Seq *potential_inputs)
+{
+    for (size_t i = 0; i < SeqLength(potential_inputs); i++)
+    {
+        const Constraint *cp = SeqAt(potential_inputs, i);
+        if (!StringEqual(ConstraintContext(cp), "any"))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
 
 
 
@@ -147,7 +167,7 @@ Policy *Cf3ParseFile(const GenericAgentConfig *config, const char *input_path)
 
 static Policy *LoadPolicyInputFiles(EvalContext *ctx, GenericAgentConfig *config, const Rlist *inputs,
                                     StringMap *policy_files_hashes, StringSet *parsed_files_checksums,
-                                    StringSet *failed_files)
+                                    StringSet *failed_files, bool *dynamic_inputs)
 {
     Policy *policy = PolicyNew();
 
@@ -162,6 +182,9 @@ static Policy *LoadPolicyInputFiles(EvalContext *ctx, GenericAgentConfig *config
         const char *unresolved_input = RlistScalarValue(rp);
         if (IsExpandable(unresolved_input))
         {
+            /* The resolved file set depends on variable state, so this
+             * policy cannot be cached whole (see LoadPolicy()). */
+            *dynamic_inputs = true;
             PolicyResolve(ctx, policy, config);
         }
 
@@ -179,13 +202,17 @@ static Policy *LoadPolicyInputFiles(EvalContext *ctx, GenericAgentConfig *config
 
             aux_policy = LoadPolicyFile(ctx, config,
                                         GenericAgentResolveInputPath(config, RvalScalarValue(resolved_input)),
-                                        policy_files_hashes, parsed_files_checksums, failed_files);
+                                        policy_files_hashes, parsed_files_checksums, failed_files,
+                                        dynamic_inputs);
             break;
 
         case RVAL_TYPE_LIST:
+            /* A scalar entry resolved to a list: '@(...)' expansion */
+            *dynamic_inputs = true;
             aux_policy = LoadPolicyInputFiles(ctx, config,
                                               RvalRlistValue(resolved_input),
-                                              policy_files_hashes, parsed_files_checksums, failed_files);
+                                              policy_files_hashes, parsed_files_checksums, failed_files,
+                                              dynamic_inputs);
             break;
 
         default:
@@ -313,7 +340,7 @@ static void RenameMainBundle(EvalContext *ctx, Policy *policy)
 
 static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, const char *policy_file,
                               StringMap *policy_files_hashes, StringSet *parsed_files_checksums,
-                              StringSet *failed_files)
+                              StringSet *failed_files, bool *dynamic_inputs)
 {
     unsigned char digest[EVP_MAX_MD_SIZE + 1] = { 0 };
     char hashbuffer[CF_HOSTKEY_STRING_SIZE] = { 0 };
@@ -340,31 +367,70 @@ static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, cons
         Log(LOG_LEVEL_DEBUG, "Loading policy file %s", policy_file);
     }
 
-    Policy *policy = Cf3ParseFile(config, policy_file);
+    /* A fresh per-file cache entry replaces both the parse and the partial
+     * checks for this file: the entry was stored only after the same
+     * contents passed PolicyCheckPartial(). Cross-file checks still run on
+     * the merged tree in LoadPolicy(). */
+    bool file_cache_exists = PolicyFileCacheExists(policy_file);
+    Policy *policy = NULL;
+    bool from_file_cache = false;
+    if (file_cache_exists)
+    {
+        policy = PolicyFileCacheLoad(policy_file, hashbuffer);
+        from_file_cache = (policy != NULL);
+    }
+
+    if (!from_file_cache)
+    {
+        policy = Cf3ParseFile(config, policy_file);
+    }
 
     StringMapInsert(policy_files_hashes, xstrdup(policy_file), xstrdup(hashbuffer));
     StringSetAdd(parsed_files_checksums, xstrdup(hashbuffer));
 
     if (policy)
     {
+        /* Serialize the pristine AST before RenameMainBundle() rewrites it
+         * for this entry point; the entry is written below, only once the
+         * file has passed the partial checks. */
+        JsonElement *pristine = NULL;
+        if (!from_file_cache &&
+            (file_cache_exists ||
+             (config->agent_type == AGENT_TYPE_COMMON &&
+              config->agent_specific.common.compile_policy_cache)))
+        {
+            pristine = PolicyToJson(policy);
+        }
+
         RenameMainBundle(ctx, policy);
-        Seq *errors = SeqNew(10, free);
-        if (!PolicyCheckPartial(policy, errors))
+
+        if (!from_file_cache)
         {
-            Writer *writer = FileWriter(stderr);
-            for (size_t i = 0; i < errors->length; i++)
+            Seq *errors = SeqNew(10, free);
+            if (!PolicyCheckPartial(policy, errors))
             {
-                PolicyErrorWrite(writer, errors->data[i]);
+                Writer *writer = FileWriter(stderr);
+                for (size_t i = 0; i < errors->length; i++)
+                {
+                    PolicyErrorWrite(writer, errors->data[i]);
+                }
+                WriterClose(writer);
+                SeqDestroy(errors);
+                JsonDestroy(pristine);
+
+                StringSetAdd(failed_files, xstrdup(policy_file));
+                PolicyDestroy(policy);
+                return NULL;
             }
-            WriterClose(writer);
-            SeqDestroy(errors);
 
-            StringSetAdd(failed_files, xstrdup(policy_file));
-            PolicyDestroy(policy);
-            return NULL;
+            SeqDestroy(errors);
         }
 
-        SeqDestroy(errors);
+        if (pristine != NULL)
+        {
+            PolicyFileCacheStore(policy_file, hashbuffer, pristine);
+            JsonDestroy(pristine);
+        }
     }
     else
     {
@@ -381,13 +447,17 @@ static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, cons
     {
         Seq *potential_inputs = BodyGetConstraint(body_common_control, "inputs");
         Constraint *cp = EffectiveConstraint(ctx, potential_inputs);
+        if (InputsAreClassGuarded(potential_inputs))
+        {
+            *dynamic_inputs = true;
+        }
         SeqDestroy(potential_inputs);
 
         if (cp)
         {
             Policy *aux_policy = LoadPolicyInputFiles(ctx, config, RvalRlistValue(cp->rval),
                                                       policy_files_hashes, parsed_files_checksums,
-                                                      failed_files);
+                                                      failed_files, dynamic_inputs);
             if (aux_policy)
             {
                 policy = PolicyMerge(policy, aux_policy);
@@ -399,13 +469,17 @@ static Policy *LoadPolicyFile(EvalContext *ctx, GenericAgentConfig *config, cons
     {
         Seq *potential_inputs = BodyGetConstraint(body_file_control, "inputs");
         Constraint *cp = EffectiveConstraint(ctx, potential_inputs);
+        if (InputsAreClassGuarded(potential_inputs))
+        {
+            *dynamic_inputs = true;
+        }
         SeqDestroy(potential_inputs);
 
         if (cp)
         {
             Policy *aux_policy = LoadPolicyInputFiles(ctx, config, RvalRlistValue(cp->rval),
                                                       policy_files_hashes, parsed_files_checksums,
-                                                      failed_files);
+                                                      failed_files, dynamic_inputs);
             if (aux_policy)
             {
                 policy = PolicyMerge(policy, aux_policy);
@@ -494,31 +568,53 @@ static JsonElement *ReadReleaseIdFileFromInputs()
 
 Policy *LoadPolicy(EvalContext *ctx, GenericAgentConfig *config)
 {
-    StringMap *policy_files_hashes = StringMapNew();
-    StringSet *parsed_files_checksums = StringSetNew();
-    StringSet *failed_files = StringSetNew();
-
     Banner("Loading policy");
 
-    Policy *policy = LoadPolicyFile(ctx, config, config->input_file,
-                                    policy_files_hashes, parsed_files_checksums,
-                                    failed_files);
-
-    if (StringSetSize(failed_files) > 0)
+    /* If this host has a compiled policy cache (created by
+     * 'cf-promises --compile') and every recorded input file is unchanged,
+     * deserialize the merged Policy tree instead of re-parsing it. */
+    bool loaded_from_cache = false;
+    Policy *policy = NULL;
+    if (PolicyCacheExists(config))
     {
-        Log(LOG_LEVEL_ERR, "There are syntax errors in policy files");
-        DoCleanupAndExit(EXIT_FAILURE);
+        policy = PolicyCacheLoad(config);
+        loaded_from_cache = (policy != NULL);
+        if (loaded_from_cache)
+        {
+            /* LoadPolicyFile() does this per parsed file; the cached tree
+             * needs one pre-eval pass over the merged policy. */
+            PolicyResolve(ctx, policy, config);
+        }
     }
 
-    StringSetDestroy(parsed_files_checksums);
-    StringSetDestroy(failed_files);
-    if (policy != NULL)
+    bool dynamic_inputs = false;
+    if (!loaded_from_cache)
     {
-        policy->policy_files_hashes = policy_files_hashes;
-    }
-    else
-    {
-        StringMapDestroy(policy_files_hashes);
+        StringMap *policy_files_hashes = StringMapNew();
+        StringSet *parsed_files_checksums = StringSetNew();
+        StringSet *failed_files = StringSetNew();
+
+        policy = LoadPolicyFile(ctx, config, config->input_file,
+                                policy_files_hashes, parsed_files_checksums,
+                                failed_files, &dynamic_inputs);
+
+        if (StringSetSize(failed_files) > 0)
+        {
+            Log(LOG_LEVEL_ERR, "There are syntax errors in policy files");
+            DoCleanupAndExit(EXIT_FAILURE);
+        }
+
+        StringSetDestroy(parsed_files_checksums);
+        StringSetDestroy(failed_files);
+        if (policy != NULL)
+        {
+            policy->policy_files_hashes = policy_files_hashes;
+            policy->dynamic_inputs = dynamic_inputs;
+        }
+        else
+        {
+            StringMapDestroy(policy_files_hashes);
+        }
     }
 
     {
@@ -550,6 +646,44 @@ Policy *LoadPolicy(EvalContext *ctx, GenericAgentConfig *config)
         SeqDestroy(errors);
     }
 
+    /* Keep an existing (but stale) cache fresh after a successful parse, so
+     * that hosts which opted in with 'cf-promises --compile' do not fall
+     * back to parsing forever after their first policy change.  When the
+     * effective 'inputs' turned out to be class-guarded or variable-expanded
+     * the recorded digests cannot pin down the file set, so remove the cache
+     * instead of refreshing it (the per-file cache still applies: it
+     * re-derives the file set on every load). */
+    if (!loaded_from_cache && policy != NULL && PolicyCacheExists(config))
+    {
+        if (dynamic_inputs)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Not caching compiled policy: 'inputs' are class-guarded or"
+                " variable-expanded, so the parsed file set is not fixed");
+            PolicyCacheRemove(config);
+        }
+        else
+        {
+            PolicyCacheStore(config, policy);
+        }
+    }
+
+    /* Now that the whole policy has been validated, drop the bundles this
+     * host cannot reach -- large policy repositories carry many bundles per
+     * host that only exist for other hosts' bundlesequences, and the
+     * pre-evaluation pass below walks every bundle that is left.  Only the
+     * agent prunes: cf-promises must keep validating everything. */
+    if (policy != NULL && config->agent_type == AGENT_TYPE_AGENT)
+    {
+        size_t pruned = PolicyPruneUnreachableBundles(policy, config->bundlesequence);
+        if (pruned > 0)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Pruned %zu bundle(s) not reachable from this host's policy",
+                pruned);
+        }
+    }
+
     if (LogGetGlobalLevel() >= LOG_LEVEL_VERBOSE)
     {
         Legend();
@@ -185,42 +185,247 @@ static bool WriteLockData(CF_DB *dbp, const char *lock_id, LockData *lock_data)
     return ret;
 }
 
+/**
+ * Virtual clock for the acceptance test suite: the timed lock tests re-run
+ * the agent with the clock advanced instead of sleeping out ifelapsed /
+ * expireafter deadlines. Follows the CFENGINE_TEST_OVERRIDE_* convention
+ * (see GetProcdirPid()). Returns 0 outside the test suite.
+ */
+static time_t LockClockOffset(void)
+{
+    const char *offset_str = getenv("CFENGINE_TEST_OVERRIDE_LOCK_TIME_OFFSET");
+    if (offset_str == NULL)
+    {
+        return 0;
+    }
+
+    int64_t offset;
+    int rc = StringToInt64(offset_str, &offset);
+    if (rc != 0)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Could not parse CFENGINE_TEST_OVERRIDE_LOCK_TIME_OFFSET '%s' as integer",
+            offset_str);
+        return 0;
+    }
+    return (time_t) offset;
+}
+
+/**
+ * All lock timestamps and lock age comparisons use this instead of
+ * time(2), so that the whole lock clock moves together when the test
+ * suite's virtual clock offset is set.
+ */
+static time_t LockClockTime(void)
+{
+    return time(NULL) + LockClockOffset();
+}
+
 static bool WriteLockDataCurrent(CF_DB *dbp, const char *lock_id)
 {
     LockData lock_data = { 0 };
     lock_data.pid = getpid();
-    lock_data.time = time(NULL);
+    lock_data.time = LockClockTime();
     lock_data.process_start_time = GetProcessStartTime(getpid());
 
     return WriteLockData(dbp, lock_id, &lock_data);
 }
 
-static int WriteLock(const char *name)
+static bool DeleteLockData(CF_DB *dbp, const char *lock_id)
 {
-    CF_DB *dbp = OpenLock();
+    bool ret;
+
+#ifdef LMDB
+    unsigned char digest2[LMDB_MAX_KEY_SIZE];
+
+    HashLockKeyIfNecessary(lock_id, digest2);
+
+    LOG_LOCK_ENTRY(lock_id, digest2, NULL);
+    ret = DeleteDB(dbp, digest2);
+    LOG_LOCK_EXIT(lock_id, digest2, NULL);
+#else
+    ret = DeleteDB(dbp, lock_id);
+#endif
+
+    return ret;
+}
+
+/* Journal of deferred lock DB updates. All writes between one OpenLock()
+ * and CloseLock() share a single DB transaction (committed by CloseDB()),
+ * so flushing the journal turns many per-promise commits into one grouped
+ * commit. Only lock releases and "last" run stamps are journalled; lock
+ * *acquisitions* stay immediate since they provide the mutual exclusion
+ * against concurrently running agents.
+ *
+ * A crash loses at most LOCK_JOURNAL_MAX pending updates: stale "lock."
+ * entries are recovered by the existing expireafter/dead-holder logic (the
+ * same exposure as crashing before a yield today), and lost "last." stamps
+ * only make the promise eligible to run again earlier. The journal is
+ * guarded by cft_lock, like all lock DB writes. */
+typedef struct
+{
+    char *lock_id;
+    LockData data;                                  /* valid when !remove */
+    bool remove;
+} LockJournalEntry;
+
+#define LOCK_JOURNAL_MAX 32
+
+static Seq *LOCK_JOURNAL = NULL; /* GLOBAL_X */
+
+static void LockJournalEntryDestroy_untyped(void *p)
+{
+    LockJournalEntry *entry = p;
+    if (entry != NULL)
+    {
+        free(entry->lock_id);
+        free(entry);
+    }
+}
+
+/**
+ * Find the pending update for #lock_id, if any. (The append path keeps at
+ * most one entry per lock id, so a plain scan is enough.)
+ */
+static const LockJournalEntry *LockJournalFind(const char *lock_id)
+{
+    if (LOCK_JOURNAL == NULL)
+    {
+        return NULL;
+    }
+
+    const size_t length = SeqLength(LOCK_JOURNAL);
+    for (size_t i = 0; i < length; i++)
+    {
+        const LockJournalEntry *entry = SeqAt(LOCK_JOURNAL, i);
+        if (strcmp(entry->lock_id, lock_id) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Drop any pending update for #lock_id, called before an immediate DB
+ * write/delete of the same id so the journal cannot undo it later.
+ */
+static void LockJournalInvalidate(const char *lock_id)
+{
+    if (LOCK_JOURNAL == NULL)
+    {
+        return;
+    }
+
+    const size_t length = SeqLength(LOCK_JOURNAL);
+    for (size_t i = 0; i < length; i++)
+    {
+        const LockJournalEntry *entry = SeqAt(LOCK_JOURNAL, i);
+        if (strcmp(entry->lock_id, lock_id) == 0)
+        {
+            SeqRemove(LOCK_JOURNAL, i);
+            return;
+        }
+    }
+}
+
+/**
+ * Apply all pending updates in one OpenLock()..CloseLock() window, i.e.
+ * one grouped DB transaction.
+ */
+static bool LockJournalFlush(void)
+{
+    if (LOCK_JOURNAL == NULL || SeqLength(LOCK_JOURNAL) == 0)
+    {
+        return true;
+    }
 
+    CF_DB *dbp = OpenLock();
     if (dbp == NULL)
     {
-        return -1;
+        Log(LOG_LEVEL_ERR,
+            "Unable to open locks database to flush %zu pending lock updates",
+            SeqLength(LOCK_JOURNAL));
+        return false;
     }
 
-    ThreadLock(cft_lock);
-    WriteLockDataCurrent(dbp, name);
+    const size_t length = SeqLength(LOCK_JOURNAL);
+    for (size_t i = 0; i < length; i++)
+    {
+        LockJournalEntry *entry = SeqAt(LOCK_JOURNAL, i);
+        if (entry->remove)
+        {
+            DeleteLockData(dbp, entry->lock_id);
+        }
+        else
+        {
+            WriteLockData(dbp, entry->lock_id, &entry->data);
+        }
+    }
 
     CloseLock(dbp);
-    ThreadUnlock(cft_lock);
 
-    return 0;
+    Log(LOG_LEVEL_DEBUG, "Flushed %zu pending lock updates", length);
+    SeqClear(LOCK_JOURNAL);
+    return true;
+}
+
+/**
+ * Queue a write (or removal, if #data is NULL) of #lock_id, flushing the
+ * journal when it is full.
+ */
+static void LockJournalAppend(const char *lock_id, const LockData *data)
+{
+    if (LOCK_JOURNAL == NULL)
+    {
+        LOCK_JOURNAL = SeqNew(LOCK_JOURNAL_MAX,
+                              LockJournalEntryDestroy_untyped);
+    }
+
+    /* Keep only the newest pending update per lock id. */
+    LockJournalInvalidate(lock_id);
+
+    LockJournalEntry *entry = xcalloc(1, sizeof(LockJournalEntry));
+    entry->lock_id = xstrdup(lock_id);
+    if (data != NULL)
+    {
+        entry->data = *data;
+    }
+    else
+    {
+        entry->remove = true;
+    }
+    SeqAppend(LOCK_JOURNAL, entry);
+
+    if (SeqLength(LOCK_JOURNAL) >= LOCK_JOURNAL_MAX)
+    {
+        LockJournalFlush();
+    }
+}
+
+static void WriteLock(CF_DB *dbp, const char *name)
+{
+    ThreadLock(cft_lock);
+    LockJournalInvalidate(name);
+    WriteLockDataCurrent(dbp, name);
+    ThreadUnlock(cft_lock);
 }
 
-static time_t FindLockTime(const char *name)
+static time_t FindLockTime(CF_DB *dbp, const char *name)
 {
     bool ret;
-    CF_DB *dbp = OpenLock();
-    if (dbp == NULL)
+
+    /* A pending journalled update is newer than what the DB holds. */
+    ThreadLock(cft_lock);
+    const LockJournalEntry *pending = LockJournalFind(name);
+    if (pending != NULL)
     {
-        return -1;
+        time_t pending_time = pending->remove ? -1 : pending->data.time;
+        ThreadUnlock(cft_lock);
+        return pending_time;
     }
+    ThreadUnlock(cft_lock);
 
     LockData entry = { 0 };
     entry.process_start_time = PROCESS_START_TIME_UNKNOWN;
@@ -238,12 +443,10 @@ static time_t FindLockTime(const char *name)
 
     if (ret)
     {
-        CloseLock(dbp);
         return entry.time;
     }
     else
     {
-        CloseLock(dbp);
         return -1;
     }
 }
@@ -315,32 +518,6 @@ static void RemoveDates(char *s)
     }
 }
 
-static int RemoveLock(const char *name)
-{
-    CF_DB *dbp = OpenLock();
-    if (dbp == NULL)
-    {
-        return -1;
-    }
-
-    ThreadLock(cft_lock);
-#ifdef LMDB
-    unsigned char digest2[LMDB_MAX_KEY_SIZE];
-
-    HashLockKeyIfNecessary(name, digest2);
-
-    LOG_LOCK_ENTRY(name, digest2, NULL);
-    DeleteDB(dbp, digest2);
-    LOG_LOCK_EXIT(name, digest2, NULL);
-#else
-    DeleteDB(dbp, name);
-#endif
-    ThreadUnlock(cft_lock);
-
-    CloseLock(dbp);
-    return 0;
-}
-
 static bool NoOrObsoleteLock(LockData *entry, ARG_UNUSED size_t entry_size, size_t *max_old)
 {
     assert((entry == NULL) || (entry_size == sizeof(LockData)));
@@ -350,7 +527,7 @@ static bool NoOrObsoleteLock(LockData *entry, ARG_UNUSED size_t entry_size, size
         return true;
     }
 
-    time_t now = time(NULL);
+    time_t now = LockClockTime();
     if ((now - entry->time) <= (time_t) *max_old)
     {
         Log(LOG_LEVEL_DEBUG, "Giving time to process '%d' (holding lock for %jd s)", entry->pid, (intmax_t) (now - entry->time));
@@ -370,7 +547,7 @@ void WaitForCriticalSection(const char *section_id)
         return;
     }
 
-    time_t started = time(NULL);
+    time_t started = LockClockTime();
     LockData entry = { 0 };
     entry.pid = getpid();
     entry.process_start_time = PROCESS_START_TIME_UNKNOWN;
@@ -389,9 +566,9 @@ void WaitForCriticalSection(const char *section_id)
 
     Log(LOG_LEVEL_DEBUG, "Acquiring critical section lock '%s'", section_id);
     bool got_lock = false;
-    while (!got_lock && ((time(NULL) - started) <= (time_t) max_old))
+    while (!got_lock && ((LockClockTime() - started) <= (time_t) max_old))
     {
-        entry.time = time(NULL);
+        entry.time = LockClockTime();
         got_lock = OverwriteDB(dbp, section_id, &entry, sizeof(entry),
                                (OverwriteCondition) NoOrObsoleteLock, &max_old);
         if (!got_lock)
@@ -420,33 +597,40 @@ void WaitForCriticalSection(const char *section_id)
     ThreadUnlock(cft_lock);
 }
 
-void ReleaseCriticalSection(const char *section_id)
+static void ReleaseCriticalSectionDB(CF_DB *dbp, const char *section_id)
 {
     Log(LOG_LEVEL_DEBUG, "Releasing critical section lock '%s'", section_id);
-    if (RemoveLock(section_id) == 0)
-    {
-        Log(LOG_LEVEL_DEBUG, "Released critical section lock '%s'", section_id);
-    }
-    else
+
+    ThreadLock(cft_lock);
+    LockJournalInvalidate(section_id);
+    DeleteLockData(dbp, section_id);
+    ThreadUnlock(cft_lock);
+
+    Log(LOG_LEVEL_DEBUG, "Released critical section lock '%s'", section_id);
+}
+
+void ReleaseCriticalSection(const char *section_id)
+{
+    CF_DB *dbp = OpenLock();
+    if (dbp == NULL)
     {
         Log(LOG_LEVEL_DEBUG, "Failed to release critical section lock '%s'", section_id);
+        return;
     }
+
+    ReleaseCriticalSectionDB(dbp, section_id);
+    CloseLock(dbp);
 }
 
-static time_t FindLock(char *last)
+static time_t FindLock(CF_DB *dbp, char *last)
 {
     time_t mtime;
 
-    if ((mtime = FindLockTime(last)) == -1)
+    if ((mtime = FindLockTime(dbp, last)) == -1)
     {
         /* Do this to prevent deadlock loops from surviving if IfElapsed > T_sched */
 
-        if (WriteLock(last) == -1)
-        {
-            Log(LOG_LEVEL_ERR, "Unable to lock %s", last);
-            return 0;
-        }
-
+        WriteLock(dbp, last);
         return 0;
     }
     else
@@ -467,6 +651,10 @@ static void LocksCleanup(void)
         YieldCurrentLock(best_guess);
         free(lock);
     }
+
+    ThreadLock(cft_lock);
+    LockJournalFlush();
+    ThreadUnlock(cft_lock);
 }
 
 static void RegisterLockCleanup(void)
@@ -587,19 +775,30 @@ static bool IsCfengineLockHolder(pid_t pid)
     return false;
 }
 
-static bool KillLockHolder(const char *lock)
+static bool KillLockHolder(CF_DB *dbp, const char *lock)
 {
     bool ret;
-    CF_DB *dbp = OpenLock();
-    if (dbp == NULL)
-    {
-        Log(LOG_LEVEL_ERR, "Unable to open locks database");
-        return false;
-    }
 
     LockData lock_data = { 0 };
     lock_data.process_start_time = PROCESS_START_TIME_UNKNOWN;
 
+    /* A pending journalled update is newer than what the DB holds. */
+    ThreadLock(cft_lock);
+    const LockJournalEntry *pending = LockJournalFind(lock);
+    if (pending != NULL)
+    {
+        if (pending->remove)
+        {
+            /* No lock found */
+            ThreadUnlock(cft_lock);
+            return true;
+        }
+        lock_data = pending->data;
+        ThreadUnlock(cft_lock);
+        goto found;
+    }
+    ThreadUnlock(cft_lock);
+
 #ifdef LMDB
     unsigned char ohash[LMDB_MAX_KEY_SIZE];
     HashLockKeyIfNecessary(lock, ohash);
@@ -614,12 +813,10 @@ static bool KillLockHolder(const char *lock)
     if (!ret)
     {
         /* No lock found */
-        CloseLock(dbp);
         return true;
     }
 
-    CloseLock(dbp);
-
+  found:
     if (!IsCfengineLockHolder(lock_data.pid)) {
         Log(LOG_LEVEL_VERBOSE,
             "Lock holder with PID %ju was replaced by a non CFEngine process, ignoring request to kill it",
@@ -845,6 +1042,11 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
         return CfLockNull();
     }
 
+    /* The caller's timestamp (CFSTARTTIME) is a real time(2) reading; move
+     * it onto the lock clock so elapsed-time checks below see the virtual
+     * clock offset, if any. */
+    now += LockClockOffset();
+
     char str_digest[CF_HOSTKEY_STRING_SIZE];
     {
         unsigned char digest[EVP_MAX_MD_SIZE + 1];
@@ -911,8 +1113,20 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
     // Now see if we can get exclusivity to edit the locks
     WaitForCriticalSection(CF_CRITIAL_SECTION);
 
+    /* Hold one DB handle for everything done inside the critical section.
+     * All the checks, deadlock-prevention stamps, the lock write and the
+     * critical section release below then commit as a single transaction
+     * when the handle is closed, instead of one commit per operation. */
+    CF_DB *dbp = OpenLock();
+    if (dbp == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to open locks database");
+        ReleaseCriticalSection(CF_CRITIAL_SECTION);
+        return CfLockNull();
+    }
+
     // Look for non-existent (old) processes
-    time_t lastcompleted = FindLock(cflast);
+    time_t lastcompleted = FindLock(dbp, cflast);
     time_t elapsedtime = (time_t) (now - lastcompleted) / 60;
 
     // For promises/locks with ifelapsed == 0, skip all detection logic of
@@ -925,7 +1139,8 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
                 "Another cf-agent seems to have done this since I started "
                 "(elapsed=%jd)",
                 (intmax_t) elapsedtime);
-            ReleaseCriticalSection(CF_CRITIAL_SECTION);
+            ReleaseCriticalSectionDB(dbp, CF_CRITIAL_SECTION);
+            CloseLock(dbp);
             return CfLockNull();
         }
 
@@ -934,13 +1149,14 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
             Log(LOG_LEVEL_VERBOSE,
                 "Nothing promised here [%.40s] (%jd/%u minutes elapsed)",
                 cflast, (intmax_t) elapsedtime, ifelapsed);
-            ReleaseCriticalSection(CF_CRITIAL_SECTION);
+            ReleaseCriticalSectionDB(dbp, CF_CRITIAL_SECTION);
+            CloseLock(dbp);
             return CfLockNull();
         }
     }
 
     // Look for existing (current) processes
-    lastcompleted = FindLock(cflock);
+    lastcompleted = FindLock(dbp, cflock);
     if (!ignoreProcesses)
     {
         elapsedtime = (time_t) (now - lastcompleted) / 60;
@@ -953,7 +1169,7 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
                     "Lock expired after %jd/%u minutes: %s",
                     (intmax_t) elapsedtime, expireafter, cflock);
 
-                if (KillLockHolder(cflock))
+                if (KillLockHolder(dbp, cflock))
                 {
                     Log(LOG_LEVEL_VERBOSE,
                         "Lock successfully expired: %s", cflock);
@@ -966,7 +1182,8 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
             }
             else
             {
-                ReleaseCriticalSection(CF_CRITIAL_SECTION);
+                ReleaseCriticalSectionDB(dbp, CF_CRITIAL_SECTION);
+                CloseLock(dbp);
                 Log(LOG_LEVEL_VERBOSE,
                     "Couldn't obtain lock for %s (already running!)",
                     cflock);
@@ -974,20 +1191,19 @@ CfLock AcquireLock(EvalContext *ctx, const char *operand, const char *host,
             }
         }
 
-        int ret = WriteLock(cflock);
-        if (ret != -1)
-        {
-            /* Register a cleanup handler *after* having opened the DB, so that
-             * CloseAllDB() atexit() handler is registered in advance, and it
-             * is called after removing this lock.
+        WriteLock(dbp, cflock);
 
-             * There is a small race condition here that we'll leave a stale
-             * lock if we exit before the following line. */
-            pthread_once(&lock_cleanup_once, &RegisterLockCleanup);
-        }
+        /* Register a cleanup handler *after* having opened the DB, so that
+         * CloseAllDB() atexit() handler is registered in advance, and it
+         * is called after removing this lock.
+
+         * There is a small race condition here that we'll leave a stale
+         * lock if we exit before the following line. */
+        pthread_once(&lock_cleanup_once, &RegisterLockCleanup);
     }
 
-    ReleaseCriticalSection(CF_CRITIAL_SECTION);
+    ReleaseCriticalSectionDB(dbp, CF_CRITIAL_SECTION);
+    CloseLock(dbp);
 
     // Keep this as a global for signal handling
     PushLock(cflock, cflast);
@@ -1010,22 +1226,18 @@ void YieldCurrentLock(CfLock lock)
 
     Log(LOG_LEVEL_DEBUG, "Yielding lock '%s'", lock.lock);
 
-    if (RemoveLock(lock.lock) == -1)
-    {
-        Log(LOG_LEVEL_VERBOSE, "Unable to remove lock %s", lock.lock);
-        free(lock.last);
-        free(lock.lock);
-        return;
-    }
+    /* Journal the release and the "last run" stamp instead of committing
+     * two DB transactions per promise; the journal writes them to the DB
+     * grouped with other pending lock updates. */
+    LockData last_data = { 0 };
+    last_data.pid = getpid();
+    last_data.time = LockClockTime();
+    last_data.process_start_time = GetProcessStartTime(getpid());
 
-    if (WriteLock(lock.last) == -1)
-    {
-        Log(LOG_LEVEL_ERR, "Unable to create '%s'. (create: %s)",
-            lock.last, GetErrorStr());
-        free(lock.last);
-        free(lock.lock);
-        return;
-    }
+    ThreadLock(cft_lock);
+    LockJournalAppend(lock.lock, NULL);
+    LockJournalAppend(lock.last, &last_data);
+    ThreadUnlock(cft_lock);
 
     /* This lock has ben yield'ed, don't try to yield it again in case process
      * is terminated abnormally.
@@ -1215,7 +1427,7 @@ void PurgeLocks(void)
         return;
     }
 
-    time_t now = time(NULL);
+    time_t now = LockClockTime();
 
     int usage_pct = GetDBUsagePercentage(db);
     if (usage_pct == -1)
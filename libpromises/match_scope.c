@@ -33,9 +33,9 @@
 /* Sets variables */
 static bool RegExMatchSubString(EvalContext *ctx, Regex *regex, const char *teststring, int *start, int *end)
 {
-    pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(regex, NULL);
+    pcre2_match_data *match_data = RegexMatchDataAcquire(regex);
     int result = pcre2_match(regex, (PCRE2_SPTR) teststring, PCRE2_ZERO_TERMINATED,
-                             0, 0, match_data, NULL);
+                             0, 0, match_data, RegexMatchContext());
     /* pcre2_match() returns the highest capture group number + 1, i.e. 1 means
      * a match with 0 capture groups. 0 means the vector of offsets is small,
      * negative numbers are errors (incl. no match). */
@@ -64,12 +64,19 @@ static bool RegExMatchSubString(EvalContext *ctx, Regex *regex, const char *test
     }
     else
     {
+        if (result == PCRE2_ERROR_MATCHLIMIT || result == PCRE2_ERROR_DEPTHLIMIT)
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Regular expression hit its backtracking limit on a %zu byte"
+                " subject, treating as a non-match"
+                " (catastrophically backtracking pattern?)",
+                strlen(teststring));
+        }
         *start = 0;
         *end = 0;
     }
 
-    pcre2_match_data_free(match_data);
-    RegexDestroy(regex);
+    RegexMatchDataRelease(match_data);
     return result > 0;
 }
 
@@ -96,7 +103,15 @@ bool FullTextMatch(EvalContext *ctx, const char *regexp, const char *teststring)
         return true;
     }
 
-    Regex *rx = CompileRegex(regexp);
+    /* Reject on the pattern's literal prefix/suffix before paying for a
+     * PCRE execution; most candidates fail here for anchored patterns. */
+    if (!StringMatchFullLiteralPrefilter(regexp, teststring))
+    {
+        return false;
+    }
+
+    /* Cache-owned: RegExMatchSubString() deliberately does not destroy. */
+    Regex *rx = CompileRegexCached(regexp);
     if (rx == NULL)
     {
         return false;
@@ -123,7 +138,7 @@ bool ValidateRegEx(const char *regex)
 
 bool BlockTextMatch(EvalContext *ctx, const char *regexp, const char *teststring, int *start, int *end)
 {
-    Regex *rx = CompileRegex(regexp);
+    Regex *rx = CompileRegexCached(regexp);
 
     if (rx == NULL)
     {
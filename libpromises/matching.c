@@ -34,6 +34,347 @@
 #include <rlist.h>
 #include <regex.h>                          /* CompileRegex,StringMatchFull */
 #include <string_lib.h>
+#include <map.h>                                           /* TYPED_MAP_*  */
+#include <mutex.h>                                         /* ThreadLock   */
+#include <buffer.h>
+
+
+typedef struct
+{
+    Regex *regex;
+    unsigned int uses;             /* fetch count, drives JIT compilation */
+    bool jit_tried;
+} CachedRegex;
+
+static void CachedRegexDestroy_untyped(void *entry_)
+{
+    CachedRegex *entry = entry_;
+    RegexDestroy(entry->regex);
+    free(entry);
+}
+
+TYPED_MAP_DECLARE(RegexCache, char *, CachedRegex *)
+
+TYPED_MAP_DEFINE(RegexCache, char *, CachedRegex *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 CachedRegexDestroy_untyped)
+
+/* Policies re-use a bounded set of patterns, so in practice the cache never
+ * fills up; the cap only protects pathological policies that generate
+ * patterns dynamically. */
+#define REGEX_CACHE_SIZE_MAX 512
+
+/* JIT-compile a cached pattern once it has been fetched this many times:
+ * JIT compilation is not free, and one-shot patterns never earn it back. */
+#define REGEX_JIT_USE_THRESHOLD 8
+
+static RegexCacheMap *regex_cache = NULL; /* GLOBAL_X */
+static size_t regex_cache_entries = 0; /* GLOBAL_X */
+static pthread_mutex_t regex_cache_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+Regex *CompileRegexCached(const char *pattern)
+{
+    ThreadLock(&regex_cache_lock);
+
+    if (regex_cache == NULL)
+    {
+        regex_cache = RegexCacheMapNew();
+    }
+
+    CachedRegex *entry = RegexCacheMapGet(regex_cache, pattern);
+    if (entry == NULL)
+    {
+        Regex *regex = CompileRegex(pattern);
+        if (regex == NULL)
+        {
+            ThreadUnlock(&regex_cache_lock);
+            return NULL;
+        }
+
+        if (regex_cache_entries >= REGEX_CACHE_SIZE_MAX)
+        {
+            Log(LOG_LEVEL_DEBUG,
+                "Regex cache full (%zu patterns), flushing",
+                regex_cache_entries);
+            RegexCacheMapDestroy(regex_cache);
+            regex_cache = RegexCacheMapNew();
+            regex_cache_entries = 0;
+        }
+
+        entry = xcalloc(1, sizeof(CachedRegex));
+        entry->regex = regex;
+        RegexCacheMapInsert(regex_cache, xstrdup(pattern), entry);
+        regex_cache_entries++;
+    }
+
+    entry->uses++;
+    if (!entry->jit_tried && entry->uses >= REGEX_JIT_USE_THRESHOLD)
+    {
+        /* Hot pattern: JIT-compile in place, pcre2_match() picks the JIT
+         * code up automatically. Failure (no JIT support in the PCRE build,
+         * pattern not JIT-able) just keeps the interpreted form. */
+        pcre2_jit_compile(entry->regex, PCRE2_JIT_COMPLETE);
+        entry->jit_tried = true;
+    }
+
+    Regex *regex = entry->regex;
+    ThreadUnlock(&regex_cache_lock);
+    return regex;
+}
+
+/* One ovector pair for the whole match plus one per capture group that the
+ * reusable per-thread match data can hold; patterns with more capture
+ * groups fall back to a per-call allocation. */
+#define REGEX_MATCH_DATA_PAIRS 32
+
+static __thread pcre2_match_data *thread_match_data = NULL; /* GLOBAL_X, thread-local */
+static __thread bool thread_match_data_busy = false; /* GLOBAL_X, thread-local */
+
+/**
+ * Get match data suitable for matching @a regex, reusing one per-thread
+ * block instead of allocating per call. Release with
+ * RegexMatchDataRelease() -- pairs must nest, a second acquire before the
+ * release falls back to a fresh allocation.
+ */
+pcre2_match_data *RegexMatchDataAcquire(const Regex *regex)
+{
+    uint32_t captures = 0;
+    pcre2_pattern_info(regex, PCRE2_INFO_CAPTURECOUNT, &captures);
+
+    if (!thread_match_data_busy && (captures + 1) <= REGEX_MATCH_DATA_PAIRS)
+    {
+        if (thread_match_data == NULL)
+        {
+            thread_match_data =
+                pcre2_match_data_create(REGEX_MATCH_DATA_PAIRS, NULL);
+        }
+        if (thread_match_data != NULL)
+        {
+            thread_match_data_busy = true;
+            return thread_match_data;
+        }
+    }
+
+    return pcre2_match_data_create_from_pattern(regex, NULL);
+}
+
+void RegexMatchDataRelease(pcre2_match_data *match_data)
+{
+    if (match_data == thread_match_data && thread_match_data_busy)
+    {
+        thread_match_data_busy = false;
+    }
+    else
+    {
+        pcre2_match_data_free(match_data);
+    }
+}
+
+/* Backtracking caps, so that a catastrophically backtracking pattern
+ * degrades into a logged non-match instead of freezing the run. The depth
+ * limit is the effective brake: legitimate matches recurse roughly in
+ * proportion to the subject length, runaway patterns explode past this. */
+#define REGEX_MATCH_LIMIT (10 * 1000 * 1000)
+#define REGEX_DEPTH_LIMIT (1000 * 1000)
+
+static pcre2_match_context *regex_match_context = NULL; /* GLOBAL_X */
+
+/**
+ * Shared match context with backtracking limits for pcre2_match() calls.
+ * Read-only after creation, so safe to share between threads.
+ */
+pcre2_match_context *RegexMatchContext(void)
+{
+    ThreadLock(&regex_cache_lock);
+    if (regex_match_context == NULL)
+    {
+        regex_match_context = pcre2_match_context_create(NULL);
+        if (regex_match_context != NULL)
+        {
+            pcre2_set_match_limit(regex_match_context, REGEX_MATCH_LIMIT);
+            pcre2_set_depth_limit(regex_match_context, REGEX_DEPTH_LIMIT);
+        }
+    }
+    ThreadUnlock(&regex_cache_lock);
+    return regex_match_context;
+}
+
+/* Characters that end a guaranteed literal run in a regular expression. */
+#define REGEX_META_CHARS "\\^$.[]()*+?{|"
+
+/**
+ * @brief Cheap literal-anchor rejection before running PCRE on a full match
+ *
+ * Full matches are anchored to the whole candidate string, so the literal
+ * run at the start of @a pattern (up to the first metacharacter) must be a
+ * prefix of @a string, and the literal run after the last metacharacter must
+ * be a suffix. A pattern like "^/var/log/.*" thus rejects most candidates
+ * with a string compare instead of a PCRE execution.
+ *
+ * The analysis is conservative: alternation or inline option groups make it
+ * give up ('|' or "(?" anywhere in the pattern), and a quantifier directly
+ * after the leading run drops the possibly-optional last character.
+ *
+ * @return false only when @a string provably cannot fully match @a pattern
+ */
+bool StringMatchFullLiteralPrefilter(const char *pattern, const char *string)
+{
+    assert(pattern != NULL);
+    assert(string != NULL);
+
+    if (pattern[0] == '^')
+    {
+        pattern++;                /* full matches are anchored either way */
+    }
+
+    if (strchr(pattern, '|') != NULL || strstr(pattern, "(?") != NULL)
+    {
+        return true;
+    }
+
+    size_t pattern_len = strlen(pattern);
+    const size_t string_len = strlen(string);
+
+    if (pattern_len > 0 && pattern[pattern_len - 1] == '$' &&
+        (pattern_len < 2 || pattern[pattern_len - 2] != '\\'))
+    {
+        pattern_len--;            /* likewise for the trailing anchor */
+    }
+
+    /* Leading literal run. */
+    size_t prefix_len = strcspn(pattern, REGEX_META_CHARS);
+    if (prefix_len == pattern_len)
+    {
+        /* Pure literal pattern: a full match means equality. */
+        return (string_len == pattern_len &&
+                memcmp(pattern, string, pattern_len) == 0);
+    }
+    if (prefix_len > 0 && strchr("*?{", pattern[prefix_len]) != NULL)
+    {
+        prefix_len--;   /* the quantified character may match zero times */
+    }
+    if (prefix_len > string_len ||
+        memcmp(pattern, string, prefix_len) != 0)
+    {
+        return false;
+    }
+
+    /* Trailing literal run: everything after the last metacharacter (the
+     * character following a backslash is escaped, not a literal anchor). */
+    size_t tail_start = 0;
+    for (size_t i = 0; i < pattern_len; i++)
+    {
+        if (strchr(REGEX_META_CHARS, pattern[i]) != NULL)
+        {
+            if (pattern[i] == '\\' && (i + 1) < pattern_len)
+            {
+                i++;
+            }
+            tail_start = i + 1;
+        }
+    }
+    const size_t tail_len = (tail_start < pattern_len) ? (pattern_len - tail_start) : 0;
+    if (tail_len > 0)
+    {
+        if (prefix_len + tail_len > string_len ||
+            memcmp(pattern + tail_start,
+                   string + string_len - tail_len, tail_len) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Test whether any pattern in @a patterns can fully match
+ *        @a teststring, in one PCRE execution
+ *
+ * The list is combined into a single branch-reset alternation
+ * "^(?|(?:p1)$|(?:p2)$|...)" and compiled through the regex cache, so an
+ * ignore list of 50 patterns tested against every file in a tree costs one
+ * execution per file instead of 50. Callers keep their per-pattern loop for
+ * match attribution and match variables, but only enter it after a hit --
+ * and most candidates match nothing.
+ *
+ * Combination is conservative: inline option groups leak into later
+ * branches and backreference numbers shift inside an alternation, so any
+ * pattern containing "(?" or a backreference disqualifies the list. A
+ * pattern that is byte-identical to @a teststring also reports a hit, to
+ * mirror the literal-equality fast path of FullTextMatch().
+ *
+ * @return false only when no pattern in the list can fully match
+ */
+bool RegexListMatchAnyPrefilter(const Rlist *patterns, const char *teststring)
+{
+    assert(teststring != NULL);
+
+    if (patterns == NULL || patterns->next == NULL)
+    {
+        return true;                            /* nothing to combine */
+    }
+
+    for (const Rlist *rp = patterns; rp != NULL; rp = rp->next)
+    {
+        if (rp->val.type != RVAL_TYPE_SCALAR)
+        {
+            return true;
+        }
+
+        const char *pattern = RlistScalarValue(rp);
+        if (strcmp(pattern, teststring) == 0)
+        {
+            return true;
+        }
+        if (strstr(pattern, "(?") != NULL)
+        {
+            return true;
+        }
+        for (const char *sp = pattern; *sp != '\0'; sp++)
+        {
+            if (sp[0] == '\\')
+            {
+                if (isdigit((unsigned char) sp[1]))
+                {
+                    return true;                /* backreference */
+                }
+                if (sp[1] != '\0')
+                {
+                    sp++;
+                }
+            }
+        }
+    }
+
+    Buffer *combined = BufferNew();
+    BufferAppendString(combined, "^(?|");
+    for (const Rlist *rp = patterns; rp != NULL; rp = rp->next)
+    {
+        BufferAppendF(combined, "%s(?:%s)$",
+                      (rp == patterns) ? "" : "|", RlistScalarValue(rp));
+    }
+    BufferAppendString(combined, ")");
+
+    Regex *rx = CompileRegexCached(BufferData(combined));
+    BufferDestroy(combined);
+    if (rx == NULL)
+    {
+        return true;                   /* cannot decide, run the loop */
+    }
+
+    pcre2_match_data *match_data = RegexMatchDataAcquire(rx);
+    int result = pcre2_match(rx, (PCRE2_SPTR) teststring, PCRE2_ZERO_TERMINATED,
+                             0, 0, match_data, RegexMatchContext());
+    RegexMatchDataRelease(match_data);
+
+    /* Anchoring is built into the combined pattern, so any match is a full
+     * match of some branch; errors other than no-match mean "cannot decide". */
+    return (result != PCRE2_ERROR_NOMATCH);
+}
 
 
 /* Pure, non-thread-safe */
@@ -42,20 +383,19 @@ static char *FirstBackReference(Regex *regex, const char *teststring)
     static char backreference[CF_BUFSIZE]; /* GLOBAL_R, no initialization needed */
     memset(backreference, 0, CF_BUFSIZE);
 
-    pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(regex, NULL);
+    pcre2_match_data *match_data = RegexMatchDataAcquire(regex);
     int result = pcre2_match(regex, (PCRE2_SPTR) teststring, PCRE2_ZERO_TERMINATED,
-                             0, 0, match_data, NULL);
+                             0, 0, match_data, RegexMatchContext());
     /* pcre2_match() returns the highest capture group number + 1, i.e. 1 means
      * a match with 0 capture groups. 0 means the vector of offsets is small,
      * negative numbers are errors (incl. no match). */
     if (result > 0)
     {
-        uint32_t num_pairs = pcre2_get_ovector_count(match_data);
-        if (num_pairs <= 1)
+        if (result == 1)
         {
-            /* There was no match */
+            /* Matched, but no capture group participated */
             strlcpy(backreference, "CF_NOMATCH", CF_MAXVARSIZE);
-            pcre2_match_data_free(match_data);
+            RegexMatchDataRelease(match_data);
             RegexDestroy(regex);
             return backreference;
         }
@@ -71,7 +411,7 @@ static char *FirstBackReference(Regex *regex, const char *teststring)
         }
     }
 
-    pcre2_match_data_free(match_data);
+    RegexMatchDataRelease(match_data);
     RegexDestroy(regex);
     return backreference;
 }
@@ -26,6 +26,25 @@
 #define CFENGINE_MATCHING_H
 
 #include <cf3.defs.h>
+#include <regex.h>                                             /* Regex */
+
+/**
+ * Compile @a pattern like CompileRegex(), but keep the result in a
+ * process-wide cache so that hot callers (files_select leaf lists, process
+ * filters) stop paying recompilation on every use.
+ *
+ * @return Compiled regex owned by the cache -- do NOT RegexDestroy() it, and
+ *         do not hold it across further CompileRegexCached() calls, which
+ *         may flush the cache. NULL if the pattern does not compile.
+ */
+Regex *CompileRegexCached(const char *pattern);
+
+pcre2_match_data *RegexMatchDataAcquire(const Regex *regex);
+void RegexMatchDataRelease(pcre2_match_data *match_data);
+pcre2_match_context *RegexMatchContext(void);
+
+bool StringMatchFullLiteralPrefilter(const char *pattern, const char *string);
+bool RegexListMatchAnyPrefilter(const Rlist *patterns, const char *teststring);
 
 bool IsRegex(const char *str); /* Pure */
 bool IsRegexItemIn(const EvalContext *ctx, const Item *list, const char *regex); /* Uses context */
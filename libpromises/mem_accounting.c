@@ -0,0 +1,129 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <mem_accounting.h>
+
+#include <logging.h>
+
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+static size_t MEM_BUDGET = 0; /* GLOBAL_P, 0 = no budget */
+static size_t MEM_BUDGET_EVICTIONS = 0; /* GLOBAL_X */
+
+size_t MemCurrentRSS(void)
+{
+#ifdef __linux__
+    /* /proc/self/statm: total program size and resident set size, both in
+     * pages. Reading it is a handful of microseconds, no allocation. */
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL)
+    {
+        return 0;
+    }
+
+    unsigned long size_pages, resident_pages;
+    int ret = fscanf(fp, "%lu %lu", &size_pages, &resident_pages);
+    fclose(fp);
+    if (ret != 2)
+    {
+        return 0;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0)
+    {
+        page_size = 4096;
+    }
+    return (size_t) resident_pages * (size_t) page_size;
+#else
+    return 0;
+#endif
+}
+
+size_t MemHighWater(void)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+    /* ru_maxrss is in kilobytes on Linux and most BSDs. */
+    return (size_t) usage.ru_maxrss * 1024;
+#else
+    return 0;
+#endif
+}
+
+void MemBudgetSet(size_t bytes)
+{
+    MEM_BUDGET = bytes;
+}
+
+size_t MemBudgetGet(void)
+{
+    return MEM_BUDGET;
+}
+
+bool MemOverBudget(void)
+{
+    static time_t last_check = 0; /* GLOBAL_X */
+    static bool last_result = false; /* GLOBAL_X */
+
+    if (MEM_BUDGET == 0)
+    {
+        return false;
+    }
+
+    const time_t now = time(NULL);
+    if (now == last_check)
+    {
+        return last_result;
+    }
+    last_check = now;
+
+    size_t rss = MemCurrentRSS();
+    if (rss == 0)
+    {
+        /* No live RSS reading on this platform, fall back to the high-water
+         * mark: evicting cannot lower it, but it still stops further
+         * cache growth once the budget has been crossed. */
+        rss = MemHighWater();
+    }
+
+    last_result = (rss > MEM_BUDGET);
+    return last_result;
+}
+
+void MemBudgetRecordEviction(void)
+{
+    MEM_BUDGET_EVICTIONS++;
+}
+
+size_t MemBudgetEvictions(void)
+{
+    return MEM_BUDGET_EVICTIONS;
+}
@@ -0,0 +1,74 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_MEM_ACCOUNTING_H
+#define CFENGINE_MEM_ACCOUNTING_H
+
+#include <platform.h>
+
+/**
+ * Process-level memory accounting for small hosts.
+ *
+ * The agent has no allocator interposition, so these helpers read what the
+ * kernel already tracks: current resident set size and the run's high-water
+ * mark. A memory budget (body agent control "memory_budget") lets evaluation
+ * shed reclaimable state (the function caches) before the kernel's OOM
+ * killer gets involved on memory-constrained devices.
+ */
+
+/**
+ * @return the current resident set size in bytes, or 0 if it cannot be
+ *         determined on this platform.
+ */
+size_t MemCurrentRSS(void);
+
+/**
+ * @return the peak resident set size of this run in bytes, or 0 if it
+ *         cannot be determined on this platform.
+ */
+size_t MemHighWater(void);
+
+/**
+ * Set the memory budget in bytes. 0 (the default) disables budget checks.
+ */
+void MemBudgetSet(size_t bytes);
+
+size_t MemBudgetGet(void);
+
+/**
+ * @return true if a budget is set and the current resident set size exceeds
+ *         it. The RSS read is rate-limited to once per second, so this is
+ *         cheap enough for per-insertion checks in cache code.
+ */
+bool MemOverBudget(void);
+
+/**
+ * Record that reclaimable state was dropped because the budget was
+ * exceeded; counted for the run-end report.
+ */
+void MemBudgetRecordEviction(void);
+
+size_t MemBudgetEvictions(void);
+
+#endif  /* CFENGINE_MEM_ACCOUNTING_H */
@@ -271,6 +271,7 @@ const ConstraintSyntax CFG_CONTROLBODY[COMMON_CONTROL_MAX + 1] =
     ConstraintSyntaxNewStringList("package_inventory", ".*", "Name of the package manager used for software inventory management", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("package_module", ".*", "Name of the default package manager", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("evaluation_order", "(classic|top_down)", "Order of evaluation of promises", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewBool("startup_dns_resolution", "If false, environment discovery never blocks on the resolver: persisted answers are used regardless of age and unresolved names fall back to the node name. Default value: true", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewNull()
 };
 
@@ -324,6 +325,10 @@ const ConstraintSyntax CFA_CONTROLBODY[] =
     ConstraintSyntaxNewStringList("copyfrom_restrict_keys", ".*", "A list of key hashes to restrict copy_from to", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("evaluation_order", "(classic|top_down)", "Order of evaluation of promises of agent", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("default_directory_create_mode", ".*", "Default directory create mode (defaults to 0700 if not specified)", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewBool("profile", "true/false record evaluation timings for this run and write a flame graph report, as with --profile. Default value: false", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("memory_budget", CF_VALRANGE, "Resident set size in bytes above which the agent sheds its function caches instead of growing further. Default: no budget", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("bundle_time_budget", CF_VALRANGE, "Wall-clock seconds a single bundle may spend actuating promises before its remaining promises are skipped. Default: no budget", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("fs_operation_timeout", CF_VALRANGE, "Seconds a local stat in files promises may block, e.g. on a dead network mount, before it is abandoned and its directory treated as unresponsive. Default: no timeout", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewNull()
 };
 
@@ -353,6 +358,9 @@ const ConstraintSyntax CFS_CONTROLBODY[SERVER_CONTROL_MAX + 1] =
     ConstraintSyntaxNewString("allowciphers", "", "List of ciphers the server accepts. For Syntax help see man page for \"openssl ciphers\". Default is \"AES256-GCM-SHA384:AES256-SHA\"", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewStringList("allowlegacyconnects", "", "List of IPs from whom we accept legacy protocol connections", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("allowtlsversion", "", "Minimum TLS version allowed for incoming connections", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewReal("bwlimit", CF_VALRANGE, "Limit outgoing file-transfer bandwidth per peer subnet in Bytes per second. Default value: 0 (unlimited)", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewStringList("bwlimit_exempt", "", "List of IPs or subnets whose transfers are not bandwidth limited", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewString("protocol_trace_file", CF_ABSPATHRANGE, "Append a binary trace of framed protocol transactions to this file, replayable with cf-net replay. Default: no tracing", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewNull()
 };
 
@@ -54,6 +54,9 @@ typedef enum
     SERVER_CONTROL_ALLOWCIPHERS,
     SERVER_CONTROL_ALLOWLEGACYCONNECTS,
     SERVER_CONTROL_ALLOWTLSVERSION,
+    SERVER_CONTROL_BWLIMIT,
+    SERVER_CONTROL_BWLIMIT_EXEMPT,
+    SERVER_CONTROL_PROTOCOL_TRACE_FILE,
     SERVER_CONTROL_MAX
 } ServerControl;
 
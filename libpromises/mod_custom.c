@@ -35,6 +35,7 @@
 #include <map.h>             // Map*
 #include <locks.h>           // AcquireLock()
 #include <process_lib.h>     // GracefulTerminate(), GetProcessStartTime()
+#include <module_pool.h>     // ModulePoolWithdraw(), ModulePoolDeposit()
 
 static Map *custom_modules = NULL;
 
@@ -363,6 +364,93 @@ static JsonElement *PromiseModule_Receive(PromiseModule *module, const Promise *
     return response;
 }
 
+/**
+ * Extract the request ID echoed in a module reply, or 0 if there is none.
+ */
+static size_t PromiseModule_ReplyRequestID(const JsonElement *reply)
+{
+    assert(reply != NULL);
+
+    JsonElement *id = JsonObjectGet(reply, "request_id");
+    if ((id == NULL) ||
+        (JsonGetElementType(id) != JSON_ELEMENT_TYPE_PRIMITIVE))
+    {
+        return 0;
+    }
+
+    long long value = 0;
+    if ((sscanf(JsonPrimitiveGetAsString(id), "%lld", &value) != 1) ||
+        (value <= 0))
+    {
+        return 0;
+    }
+    return (size_t) value;
+}
+
+/**
+ * Receive the reply for a specific request.
+ *
+ * With a v1 module (@c request_id is 0) replies arrive strictly in request
+ * order, so this is just PromiseModule_Receive(). With a module that
+ * declared @c request_ids, replies to other outstanding requests may arrive
+ * first; they are stashed on the module and handed out when their requester
+ * comes asking.
+ */
+static JsonElement *PromiseModule_ReceiveReply(
+    PromiseModule *module,
+    const Promise *pp,
+    uint16_t n_log_msgs[LOG_LEVEL_DEBUG + 1],
+    size_t request_id)
+{
+    assert(module != NULL);
+
+    if (request_id == 0)
+    {
+        return PromiseModule_Receive(module, pp, n_log_msgs);
+    }
+
+    /* The reply may already have been read and stashed while waiting for an
+     * earlier request. */
+    const size_t n_stashed = SeqLength(module->replies);
+    for (size_t i = 0; i < n_stashed; i++)
+    {
+        JsonElement *stashed = SeqAt(module->replies, i);
+        if (PromiseModule_ReplyRequestID(stashed) == request_id)
+        {
+            SeqSoftRemove(module->replies, i);
+            return stashed;
+        }
+    }
+
+    while (true)
+    {
+        JsonElement *reply = PromiseModule_Receive(module, pp, n_log_msgs);
+        if (reply == NULL)
+        {
+            // Error already printed in PromiseModule_Receive()
+            return NULL;
+        }
+
+        const size_t reply_id = PromiseModule_ReplyRequestID(reply);
+        if (reply_id == request_id)
+        {
+            return reply;
+        }
+        if (reply_id == 0)
+        {
+            Log(LOG_LEVEL_ERR,
+                "Promise module '%s' declared request IDs"
+                " but sent a reply without one",
+                module->path);
+            JsonDestroy(reply);
+            return NULL;
+        }
+
+        // Reply to another outstanding request, keep it for its requester:
+        SeqAppend(module->replies, reply);
+    }
+}
+
 static void PromiseModule_SendMessage(PromiseModule *module, Seq *message)
 {
     assert(module != NULL);
@@ -439,11 +527,197 @@ static void PromiseModule_DestroyInternal(PromiseModule *module)
 
     free(module->path);
     free(module->interpreter);
+    SeqDestroy(module->replies);
 
-    cf_pclose_full_duplex(&(module->fds));
+    if (module->pooled || module->handed_off)
+    {
+        /* The module process lives on in the cf-execd pool, just drop our
+         * stream ends (cf_pclose_full_duplex() would wait for it to exit). */
+        if (module->input != NULL)
+        {
+            fclose(module->input);
+        }
+        if (module->output != NULL)
+        {
+            fclose(module->output);
+        }
+    }
+    else
+    {
+        cf_pclose_full_duplex(&(module->fds));
+    }
     free(module);
 }
 
+/**
+ * Apply one protocol header flag to the module. Used both when parsing the
+ * header of a freshly started module and when restoring the recorded flags
+ * of a module withdrawn from the cf-execd pool.
+ */
+static void PromiseModule_SetFlag(
+    PromiseModule *module, const char *flag, bool *protocol_specified)
+{
+    assert(module != NULL);
+    assert(flag != NULL);
+    assert(protocol_specified != NULL);
+
+    if (StringEqual(flag, "json_based"))
+    {
+        module->json = true;
+        if (*protocol_specified)
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Ambiguous protocol specification from the custom promise module '%s'."
+                " Please report this as a bug in the module",
+                module->path);
+        }
+        *protocol_specified = true;
+    }
+    else if (StringEqual(flag, "line_based"))
+    {
+        module->json = false;
+        if (*protocol_specified)
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Ambiguous protocol specification from the custom promise module '%s'."
+                " Please report this as a bug in the module",
+                module->path);
+        }
+        *protocol_specified = true;
+    }
+    else if (StringEqual(flag, "action_policy"))
+    {
+        module->action_policy = true;
+    }
+    else if (StringEqual(flag, "resident"))
+    {
+        module->resident = true;
+    }
+    else if (StringEqual(flag, "request_ids"))
+    {
+        module->request_ids = true;
+    }
+    else if (StringStartsWith(flag, "max_outstanding="))
+    {
+        size_t max_outstanding = 0;
+        if (sscanf(flag, "max_outstanding=%zu", &max_outstanding) == 1)
+        {
+            module->max_outstanding = max_outstanding;
+        }
+        else
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Invalid max_outstanding flag '%s' from custom promise module '%s'."
+                " Please report this as a bug in the module",
+                flag,
+                module->path);
+        }
+    }
+}
+
+/**
+ * Try to resume a resident instance of the module from the cf-execd pool
+ * instead of starting a new process. Takes ownership of #interpreter and
+ * #path only on success.
+ *
+ * @return the resumed module, or NULL when there is none (callers then
+ *         start a fresh process)
+ */
+static PromiseModule *PromiseModule_Resume(
+    char *interpreter, char *path, time_t module_mtime)
+{
+    assert(path != NULL);
+
+    PooledModule pooled;
+    if (!ModulePoolWithdraw(path, &pooled))
+    {
+        return NULL;
+    }
+
+    /* Health check: the pooled PID must still belong to the same process. */
+    if (GetProcessStartTime(pooled.pid) != pooled.process_start_time)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Pooled module '%s' (PID %jd) is gone, starting a new one",
+            path, (intmax_t) pooled.pid);
+        close(pooled.output_fd);
+        close(pooled.input_fd);
+        return NULL;
+    }
+
+    /* Restart on change: a module updated by policy must not keep running
+     * as its old self. */
+    if (pooled.module_mtime != module_mtime)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Module '%s' changed since pooled instance started, restarting it",
+            path);
+        if (!GracefulTerminate(pooled.pid, pooled.process_start_time))
+        {
+            Log(LOG_LEVEL_ERR, "Failed to terminate outdated pooled module '%s'",
+                path);
+        }
+        close(pooled.output_fd);
+        close(pooled.input_fd);
+        return NULL;
+    }
+
+    PromiseModule *module = xcalloc(1, sizeof(PromiseModule));
+    module->fds.read_fd = pooled.output_fd;
+    module->fds.write_fd = pooled.input_fd;
+    module->output = fdopen(pooled.output_fd, "r");
+    module->input = fdopen(pooled.input_fd, "w");
+    if ((module->output == NULL) || (module->input == NULL))
+    {
+        Log(LOG_LEVEL_ERR, "Failed to open streams of pooled module '%s'",
+            path);
+        if (module->output != NULL)
+        {
+            fclose(module->output);
+        }
+        else
+        {
+            close(pooled.output_fd);
+        }
+        if (module->input != NULL)
+        {
+            fclose(module->input);
+        }
+        else
+        {
+            close(pooled.input_fd);
+        }
+        free(module);
+        return NULL;
+    }
+
+    module->interpreter = interpreter;
+    module->path = path;
+    module->pid = pooled.pid;
+    module->process_start_time = pooled.process_start_time;
+    module->module_mtime = pooled.module_mtime;
+    module->pooled = true;
+
+    /* The handshake happened in the module's first life; restore its
+     * declared flags from the pool record. */
+    bool protocol_specified = false;
+    Seq *flags = SeqStringFromString(pooled.flags, ',');
+    const size_t n_flags = SeqLength(flags);
+    for (size_t i = 0; i < n_flags; i++)
+    {
+        PromiseModule_SetFlag(module, SeqAt(flags, i), &protocol_specified);
+    }
+    SeqDestroy(flags);
+
+    if (module->max_outstanding == 0)
+    {
+        module->max_outstanding = 1;
+    }
+    module->replies = SeqNew(2, &JsonDestroy);
+
+    return module;
+}
+
 static PromiseModule *PromiseModule_Start(char *interpreter, char *path)
 {
     assert(path != NULL);
@@ -472,7 +746,21 @@ static PromiseModule *PromiseModule_Start(char *interpreter, char *path)
         return NULL;
     }
 
+    struct stat module_stat;
+    const time_t module_mtime =
+        (stat(path, &module_stat) == 0) ? module_stat.st_mtime : 0;
+
+    /* A resident instance kept by cf-execd from a previous run saves the
+     * module (interpreter) startup cost. */
+    PromiseModule *resumed =
+        PromiseModule_Resume(interpreter, path, module_mtime);
+    if (resumed != NULL)
+    {
+        return resumed;
+    }
+
     PromiseModule *module = xcalloc(1, sizeof(PromiseModule));
+    module->module_mtime = module_mtime;
 
     module->interpreter = interpreter;
     module->path = path;
@@ -509,7 +797,10 @@ static PromiseModule *PromiseModule_Start(char *interpreter, char *path)
         return NULL;
     }
 
-    fprintf(module->input, "cf-agent %s v1\n\n", Version());
+    /* The request_ids flag tells the module it may declare request_ids /
+     * max_outstanding= in its own header; older agents omit it and modules
+     * must then stay with the v1 one-reply-per-request lockstep. */
+    fprintf(module->input, "cf-agent %s v1 request_ids\n\n", Version());
     fflush(module->input);
 
     Seq *header = PromiseModule_ReceiveHeader(module);
@@ -536,37 +827,24 @@ static PromiseModule *PromiseModule_Start(char *interpreter, char *path)
     assert(header_length > flags_offset); /* at least one flag required -- json_based/line_based */
     for (size_t i = flags_offset; i < header_length; ++i)
     {
-        const char *const flag = SeqAt(header, i);
-        if (StringEqual(flag, "json_based"))
-        {
-            module->json = true;
-            if (protocol_specified)
-            {
-                Log(LOG_LEVEL_WARNING,
-                    "Ambiguous protocol specification from the custom promise module '%s'."
-                    " Please report this as a bug in the module",
-                    module->path);
-            }
-            protocol_specified = true;
-        }
-        else if (StringEqual(flag, "line_based"))
-        {
-            module->json = false;
-            if (protocol_specified)
-            {
-                Log(LOG_LEVEL_WARNING,
-                    "Ambiguous protocol specification from the custom promise module '%s'."
-                    " Please report this as a bug in the module",
-                    module->path);
-            }
-            protocol_specified = true;
-        }
-        else if (StringEqual(flag, "action_policy"))
-        {
-            module->action_policy = true;
-        }
+        PromiseModule_SetFlag(module, SeqAt(header, i), &protocol_specified);
     }
 
+    if (module->max_outstanding > 1 && !module->request_ids)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Custom promise module '%s' declared max_outstanding=%zu without"
+            " request_ids, ignoring. Please report this as a bug in the module",
+            module->path,
+            module->max_outstanding);
+        module->max_outstanding = 0;
+    }
+    if (module->max_outstanding == 0)
+    {
+        module->max_outstanding = 1;
+    }
+    module->replies = SeqNew(2, &JsonDestroy);
+
     if (!protocol_specified)
     {
         Log(LOG_LEVEL_WARNING,
@@ -624,10 +902,22 @@ static void PromiseModule_AppendAttribute(
     JsonObjectAppendElement(attributes, key, value);
 }
 
-static void PromiseModule_Send(PromiseModule *module)
+/**
+ * Send the composed request to the module.
+ *
+ * @return the request ID the reply must echo, or 0 for a v1 module
+ */
+static size_t PromiseModule_Send(PromiseModule *module)
 {
     assert(module != NULL);
 
+    size_t request_id = 0;
+    if (module->request_ids)
+    {
+        request_id = ++(module->next_request_id);
+        PromiseModule_AppendInteger(module, "request_id", request_id);
+    }
+
     if (module->json)
     {
         Writer *w = FileWriter(module->input);
@@ -636,7 +926,7 @@ static void PromiseModule_Send(PromiseModule *module)
         DESTROY_AND_NULL(JsonDestroy, module->message);
         fprintf(module->input, "\n\n");
         fflush(module->input);
-        return;
+        return request_id;
     }
 
     Seq *message = SeqNew(10, free);
@@ -673,6 +963,8 @@ static void PromiseModule_Send(PromiseModule *module)
     PromiseModule_SendMessage(module, message);
     SeqDestroy(message);
     DESTROY_AND_NULL(JsonDestroy, module->message);
+
+    return request_id;
 }
 
 static inline bool TryToGetContainerFromScalarRef(const EvalContext *ctx, const char *scalar, JsonElement **out)
@@ -940,11 +1232,12 @@ static bool PromiseModule_Validate(PromiseModule *module, const EvalContext *ctx
     PromiseModule_AppendInteger(module, "line_number", pp->offset.line);
     PromiseModule_AppendString(module, "filename", PromiseGetBundle(pp)->source_path);
     PromiseModule_AppendAllAttributes(module, ctx, pp);
-    PromiseModule_Send(module);
+    const size_t request_id = PromiseModule_Send(module);
 
     // Prints errors / log messages from module:
     uint16_t n_log_msgs[LOG_LEVEL_DEBUG + 1] = {0};
-    JsonElement *response = PromiseModule_Receive(module, pp, n_log_msgs);
+    JsonElement *response =
+        PromiseModule_ReceiveReply(module, pp, n_log_msgs, request_id);
 
     if (response == NULL)
     {
@@ -1001,14 +1294,15 @@ static PromiseResult PromiseModule_Evaluate(
     PromiseModule_AppendString(module, "filename", PromiseGetBundle(pp)->source_path);
 
     PromiseModule_AppendAllAttributes(module, ctx, pp);
-    PromiseModule_Send(module);
+    const size_t request_id = PromiseModule_Send(module);
 
     const char *action_policy = PromiseGetConstraintAsRval(pp, "action_policy", RVAL_TYPE_SCALAR);
     const bool dontdo = ((EVAL_MODE != EVAL_MODE_NORMAL) ||
                          StringEqual(action_policy, "warn") || StringEqual(action_policy, "nop"));
 
     uint16_t n_log_msgs[LOG_LEVEL_DEBUG + 1] = {0};
-    JsonElement *response = PromiseModule_Receive(module, pp, n_log_msgs);
+    JsonElement *response =
+        PromiseModule_ReceiveReply(module, pp, n_log_msgs, request_id);
     if (response == NULL)
     {
         // Log from PromiseModule_Receive
@@ -1176,15 +1470,68 @@ static PromiseResult PromiseModule_Evaluate(
     return result;
 }
 
+/**
+ * Try to hand a resident module over to the cf-execd pool instead of
+ * terminating it. On success the module process keeps running with cf-execd
+ * holding its pipe ends until the next agent run.
+ */
+static bool PromiseModule_TryHandOff(PromiseModule *module)
+{
+    assert(module != NULL);
+
+    if (!module->resident)
+    {
+        return false;
+    }
+
+    fflush(module->input);
+
+    PooledModule pooled = {
+        .pid = module->pid,
+        .process_start_time = module->process_start_time,
+        .module_mtime = module->module_mtime,
+        .output_fd = fileno(module->output),
+        .input_fd = fileno(module->input),
+    };
+
+    int len = snprintf(pooled.flags, sizeof(pooled.flags), "%s%s%s,resident",
+                       module->json ? "json_based" : "line_based",
+                       module->action_policy ? ",action_policy" : "",
+                       module->request_ids ? ",request_ids" : "");
+    if ((len > 0) && ((size_t) len < sizeof(pooled.flags)) &&
+        (module->max_outstanding > 1))
+    {
+        snprintf(pooled.flags + len, sizeof(pooled.flags) - len,
+                 ",max_outstanding=%zu", module->max_outstanding);
+    }
+
+    if (!ModulePoolDeposit(module->path, &pooled))
+    {
+        /* No pool available (e.g. cf-execd not running), terminate as
+         * usual. */
+        return false;
+    }
+
+    module->handed_off = true;
+    return true;
+}
+
 static void PromiseModule_Terminate(PromiseModule *module, const Promise *pp)
 {
     if (module != NULL)
     {
+        if (PromiseModule_TryHandOff(module))
+        {
+            PromiseModule_DestroyInternal(module);
+            return;
+        }
+
         PromiseModule_AppendString(module, "operation", "terminate");
-        PromiseModule_Send(module);
+        const size_t request_id = PromiseModule_Send(module);
 
         uint16_t n_log_msgs[LOG_LEVEL_DEBUG + 1] = {0};
-        JsonElement *response = PromiseModule_Receive(module, pp, n_log_msgs);
+        JsonElement *response =
+            PromiseModule_ReceiveReply(module, pp, n_log_msgs, request_id);
         JsonDestroy(response);
 
         PromiseModule_DestroyInternal(module);
@@ -54,6 +54,14 @@ typedef struct PromiseModule
     char *interpreter;
     bool json;
     bool action_policy;
+    bool resident;          /* module may stay alive between agent runs */
+    bool pooled;            /* streams withdrawn from the cf-execd pool */
+    bool handed_off;        /* module deposited back, do not terminate */
+    time_t module_mtime;    /* st_mtime of the module file when started */
+    bool request_ids;       /* module echoes request_id in every reply (v2) */
+    size_t max_outstanding; /* module-declared concurrent request limit */
+    size_t next_request_id; /* ID assigned to the next request sent */
+    Seq *replies;           /* replies stashed for other outstanding IDs */
     JsonElement *message;
 } PromiseModule;
 
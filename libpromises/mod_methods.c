@@ -36,6 +36,7 @@ static const char *const POLICY_ERROR_METHODS_BUNDLE_ARITY =
 
 static const ConstraintSyntax CF_METHOD_BODIES[] =
 {
+    ConstraintSyntaxNewBool("cache_method", "If true, repeated invocations of this bundle with identical arguments within one run reuse the first invocation's outcome instead of re-evaluating", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("inherit", "If true this causes the sub-bundle to inherit the private classes of its parent", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBundle("usebundle", "Specify the name of a bundle to run as a parameterized method", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("useresult", CF_IDRANGE, "Specify the name of a local variable to contain any result/return value from the child", SYNTAX_STATUS_NORMAL),
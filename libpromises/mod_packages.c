@@ -70,6 +70,7 @@ static const ConstraintSyntax package_module_constraints[] =
 {
     ConstraintSyntaxNewInt("query_installed_ifelapsed", CF_INTRANGE, "The ifelapsed locking time in between updates of the installed package list", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewInt("query_updates_ifelapsed", CF_INTRANGE, "The ifelapsed locking time in between updates of the available updates list", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewStringList("query_installed_state_files", "", "Package manager state files (e.g. /var/lib/dpkg/status); while they are unchanged the cached installed package list is reused without querying the module", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewStringList("default_options", "", "Default options passed to package manager wrapper", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("interpreter", "", "Path to the interpreter to run the package manager wrapper with", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("module_path", "", "Non-standard path to the package manager wrapper", SYNTAX_STATUS_NORMAL),
@@ -0,0 +1,527 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <module_pool.h>
+
+#include <passopenfile.h>                   /* PassOpenFile_Put/_Get */
+#include <files_lib.h>                      /* MakeParentDirectoryPerms */
+#include <file_lib.h>                       /* safe_chmod */
+#include <known_dirs.h>                     /* GetStateDir */
+#include <process_lib.h>                    /* GracefulTerminate */
+#include <string_lib.h>
+#include <sequence.h>
+#include <logging.h>
+#include <alloc.h>
+
+#ifndef __MINGW32__
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MODULE_POOL_SOCKET_NAME "module-pool.socket"
+#define MODULE_POOL_TIMEOUT_SECONDS 5
+#define MODULE_POOL_MAX_ENTRIES 16
+
+/* One transaction per connection, both sent as a plain request line first:
+ *
+ *   "GET <path>"  agent withdraws a module; cf-execd replies either
+ *                 "NONE" or "OK <pid> <start_time> <mtime> <flags>"
+ *                 followed by the two descriptors (output, then input)
+ *                 passed with the passopenfile helpers.
+ *
+ *   "PUT"         agent deposits a module; the metadata line
+ *                 "<pid> <start_time> <mtime> <flags> <path>" rides
+ *                 along with the first (output) descriptor, the second
+ *                 message carries the input descriptor. cf-execd
+ *                 replies "OK" once the module is pooled.
+ */
+
+static bool ModulePoolSocketPath(char *buf, size_t size)
+{
+    int ret = snprintf(buf, size, "%s/cf-execd.sockets/" MODULE_POOL_SOCKET_NAME,
+                       GetStateDir());
+    return ((ret > 0) && ((size_t) ret < size));
+}
+
+static void ModulePoolSetTimeouts(int sock)
+{
+    struct timeval tv = { MODULE_POOL_TIMEOUT_SECONDS, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static bool ModulePoolWriteLine(int sock, const char *line)
+{
+    size_t length = strlen(line);
+    ssize_t ret = write(sock, line, length);
+    return (ret == (ssize_t) length);
+}
+
+/**
+ * Read one '\n'-terminated line byte by byte, so that the stream
+ * position afterwards is exactly the start of any following
+ * passopenfile message (same approach as ExecBrokerPclose()).
+ */
+static bool ModulePoolReadLine(int sock, char *buf, size_t size)
+{
+    size_t len = 0;
+    while (len < size - 1)
+    {
+        ssize_t got = read(sock, buf + len, 1);
+        if (got != 1)
+        {
+            return false;
+        }
+        if (buf[len] == '\n')
+        {
+            break;
+        }
+        len++;
+    }
+    buf[len] = '\0';
+    return true;
+}
+
+/*****************************************************************************/
+/* Agent side                                                                */
+/*****************************************************************************/
+
+static int ModulePoolConnect(void)
+{
+    struct sockaddr_un sock_info;
+    memset(&sock_info, 0, sizeof(sock_info));
+    sock_info.sun_family = AF_LOCAL;
+    if (!ModulePoolSocketPath(sock_info.sun_path, sizeof(sock_info.sun_path)))
+    {
+        return -1;
+    }
+
+    int sock = socket(AF_LOCAL, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    if (connect(sock, (const struct sockaddr *) &sock_info, sizeof(sock_info)) == -1)
+    {
+        /* Normal when cf-execd is not running or predates the pool. */
+        Log(LOG_LEVEL_DEBUG, "No module pool socket available (connect: %s)",
+            GetErrorStr());
+        close(sock);
+        return -1;
+    }
+    ModulePoolSetTimeouts(sock);
+    return sock;
+}
+
+bool ModulePoolWithdraw(const char *path, PooledModule *pooled_out)
+{
+    assert(path != NULL);
+    assert(pooled_out != NULL);
+
+    int sock = ModulePoolConnect();
+    if (sock < 0)
+    {
+        return false;
+    }
+
+    char *request = StringFormat("GET %s\n", path);
+    bool sent = ModulePoolWriteLine(sock, request);
+    free(request);
+
+    char reply[CF_BUFSIZE];
+    if (!sent || !ModulePoolReadLine(sock, reply, sizeof(reply)))
+    {
+        close(sock);
+        return false;
+    }
+
+    intmax_t pid, start_time, mtime;
+    if (sscanf(reply, "OK %jd %jd %jd %127s",
+               &pid, &start_time, &mtime, pooled_out->flags) != 4)
+    {
+        /* "NONE" (or garbage) -- no pooled instance. */
+        close(sock);
+        return false;
+    }
+
+    pooled_out->pid = (pid_t) pid;
+    pooled_out->process_start_time = (time_t) start_time;
+    pooled_out->module_mtime = (time_t) mtime;
+    pooled_out->output_fd = PassOpenFile_Get(sock, NULL);
+    pooled_out->input_fd = PassOpenFile_Get(sock, NULL);
+    close(sock);
+
+    if ((pooled_out->output_fd < 0) || (pooled_out->input_fd < 0))
+    {
+        Log(LOG_LEVEL_ERR,
+            "Failed to receive descriptors of pooled module '%s'", path);
+        if (pooled_out->output_fd >= 0)
+        {
+            close(pooled_out->output_fd);
+        }
+        if (pooled_out->input_fd >= 0)
+        {
+            close(pooled_out->input_fd);
+        }
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Withdrew resident module '%s' (PID %jd) from cf-execd pool",
+        path, pid);
+    return true;
+}
+
+bool ModulePoolDeposit(const char *path, const PooledModule *pooled)
+{
+    assert(path != NULL);
+    assert(pooled != NULL);
+
+    int sock = ModulePoolConnect();
+    if (sock < 0)
+    {
+        return false;
+    }
+
+    char *metadata = StringFormat("%jd %jd %jd %s %s",
+                                  (intmax_t) pooled->pid,
+                                  (intmax_t) pooled->process_start_time,
+                                  (intmax_t) pooled->module_mtime,
+                                  pooled->flags, path);
+    bool sent = (ModulePoolWriteLine(sock, "PUT\n") &&
+                 PassOpenFile_Put(sock, pooled->output_fd, metadata) &&
+                 PassOpenFile_Put(sock, pooled->input_fd, NULL));
+    free(metadata);
+
+    char reply[CF_SMALLBUF];
+    bool accepted = (sent &&
+                     ModulePoolReadLine(sock, reply, sizeof(reply)) &&
+                     StringEqual(reply, "OK"));
+    close(sock);
+
+    if (accepted)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Deposited resident module '%s' (PID %jd) in cf-execd pool",
+            path, (intmax_t) pooled->pid);
+    }
+    return accepted;
+}
+
+/*****************************************************************************/
+/* cf-execd side                                                             */
+/*****************************************************************************/
+
+typedef struct
+{
+    char *path;
+    char *flags;
+    pid_t pid;
+    time_t process_start_time;
+    time_t module_mtime;
+    int output_fd;
+    int input_fd;
+} PoolEntry;
+
+/* Closing the descriptors EOFs the module's stdin, which per the module
+ * protocol makes it exit. */
+static void PoolEntryDestroy(void *entry_)
+{
+    PoolEntry *entry = entry_;
+    if (entry != NULL)
+    {
+        close(entry->output_fd);
+        close(entry->input_fd);
+        free(entry->path);
+        free(entry->flags);
+        free(entry);
+    }
+}
+
+static Seq *pool = NULL; /* GLOBAL_X, main cf-execd process only */
+
+static PoolEntry *PoolLookup(const char *path, size_t *index_out)
+{
+    const size_t length = SeqLength(pool);
+    for (size_t i = 0; i < length; i++)
+    {
+        PoolEntry *entry = SeqAt(pool, i);
+        if (StringEqual(entry->path, path))
+        {
+            if (index_out != NULL)
+            {
+                *index_out = i;
+            }
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int ModulePoolSetupSocket(void)
+{
+    struct sockaddr_un sock_info;
+    memset(&sock_info, 0, sizeof(sock_info));
+    sock_info.sun_family = AF_LOCAL;
+    if (!ModulePoolSocketPath(sock_info.sun_path, sizeof(sock_info.sun_path)))
+    {
+        Log(LOG_LEVEL_ERR, "State directory path too long for module pool socket");
+        return -1;
+    }
+
+    MakeParentDirectoryPerms(sock_info.sun_path, true, NULL, (mode_t) 0700);
+
+    /* Remove potential left-overs from old processes. */
+    unlink(sock_info.sun_path);
+
+    int pool_socket = socket(AF_LOCAL, SOCK_STREAM, 0);
+    if (pool_socket < 0)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to create module pool socket: %s",
+            GetErrorStr());
+        return -1;
+    }
+    if (bind(pool_socket, (const struct sockaddr *) &sock_info,
+             sizeof(sock_info)) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to bind the module pool socket: %s",
+            GetErrorStr());
+        close(pool_socket);
+        return -1;
+    }
+    safe_chmod(sock_info.sun_path, (mode_t) 0600);
+    if (listen(pool_socket, 5) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to listen on module pool socket: %s",
+            GetErrorStr());
+        close(pool_socket);
+        return -1;
+    }
+
+    pool = SeqNew(MODULE_POOL_MAX_ENTRIES, PoolEntryDestroy);
+    return pool_socket;
+}
+
+static void HandleDeposit(int data_socket)
+{
+    char *metadata = NULL;
+    int output_fd = PassOpenFile_Get(data_socket, &metadata);
+    if ((output_fd < 0) || (metadata == NULL))
+    {
+        free(metadata);
+        if (output_fd >= 0)
+        {
+            close(output_fd);
+        }
+        return;
+    }
+    int input_fd = PassOpenFile_Get(data_socket, NULL);
+    if (input_fd < 0)
+    {
+        free(metadata);
+        close(output_fd);
+        return;
+    }
+
+    intmax_t pid, start_time, mtime;
+    char flags[CF_SMALLBUF];
+    char path[CF_BUFSIZE];
+    if (sscanf(metadata, "%jd %jd %jd %127s %4095[^\n]",
+               &pid, &start_time, &mtime, flags, path) != 5)
+    {
+        Log(LOG_LEVEL_ERR, "Malformed module pool deposit: '%s'", metadata);
+        free(metadata);
+        close(output_fd);
+        close(input_fd);
+        return;
+    }
+    free(metadata);
+
+    /* A newer instance replaces any stale pooled one. */
+    size_t index;
+    if (PoolLookup(path, &index) != NULL)
+    {
+        SeqRemove(pool, index);
+    }
+    else if (SeqLength(pool) >= MODULE_POOL_MAX_ENTRIES)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Module pool full, not keeping module '%s' resident", path);
+        close(output_fd);
+        close(input_fd);
+        return;
+    }
+
+    PoolEntry *entry = xcalloc(1, sizeof(PoolEntry));
+    entry->path = xstrdup(path);
+    entry->flags = xstrdup(flags);
+    entry->pid = (pid_t) pid;
+    entry->process_start_time = (time_t) start_time;
+    entry->module_mtime = (time_t) mtime;
+    entry->output_fd = output_fd;
+    entry->input_fd = input_fd;
+    SeqAppend(pool, entry);
+
+    Log(LOG_LEVEL_VERBOSE, "Holding resident module '%s' (PID %jd)",
+        path, pid);
+    ModulePoolWriteLine(data_socket, "OK\n");
+}
+
+static void HandleWithdraw(int data_socket, const char *path)
+{
+    size_t index;
+    PoolEntry *entry = PoolLookup(path, &index);
+    if (entry == NULL)
+    {
+        ModulePoolWriteLine(data_socket, "NONE\n");
+        return;
+    }
+
+    char *reply = StringFormat("OK %jd %jd %jd %s\n",
+                               (intmax_t) entry->pid,
+                               (intmax_t) entry->process_start_time,
+                               (intmax_t) entry->module_mtime,
+                               entry->flags);
+    bool sent = (ModulePoolWriteLine(data_socket, reply) &&
+                 PassOpenFile_Put(data_socket, entry->output_fd, NULL) &&
+                 PassOpenFile_Put(data_socket, entry->input_fd, NULL));
+    free(reply);
+
+    if (sent)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Handed resident module '%s' (PID %jd) to agent",
+            path, (intmax_t) entry->pid);
+    }
+    /* Either way this entry is spent: on success the agent owns the
+     * module now, on failure the transfer state is unknown, so drop our
+     * ends and let the module exit. */
+    SeqRemove(pool, index);
+}
+
+void ModulePoolHandleRequest(int data_socket)
+{
+    assert(pool != NULL);
+
+    ModulePoolSetTimeouts(data_socket);
+
+    char request[CF_BUFSIZE];
+    if (!ModulePoolReadLine(data_socket, request, sizeof(request)))
+    {
+        return;
+    }
+
+    if (StringEqual(request, "PUT"))
+    {
+        HandleDeposit(data_socket);
+    }
+    else if (StringStartsWith(request, "GET "))
+    {
+        HandleWithdraw(data_socket, request + strlen("GET "));
+    }
+    else
+    {
+        Log(LOG_LEVEL_ERR, "Malformed module pool request: '%s'", request);
+    }
+}
+
+void ModulePoolMaintain(void)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = SeqLength(pool); i > 0; i--)
+    {
+        PoolEntry *entry = SeqAt(pool, i - 1);
+        if ((kill(entry->pid, 0) == -1) && (errno == ESRCH))
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Pooled module '%s' (PID %jd) has died, dropping it",
+                entry->path, (intmax_t) entry->pid);
+            SeqRemove(pool, i - 1);
+        }
+    }
+}
+
+void ModulePoolShutdown(void)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    const size_t length = SeqLength(pool);
+    for (size_t i = 0; i < length; i++)
+    {
+        const PoolEntry *entry = SeqAt(pool, i);
+        if (!GracefulTerminate(entry->pid, entry->process_start_time))
+        {
+            Log(LOG_LEVEL_ERR, "Failed to terminate pooled module '%s'",
+                entry->path);
+        }
+    }
+    DESTROY_AND_NULL(SeqDestroy, pool);
+
+    char sock_path[sizeof(((struct sockaddr_un *) NULL)->sun_path)];
+    if (ModulePoolSocketPath(sock_path, sizeof(sock_path)))
+    {
+        unlink(sock_path);
+    }
+}
+
+#else  /* __MINGW32__ */
+
+/* No descriptor passing on Windows: modules are spawned per run. */
+
+bool ModulePoolWithdraw(ARG_UNUSED const char *path,
+                        ARG_UNUSED PooledModule *pooled_out)
+{
+    return false;
+}
+
+bool ModulePoolDeposit(ARG_UNUSED const char *path,
+                       ARG_UNUSED const PooledModule *pooled)
+{
+    return false;
+}
+
+int ModulePoolSetupSocket(void)
+{
+    return -1;
+}
+
+void ModulePoolHandleRequest(ARG_UNUSED int data_socket)
+{
+}
+
+void ModulePoolMaintain(void)
+{
+}
+
+void ModulePoolShutdown(void)
+{
+}
+
+#endif  /* __MINGW32__ */
@@ -0,0 +1,106 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_MODULE_POOL_H
+#define CFENGINE_MODULE_POOL_H
+
+#include <cf3.defs.h>
+
+/**
+ * @file module_pool.h
+ *
+ * Keeping custom promise module processes resident between agent runs.
+ *
+ * Starting a module (often a Python interpreter) costs hundreds of
+ * milliseconds, paid on every scheduled agent run. A module that
+ * declares the 'resident' flag in its protocol header can instead be
+ * handed over to cf-execd when the agent exits: the agent passes the
+ * module's pipe descriptors over a Unix domain socket (using the
+ * passopenfile helpers, as in exec_broker.c) and cf-execd holds them
+ * until the next agent run withdraws the module again. The module
+ * itself needs no changes beyond the flag -- its stdin/stdout pipes
+ * simply stay open across the handoff.
+ *
+ * cf-execd drops pooled modules whose process has died, and the agent
+ * refuses (and restarts) a withdrawn module whose executable changed
+ * since it was started. When cf-execd is not running or the socket is
+ * unavailable, modules are spawned and terminated per run as before.
+ */
+
+/**
+ * Everything the next agent run needs to resume talking to a pooled
+ * module without redoing the protocol handshake.
+ */
+typedef struct
+{
+    pid_t pid;
+    time_t process_start_time;
+    time_t module_mtime;          /* st_mtime of the module when started */
+    int output_fd;                   /* agent reads module replies here */
+    int input_fd;                    /* agent writes requests here */
+    char flags[CF_SMALLBUF];  /* comma-separated header flags of module */
+} PooledModule;
+
+/* Agent side (mod_custom.c): */
+
+/**
+ * Ask cf-execd for a resident instance of the module at #path.
+ *
+ * @return true and fill #pooled_out (caller owns the descriptors) on a
+ *         pool hit, false when there is none (or no pool at all)
+ */
+bool ModulePoolWithdraw(const char *path, PooledModule *pooled_out);
+
+/**
+ * Hand the running module over to cf-execd for the next run. On success
+ * the pool owns (duplicates of) the descriptors; the caller must still
+ * close its own copies but must not terminate the module process.
+ */
+bool ModulePoolDeposit(const char *path, const PooledModule *pooled);
+
+/* cf-execd side: */
+
+/**
+ * Create the listening pool socket, or -1 on failure (callers carry on
+ * without a pool).
+ */
+int ModulePoolSetupSocket(void);
+
+/**
+ * Serve one accepted deposit/withdraw connection (in the main process,
+ * which must hold the pooled descriptors).
+ */
+void ModulePoolHandleRequest(int data_socket);
+
+/**
+ * Heartbeat: drop pooled modules whose process has died.
+ */
+void ModulePoolMaintain(void);
+
+/**
+ * Terminate all pooled modules and remove the pool socket.
+ */
+void ModulePoolShutdown(void);
+
+#endif
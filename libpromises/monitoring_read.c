@@ -25,8 +25,14 @@
 
 #include <monitoring_read.h>
 
+#include <averages_pack.h>       /* AveragesPackValues,AveragesUnpackValues */
 #include <file_lib.h>                                     /* FILE_SEPARATOR */
 #include <known_dirs.h>
+#include <map.h>                                                     /* Map */
+#include <string_lib.h>                    /* StringHash,StringEqual */
+
+/* An Averages record viewed as the flat array of doubles it stores. */
+#define AVERAGES_N_DOUBLES (CF_OBSERVABLES * (sizeof(QPoint) / sizeof(double)))
 
 
 /* GLOBALS */
@@ -103,9 +109,43 @@ static const char *UNITS[CF_OBSERVABLES] =                      /* constant */
 time_t slots_load_time = 0;
 MonitoringSlot *SLOTS[CF_OBSERVABLES - ob_spare];
 
+/* Lazily built index over SLOTS: observable name -> array index + 1 (so 0
+ * still means "not in the map").  Registering hundreds of custom
+ * measurements otherwise rescans the whole slot array per registration,
+ * every sample pass.  Values are encoded integers, nothing owned. */
+static Map *slot_index = NULL;                                  /* GLOBAL_X */
+
 
 /*****************************************************************************/
 
+void Nova_InvalidateSlotIndex(void)
+{
+    MapDestroy(slot_index);
+    slot_index = NULL;
+}
+
+int Nova_FindSlotByName(const char *name)
+{
+    Nova_LoadSlots();
+
+    if (slot_index == NULL)
+    {
+        slot_index = MapNew(StringHash_untyped, StringEqual_untyped,
+                            free, NULL);
+        for (int i = 0; i < CF_OBSERVABLES - ob_spare; i++)
+        {
+            if (SLOTS[i] != NULL)
+            {
+                MapInsert(slot_index, xstrdup(SLOTS[i]->name),
+                          (void *) (uintptr_t) (i + 1));
+            }
+        }
+    }
+
+    const uintptr_t idx = (uintptr_t) MapGet(slot_index, name);
+    return (int) idx - 1;
+}
+
 void Nova_FreeSlot(MonitoringSlot *slot)
 {
     if (slot)
@@ -161,6 +201,9 @@ void Nova_LoadSlots(void)
 
     slots_load_time = sb.st_mtime;
 
+    /* The name index is rebuilt from the reloaded slots on next lookup. */
+    Nova_InvalidateSlotIndex();
+
     for (i = 0; i < CF_OBSERVABLES; ++i)
     {
         if (i < ob_spare)
@@ -324,6 +367,46 @@ bool GetRecordForTime(CF_DB *db, time_t time, Averages *result)
 
     MakeTimekey(time, timekey);
 
-    return ReadDB(db, timekey, result, sizeof(Averages));
+    const int size = ValueSizeDB(db, timekey, strlen(timekey) + 1);
+    if (size <= 0)
+    {
+        return false;
+    }
+
+    if ((size_t) size == sizeof(Averages))
+    {
+        /* Record predating the packed format, stored as the raw struct. */
+        return ReadDB(db, timekey, result, sizeof(Averages));
+    }
+
+    unsigned char packed[AVERAGES_PACK_MAX(AVERAGES_N_DOUBLES)];
+    if ((size_t) size > sizeof(packed) ||
+        !ReadDB(db, timekey, packed, size))
+    {
+        return false;
+    }
+
+    return AveragesUnpackValues(packed, size, &result->last_seen,
+                                (double *) result->Q, AVERAGES_N_DOUBLES);
+}
+
+void PutRecordForTime(CF_DB *db, time_t time, const Averages *values)
+{
+    char timekey[CF_MAXVARSIZE];
+    unsigned char packed[AVERAGES_PACK_MAX(AVERAGES_N_DOUBLES)];
+
+    MakeTimekey(time, timekey);
+
+    size_t size = AveragesPackValues(values->last_seen,
+                                     (const double *) values->Q,
+                                     AVERAGES_N_DOUBLES, packed);
+    if (size == sizeof(Averages))
+    {
+        /* Never collide with the size of a raw legacy record, which is how
+         * GetRecordForTime() tells the two formats apart. */
+        packed[size++] = 0;
+    }
+
+    WriteDB(db, timekey, packed, size);
 }
 
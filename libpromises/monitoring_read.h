@@ -39,6 +39,15 @@ MonitoringSlot *Nova_MakeSlot(const char *name, const char *description,
                               double expected_minimum, double expected_maximum,
                               bool consolidable);
 void Nova_LoadSlots(void);
+
+/**
+ * Hashed lookup of an observable name in SLOTS.  Returns the array index
+ * (NOT offset by ob_spare) or -1 when no slot carries that name.  Callers
+ * mutating SLOTS directly must call Nova_InvalidateSlotIndex() afterwards.
+ */
+int Nova_FindSlotByName(const char *name);
+void Nova_InvalidateSlotIndex(void);
+
 bool NovaHasSlot(int idx);
 const char *NovaGetSlotName(int idx);
 const char *NovaGetSlotDescription(int index);
@@ -46,7 +55,12 @@ const char *NovaGetSlotUnits(int index);
 double NovaGetSlotExpectedMinimum(int index);
 double NovaGetSlotExpectedMaximum(int index);
 bool NovaIsSlotConsolidable(int index);
+/**
+ * History records are stored packed (cf-check/averages_pack.h); the reader
+ * transparently accepts raw Averages records written by older versions.
+ */
 bool GetRecordForTime(CF_DB *db, time_t time, Averages *result);
+void PutRecordForTime(CF_DB *db, time_t time, const Averages *values);
 
 
 /* - date-related functions - */
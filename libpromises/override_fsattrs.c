@@ -7,6 +7,199 @@
 #include <string_lib.h>
 #include <file_lib.h>
 #include <fsattrs.h>
+#include <set.h>
+#include <known_dirs.h>
+
+/* Batched immutable bit overrides.
+ *
+ * Clearing and restoring the immutable bit is two extra syscalls (plus a
+ * verbose log pair) per operation, and promises like copy_from with
+ * fsattrs override can touch the same file several times in one bundle
+ * (chmod, utime, rename). While a batch is open, cleared bits are left
+ * cleared and restored in one sweep by OverrideImmutableBatchEnd().
+ *
+ * To stay crash safe, every path is appended to a journal file and synced
+ * to disk *before* its bit is cleared. If the agent dies mid-batch, the
+ * next OverrideImmutableBatchBegin() replays the journal and restores the
+ * bits the interrupted run left cleared. */
+
+static int BATCH_DEPTH = 0; /* GLOBAL_X */
+static StringSet *BATCH_CLEARED = NULL; /* GLOBAL_X */
+static FILE *BATCH_JOURNAL = NULL; /* GLOBAL_X */
+
+static char *ImmutableBatchJournalPath(void)
+{
+    return StringFormat(
+        "%s%cimmutable_restore.journal", GetStateDir(), FILE_SEPARATOR);
+}
+
+/* Restore immutable bits recorded by a run that died mid-batch */
+static void ImmutableBatchRecover(const char *journal_path)
+{
+    FILE *file = safe_fopen(journal_path, "r");
+    if (file == NULL)
+    {
+        /* The normal case: the previous run finished its batch */
+        return;
+    }
+
+    Log(LOG_LEVEL_NOTICE,
+        "Found immutable bit restore journal '%s' from an interrupted run: "
+        "replaying it",
+        journal_path);
+
+    char line[PATH_MAX + 2];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n')
+        {
+            line[len - 1] = '\0';
+        }
+        if (line[0] == '\0')
+        {
+            continue;
+        }
+
+        FSAttrsResult res = FSAttrsUpdateImmutableFlag(line, true);
+        if (res == FS_ATTRS_SUCCESS)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Restored immutable bit for file '%s' from journal",
+                line);
+        }
+        else
+        {
+            /* E.g. the interrupted run deleted or renamed the file */
+            Log(LOG_LEVEL_VERBOSE,
+                "Could not restore immutable bit for file '%s' from journal: %s",
+                line,
+                FSAttrsErrorCodeToString(res));
+        }
+    }
+
+    fclose(file);
+    unlink(journal_path);
+}
+
+void OverrideImmutableBatchBegin(void)
+{
+    if (BATCH_DEPTH++ > 0)
+    {
+        /* Nested bundle (e.g. through methods): the outermost batch owns
+         * the journal */
+        return;
+    }
+
+    char *journal_path = ImmutableBatchJournalPath();
+    ImmutableBatchRecover(journal_path);
+
+    BATCH_JOURNAL = safe_fopen_create_perms(journal_path, "w", 0600);
+    if (BATCH_JOURNAL == NULL)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Failed to open immutable bit restore journal '%s' (fopen: %s): "
+            "immutable bit overrides will not be batched",
+            journal_path,
+            GetErrorStr());
+        free(journal_path);
+        return;
+    }
+
+    BATCH_CLEARED = StringSetNew();
+    free(journal_path);
+}
+
+/* Record that the immutable bit of filename is about to be left cleared
+ * until the end of the batch. Returns true when the restore is deferred. */
+static bool ImmutableBatchDefer(const char *filename)
+{
+    if (BATCH_JOURNAL == NULL)
+    {
+        return false;
+    }
+
+    if (StringSetContains(BATCH_CLEARED, filename))
+    {
+        return true;
+    }
+
+    /* The journal entry must be durable before the bit is cleared, so
+     * that an interrupted run can always restore what it changed */
+    if (fprintf(BATCH_JOURNAL, "%s\n", filename) < 0 ||
+        fflush(BATCH_JOURNAL) != 0 || fsync(fileno(BATCH_JOURNAL)) == -1)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Failed to journal immutable bit override of file '%s' (%s): "
+            "not deferring the restore",
+            filename,
+            GetErrorStr());
+        return false;
+    }
+
+    StringSetAdd(BATCH_CLEARED, xstrdup(filename));
+    return true;
+}
+
+/* Whether the restore of filename's immutable bit is deferred to
+ * OverrideImmutableBatchEnd() */
+static bool ImmutableBatchDeferred(const char *filename)
+{
+    return (BATCH_JOURNAL != NULL) && StringSetContains(BATCH_CLEARED, filename);
+}
+
+void OverrideImmutableBatchEnd(void)
+{
+    assert(BATCH_DEPTH > 0);
+    if (--BATCH_DEPTH > 0)
+    {
+        return;
+    }
+
+    if (BATCH_JOURNAL == NULL)
+    {
+        /* The batch never got a journal, nothing was deferred */
+        return;
+    }
+
+    size_t restored = 0;
+    StringSetIterator iter = StringSetIteratorInit(BATCH_CLEARED);
+    const char *filename;
+    while ((filename = StringSetIteratorNext(&iter)) != NULL)
+    {
+        FSAttrsResult res = FSAttrsUpdateImmutableFlag(filename, true);
+        if (res == FS_ATTRS_SUCCESS)
+        {
+            restored++;
+        }
+        else
+        {
+            /* E.g. the file was deleted or renamed away in the meantime */
+            Log(LOG_LEVEL_VERBOSE,
+                "Could not restore immutable bit for file '%s' at the end "
+                "of the batch: %s",
+                filename,
+                FSAttrsErrorCodeToString(res));
+        }
+    }
+
+    if (restored > 0)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Restored immutable bit for %zu file(s) at the end of the batch",
+            restored);
+    }
+
+    fclose(BATCH_JOURNAL);
+    BATCH_JOURNAL = NULL;
+
+    char *journal_path = ImmutableBatchJournalPath();
+    unlink(journal_path);
+    free(journal_path);
+
+    StringSetDestroy(BATCH_CLEARED);
+    BATCH_CLEARED = NULL;
+}
 
 bool OverrideImmutableBegin(
     const char *orig, char *copy, size_t copy_len, bool override)
@@ -104,6 +297,10 @@ FSAttrsResult TemporarilyClearImmutableBit(
     {
         if (*was_immutable)
         {
+            /* Journal the path first so an interrupted batch can be
+             * replayed; see OverrideImmutableBatchBegin() */
+            ImmutableBatchDefer(filename);
+
             res = FSAttrsUpdateImmutableFlag(filename, false);
             if (res == FS_ATTRS_SUCCESS)
             {
@@ -157,6 +354,16 @@ void ResetTemporarilyClearedImmutableBit(
 
     if ((res == FS_ATTRS_SUCCESS) && was_immutable)
     {
+        if (ImmutableBatchDeferred(filename))
+        {
+            /* Restored in one sweep by OverrideImmutableBatchEnd() */
+            Log(LOG_LEVEL_DEBUG,
+                "Deferring restore of immutable bit for file '%s' to the "
+                "end of the batch",
+                filename);
+            return;
+        }
+
         res = FSAttrsUpdateImmutableFlag(filename, true);
         if (res == FS_ATTRS_SUCCESS)
         {
@@ -137,4 +137,23 @@ void ResetTemporarilyClearedImmutableBit(
     FSAttrsResult res,
     bool was_immutable);
 
+/**
+ * @brief Open a batch of immutable bit overrides. Until the matching call
+ * to OverrideImmutableBatchEnd(), immutable bits cleared by the override
+ * functions above are left cleared instead of being restored after each
+ * individual operation. Every cleared path is journaled to disk before the
+ * bit is cleared; a journal left behind by an interrupted run is replayed
+ * here (restoring the bits) before the new batch starts.
+ * @note Calls nest (e.g. through methods bundles); only the outermost
+ * batch restores the bits
+ */
+void OverrideImmutableBatchBegin(void);
+
+/**
+ * @brief Close a batch of immutable bit overrides by restoring the
+ * immutable bit on every file the batch cleared it from, then removing the
+ * journal. Files deleted or renamed during the batch are skipped.
+ */
+void OverrideImmutableBatchEnd(void);
+
 #endif /* CFENGINE_OVERRIDE_FSATTRS_H */
@@ -59,11 +59,14 @@ bool PipeTypeIsOk(const char *type)
 /* Pipe read/write interface, originally in package modules        */
 /*******************************************************************/
 
+/* Size of the chunk buffer used when draining pipe output.  Package modules
+ * send megabytes when listing installed packages, so read in large chunks to
+ * keep the number of select()+read() round trips small. */
+#define PIPE_READ_CHUNK_SIZE (64 * 1024)
+
 Rlist *PipeReadData(const IOData *io, int pipe_timeout_secs, int pipe_termination_check_secs)
 {
-    char buff[CF_BUFSIZE] = {0};
-
-    Buffer *data = BufferNew();
+    Buffer *data = BufferNewWithCapacity(PIPE_READ_CHUNK_SIZE);
     if (!data)
     {
         Log(LOG_LEVEL_VERBOSE,
@@ -71,6 +74,8 @@ Rlist *PipeReadData(const IOData *io, int pipe_timeout_secs, int pipe_terminatio
         return NULL;
     }
 
+    char *buff = xmalloc(PIPE_READ_CHUNK_SIZE);
+
     int timeout_seconds_left = pipe_timeout_secs;
 
     while (!IsPendingTermination() && timeout_seconds_left > 0)
@@ -85,7 +90,7 @@ Rlist *PipeReadData(const IOData *io, int pipe_timeout_secs, int pipe_terminatio
         }
         else if (fd == io->read_fd)
         {
-            ssize_t res = read(fd, buff, sizeof(buff) - 1);
+            ssize_t res = read(fd, buff, PIPE_READ_CHUNK_SIZE);
             if (res == -1)
             {
                 if (errno == EINTR)
@@ -97,6 +102,7 @@ Rlist *PipeReadData(const IOData *io, int pipe_timeout_secs, int pipe_terminatio
                     Log(LOG_LEVEL_ERR,
                         "Unable to read output from application pipe: %s",
                         GetErrorStr());
+                    free(buff);
                     BufferDestroy(data);
                     return NULL;
                 }
@@ -105,11 +111,9 @@ Rlist *PipeReadData(const IOData *io, int pipe_timeout_secs, int pipe_terminatio
             {
                 break;
             }
-            Log(LOG_LEVEL_DEBUG, "Data read from application pipe: %zd [%s]",
-                res, buff);
+            Log(LOG_LEVEL_DEBUG, "Read %zd bytes from application pipe", res);
 
-            BufferAppendString(data, buff);
-            memset(buff, 0, sizeof(buff));
+            BufferAppend(data, buff, res);
         }
         else if (fd == 0) /* timeout */
         {
@@ -118,6 +122,8 @@ Rlist *PipeReadData(const IOData *io, int pipe_timeout_secs, int pipe_terminatio
         }
     }
 
+    free(buff);
+
     char *read_string = BufferClose(data);
 
 #ifdef __MINGW32__
@@ -25,6 +25,7 @@
 #include <policy.h>
 
 #include <syntax.h>
+#include <string_intern.h>
 #include <string_lib.h>
 #include <conversion.h>
 #include <mutex.h>
@@ -134,6 +135,7 @@ Policy *PolicyNew(void)
     policy->bodies = SeqNew(100, BodyDestroy);
     policy->custom_promise_types = SeqNew(20, BodyDestroy);
     policy->policy_files_hashes = NULL;
+    policy->dynamic_inputs = false;
 
     return policy;
 }
@@ -294,6 +296,146 @@ StringSet *PolicySourceFiles(const Policy *policy)
 
 /*************************************************************************/
 
+/* Append every string a policy element could use to name a bundle -- scalar
+ * rvals, function-call names and arguments, data containers -- to one big
+ * newline-separated buffer, so that reachability can be decided with a
+ * substring probe per bundle.  Treating every string as a potential
+ * reference deliberately over-approximates: a bundle is only pruned when
+ * its name appears nowhere at all. */
+static void CollectRvalStrings(Rval rval, Writer *w, bool *dynamic)
+{
+    switch (rval.type)
+    {
+    case RVAL_TYPE_SCALAR:
+        WriterWrite(w, RvalScalarValue(rval));
+        WriterWriteChar(w, '\n');
+        break;
+
+    case RVAL_TYPE_LIST:
+        for (const Rlist *rp = RvalRlistValue(rval); rp != NULL; rp = rp->next)
+        {
+            CollectRvalStrings(rp->val, w, dynamic);
+        }
+        break;
+
+    case RVAL_TYPE_FNCALL:
+        {
+            const FnCall *fp = RvalFnCallValue(rval);
+
+            /* bundlesmatching() constructs bundle names from tag regexes at
+             * run time, so no textual scan can tell what it will return. */
+            if (StringEqual(fp->name, "bundlesmatching"))
+            {
+                *dynamic = true;
+            }
+
+            WriterWrite(w, fp->name);
+            WriterWriteChar(w, '\n');
+            for (const Rlist *rp = fp->args; rp != NULL; rp = rp->next)
+            {
+                CollectRvalStrings(rp->val, w, dynamic);
+            }
+        }
+        break;
+
+    case RVAL_TYPE_CONTAINER:
+        JsonWriteCompact(w, RvalContainerValue(rval));
+        WriterWriteChar(w, '\n');
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * Remove bundles that nothing in the policy can possibly call, so that the
+ * pre-evaluation pass and the resident policy tree only cover the bundles
+ * this host actually uses.  Reachability is over-approximated by collecting
+ * every literal string in the policy (promisers, rvals, function names and
+ * arguments, body constraints -- which covers the bundlesequence) plus the
+ * command-line bundlesequence, and keeping every bundle whose name occurs
+ * in that text.  If the policy calls bundlesmatching(), bundle names are
+ * constructed at run time and nothing is pruned.
+ *
+ * @return the number of bundles removed
+ */
+size_t PolicyPruneUnreachableBundles(Policy *policy, const Rlist *cli_bundlesequence)
+{
+    bool dynamic = false;
+    Writer *w = StringWriter();
+
+    /* Default entry point when no bundlesequence is given anywhere. */
+    WriterWrite(w, "main\n");
+
+    for (const Rlist *rp = cli_bundlesequence; rp != NULL; rp = rp->next)
+    {
+        CollectRvalStrings(rp->val, w, &dynamic);
+    }
+
+    for (size_t i = 0; i < SeqLength(policy->bodies); i++)
+    {
+        const Body *bdp = SeqAt(policy->bodies, i);
+        for (size_t j = 0; j < SeqLength(bdp->conlist); j++)
+        {
+            const Constraint *cp = SeqAt(bdp->conlist, j);
+            CollectRvalStrings(cp->rval, w, &dynamic);
+        }
+    }
+
+    for (size_t i = 0; i < SeqLength(policy->bundles); i++)
+    {
+        const Bundle *bp = SeqAt(policy->bundles, i);
+        for (size_t j = 0; j < SeqLength(bp->sections); j++)
+        {
+            const BundleSection *section = SeqAt(bp->sections, j);
+            for (size_t k = 0; k < SeqLength(section->promises); k++)
+            {
+                const Promise *pp = SeqAt(section->promises, k);
+
+                WriterWrite(w, pp->promiser);
+                WriterWriteChar(w, '\n');
+                CollectRvalStrings(pp->promisee, w, &dynamic);
+
+                for (size_t l = 0; l < SeqLength(pp->conlist); l++)
+                {
+                    const Constraint *cp = SeqAt(pp->conlist, l);
+                    CollectRvalStrings(cp->rval, w, &dynamic);
+                }
+            }
+        }
+    }
+
+    size_t pruned = 0;
+
+    if (!dynamic)
+    {
+        const char *references = StringWriterData(w);
+
+        for (size_t i = SeqLength(policy->bundles); i > 0; i--)
+        {
+            const Bundle *bp = SeqAt(policy->bundles, i - 1);
+            if (strstr(references, bp->name) == NULL)
+            {
+                Log(LOG_LEVEL_DEBUG, "Pruning unreachable bundle '%s'",
+                    bp->name);
+                SeqRemove(policy->bundles, i - 1);
+                pruned++;
+            }
+        }
+    }
+    else
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Policy calls bundlesmatching(), not pruning any bundles");
+    }
+
+    WriterClose(w);
+    return pruned;
+}
+
+/*************************************************************************/
+
 /**
  * Get hash digest of the given policy file.
  *
@@ -485,6 +627,8 @@ Policy *PolicyMerge(Policy *a, Policy *b)
         StringMapSoftDestroy(extra_hashes);
     }
 
+    result->dynamic_inputs = (a->dynamic_inputs || b->dynamic_inputs);
+
     /* Should result take over a release_id ? */
     free(a->release_id);
     free(b->release_id);
@@ -1390,6 +1534,40 @@ Body *PolicyAppendPromiseBlock(
 
 /*******************************************************************/
 
+const char *const TYPE_SEQUENCE_NAMES[] =
+{
+    "meta",
+    "vars",
+    "defaults",
+    "classes",                              /* TYPE_SEQUENCE_CONTEXTS */
+    "users",
+    "files",
+    "packages",
+    "guest_environments",               /* TYPE_SEQUENCE_ENVIRONMENTS */
+    "methods",
+    "processes",
+    "services",
+    "commands",
+    "storage",
+    "databases",
+    "reports",
+    NULL
+};
+
+TypeSequence TypeSequenceFromString(const char *promise_type)
+{
+    assert(promise_type != NULL);
+
+    for (size_t i = 0; TYPE_SEQUENCE_NAMES[i] != NULL; i++)
+    {
+        if (StringEqual(promise_type, TYPE_SEQUENCE_NAMES[i]))
+        {
+            return (TypeSequence) i;
+        }
+    }
+    return TYPE_SEQUENCE_NONE;
+}
+
 BundleSection *BundleAppendSection(Bundle *bundle, const char *promise_type)
 {
     if (bundle == NULL)
@@ -1419,6 +1597,7 @@ BundleSection *BundleAppendSection(Bundle *bundle, const char *promise_type)
 
     section->parent_bundle = bundle;
     section->promise_type = xstrdup(promise_type);
+    section->type_sequence = TypeSequenceFromString(promise_type);
     section->promises = SeqNew(10, PromiseDestroy);
 
     if (IsBuiltInPromiseType(promise_type))
@@ -1520,6 +1699,7 @@ void PromiseDestroy(Promise *pp)
         free(pp->comment);
 
         SeqDestroy(pp->conlist);
+        free(pp->constraint_index);
 
         free(pp);
     }
@@ -1527,25 +1707,59 @@ void PromiseDestroy(Promise *pp)
 
 /*******************************************************************/
 
+/* Constraint lvals and class guards are drawn from a small vocabulary (the
+ * attribute names of the syntax tables, "any", and the guards actually
+ * written in policy), yet every Constraint -- including the per-evaluation
+ * promise copies made by DeRefCopyPromise() -- carried its own heap copy of
+ * both strings. Interned pointers are borrowed from the process-lifetime
+ * pool; ConstraintDestroy() must not free them. */
+
 static Constraint *ConstraintNew(const char *lval, Rval rval, const char *classes, bool references_body)
 {
     Constraint *cp = xcalloc(1, sizeof(Constraint));
 
-    cp->lval = SafeStringDuplicate(lval);
+    cp->lval = (char *) StringIntern(lval);
     cp->rval = rval;
 
-    cp->classes = SafeStringDuplicate(classes);
+    cp->classes = (char *) StringIntern(classes);
     cp->references_body = references_body;
 
     return cp;
 }
 
+/* Template-generated policies repeat the same literal scalar rvals ("true",
+ * "enforce", standard body arguments) across thousands of promises, each of
+ * which would otherwise carry its own heap copy. At parse time identical
+ * scalars can share one pooled copy (hash-consing), the same way lvals and
+ * class guards are interned above. "if" and "ifvarclass" are excluded:
+ * PromiseAppendConstraint() merges their rvals in place and must own what it
+ * destroys. Callers must record the returned ownership in the constraint's
+ * rval_interned flag. */
+Rval RvalCopyHashConsed(const char *lval, Rval rval, bool *interned)
+{
+    assert(interned != NULL);
+
+    if (rval.type == RVAL_TYPE_SCALAR &&
+        strcmp(lval, "if") != 0 && strcmp(lval, "ifvarclass") != 0)
+    {
+        *interned = true;
+        return (Rval) { (char *) StringIntern(RvalScalarValue(rval)), RVAL_TYPE_SCALAR };
+    }
+
+    *interned = false;
+    return RvalCopy(rval);
+}
+
 Constraint *PromiseAppendConstraint(Promise *pp, const char *lval, Rval rval, bool references_body)
 {
     Constraint *cp = ConstraintNew(lval, rval, "any", references_body);
     cp->type = POLICY_ELEMENT_TYPE_PROMISE;
     cp->parent.promise = pp;
 
+    /* The conlist is about to change, in both branches below. */
+    free(pp->constraint_index);
+    pp->constraint_index = NULL;
+
     for (size_t i = 0; i < SeqLength(pp->conlist); i++)
     {
         Constraint *old_cp = SeqAt(pp->conlist, i);
@@ -1956,6 +2170,46 @@ JsonElement *BundleToJson(const Bundle *bundle)
     return json_bundle;
 }
 
+/**
+ * @brief Check whether two policies contain the same bundles, ignoring bodies
+ *
+ * Used by the long-running daemons to detect reloads that only change
+ * control settings, which can be applied without tearing down the running
+ * evaluation context. Comparison is by serialized form, so a shifted line
+ * number counts as a change; the failure mode is just a full reload.
+ */
+bool PolicyBundlesEqual(const Policy *a, const Policy *b)
+{
+    assert(a != NULL);
+    assert(b != NULL);
+
+    if (SeqLength(a->bundles) != SeqLength(b->bundles))
+    {
+        return false;
+    }
+
+    bool equal = true;
+    for (size_t i = 0; equal && (i < SeqLength(a->bundles)); i++)
+    {
+        JsonElement *json_a = BundleToJson(SeqAt(a->bundles, i));
+        JsonElement *json_b = BundleToJson(SeqAt(b->bundles, i));
+
+        Writer *writer_a = StringWriter();
+        Writer *writer_b = StringWriter();
+        JsonWriteCompact(writer_a, json_a);
+        JsonWriteCompact(writer_b, json_b);
+
+        equal = StringEqual(StringWriterData(writer_a),
+                            StringWriterData(writer_b));
+
+        WriterClose(writer_a);
+        WriterClose(writer_b);
+        JsonDestroy(json_a);
+        JsonDestroy(json_b);
+    }
+    return equal;
+}
+
 /**
  * @brief Serialize a body as JSON
  * @param body The body to serialize
@@ -2029,6 +2283,46 @@ JsonElement *PolicyToJson(const Policy *policy)
     return json_policy;
 }
 
+/**
+ * @brief Stream a policy as JSON directly to a writer
+ *
+ * Structurally the same output as JsonWrite(PolicyToJson()), but only one
+ * bundle or body is materialized as a JsonElement at a time, so peak memory
+ * is proportional to the largest block instead of the whole policy. Used for
+ * `cf-promises --policy-output-format json` where the materialized tree can
+ * dwarf the parsed policy itself.
+ */
+void PolicyToJsonStreamed(const Policy *policy, Writer *writer)
+{
+    WriterWrite(writer, "{\n  \"bundles\": [\n");
+
+    const size_t n_bundles = SeqLength(policy->bundles);
+    for (size_t i = 0; i < n_bundles; i++)
+    {
+        const Bundle *bp = SeqAt(policy->bundles, i);
+        JsonElement *json_bundle = BundleToJson(bp);
+        WriterWrite(writer, "    ");
+        JsonWrite(writer, json_bundle, 2);
+        JsonDestroy(json_bundle);
+        WriterWrite(writer, (i + 1 < n_bundles) ? ",\n" : "\n");
+    }
+
+    WriterWrite(writer, "  ],\n  \"bodies\": [\n");
+
+    const size_t n_bodies = SeqLength(policy->bodies);
+    for (size_t i = 0; i < n_bodies; i++)
+    {
+        const Body *bdp = SeqAt(policy->bodies, i);
+        JsonElement *json_body = BodyToJson(bdp);
+        WriterWrite(writer, "    ");
+        JsonWrite(writer, json_body, 2);
+        JsonDestroy(json_body);
+        WriterWrite(writer, (i + 1 < n_bodies) ? ",\n" : "\n");
+    }
+
+    WriterWrite(writer, "  ]\n}\n");
+}
+
 /****************************************************************************/
 
 
@@ -2502,9 +2796,12 @@ void ConstraintDestroy(Constraint *cp)
 {
     if (cp)
     {
-        RvalDestroy(cp->rval);
-        free(cp->lval);
-        free(cp->classes);
+        if (!cp->rval_interned)
+        {
+            RvalDestroy(cp->rval);
+        }
+        /* lval, classes and hash-consed rvals are owned by the constraint
+         * string pool. */
 
         free(cp);
     }
@@ -3058,6 +3355,31 @@ Rlist *PromiseGetConstraintAsList(const EvalContext *ctx, const char *lval, cons
  * @param lval
  * @return Effective constraint if found, otherwise NULL
  */
+static int ConstraintLvalPointerCompare(const void *a, const void *b)
+{
+    const uintptr_t lval_a = (uintptr_t) (*(const Constraint *const *) a)->lval;
+    const uintptr_t lval_b = (uintptr_t) (*(const Constraint *const *) b)->lval;
+
+    if (lval_a < lval_b)
+    {
+        return -1;
+    }
+    return (lval_a > lval_b) ? 1 : 0;
+}
+
+static void PromiseBuildConstraintIndex(Promise *pp)
+{
+    const size_t length = SeqLength(pp->conlist);
+
+    pp->constraint_index = xmalloc(length * sizeof(Constraint *));
+    for (size_t i = 0; i < length; i++)
+    {
+        pp->constraint_index[i] = SeqAt(pp->conlist, i);
+    }
+    qsort(pp->constraint_index, length, sizeof(Constraint *),
+          ConstraintLvalPointerCompare);
+}
+
 Constraint *PromiseGetConstraint(const Promise *pp, const char *lval)
 {
     if (!pp)
@@ -3065,17 +3387,33 @@ Constraint *PromiseGetConstraint(const Promise *pp, const char *lval)
         return NULL;
     }
 
-    for (size_t i = 0; i < SeqLength(pp->conlist); i++)
+    const size_t length = SeqLength(pp->conlist);
+    if (length == 0)
     {
-        Constraint *cp = SeqAt(pp->conlist, i);
+        return NULL;
+    }
 
-        if (strcmp(cp->lval, lval) == 0)
-        {
-            return cp;
-        }
+    if (pp->constraint_index == NULL)
+    {
+        /* Lazy cache build, the promise is not logically modified. */
+        PromiseBuildConstraintIndex((Promise *) pp);
     }
 
-    return NULL;
+    /* Constraint lvals are interned (see ConstraintNew()), so after
+     * interning the query both sort order and equality are plain pointer
+     * comparisons, and the search below is a branch-free binary search. */
+    const uintptr_t interned = (uintptr_t) StringIntern(lval);
+
+    Constraint *const *base = pp->constraint_index;
+    size_t n = length;
+    while (n > 1)
+    {
+        const size_t half = n / 2;
+        base += ((uintptr_t) base[half - 1]->lval < interned) ? half : 0;
+        n -= half;
+    }
+
+    return ((uintptr_t) (*base)->lval == interned) ? *base : NULL;
 }
 
 Constraint *PromiseGetConstraintWithType(const Promise *pp, const char *lval, RvalType type)
@@ -58,6 +58,12 @@ struct Policy_
     Seq *bodies;
     Seq *custom_promise_types;
     StringMap *policy_files_hashes;
+
+    /* True if the effective 'inputs' were class-guarded or required variable
+     * expansion while loading, i.e. the file set in policy_files_hashes is
+     * not a pure function of the files themselves and the policy must not be
+     * cached whole. Set by LoadPolicy(). */
+    bool dynamic_inputs;
 };
 
 typedef struct
@@ -107,6 +113,10 @@ struct BundleSection_
     Bundle *parent_bundle;
 
     char *promise_type;
+    /* Dense ID of a built-in agent promise type, resolved at parse time;
+     * TYPE_SEQUENCE_NONE for custom and non-agent types. Lets actuation
+     * dispatch on an integer instead of the type string. */
+    TypeSequence type_sequence;
     Seq *promises;
 
     SourceOffset offset;
@@ -122,6 +132,11 @@ struct Promise_
     Rval promisee;
     Seq *conlist;
 
+    /* Lazily built index of conlist, sorted by interned lval pointer, for
+     * binary search in PromiseGetConstraint(). PromiseAppendConstraint()
+     * invalidates it; it is rebuilt on the next lookup. */
+    Constraint **constraint_index;
+
     const Promise *org_pp;            /* A ptr to the unexpanded raw promise */
 
     SourceOffset offset;
@@ -135,12 +150,25 @@ struct Constraint_
         Body *body;
     } parent;
 
-    char *lval;
+    char *lval;                 /* interned in policy.c, do not free/modify */
     Rval rval;
 
-    char *classes;
+    char *classes;              /* interned in policy.c, do not free/modify */
     bool references_body;
 
+    /* True when the rval is a scalar borrowed from the constraint string
+     * pool (see RvalCopyHashConsed()); ConstraintDestroy() must not free
+     * it. Only ever set on the parsed policy tree, never on the
+     * per-evaluation promise copies. */
+    bool rval_interned;
+
+    /* True when the rval is known to contain nothing expandable (no
+     * "$(x)"/"${x}" references, no "@(list)", no function calls), so each
+     * iteration can plainly copy it instead of running the expander.
+     * Computed by DeRefCopyPromise() on the iterated copy of the promise;
+     * always false on the parsed policy tree. */
+    bool rval_is_static;
+
     SourceOffset offset;
 };
 
@@ -165,6 +193,7 @@ unsigned PolicyHash(const Policy *policy);
 
 StringSet *PolicySourceFiles(const Policy *policy);
 const char *PolicyGetPolicyFileHash(const Policy *policy, const char *policy_file_path);
+size_t PolicyPruneUnreachableBundles(Policy *policy, const Rlist *cli_bundlesequence);
 
 Policy *PolicyMerge(Policy *a, Policy *b);
 Body *PolicyGetBody(const Policy *policy, const char *ns, const char *type, const char *name);
@@ -186,15 +215,23 @@ Body *PolicyAppendBody(Policy *policy, const char *ns, const char *name,
                        bool is_custom);
 Body *PolicyAppendPromiseBlock(Policy *policy, const char *ns, const char *name, const char *type, Rlist *args, const char *source_path);
 
+bool PolicyBundlesEqual(const Policy *a, const Policy *b);
+
 JsonElement *PolicyToJson(const Policy *policy);
 JsonElement *BundleToJson(const Bundle *bundle);
 JsonElement *BodyToJson(const Body *body);
 Policy *PolicyFromJson(JsonElement *json_policy);
+void PolicyToJsonStreamed(const Policy *policy, Writer *writer);
 void PolicyToString(const Policy *policy, Writer *writer);
 
 BundleSection *BundleAppendSection(Bundle *bundle, const char *promise_type);
 const BundleSection *BundleGetSection(const Bundle *bp, const char *promise_type);
 
+/* Canonical names of the promise types the agent actuates, indexed by
+ * TypeSequence (in evaluation order), NULL-terminated. */
+extern const char *const TYPE_SEQUENCE_NAMES[];
+TypeSequence TypeSequenceFromString(const char *promise_type);
+
 Constraint *BodyAppendConstraint(Body *body, const char *lval, Rval rval, const char *classes, bool references_body);
 Seq *BodyGetConstraint(Body *body, const char *lval);
 bool BodyHasConstraint(const Body *body, const char *lval);
@@ -208,6 +245,8 @@ void PromiseDestroy(Promise *pp);
 
 Constraint *PromiseAppendConstraint(Promise *promise, const char *lval, Rval rval, bool references_body);
 
+Rval RvalCopyHashConsed(const char *lval, Rval rval, bool *interned);
+
 const char *PromiseGetNamespace(const Promise *pp);
 const Bundle *PromiseGetBundle(const Promise *pp);
 const Policy *PromiseGetPolicy(const Promise *pp);
@@ -0,0 +1,489 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <policy_cache.h>
+
+#include <hash.h>                                         /* HashFile */
+#include <file_lib.h>                                     /* safe_fopen */
+#include <files_names.h>                                  /* CanonifyName */
+#include <known_dirs.h>                          /* GetStateDir,GetDataDir */
+#include <string_lib.h>                                   /* StringEqual */
+#include <writer.h>                                       /* FileWriter */
+#include <map.h>                                          /* StringMap */
+#include <generic_agent.h>              /* GenericAgentGetAugmentsFiles */
+#include <json.h>
+
+/* Bump whenever PolicyToJson() output or this container format changes. */
+#define POLICY_CACHE_VERSION 2
+
+/* Recorded digest for an augments file that was probed but did not exist. */
+#define POLICY_CACHE_ABSENT "absent"
+
+/* A compiled 4 MB policy tree serializes to well below this. */
+#define POLICY_CACHE_SIZE_MAX (256 * 1024 * 1024)
+
+void PolicyCachePath(char *buf, size_t buf_size, const GenericAgentConfig *config)
+{
+    assert(config != NULL);
+    assert(config->input_file != NULL);
+
+    snprintf(buf, buf_size, "%s%cpolicy_cache_%s.json",
+             GetStateDir(), FILE_SEPARATOR, CanonifyName(config->input_file));
+}
+
+bool PolicyCacheExists(const GenericAgentConfig *config)
+{
+    char filename[CF_BUFSIZE];
+    PolicyCachePath(filename, sizeof(filename), config);
+
+    struct stat sb;
+    return (stat(filename, &sb) == 0);
+}
+
+/**
+ * @return true if every file recorded in @a file_hashes still hashes to the
+ *         recorded digest.
+ */
+static bool PolicyCacheIsFresh(const JsonElement *file_hashes)
+{
+    assert(JsonGetType(file_hashes) == JSON_TYPE_OBJECT);
+
+    JsonIterator iter = JsonIteratorInit(file_hashes);
+    while (JsonIteratorHasMore(&iter))
+    {
+        const char *path = JsonIteratorNextKey(&iter);
+        const JsonElement *recorded = JsonObjectGet(file_hashes, path);
+        if (recorded == NULL || JsonGetType(recorded) != JSON_TYPE_STRING)
+        {
+            return false;
+        }
+
+        unsigned char digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+        char hashbuffer[CF_HOSTKEY_STRING_SIZE] = { 0 };
+        HashFile(path, digest, CF_DEFAULT_DIGEST, false);
+        HashPrintSafe(hashbuffer, sizeof(hashbuffer), digest,
+                      CF_DEFAULT_DIGEST, true);
+
+        if (!StringEqual(hashbuffer, JsonPrimitiveGetAsString(recorded)))
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Policy cache is stale: '%s' has changed", path);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * The files that can change the parse without any '.cf' file changing: the
+ * augments chain probed at startup (def.json / def_preferred.json and
+ * anything their "augments" keys pulled in) plus host_specific.json, since
+ * 'inputs' entries are variable-expanded against data these install.
+ */
+static StringSet *PolicyCacheEnvironmentFiles(void)
+{
+    StringSet *files = StringSetNew();
+
+    const StringSet *augments = GenericAgentGetAugmentsFiles();
+    if (augments != NULL)
+    {
+        StringSetIterator iter = StringSetIteratorInit((StringSet *) augments);
+        const char *path;
+        while ((path = StringSetIteratorNext(&iter)) != NULL)
+        {
+            StringSetAdd(files, xstrdup(path));
+        }
+    }
+
+    char host_specific[CF_BUFSIZE];
+    snprintf(host_specific, sizeof(host_specific), "%s%chost_specific.json",
+             GetDataDir(), FILE_SEPARATOR);
+    StringSetAdd(files, xstrdup(host_specific));
+
+    return files;
+}
+
+static void PolicyCacheFileDigest(const char *path,
+                                  char buf[CF_HOSTKEY_STRING_SIZE])
+{
+    struct stat sb;
+    if (stat(path, &sb) != 0)
+    {
+        strlcpy(buf, POLICY_CACHE_ABSENT, CF_HOSTKEY_STRING_SIZE);
+        return;
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+    HashFile(path, digest, CF_DEFAULT_DIGEST, false);
+    HashPrintSafe(buf, CF_HOSTKEY_STRING_SIZE, digest, CF_DEFAULT_DIGEST, true);
+}
+
+/**
+ * @return true if the recorded augments digests match the current augments
+ *         chain exactly: same set of files, same contents, and files
+ *         recorded as absent still absent.
+ */
+static bool PolicyCacheAugmentsFresh(const JsonElement *augments_hashes)
+{
+    assert(JsonGetType(augments_hashes) == JSON_TYPE_OBJECT);
+
+    JsonIterator iter = JsonIteratorInit(augments_hashes);
+    while (JsonIteratorHasMore(&iter))
+    {
+        const char *path = JsonIteratorNextKey(&iter);
+        const JsonElement *recorded = JsonObjectGet(augments_hashes, path);
+        if (recorded == NULL || JsonGetType(recorded) != JSON_TYPE_STRING)
+        {
+            return false;
+        }
+
+        char current[CF_HOSTKEY_STRING_SIZE];
+        PolicyCacheFileDigest(path, current);
+        if (!StringEqual(current, JsonPrimitiveGetAsString(recorded)))
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Policy cache is stale: augments file '%s' has changed", path);
+            return false;
+        }
+    }
+
+    /* A file probed now but never recorded (e.g. a nested augments file
+     * added via a def.json edit) also invalidates the cache. */
+    StringSet *current_files = PolicyCacheEnvironmentFiles();
+    StringSetIterator it = StringSetIteratorInit(current_files);
+    const char *path;
+    while ((path = StringSetIteratorNext(&it)) != NULL)
+    {
+        if (JsonObjectGet(augments_hashes, path) == NULL)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Policy cache is stale: augments file '%s' was not known"
+                " when the cache was compiled", path);
+            StringSetDestroy(current_files);
+            return false;
+        }
+    }
+    StringSetDestroy(current_files);
+
+    return true;
+}
+
+Policy *PolicyCacheLoad(const GenericAgentConfig *config)
+{
+    char filename[CF_BUFSIZE];
+    PolicyCachePath(filename, sizeof(filename), config);
+
+    JsonElement *doc = NULL;
+    JsonParseError err = JsonParseFile(filename, POLICY_CACHE_SIZE_MAX, &doc);
+    if (err != JSON_PARSE_OK)
+    {
+        Log(LOG_LEVEL_DEBUG, "No usable policy cache at '%s' (%s)",
+            filename, JsonParseErrorToString(err));
+        return NULL;
+    }
+
+    const JsonElement *version = JsonObjectGet(doc, "version");
+    if (version == NULL ||
+        JsonPrimitiveGetAsInteger(version) != POLICY_CACHE_VERSION)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Ignoring policy cache '%s' with unsupported version", filename);
+        JsonDestroy(doc);
+        return NULL;
+    }
+
+    JsonElement *file_hashes = JsonObjectGet(doc, "file_hashes");
+    JsonElement *augments_hashes = JsonObjectGet(doc, "augments_hashes");
+    JsonElement *json_policy = JsonObjectGet(doc, "policy");
+    if (file_hashes == NULL || JsonGetType(file_hashes) != JSON_TYPE_OBJECT ||
+        augments_hashes == NULL ||
+        JsonGetType(augments_hashes) != JSON_TYPE_OBJECT ||
+        json_policy == NULL || JsonGetType(json_policy) != JSON_TYPE_OBJECT)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Malformed policy cache '%s'", filename);
+        JsonDestroy(doc);
+        return NULL;
+    }
+
+    /* The set of files parsed depends not only on the '.cf' files
+     * themselves but on the augments data 'inputs' entries expand against,
+     * so both must be unchanged. */
+    if (!PolicyCacheIsFresh(file_hashes) ||
+        !PolicyCacheAugmentsFresh(augments_hashes))
+    {
+        JsonDestroy(doc);
+        return NULL;
+    }
+
+    Policy *policy = PolicyFromJson(json_policy);
+    if (policy == NULL)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Failed to deserialize policy cache '%s', re-parsing policy",
+            filename);
+        JsonDestroy(doc);
+        return NULL;
+    }
+
+    /* Rebuild the file->digest map so that a later PolicyCacheStore() (and
+     * anything else using it) sees the same data as after a real parse. */
+    policy->policy_files_hashes = StringMapNew();
+    JsonIterator iter = JsonIteratorInit(file_hashes);
+    while (JsonIteratorHasMore(&iter))
+    {
+        const char *path = JsonIteratorNextKey(&iter);
+        const char *digest =
+            JsonPrimitiveGetAsString(JsonObjectGet(file_hashes, path));
+        StringMapInsert(policy->policy_files_hashes,
+                        xstrdup(path), xstrdup(digest));
+    }
+
+    JsonDestroy(doc);
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Loaded compiled policy from cache '%s', skipping parse", filename);
+    return policy;
+}
+
+bool PolicyCacheStore(const GenericAgentConfig *config, const Policy *policy)
+{
+    assert(policy != NULL);
+
+    if (policy->policy_files_hashes == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Not writing policy cache: policy has no file digests"
+            " (not loaded from files?)");
+        return false;
+    }
+
+    if (policy->dynamic_inputs)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Not writing policy cache: the effective 'inputs' are"
+            " class-guarded or variable-expanded, so the recorded digests"
+            " cannot pin down the set of files to parse");
+        return false;
+    }
+
+    char filename[CF_BUFSIZE];
+    PolicyCachePath(filename, sizeof(filename), config);
+
+    JsonElement *file_hashes = JsonObjectCreate(10);
+    MapIterator it = MapIteratorInit(policy->policy_files_hashes->impl);
+    MapKeyValue *item;
+    while ((item = MapIteratorNext(&it)) != NULL)
+    {
+        JsonObjectAppendString(file_hashes,
+                               (const char *) item->key,
+                               (const char *) item->value);
+    }
+
+    JsonElement *augments_hashes = JsonObjectCreate(10);
+    {
+        StringSet *env_files = PolicyCacheEnvironmentFiles();
+        StringSetIterator iter = StringSetIteratorInit(env_files);
+        const char *path;
+        while ((path = StringSetIteratorNext(&iter)) != NULL)
+        {
+            char digest[CF_HOSTKEY_STRING_SIZE];
+            PolicyCacheFileDigest(path, digest);
+            JsonObjectAppendString(augments_hashes, path, digest);
+        }
+        StringSetDestroy(env_files);
+    }
+
+    JsonElement *doc = JsonObjectCreate(4);
+    JsonObjectAppendInteger(doc, "version", POLICY_CACHE_VERSION);
+    JsonObjectAppendObject(doc, "file_hashes", file_hashes);
+    JsonObjectAppendObject(doc, "augments_hashes", augments_hashes);
+    JsonObjectAppendObject(doc, "policy", PolicyToJson(policy));
+
+    /* Write to a temporary file and rename so that readers never see a
+     * truncated cache. */
+    char tmp_filename[CF_BUFSIZE];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+
+    FILE *fp = safe_fopen(tmp_filename, "w");
+    if (fp == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Could not write policy cache '%s' (fopen: %s)",
+            tmp_filename, GetErrorStr());
+        JsonDestroy(doc);
+        return false;
+    }
+
+    Writer *w = FileWriter(fp);
+    JsonWriteCompact(w, doc);
+    WriterClose(w);
+    JsonDestroy(doc);
+
+    if (rename(tmp_filename, filename) != 0)
+    {
+        Log(LOG_LEVEL_ERR, "Could not rename policy cache into place"
+            " ('%s' -> '%s': %s)", tmp_filename, filename, GetErrorStr());
+        unlink(tmp_filename);
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Wrote compiled policy cache '%s'", filename);
+    return true;
+}
+
+void PolicyCacheRemove(const GenericAgentConfig *config)
+{
+    char filename[CF_BUFSIZE];
+    PolicyCachePath(filename, sizeof(filename), config);
+
+    if (unlink(filename) == 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Removed policy cache '%s'", filename);
+    }
+    else if (errno != ENOENT)
+    {
+        Log(LOG_LEVEL_WARNING, "Could not remove policy cache '%s' (%s)",
+            filename, GetErrorStr());
+    }
+}
+
+static void PolicyFileCachePath(char *buf, size_t buf_size, const char *policy_file)
+{
+    assert(policy_file != NULL);
+
+    snprintf(buf, buf_size, "%s%cpolicy_cache_file_%s.json",
+             GetStateDir(), FILE_SEPARATOR, CanonifyName(policy_file));
+}
+
+bool PolicyFileCacheExists(const char *policy_file)
+{
+    char filename[CF_BUFSIZE];
+    PolicyFileCachePath(filename, sizeof(filename), policy_file);
+
+    struct stat sb;
+    return (stat(filename, &sb) == 0);
+}
+
+Policy *PolicyFileCacheLoad(const char *policy_file, const char *digest)
+{
+    char filename[CF_BUFSIZE];
+    PolicyFileCachePath(filename, sizeof(filename), policy_file);
+
+    JsonElement *doc = NULL;
+    JsonParseError err = JsonParseFile(filename, POLICY_CACHE_SIZE_MAX, &doc);
+    if (err != JSON_PARSE_OK)
+    {
+        Log(LOG_LEVEL_DEBUG, "No usable policy cache entry at '%s' (%s)",
+            filename, JsonParseErrorToString(err));
+        return NULL;
+    }
+
+    const JsonElement *version = JsonObjectGet(doc, "version");
+    if (version == NULL ||
+        JsonPrimitiveGetAsInteger(version) != POLICY_CACHE_VERSION)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Ignoring policy cache entry '%s' with unsupported version",
+            filename);
+        JsonDestroy(doc);
+        return NULL;
+    }
+
+    const JsonElement *recorded = JsonObjectGet(doc, "digest");
+    if (recorded == NULL || JsonGetType(recorded) != JSON_TYPE_STRING ||
+        !StringEqual(digest, JsonPrimitiveGetAsString(recorded)))
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Policy cache entry for '%s' is stale: file has changed",
+            policy_file);
+        JsonDestroy(doc);
+        return NULL;
+    }
+
+    JsonElement *json_policy = JsonObjectGet(doc, "policy");
+    if (json_policy == NULL || JsonGetType(json_policy) != JSON_TYPE_OBJECT)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Malformed policy cache entry '%s'", filename);
+        JsonDestroy(doc);
+        return NULL;
+    }
+
+    Policy *policy = PolicyFromJson(json_policy);
+    JsonDestroy(doc);
+    if (policy == NULL)
+    {
+        Log(LOG_LEVEL_WARNING,
+            "Failed to deserialize policy cache entry '%s', re-parsing '%s'",
+            filename, policy_file);
+        return NULL;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Loaded '%s' from policy cache entry '%s',"
+        " skipping parse", policy_file, filename);
+    return policy;
+}
+
+bool PolicyFileCacheStore(const char *policy_file, const char *digest,
+                          const JsonElement *policy_json)
+{
+    assert(policy_json != NULL);
+
+    char filename[CF_BUFSIZE];
+    PolicyFileCachePath(filename, sizeof(filename), policy_file);
+
+    JsonElement *doc = JsonObjectCreate(3);
+    JsonObjectAppendInteger(doc, "version", POLICY_CACHE_VERSION);
+    JsonObjectAppendString(doc, "digest", digest);
+    JsonObjectAppendElement(doc, "policy", JsonCopy(policy_json));
+
+    /* Write to a temporary file and rename so that readers never see a
+     * truncated entry. */
+    char tmp_filename[CF_BUFSIZE];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+
+    FILE *fp = safe_fopen(tmp_filename, "w");
+    if (fp == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Could not write policy cache entry '%s'"
+            " (fopen: %s)", tmp_filename, GetErrorStr());
+        JsonDestroy(doc);
+        return false;
+    }
+
+    Writer *w = FileWriter(fp);
+    JsonWriteCompact(w, doc);
+    WriterClose(w);
+    JsonDestroy(doc);
+
+    if (rename(tmp_filename, filename) != 0)
+    {
+        Log(LOG_LEVEL_ERR, "Could not rename policy cache entry into place"
+            " ('%s' -> '%s': %s)", tmp_filename, filename, GetErrorStr());
+        unlink(tmp_filename);
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Wrote policy cache entry '%s'", filename);
+    return true;
+}
@@ -0,0 +1,126 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_POLICY_CACHE_H
+#define CFENGINE_POLICY_CACHE_H
+
+#include <cf3.defs.h>
+#include <policy.h>
+
+/**
+ * Compiled policy cache.
+ *
+ * After a successful parse + validation, the whole merged Policy tree can be
+ * serialized to a JSON document in the state directory together with the
+ * digests of every policy file that went into it and of the augments chain
+ * (def.json / def_preferred.json, files pulled in via their "augments" keys,
+ * and host_specific.json). On later runs the cache is only used if every
+ * recorded file still hashes to the same digest and no new augments file has
+ * appeared, in which case deserializing the document (PolicyFromJson)
+ * replaces re-running the lexer/parser over the whole input tree. The
+ * augments digests matter because 'inputs' entries expand variables the
+ * augments data installs, so the *set* of files parsed can change without
+ * any '.cf' file changing.
+ *
+ * The cache is opt-in: it is created by 'cf-promises --compile' and from
+ * then on kept fresh by whichever component parses the policy next. Policies
+ * whose effective 'inputs' are class-guarded or variable-expanded beyond
+ * what the augments digests pin down are never cached whole (see
+ * LoadPolicy()); the per-file cache below still serves them, and it
+ * re-derives the file set on every load. A cache compiled on one host must
+ * not be copied to other hosts (the per-host state directory location
+ * already ensures this).
+ */
+
+/**
+ * Fill @a buf with the path of the policy cache file for @a config's
+ * entry-point policy file.
+ */
+void PolicyCachePath(char *buf, size_t buf_size, const GenericAgentConfig *config);
+
+/**
+ * @return true if a policy cache file exists for @a config, fresh or stale.
+ */
+bool PolicyCacheExists(const GenericAgentConfig *config);
+
+/**
+ * Load the policy from the cache if all recorded file digests still match.
+ *
+ * @return the deserialized Policy, or NULL if there is no cache, it is
+ *         stale, or it fails to deserialize (callers fall back to parsing).
+ */
+Policy *PolicyCacheLoad(const GenericAgentConfig *config);
+
+/**
+ * Serialize @a policy and its file digests to the cache file.
+ *
+ * @return true if the cache was written successfully.
+ */
+bool PolicyCacheStore(const GenericAgentConfig *config, const Policy *policy);
+
+/**
+ * Delete the policy cache file for @a config, if any. Used when a fresh
+ * parse shows the policy cannot be cached safely (dynamic 'inputs').
+ */
+void PolicyCacheRemove(const GenericAgentConfig *config);
+
+/**
+ * Per-file policy cache.
+ *
+ * Finer-grained companion to the whole-tree cache above: each parsed policy
+ * file gets its own cache entry keyed by the file's digest, so that changing
+ * one input out of hundreds only re-parses and re-checks that one file --
+ * the rest deserialize from their entries and the merged tree is re-linked
+ * and re-checked as usual. Entries hold the pristine AST as it came out of
+ * the parser, before any entry-point-specific rewriting, and are stored
+ * only after the file passed PolicyCheckPartial().
+ */
+
+/**
+ * @return true if a per-file cache entry exists for @a policy_file, fresh or
+ *         stale.
+ */
+bool PolicyFileCacheExists(const char *policy_file);
+
+/**
+ * Load the AST of a single policy file from its cache entry.
+ *
+ * @param digest printable digest the file currently hashes to
+ * @return the deserialized Policy, or NULL if there is no entry, it was
+ *         stored for different file contents, or it fails to deserialize
+ *         (callers fall back to parsing).
+ */
+Policy *PolicyFileCacheLoad(const char *policy_file, const char *digest);
+
+/**
+ * Write a per-file cache entry for @a policy_file.
+ *
+ * @param policy_json the file's AST as serialized by PolicyToJson(), taken
+ *                    before any entry-point-specific rewriting (borrowed)
+ * @return true if the entry was written successfully.
+ */
+bool PolicyFileCacheStore(const char *policy_file, const char *digest,
+                          const JsonElement *policy_json);
+
+#endif
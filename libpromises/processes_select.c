@@ -42,9 +42,9 @@
 #include <zones.h>
 #include <printsize.h>
 #include <known_dirs.h>
+#include <sequence.h>
 
 # ifdef HAVE_GETZONEID
-#include <sequence.h>
 #define MAX_ZONENAME_SIZE 64
 # endif
 
@@ -55,6 +55,21 @@
 #endif
 TABLE_STORAGE Item *PROCESSTABLE = NULL;
 
+/**
+ * Parsed snapshot of PROCESSTABLE. Splitting a ps line into columns is by
+ * far the most expensive part of process matching, and every processes
+ * promise used to redo it for the whole table. The rows are split once, on
+ * the first SelectProcesses() call after a table load, and reused until
+ * ClearProcessTable().
+ */
+typedef struct
+{
+    const Item *entry;          /* borrowed from PROCESSTABLE */
+    char *fields[CF_PROCCOLS];  /* all NULL if the line failed to parse */
+} ProcessTableRow;
+
+static Seq *PROCESS_TABLE_ROWS = NULL; /* GLOBAL_X */
+
 typedef enum
 {
     /*
@@ -134,17 +149,13 @@ static void ApplyPlatformExtraTable(char **names, char **columns);
 
 /***************************************************************************/
 
-static bool SelectProcess(const char *procentry,
-                          time_t pstime,
+static bool SelectProcess(char **column,
                           char **names,
-                          int *start,
-                          int *end,
                           const char *process_regex,
                           const ProcessSelect *a,
                           bool attrselect)
 {
     bool result = true;
-    char *column[CF_PROCCOLS];
     Rlist *rp;
 
     assert(process_regex);
@@ -153,17 +164,6 @@ static bool SelectProcess(const char *procentry,
     StringSet *process_select_attributes = StringSetNew();
     bool unmatched_attribute = false;
 
-    memset(column, 0, sizeof(column));
-
-    if (!SplitProcLine(procentry, pstime, names, start, end,
-                       PS_COLUMN_ALGORITHM[VPSHARDCLASS], column))
-    {
-        result = false;
-        goto cleanup;
-    }
-
-    ApplyPlatformExtraTable(names, column);
-
     for (int i = 0; names[i] != NULL; i++)
     {
         LogDebug(LOG_MOD_PS, "In SelectProcess, COL[%s] = '%s'",
@@ -172,14 +172,15 @@ static bool SelectProcess(const char *procentry,
 
     if (!SelectProcRegexMatch("CMD", "COMMAND", process_regex, false, names, column))
     {
-        result = false;
-        goto cleanup;
+        StringSetDestroy(process_select_attributes);
+        return false;
     }
 
     if (!attrselect)
     {
         // If we are not considering attributes, then the matching is done.
-        goto cleanup;
+        StringSetDestroy(process_select_attributes);
+        return true;
     }
 
     for (rp = a->owner; rp != NULL; rp = rp->next)
@@ -343,15 +344,55 @@ static bool SelectProcess(const char *procentry,
         result = EvalProcessResult(a->process_result, process_select_attributes);
     }
 
-cleanup:
     StringSetDestroy(process_select_attributes);
 
-    for (int i = 0; column[i] != NULL; i++)
+    return result;
+}
+
+static void ProcessTableRowDestroy(void *p)
+{
+    ProcessTableRow *row = p;
+    for (int i = 0; i < CF_PROCCOLS && row->fields[i] != NULL; i++)
     {
-        free(column[i]);
+        free(row->fields[i]);
     }
+    free(row);
+}
 
-    return result;
+/**
+ * Split every PROCESSTABLE line into columns, once per table load.
+ * @param pstime  the time ps was (approximately) run, used to amend
+ *                imprecise start times; rows keep the amendment from the
+ *                first selection pass.
+ */
+static void EnsureProcessTableRows(time_t pstime, char **names, int *start, int *end)
+{
+    if (PROCESS_TABLE_ROWS != NULL)
+    {
+        return;
+    }
+
+    PROCESS_TABLE_ROWS = SeqNew(512, ProcessTableRowDestroy);
+
+    for (const Item *ip = PROCESSTABLE->next; ip != NULL; ip = ip->next)
+    {
+        if (NULL_OR_EMPTY(ip->name))
+        {
+            continue;
+        }
+
+        ProcessTableRow *row = xcalloc(1, sizeof(ProcessTableRow));
+        row->entry = ip;
+
+        if (SplitProcLine(ip->name, pstime, names, start, end,
+                          PS_COLUMN_ALGORITHM[VPSHARDCLASS], row->fields))
+        {
+            ApplyPlatformExtraTable(names, row->fields);
+        }
+        /* Rows that fail to parse keep fields[0] == NULL and never match. */
+
+        SeqAppend(PROCESS_TABLE_ROWS, row);
+    }
 }
 
 Item *SelectProcesses(const char *process_name, const ProcessSelect *a, bool attrselect)
@@ -374,19 +415,24 @@ Item *SelectProcesses(const char *process_name, const ProcessSelect *a, bool att
     /* TODO: use actual time of ps-run, as time(NULL) may be later. */
     time_t pstime = time(NULL);
 
-    for (Item *ip = processes->next; ip != NULL; ip = ip->next)
+    EnsureProcessTableRows(pstime, names, start, end);
+
+    const size_t num_rows = SeqLength(PROCESS_TABLE_ROWS);
+    for (size_t i = 0; i < num_rows; i++)
     {
-        if (NULL_OR_EMPTY(ip->name))
+        ProcessTableRow *row = SeqAt(PROCESS_TABLE_ROWS, i);
+
+        if (row->fields[0] == NULL)
         {
             continue;
         }
 
-        if (!SelectProcess(ip->name, pstime, names, start, end, process_name, a, attrselect))
+        if (!SelectProcess(row->fields, names, process_name, a, attrselect))
         {
             continue;
         }
 
-        pid_t pid = ExtractPid(ip->name, names, end);
+        pid_t pid = ExtractPid(row->entry->name, names, end);
 
         if (pid == -1)
         {
@@ -394,7 +440,7 @@ Item *SelectProcesses(const char *process_name, const ProcessSelect *a, bool att
             continue;
         }
 
-        PrependItem(&result, ip->name, "");
+        PrependItem(&result, row->entry->name, "");
         result->counter = (int)pid;
     }
 
@@ -648,14 +694,29 @@ static bool SelectProcRegexMatch(const char *name1, const char *name2,
 
     if ((i = GetProcColumnIndex(name1, name2, colNames)) != -1)
     {
+        /* Applied to every row of the process table, so reject on the
+         * pattern's literal anchors before paying for a PCRE execution. */
+        if (anchored && !StringMatchFullLiteralPrefilter(regex, line[i]))
+        {
+            return false;
+        }
+
+        /* The same patterns are applied to every row of the process table,
+         * so compile them through the process-wide regex cache. */
+        Regex *rx = CompileRegexCached(regex);
+        if (rx == NULL)
+        {
+            return false;
+        }
+
         if (anchored)
         {
-            return StringMatchFull(regex, line[i]);
+            return StringMatchFullWithPrecompiledRegex(rx, line[i]);
         }
         else
         {
             size_t s, e;
-            return StringMatch(regex, line[i], &s, &e);
+            return StringMatchWithPrecompiledRegex(rx, line[i], &s, &e);
         }
     }
 
@@ -1833,6 +1894,11 @@ void ClearProcessTable(void)
 {
     ClearPlatformExtraTable();
 
+    /* The parsed rows borrow their entries from PROCESSTABLE, so they must
+     * go first. */
+    SeqDestroy(PROCESS_TABLE_ROWS);
+    PROCESS_TABLE_ROWS = NULL;
+
     DeleteItemList(PROCESSTABLE);
     PROCESSTABLE = NULL;
 }
@@ -508,7 +508,19 @@ Promise *DeRefCopyPromise(EvalContext *ctx, const Promise *pp)
                     RlistFlatten(ctx, (Rlist **) &newrv.item);
                 }
 
-                PromiseAppendConstraint(pcopy, cp->lval, newrv, false);
+                Constraint *cp_copy =
+                    PromiseAppendConstraint(pcopy, cp->lval, newrv, false);
+
+                /* Most constraints contain no variable references at all;
+                 * mark those so that every iteration copies them instead of
+                 * running the expander (see EvaluateConstraintIteration()).
+                 * Static lists of BUNDLE-typed constraints are excluded,
+                 * since ExpandBundleReference() rejects lists rather than
+                 * copying them. */
+                cp_copy->rval_is_static =
+                    (!RvalIsExpandable(newrv) &&
+                     (newrv.type == RVAL_TYPE_SCALAR ||
+                      ExpectedDataType(cp->lval) != CF_DATA_TYPE_BUNDLE));
             }
         }
 
@@ -569,6 +581,14 @@ static bool EvaluateConstraintIteration(EvalContext *ctx, const Constraint *cp,
         return false;
     }
 
+    if (cp->rval_is_static)
+    {
+        /* Nothing in the rval can expand (see DeRefCopyPromise()), so the
+         * result of full evaluation would be a verbatim copy anyway. */
+        *rval_out = RvalCopy(cp->rval);
+        return true;
+    }
+
     if (ExpectedDataType(cp->lval) == CF_DATA_TYPE_BUNDLE)
     {
         *rval_out = ExpandBundleReference(ctx, NULL, "this", cp->rval);
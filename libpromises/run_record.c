@@ -0,0 +1,333 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <run_record.h>
+
+#include <policy.h>                                    /* PromiseGetHandle */
+#include <known_dirs.h>                                      /* GetStateDir */
+#include <file_lib.h>                                         /* safe_fopen */
+#include <map.h>
+#include <sequence.h>
+#include <string_lib.h>                                   /* StringEndsWith */
+#include <mutex.h>
+#include <logging.h>
+
+#define RUN_RECORD_VERSION 1
+#define RUN_RECORD_HEADER_SIZE 32
+#define RUN_RECORD_SUFFIX ".crr"
+
+/* Files that nothing collected are pruned after a week. */
+#define RUN_RECORD_RETENTION (7 * SECONDS_PER_DAY)
+
+static void SizeBoxDestroy_untyped(void *p)
+{
+    free(p);
+}
+
+TYPED_MAP_DECLARE(HandleId, char *, size_t *)
+TYPED_MAP_DEFINE(HandleId, char *, size_t *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 SizeBoxDestroy_untyped)
+
+typedef struct
+{
+    time_t timestamp;
+    uint32_t duration_ms;
+    uint32_t handle_id;
+    uint8_t outcome;
+} RunRecord;
+
+static RunRecord *run_records = NULL; /* GLOBAL_X */
+static size_t run_record_count = 0; /* GLOBAL_X */
+static size_t run_record_capacity = 0; /* GLOBAL_X */
+static Seq *run_record_handles = NULL; /* GLOBAL_X, owns the strings */
+static HandleIdMap *run_record_handle_ids = NULL; /* GLOBAL_X */
+static time_t run_record_start = 0; /* GLOBAL_X */
+static int64_t run_record_last_event_ns = 0; /* GLOBAL_X */
+static pthread_mutex_t run_record_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+static int64_t RunRecordNowNS(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    /* Some OS-es have no monotonic clock; the realtime clock is the best
+     * we can do (see libcfnet/net.c). */
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t RunRecordHandleId(const char *handle)
+{
+    size_t *id = HandleIdMapGet(run_record_handle_ids, (char *) handle);
+    if (id == NULL)
+    {
+        id = xmalloc(sizeof(size_t));
+        *id = SeqLength(run_record_handles);
+        SeqAppend(run_record_handles, xstrdup(handle));
+        HandleIdMapInsert(run_record_handle_ids, xstrdup(handle), id);
+    }
+    return (uint32_t) *id;
+}
+
+void RunRecordAppend(const Promise *pp, PromiseResult status)
+{
+    assert(pp != NULL);
+
+    const char *handle = PromiseGetHandle(pp);
+    if (handle == NULL)
+    {
+        handle = pp->promiser;
+    }
+
+    ThreadLock(&run_record_lock);
+
+    const int64_t now_ns = RunRecordNowNS();
+    if (run_records == NULL)
+    {
+        run_record_capacity = 1024;
+        run_records = xmalloc(run_record_capacity * sizeof(RunRecord));
+        run_record_handles = SeqNew(64, free);
+        run_record_handle_ids = HandleIdMapNew();
+        run_record_start = time(NULL);
+        run_record_last_event_ns = now_ns;
+    }
+    else if (run_record_count == run_record_capacity)
+    {
+        run_record_capacity *= 2;
+        run_records = xrealloc(run_records,
+                               run_record_capacity * sizeof(RunRecord));
+    }
+
+    /* Promises are actuated sequentially, so the gap between consecutive
+     * outcome events is (almost all of) the time spent on this one. */
+    int64_t elapsed_ms = (now_ns - run_record_last_event_ns) / 1000000;
+    run_record_last_event_ns = now_ns;
+    if (elapsed_ms < 0 || elapsed_ms > UINT32_MAX)
+    {
+        elapsed_ms = 0;             /* non-monotonic clock stepped, or junk */
+    }
+
+    RunRecord *record = &run_records[run_record_count++];
+    record->timestamp = time(NULL);
+    record->duration_ms = (uint32_t) elapsed_ms;
+    record->handle_id = RunRecordHandleId(handle);
+    record->outcome = (uint8_t) status;
+
+    ThreadUnlock(&run_record_lock);
+}
+
+static void PutLE32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t) (v & 0xff);
+    p[1] = (uint8_t) ((v >> 8) & 0xff);
+    p[2] = (uint8_t) ((v >> 16) & 0xff);
+    p[3] = (uint8_t) ((v >> 24) & 0xff);
+}
+
+static void PutLE64(uint8_t *p, uint64_t v)
+{
+    PutLE32(p, (uint32_t) (v & 0xffffffff));
+    PutLE32(p + 4, (uint32_t) (v >> 32));
+}
+
+/**
+ * Serialize the buffered records into a self-contained columnar image;
+ * layout documented in run_record.h.
+ */
+static uint8_t *RunRecordSerialize(size_t *image_size)
+{
+    const size_t n = run_record_count;
+    const size_t h = SeqLength(run_record_handles);
+
+    size_t blob_size = 0;
+    for (size_t i = 0; i < h; i++)
+    {
+        blob_size += strlen(SeqAt(run_record_handles, i)) + 1;
+    }
+
+    const size_t columns_size = (n * 8) + (n * 4) + (n * 4) + n;
+    const size_t padding = (8 - ((RUN_RECORD_HEADER_SIZE + columns_size) % 8)) % 8;
+    const size_t total = RUN_RECORD_HEADER_SIZE + columns_size + padding +
+        4 + (h * 4) + blob_size;
+
+    uint8_t *image = xcalloc(1, total);
+    uint8_t *p = image;
+
+    memcpy(p, "CFRR", 4);
+    p[4] = RUN_RECORD_VERSION;
+    PutLE32(p + 8, (uint32_t) n);
+    PutLE32(p + 12, (uint32_t) h);
+    PutLE64(p + 16, (uint64_t) run_record_start);
+    p += RUN_RECORD_HEADER_SIZE;
+
+    for (size_t i = 0; i < n; i++, p += 8)
+    {
+        PutLE64(p, (uint64_t) run_records[i].timestamp);
+    }
+    for (size_t i = 0; i < n; i++, p += 4)
+    {
+        PutLE32(p, run_records[i].duration_ms);
+    }
+    for (size_t i = 0; i < n; i++, p += 4)
+    {
+        PutLE32(p, run_records[i].handle_id);
+    }
+    for (size_t i = 0; i < n; i++, p++)
+    {
+        *p = run_records[i].outcome;
+    }
+    p += padding;
+
+    PutLE32(p, (uint32_t) blob_size);
+    p += 4;
+
+    uint8_t *blob = p + (h * 4);
+    size_t offset = 0;
+    for (size_t i = 0; i < h; i++, p += 4)
+    {
+        const char *handle = SeqAt(run_record_handles, i);
+        const size_t len = strlen(handle) + 1;
+
+        PutLE32(p, (uint32_t) offset);
+        memcpy(blob + offset, handle, len);
+        offset += len;
+    }
+
+    *image_size = total;
+    return image;
+}
+
+/**
+ * Delete record files that have sat uncollected for longer than the
+ * retention period.
+ */
+static void RunRecordPrune(const char *dirname, time_t now)
+{
+    DIR *dir = opendir(dirname);
+    if (dir == NULL)
+    {
+        return;
+    }
+
+    const struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (!StringEndsWith(entry->d_name, RUN_RECORD_SUFFIX))
+        {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dirname, entry->d_name);
+
+        struct stat sb;
+        if ((stat(path, &sb) == 0) &&
+            (now - sb.st_mtime > RUN_RECORD_RETENTION))
+        {
+            Log(LOG_LEVEL_VERBOSE, "Pruning old run record '%s'", path);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+}
+
+void RunRecordCommit(void)
+{
+    ThreadLock(&run_record_lock);
+
+    if (run_record_count == 0)
+    {
+        ThreadUnlock(&run_record_lock);
+        return;
+    }
+
+    size_t image_size;
+    uint8_t *image = RunRecordSerialize(&image_size);
+    const size_t count = run_record_count;
+    const time_t start = run_record_start;
+
+    free(run_records);
+    run_records = NULL;
+    run_record_count = 0;
+    run_record_capacity = 0;
+    SeqDestroy(run_record_handles);
+    run_record_handles = NULL;
+    HandleIdMapDestroy(run_record_handle_ids);
+    run_record_handle_ids = NULL;
+
+    ThreadUnlock(&run_record_lock);
+
+    char dirname[PATH_MAX];
+    snprintf(dirname, sizeof(dirname), "%s/run_records", GetStateDir());
+    if ((mkdir(dirname, 0700) == -1) && (errno != EEXIST))
+    {
+        Log(LOG_LEVEL_ERR, "Failed to create run record directory '%s' (mkdir: %s)",
+            dirname, GetErrorStr());
+        free(image);
+        return;
+    }
+
+    char path[PATH_MAX], tmp_path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/run-%jd-%jd" RUN_RECORD_SUFFIX,
+             dirname, (intmax_t) start, (intmax_t) getpid());
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    bool written = false;
+    FILE *file = safe_fopen(tmp_path, "w");
+    if (file == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to open run record file '%s' (fopen: %s)",
+            tmp_path, GetErrorStr());
+    }
+    else
+    {
+        written = (fwrite(image, image_size, 1, file) == 1);
+        written = (fflush(file) == 0) && (fsync(fileno(file)) == 0) && written;
+        written = (fclose(file) == 0) && written;
+
+        if (written && (rename(tmp_path, path) == -1))
+        {
+            Log(LOG_LEVEL_ERR, "Failed to finalize run record file '%s' (rename: %s)",
+                path, GetErrorStr());
+            written = false;
+        }
+        if (!written)
+        {
+            unlink(tmp_path);
+        }
+    }
+    free(image);
+
+    if (written)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Wrote %zu promise outcome records to '%s'", count, path);
+        RunRecordPrune(dirname, time(NULL));
+    }
+}
@@ -0,0 +1,84 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_RUN_RECORD_H
+#define CFENGINE_RUN_RECORD_H
+
+#include <cf3.defs.h>
+
+/**
+ * Compact per-run record of promise outcomes.
+ *
+ * The totals that feed EndAudit() are only available as text logs, which
+ * compliance pipelines then re-parse per host.  This module additionally
+ * accumulates one fixed-width record per promise outcome event (promise
+ * handle, outcome, duration, timestamp) and writes them out once, at the
+ * end of the run, as a single columnar file under
+ * $(statedir)/run_records/.  The layout is fixed-width and documented
+ * below, so collectors can mmap() the file and scan the columns directly
+ * instead of tokenizing text.
+ *
+ * File layout (all integers little-endian regardless of host):
+ *
+ *     0   "CFRR"                  magic
+ *     4   u8   version            currently 1
+ *     5   u8[3]                   zero padding
+ *     8   u32  record_count       n
+ *     12  u32  handle_count       h
+ *     16  u64  run_start          unix time the agent run started
+ *     24  u64                     reserved, zero
+ *     32  u64[n]                  timestamp column (unix time)
+ *         u32[n]                  duration column (milliseconds)
+ *         u32[n]                  handle-id column (index into handle table)
+ *         u8[n]                   outcome column (PromiseResult character)
+ *         zero padding to a multiple of 8 bytes
+ *         u32  blob_size          size of the handle string blob
+ *         u32[h]                  byte offset of each handle in the blob
+ *         u8[blob_size]           NUL-terminated handle strings
+ *
+ * The recorded handle is the promise's handle attribute, falling back to
+ * the promiser.  The agent actuates promises sequentially, so the duration
+ * column holds the wall-clock time elapsed since the previous outcome
+ * event, which in practice is the time spent reaching this one; the first
+ * record of a run measures from the start of the run.
+ *
+ * The file is written atomically (temp file plus rename) and files older
+ * than a week are pruned on each write, bounding what an unattended host
+ * accumulates if nothing collects them.  cf-check's "records" command is
+ * the matching reader.
+ */
+
+/**
+ * Buffer one outcome event for #pp.  Called from ClassAuditLog() for the
+ * promises that count towards compliance totals.
+ */
+void RunRecordAppend(const Promise *pp, PromiseResult status);
+
+/**
+ * Write the buffered records of this run to disk and discard them.
+ * Writes nothing when no records were appended.
+ */
+void RunRecordCommit(void);
+
+#endif
@@ -0,0 +1,560 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <rval_flat.h>
+
+#include <rlist.h>
+#include <json.h>
+#include <string_lib.h>                                 /* StringFromDouble */
+#include <file_lib.h>                                         /* safe_fopen */
+#include <logging.h>
+
+#include <sys/mman.h>
+
+#define RVAL_FLAT_MAGIC "CFRV"
+#define RVAL_FLAT_VERSION 1
+#define RVAL_FLAT_HEADER_SIZE 8
+
+/* Containers from hostile files cannot recurse us off the stack. */
+#define RVAL_FLAT_MAX_DEPTH 128
+
+/*****************************************************************************/
+/* Encoding                                                                  */
+/*****************************************************************************/
+
+static void AppendLE32(Buffer *out, uint32_t v)
+{
+    const uint8_t bytes[4] = {
+        (uint8_t) (v & 0xff),
+        (uint8_t) ((v >> 8) & 0xff),
+        (uint8_t) ((v >> 16) & 0xff),
+        (uint8_t) ((v >> 24) & 0xff),
+    };
+    BufferAppend(out, (const char *) bytes, sizeof(bytes));
+}
+
+static void AppendLE64(Buffer *out, uint64_t v)
+{
+    AppendLE32(out, (uint32_t) (v & 0xffffffff));
+    AppendLE32(out, (uint32_t) (v >> 32));
+}
+
+/* Strings carry their length and stay NUL-terminated in the image, so the
+ * decoder neither scans nor unescapes them. */
+static void AppendString(Buffer *out, const char *s)
+{
+    const size_t len = strlen(s);
+    AppendLE32(out, (uint32_t) len);
+    BufferAppend(out, s, len + 1);
+}
+
+static bool EncodeJson(Buffer *out, const JsonElement *json)
+{
+    switch (JsonGetElementType(json))
+    {
+    case JSON_ELEMENT_TYPE_PRIMITIVE:
+        switch (JsonGetPrimitiveType(json))
+        {
+        case JSON_PRIMITIVE_TYPE_STRING:
+            BufferAppendChar(out, 'S');
+            AppendString(out, JsonPrimitiveGetAsString(json));
+            return true;
+        case JSON_PRIMITIVE_TYPE_INTEGER:
+            BufferAppendChar(out, 'I');
+            AppendLE64(out, (uint64_t) (int64_t) JsonPrimitiveGetAsInteger(json));
+            return true;
+        case JSON_PRIMITIVE_TYPE_REAL:
+        {
+            char *s = StringFromDouble(JsonPrimitiveGetAsReal(json));
+            BufferAppendChar(out, 'R');
+            AppendString(out, s);
+            free(s);
+            return true;
+        }
+        case JSON_PRIMITIVE_TYPE_BOOL:
+            BufferAppendChar(out, 'B');
+            BufferAppendChar(out, JsonPrimitiveGetAsBool(json) ? 1 : 0);
+            return true;
+        case JSON_PRIMITIVE_TYPE_NULL:
+            BufferAppendChar(out, 'N');
+            return true;
+        }
+        return false;
+
+    case JSON_ELEMENT_TYPE_CONTAINER:
+        if (JsonGetContainerType(json) == JSON_CONTAINER_TYPE_OBJECT)
+        {
+            BufferAppendChar(out, 'O');
+            AppendLE32(out, (uint32_t) JsonLength(json));
+
+            JsonIterator iter = JsonIteratorInit(json);
+            const char *key;
+            while ((key = JsonIteratorNextKey(&iter)) != NULL)
+            {
+                AppendString(out, key);
+                if (!EncodeJson(out, JsonObjectGet(json, key)))
+                {
+                    return false;
+                }
+            }
+        }
+        else
+        {
+            BufferAppendChar(out, 'A');
+            const size_t length = JsonLength(json);
+            AppendLE32(out, (uint32_t) length);
+
+            for (size_t i = 0; i < length; i++)
+            {
+                if (!EncodeJson(out, JsonArrayGet(json, i)))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool EncodeRval(Buffer *out, Rval rval)
+{
+    switch (rval.type)
+    {
+    case RVAL_TYPE_SCALAR:
+        BufferAppendChar(out, 'S');
+        AppendString(out, RvalScalarValue(rval));
+        return true;
+
+    case RVAL_TYPE_LIST:
+    {
+        BufferAppendChar(out, 'L');
+        AppendLE32(out, (uint32_t) RlistLen(RvalRlistValue(rval)));
+
+        for (const Rlist *rp = RvalRlistValue(rval); rp != NULL; rp = rp->next)
+        {
+            if (!EncodeRval(out, rp->val))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    case RVAL_TYPE_CONTAINER:
+        return EncodeJson(out, RvalContainerValue(rval));
+
+    default:
+        /* Function calls are policy, not data. */
+        return false;
+    }
+}
+
+Buffer *RvalFlatEncode(Rval rval)
+{
+    Buffer *out = BufferNew();
+
+    BufferAppend(out, RVAL_FLAT_MAGIC, strlen(RVAL_FLAT_MAGIC));
+    BufferAppendChar(out, RVAL_FLAT_VERSION);
+    BufferAppendChar(out, 0);
+    BufferAppendChar(out, 0);
+    BufferAppendChar(out, 0);
+
+    if (!EncodeRval(out, rval))
+    {
+        Log(LOG_LEVEL_ERR,
+            "Cannot flat-encode rval of type '%c'", rval.type);
+        BufferDestroy(out);
+        return NULL;
+    }
+    return out;
+}
+
+/*****************************************************************************/
+/* Decoding                                                                  */
+/*****************************************************************************/
+
+typedef struct
+{
+    const uint8_t *cursor;
+    size_t remaining;
+} FlatReader;
+
+static bool ReadBytes(FlatReader *in, const uint8_t **bytes, size_t count)
+{
+    if (in->remaining < count)
+    {
+        return false;
+    }
+    *bytes = in->cursor;
+    in->cursor += count;
+    in->remaining -= count;
+    return true;
+}
+
+static bool ReadLE32(FlatReader *in, uint32_t *v)
+{
+    const uint8_t *p;
+    if (!ReadBytes(in, &p, 4))
+    {
+        return false;
+    }
+    *v = (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+         ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+    return true;
+}
+
+static bool ReadLE64(FlatReader *in, uint64_t *v)
+{
+    uint32_t lo, hi;
+    if (!ReadLE32(in, &lo) || !ReadLE32(in, &hi))
+    {
+        return false;
+    }
+    *v = (uint64_t) lo | ((uint64_t) hi << 32);
+    return true;
+}
+
+/* A string is valid only if its claimed length fits and the terminator is
+ * where the length says; #s then points straight into the image. */
+static bool ReadString(FlatReader *in, const char **s)
+{
+    uint32_t len;
+    const uint8_t *bytes;
+
+    /* UINT32_MAX is rejected up front: on 32-bit platforms the +1 for the
+     * terminator would wrap to 0 and ReadBytes() would "succeed" reading
+     * nothing, leaving bytes[len] far outside the image. */
+    if (!ReadLE32(in, &len) || (len == UINT32_MAX) ||
+        !ReadBytes(in, &bytes, (size_t) len + 1) ||
+        (bytes[len] != '\0') || (memchr(bytes, '\0', len) != NULL))
+    {
+        return false;
+    }
+    *s = (const char *) bytes;
+    return true;
+}
+
+static bool DecodeJson(FlatReader *in, uint8_t tag, size_t depth,
+                       JsonElement **json_out);
+
+static bool DecodeTaggedJson(FlatReader *in, size_t depth,
+                             JsonElement **json_out)
+{
+    const uint8_t *tag;
+    return ReadBytes(in, &tag, 1) && DecodeJson(in, *tag, depth, json_out);
+}
+
+static bool DecodeJson(FlatReader *in, uint8_t tag, size_t depth,
+                       JsonElement **json_out)
+{
+    if (depth > RVAL_FLAT_MAX_DEPTH)
+    {
+        return false;
+    }
+
+    switch (tag)
+    {
+    case 'S':
+    {
+        const char *s;
+        if (!ReadString(in, &s))
+        {
+            return false;
+        }
+        *json_out = JsonStringCreate(s);
+        return true;
+    }
+    case 'I':
+    {
+        uint64_t v;
+        if (!ReadLE64(in, &v))
+        {
+            return false;
+        }
+        *json_out = JsonIntegerCreate64((int64_t) v);
+        return true;
+    }
+    case 'R':
+    {
+        const char *s;
+        if (!ReadString(in, &s))
+        {
+            return false;
+        }
+        *json_out = JsonRealCreate(atof(s));
+        return true;
+    }
+    case 'B':
+    {
+        const uint8_t *v;
+        if (!ReadBytes(in, &v, 1))
+        {
+            return false;
+        }
+        *json_out = JsonBoolCreate(*v != 0);
+        return true;
+    }
+    case 'N':
+        *json_out = JsonNullCreate();
+        return true;
+
+    case 'O':
+    {
+        uint32_t count;
+        if (!ReadLE32(in, &count))
+        {
+            return false;
+        }
+        JsonElement *object = JsonObjectCreate(MIN(count, 4096));
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const char *key;
+            JsonElement *child;
+            if (!ReadString(in, &key) ||
+                !DecodeTaggedJson(in, depth + 1, &child))
+            {
+                JsonDestroy(object);
+                return false;
+            }
+            JsonObjectAppendElement(object, key, child);
+        }
+        *json_out = object;
+        return true;
+    }
+    case 'A':
+    {
+        uint32_t count;
+        if (!ReadLE32(in, &count))
+        {
+            return false;
+        }
+        JsonElement *array = JsonArrayCreate(MIN(count, 4096));
+        for (uint32_t i = 0; i < count; i++)
+        {
+            JsonElement *child;
+            if (!DecodeTaggedJson(in, depth + 1, &child))
+            {
+                JsonDestroy(array);
+                return false;
+            }
+            JsonArrayAppendElement(array, child);
+        }
+        *json_out = array;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+static bool DecodeRlist(FlatReader *in, size_t depth, Rlist **list_out)
+{
+    if (depth > RVAL_FLAT_MAX_DEPTH)
+    {
+        return false;
+    }
+
+    uint32_t count;
+    if (!ReadLE32(in, &count))
+    {
+        return false;
+    }
+
+    Rlist *list = NULL;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint8_t *tag;
+        if (!ReadBytes(in, &tag, 1))
+        {
+            RlistDestroy(list);
+            return false;
+        }
+
+        if (*tag == 'S')
+        {
+            const char *s;
+            if (!ReadString(in, &s))
+            {
+                RlistDestroy(list);
+                return false;
+            }
+            RlistAppendScalar(&list, s);
+        }
+        else if (*tag == 'L')
+        {
+            Rlist *nested;
+            if (!DecodeRlist(in, depth + 1, &nested))
+            {
+                RlistDestroy(list);
+                return false;
+            }
+            RlistAppendRval(&list, (Rval) { nested, RVAL_TYPE_LIST });
+        }
+        else
+        {
+            RlistDestroy(list);
+            return false;
+        }
+    }
+    *list_out = list;
+    return true;
+}
+
+bool RvalFlatDecode(const void *data, size_t size, Rval *rval_out)
+{
+    assert(rval_out != NULL);
+
+    FlatReader in = { .cursor = data, .remaining = size };
+    const uint8_t *header;
+
+    if (!ReadBytes(&in, &header, RVAL_FLAT_HEADER_SIZE) ||
+        (memcmp(header, RVAL_FLAT_MAGIC, strlen(RVAL_FLAT_MAGIC)) != 0) ||
+        (header[4] != RVAL_FLAT_VERSION))
+    {
+        return false;
+    }
+
+    const uint8_t *tag;
+    if (!ReadBytes(&in, &tag, 1))
+    {
+        return false;
+    }
+
+    bool ok = false;
+    switch (*tag)
+    {
+    case 'S':
+    {
+        const char *s;
+        if (ReadString(&in, &s))
+        {
+            *rval_out = (Rval) { xstrdup(s), RVAL_TYPE_SCALAR };
+            ok = true;
+        }
+        break;
+    }
+    case 'L':
+    {
+        Rlist *list;
+        if (DecodeRlist(&in, 0, &list))
+        {
+            *rval_out = (Rval) { list, RVAL_TYPE_LIST };
+            ok = true;
+        }
+        break;
+    }
+    default:
+    {
+        JsonElement *json;
+        if (DecodeJson(&in, *tag, 0, &json))
+        {
+            *rval_out = (Rval) { json, RVAL_TYPE_CONTAINER };
+            ok = true;
+        }
+        break;
+    }
+    }
+
+    /* The whole image must be one value; trailing junk means truncation
+     * went unnoticed or the file is not what it claims. */
+    if (ok && in.remaining != 0)
+    {
+        RvalDestroy(*rval_out);
+        ok = false;
+    }
+    return ok;
+}
+
+/*****************************************************************************/
+/* Files                                                                     */
+/*****************************************************************************/
+
+bool RvalFlatWriteFile(const char *path, Rval rval)
+{
+    Buffer *image = RvalFlatEncode(rval);
+    if (image == NULL)
+    {
+        return false;
+    }
+
+    bool ok = false;
+    FILE *file = safe_fopen(path, "w");
+    if (file == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to open '%s' for flat rval (fopen: %s)",
+            path, GetErrorStr());
+    }
+    else
+    {
+        ok = (fwrite(BufferData(image), BufferSize(image), 1, file) == 1);
+        ok = (fclose(file) == 0) && ok;
+        if (!ok)
+        {
+            Log(LOG_LEVEL_ERR, "Failed to write flat rval to '%s' (fwrite: %s)",
+                path, GetErrorStr());
+        }
+    }
+    BufferDestroy(image);
+    return ok;
+}
+
+bool RvalFlatReadFile(const char *path, Rval *rval_out)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Could not open flat rval file '%s' (open: %s)",
+            path, GetErrorStr());
+        return false;
+    }
+
+    struct stat sb;
+    if ((fstat(fd, &sb) == -1) || (sb.st_size < RVAL_FLAT_HEADER_SIZE))
+    {
+        Log(LOG_LEVEL_ERR, "Flat rval file '%s' is missing or too short", path);
+        close(fd);
+        return false;
+    }
+    const size_t size = (size_t) sb.st_size;
+
+    /* Decode straight out of the mapping: string bytes are copied once
+     * into the values being built, nothing is tokenized. */
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        Log(LOG_LEVEL_ERR, "Could not map flat rval file '%s' (mmap: %s)",
+            path, GetErrorStr());
+        return false;
+    }
+
+    const bool ok = RvalFlatDecode(data, size, rval_out);
+    if (!ok)
+    {
+        Log(LOG_LEVEL_ERR, "Flat rval file '%s' is malformed", path);
+    }
+    munmap(data, size);
+    return ok;
+}
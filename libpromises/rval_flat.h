@@ -0,0 +1,82 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_RVAL_FLAT_H
+#define CFENGINE_RVAL_FLAT_H
+
+#include <cf3.defs.h>
+#include <buffer.h>
+
+/**
+ * Flat binary serialization of Rval values (scalars, lists and data
+ * containers).
+ *
+ * The module protocol and the data-file loaders move values through text:
+ * a module emitting a large list or container has its output re-tokenized
+ * line by line, with quoting and escaping parsed on every byte.  The flat
+ * encoding is a single contiguous buffer of length-prefixed,
+ * NUL-terminated values that a decoder walks in one pass: lengths are read
+ * instead of scanned for, and string bytes are copied verbatim into the
+ * resulting structure without any unescaping.
+ *
+ * Layout: an 8-byte header ("CFRV", u8 version, 3 bytes zero padding)
+ * followed by one element.  All integers are little-endian.  An element is
+ * a one-byte tag followed by its payload:
+ *
+ *     'S'  string/scalar:  u32 length, bytes, NUL
+ *     'L'  Rlist:          u32 count, that many elements ('S' or 'L')
+ *     'A'  JSON array:     u32 count, that many elements
+ *     'O'  JSON object:    u32 count, that many (key, element) pairs,
+ *                          where a key is encoded like 'S' without the tag
+ *     'I'  JSON integer:   i64
+ *     'R'  JSON real:      encoded like 'S' (printed representation)
+ *     'B'  JSON bool:      u8
+ *     'N'  JSON null:      no payload
+ *
+ * Function-call rvals are policy, not data, and are not encodable.
+ */
+
+/**
+ * Encode #rval into a newly allocated buffer, or return NULL if it
+ * contains something the format cannot carry (a function call).
+ */
+Buffer *RvalFlatEncode(Rval rval);
+
+/**
+ * Decode the flat-encoded image #data of #size bytes.  On success returns
+ * true and puts the decoded value in #rval_out (type RVAL_TYPE_SCALAR,
+ * RVAL_TYPE_LIST or RVAL_TYPE_CONTAINER, owned by the caller); on any
+ * structural error returns false and creates nothing.
+ */
+bool RvalFlatDecode(const void *data, size_t size, Rval *rval_out);
+
+/**
+ * Convenience wrappers moving a flat-encoded value through a file;
+ * RvalFlatReadFile() maps the file read-only and decodes straight out of
+ * the mapping.
+ */
+bool RvalFlatWriteFile(const char *path, Rval rval);
+bool RvalFlatReadFile(const char *path, Rval *rval_out);
+
+#endif
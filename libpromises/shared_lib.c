@@ -42,7 +42,24 @@ void *shlib_open(const char *lib_name)
         return NULL;
     }
 
-    void * ret = dlopen(lib_name, RTLD_NOW);
+    void *ret;
+
+#ifdef RTLD_NOLOAD
+    /* If the library is already mapped (e.g. the extension plugin probed
+     * through several candidate paths, or repeatedly opened by the tests),
+     * reuse that mapping instead of re-running relocation processing. */
+    ret = dlopen(lib_name, RTLD_NOLOAD | RTLD_LAZY);
+    if (ret != NULL)
+    {
+        return ret;
+    }
+#endif
+
+    /* Lazy binding: the plugin's exported symbols are only ever looked up
+     * explicitly through shlib_load(), and its own outgoing references are
+     * resolved on first use. Eager binding would just front-load the whole
+     * relocation pass onto every component start. */
+    ret = dlopen(lib_name, RTLD_LAZY);
     if (!ret)
     {
         Log(LOG_LEVEL_ERR, "Could not open shared library: %s\n", dlerror());
@@ -31,20 +31,80 @@
 #include <rlist.h>
 #include <item_lib.h>
 #include <ip_address.h>
+#include <misc_lib.h>                                          /* MIN */
 
 typedef bool (*LessFn)(void *lhs, void *rhs, void *ctx);
 typedef void * (*GetNextElementFn)(void *element);
 typedef void (*PutNextElementFn)(void *element, void *next);
 
-static void *Sort(void *list, LessFn less, GetNextElementFn next, PutNextElementFn putnext, void *ctx)
+/* Lists at least this long are gathered into a contiguous pointer array
+ * before merging, so the merge passes walk sequential memory instead of
+ * chasing next pointers all over the heap. Shorter lists are not worth the
+ * two array allocations and stay on the in-place list merge. */
+#define SORT_ARRAY_THRESHOLD 32
+
+/**
+ * Merge sort over a pointer array, with the same comparison semantics and
+ * tie-breaking order as SortList() below. Relinks the nodes and returns the
+ * new head when done.
+ */
+static void *SortArray(void *list, size_t length, LessFn less,
+                       GetNextElementFn next, PutNextElementFn putnext, void *ctx)
 {
-    void *p, *q, *e, *tail;
-    int insize, nmerges, psize, qsize, i;
+    void **nodes = xmalloc(length * sizeof(void *));
+    void **scratch = xmalloc(length * sizeof(void *));
 
-    if (list == NULL)
+    size_t n = 0;
+    for (void *e = list; e != NULL; e = next(e))
     {
-        return NULL;
+        nodes[n++] = e;
     }
+    assert(n == length);
+
+    for (size_t insize = 1; insize < length; insize *= 2)
+    {
+        for (size_t start = 0; start < length; start += 2 * insize)
+        {
+            const size_t mid = MIN(start + insize, length);
+            const size_t stop = MIN(start + 2 * insize, length);
+            size_t p = start;
+            size_t q = mid;
+            size_t out = start;
+
+            while (p < mid || q < stop)
+            {
+                if (q >= stop || (p < mid && less(nodes[p], nodes[q], ctx)))
+                {
+                    scratch[out++] = nodes[p++];
+                }
+                else
+                {
+                    scratch[out++] = nodes[q++];
+                }
+            }
+        }
+
+        void **swap = nodes;
+        nodes = scratch;
+        scratch = swap;
+    }
+
+    for (size_t i = 0; i + 1 < length; i++)
+    {
+        putnext(nodes[i], nodes[i + 1]);
+    }
+    putnext(nodes[length - 1], NULL);
+
+    list = nodes[0];
+    free(nodes);
+    free(scratch);
+    return list;
+}
+
+static void *SortList(void *list, LessFn less, GetNextElementFn next, PutNextElementFn putnext, void *ctx)
+{
+    void *p, *q, *e, *tail;
+    int insize, nmerges, psize, qsize, i;
 
     insize = 1;
 
@@ -143,6 +203,27 @@ static void *Sort(void *list, LessFn less, GetNextElementFn next, PutNextElement
     }
 }
 
+static void *Sort(void *list, LessFn less, GetNextElementFn next, PutNextElementFn putnext, void *ctx)
+{
+    if (list == NULL)
+    {
+        return NULL;
+    }
+
+    size_t length = 0;
+    for (void *e = list; e != NULL; e = next(e))
+    {
+        length++;
+    }
+
+    if (length >= SORT_ARRAY_THRESHOLD)
+    {
+        return SortArray(list, length, less, next, putnext, ctx);
+    }
+
+    return SortList(list, less, next, putnext, ctx);
+}
+
 /* Item* callbacks */
 
 static bool ItemNameLess(void *lhs, void *rhs, ARG_UNUSED void *ctx)
@@ -366,6 +447,184 @@ static bool RlistItemMACLess(void *lhs, void *rhs, ARG_UNUSED void *ctx)
     return StringItemMACLess(RlistScalarValue((Rlist*)lhs), RlistScalarValue((Rlist*)rhs), ctx);
 }
 
+/* Keyed Rlist sorting (decorate-sort-undecorate) */
+
+/*
+ * The typed sorters below used to parse both operands on every comparison:
+ * two sscanf() calls for int/real, two IPAddressNew() allocations for IP,
+ * and so on, repeated log n times per element. Instead, parse each element
+ * into a sort key once, merge over the contiguous key array, and relink.
+ */
+
+typedef struct
+{
+    Rlist *node;
+    const char *str;            /* scalar value, for the fallback compare */
+    bool matched;               /* whether the key parsed successfully */
+    double number;              /* int/real key */
+    IPAddress *ip;              /* IP key (owned), NULL unless parsed */
+    unsigned char mac[6];       /* MAC key */
+} RlistSortKey;
+
+typedef void (*MakeKeyFn)(RlistSortKey *key);
+typedef bool (*KeyLessFn)(const RlistSortKey *a, const RlistSortKey *b);
+
+static void NumberSortKey(RlistSortKey *key)
+{
+    char remainder[4096];
+    key->matched = ((sscanf(key->str, "%lf", &key->number) > 0) ||
+                    (sscanf(key->str, "%lf%4095s", &key->number, remainder) > 0));
+}
+
+static void IPSortKey(RlistSortKey *key)
+{
+    Buffer *buffer = BufferNewFrom(key->str, strlen(key->str));
+    key->ip = IPAddressNew(buffer);
+    BufferDestroy(buffer);
+    key->matched = (key->ip != NULL);
+}
+
+static void MACSortKey(RlistSortKey *key)
+{
+    key->matched = (ParseEtherAddress(key->str, key->mac) == 6);
+}
+
+/* Same ordering of unparsable elements as the StringItem*Less() helpers:
+ * parsed keys sort after unparsable ones, which fall back to strcmp(). */
+static bool KeyLessFallback(const RlistSortKey *a, const RlistSortKey *b)
+{
+    if (a->matched)
+    {
+        return false;
+    }
+
+    if (b->matched)
+    {
+        return true;
+    }
+
+    return strcmp(a->str, b->str) < 0;
+}
+
+static bool IntKeyLess(const RlistSortKey *a, const RlistSortKey *b)
+{
+    if (a->matched && b->matched)
+    {
+        return ((long int) a->number) < ((long int) b->number);
+    }
+
+    return KeyLessFallback(a, b);
+}
+
+static bool RealKeyLess(const RlistSortKey *a, const RlistSortKey *b)
+{
+    if (a->matched && b->matched)
+    {
+        return a->number < b->number;
+    }
+
+    return KeyLessFallback(a, b);
+}
+
+static bool IPKeyLess(const RlistSortKey *a, const RlistSortKey *b)
+{
+    if (a->matched && b->matched)
+    {
+        return IPAddressCompareLess(a->ip, b->ip);
+    }
+
+    return KeyLessFallback(a, b);
+}
+
+static bool MACKeyLess(const RlistSortKey *a, const RlistSortKey *b)
+{
+    if (a->matched && b->matched)
+    {
+        int difference = memcmp(a->mac, b->mac, sizeof(a->mac));
+        if (difference != 0)
+        {
+            return difference < 0;
+        }
+        return false;
+    }
+
+    return KeyLessFallback(a, b);
+}
+
+static Rlist *RlistKeyedSort(Rlist *list, MakeKeyFn make_key, KeyLessFn less)
+{
+    if (list == NULL)
+    {
+        return NULL;
+    }
+
+    size_t length = 0;
+    for (const Rlist *rp = list; rp != NULL; rp = rp->next)
+    {
+        length++;
+    }
+
+    RlistSortKey *keys = xcalloc(length, sizeof(RlistSortKey));
+    RlistSortKey *scratch = xmalloc(length * sizeof(RlistSortKey));
+
+    size_t n = 0;
+    for (Rlist *rp = list; rp != NULL; rp = rp->next)
+    {
+        keys[n].node = rp;
+        keys[n].str = RlistScalarValue(rp);
+        make_key(&keys[n]);
+        n++;
+    }
+
+    for (size_t insize = 1; insize < length; insize *= 2)
+    {
+        for (size_t start = 0; start < length; start += 2 * insize)
+        {
+            const size_t mid = MIN(start + insize, length);
+            const size_t stop = MIN(start + 2 * insize, length);
+            size_t p = start;
+            size_t q = mid;
+            size_t out = start;
+
+            while (p < mid || q < stop)
+            {
+                if (q >= stop || (p < mid && less(&keys[p], &keys[q])))
+                {
+                    scratch[out++] = keys[p++];
+                }
+                else
+                {
+                    scratch[out++] = keys[q++];
+                }
+            }
+        }
+
+        RlistSortKey *swap = keys;
+        keys = scratch;
+        scratch = swap;
+    }
+
+    for (size_t i = 0; i + 1 < length; i++)
+    {
+        keys[i].node->next = keys[i + 1].node;
+    }
+    keys[length - 1].node->next = NULL;
+
+    list = keys[0].node;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (keys[i].ip != NULL)
+        {
+            IPAddressDestroy(&keys[i].ip);
+        }
+    }
+    free(keys);
+    free(scratch);
+
+    return list;
+}
+
 static void *RlistGetNext(void *element)
 {
     return ((Rlist*)element)->next;
@@ -390,22 +649,22 @@ Rlist *AlphaSortRListNames(Rlist *list)
 
 Rlist *IntSortRListNames(Rlist *list)
 {
-    return Sort(list, &RlistItemIntLess, &RlistGetNext, &RlistPutNext, NULL);
+    return RlistKeyedSort(list, &NumberSortKey, &IntKeyLess);
 }
 
 Rlist *RealSortRListNames(Rlist *list)
 {
-    return Sort(list, &RlistItemRealLess, &RlistGetNext, &RlistPutNext, NULL);
+    return RlistKeyedSort(list, &NumberSortKey, &RealKeyLess);
 }
 
 Rlist *IPSortRListNames(Rlist *list)
 {
-    return Sort(list, &RlistItemIPLess, &RlistGetNext, &RlistPutNext, NULL);
+    return RlistKeyedSort(list, &IPSortKey, &IPKeyLess);
 }
 
 Rlist *MACSortRListNames(Rlist *list)
 {
-    return Sort(list, &RlistItemMACLess, &RlistGetNext, &RlistPutNext, NULL);
+    return RlistKeyedSort(list, &MACSortKey, &MACKeyLess);
 }
 
 bool GenericItemLess(const char *sort_type, void *lhs, void *rhs)
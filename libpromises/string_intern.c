@@ -0,0 +1,60 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <string_intern.h>
+
+#include <map.h>
+#include <mutex.h>
+#include <string_lib.h>
+#include <alloc.h>
+
+static Map *string_pool = NULL; /* GLOBAL_X */
+static pthread_mutex_t string_pool_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
+const char *StringIntern(const char *str)
+{
+    if (str == NULL)
+    {
+        return NULL;
+    }
+
+    ThreadLock(&string_pool_lock);
+
+    if (string_pool == NULL)
+    {
+        string_pool = MapNew(StringHash_untyped, StringEqual_untyped,
+                             free, NULL);
+    }
+
+    const char *interned = MapGet(string_pool, str);
+    if (interned == NULL)
+    {
+        char *copy = xstrdup(str);
+        MapInsert(string_pool, copy, copy);
+        interned = copy;
+    }
+
+    ThreadUnlock(&string_pool_lock);
+    return interned;
+}
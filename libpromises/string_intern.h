@@ -0,0 +1,52 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_STRING_INTERN_H
+#define CFENGINE_STRING_INTERN_H
+
+#include <platform.h>
+
+/**
+ * @file string_intern.h
+ *
+ * Process-lifetime string interning pool.
+ *
+ * Policy evaluation duplicates the same small vocabulary of strings --
+ * constraint lvals, namespace/scope/variable names -- once per copied
+ * structure, millions of times in a large run. Interning keeps one copy
+ * of each distinct string and hands out borrowed pointers to it.
+ *
+ * The pool is append-only and lives until process exit, so interned
+ * pointers never dangle and need no reference counting; the flip side
+ * is that owners of interned pointers must NOT free() them, and strings
+ * with unbounded value sets (expanded promisers, file paths) must not
+ * be interned or the pool would grow without limit.
+ */
+
+/**
+ * @return the pooled copy of #str (never freed). NULL-safe.
+ */
+const char *StringIntern(const char *str);
+
+#endif
@@ -35,6 +35,9 @@
 #include <scope.h>
 #include <fncall.h>
 #include <string_lib.h>                                  /* IsStrIn */
+#include <known_dirs.h>                                  /* GetStateDir */
+#include <file_lib.h>                                    /* safe_fopen */
+#include <writer.h>                                      /* FileWriter */
 #include <regex.h>                                       /* StringMatchFull */
 #include <misc_lib.h>
 #include <rlist.h>
@@ -1340,3 +1343,71 @@ JsonElement *SyntaxToJson(void)
 
     return syntax_tree;
 }
+
+static void SyntaxDescriptionCachePath(char *buf, size_t buf_size)
+{
+    snprintf(buf, buf_size, "%s%csyntax_description_%s.json",
+             GetStateDir(), FILE_SEPARATOR, CanonifyName(Version()));
+}
+
+/**
+ * @brief Write the JSON syntax description, serving it from a disk cache
+ *
+ * The description depends only on the compiled-in syntax tables, so it is
+ * generated once per installed version and then replayed from a cache file
+ * keyed by the version string. Editor tooling calls
+ * `cf-promises --syntax-description json` on every completion request, and
+ * rebuilding the whole tree each time dominated its latency. Any failure to
+ * read or write the cache silently falls back to regeneration.
+ */
+void SyntaxDescriptionWriteJson(Writer *out)
+{
+    char filename[CF_BUFSIZE];
+    SyntaxDescriptionCachePath(filename, sizeof(filename));
+
+    FILE *cached = safe_fopen(filename, "r");
+    if (cached != NULL)
+    {
+        char buf[CF_BUFSIZE + 1];
+        size_t num_read;
+        while ((num_read = fread(buf, 1, sizeof(buf) - 1, cached)) > 0)
+        {
+            buf[num_read] = '\0';
+            WriterWrite(out, buf);
+        }
+        fclose(cached);
+        return;
+    }
+
+    JsonElement *json_syntax = SyntaxToJson();
+    JsonWrite(out, json_syntax, 0);
+
+    /* Write to a temporary file and rename so that readers never see a
+     * truncated cache. */
+    char tmp_filename[CF_BUFSIZE];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+
+    FILE *fp = safe_fopen(tmp_filename, "w");
+    if (fp != NULL)
+    {
+        Writer *w = FileWriter(fp);
+        JsonWrite(w, json_syntax, 0);
+        WriterClose(w);
+
+        if (rename(tmp_filename, filename) != 0)
+        {
+            Log(LOG_LEVEL_DEBUG,
+                "Could not rename syntax description cache into place"
+                " ('%s' -> '%s': %s)", tmp_filename, filename, GetErrorStr());
+            unlink(tmp_filename);
+        }
+    }
+    else
+    {
+        Log(LOG_LEVEL_DEBUG,
+            "Could not write syntax description cache '%s' (fopen: %s)",
+            tmp_filename, GetErrorStr());
+    }
+
+    JsonDestroy(json_syntax);
+}
@@ -29,6 +29,7 @@
 
 #include <sequence.h>
 #include <json.h>
+#include <writer.h>
 #include <parser_helpers.h>
 
 #include <stdio.h>
@@ -90,6 +91,7 @@ const ConstraintSyntax *BodySyntaxGetConstraintSyntax(const ConstraintSyntax *bo
 const char *SyntaxStatusToString(SyntaxStatus status);
 
 JsonElement *SyntaxToJson(void);
+void SyntaxDescriptionWriteJson(Writer *out);
 
 #define ConstraintSyntaxNewNull() { NULL, CF_DATA_TYPE_NONE, .range.validation_string = NULL, .status = SYNTAX_STATUS_NORMAL }
 #define ConstraintSyntaxNewBool(lval, description, status) { lval, CF_DATA_TYPE_OPTION, .range.validation_string = CF_BOOL, description, status }
@@ -26,6 +26,7 @@
 #include <printsize.h>
 
 #include <cf3.defs.h>
+#include <cleanup.h>                            /* RegisterCleanupFunction */
 
 
 #define RFC3164_LENGTH 1024
@@ -71,7 +72,7 @@ void SetSyslogPort(uint16_t port)
     SYSLOG_PORT = port;
 }
 
-void RemoteSysLog(int log_priority, const char *log_string)
+static void RemoteSysLogSend(int log_priority, const char *log_string)
 {
     time_t now = time(NULL);
 
@@ -145,3 +146,156 @@ void RemoteSysLog(int log_priority, const char *log_string)
 
     freeaddrinfo(response);
 }
+
+/*
+ * Asynchronous delivery.
+ *
+ * RemoteSysLogSend() resolves the server and opens a socket for every single
+ * message, which is far too slow to run inline from promise evaluation.
+ * When enabled (cf-agent does so for the duration of a run), messages are
+ * queued in a bounded ring and delivered by a background thread instead, so
+ * the evaluating thread never waits on the resolver or the network.  The
+ * queue drops (and counts) messages rather than block when the drainer can't
+ * keep up.
+ *
+ * Disabled by default: short-lived callers and the unit tests keep the
+ * synchronous behaviour.
+ */
+
+#define SYSLOG_QUEUE_MAX 1024
+
+typedef struct
+{
+    int priority;
+    char *message;
+} QueuedSyslogRecord;
+
+static QueuedSyslogRecord SYSLOG_QUEUE[SYSLOG_QUEUE_MAX]; /* GLOBAL_T */
+static size_t SYSLOG_QUEUE_HEAD = 0;                    /* GLOBAL_T */
+static size_t SYSLOG_QUEUE_LEN = 0;                     /* GLOBAL_T */
+static unsigned SYSLOG_QUEUE_DROPPED = 0;               /* GLOBAL_T */
+static bool SYSLOG_ASYNC = false;                       /* GLOBAL_T */
+static bool SYSLOG_DRAIN_STOP = false;                  /* GLOBAL_T */
+static pthread_t SYSLOG_DRAIN_THREAD;                   /* GLOBAL_T */
+static bool SYSLOG_CLEANUP_REGISTERED = false;          /* GLOBAL_T */
+static pthread_mutex_t syslog_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t syslog_queue_cond = PTHREAD_COND_INITIALIZER;
+
+static void *SyslogQueueDrain(ARG_UNUSED void *unused)
+{
+    while (true)
+    {
+        pthread_mutex_lock(&syslog_queue_lock);
+        while (SYSLOG_QUEUE_LEN == 0 && !SYSLOG_DRAIN_STOP)
+        {
+            pthread_cond_wait(&syslog_queue_cond, &syslog_queue_lock);
+        }
+        if (SYSLOG_QUEUE_LEN == 0)
+        {
+            /* Stop requested and everything is flushed. */
+            pthread_mutex_unlock(&syslog_queue_lock);
+            return NULL;
+        }
+
+        QueuedSyslogRecord record = SYSLOG_QUEUE[SYSLOG_QUEUE_HEAD];
+        SYSLOG_QUEUE_HEAD = (SYSLOG_QUEUE_HEAD + 1) % SYSLOG_QUEUE_MAX;
+        SYSLOG_QUEUE_LEN--;
+
+        unsigned dropped = 0;
+        if (SYSLOG_QUEUE_LEN == 0)
+        {
+            dropped = SYSLOG_QUEUE_DROPPED;
+            SYSLOG_QUEUE_DROPPED = 0;
+        }
+        pthread_mutex_unlock(&syslog_queue_lock);
+
+        RemoteSysLogSend(record.priority, record.message);
+        free(record.message);
+
+        if (dropped > 0)
+        {
+            Log(LOG_LEVEL_INFO,
+                "Dropped %u queued syslog messages, server '%s' too slow",
+                dropped, SYSLOG_HOST);
+        }
+    }
+}
+
+static void RemoteSysLogAsyncCleanup(void)
+{
+    RemoteSysLogAsyncEnable(false);
+}
+
+void RemoteSysLogAsyncEnable(bool enable)
+{
+    pthread_mutex_lock(&syslog_queue_lock);
+
+    if (enable == SYSLOG_ASYNC)
+    {
+        pthread_mutex_unlock(&syslog_queue_lock);
+        return;
+    }
+
+    if (enable)
+    {
+        SYSLOG_DRAIN_STOP = false;
+        int ret = pthread_create(&SYSLOG_DRAIN_THREAD, NULL,
+                                 &SyslogQueueDrain, NULL);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_ERR,
+                "Could not start syslog drain thread,"
+                " keeping synchronous delivery (pthread_create: %s)",
+                GetErrorStrFromCode(ret));
+            pthread_mutex_unlock(&syslog_queue_lock);
+            return;
+        }
+        SYSLOG_ASYNC = true;
+
+        /* Make sure queued messages are flushed on any exit path. */
+        if (!SYSLOG_CLEANUP_REGISTERED)
+        {
+            RegisterCleanupFunction(&RemoteSysLogAsyncCleanup);
+            SYSLOG_CLEANUP_REGISTERED = true;
+        }
+        pthread_mutex_unlock(&syslog_queue_lock);
+    }
+    else
+    {
+        /* Stop accepting into the queue, then wait for the drain thread to
+         * flush what remains. */
+        SYSLOG_ASYNC = false;
+        SYSLOG_DRAIN_STOP = true;
+        pthread_cond_signal(&syslog_queue_cond);
+        pthread_mutex_unlock(&syslog_queue_lock);
+
+        pthread_join(SYSLOG_DRAIN_THREAD, NULL);
+    }
+}
+
+void RemoteSysLog(int log_priority, const char *log_string)
+{
+    pthread_mutex_lock(&syslog_queue_lock);
+    if (SYSLOG_ASYNC)
+    {
+        if (SYSLOG_QUEUE_LEN == SYSLOG_QUEUE_MAX)
+        {
+            SYSLOG_QUEUE_DROPPED++;
+            pthread_mutex_unlock(&syslog_queue_lock);
+            return;
+        }
+
+        const size_t tail =
+            (SYSLOG_QUEUE_HEAD + SYSLOG_QUEUE_LEN) % SYSLOG_QUEUE_MAX;
+        SYSLOG_QUEUE[tail].priority = log_priority;
+        SYSLOG_QUEUE[tail].message = xstrdup(log_string);
+        SYSLOG_QUEUE_LEN++;
+
+        pthread_cond_signal(&syslog_queue_cond);
+        pthread_mutex_unlock(&syslog_queue_lock);
+        return;
+    }
+    pthread_mutex_unlock(&syslog_queue_lock);
+
+    RemoteSysLogSend(log_priority, log_string);
+}
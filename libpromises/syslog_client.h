@@ -38,4 +38,11 @@ int GetSyslogFacility();
 
 void RemoteSysLog(int log_priority, const char *log_string);
 
+/**
+ * Deliver RemoteSysLog() messages from a background thread instead of
+ * resolving and sending inline.  Disabling (also run from the registered
+ * cleanup function on exit) flushes the queue and joins the thread.
+ */
+void RemoteSysLogAsyncEnable(bool enable);
+
 #endif
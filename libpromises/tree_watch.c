@@ -0,0 +1,529 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <tree_watch.h>
+
+#include <hash.h>                        /* HashString, HashPrintSafe */
+#include <known_dirs.h>                  /* GetStateDir */
+#include <files_lib.h>                   /* MakeParentDirectory */
+#include <file_lib.h>                    /* safe_fopen */
+#include <dir.h>
+#include <logging.h>
+#include <misc_lib.h>                    /* MAX */
+#include <alloc.h>
+
+#ifdef __linux__
+# include <sys/inotify.h>
+# include <poll.h>
+#endif
+
+/* How stale the watcher's heartbeat may get before trees are treated as
+ * unwatched. Must comfortably exceed TREE_WATCH_RESCAN_INTERVAL. */
+#define TREE_WATCH_HEARTBEAT_MAX 600
+
+/* How often the watcher re-reads registrations and refreshes the
+ * heartbeat markers. */
+#define TREE_WATCH_RESCAN_INTERVAL 60
+
+/* Upper bound on inotify watches across all trees. A tree that would
+ * push us past it gets no heartbeat and thus always scans fully. */
+#define TREE_WATCH_MAX_WATCHES 65536
+
+/**
+ * State-file path for #tree: "$(statedir)/tree_watch/<hash>.<suffix>".
+ * The hash keeps tree paths of any length and character set out of the
+ * file names.
+ */
+static bool TreeWatchStatePath(const char *tree, const char *suffix,
+                               char *buf, size_t bufsize)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    char str_digest[CF_HOSTKEY_STRING_SIZE];
+
+    HashString(tree, strlen(tree), digest, CF_DEFAULT_DIGEST);
+    HashPrintSafe(str_digest, sizeof(str_digest), digest,
+                  CF_DEFAULT_DIGEST, false);
+
+    int ret = snprintf(buf, bufsize, "%s%ctree_watch%c%s.%s",
+                       GetStateDir(), FILE_SEPARATOR, FILE_SEPARATOR,
+                       str_digest, suffix);
+    return (ret >= 0 && (size_t) ret < bufsize);
+}
+
+/**
+ * Create #path if missing, else just refresh its mtime.
+ */
+static bool TouchMarker(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT, 0600);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to create marker file '%s'. (open: %s)",
+            path, GetErrorStr());
+        return false;
+    }
+    close(fd);
+
+    if (utime(path, NULL) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to touch marker file '%s'. (utime: %s)",
+            path, GetErrorStr());
+        return false;
+    }
+    return true;
+}
+
+void TreeWatchRegister(const char *tree)
+{
+    char path[PATH_MAX];
+    if (!TreeWatchStatePath(tree, "tree", path, sizeof(path)))
+    {
+        return;
+    }
+
+    if (!MakeParentDirectory(path, true, NULL))
+    {
+        Log(LOG_LEVEL_ERR, "Failed to create directory for '%s'", path);
+        return;
+    }
+
+    FILE *fp = safe_fopen(path, "w");
+    if (fp == NULL)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Failed to register tree '%s' for change monitoring. (fopen: %s)",
+            tree, GetErrorStr());
+        return;
+    }
+    fprintf(fp, "%s\n", tree);
+    fclose(fp);
+}
+
+bool TreeWatchTreeIsClean(const char *tree, time_t max_full_scan_age)
+{
+    char path[PATH_MAX];
+    struct stat sb;
+    const time_t now = time(NULL);
+
+    if (!TreeWatchStatePath(tree, "watched", path, sizeof(path)) ||
+        stat(path, &sb) == -1 ||
+        now - sb.st_mtime > TREE_WATCH_HEARTBEAT_MAX)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Tree '%s' has no fresh change-monitor heartbeat, doing a full scan",
+            tree);
+        return false;
+    }
+
+    if (!TreeWatchStatePath(tree, "dirty", path, sizeof(path)) ||
+        stat(path, &sb) != -1)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Tree '%s' saw changes since the last full scan", tree);
+        return false;
+    }
+
+    if (!TreeWatchStatePath(tree, "scanned", path, sizeof(path)) ||
+        stat(path, &sb) == -1 ||
+        now - sb.st_mtime > max_full_scan_age)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Tree '%s' is due for a periodic full scan", tree);
+        return false;
+    }
+
+    Log(LOG_LEVEL_VERBOSE,
+        "Tree '%s' is watched and unchanged since the last full scan", tree);
+    return true;
+}
+
+void TreeWatchMarkScanned(const char *tree, time_t scan_start)
+{
+    char path[PATH_MAX];
+    if (TreeWatchStatePath(tree, "scanned", path, sizeof(path)))
+    {
+        TouchMarker(path);
+    }
+
+    /* Only clear a dirty marker that predates the scan: events that
+     * raced with the scan itself keep the tree dirty for the next run. */
+    struct stat sb;
+    if (TreeWatchStatePath(tree, "dirty", path, sizeof(path)) &&
+        stat(path, &sb) != -1 && sb.st_mtime <= scan_start)
+    {
+        unlink(path);
+    }
+}
+
+/*****************************************************************************/
+/* Watcher side (cf-execd)                                                   */
+/*****************************************************************************/
+
+#ifdef __linux__
+
+typedef struct WatchedTree_
+{
+    char *tree;
+    int watch_count;
+    bool healthy;              /* root watched and watch cap not exceeded */
+    struct WatchedTree_ *next;
+} WatchedTree;
+
+/* One entry per inotify watch descriptor, so events (which only carry
+ * the descriptor and a leaf name) can be mapped back to a tree and to
+ * the directory whose children need new watches. */
+typedef struct
+{
+    WatchedTree *tree;
+    char *dir;
+} WatchMapping;
+
+static WatchedTree *WATCHED_TREES = NULL; /* GLOBAL_T */
+static WatchMapping *WATCH_MAP = NULL; /* GLOBAL_T, indexed by watch descriptor */
+static size_t WATCH_MAP_SIZE = 0; /* GLOBAL_T */
+static int TOTAL_WATCHES = 0; /* GLOBAL_T */
+
+#define TREE_WATCH_EVENT_MASK                                           \
+    (IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MODIFY |                    \
+     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static void TreeWatchMarkDirty(const WatchedTree *wt)
+{
+    char path[PATH_MAX];
+    if (TreeWatchStatePath(wt->tree, "dirty", path, sizeof(path)))
+    {
+        TouchMarker(path);
+    }
+}
+
+/**
+ * Watch #dir on behalf of #wt and remember the mapping. Returns the
+ * watch descriptor, or -1 on failure or when the global cap is hit.
+ */
+static int WatchDirectory(int inotify_fd, WatchedTree *wt, const char *dir)
+{
+    if (TOTAL_WATCHES >= TREE_WATCH_MAX_WATCHES)
+    {
+        if (wt->healthy)
+        {
+            Log(LOG_LEVEL_WARNING,
+                "Watch limit (%d) reached, tree '%s' will not be monitored",
+                TREE_WATCH_MAX_WATCHES, wt->tree);
+        }
+        wt->healthy = false;
+        return -1;
+    }
+
+    int wd = inotify_add_watch(inotify_fd, dir, TREE_WATCH_EVENT_MASK);
+    if (wd == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Failed to watch directory '%s'. (inotify_add_watch: %s)",
+            dir, GetErrorStr());
+        return -1;
+    }
+
+    if ((size_t) wd >= WATCH_MAP_SIZE)
+    {
+        size_t new_size = MAX(WATCH_MAP_SIZE * 2, (size_t) wd + 64);
+        WATCH_MAP = xrealloc(WATCH_MAP, new_size * sizeof(WatchMapping));
+        memset(WATCH_MAP + WATCH_MAP_SIZE, 0,
+               (new_size - WATCH_MAP_SIZE) * sizeof(WatchMapping));
+        WATCH_MAP_SIZE = new_size;
+    }
+
+    if (WATCH_MAP[wd].dir == NULL)                  /* not a re-watch */
+    {
+        TOTAL_WATCHES++;
+        wt->watch_count++;
+    }
+    else
+    {
+        free(WATCH_MAP[wd].dir);
+    }
+    WATCH_MAP[wd].tree = wt;
+    WATCH_MAP[wd].dir = xstrdup(dir);
+
+    return wd;
+}
+
+/**
+ * Recursively watch #dir and its subdirectories (symlinks are not
+ * followed, matching what a depth_search with default traverse_links
+ * visits).
+ */
+static void WatchTreeRecursively(int inotify_fd, WatchedTree *wt,
+                                 const char *dir)
+{
+    if (WatchDirectory(inotify_fd, wt, dir) == -1)
+    {
+        return;
+    }
+
+    Dir *dirh = DirOpen(dir);
+    if (dirh == NULL)
+    {
+        return;
+    }
+
+    const struct dirent *dirp;
+    while ((dirp = DirRead(dirh)) != NULL)
+    {
+        if (strcmp(dirp->d_name, ".") == 0 || strcmp(dirp->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char sub[PATH_MAX];
+        int ret = snprintf(sub, sizeof(sub), "%s%c%s",
+                           dir, FILE_SEPARATOR, dirp->d_name);
+        if (ret < 0 || (size_t) ret >= sizeof(sub))
+        {
+            continue;
+        }
+
+        struct stat sb;
+        if (lstat(sub, &sb) == 0 && S_ISDIR(sb.st_mode))
+        {
+            WatchTreeRecursively(inotify_fd, wt, sub);
+        }
+    }
+    DirClose(dirh);
+}
+
+/**
+ * Read the "*.tree" registration files and set up watches for trees we
+ * have not seen yet (or failed to watch so far, e.g. because the tree
+ * did not exist). Refreshes the heartbeat of every healthy tree.
+ */
+static void RescanRegistrations(int inotify_fd)
+{
+    char watch_dir[PATH_MAX];
+    snprintf(watch_dir, sizeof(watch_dir), "%s%ctree_watch",
+             GetStateDir(), FILE_SEPARATOR);
+
+    Dir *dirh = DirOpen(watch_dir);
+    if (dirh == NULL)
+    {
+        return;                      /* nothing registered yet */
+    }
+
+    const struct dirent *dirp;
+    while ((dirp = DirRead(dirh)) != NULL)
+    {
+        const char *suffix = strrchr(dirp->d_name, '.');
+        if (suffix == NULL || strcmp(suffix, ".tree") != 0)
+        {
+            continue;
+        }
+
+        char reg_path[PATH_MAX];
+        int ret = snprintf(reg_path, sizeof(reg_path), "%s%c%s",
+                           watch_dir, FILE_SEPARATOR, dirp->d_name);
+        if (ret < 0 || (size_t) ret >= sizeof(reg_path))
+        {
+            continue;
+        }
+
+        char tree[PATH_MAX] = "";
+        FILE *fp = safe_fopen(reg_path, "r");
+        if (fp == NULL)
+        {
+            continue;
+        }
+        if (fgets(tree, sizeof(tree), fp) != NULL)
+        {
+            char *newline = strchr(tree, '\n');
+            if (newline != NULL)
+            {
+                *newline = '\0';
+            }
+        }
+        fclose(fp);
+        if (tree[0] == '\0')
+        {
+            continue;
+        }
+
+        WatchedTree *wt = WATCHED_TREES;
+        while (wt != NULL && strcmp(wt->tree, tree) != 0)
+        {
+            wt = wt->next;
+        }
+        if (wt == NULL)
+        {
+            wt = xcalloc(1, sizeof(WatchedTree));
+            wt->tree = xstrdup(tree);
+            wt->healthy = true;
+            wt->next = WATCHED_TREES;
+            WATCHED_TREES = wt;
+
+            Log(LOG_LEVEL_VERBOSE, "Monitoring tree '%s' for changes", tree);
+            WatchTreeRecursively(inotify_fd, wt, tree);
+        }
+        else if (wt->healthy && wt->watch_count == 0)
+        {
+            WatchTreeRecursively(inotify_fd, wt, tree);
+        }
+    }
+    DirClose(dirh);
+
+    for (WatchedTree *wt = WATCHED_TREES; wt != NULL; wt = wt->next)
+    {
+        if (wt->healthy && wt->watch_count > 0)
+        {
+            char path[PATH_MAX];
+            if (TreeWatchStatePath(wt->tree, "watched", path, sizeof(path)))
+            {
+                TouchMarker(path);
+            }
+        }
+    }
+}
+
+static void HandleEvent(int inotify_fd, const struct inotify_event *event)
+{
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+        /* Events were dropped: we can no longer say which trees are
+         * clean, so pessimistically dirty them all. */
+        for (WatchedTree *wt = WATCHED_TREES; wt != NULL; wt = wt->next)
+        {
+            TreeWatchMarkDirty(wt);
+        }
+        return;
+    }
+
+    if (event->wd < 0 || (size_t) event->wd >= WATCH_MAP_SIZE ||
+        WATCH_MAP[event->wd].tree == NULL)
+    {
+        return;
+    }
+    WatchedTree *wt = WATCH_MAP[event->wd].tree;
+
+    TreeWatchMarkDirty(wt);
+
+    if (event->mask & IN_IGNORED)
+    {
+        free(WATCH_MAP[event->wd].dir);
+        WATCH_MAP[event->wd].tree = NULL;
+        WATCH_MAP[event->wd].dir = NULL;
+        TOTAL_WATCHES--;
+        wt->watch_count--;
+        return;
+    }
+
+    /* New subdirectories need their own watches, or changes inside them
+     * would go unnoticed once the pending dirty marker is cleared. */
+    if ((event->mask & IN_ISDIR) &&
+        (event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+        event->len > 0)
+    {
+        char sub[PATH_MAX];
+        int ret = snprintf(sub, sizeof(sub), "%s%c%s",
+                           WATCH_MAP[event->wd].dir, FILE_SEPARATOR,
+                           event->name);
+        if (ret >= 0 && (size_t) ret < sizeof(sub))
+        {
+            WatchTreeRecursively(inotify_fd, wt, sub);
+        }
+    }
+}
+
+static void *TreeWatchThread(ARG_UNUSED void *unused)
+{
+    int inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd == -1)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Failed to initialize tree change monitoring. (inotify_init1: %s)",
+            GetErrorStr());
+        return NULL;
+    }
+
+    time_t last_rescan = 0;
+    while (true)
+    {
+        time_t now = time(NULL);
+        if (now - last_rescan >= TREE_WATCH_RESCAN_INTERVAL)
+        {
+            RescanRegistrations(inotify_fd);
+            last_rescan = now;
+        }
+
+        struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, TREE_WATCH_RESCAN_INTERVAL * 1000);
+        if (ready <= 0)
+        {
+            continue;        /* timeout or EINTR: go refresh heartbeats */
+        }
+
+        char buf[8 * 1024]
+            __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len <= 0)
+        {
+            continue;
+        }
+
+        for (ssize_t offset = 0; offset < len;)
+        {
+            const struct inotify_event *event =
+                (const struct inotify_event *) (buf + offset);
+            HandleEvent(inotify_fd, event);
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return NULL;
+}
+
+void TreeWatchDaemonStart(void)
+{
+    pthread_attr_t attrs;
+    pthread_attr_init(&attrs);
+    pthread_attr_setdetachstate(&attrs, PTHREAD_CREATE_DETACHED);
+
+    pthread_t tid;
+    int ret = pthread_create(&tid, &attrs, &TreeWatchThread, NULL);
+    if (ret != 0)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Failed to start tree change monitoring thread. (pthread_create: %s)",
+            GetErrorStrFromCode(ret));
+    }
+    pthread_attr_destroy(&attrs);
+}
+
+#else  /* !__linux__ */
+
+void TreeWatchDaemonStart(void)
+{
+    /* No inotify: registered trees never get a heartbeat and thus
+     * always do the normal full scan. */
+    Log(LOG_LEVEL_VERBOSE,
+        "Tree change monitoring is not supported on this platform");
+}
+
+#endif  /* __linux__ */
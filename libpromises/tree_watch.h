@@ -0,0 +1,81 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_TREE_WATCH_H
+#define CFENGINE_TREE_WATCH_H
+
+#include <platform.h>
+
+/**
+ * @file tree_watch.h
+ *
+ * Change monitoring for depth_search trees (body depth_search monitor).
+ *
+ * cf-agent registers the trees it scans, cf-execd (which outlives agent
+ * runs) keeps inotify watches on them, and the next agent run may skip
+ * the recursive re-scan when the monitor reports the tree unchanged.
+ * The two sides only communicate through small marker files under
+ * "$(statedir)/tree_watch/", keyed by a hash of the tree path:
+ *
+ *   <hash>.tree     tree path, written by the agent (registration)
+ *   <hash>.watched  touched by cf-execd while watches are in place
+ *                   (its mtime is the watcher's heartbeat)
+ *   <hash>.dirty    created by cf-execd when any event fires under
+ *                   the tree, removed by the agent after a full scan
+ *   <hash>.scanned  touched by the agent after a completed full scan
+ *
+ * A tree is only considered clean when the heartbeat is fresh, no dirty
+ * marker exists and the last full scan is recent enough -- so a stopped
+ * cf-execd, a watch registration failure or plain old age all degrade
+ * safely to the normal full scan.
+ */
+
+/**
+ * Ask the resident watcher (if any) to keep an eye on #tree. Safe to
+ * call on every agent run; registration is idempotent.
+ */
+void TreeWatchRegister(const char *tree);
+
+/**
+ * Whether #tree is being watched and has seen no events since the last
+ * completed full scan, which itself is no older than
+ * #max_full_scan_age seconds. False means: do the full scan.
+ */
+bool TreeWatchTreeIsClean(const char *tree, time_t max_full_scan_age);
+
+/**
+ * Record that a full scan of #tree which started at #scan_start just
+ * completed, clearing any dirty marker that predates the scan.
+ */
+void TreeWatchMarkScanned(const char *tree, time_t scan_start);
+
+/**
+ * Start the resident watcher thread (called by cf-execd). Reads the
+ * registered trees periodically and maintains inotify watches on them.
+ * No-op on platforms without inotify; registered trees then simply
+ * never report clean.
+ */
+void TreeWatchDaemonStart(void);
+
+#endif
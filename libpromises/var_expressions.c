@@ -27,14 +27,17 @@
 #include <cf3.defs.h>
 #include <buffer.h>
 #include <misc_lib.h>
+#include <string_intern.h>
 #include <string_lib.h>
 #include <scope.h>
+#include <map.h>
+#include <mutex.h>
 
 // This is not allowed to be the part of VarRef.indices so looks safe
 // to be used as multi array indices separator while hashing.
 #define ARRAY_SEPARATOR_HASH ']'
 
-static unsigned VarRefHash(const VarRef *ref)
+static unsigned VarRefHashCompute(const VarRef *ref)
 {
     unsigned int h = 0;
 
@@ -94,6 +97,18 @@ static unsigned VarRefHash(const VarRef *ref)
     return h;
 }
 
+static unsigned VarRefHash(const VarRef *ref)
+{
+    if (ref->hash == 0)
+    {
+        /* hash doubles as a "not yet computed" flag, so a value that
+         * genuinely hashes to 0 is recomputed on every call; that only
+         * costs time, never a wrong answer. */
+        ((VarRef *) ref)->hash = VarRefHashCompute(ref);
+    }
+    return ref->hash;
+}
+
 unsigned int VarRefHash_untyped(const void *ref,
                                 unsigned int seed ARG_UNUSED)
 {
@@ -109,6 +124,7 @@ VarRef VarRefConst(const char *ns, const char *scope, const char *lval)
     ref.lval = (char *)lval;
     ref.num_indices = 0;
     ref.indices = NULL;
+    ref.hash = 0;
 
     return ref;
 }
@@ -117,9 +133,10 @@ VarRef *VarRefCopy(const VarRef *ref)
 {
     VarRef *copy = xmalloc(sizeof(VarRef));
 
-    copy->ns = ref->ns ? xstrdup(ref->ns) : NULL;
-    copy->scope = ref->scope ? xstrdup(ref->scope) : NULL;
-    copy->lval = ref->lval ? xstrdup(ref->lval) : NULL;
+    copy->ns = (char *) StringIntern(ref->ns);
+    copy->scope = (char *) StringIntern(ref->scope);
+    copy->lval = (char *) StringIntern(ref->lval);
+    copy->hash = ref->hash;
 
     copy->num_indices = ref->num_indices;
     if (ref->num_indices > 0)
@@ -143,8 +160,9 @@ VarRef *VarRefCopyLocalized(const VarRef *ref)
     VarRef *copy = xmalloc(sizeof(VarRef));
 
     copy->ns = NULL;
-    copy->scope = xstrdup("this");
-    copy->lval = ref->lval ? xstrdup(ref->lval) : NULL;
+    copy->scope = (char *) StringIntern("this");
+    copy->lval = (char *) StringIntern(ref->lval);
+    copy->hash = 0;
 
     copy->num_indices = ref->num_indices;
     if (ref->num_indices > 0)
@@ -167,11 +185,12 @@ VarRef *VarRefCopyIndexless(const VarRef *ref)
 {
     VarRef *copy = xmalloc(sizeof(VarRef));
 
-    copy->ns = ref->ns ? xstrdup(ref->ns) : NULL;
-    copy->scope = ref->scope ? xstrdup(ref->scope) : NULL;
-    copy->lval = ref->lval ? xstrdup(ref->lval) : NULL;
+    copy->ns = (char *) StringIntern(ref->ns);
+    copy->scope = (char *) StringIntern(ref->scope);
+    copy->lval = (char *) StringIntern(ref->lval);
     copy->num_indices = 0;
     copy->indices = NULL;
+    copy->hash = 0;
 
     return copy;
 }
@@ -329,11 +348,16 @@ VarRef *VarRefParseFromNamespaceAndScope(const char *qualified_name,
 
     VarRef *ref = xmalloc(sizeof(VarRef));
 
-    ref->ns = ns ? ns : (_ns ? xstrdup(_ns) : NULL);
-    ref->scope = scope ? scope : (_scope ? xstrdup(_scope) : NULL);
-    ref->lval = lval;
+    ref->ns = (char *) StringIntern(ns ? ns : _ns);
+    ref->scope = (char *) StringIntern(scope ? scope : _scope);
+    ref->lval = (char *) StringIntern(lval);
     ref->indices = indices;
     ref->num_indices = num_indices;
+    ref->hash = 0;
+
+    free(ns);
+    free(scope);
+    free(lval);
 
     return ref;
 }
@@ -361,9 +385,40 @@ bool is_this_not_special(const char *scope, const char *lval) {
     return true;
 }
 
+static Map *parse_cache = NULL; /* GLOBAL_X */
+static pthread_mutex_t parse_cache_lock = PTHREAD_MUTEX_INITIALIZER; /* GLOBAL_T */
+
 VarRef *VarRefParse(const char *var_ref_string)
 {
-    return VarRefParseFromNamespaceAndScope(var_ref_string, NULL, NULL, CF_NS, '.');
+    /* Index-free references draw from the bounded vocabulary of variable
+     * names in the policy, so parsed templates can be cached for the
+     * lifetime of the process. Indexed references can embed arbitrary
+     * expanded values and are always parsed directly. */
+    if (strchr(var_ref_string, '[') != NULL)
+    {
+        return VarRefParseFromNamespaceAndScope(var_ref_string, NULL, NULL, CF_NS, '.');
+    }
+
+    ThreadLock(&parse_cache_lock);
+
+    if (parse_cache == NULL)
+    {
+        parse_cache = MapNew(StringHash_untyped, StringEqual_untyped,
+                             free, NULL);
+    }
+
+    VarRef *cached = MapGet(parse_cache, var_ref_string);
+    if (cached == NULL)
+    {
+        cached = VarRefParseFromNamespaceAndScope(var_ref_string, NULL, NULL, CF_NS, '.');
+        VarRefHash(cached);     /* copies below inherit the stored hash */
+        MapInsert(parse_cache, xstrdup(var_ref_string), cached);
+    }
+
+    VarRef *ref = VarRefCopy(cached);
+
+    ThreadUnlock(&parse_cache_lock);
+    return ref;
 }
 
 VarRef *VarRefParseFromScope(const char *var_ref_string, const char *scope)
@@ -410,9 +465,7 @@ void VarRefDestroy(VarRef *ref)
 {
     if (ref)
     {
-        free(ref->ns);
-        free(ref->scope);
-        free(ref->lval);
+        /* ns, scope and lval are borrowed from the intern pool. */
         if (ref->num_indices > 0)
         {
             for (size_t i = 0; i < ref->num_indices; ++i)
@@ -502,17 +555,21 @@ void VarRefSetMeta(VarRef *ref, bool enabled)
         if (!VarRefIsMeta(ref))
         {
             char *tmp = StringConcatenate(2, ref->scope, "_meta");
-            free(ref->scope);
-            ref->scope = tmp;
+            ref->scope = (char *) StringIntern(tmp);
+            ref->hash = 0;
+            free(tmp);
         }
     }
     else
     {
         if (VarRefIsMeta(ref))
         {
-            char *tmp = ref->scope;
-            size_t len = strlen(ref->scope);
-            memcpy(ref->scope, StringSubstring(ref->scope, len, 0, len - strlen("_meta")), len - strlen("_meta"));
+            /* The pooled string is shared: derive the stripped scope in a
+             * private buffer, never in place. */
+            char *tmp = xstrndup(ref->scope,
+                                 strlen(ref->scope) - strlen("_meta"));
+            ref->scope = (char *) StringIntern(tmp);
+            ref->hash = 0;
             free(tmp);
         }
     }
@@ -527,14 +584,9 @@ void VarRefQualify(VarRef *ref, const char *ns, const char *scope)
 {
     assert(scope);
 
-    free(ref->ns);
-    ref->ns = NULL;
-
-    free(ref->scope);
-    ref->scope = NULL;
-
-    ref->ns = ns ? xstrdup(ns) : NULL;
-    ref->scope = xstrdup(scope);
+    ref->ns = (char *) StringIntern(ns);
+    ref->scope = (char *) StringIntern(scope);
+    ref->hash = 0;
 }
 
 void VarRefAddIndex(VarRef *ref, const char *index)
@@ -552,6 +604,7 @@ void VarRefAddIndex(VarRef *ref, const char *index)
 
     ref->indices[ref->num_indices] = xstrdup(index);
     ref->num_indices++;
+    ref->hash = 0;
 }
 
 int VarRefCompare(const VarRef *a, const VarRef *b)
@@ -40,12 +40,20 @@
 */
 typedef struct
 {
+    /* ns, scope and lval are borrowed from the process-lifetime intern
+     * pool (string_intern.h): VarRefDestroy() does not free them, and
+     * any code replacing them must store interned pointers. Indices can
+     * hold arbitrary expanded values, so they stay owned. */
     char *ns;
     char *scope;
     char *lval;
     char **indices;
     size_t num_indices;
 
+    /* Cached VarRefHash() value, 0 meaning "not yet computed". Any code
+     * replacing the fields above must reset it to 0. */
+    unsigned int hash;
+
     /* TODO performance: when using VarRefCopy() we just need to allocate one
      *      big chunk with malloc() and all pointers can point in there.  This
      *      whole struct can be a single malloc'ed chunk with array[] space in
@@ -38,8 +38,25 @@ struct Variable_
     StringSet *tags;
     char *comment;
     const Promise *promise; // The promise that set the present value
+
+    /* Lazily built index over a container rval: encoded index path ->
+     * JsonElement inside rval. Children are borrowed, the index is dropped
+     * together with (or on replacement of) the rval. */
+    Map *json_index;
+
+    /* Large scalar-only lists are stored as one contiguous block of
+     * NUL-terminated strings instead of an Rlist (rval.item stays NULL).
+     * The block is inflated into a real Rlist on first read, so variables
+     * that are defined but never read this run keep the compact form. */
+    char *packed;
+    size_t packed_size;
+    size_t packed_items;
 };
 
+/* Lists shorter than this keep the plain Rlist form: the per-node overhead
+ * only matters for inventory-sized lists, and small ones are usually read. */
+#define VARIABLE_PACK_MIN_ITEMS 256
+
 static Variable *VariableNew(VarRef *ref, Rval rval, DataType type,
                              StringSet *tags, char *comment,
                              const Promise *promise)
@@ -52,10 +69,87 @@ static Variable *VariableNew(VarRef *ref, Rval rval, DataType type,
     var->tags = tags;
     var->comment = comment;
     var->promise = promise;
+    var->json_index = NULL;
+    var->packed = NULL;
+    var->packed_size = 0;
+    var->packed_items = 0;
 
     return var;
 }
 
+/**
+ * Serialize a list into one block of consecutive NUL-terminated strings.
+ *
+ * Returns NULL (leaving the caller to store the list as-is) unless the list
+ * has at least #VARIABLE_PACK_MIN_ITEMS items, all of them scalars. Order is
+ * preserved: slist order is semantically meaningful, so no sorting or
+ * prefix-sharing tricks are applied.
+ */
+static char *VariableListPack(const Rlist *list,
+                              size_t *size_out, size_t *items_out)
+{
+    size_t items = 0;
+    size_t size = 0;
+
+    for (const Rlist *rp = list; rp != NULL; rp = rp->next)
+    {
+        if (rp->val.type != RVAL_TYPE_SCALAR)
+        {
+            return NULL;
+        }
+        size += strlen(RlistScalarValue(rp)) + 1;
+        items++;
+    }
+
+    if (items < VARIABLE_PACK_MIN_ITEMS)
+    {
+        return NULL;
+    }
+
+    char *packed = xmalloc(size);
+    char *p = packed;
+    for (const Rlist *rp = list; rp != NULL; rp = rp->next)
+    {
+        const char *scalar = RlistScalarValue(rp);
+        const size_t len = strlen(scalar) + 1;
+        memcpy(p, scalar, len);
+        p += len;
+    }
+
+    *size_out = size;
+    *items_out = items;
+    return packed;
+}
+
+/**
+ * Rebuild the Rlist from a packed block and drop the block. Once read, the
+ * variable is hot and stays an ordinary list.
+ */
+static void VariableInflate(Variable *var)
+{
+    assert(var->packed != NULL);
+    assert(var->rval.type == RVAL_TYPE_LIST && var->rval.item == NULL);
+
+    Rlist *list = NULL;
+    const char *p = var->packed;
+    const char *const end = var->packed + var->packed_size;
+
+    /* Prepend (O(1) per item) and reverse once, instead of appending with a
+     * tail walk each time. */
+    while (p < end)
+    {
+        RlistPrepend(&list, p, RVAL_TYPE_SCALAR);
+        p += strlen(p) + 1;
+    }
+    RlistReverse(&list);
+
+    var->rval.item = list;
+    free(var->packed);
+    var->packed = NULL;
+    var->packed_size = 0;
+    var->packed_items = 0;
+}
+
 /* DO NOT EXPORT, this is for internal (hash table) use only, and it doesn't
  * free everything in Variable, in particular it leaves var->ref to be handled
  * by the Map implementation calling the key-destroy function. */
@@ -66,6 +160,8 @@ static void VariableDestroy(Variable *var)
         RvalDestroy(var->rval);
         StringSetDestroy(var->tags);
         free(var->comment);
+        MapDestroy(var->json_index);
+        free(var->packed);
         // Nothing to do for ->promise
 
         free(var);
@@ -126,6 +222,12 @@ Rval VariableGetRval(const Variable *var, bool get_secret)
     {
         return RvalNewSecret();
     }
+    if (var->packed != NULL)
+    {
+        /* Logically const: the value the caller observes is unchanged, only
+         * its representation switches from packed block to Rlist. */
+        VariableInflate((Variable *) var);
+    }
     return var->rval;
 }
 
@@ -134,6 +236,53 @@ void VariableSetRval(Variable *var, Rval new_rval)
     assert(var != NULL);
     RvalDestroy(var->rval);
     var->rval = new_rval;
+
+    /* The index points into the old rval. */
+    MapDestroy(var->json_index);
+    var->json_index = NULL;
+
+    /* Same for any packed form of the old value. */
+    free(var->packed);
+    var->packed = NULL;
+    var->packed_size = 0;
+    var->packed_items = 0;
+}
+
+JsonElement *VariableSelectContainerChild(Variable *var,
+                                          size_t num_indices, char **indices)
+{
+    assert(var != NULL);
+    assert(var->rval.type == RVAL_TYPE_CONTAINER);
+    assert(num_indices > 0);
+
+    Buffer *key = BufferNew();
+    for (size_t i = 0; i < num_indices; i++)
+    {
+        /* Length-prefix every component so index values containing any
+         * would-be separator cannot collide. */
+        BufferAppendF(key, "%zu:", strlen(indices[i]));
+        BufferAppendString(key, indices[i]);
+    }
+
+    if (var->json_index == NULL)
+    {
+        var->json_index = MapNew(StringHash_untyped, StringEqual_untyped,
+                                 free, NULL);
+    }
+
+    JsonElement *child = MapGet(var->json_index, BufferData(key));
+    if (child == NULL)
+    {
+        child = JsonSelect(RvalContainerValue(var->rval),
+                           num_indices, indices);
+        if (child != NULL)
+        {
+            MapInsert(var->json_index, xstrdup(BufferData(key)), child);
+        }
+    }
+
+    BufferDestroy(key);
+    return child;
 }
 
 /**
@@ -148,23 +297,113 @@ TYPED_MAP_DEFINE(Var, VarRef *, Variable *,
                  VarRefDestroy_untyped,
                  VariableDestroy_untyped)
 
+/**
+   Define "ScopeIndex" hash table: a secondary index of the table.
+       Key:   scope name (e.g. the bundle name)
+       Value: Seq of (Variable *), NOT owned -- the VarMap owns them
+
+   Scope-filtered iteration (done for the whole global table on every bundle
+   frame push) walks just the scope's bucket instead of the entire map.
+*/
+static void SeqDestroy_untyped(void *p)
+{
+    Seq *s = p;
+    SeqDestroy(s);
+}
+
+TYPED_MAP_DECLARE(ScopeIndex, char *, Seq *)
+TYPED_MAP_DEFINE(ScopeIndex, char *, Seq *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 SeqDestroy_untyped)
+
+
+/**
+   Bloom filter over the lvals ever put in a table.
+
+   Negative lookups (common for optional variables probed via isvariable()
+   and defaults) otherwise pay the full hash-table probe per frame. The
+   filter is append-only: removes leave their bits set, which can only
+   cause a spurious probe, never a wrong NULL.
+*/
+#define LVAL_FILTER_BITS 4096
 
 struct VariableTable_
 {
     VarMap *vars;
+    ScopeIndexMap *scope_index;
+    uint64_t lval_filter[LVAL_FILTER_BITS / 64];
 };
 
+static void LvalFilterAdd(VariableTable *table, const char *lval)
+{
+    const unsigned int h = StringHash(lval, 0);
+    const unsigned int bit1 = h % LVAL_FILTER_BITS;
+    const unsigned int bit2 = (h >> 12) % LVAL_FILTER_BITS;
+
+    table->lval_filter[bit1 / 64] |= ((uint64_t) 1) << (bit1 % 64);
+    table->lval_filter[bit2 / 64] |= ((uint64_t) 1) << (bit2 % 64);
+}
+
+static bool LvalFilterMightContain(const VariableTable *table, const char *lval)
+{
+    const unsigned int h = StringHash(lval, 0);
+    const unsigned int bit1 = h % LVAL_FILTER_BITS;
+    const unsigned int bit2 = (h >> 12) % LVAL_FILTER_BITS;
+
+    return (((table->lval_filter[bit1 / 64] >> (bit1 % 64)) & 1) != 0 &&
+            ((table->lval_filter[bit2 / 64] >> (bit2 % 64)) & 1) != 0);
+}
+
 struct VariableTableIterator_
 {
     VarRef *ref;
     MapIterator iter;
+
+    /* When the filter names a scope, we iterate that scope's bucket of the
+     * index instead of the whole map; see VariableTableIteratorNext(). */
+    const Seq *bucket;
+    size_t bucket_pos;
+    bool scope_indexed;
 };
 
+static void ScopeIndexAdd(VariableTable *table, Variable *var)
+{
+    Seq *bucket = ScopeIndexMapGet(table->scope_index, var->ref->scope);
+    if (bucket == NULL)
+    {
+        bucket = SeqNew(16, NULL);
+        ScopeIndexMapInsert(table->scope_index,
+                            xstrdup(var->ref->scope), bucket);
+    }
+    SeqAppend(bucket, var);
+}
+
+static void ScopeIndexRemove(VariableTable *table, const Variable *var)
+{
+    Seq *bucket = ScopeIndexMapGet(table->scope_index, var->ref->scope);
+    if (bucket != NULL)
+    {
+        const size_t length = SeqLength(bucket);
+        for (size_t i = 0; i < length; i++)
+        {
+            if (SeqAt(bucket, i) == var)
+            {
+                SeqRemove(bucket, i);
+                return;
+            }
+        }
+    }
+}
+
 VariableTable *VariableTableNew(void)
 {
     VariableTable *table = xmalloc(sizeof(VariableTable));
 
     table->vars = VarMapNew();
+    table->scope_index = ScopeIndexMapNew();
+    memset(table->lval_filter, 0, sizeof(table->lval_filter));
 
     return table;
 }
@@ -173,6 +412,7 @@ void VariableTableDestroy(VariableTable *table)
 {
     if (table)
     {
+        ScopeIndexMapDestroy(table->scope_index);
         VarMapDestroy(table->vars);
         free(table);
     }
@@ -181,6 +421,16 @@ void VariableTableDestroy(VariableTable *table)
 /* NULL return value means variable not found. */
 Variable *VariableTableGet(const VariableTable *table, const VarRef *ref)
 {
+    /* O(1) rejection of names never put in this table. Skipped when the
+     * vartable log module is enabled so the NOT FOUND line below is still
+     * emitted for every miss. */
+    if (ref->lval != NULL &&
+        !LvalFilterMightContain(table, ref->lval) &&
+        !LogModuleEnabled(LOG_MOD_VARTABLE))
+    {
+        return NULL;
+    }
+
     Variable *v = VarMapGet(table->vars, ref);
 
     char *ref_s = VarRefToString(ref, true);              /* TODO optimise */
@@ -202,8 +452,13 @@ Variable *VariableTableGet(const VariableTable *table, const VarRef *ref)
         {
             char *value_s;
             BufferAppendString(buf, "  => ");
-            if (DataTypeIsIterable(v->type) &&
-                v->rval.item == NULL)
+            if (v->packed != NULL)
+            {
+                xasprintf(&value_s, "PACKED LIST (%zu items)",
+                          v->packed_items);
+            }
+            else if (DataTypeIsIterable(v->type) &&
+                     v->rval.item == NULL)
             {
                 value_s = xstrdup("EMPTY");
             }
@@ -227,6 +482,11 @@ Variable *VariableTableGet(const VariableTable *table, const VarRef *ref)
 
 bool VariableTableRemove(VariableTable *table, const VarRef *ref)
 {
+    Variable *var = VarMapGet(table->vars, ref);
+    if (var != NULL)
+    {
+        ScopeIndexRemove(table, var);
+    }
     return VarMapRemove(table->vars, ref);
 }
 
@@ -252,8 +512,37 @@ bool VariableTablePut(VariableTable *table, const VarRef *ref,
               "VariableTablePut(): "
               "Only iterables (Rlists) are allowed to be NULL");
 
-    Variable *var = VariableNew(VarRefCopy(ref), RvalCopy(*rval), type,
-                                tags, comment, promise);
+    /* VarMapInsert() destroys any overwritten entry, so take it out of the
+     * scope index first. */
+    Variable *existing = VarMapGet(table->vars, ref);
+    if (existing != NULL)
+    {
+        ScopeIndexRemove(table, existing);
+    }
+
+    Variable *var;
+    char *packed = NULL;
+    size_t packed_size = 0, packed_items = 0;
+    if (rval->type == RVAL_TYPE_LIST && DataTypeIsIterable(type) &&
+        (packed = VariableListPack(rval->item,
+                                   &packed_size, &packed_items)) != NULL)
+    {
+        /* Store large scalar lists packed instead of deep-copying them; the
+         * caller keeps ownership of the original either way. */
+        var = VariableNew(VarRefCopy(ref),
+                          (Rval) {NULL, RVAL_TYPE_LIST}, type,
+                          tags, comment, promise);
+        var->packed = packed;
+        var->packed_size = packed_size;
+        var->packed_items = packed_items;
+    }
+    else
+    {
+        var = VariableNew(VarRefCopy(ref), RvalCopy(*rval), type,
+                          tags, comment, promise);
+    }
+    ScopeIndexAdd(table, var);
+    LvalFilterAdd(table, var->ref->lval);
     return VarMapInsert(table->vars, var->ref, var);
 }
 
@@ -264,6 +553,8 @@ bool VariableTableClear(VariableTable *table, const char *ns, const char *scope,
     if (!ns && !scope && !lval)
     {
         VarMapClear(table->vars);
+        ScopeIndexMapClear(table->scope_index);
+        memset(table->lval_filter, 0, sizeof(table->lval_filter));
         bool has_vars = (vars_num > 0);
         return has_vars;
     }
@@ -329,7 +620,18 @@ VariableTableIterator *VariableTableIteratorNewFromVarRef(const VariableTable *t
     VariableTableIterator *iter = xmalloc(sizeof(VariableTableIterator));
 
     iter->ref = VarRefCopy(ref);
-    iter->iter = MapIteratorInit(table->vars->impl);
+    iter->scope_indexed = (ref->scope != NULL);
+
+    if (iter->scope_indexed)
+    {
+        /* NULL bucket (scope holds no variables) yields an empty iterator. */
+        iter->bucket = ScopeIndexMapGet(table->scope_index, ref->scope);
+        iter->bucket_pos = 0;
+    }
+    else
+    {
+        iter->iter = MapIteratorInit(table->vars->impl);
+    }
 
     return iter;
 }
@@ -344,54 +646,72 @@ VariableTableIterator *VariableTableIteratorNew(const VariableTable *table, cons
     return VariableTableIteratorNewFromVarRef(table, &ref);
 }
 
-Variable *VariableTableIteratorNext(VariableTableIterator *iter)
+static bool VariableMatchesFilter(const Variable *var, const VarRef *filter)
 {
-    MapKeyValue *keyvalue;
+    const char *key_ns = var->ref->ns ? var->ref->ns : "default";
 
-    while ((keyvalue = MapIteratorNext(&iter->iter)) != NULL)
+    if (filter->ns && strcmp(key_ns, filter->ns) != 0)
     {
-        Variable *var = keyvalue->value;
-        const char *key_ns = var->ref->ns ? var->ref->ns : "default";
+        return false;
+    }
 
-        if (iter->ref->ns && strcmp(key_ns, iter->ref->ns) != 0)
-        {
-            continue;
-        }
+    if (filter->scope && strcmp(var->ref->scope, filter->scope) != 0)
+    {
+        return false;
+    }
 
-        if (iter->ref->scope && strcmp(var->ref->scope, iter->ref->scope) != 0)
-        {
-            continue;
-        }
+    if (filter->lval && strcmp(var->ref->lval, filter->lval) != 0)
+    {
+        return false;
+    }
 
-        if (iter->ref->lval && strcmp(var->ref->lval, iter->ref->lval) != 0)
+    if (filter->num_indices > 0)
+    {
+        if (filter->num_indices > var->ref->num_indices)
         {
-            continue;
+            return false;
         }
 
-        if (iter->ref->num_indices > 0)
+        for (size_t i = 0; i < filter->num_indices; i++)
         {
-            if (iter->ref->num_indices > var->ref->num_indices)
+            if (strcmp(var->ref->indices[i], filter->indices[i]) != 0)
             {
-                continue;
+                return false;
             }
+        }
+    }
 
-            bool match = true;
-            for (size_t i = 0; i < iter->ref->num_indices; i++)
-            {
-                if (strcmp(var->ref->indices[i], iter->ref->indices[i]) != 0)
-                {
-                    match = false;
-                    break;
-                }
-            }
+    return true;
+}
 
-            if (!match)
+Variable *VariableTableIteratorNext(VariableTableIterator *iter)
+{
+    if (iter->scope_indexed)
+    {
+        while (iter->bucket != NULL && iter->bucket_pos < SeqLength(iter->bucket))
+        {
+            Variable *var = SeqAt(iter->bucket, iter->bucket_pos);
+            iter->bucket_pos++;
+
+            if (VariableMatchesFilter(var, iter->ref))
             {
-                continue;
+                return var;
             }
         }
 
-        return var;
+        return NULL;
+    }
+
+    MapKeyValue *keyvalue;
+
+    while ((keyvalue = MapIteratorNext(&iter->iter)) != NULL)
+    {
+        Variable *var = keyvalue->value;
+
+        if (VariableMatchesFilter(var, iter->ref))
+        {
+            return var;
+        }
     }
 
     return NULL;
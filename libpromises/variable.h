@@ -61,6 +61,16 @@ void VariableSetRval(Variable *var, Rval new_rval);
  */
 bool VariableIsSecret(const Variable *var);
 
+/**
+ * Select a child of a container variable by index path, like JsonSelect(),
+ * memoized per variable so repeated dereferences of the same path are O(1).
+ *
+ * @note The returned element is borrowed from the variable's rval. The
+ *       variable must be of type CF_DATA_TYPE_CONTAINER.
+ */
+JsonElement *VariableSelectContainerChild(Variable *var,
+                                          size_t num_indices, char **indices);
+
 VariableTable *VariableTableNew(void);
 void VariableTableDestroy(VariableTable *table);
 
@@ -35,10 +35,203 @@
 #include <logic_expressions.h>
 #include <string_lib.h>                                  /* StringHash */
 #include <regex.h>                                       /* StringMatchFull */
+#include <map.h>                                         /* Map */
+#include <writer.h>                                      /* StringWriter */
 
 
 static bool EvalClassExpression(EvalContext *ctx, Constraint *cp, const Promise *pp);
 static PromiseResult VerifyClassCancel(EvalContext *ctx, const Promise *pp, Attributes *a);
+static PromiseResult VerifyClassPromiseInner(EvalContext *ctx, const Promise *pp);
+
+/* --- Sparse re-evaluation of classes promises ---------------------------
+ *
+ * A bundle's classes promises are re-run on every evaluation pass until the
+ * class state reaches a fixpoint.  Most of them are pure boolean functions
+ * of other classes, so re-running one whose inputs did not change since the
+ * last pass re-derives the same verdict at full expression-evaluation cost.
+ *
+ * For those pure promises we record which class atoms the guard and the
+ * expression read (by parsing them with the same grammar the evaluator
+ * uses) together with the defined-state of each atom at the last
+ * evaluation.  Later passes skip the promise outright while the states
+ * still match, so a pass over N classes promises re-evaluates only the ones
+ * downstream of whatever changed.  Promises with function calls, variable
+ * references, random selection (select_class/dist), persistence or cancel
+ * semantics are never memoized.
+ *
+ * The promiser itself is one of the recorded atoms: defining it (here or
+ * elsewhere) changes the states and forces one re-evaluation, after which
+ * the already-defined short-circuit verdict is memoized in turn.
+ */
+
+typedef struct
+{
+    StringSet *reads;      /* class atoms the promise depends on */
+    size_t num_reads;
+    unsigned char *states; /* defined-state per atom at last evaluation */
+    size_t generation;     /* eval context state generation at last eval */
+} ClassPromiseMemo;
+
+/* Promise evaluation is single-threaded in all components (cf-serverd only
+ * installs policy with no connection threads active), so no lock. */
+static Map *CLASS_PROMISE_MEMOS = NULL; /* GLOBAL_X */
+static size_t class_promise_memos_entries = 0; /* GLOBAL_X */
+
+/* One entry per distinct classes promise; flush if some pathological
+ * policy expands past this. */
+#define CLASS_PROMISE_MEMOS_MAX 16384
+
+static void ClassPromiseMemoDestroy_untyped(void *memo_)
+{
+    ClassPromiseMemo *memo = memo_;
+    if (memo != NULL)
+    {
+        StringSetDestroy(memo->reads);
+        free(memo->states);
+        free(memo);
+    }
+}
+
+static void MemoReadStates(const EvalContext *ctx, const StringSet *reads,
+                           unsigned char *states)
+{
+    size_t i = 0;
+    StringSetIterator iter = StringSetIteratorInit((StringSet *) reads);
+    const char *atom;
+    while ((atom = StringSetIteratorNext(&iter)) != NULL)
+    {
+        states[i++] = IsDefinedClass(ctx, atom) ? 1 : 0;
+    }
+}
+
+static bool CollectAtomsFromTree(const Expression *expr, StringSet *atoms)
+{
+    switch (expr->op)
+    {
+    case LOGICAL_OP_OR:
+    case LOGICAL_OP_AND:
+        return CollectAtomsFromTree(expr->val.andor.lhs, atoms) &&
+               CollectAtomsFromTree(expr->val.andor.rhs, atoms);
+
+    case LOGICAL_OP_NOT:
+        return CollectAtomsFromTree(expr->val.not.arg, atoms);
+
+    case LOGICAL_OP_EVAL:
+        /* Variable references (and concatenations around them) cannot be
+         * resolved statically */
+        if (expr->val.eval.name->op != LITERAL)
+        {
+            return false;
+        }
+        StringSetAdd(atoms, xstrdup(expr->val.eval.name->val.literal.literal));
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/**
+ * Collect the class atoms an (already expanded) class expression reads.
+ * @return false when the expression cannot be analysed statically
+ *         (variables, whitespace, parse failure); the caller then keeps
+ *         re-evaluating the promise on every pass as before.
+ */
+static bool CollectExpressionAtoms(const char *expr_str, StringSet *atoms)
+{
+    if (strchr(expr_str, '$') != NULL)
+    {
+        return false;
+    }
+
+    ParseResult res = ParseExpression(expr_str, 0, strlen(expr_str));
+    if (res.result == NULL || (size_t) res.position != strlen(expr_str))
+    {
+        FreeExpression(res.result);
+        return false;
+    }
+
+    bool ok = CollectAtomsFromTree(res.result, atoms);
+    FreeExpression(res.result);
+    return ok;
+}
+
+/* The class-defining expression attributes whose rvals are pure boolean
+ * functions of other classes (in sync with EvalClassExpression()). */
+static const char *const MEMOIZABLE_CLASS_LVALS[] =
+{
+    "expression", "not", "and", "or", "xor", NULL
+};
+
+/**
+ * Decide whether #pp is a pure function of class state, and if so collect
+ * the class atoms it reads into #atoms and write a key identifying the
+ * promise (promiser, guard and expression text - everything the atoms are
+ * derived from) to #key.
+ */
+static bool ClassPromiseDependencies(const Promise *pp, StringSet *atoms,
+                                     Writer *key)
+{
+    /* These give evaluation side effects beyond defining the promiser, or
+     * make it non-deterministic. */
+    if (PromiseGetConstraint(pp, "persistence") != NULL ||
+        PromiseGetConstraint(pp, "cancel") != NULL ||
+        PromiseGetConstraint(pp, "select_class") != NULL ||
+        PromiseGetConstraint(pp, "dist") != NULL)
+    {
+        return false;
+    }
+
+    /* Once the promiser is defined, evaluation short-circuits differently,
+     * so it is an input in its own right. */
+    StringSetAdd(atoms, xstrdup(pp->promiser));
+
+    const char *guard = (pp->classes != NULL) ? pp->classes : "any";
+    if (!StringEqual(guard, "any") && !CollectExpressionAtoms(guard, atoms))
+    {
+        return false;
+    }
+
+    WriterWriteF(key, "%s\x1f%s", pp->promiser, guard);
+
+    for (size_t i = 0; MEMOIZABLE_CLASS_LVALS[i] != NULL; i++)
+    {
+        const char *lval = MEMOIZABLE_CLASS_LVALS[i];
+        const Constraint *cp = PromiseGetConstraint(pp, lval);
+        if (cp == NULL)
+        {
+            continue;
+        }
+
+        if (cp->rval.type == RVAL_TYPE_SCALAR)
+        {
+            if (!CollectExpressionAtoms(RvalScalarValue(cp->rval), atoms))
+            {
+                return false;
+            }
+            WriterWriteF(key, "\x1f%s=%s", lval, RvalScalarValue(cp->rval));
+        }
+        else if (cp->rval.type == RVAL_TYPE_LIST)
+        {
+            for (const Rlist *rp = cp->rval.item; rp != NULL; rp = rp->next)
+            {
+                if (rp->val.type != RVAL_TYPE_SCALAR ||
+                    !CollectExpressionAtoms(RlistScalarValue(rp), atoms))
+                {
+                    return false;
+                }
+                WriterWriteF(key, "\x1f%s+=%s", lval, RlistScalarValue(rp));
+            }
+        }
+        else
+        {
+            /* A function call: not a pure function of class state */
+            return false;
+        }
+    }
+
+    return true;
+}
 
 static bool ValidClassName(const char *str)
 {
@@ -60,14 +253,89 @@ PromiseResult VerifyClassPromise(EvalContext *ctx, const Promise *pp, ARG_UNUSED
 
     Log(LOG_LEVEL_DEBUG, "Evaluating classes promise: %s", pp->promiser);
 
-    Attributes a = GetClassContextAttributes(ctx, pp);
-
     if (!StringMatchFull("[a-zA-Z0-9_]+", pp->promiser))
     {
         Log(LOG_LEVEL_VERBOSE, "Class identifier '%s' contains illegal characters - canonifying", pp->promiser);
         CanonifyNameInPlace(pp->promiser);
     }
 
+    StringSet *atoms = StringSetNew();
+    Writer *key_writer = StringWriter();
+    if (!ClassPromiseDependencies(pp, atoms, key_writer))
+    {
+        /* Not a pure function of class state: evaluate on every pass */
+        StringSetDestroy(atoms);
+        WriterClose(key_writer);
+        return VerifyClassPromiseInner(ctx, pp);
+    }
+
+    if (CLASS_PROMISE_MEMOS == NULL)
+    {
+        CLASS_PROMISE_MEMOS = MapNew(StringHash_untyped, StringEqual_untyped,
+                                     free, ClassPromiseMemoDestroy_untyped);
+    }
+
+    const char *key = StringWriterData(key_writer);
+    ClassPromiseMemo *memo = MapGet(CLASS_PROMISE_MEMOS, key);
+    if (memo != NULL)
+    {
+        bool unchanged =
+            (memo->generation == EvalContextGetStateGeneration(ctx));
+        if (!unchanged)
+        {
+            unsigned char *states = xmalloc(memo->num_reads);
+            MemoReadStates(ctx, memo->reads, states);
+            unchanged = (memcmp(states, memo->states, memo->num_reads) == 0);
+            free(states);
+        }
+        if (unchanged)
+        {
+            Log(LOG_LEVEL_DEBUG,
+                "Skipping classes promise '%s':"
+                " no class it reads changed state since last evaluation",
+                pp->promiser);
+            StringSetDestroy(atoms);
+            WriterClose(key_writer);
+            return PROMISE_RESULT_NOOP;
+        }
+    }
+
+    const PromiseResult result = VerifyClassPromiseInner(ctx, pp);
+
+    /* Failures keep being reported on every pass, as before */
+    if (result == PROMISE_RESULT_NOOP)
+    {
+        if (memo == NULL)
+        {
+            if (class_promise_memos_entries >= CLASS_PROMISE_MEMOS_MAX)
+            {
+                MapDestroy(CLASS_PROMISE_MEMOS);
+                CLASS_PROMISE_MEMOS = MapNew(StringHash_untyped,
+                                             StringEqual_untyped, free,
+                                             ClassPromiseMemoDestroy_untyped);
+                class_promise_memos_entries = 0;
+            }
+            memo = xmalloc(sizeof(ClassPromiseMemo));
+            memo->reads = atoms;
+            memo->num_reads = StringSetSize(atoms);
+            memo->states = xmalloc(memo->num_reads);
+            atoms = NULL;                           /* owned by the memo */
+            MapInsert(CLASS_PROMISE_MEMOS, xstrdup(key), memo);
+            class_promise_memos_entries++;
+        }
+        MemoReadStates(ctx, memo->reads, memo->states);
+        memo->generation = EvalContextGetStateGeneration(ctx);
+    }
+
+    StringSetDestroy(atoms);
+    WriterClose(key_writer);
+    return result;
+}
+
+static PromiseResult VerifyClassPromiseInner(EvalContext *ctx, const Promise *pp)
+{
+    Attributes a = GetClassContextAttributes(ctx, pp);
+
     if (a.context.nconstraints > 1)
     {
         cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_FAIL, pp, &a, "Irreconcilable constraints in classes for '%s'", pp->promiser);
@@ -371,7 +639,7 @@ static bool EvalClassExpression(EvalContext *ctx, Constraint *cp, const Promise
             Log(LOG_LEVEL_VERBOSE,
                 " ?> Cancelling cached persistent class %s",
                 pp->promiser);
-            EvalContextHeapPersistentRemove(pp->promiser);
+            EvalContextHeapPersistentRemove(ctx, pp->promiser);
         }
         return false;
     }
@@ -540,7 +808,7 @@ static PromiseResult VerifyClassCancel(EvalContext *ctx, const Promise *pp, Attr
 
     Log(LOG_LEVEL_VERBOSE, "C:     -  Cancelling class: %s", pp->promiser);
 
-    EvalContextHeapPersistentRemove(pp->promiser);
+    EvalContextHeapPersistentRemove(ctx, pp->promiser);
     {
         ClassRef ref = ClassRefParse(pp->promiser);
         EvalContextClassRemove(ctx, ref.ns, ref.name);
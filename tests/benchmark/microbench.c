@@ -0,0 +1,326 @@
+/*
+  Copyright 2024 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+/*
+ * Micro-benchmarks for the evaluator hot paths that dominate agent
+ * profiles: scalar expansion, class expression evaluation, promise
+ * iteration, list sorting, cached regex matching and promise
+ * dereferencing.  Run via "make bench"; not part of "make check".
+ *
+ * Each benchmark is calibrated by growing the repetition count until the
+ * run is long enough to time reliably, then reported both human-readably
+ * on stderr and as a JSON document on stdout, so results can be collected
+ * per commit and compared.
+ */
+
+#include <platform.h>
+
+#include <eval_context.h>
+#include <expand.h>
+#include <policy.h>
+#include <promises.h>
+#include <iteration.h>
+#include <rlist.h>
+#include <sort.h>
+#include <matching.h>
+#include <var_expressions.h>
+#include <string_lib.h>
+#include <json.h>
+#include <writer.h>
+#include <file_lib.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+
+#define BENCH_MIN_SECONDS 0.25
+#define BENCH_MAX_REPS (1UL << 24)
+
+static double NowSeconds(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    {
+        return ts.tv_sec + (ts.tv_nsec / 1e9);
+    }
+#endif
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (tv.tv_usec / 1e6);
+}
+
+typedef void (*BenchBody)(size_t reps, void *data);
+
+static void RunBenchmark(JsonElement *results, const char *name,
+                         BenchBody body, void *data)
+{
+    size_t reps = 1;
+    double seconds = 0.0;
+
+    /* Calibrate: grow the repetition count until the run is long enough to
+     * time reliably.  The final (longest) run is the one reported. */
+    while (true)
+    {
+        const double start = NowSeconds();
+        body(reps, data);
+        seconds = NowSeconds() - start;
+
+        if (seconds >= BENCH_MIN_SECONDS || reps >= BENCH_MAX_REPS)
+        {
+            break;
+        }
+        reps *= 4;
+    }
+
+    JsonElement *entry = JsonObjectCreate(3);
+    JsonObjectAppendInteger(entry, "iterations", reps);
+    JsonObjectAppendReal(entry, "seconds", seconds);
+    JsonObjectAppendReal(entry, "ns_per_op", (seconds * 1e9) / reps);
+    JsonObjectAppendObject(results, name, entry);
+
+    fprintf(stderr, "%-22s %12zu ops %10.3f s %14.1f ns/op\n",
+            name, reps, seconds, (seconds * 1e9) / reps);
+}
+
+/*
+ * Shared fixture: a bundle pushed on the evaluation stack, so variable
+ * lookups behave like mid-evaluation lookups in cf-agent.
+ */
+typedef struct
+{
+    EvalContext *ctx;
+    Policy *policy;
+    Bundle *bundle;
+    BundleSection *section;
+} BenchFixture;
+
+static void FixtureInit(BenchFixture *fix)
+{
+    fix->ctx = EvalContextNew();
+    fix->policy = PolicyNew();
+    fix->bundle = PolicyAppendBundle(fix->policy, "default", "bench", "agent",
+                                     NULL, NULL, EVAL_ORDER_UNDEFINED);
+    fix->section = BundleAppendSection(fix->bundle, "dummy");
+
+    EvalContextStackPushBundleFrame(fix->ctx, fix->bundle, NULL, false, NULL);
+    EvalContextStackPushBundleSectionFrame(fix->ctx, fix->section);
+}
+
+static void FixtureDestroy(BenchFixture *fix)
+{
+    EvalContextStackPopFrame(fix->ctx);
+    EvalContextStackPopFrame(fix->ctx);
+    PolicyDestroy(fix->policy);
+    EvalContextDestroy(fix->ctx);
+}
+
+static void FixturePutScalar(BenchFixture *fix, const char *lval,
+                             const char *value)
+{
+    VarRef *ref = VarRefParseFromBundle(lval, fix->bundle);
+    EvalContextVariablePut(fix->ctx, ref, value, CF_DATA_TYPE_STRING, NULL);
+    VarRefDestroy(ref);
+}
+
+static void FixturePutSlist(BenchFixture *fix, const char *lval,
+                            const char *prefix, size_t len)
+{
+    Rlist *list = NULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        char item[64];
+        xsnprintf(item, sizeof(item), "%s%03zu", prefix, i);
+        RlistAppendScalar(&list, item);
+    }
+
+    VarRef *ref = VarRefParseFromBundle(lval, fix->bundle);
+    EvalContextVariablePut(fix->ctx, ref, list, CF_DATA_TYPE_STRING_LIST,
+                           NULL);
+    VarRefDestroy(ref);
+    RlistDestroy(list);
+}
+
+/*****************************************************************************/
+
+static void BenchExpandScalar(size_t reps, void *data)
+{
+    BenchFixture *fix = data;
+    Buffer *out = BufferNew();
+
+    for (size_t i = 0; i < reps; i++)
+    {
+        BufferClear(out);
+        ExpandScalar(fix->ctx, NULL, "bench",
+                     "/srv/$(color)/$(size)/file_$(shape).dat", out);
+    }
+
+    BufferDestroy(out);
+}
+
+static void BenchIsDefinedClass(size_t reps, void *data)
+{
+    BenchFixture *fix = data;
+
+    for (size_t i = 0; i < reps; i++)
+    {
+        IsDefinedClass(fix->ctx, "(linux.debian_11)|(windows&!x86_64)");
+    }
+}
+
+/* One op is a full iteration cycle over two slists, the way ExpandPromise
+ * drives it: copy the promise, start the engine, turn the wheels to
+ * exhaustion. */
+static void BenchPromiseIterator(size_t reps, void *data)
+{
+    BenchFixture *fix = data;
+
+    Promise *promise = BundleSectionAppendPromise(
+        fix->section, "file_$(i)_$(j)",
+        (Rval) { NULL, RVAL_TYPE_NOPROMISEE }, "any", NULL);
+
+    for (size_t r = 0; r < reps; r++)
+    {
+        Promise *pcopy = DeRefCopyPromise(fix->ctx, promise);
+        EvalContextStackPushPromiseFrame(fix->ctx, pcopy);
+
+        PromiseIterator *iterctx = PromiseIteratorNew(pcopy);
+        char *promiser_copy = xstrdup(pcopy->promiser);
+        PromiseIteratorPrepare(iterctx, fix->ctx, promiser_copy);
+
+        while (PromiseIteratorNext(iterctx, fix->ctx))
+        {
+            /* turning is what we measure */
+        }
+
+        free(promiser_copy);
+        PromiseIteratorDestroy(iterctx);
+        EvalContextStackPopFrame(fix->ctx);
+        PromiseDestroy(pcopy);
+    }
+}
+
+/* Sorting is destructive, so each op copies the fixture list first; real
+ * callers (the sort() policy function) pay the same copy. */
+static void BenchRlistSort(size_t reps, void *data)
+{
+    const Rlist *master = data;
+
+    for (size_t i = 0; i < reps; i++)
+    {
+        Rlist *copy = RlistCopy(master);
+        copy = AlphaSortRListNames(copy);
+        RlistDestroy(copy);
+    }
+}
+
+static void BenchRegexCached(size_t reps, void *data)
+{
+    const char *const *patterns = data;
+
+    for (size_t i = 0; i < reps; i++)
+    {
+        Regex *rx = CompileRegexCached(patterns[i % 4]);
+        assert(rx != NULL);
+        StringMatchFullWithPrecompiledRegex(
+            rx, "/var/cfengine/state/cf_lastseen.lmdb");
+    }
+}
+
+static void BenchDeRefCopyPromise(size_t reps, void *data)
+{
+    BenchFixture *fix = data;
+
+    Promise *promise = BundleSectionAppendPromise(
+        fix->section, "/tmp/bench_$(color)",
+        (Rval) { NULL, RVAL_TYPE_NOPROMISEE }, "any", NULL);
+    PromiseAppendConstraint(promise, "create",
+                            RvalNew("true", RVAL_TYPE_SCALAR), false);
+    PromiseAppendConstraint(promise, "perms_mode",
+                            RvalNew("0600", RVAL_TYPE_SCALAR), false);
+    PromiseAppendConstraint(promise, "action_policy",
+                            RvalNew("fix", RVAL_TYPE_SCALAR), false);
+    PromiseAppendConstraint(promise, "comment",
+                            RvalNew("bench fixture promise $(size)",
+                                    RVAL_TYPE_SCALAR), false);
+
+    for (size_t i = 0; i < reps; i++)
+    {
+        Promise *pcopy = DeRefCopyPromise(fix->ctx, promise);
+        PromiseDestroy(pcopy);
+    }
+}
+
+/*****************************************************************************/
+
+int main(void)
+{
+    BenchFixture fix;
+    FixtureInit(&fix);
+
+    FixturePutScalar(&fix, "color", "blue");
+    FixturePutScalar(&fix, "size", "large");
+    FixturePutScalar(&fix, "shape", "round");
+    FixturePutSlist(&fix, "i", "alpha_", 64);
+    FixturePutSlist(&fix, "j", "beta_", 16);
+
+    EvalContextClassPutHard(fix.ctx, "linux", "source=bench");
+    EvalContextClassPutHard(fix.ctx, "debian", "source=bench");
+    EvalContextClassPutHard(fix.ctx, "debian_11", "source=bench");
+    EvalContextClassPutHard(fix.ctx, "x86_64", "source=bench");
+
+    /* Unsorted on purpose; see BenchRlistSort(). */
+    Rlist *sort_fixture = NULL;
+    for (size_t i = 0; i < 512; i++)
+    {
+        char item[64];
+        xsnprintf(item, sizeof(item), "host%03zu", (i * 211) % 512);
+        RlistAppendScalar(&sort_fixture, item);
+    }
+
+    const char *regex_fixtures[4] =
+    {
+        ".*\\.lmdb",
+        "/var/cfengine/state/.*",
+        "(cf_lastseen|cf_lock|cf_observations)\\.lmdb.*",
+        "[a-z_/]+/cf_[a-z]+\\.(lmdb|tcdb)",
+    };
+
+    JsonElement *results = JsonObjectCreate(6);
+
+    RunBenchmark(results, "ExpandScalar", BenchExpandScalar, &fix);
+    RunBenchmark(results, "IsDefinedClass", BenchIsDefinedClass, &fix);
+    RunBenchmark(results, "PromiseIterator", BenchPromiseIterator, &fix);
+    RunBenchmark(results, "RlistSort", BenchRlistSort, sort_fixture);
+    RunBenchmark(results, "CompileRegexCached", BenchRegexCached,
+                 regex_fixtures);
+    RunBenchmark(results, "DeRefCopyPromise", BenchDeRefCopyPromise, &fix);
+
+    Writer *w = FileWriter(stdout);
+    JsonWrite(w, results, 2);
+    FileWriterDetach(w);
+
+    JsonDestroy(results);
+    RlistDestroy(sort_fixture);
+    FixtureDestroy(&fix);
+
+    return EXIT_SUCCESS;
+}
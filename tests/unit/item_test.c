@@ -25,6 +25,28 @@ static void test_list_len(void)
     DeleteItemList(list);
 }
 
+static void test_item_index(void)
+{
+    Item *list = NULL;
+
+    PrependItem(&list, "one", NULL);
+    PrependItem(&list, "two", NULL);
+
+    ItemIndex *index = ItemIndexNew(list);
+    assert_true(ItemIndexContains(index, "one"));
+    assert_true(ItemIndexContains(index, "two"));
+    assert_false(ItemIndexContains(index, "three"));
+
+    assert_int_not_equal(ItemIndexPrependUnique(index, &list, "three", NULL), NULL);
+    assert_int_equal(ItemIndexPrependUnique(index, &list, "three", NULL), NULL);
+    assert_true(ItemIndexContains(index, "three"));
+    assert_true(IsItemIn(list, "three"));
+    assert_int_equal(ListLen(list), 3);
+
+    ItemIndexDestroy(index);
+    DeleteItemList(list);
+}
+
 /* FIXME: those functions are now internal to cf-agent */
 #if 0
 static void test_list_select_last_matching_finds_first(void)
@@ -381,6 +403,7 @@ int main()
     {
         unit_test(test_prepend_item),
         unit_test(test_list_len),
+        unit_test(test_item_index),
         unit_test(test_list_compare),
         unit_test(test_split_string)
     };
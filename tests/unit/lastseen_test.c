@@ -56,6 +56,9 @@ static void setup(void)
     char cmd[CF_BUFSIZE];
     xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'/*", GetStateDir());
     system(cmd);
+
+    /* The database is re-created behind the back of LastSaw(). */
+    FlushLastSawCache();
 }
 
 static void test_newentry(void)
@@ -113,6 +116,39 @@ static void test_update(void)
     CloseDB(db);
 }
 
+static void test_coalesce(void)
+{
+    setup();
+
+    /* The second update repeats the first within the coalescing window and
+     * must be dropped. */
+    UpdateLastSawHost("SHA-12345", "127.0.0.64", true, 555);
+    UpdateLastSawHost("SHA-12345", "127.0.0.64", true, 556);
+
+    DBHandle *db;
+    OpenDB(&db, dbid_lastseen);
+
+    KeyHostSeen q;
+    assert_int_equal(ReadDB(db, "qiSHA-12345", &q, sizeof(q)), true);
+    assert_int_equal(q.lastseen, 555);
+
+    /* A different direction is not coalesced. */
+    UpdateLastSawHost("SHA-12345", "127.0.0.64", false, 557);
+    assert_int_equal(ReadDB(db, "qoSHA-12345", &q, sizeof(q)), true);
+    assert_int_equal(q.lastseen, 557);
+
+    /* Neither is an update for an address whose key just changed; the
+     * mapping must be rewritten right away. */
+    UpdateLastSawHost("SHA-98765", "127.0.0.64", true, 558);
+    UpdateLastSawHost("SHA-12345", "127.0.0.64", true, 559);
+
+    char hostkey[CF_BUFSIZE];
+    assert_int_equal(ReadDB(db, "a127.0.0.64", hostkey, sizeof(hostkey)), true);
+    assert_string_equal(hostkey, "SHA-12345");
+
+    CloseDB(db);
+}
+
 static void test_HostkeyToAddress(void)
 {
     setup();
@@ -265,6 +301,9 @@ static void end()
     char cmd[CF_BUFSIZE];
     xsnprintf(cmd, sizeof(cmd), "rm -rf '%s'/*", GetStateDir());
     system(cmd);
+
+    /* The database is re-created behind the back of LastSaw(). */
+    FlushLastSawCache();
 }
 
 
@@ -618,6 +657,7 @@ int main()
         {
             unit_test(test_newentry),
             unit_test(test_update),
+            unit_test(test_coalesce),
             unit_test(test_HostkeyToAddress),
             unit_test(test_reverse_missing),
             unit_test(test_reverse_conflict),
@@ -70,6 +70,29 @@ static void test_set_host(void)
     got_address = NULL; // Safe to free(NULL) in another test
 }
 
+static void test_async_queue(void)
+{
+    SetSyslogPort(9999);
+
+    RemoteSysLogAsyncEnable(true);
+    RemoteSysLog(LOG_EMERG, "Queued test string");
+    /* Disabling flushes the queue and joins the drain thread. */
+    RemoteSysLogAsyncEnable(false);
+
+    assert_true(got_address != NULL);
+    if (got_address->sa_family == AF_INET)
+    {
+        assert_int_equal(ntohs(((struct sockaddr_in *) got_address)->sin_port), 9999);
+    }
+    else if (got_address->sa_family == AF_INET6)
+    {
+        assert_int_equal(ntohs(((struct sockaddr_in6 *) got_address)->sin6_port), 9999);
+    }
+
+    free(got_address);
+    got_address = NULL; // Safe to free(NULL) in another test
+}
+
 #define check_level(str, lvl) \
 {\
     assert_int_equal(LogLevelFromString(str), lvl);\
@@ -108,6 +131,7 @@ int main()
     {
         unit_test(test_set_port),
         unit_test(test_set_host),
+        unit_test(test_async_queue),
         unit_test(test_log_level),
     };
 
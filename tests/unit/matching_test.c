@@ -34,11 +34,42 @@ void test_has_regex_meta_chars(void)
     assert_true(HasRegexMetaChars("\\d"));
 }
 
+void test_string_match_full_literal_prefilter(void)
+{
+    /* The literal prefix of an anchored pattern must match. */
+    assert_true(StringMatchFullLiteralPrefilter("^/var/log/.*", "/var/log/syslog"));
+    assert_false(StringMatchFullLiteralPrefilter("^/var/log/.*", "/etc/passwd"));
+
+    /* Full matches are anchored even without '^'. */
+    assert_false(StringMatchFullLiteralPrefilter("/var/log/.*", "/etc/passwd"));
+
+    /* The literal run after the last metacharacter must be a suffix. */
+    assert_true(StringMatchFullLiteralPrefilter(".*\\.log", "messages.log"));
+    assert_false(StringMatchFullLiteralPrefilter(".*\\.log", "messages.txt"));
+
+    /* Pure literal patterns require equality. */
+    assert_true(StringMatchFullLiteralPrefilter("exact", "exact"));
+    assert_false(StringMatchFullLiteralPrefilter("exact", "exactly"));
+
+    /* A quantifier makes the last prefix character optional. */
+    assert_true(StringMatchFullLiteralPrefilter("abc*", "ab"));
+    assert_false(StringMatchFullLiteralPrefilter("abc*", "xb"));
+
+    /* Alternation and inline option groups disable the analysis. */
+    assert_true(StringMatchFullLiteralPrefilter("foo|bar", "bar"));
+    assert_true(StringMatchFullLiteralPrefilter("(?i)FOO.*", "foobar"));
+
+    /* The trailing anchor is stripped like the leading one. */
+    assert_true(StringMatchFullLiteralPrefilter("^a.*z$", "abcz"));
+    assert_false(StringMatchFullLiteralPrefilter("^a.*z$", "abcy"));
+}
+
 int main()
 {
     const UnitTest tests[] =
     {
         unit_test(test_has_regex_meta_chars),
+        unit_test(test_string_match_full_literal_prefilter),
     };
 
     PRINT_TEST_BANNER();
@@ -0,0 +1,130 @@
+#include <test.h>
+
+#include <rval_flat.h>
+#include <rlist.h>
+
+static void test_scalar_roundtrip(void)
+{
+    Rval rval = { "hello world", RVAL_TYPE_SCALAR };
+    Buffer *image = RvalFlatEncode(rval);
+    assert_true(image != NULL);
+
+    Rval decoded;
+    assert_true(RvalFlatDecode(BufferData(image), BufferSize(image),
+                               &decoded));
+    assert_int_equal(decoded.type, RVAL_TYPE_SCALAR);
+    assert_string_equal(RvalScalarValue(decoded), "hello world");
+
+    RvalDestroy(decoded);
+    BufferDestroy(image);
+}
+
+static void test_list_roundtrip(void)
+{
+    Rlist *list = NULL;
+    RlistAppendScalar(&list, "alpha");
+    RlistAppendScalar(&list, "beta");
+    RlistAppendScalar(&list, "gamma");
+
+    Rval rval = { list, RVAL_TYPE_LIST };
+    Buffer *image = RvalFlatEncode(rval);
+    assert_true(image != NULL);
+
+    Rval decoded;
+    assert_true(RvalFlatDecode(BufferData(image), BufferSize(image),
+                               &decoded));
+    assert_int_equal(decoded.type, RVAL_TYPE_LIST);
+    assert_int_equal(RlistLen(RvalRlistValue(decoded)), 3);
+    assert_string_equal(RlistScalarValue(RvalRlistValue(decoded)), "alpha");
+
+    RvalDestroy(decoded);
+    RvalDestroy(rval);
+    BufferDestroy(image);
+}
+
+static void test_decode_truncated(void)
+{
+    Rlist *list = NULL;
+    RlistAppendScalar(&list, "alpha");
+    RlistAppendScalar(&list, "beta");
+
+    Rval rval = { list, RVAL_TYPE_LIST };
+    Buffer *image = RvalFlatEncode(rval);
+    assert_true(image != NULL);
+
+    /* Every proper prefix of a valid image must be rejected */
+    Rval decoded;
+    for (size_t size = 0; size < BufferSize(image); size++)
+    {
+        assert_false(RvalFlatDecode(BufferData(image), size, &decoded));
+    }
+
+    RvalDestroy(rval);
+    BufferDestroy(image);
+}
+
+static void test_decode_oversized_length(void)
+{
+    unsigned char image[] =
+    {
+        'C', 'F', 'R', 'V', 1, 0, 0, 0,               /* header */
+        'S',                                          /* scalar tag */
+        0xff, 0xff, 0xff, 0xff,                       /* length UINT32_MAX */
+        'h', 'i', '\0',
+    };
+
+    /* UINT32_MAX: the +1 for the terminator wraps to 0 on 32-bit, so the
+     * length must be rejected before any read is attempted */
+    Rval decoded;
+    assert_false(RvalFlatDecode(image, sizeof(image), &decoded));
+
+    /* A large length that merely overruns the image must also fail */
+    image[9] = 0x00;
+    image[10] = 0x10;                                 /* length 4096 */
+    image[11] = 0x00;
+    image[12] = 0x00;
+    assert_false(RvalFlatDecode(image, sizeof(image), &decoded));
+}
+
+static void test_decode_bad_terminator(void)
+{
+    unsigned char image[] =
+    {
+        'C', 'F', 'R', 'V', 1, 0, 0, 0,
+        'S',
+        2, 0, 0, 0,                                   /* length 2 */
+        'h', 'i', 'x',                     /* 'x' where the NUL belongs */
+    };
+
+    Rval decoded;
+    assert_false(RvalFlatDecode(image, sizeof(image), &decoded));
+}
+
+static void test_decode_trailing_junk(void)
+{
+    Rval rval = { "hello", RVAL_TYPE_SCALAR };
+    Buffer *image = RvalFlatEncode(rval);
+    assert_true(image != NULL);
+    BufferAppendChar(image, 'X');
+
+    Rval decoded;
+    assert_false(RvalFlatDecode(BufferData(image), BufferSize(image),
+                                &decoded));
+    BufferDestroy(image);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_scalar_roundtrip),
+        unit_test(test_list_roundtrip),
+        unit_test(test_decode_truncated),
+        unit_test(test_decode_oversized_length),
+        unit_test(test_decode_bad_terminator),
+        unit_test(test_decode_trailing_junk),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,112 @@
+#include <test.h>
+
+#include <set_sync.h>
+#include <item_lib.h>
+
+static void test_sketch_membership(void)
+{
+    SetSyncSketch *sketch = SetSyncSketchNew(3);
+    assert_true(sketch != NULL);
+
+    /* No entries added: every probe must miss */
+    assert_false(SetSyncSketchContains(sketch, "anything"));
+
+    SetSyncSketchAdd(sketch, "cfengine_3");
+    SetSyncSketchAdd(sketch, "linux");
+    SetSyncSketchAdd(sketch, "policy_server");
+
+    assert_true(SetSyncSketchContains(sketch, "cfengine_3"));
+    assert_true(SetSyncSketchContains(sketch, "linux"));
+    assert_true(SetSyncSketchContains(sketch, "policy_server"));
+
+    SetSyncSketchDestroy(sketch);
+}
+
+static void test_serialize_roundtrip(void)
+{
+    SetSyncSketch *sketch = SetSyncSketchNew(2);
+    SetSyncSketchAdd(sketch, "alpha");
+    SetSyncSketchAdd(sketch, "beta");
+
+    char *serialized = SetSyncSketchSerialize(sketch);
+    assert_true(serialized != NULL);
+
+    SetSyncSketch *copy = SetSyncSketchDeserialize(serialized);
+    assert_true(copy != NULL);
+
+    assert_true(SetSyncSketchContains(copy, "alpha"));
+    assert_true(SetSyncSketchContains(copy, "beta"));
+
+    free(serialized);
+    SetSyncSketchDestroy(sketch);
+    SetSyncSketchDestroy(copy);
+}
+
+static void test_deserialize_malformed(void)
+{
+    /* sscanf() counts conversions, so the missing second colon in "8:3"
+     * does not lower its return value; the parser must still reject it */
+    assert_true(SetSyncSketchDeserialize("8:3") == NULL);
+    assert_true(SetSyncSketchDeserialize("64:7") == NULL);
+
+    assert_true(SetSyncSketchDeserialize("") == NULL);
+    assert_true(SetSyncSketchDeserialize("garbage") == NULL);
+
+    /* Zero or out-of-range dimensions */
+    assert_true(SetSyncSketchDeserialize("0:7:") == NULL);
+    assert_true(SetSyncSketchDeserialize("64:0:") == NULL);
+    assert_true(SetSyncSketchDeserialize("64:17:") == NULL);
+    assert_true(SetSyncSketchDeserialize("65:7:") == NULL);   /* not %8 */
+    assert_true(SetSyncSketchDeserialize("1048576:7:") == NULL);
+
+    /* Hex payload shorter / longer than the declared bit count */
+    assert_true(SetSyncSketchDeserialize("64:7:") == NULL);
+    assert_true(SetSyncSketchDeserialize("64:7:00") == NULL);
+    assert_true(
+        SetSyncSketchDeserialize("64:7:000000000000000000") == NULL);
+
+    /* Right length, but not hex */
+    assert_true(
+        SetSyncSketchDeserialize("64:7:zzzzzzzzzzzzzzzz") == NULL);
+}
+
+static void test_digest_order_independent(void)
+{
+    Item *forwards = NULL;
+    AppendItem(&forwards, "alpha", NULL);
+    AppendItem(&forwards, "beta", NULL);
+    AppendItem(&forwards, "gamma", NULL);
+
+    Item *backwards = NULL;
+    AppendItem(&backwards, "gamma", NULL);
+    AppendItem(&backwards, "beta", NULL);
+    AppendItem(&backwards, "alpha", NULL);
+
+    char digest_a[SET_SYNC_DIGEST_LEN + 1];
+    char digest_b[SET_SYNC_DIGEST_LEN + 1];
+    SetSyncDigest(forwards, digest_a);
+    SetSyncDigest(backwards, digest_b);
+    assert_string_equal(digest_a, digest_b);
+
+    /* Adding an entry must change the digest */
+    AppendItem(&forwards, "delta", NULL);
+    SetSyncDigest(forwards, digest_a);
+    assert_true(strcmp(digest_a, digest_b) != 0);
+
+    DeleteItemList(forwards);
+    DeleteItemList(backwards);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_sketch_membership),
+        unit_test(test_serialize_roundtrip),
+        unit_test(test_deserialize_malformed),
+        unit_test(test_digest_order_independent),
+    };
+
+    return run_tests(tests);
+}